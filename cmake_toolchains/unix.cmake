@@ -5,6 +5,11 @@ set(PLATFORM_SHIM_PATH "${CMAKE_CURRENT_LIST_DIR}/../src/platform/posix" )
 
 set (EXTRA_LINKER_LIBS "${EXTRA_LINKER_LIBS}" pthread)
 
+# shm_open() is in librt on older glibc.
+if(CMAKE_SYSTEM_NAME STREQUAL "Linux")
+    set (EXTRA_LINKER_LIBS "${EXTRA_LINKER_LIBS}" rt)
+endif()
+
 message("EXTRA_LINKER_LIBS = ${EXTRA_LINKER_LIBS}")
 
 set(POSIX True)
@@ -0,0 +1,310 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Check the Modbus request batching against modbus_server.  The server counts
+ * the requests it sees per function code and prints the counts when it is
+ * stopped, so run_simulator_tests.sh can tell whether requests were merged.
+ *
+ *   coalesce  - queued writes to adjacent registers go out as fewer Write
+ *               Multiple Registers (0x10) requests.  Reads of the same
+ *               registers over a connection with several requests in flight
+ *               check the data.
+ *   fuse      - a queued register write rides along with a read in a
+ *               Read/Write Multiple Registers (0x17) request.
+ *   reconnect - tags with automatic reads keep reading after the server is
+ *               restarted.  The script restarts it a few times while this
+ *               runs, without a pause so that the library connects again at
+ *               once.
+ *
+ * Run against: modbus_server
+ */
+
+#include "compat_utils.h"
+#include <inttypes.h>
+#include <libplctag/lib/libplctag.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define REQUIRED_VERSION 2, 4, 7
+
+#define PLC_ATTRIBS "protocol=modbus-tcp&gateway=127.0.0.1:5020&path=0"
+
+/* one request in flight so that writes queue up behind each other. */
+#define WRITE_TAG_ATTRIBS PLC_ATTRIBS "&connection_group_id=1&max_requests_in_flight=1&coalesce_writes=1&elem_count=1&name=hr%d"
+#define READ_TAG_ATTRIBS PLC_ATTRIBS "&connection_group_id=2&max_requests_in_flight=8&batch_requests=1&elem_count=1&name=hr%d"
+#define FUSE_ATTRIBS PLC_ATTRIBS "&connection_group_id=3&max_requests_in_flight=1&fuse_read_write=1"
+#define AUTO_READ_ATTRIBS \
+    PLC_ATTRIBS "&connection_group_id=4&max_requests_in_flight=4&batch_requests=1&auto_sync_read_ms=20&elem_count=1&name=hr%d"
+
+#define DATA_TIMEOUT (5000)
+#define NUM_TAGS (10)
+#define NUM_ROUNDS (20)
+#define COALESCE_BASE (100)
+#define RECONNECT_BASE (900)
+
+/* the script restarts the server in the first few seconds. */
+#define RECONNECT_RUN_MS (8000)
+#define RECONNECT_FRESH_MS (3000)
+
+
+static int create_tags(int32_t *tags, int num_tags, const char *attrib_format, int base) {
+    char attribs[256];
+
+    for(int i = 0; i < num_tags; i++) {
+        // NOLINTNEXTLINE
+        snprintf(attribs, sizeof(attribs), attrib_format, base + i);
+
+        tags[i] = plc_tag_create(attribs, DATA_TIMEOUT);
+        if(tags[i] < 0) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Error %s creating tag %s!\n", plc_tag_decode_error(tags[i]), attribs);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static void destroy_tags(int32_t *tags, int num_tags) {
+    for(int i = 0; i < num_tags; i++) {
+        if(tags[i] > 0) { plc_tag_destroy(tags[i]); }
+    }
+}
+
+
+/* wait for operations started with a zero timeout. */
+static int wait_for_tags(int32_t *tags, int num_tags) {
+    int64_t end_time = compat_time_ms() + DATA_TIMEOUT;
+
+    for(int i = 0; i < num_tags; i++) {
+        int rc = plc_tag_status(tags[i]);
+
+        while(rc == PLCTAG_STATUS_PENDING && compat_time_ms() < end_time) {
+            compat_sleep_ms(1, NULL);
+            rc = plc_tag_status(tags[i]);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Tag %d finished with status %s!\n", i, plc_tag_decode_error(rc));
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int test_coalesce(void) {
+    int32_t write_tags[NUM_TAGS] = {0};
+    int32_t read_tags[NUM_TAGS] = {0};
+    int failures = 0;
+
+    if(create_tags(write_tags, NUM_TAGS, WRITE_TAG_ATTRIBS, COALESCE_BASE)
+       || create_tags(read_tags, NUM_TAGS, READ_TAG_ATTRIBS, COALESCE_BASE)) {
+        failures++;
+    }
+
+    for(int round = 1; round <= NUM_ROUNDS && !failures; round++) {
+        for(int i = 0; i < NUM_TAGS; i++) {
+            plc_tag_set_int16(write_tags[i], 0, (int16_t)((round * 100) + i));
+            plc_tag_write(write_tags[i], 0);
+        }
+
+        if(wait_for_tags(write_tags, NUM_TAGS)) {
+            failures++;
+            break;
+        }
+
+        /* all the reads are queued at once so that they go out in one batch. */
+        for(int i = 0; i < NUM_TAGS; i++) {
+            plc_tag_set_int16(read_tags[i], 0, 0);
+            plc_tag_read(read_tags[i], 0);
+        }
+
+        if(wait_for_tags(read_tags, NUM_TAGS)) {
+            failures++;
+            break;
+        }
+
+        for(int i = 0; i < NUM_TAGS; i++) {
+            if(plc_tag_get_int16(read_tags[i], 0) != (int16_t)((round * 100) + i)) {
+                // NOLINTNEXTLINE
+                fprintf(stderr, "Round %d: register %d is %d, expected %d!\n", round, COALESCE_BASE + i,
+                        plc_tag_get_int16(read_tags[i], 0), (round * 100) + i);
+                failures++;
+            }
+        }
+    }
+
+    destroy_tags(write_tags, NUM_TAGS);
+    destroy_tags(read_tags, NUM_TAGS);
+
+    return failures;
+}
+
+
+static int test_fuse(void) {
+    /* a long read keeps the only request slot busy while the others queue up. */
+    int32_t tags[3] = {0};
+    int failures = 0;
+
+    tags[0] = plc_tag_create(FUSE_ATTRIBS "&elem_count=100&name=hr600", DATA_TIMEOUT);
+    tags[1] = plc_tag_create(FUSE_ATTRIBS "&elem_count=4&name=hr700", DATA_TIMEOUT);
+    tags[2] = plc_tag_create(FUSE_ATTRIBS "&elem_count=1&name=hr800", DATA_TIMEOUT);
+
+    for(int i = 0; i < 3; i++) {
+        if(tags[i] < 0) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Error %s creating tag %d!\n", plc_tag_decode_error(tags[i]), i);
+            failures++;
+        }
+    }
+
+    for(int round = 1; round <= NUM_ROUNDS && !failures; round++) {
+        int rc = PLCTAG_STATUS_OK;
+
+        plc_tag_set_int16(tags[2], 0, (int16_t)round);
+
+        /* the write waits behind the read that it can join. */
+        plc_tag_read(tags[0], 0);
+        plc_tag_read(tags[1], 0);
+        plc_tag_write(tags[2], 0);
+
+        if(wait_for_tags(tags, 3)) {
+            failures++;
+            break;
+        }
+
+        plc_tag_set_int16(tags[2], 0, 0);
+
+        rc = plc_tag_read(tags[2], DATA_TIMEOUT);
+        if(rc != PLCTAG_STATUS_OK) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Round %d: error %s reading the written register!\n", round, plc_tag_decode_error(rc));
+            failures++;
+        } else if(plc_tag_get_int16(tags[2], 0) != (int16_t)round) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Round %d: read back %d but wrote %d!\n", round, plc_tag_get_int16(tags[2], 0), round);
+            failures++;
+        }
+    }
+
+    destroy_tags(tags, 3);
+
+    return failures;
+}
+
+
+static volatile int64_t last_read_ms[NUM_TAGS] = {0};
+
+static void read_callback(int32_t tag_id, int event, int status, void *userdata) {
+    (void)tag_id;
+
+    if(event == PLCTAG_EVENT_READ_COMPLETED && status == PLCTAG_STATUS_OK) {
+        last_read_ms[(int)(intptr_t)userdata] = compat_time_ms();
+    }
+}
+
+
+static int test_reconnect(void) {
+    int32_t tags[NUM_TAGS] = {0};
+    int64_t start_time = compat_time_ms();
+    int failures = 0;
+
+    if(create_tags(tags, NUM_TAGS, AUTO_READ_ATTRIBS, RECONNECT_BASE)) { failures++; }
+
+    for(int i = 0; i < NUM_TAGS && !failures; i++) {
+        plc_tag_register_callback_ex(tags[i], read_callback, (void *)(intptr_t)i);
+    }
+
+    if(!failures) { compat_sleep_ms(RECONNECT_RUN_MS, NULL); }
+
+    /* every tag must have been read again since the server came back. */
+    for(int i = 0; i < NUM_TAGS && !failures; i++) {
+        int64_t age = compat_time_ms() - last_read_ms[i];
+
+        if(age > RECONNECT_FRESH_MS) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Tag %d was last read %" PRId64 "ms into the test!\n", i,
+                    last_read_ms[i] ? last_read_ms[i] - start_time : (int64_t)0);
+            failures++;
+        }
+    }
+
+    destroy_tags(tags, NUM_TAGS);
+
+    return failures;
+}
+
+
+int main(int argc, char **argv) {
+    int failures = 0;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    if(argc != 2) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Usage: test_modbus_batching <coalesce|fuse|reconnect>\n");
+        return 1;
+    }
+
+    plc_tag_set_debug_level(PLCTAG_DEBUG_WARN);
+
+    if(strcmp(argv[1], "coalesce") == 0) {
+        failures = test_coalesce();
+    } else if(strcmp(argv[1], "fuse") == 0) {
+        failures = test_fuse();
+    } else if(strcmp(argv[1], "reconnect") == 0) {
+        failures = test_reconnect();
+    } else {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Unknown test %s!\n", argv[1]);
+        return 1;
+    }
+
+    // NOLINTNEXTLINE
+    fprintf(stderr, "Test %s done with %d failures.\n", argv[1], failures);
+
+    return failures ? 1 : 0;
+}
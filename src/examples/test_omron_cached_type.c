@@ -0,0 +1,156 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Check the Omron connection's tag type cache against a PLC whose tag is not the
+ * type the program claims.  The first tag is created without an initial read and
+ * with the wrong element type, so its first read must notice the type in the reply,
+ * learn the real one and put that in the cache.  A second tag of the same name,
+ * also without an initial read and without a type, must then start with the real
+ * type and size, and a write through it must read back through the first tag.
+ *
+ * Run against: ab_server --plc=Omron --tag=TestDINTArray:DINT[10]
+ */
+
+#include "compat_utils.h"
+#include <inttypes.h>
+#include <libplctag/lib/libplctag.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define REQUIRED_VERSION 2, 4, 7
+#define TAG_BASE "protocol=ab-eip&gateway=127.0.0.1&path=18,127.0.0.1&plc=omron-njnx&elem_count=10&name=TestDINTArray"
+#define WRONG_TYPE_ATTRIBS TAG_BASE "&initial_read=0&elem_type=INT"
+#define CACHED_TYPE_ATTRIBS TAG_BASE "&initial_read=0"
+#define DATA_TIMEOUT (5000)
+
+#define ELEM_COUNT (10)
+#define DINT_SIZE (4)
+
+
+static int check_size(int32_t tag, const char *which) {
+    int size = plc_tag_get_size(tag);
+    int elem_size = plc_tag_get_int_attribute(tag, "elem_size", -1);
+
+    if(size != ELEM_COUNT * DINT_SIZE || elem_size != DINT_SIZE) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "The %s tag is %d bytes with %d byte elements, expected %d and %d!\n", which, size, elem_size,
+                ELEM_COUNT * DINT_SIZE, DINT_SIZE);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+int main(void) {
+    int32_t wrong_tag = 0;
+    int32_t cached_tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        return 1;
+    }
+
+    plc_tag_set_debug_level(PLCTAG_DEBUG_WARN);
+
+    wrong_tag = plc_tag_create(WRONG_TYPE_ATTRIBS, DATA_TIMEOUT);
+    if(wrong_tag < 0) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Error %s creating the tag with the wrong type!\n", plc_tag_decode_error(wrong_tag));
+        return 1;
+    }
+
+    /* the tag believes the element type it was given until it reads. */
+    if(plc_tag_get_int_attribute(wrong_tag, "elem_size", -1) != 2) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "The tag with the wrong type did not skip its initial read!\n");
+        return 1;
+    }
+
+    rc = plc_tag_read(wrong_tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Error %s reading the tag with the wrong type!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    if(check_size(wrong_tag, "first")) { return 1; }
+
+    cached_tag = plc_tag_create(CACHED_TYPE_ATTRIBS, DATA_TIMEOUT);
+    if(cached_tag < 0) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Error %s creating the tag from the cached type!\n", plc_tag_decode_error(cached_tag));
+        return 1;
+    }
+
+    if(check_size(cached_tag, "second")) { return 1; }
+
+    for(int i = 0; i < ELEM_COUNT; i++) { plc_tag_set_int32(cached_tag, i * DINT_SIZE, (int32_t)(i * 7 + 3)); }
+
+    rc = plc_tag_write(cached_tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Error %s writing the tag created from the cached type!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    rc = plc_tag_read(wrong_tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Error %s reading back!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    for(int i = 0; i < ELEM_COUNT; i++) {
+        int32_t val = plc_tag_get_int32(wrong_tag, i * DINT_SIZE);
+
+        if(val != (int32_t)(i * 7 + 3)) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Element %d is %" PRId32 ", expected %d!\n", i, val, i * 7 + 3);
+            return 1;
+        }
+    }
+
+    plc_tag_destroy(cached_tag);
+    plc_tag_destroy(wrong_tag);
+
+    // NOLINTNEXTLINE
+    printf("The type cache learned the real type from a read.\n");
+
+    return 0;
+}
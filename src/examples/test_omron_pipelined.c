@@ -0,0 +1,142 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Check max_requests_in_flight=4 on an Omron connection.  One tag per element of
+ * the array, without packing, so every request is its own packet and several go
+ * out before the first reply comes back.  Every reply has to find its own
+ * request, so any mix-up shows up as the wrong value in one of the tags.
+ *
+ * Run against: ab_server --plc=Omron --tag=TestDINTArray:DINT[10]
+ */
+
+#include "compat_utils.h"
+#include <inttypes.h>
+#include <libplctag/lib/libplctag.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define REQUIRED_VERSION 2, 4, 7
+#define ELEM_TAG_ATTRIBS \
+    "protocol=ab-eip&gateway=127.0.0.1&path=18,127.0.0.1&plc=omron-njnx&elem_count=1&allow_packing=0&max_requests_in_flight=4&name=TestDINTArray[%d]"
+#define DATA_TIMEOUT (5000)
+
+#define NUM_TAGS (10)
+#define NUM_ROUNDS (20)
+
+
+/* start the operation on every tag, then wait for all of them. */
+static int run_all(int32_t *tags, int is_write) {
+    int64_t timeout_time = compat_time_ms() + DATA_TIMEOUT;
+
+    for(int i = 0; i < NUM_TAGS; i++) {
+        int rc = (is_write ? plc_tag_write(tags[i], 0) : plc_tag_read(tags[i], 0));
+
+        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Error %s starting the %s of tag %d!\n", plc_tag_decode_error(rc), (is_write ? "write" : "read"), i);
+            return 1;
+        }
+    }
+
+    for(int i = 0; i < NUM_TAGS; i++) {
+        int rc = PLCTAG_STATUS_PENDING;
+
+        while((rc = plc_tag_status(tags[i])) == PLCTAG_STATUS_PENDING && compat_time_ms() < timeout_time) {
+            compat_sleep_ms(1, NULL);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Error %s from the %s of tag %d!\n", plc_tag_decode_error(rc), (is_write ? "write" : "read"), i);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+int main(void) {
+    int32_t tags[NUM_TAGS] = {0};
+    char attribs[256] = {0};
+
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        return 1;
+    }
+
+    plc_tag_set_debug_level(PLCTAG_DEBUG_WARN);
+
+    for(int i = 0; i < NUM_TAGS; i++) {
+        compat_snprintf(attribs, sizeof(attribs), ELEM_TAG_ATTRIBS, i);
+
+        tags[i] = plc_tag_create(attribs, DATA_TIMEOUT);
+        if(tags[i] < 0) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Error %s creating tag %d!\n", plc_tag_decode_error(tags[i]), i);
+            return 1;
+        }
+    }
+
+    for(int round = 0; round < NUM_ROUNDS; round++) {
+        for(int i = 0; i < NUM_TAGS; i++) { plc_tag_set_int32(tags[i], 0, (int32_t)(round * 100 + i)); }
+
+        if(run_all(tags, 1)) { return 1; }
+
+        /* clear the local copies so that the read has to fill them in. */
+        for(int i = 0; i < NUM_TAGS; i++) { plc_tag_set_int32(tags[i], 0, -1); }
+
+        if(run_all(tags, 0)) { return 1; }
+
+        for(int i = 0; i < NUM_TAGS; i++) {
+            int32_t val = plc_tag_get_int32(tags[i], 0);
+
+            if(val != (int32_t)(round * 100 + i)) {
+                // NOLINTNEXTLINE
+                fprintf(stderr, "Round %d: tag %d is %" PRId32 ", expected %d!\n", round, i, val, round * 100 + i);
+                return 1;
+            }
+        }
+    }
+
+    for(int i = 0; i < NUM_TAGS; i++) { plc_tag_destroy(tags[i]); }
+
+    // NOLINTNEXTLINE
+    printf("Every pipelined reply found its own request.\n");
+
+    return 0;
+}
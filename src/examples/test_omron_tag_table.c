@@ -0,0 +1,163 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Check that tags created with fetch_tag_table=1 get their types from the
+ * Omron variable table instead of reading.  Values are first written through
+ * a tag with an explicit type, which does not put anything in the type cache.
+ * Then tags without a type are created without an initial read.  They must
+ * have the right sizes right away and still hold zeros, which shows they did
+ * not read.  A read must then give back the written values.
+ *
+ * Run against: ab_server --plc=Omron --tag=TestDINTArray:DINT[10] --tag=TestINTArray:INT[5]
+ */
+
+#include "compat_utils.h"
+#include <inttypes.h>
+#include <libplctag/lib/libplctag.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define REQUIRED_VERSION 2, 4, 7
+#define TAG_BASE "protocol=ab-eip&gateway=127.0.0.1&path=18,127.0.0.1&plc=omron-njnx&initial_read=0"
+#define WRITER_ATTRIBS TAG_BASE "&elem_type=DINT&elem_count=10&name=TestDINTArray"
+#define DINT_TABLE_ATTRIBS TAG_BASE "&fetch_tag_table=1&elem_count=10&name=TestDINTArray"
+#define INT_TABLE_ATTRIBS TAG_BASE "&fetch_tag_table=1&elem_count=5&name=TestINTArray"
+#define DATA_TIMEOUT (5000)
+
+#define DINT_COUNT (10)
+#define DINT_SIZE (4)
+#define INT_COUNT (5)
+#define INT_SIZE (2)
+
+
+static int32_t create_tag(const char *attribs, const char *which) {
+    int32_t tag = plc_tag_create(attribs, DATA_TIMEOUT);
+
+    if(tag < 0) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Error %s creating the %s tag!\n", plc_tag_decode_error(tag), which);
+    }
+
+    return tag;
+}
+
+
+static int check_size(int32_t tag, const char *which, int elem_count, int elem_size) {
+    int size = plc_tag_get_size(tag);
+    int tag_elem_size = plc_tag_get_int_attribute(tag, "elem_size", -1);
+
+    if(size != elem_count * elem_size || tag_elem_size != elem_size) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "The %s tag is %d bytes with %d byte elements, expected %d and %d!\n", which, size, tag_elem_size,
+                elem_count * elem_size, elem_size);
+        return 1;
+    }
+
+    /* the data is only filled in by a read. */
+    for(int i = 0; i < size; i++) {
+        if(plc_tag_get_uint8(tag, i) != 0) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "The %s tag was read to get its type!\n", which);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+int main(void) {
+    int32_t writer_tag = 0;
+    int32_t dint_tag = 0;
+    int32_t int_tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        return 1;
+    }
+
+    plc_tag_set_debug_level(PLCTAG_DEBUG_WARN);
+
+    writer_tag = create_tag(WRITER_ATTRIBS, "writer");
+    if(writer_tag < 0) { return 1; }
+
+    for(int i = 0; i < DINT_COUNT; i++) { plc_tag_set_int32(writer_tag, i * DINT_SIZE, (int32_t)(i * 11 + 5)); }
+
+    rc = plc_tag_write(writer_tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Error %s writing the test values!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    dint_tag = create_tag(DINT_TABLE_ATTRIBS, "DINT");
+    if(dint_tag < 0) { return 1; }
+
+    if(check_size(dint_tag, "DINT", DINT_COUNT, DINT_SIZE)) { return 1; }
+
+    int_tag = create_tag(INT_TABLE_ATTRIBS, "INT");
+    if(int_tag < 0) { return 1; }
+
+    if(check_size(int_tag, "INT", INT_COUNT, INT_SIZE)) { return 1; }
+
+    rc = plc_tag_read(dint_tag, DATA_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Error %s reading back!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    for(int i = 0; i < DINT_COUNT; i++) {
+        int32_t val = plc_tag_get_int32(dint_tag, i * DINT_SIZE);
+
+        if(val != (int32_t)(i * 11 + 5)) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Element %d is %" PRId32 ", expected %d!\n", i, val, i * 11 + 5);
+            return 1;
+        }
+    }
+
+    plc_tag_destroy(int_tag);
+    plc_tag_destroy(dint_tag);
+    plc_tag_destroy(writer_tag);
+
+    // NOLINTNEXTLINE
+    printf("The tags got their types from the variable table.\n");
+
+    return 0;
+}
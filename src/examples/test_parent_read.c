@@ -0,0 +1,404 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Exercise array parent reads from several threads.  Each reader thread owns a block
+ * of element tags that share one ranged read of Test_Array_1, and keeps destroying
+ * and recreating one of them while the other threads read.  The tags use plc=CompactLogix
+ * so the internal range tag must follow the member's PLC type onto the same session.
+ *
+ * Then, from one thread, check that reads of all the elements share packets and that
+ * the range read gets smaller again when a far away element leaves the group.  Last,
+ * abort reads that are waiting on the parent read and check that the tags can read
+ * again right away.
+ *
+ * Run against: ab_server --plc=ControlLogix --path=1,0 --tag=Test_Array_1:DINT[1000]
+ */
+
+#include "compat_utils.h"
+#include <inttypes.h>
+#include <libplctag/lib/libplctag.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define REQUIRED_VERSION 2, 4, 7
+#define TAG_BASE "protocol=ab-eip&gateway=127.0.0.1&path=1,0&plc=CompactLogix&allow_packing=0"
+#define ELEMENT_ATTRIBS TAG_BASE "&array_parent_read=1&elem_type=DINT&elem_count=1&name=Test_Array_1[%d]"
+#define ARRAY_ATTRIBS TAG_BASE "&elem_type=DINT&elem_count=%d&name=Test_Array_1"
+#define DATA_TIMEOUT (5000)
+#define RUN_PERIOD (5000)
+#define DEADLOCK_TIMEOUT (RUN_PERIOD + 20000)
+
+#define NUM_THREADS (4)
+#define TAGS_PER_THREAD (10)
+#define NUM_ELEMENTS (NUM_THREADS * TAGS_PER_THREAD)
+
+#define ELEMENT_VALUE(i) ((int32_t)((i) * 3 + 1))
+
+#define NUM_ROUNDS (3)
+#define FAR_ELEMENT (500)
+#define ABORT_ROUNDS (50)
+
+static volatile int threads_done = 0;
+static volatile int failures = 0;
+static volatile int64_t reads_done[NUM_THREADS] = {0};
+
+
+static int32_t create_element(int index) {
+    char attribs[256];
+
+    compat_snprintf(attribs, sizeof(attribs), ELEMENT_ATTRIBS, index);
+
+    return plc_tag_create(attribs, DATA_TIMEOUT);
+}
+
+
+static int read_elements(int32_t *tags, int num_tags, int first) {
+    for(int i = 0; i < num_tags; i++) { plc_tag_read(tags[i], 0); }
+
+    for(int i = 0; i < num_tags; i++) {
+        int rc = PLCTAG_STATUS_PENDING;
+        int64_t timeout_time = compat_time_ms() + DATA_TIMEOUT;
+
+        while((rc = plc_tag_status(tags[i])) == PLCTAG_STATUS_PENDING && timeout_time > compat_time_ms()) {
+            compat_sleep_ms(1, NULL);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Error %s reading element %d!\n", plc_tag_decode_error(rc), first + i);
+            return 1;
+        }
+
+        if(plc_tag_get_int32(tags[i], 0) != ELEMENT_VALUE(first + i)) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Element %d is %d, expected %d!\n", first + i, plc_tag_get_int32(tags[i], 0), ELEMENT_VALUE(first + i));
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+void *reader_function(void *arg) {
+    int thread_num = (int)(intptr_t)arg;
+    int first = thread_num * TAGS_PER_THREAD;
+    int32_t tags[TAGS_PER_THREAD] = {0};
+    int64_t run_until = compat_time_ms() + RUN_PERIOD;
+    int iteration = 0;
+
+    for(int i = 0; i < TAGS_PER_THREAD; i++) {
+        tags[i] = create_element(first + i);
+
+        if(tags[i] < 0) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Thread %d: error %s creating element %d!\n", thread_num, plc_tag_decode_error(tags[i]), first + i);
+            failures++;
+            threads_done++;
+            return NULL;
+        }
+    }
+
+    while(run_until > compat_time_ms() && !failures) {
+        /* start all the reads, then wait for them, so that they land in the same parent read. */
+        if(read_elements(tags, TAGS_PER_THREAD, first)) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Thread %d: read failed!\n", thread_num);
+            failures++;
+            break;
+        }
+
+        reads_done[thread_num] += TAGS_PER_THREAD;
+
+        /* churn the group membership while the other threads read. */
+        iteration++;
+        plc_tag_destroy(tags[iteration % TAGS_PER_THREAD]);
+        tags[iteration % TAGS_PER_THREAD] = create_element(first + (iteration % TAGS_PER_THREAD));
+
+        if(tags[iteration % TAGS_PER_THREAD] < 0) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Thread %d: error %s recreating element!\n", thread_num,
+                    plc_tag_decode_error(tags[iteration % TAGS_PER_THREAD]));
+            failures++;
+            break;
+        }
+    }
+
+    for(int i = 0; i < TAGS_PER_THREAD; i++) {
+        if(tags[i] > 0) { plc_tag_destroy(tags[i]); }
+    }
+
+    threads_done++;
+
+    return NULL;
+}
+
+
+static int check_range(void) {
+    int32_t tags[NUM_ELEMENTS] = {0};
+    int32_t far_tag = 0;
+    int far_value_ok = 0;
+    int packets = 0;
+    int wide_bytes = 0;
+    int narrow_bytes = 0;
+    int rc = 0;
+
+    for(int i = 0; i < NUM_ELEMENTS; i++) {
+        tags[i] = create_element(i);
+
+        if(tags[i] < 0) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Error %s creating element %d!\n", plc_tag_decode_error(tags[i]), i);
+            rc = 1;
+            break;
+        }
+    }
+
+    /* the first read of a member is its own, it sizes the tag. */
+    for(int round = 0; round <= NUM_ROUNDS && !rc; round++) {
+        int start_packets = plc_tag_get_int_attribute(tags[0], "conn_packets_sent", 0);
+
+        rc = read_elements(tags, NUM_ELEMENTS, 0);
+
+        if(round > 0) { packets += plc_tag_get_int_attribute(tags[0], "conn_packets_sent", 0) - start_packets; }
+    }
+
+    if(!rc) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "%d reads of %d elements took %d packets.\n", NUM_ROUNDS, NUM_ELEMENTS, packets);
+
+        /* each element on its own would take a packet per read, and none means the reads went to another session. */
+        if(packets <= 0 || packets >= NUM_ROUNDS * NUM_ELEMENTS) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Element reads were not combined!\n");
+            rc = 1;
+        }
+    }
+
+    /* a far away element widens the range. */
+    if(!rc) {
+        far_tag = create_element(FAR_ELEMENT);
+        far_value_ok = (far_tag > 0 && plc_tag_read(far_tag, DATA_TIMEOUT) == PLCTAG_STATUS_OK);
+
+        if(!far_value_ok) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Unable to read element %d!\n", FAR_ELEMENT);
+            rc = 1;
+        }
+    }
+
+    if(!rc) {
+        int start_bytes = plc_tag_get_int_attribute(tags[0], "conn_bytes_received", 0);
+
+        rc = read_elements(tags, 1, 0);
+        wide_bytes = plc_tag_get_int_attribute(tags[0], "conn_bytes_received", 0) - start_bytes;
+    }
+
+    /* once it leaves, the range goes back to the first elements. */
+    if(far_tag > 0) {
+        plc_tag_destroy(far_tag);
+        far_tag = 0;
+    }
+
+    if(!rc) {
+        int start_bytes = plc_tag_get_int_attribute(tags[0], "conn_bytes_received", 0);
+
+        rc = read_elements(tags, 1, 0);
+        narrow_bytes = plc_tag_get_int_attribute(tags[0], "conn_bytes_received", 0) - start_bytes;
+    }
+
+    if(!rc) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Reading element 0 took %d bytes with element %d in the group and %d bytes after it left.\n", wide_bytes,
+                FAR_ELEMENT, narrow_bytes);
+
+        if(narrow_bytes <= 0 || narrow_bytes * 4 > wide_bytes) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "The range did not shrink!\n");
+            rc = 1;
+        }
+    }
+
+    for(int i = 0; i < NUM_ELEMENTS; i++) {
+        if(tags[i] > 0) { plc_tag_destroy(tags[i]); }
+    }
+
+    return rc;
+}
+
+
+/*
+ * A read waiting on the parent read has no request of its own.  Aborting it, or timing
+ * it out, must still end the read so that the next one does not come back busy.
+ */
+static int check_abort(void) {
+    int32_t tags[TAGS_PER_THREAD] = {0};
+    int aborted = 0;
+    int rc = 0;
+
+    for(int i = 0; i < TAGS_PER_THREAD; i++) {
+        tags[i] = create_element(i);
+
+        if(tags[i] < 0) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Error %s creating element %d!\n", plc_tag_decode_error(tags[i]), i);
+            rc = 1;
+            break;
+        }
+    }
+
+    /* the first read of a member is its own, it sizes the tag. */
+    if(!rc) { rc = read_elements(tags, TAGS_PER_THREAD, 0); }
+
+    for(int round = 0; round < ABORT_ROUNDS && !rc; round++) {
+        int status = PLCTAG_STATUS_OK;
+
+        /* element 1 reads below with a short timeout. */
+        for(int i = 0; i < TAGS_PER_THREAD; i++) {
+            if(i != 1) { plc_tag_read(tags[i], 0); }
+        }
+
+        if(plc_tag_status(tags[0]) == PLCTAG_STATUS_PENDING) { aborted++; }
+
+        /* abort one tag and let another time out. */
+        plc_tag_abort(tags[0]);
+        status = plc_tag_read(tags[1], 1);
+
+        if(plc_tag_status(tags[0]) == PLCTAG_STATUS_PENDING) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Element 0 is still reading after the abort!\n");
+            rc = 1;
+            break;
+        }
+
+        if(status != PLCTAG_STATUS_OK && status != PLCTAG_ERR_TIMEOUT) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Error %s reading element 1 with a short timeout!\n", plc_tag_decode_error(status));
+            rc = 1;
+            break;
+        }
+
+        /* busy here means the aborted reads are still waiting on the parent read. */
+        for(int i = 0; i < 2 && !rc; i++) {
+            status = plc_tag_read(tags[i], DATA_TIMEOUT);
+
+            if(status != PLCTAG_STATUS_OK) {
+                // NOLINTNEXTLINE
+                fprintf(stderr, "Error %s reading element %d again after the abort!\n", plc_tag_decode_error(status), i);
+                rc = 1;
+            }
+        }
+
+        if(!rc) { rc = read_elements(tags, TAGS_PER_THREAD, 0); }
+    }
+
+    if(!rc) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "%d of %d aborted reads were waiting on the parent read.\n", aborted, ABORT_ROUNDS);
+    }
+
+    for(int i = 0; i < TAGS_PER_THREAD; i++) {
+        if(tags[i] > 0) { plc_tag_destroy(tags[i]); }
+    }
+
+    return rc;
+}
+
+
+int main(void) {
+    char attribs[256];
+    int32_t array_tag = 0;
+    int rc = PLCTAG_STATUS_OK;
+    compat_thread_t threads[NUM_THREADS];
+    int64_t give_up_time = 0;
+    int64_t total_reads = 0;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    plc_tag_set_debug_level(PLCTAG_DEBUG_WARN);
+
+    /* set up known values through a tag that is not in any group. */
+    compat_snprintf(attribs, sizeof(attribs), ARRAY_ATTRIBS, NUM_ELEMENTS);
+
+    array_tag = plc_tag_create(attribs, DATA_TIMEOUT);
+    if(array_tag < 0) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Error %s creating array tag!\n", plc_tag_decode_error(array_tag));
+        return 1;
+    }
+
+    for(int i = 0; i < NUM_ELEMENTS; i++) { plc_tag_set_int32(array_tag, i * 4, ELEMENT_VALUE(i)); }
+
+    rc = plc_tag_write(array_tag, DATA_TIMEOUT);
+    plc_tag_destroy(array_tag);
+
+    if(rc != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Error %s writing array tag!\n", plc_tag_decode_error(rc));
+        return 1;
+    }
+
+    for(int i = 0; i < NUM_THREADS; i++) { compat_thread_create(&threads[i], reader_function, (void *)(intptr_t)i); }
+
+    /* a lock order problem shows up as threads that never finish. */
+    give_up_time = compat_time_ms() + DEADLOCK_TIMEOUT;
+    while(threads_done < NUM_THREADS && give_up_time > compat_time_ms()) { compat_sleep_ms(100, NULL); }
+
+    if(threads_done < NUM_THREADS) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Only %d of %d threads finished, giving up!\n", threads_done, NUM_THREADS);
+        return 1;
+    }
+
+    for(int i = 0; i < NUM_THREADS; i++) {
+        compat_thread_join(threads[i], NULL);
+        total_reads += reads_done[i];
+    }
+
+    // NOLINTNEXTLINE
+    fprintf(stderr, "%" PRId64 " element reads done with %d failures.\n", total_reads, failures);
+
+    if(failures || total_reads == 0) { return 1; }
+
+    if(check_range()) { return 1; }
+
+    return check_abort();
+}
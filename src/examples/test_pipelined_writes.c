@@ -0,0 +1,184 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Check max_requests_in_flight=4 on a Logix session.  The big array is written in
+ * many fragments, which go out without waiting for each other's replies, and read
+ * back.  At the same time, threads write and read single elements of another array
+ * over the same session.  Every reply has to find its own request, so any mix-up
+ * shows up as the wrong data in one of the tags.
+ *
+ * Run against: ab_server --plc=ControlLogix --path=1,0 --tag=TestBigArray:DINT[2000] --tag=Test_Array_1:DINT[1000]
+ */
+
+#include "compat_utils.h"
+#include <inttypes.h>
+#include <libplctag/lib/libplctag.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define REQUIRED_VERSION 2, 4, 7
+
+/* small packets make many fragments, and a session of its own holds the in flight setting. */
+#define SESSION_ATTRIBS \
+    "protocol=ab-eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix&connection_group_id=45&max_requests_in_flight=4&conn_only_use_old_forward_open=1"
+#define BIG_TAG_ATTRIBS SESSION_ATTRIBS "&elem_type=DINT&elem_count=2000&name=TestBigArray"
+#define ELEM_TAG_ATTRIBS SESSION_ATTRIBS "&elem_type=DINT&elem_count=1&name=Test_Array_1[%d]"
+#define DATA_TIMEOUT (5000)
+#define NUM_ELEMENTS (2000)
+#define NUM_WORKERS (3)
+#define NUM_ROUNDS (20)
+
+static volatile int done = 0;
+static volatile int failures = 0;
+static volatile int worker_rounds[NUM_WORKERS] = {0};
+
+
+void *worker_function(void *arg) {
+    int worker_num = (int)(intptr_t)arg;
+    char attribs[256];
+    int32_t tag = 0;
+
+    // NOLINTNEXTLINE
+    snprintf(attribs, sizeof(attribs), ELEM_TAG_ATTRIBS, worker_num * 10);
+
+    tag = plc_tag_create(attribs, DATA_TIMEOUT);
+    if(tag < 0) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Worker %d: error %s creating tag!\n", worker_num, plc_tag_decode_error(tag));
+        failures++;
+        return NULL;
+    }
+
+    for(int32_t round = 1; !done && !failures; round++) {
+        int32_t value = (worker_num * 1000000) + round;
+        int rc = plc_tag_set_int32(tag, 0, value);
+
+        if(rc == PLCTAG_STATUS_OK) { rc = plc_tag_write(tag, DATA_TIMEOUT); }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            plc_tag_set_int32(tag, 0, 0);
+            rc = plc_tag_read(tag, DATA_TIMEOUT);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Worker %d: error %s in round %d!\n", worker_num, plc_tag_decode_error(rc), round);
+            failures++;
+        } else if(plc_tag_get_int32(tag, 0) != value) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Worker %d: read back %d but wrote %d!\n", worker_num, plc_tag_get_int32(tag, 0), value);
+            failures++;
+        }
+
+        worker_rounds[worker_num]++;
+    }
+
+    plc_tag_destroy(tag);
+
+    return NULL;
+}
+
+
+static int32_t element_value(int32_t round, int index) { return (round * 10000) + index; }
+
+
+int main(void) {
+    int rc = PLCTAG_STATUS_OK;
+    int32_t tag = 0;
+    compat_thread_t workers[NUM_WORKERS];
+    int total_worker_rounds = 0;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    plc_tag_set_debug_level(PLCTAG_DEBUG_WARN);
+
+    tag = plc_tag_create(BIG_TAG_ATTRIBS, DATA_TIMEOUT);
+    if(tag < 0) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Error %s creating tag!\n", plc_tag_decode_error(tag));
+        return 1;
+    }
+
+    for(int i = 0; i < NUM_WORKERS; i++) { compat_thread_create(&workers[i], worker_function, (void *)(intptr_t)i); }
+
+    for(int32_t round = 1; round <= NUM_ROUNDS && !failures; round++) {
+        for(int i = 0; i < NUM_ELEMENTS; i++) { plc_tag_set_int32(tag, i * 4, element_value(round, i)); }
+
+        rc = plc_tag_write(tag, DATA_TIMEOUT);
+
+        if(rc == PLCTAG_STATUS_OK) {
+            for(int i = 0; i < NUM_ELEMENTS; i++) { plc_tag_set_int32(tag, i * 4, 0); }
+
+            rc = plc_tag_read(tag, DATA_TIMEOUT);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Round %d: error %s!\n", round, plc_tag_decode_error(rc));
+            failures++;
+            break;
+        }
+
+        for(int i = 0; i < NUM_ELEMENTS; i++) {
+            if(plc_tag_get_int32(tag, i * 4) != element_value(round, i)) {
+                // NOLINTNEXTLINE
+                fprintf(stderr, "Round %d: element %d is %d, expected %d!\n", round, i, plc_tag_get_int32(tag, i * 4),
+                        element_value(round, i));
+                failures++;
+                break;
+            }
+        }
+    }
+
+    done = 1;
+
+    for(int i = 0; i < NUM_WORKERS; i++) {
+        compat_thread_join(workers[i], NULL);
+        total_worker_rounds += worker_rounds[i];
+    }
+
+    plc_tag_destroy(tag);
+
+    // NOLINTNEXTLINE
+    fprintf(stderr, "%d big array rounds and %d element rounds, %d failures.\n", NUM_ROUNDS, total_worker_rounds, failures);
+
+    return (failures || total_worker_rounds == 0) ? 1 : 0;
+}
@@ -0,0 +1,192 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Check snapshot_reads=1 from several threads.  The main thread keeps filling an
+ * array with one value per round, writing it and reading it back, which publishes a
+ * new snapshot each time.  Reader threads get the whole array at once and fail if
+ * the elements do not all match, which is what a torn copy of the snapshot looks like.
+ *
+ * Run against: ab_server --plc=ControlLogix --path=1,0 --tag=Test_Array_1:DINT[1000]
+ */
+
+#include "compat_utils.h"
+#include <inttypes.h>
+#include <libplctag/lib/libplctag.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define REQUIRED_VERSION 2, 4, 7
+#define TAG_ATTRIBS \
+    "protocol=ab-eip&gateway=127.0.0.1&path=1,0&plc=ControlLogix&elem_type=DINT&elem_count=256&name=Test_Array_1&snapshot_reads=1"
+#define DATA_TIMEOUT (5000)
+#define NUM_ELEMENTS (256)
+#define NUM_READERS (3)
+#define NUM_ROUNDS (200)
+
+static int32_t tag = 0;
+static volatile int done = 0;
+static volatile int failures = 0;
+static volatile int64_t gets_done[NUM_READERS] = {0};
+
+
+static int32_t get_element(const uint8_t *data, int index) {
+    const uint8_t *p = data + (index * 4);
+
+    return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+
+void *reader_function(void *arg) {
+    int reader_num = (int)(intptr_t)arg;
+    uint8_t data[NUM_ELEMENTS * 4];
+
+    while(!done && !failures) {
+        int rc = plc_tag_get_raw_bytes(tag, 0, data, (int)sizeof(data));
+
+        if(rc != PLCTAG_STATUS_OK) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Reader %d: error %s getting the data!\n", reader_num, plc_tag_decode_error(rc));
+            failures++;
+            break;
+        }
+
+        for(int i = 1; i < NUM_ELEMENTS; i++) {
+            if(get_element(data, i) != get_element(data, 0)) {
+                // NOLINTNEXTLINE
+                fprintf(stderr, "Reader %d: element %d is %d but element 0 is %d!\n", reader_num, i, get_element(data, i),
+                        get_element(data, 0));
+                failures++;
+                break;
+            }
+        }
+
+        /* single values come out of the same snapshot. */
+        if(plc_tag_get_int32(tag, (NUM_ELEMENTS - 1) * 4) < get_element(data, 0)) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Reader %d: the last element went backwards!\n", reader_num);
+            failures++;
+        }
+
+        gets_done[reader_num]++;
+    }
+
+    return NULL;
+}
+
+
+static int fill(int32_t value) {
+    uint8_t data[NUM_ELEMENTS * 4];
+
+    for(int i = 0; i < NUM_ELEMENTS; i++) {
+        data[(i * 4) + 0] = (uint8_t)((uint32_t)value & 0xFF);
+        data[(i * 4) + 1] = (uint8_t)(((uint32_t)value >> 8) & 0xFF);
+        data[(i * 4) + 2] = (uint8_t)(((uint32_t)value >> 16) & 0xFF);
+        data[(i * 4) + 3] = (uint8_t)(((uint32_t)value >> 24) & 0xFF);
+    }
+
+    /* all at once, so that readers going through the API mutex see a whole round too. */
+    return plc_tag_set_raw_bytes(tag, 0, data, (int)sizeof(data));
+}
+
+
+int main(void) {
+    int rc = PLCTAG_STATUS_OK;
+    compat_thread_t readers[NUM_READERS];
+    int64_t total_gets = 0;
+
+    /* check the library version. */
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        exit(1);
+    }
+
+    plc_tag_set_debug_level(PLCTAG_DEBUG_WARN);
+
+    tag = plc_tag_create(TAG_ATTRIBS, DATA_TIMEOUT);
+    if(tag < 0) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Error %s creating tag!\n", plc_tag_decode_error(tag));
+        return 1;
+    }
+
+    if((rc = fill(0)) != PLCTAG_STATUS_OK || (rc = plc_tag_write(tag, DATA_TIMEOUT)) != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Error %s setting up the tag!\n", plc_tag_decode_error(rc));
+        plc_tag_destroy(tag);
+        return 1;
+    }
+
+    /* a good get after a failed one leaves the status OK, even from the snapshot. */
+    plc_tag_get_int32(tag, NUM_ELEMENTS * 4);
+    plc_tag_get_int32(tag, 0);
+
+    if(plc_tag_status(tag) != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Tag status is %s after a good get!\n", plc_tag_decode_error(plc_tag_status(tag)));
+        plc_tag_destroy(tag);
+        return 1;
+    }
+
+    for(int i = 0; i < NUM_READERS; i++) { compat_thread_create(&readers[i], reader_function, (void *)(intptr_t)i); }
+
+    for(int32_t round = 1; round <= NUM_ROUNDS && !failures; round++) {
+        rc = fill(round);
+
+        if(rc == PLCTAG_STATUS_OK) { rc = plc_tag_write(tag, DATA_TIMEOUT); }
+        if(rc == PLCTAG_STATUS_OK) { rc = plc_tag_read(tag, DATA_TIMEOUT); }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Round %d: error %s!\n", round, plc_tag_decode_error(rc));
+            failures++;
+        }
+    }
+
+    done = 1;
+
+    for(int i = 0; i < NUM_READERS; i++) {
+        compat_thread_join(readers[i], NULL);
+        total_gets += gets_done[i];
+    }
+
+    plc_tag_destroy(tag);
+
+    // NOLINTNEXTLINE
+    fprintf(stderr, "%" PRId64 " whole array gets during %d rounds, %d failures.\n", total_gets, NUM_ROUNDS, failures);
+
+    return (failures || total_gets == 0) ? 1 : 0;
+}
@@ -154,6 +154,9 @@ void destroy_modules(void) {
         }
     }
 
+    /* write out any queued log messages before the logger goes away. */
+    debug_async_flush();
+
     plc_tag_unregister_logger();
 
     library_initialized = 0;
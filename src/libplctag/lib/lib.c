@@ -51,6 +51,7 @@
 #include <utils/debug.h>
 #include <utils/hash.h>
 #include <utils/hashtable.h>
+#include <utils/process_image.h>
 #include <utils/random_utils.h>
 #include <utils/rc.h>
 #include <utils/vector.h>
@@ -74,6 +75,9 @@ static thread_p tag_tickler_thread = NULL;
 static cond_p tag_tickler_wait = NULL;
 #define TAG_TICKLER_TIMEOUT_MS (100)
 #define TAG_TICKLER_TIMEOUT_MIN_MS (10)
+
+/* how many times a getter tries the snapshot before falling back to the API mutex. */
+#define SNAPSHOT_READ_ATTEMPTS (3)
 static int64_t tag_tickler_wait_timeout_end = 0;
 
 // static mutex_p global_library_mutex = NULL;
@@ -86,12 +90,21 @@ static int tag_id_inc(int id);
 static THREAD_FUNC(tag_tickler_func);
 static int plc_tag_abort_impl(plc_tag_p tag);
 static int set_tag_byte_order(plc_tag_p tag, attr attribs);
+static int set_tag_process_image(plc_tag_p tag, attr attribs);
 static int check_byte_order_str(const char *byte_order, int length);
 static int get_string_total_length_unsafe(plc_tag_p tag, int string_start_offset);
 static int get_string_length_unsafe(plc_tag_p tag, int offset);
 static int resize_tag_buffer_at_offset_unsafe(plc_tag_p tag, int old_split_index, int new_split_index);
 static int resize_tag_buffer_unsafe(plc_tag_p tag, int new_size);
 static int get_new_string_total_length_unsafe(plc_tag_p tag, const char *string_val);
+static void adapt_auto_sync_read(plc_tag_p tag, int is_write, int status);
+static void record_reads_saved(plc_tag_p tag, int64_t reads);
+static void publish_snapshot(plc_tag_p tag);
+static void invalidate_snapshot(plc_tag_p tag);
+static int snapshot_copy(plc_tag_p tag, int offset, uint8_t *buffer, int length, int *bit_num);
+static void snapshot_status_ok(plc_tag_p tag);
+static int snapshot_get_uint(plc_tag_p tag, int offset, const int *byte_order, int size, uint64_t *val);
+static int snapshot_get_bit(plc_tag_p tag, int offset_bit, int *val);
 
 
 #ifdef LIPLCTAGDLL_EXPORTS
@@ -140,6 +153,15 @@ int lib_init(void) {
 
     pdebug(DEBUG_INFO, "Setting up global library data.");
 
+    metrics_init(&library_metrics, NULL);
+
+    pdebug(DEBUG_INFO, "Setting up process images.");
+    rc = process_image_init();
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to set up process images!");
+        return rc;
+    }
+
     pdebug(DEBUG_INFO, "Creating tag hashtable.");
     if((tags = hashtable_create(INITIAL_TAG_TABLE_SIZE)) == NULL) { /* MAGIC */
         pdebug(DEBUG_ERROR, "Unable to create tag hashtable!");
@@ -199,6 +221,8 @@ void lib_teardown(void) {
         tags = NULL;
     }
 
+    process_image_teardown();
+
     atomic_set_bool(&library_terminating, false);
 
     pdebug(DEBUG_INFO, "Done.");
@@ -327,6 +351,8 @@ void plc_tag_generic_tickler(plc_tag_p tag) {
                     tag->write_in_flight = 1;
                     tag->auto_sync_next_write = 0;
 
+                    plc_tag_generic_op_started(tag);
+
                     if(tag->vtable && tag->vtable->write) { tag->status = (int8_t)tag->vtable->write(tag); }
 
                     // tag->event_write_started = 1;
@@ -349,11 +375,17 @@ void plc_tag_generic_tickler(plc_tag_p tag) {
                 /* make sure that we do not have an outstanding read or write. */
                 if(!tag->read_in_flight && !tag->tag_is_dirty && !tag->write_in_flight) {
                     int64_t periods = 0;
+                    int32_t period_ms = tag->auto_sync_read_ms;
+
+                    /* adaptive polling may have backed off from the base period. */
+                    if(tag->auto_sync_read_period_ms > tag->auto_sync_read_ms) { period_ms = tag->auto_sync_read_period_ms; }
 
                     pdebug(DEBUG_DETAIL, "Triggering automatic read start.");
 
                     tag->read_in_flight = 1;
 
+                    plc_tag_generic_op_started(tag);
+
                     if(tag->vtable && tag->vtable->read) { tag->status = (int8_t)tag->vtable->read(tag); }
 
                     // tag->event_read_started = 1;
@@ -369,14 +401,22 @@ void plc_tag_generic_tickler(plc_tag_p tag) {
                      *
                      * Round up to the next period.
                      */
-                    periods = (current_time - tag->auto_sync_next_read + (tag->auto_sync_read_ms - 1)) / tag->auto_sync_read_ms;
+                    periods = (current_time - tag->auto_sync_next_read + (period_ms - 1)) / period_ms;
 
                     /* warn if we need to skip more than one period. */
                     if(periods > 1) {
-                        pdebug(DEBUG_WARN, "Skipping %" PRId64 " periods of %" PRId32 "ms.", periods, tag->auto_sync_read_ms);
+                        pdebug(DEBUG_WARN, "Skipping %" PRId64 " periods of %" PRId32 "ms.", periods, period_ms);
                     }
 
-                    tag->auto_sync_next_read += (periods * tag->auto_sync_read_ms);
+                    tag->auto_sync_next_read += (periods * period_ms);
+
+                    /* stay on the phase of the other tags in the family, it may have moved. */
+                    tag->auto_sync_next_read = poll_planner_align(tag->auto_sync_planner, tag->auto_sync_family_id,
+                                                                  tag->auto_sync_next_read);
+
+                    /* every base period inside the longer one is a read we did not do. */
+                    if(period_ms > tag->auto_sync_read_ms) { record_reads_saved(tag, (period_ms / tag->auto_sync_read_ms) - 1); }
+
                     pdebug(DEBUG_DETAIL, "Scheduling next read at time %" PRId64 ".", tag->auto_sync_next_read);
                 } else {
                     pdebug(DEBUG_SPEW,
@@ -467,6 +507,265 @@ void plc_tag_generic_handle_event_callbacks(plc_tag_p tag) {
 }
 
 
+/*
+ * Track operation latency per tag.  Must be called with the tag API mutex held.
+ *
+ * The completion can be seen both by the thread waiting in plc_tag_read/write and by
+ * the tickler, so only the first call after a start is counted and published.
+ */
+
+void plc_tag_generic_op_started(plc_tag_p tag) { tag->op_start_us = time_monotonic_us(); }
+
+
+/*
+ * Give up the tag's place in the automatic read plan of its connection.  The
+ * protocol must call this before it lets go of the connection.
+ */
+
+void plc_tag_generic_leave_poll_planner(plc_tag_p tag) {
+    if(!tag || !tag->auto_sync_planner) { return; }
+
+    poll_planner_leave(tag->auto_sync_planner, tag->auto_sync_family_id);
+
+    tag->auto_sync_planner = NULL;
+    tag->auto_sync_family_id = 0;
+}
+
+
+void plc_tag_generic_op_completed(plc_tag_p tag, int is_write, int status) {
+    if(!tag->op_start_us) { return; }
+
+    metrics_record_op(&tag->metrics, is_write, status, time_monotonic_us() - tag->op_start_us);
+
+    /* the tag data now matches the PLC. */
+    if(status == PLCTAG_STATUS_OK) { publish_snapshot(tag); }
+
+    /* let other processes see the new data, or why there is none. */
+    if(tag->process_image_slot && (!is_write || status == PLCTAG_STATUS_OK)) {
+        process_image_publish(tag->process_image_slot, tag->tag_id, tag->data, tag->size, status);
+    }
+
+    adapt_auto_sync_read(tag, is_write, status);
+
+    tag->op_start_us = 0;
+}
+
+
+/*
+ * adapt_auto_sync_read
+ *
+ * Adaptive polling.  If the tag has auto_sync_read_max_ms set above
+ * auto_sync_read_ms, then the automatic read period doubles each time a read
+ * returns the same data as before, up to the maximum.  As soon as the data
+ * changes, or the tag is written, the period drops back to auto_sync_read_ms
+ * and the next read is pulled in to match.
+ *
+ * The data is compared by hash so that we do not need to keep a copy of it.
+ */
+
+static void adapt_auto_sync_read(plc_tag_p tag, int is_write, int status) {
+    uint32_t data_hash = 0;
+    int changed = 1;
+
+    if(tag->auto_sync_read_ms <= 0 || tag->auto_sync_read_max_ms <= tag->auto_sync_read_ms) { return; }
+
+    /* a failed operation tells us nothing about the data. */
+    if(status != PLCTAG_STATUS_OK) { return; }
+
+    if(tag->data && tag->size > 0) { data_hash = hash(tag->data, (size_t)(unsigned int)tag->size, 0); }
+
+    /* writes always count as a change, we expect the PLC to react. */
+    if(!is_write && tag->auto_sync_data_hash_valid && data_hash == tag->auto_sync_data_hash) { changed = 0; }
+
+    tag->auto_sync_data_hash = data_hash;
+    tag->auto_sync_data_hash_valid = 1;
+
+    if(changed) {
+        if(tag->auto_sync_read_period_ms > tag->auto_sync_read_ms) {
+            int64_t next_read = time_ms() + tag->auto_sync_read_ms;
+
+            pdebug(DEBUG_DETAIL, "Tag data changed, dropping read period from %" PRId32 "ms to %" PRId32 "ms.",
+                   tag->auto_sync_read_period_ms, tag->auto_sync_read_ms);
+
+            /* give back the reads we counted as saved but will now do. */
+            if(tag->auto_sync_next_read > next_read) {
+                record_reads_saved(tag, -((tag->auto_sync_next_read - next_read) / tag->auto_sync_read_ms));
+                tag->auto_sync_next_read = next_read;
+            }
+        }
+
+        tag->auto_sync_read_period_ms = tag->auto_sync_read_ms;
+    } else if(tag->auto_sync_read_period_ms < tag->auto_sync_read_max_ms) {
+        int32_t old_period_ms = (tag->auto_sync_read_period_ms > tag->auto_sync_read_ms ? tag->auto_sync_read_period_ms
+                                                                                           : tag->auto_sync_read_ms);
+        int64_t new_period_ms = (int64_t)old_period_ms * 2;
+
+        if(new_period_ms > tag->auto_sync_read_max_ms) { new_period_ms = tag->auto_sync_read_max_ms; }
+
+        tag->auto_sync_read_period_ms = (int32_t)new_period_ms;
+
+        /* the next read was scheduled with the old period, push it out to the new one. */
+        if(tag->auto_sync_next_read) {
+            tag->auto_sync_next_read += (new_period_ms - old_period_ms);
+            record_reads_saved(tag, (new_period_ms - old_period_ms) / tag->auto_sync_read_ms);
+        }
+
+        pdebug(DEBUG_DETAIL, "Tag data stable, backing off read period to %" PRId32 "ms.", tag->auto_sync_read_period_ms);
+    }
+}
+
+
+static void record_reads_saved(plc_tag_p tag, int64_t reads) {
+    if(!reads) { return; }
+
+    metrics_record_reads_saved(&tag->metrics, reads);
+}
+
+
+/*
+ * Snapshot reads.  If the tag has snapshot_reads set, every successful operation
+ * publishes a copy of the tag data under a sequence lock.  The getters copy out
+ * of it without the API mutex, so they do not wait behind the tickler or I/O.
+ *
+ * The sequence is odd while a copy is being published and stays odd after a
+ * setter changes the data locally, until the next operation publishes it.  Readers
+ * that see an odd or changing sequence use the API mutex as usual.  Everything a
+ * reader looks at, the size and the tag's bit included, is published inside the
+ * sequence and read between the two loads of it.
+ *
+ * The snapshot buffer is allocated once and never moved because readers do not
+ * hold any lock.  If the tag data grows past it, snapshot reads stop.
+ */
+
+static void publish_snapshot(plc_tag_p tag) {
+    if(!tag->snapshot_reads || !tag->data || tag->size <= 0) { return; }
+
+    if(!tag->snapshot_data) {
+        tag->snapshot_data = (uint8_t *)mem_alloc(tag->size);
+        if(!tag->snapshot_data) {
+            pdebug(DEBUG_WARN, "Unable to allocate snapshot buffer!");
+            return;
+        }
+
+        tag->snapshot_capacity = tag->size;
+    }
+
+    invalidate_snapshot(tag);
+
+    if(tag->size > tag->snapshot_capacity) {
+        pdebug(DEBUG_DETAIL, "Tag data grew past the snapshot buffer, reads will use the API mutex.");
+        return;
+    }
+
+    /* readers must see the odd sequence before any of the new bytes. */
+    atomic_fence_release();
+
+    mem_copy(tag->snapshot_data, tag->data, tag->size);
+    atomic_set_int32(&tag->snapshot_size, tag->size);
+    atomic_set_int32(&tag->snapshot_bit, tag->is_bit ? tag->bit : -1);
+
+    /* and all of the new bytes before the even sequence. */
+    atomic_fence_release();
+
+    atomic_add_int32(&tag->snapshot_seq, 1);
+}
+
+
+/* must be called with the API mutex held. */
+static void invalidate_snapshot(plc_tag_p tag) {
+    if(tag->snapshot_data && !(atomic_get_int32(&tag->snapshot_seq) & 1)) { atomic_add_int32(&tag->snapshot_seq, 1); }
+}
+
+
+/*
+ * snapshot_copy
+ *
+ * Copy length bytes at offset out of the snapshot.  For bit reads, bit_num points at
+ * the bit wanted and the byte holding it is copied.  Bit tags always read their own
+ * bit, and only through bit reads.
+ */
+static int snapshot_copy(plc_tag_p tag, int offset, uint8_t *buffer, int length, int *bit_num) {
+    for(int attempt = 0; attempt < SNAPSHOT_READ_ATTEMPTS; attempt++) {
+        int32_t seq = atomic_get_int32(&tag->snapshot_seq);
+        int32_t size = 0;
+        int32_t tag_bit = 0;
+        int rc = PLCTAG_STATUS_OK;
+
+        /* never published, being published or stale. */
+        if(seq == 0 || (seq & 1)) { return PLCTAG_ERR_BUSY; }
+
+        size = atomic_get_int32(&tag->snapshot_size);
+        tag_bit = atomic_get_int32(&tag->snapshot_bit);
+
+        if(bit_num) {
+            if(tag_bit >= 0) { *bit_num = tag_bit; }
+
+            offset = (*bit_num >= 0) ? *bit_num / 8 : -1;
+        } else if(tag_bit >= 0) {
+            /* the getters treat bit tags differently. */
+            rc = PLCTAG_ERR_UNSUPPORTED;
+        }
+
+        if(rc == PLCTAG_STATUS_OK && (offset < 0 || length <= 0 || offset > size - length)) { rc = PLCTAG_ERR_OUT_OF_BOUNDS; }
+
+        if(rc == PLCTAG_STATUS_OK) { mem_copy(buffer, tag->snapshot_data + offset, length); }
+
+        /* the copy must be done before the sequence is checked again. */
+        atomic_fence_acquire();
+
+        /* if nothing was published while we looked, the result is good. */
+        if(atomic_get_int32(&tag->snapshot_seq) == seq) {
+            if(rc == PLCTAG_STATUS_OK) { snapshot_status_ok(tag); }
+
+            return rc;
+        }
+    }
+
+    return PLCTAG_ERR_BUSY;
+}
+
+
+/*
+ * A successful get leaves the tag status OK, as it does under the API mutex.  The
+ * status is only written, under the mutex, when it is not OK already.  A stale look
+ * at it costs at most one trip through the mutex.
+ */
+static void snapshot_status_ok(plc_tag_p tag) {
+    if(*(volatile int8_t *)&(tag->status) != PLCTAG_STATUS_OK) {
+        critical_block(tag->api_mutex) { tag->status = PLCTAG_STATUS_OK; }
+    }
+}
+
+
+static int snapshot_get_uint(plc_tag_p tag, int offset, const int *byte_order, int size, uint64_t *val) {
+    uint8_t buffer[8];
+    int rc = PLCTAG_STATUS_OK;
+
+    rc = snapshot_copy(tag, offset, buffer, size, NULL);
+    if(rc != PLCTAG_STATUS_OK) { return rc; }
+
+    *val = 0;
+
+    for(int i = 0; i < size; i++) { *val |= (uint64_t)buffer[byte_order ? byte_order[i] : i] << (8 * i); }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+static int snapshot_get_bit(plc_tag_p tag, int offset_bit, int *val) {
+    uint8_t byte_val = 0;
+    int bit_num = offset_bit;
+    int rc = PLCTAG_STATUS_OK;
+
+    rc = snapshot_copy(tag, 0, &byte_val, 1, &bit_num);
+    if(rc != PLCTAG_STATUS_OK) { return rc; }
+
+    *val = !!(byte_val & (1 << (bit_num % 8)));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 int plc_tag_generic_init_tag(plc_tag_p tag, attr attribs,
                              void (*tag_callback_func)(int32_t tag_id, int event, int status, void *userdata), void *userdata) {
     int rc = PLCTAG_STATUS_OK;
@@ -480,6 +779,9 @@ int plc_tag_generic_init_tag(plc_tag_p tag, attr attribs,
         return PLCTAG_ERR_OUT_OF_BOUNDS;
     }
 
+    /* optional wait-free getters, see publish_snapshot(). */
+    tag->snapshot_reads = (uint8_t)(attr_get_int(attribs, "snapshot_reads", 0) ? 1 : 0);
+
     rc = mutex_create(&(tag->ext_mutex));
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to create tag external mutex!");
@@ -502,6 +804,9 @@ int plc_tag_generic_init_tag(plc_tag_p tag, attr attribs,
     tag->callback = tag_callback_func;
     tag->userdata = userdata;
 
+    /* the protocol moves this under the tag's connection once it has one. */
+    metrics_init(&tag->metrics, &library_metrics);
+
     pdebug(DEBUG_INFO, "Done.");
 
     return rc;
@@ -564,6 +869,8 @@ THREAD_FUNC(tag_tickler_func) {
                                 tag->read_complete = 0;
                                 tag->read_in_flight = 0;
 
+                                plc_tag_generic_op_completed(tag, 0, tag->status);
+
                                 // tag->event_read_complete = 1;
                                 tag_raise_event(tag, PLCTAG_EVENT_READ_COMPLETED, tag->status);
 
@@ -577,6 +884,8 @@ THREAD_FUNC(tag_tickler_func) {
                                 tag->write_in_flight = 0;
                                 tag->auto_sync_next_write = 0;
 
+                                plc_tag_generic_op_completed(tag, 1, tag->status);
+
                                 // tag->event_write_complete = 1;
                                 tag_raise_event(tag, PLCTAG_EVENT_WRITE_COMPLETED, tag->status);
 
@@ -883,6 +1192,9 @@ LIB_EXPORT int32_t plc_tag_create_ex(const char *attrib_str,
     debug_level = attr_get_int(attribs, "debug", -1);
     if(debug_level > DEBUG_NONE) { set_debug_level(debug_level); }
 
+    /* turn on deferred log formatting. */
+    if(attr_get_int(attribs, "debug_async", 0)) { debug_set_async(1); }
+
     /*
      * create the tag, this is protocol specific.
      *
@@ -937,8 +1249,26 @@ LIB_EXPORT int32_t plc_tag_create_ex(const char *attrib_str,
         /* how many periods did we already pass? */
         // int64_t periods = (time_ms() / tag->auto_sync_read_ms);
         // tag->auto_sync_next_read = (periods + 1) * tag->auto_sync_read_ms;
-        /* start some time in the future, but with random jitter. */
-        tag->auto_sync_next_read = time_ms() + (int64_t)(random_u64((uint64_t)tag->auto_sync_read_ms));
+        /*
+         * start some time in the future, but with random jitter.  The protocol may already have
+         * planned the first read to line up with other tags on the same connection.
+         */
+        if(!tag->auto_sync_next_read) {
+            tag->auto_sync_next_read = time_ms() + (int64_t)(random_u64((uint64_t)tag->auto_sync_read_ms));
+        }
+    }
+
+    tag->auto_sync_read_period_ms = tag->auto_sync_read_ms;
+
+    /* optional adaptive polling, backs off to this period while the data does not change. */
+    tag->auto_sync_read_max_ms = attr_get_int(attribs, "auto_sync_read_max_ms", 0);
+    if(tag->auto_sync_read_max_ms < 0) {
+        pdebug(DEBUG_WARN, "auto_sync_read_max_ms value must be positive!");
+        attr_destroy(attribs);
+        rc_dec(tag);
+        return PLCTAG_ERR_BAD_PARAM;
+    } else if(tag->auto_sync_read_max_ms > 0 && tag->auto_sync_read_max_ms <= tag->auto_sync_read_ms) {
+        pdebug(DEBUG_WARN, "auto_sync_read_max_ms is not larger than auto_sync_read_ms, adaptive polling is disabled.");
     }
 
     tag->auto_sync_write_ms = attr_get_int(attribs, "auto_sync_write_ms", 0);
@@ -963,17 +1293,13 @@ LIB_EXPORT int32_t plc_tag_create_ex(const char *attrib_str,
         return rc;
     }
 
-    /*
-     * Release memory for attributes
-     */
-    attr_destroy(attribs);
-
     /* map the tag to a tag ID */
     id = add_tag_lookup(tag);
 
     /* if the mapping failed, then punt */
     if(id < 0) {
         pdebug(DEBUG_ERROR, "Unable to map tag %p to lookup table entry, rc=%s", tag, plc_tag_decode_error(id));
+        attr_destroy(attribs);
         rc_dec(tag);
         return id;
     }
@@ -983,6 +1309,21 @@ LIB_EXPORT int32_t plc_tag_create_ex(const char *attrib_str,
 
     debug_set_tag_id(id);
 
+    /* publish the tag into a shared memory process image if asked. */
+    rc = set_tag_process_image(tag, attribs);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to set up the tag process image: %s!", plc_tag_decode_error(rc));
+        attr_destroy(attribs);
+        critical_block(tag_lookup_mutex) { hashtable_remove(tags, (int64_t)tag->tag_id); }
+        rc_dec(tag);
+        return rc;
+    }
+
+    /*
+     * Release memory for attributes
+     */
+    attr_destroy(attribs);
+
     pdebug(DEBUG_INFO, "Returning mapped tag ID %d", id);
 
     /* wake up tag's PLC here. */
@@ -1598,6 +1939,8 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout) {
         tag->read_in_flight = 1;
         tag->status = PLCTAG_STATUS_PENDING;
 
+        plc_tag_generic_op_started(tag);
+
         /* clear the condition var */
         cond_clear(tag->tag_cond_wait);
 
@@ -1619,6 +1962,8 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout) {
                 rc = plc_tag_abort_impl(tag);
             }
 
+            plc_tag_generic_op_completed(tag, 0, rc);
+
             tag->read_in_flight = 0;
             is_done = 1;
             break;
@@ -1669,6 +2014,7 @@ LIB_EXPORT int plc_tag_read(int32_t id, int timeout) {
             tag->read_in_flight = 0;
             tag->read_complete = 0;
             /* is_done = 1; */
+            plc_tag_generic_op_completed(tag, 0, rc);
             tag_raise_event(tag, PLCTAG_EVENT_READ_COMPLETED, (int8_t)rc);
         }
 
@@ -1772,6 +2118,8 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout) {
         tag->write_in_flight = 1;
         tag->status = PLCTAG_STATUS_OK;
 
+        plc_tag_generic_op_started(tag);
+
         /*
          * This needs to be done before we raise the event below in case the user code
          * tries to do something tricky like abort the write.   In that case, the condition
@@ -1806,6 +2154,8 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout) {
                 if(tag->vtable && tag->vtable->abort) { tag->vtable->abort(tag); }
             }
 
+            plc_tag_generic_op_completed(tag, 1, rc);
+
             tag->write_in_flight = 0;
             is_done = 1;
             break;
@@ -1856,6 +2206,7 @@ LIB_EXPORT int plc_tag_write(int32_t id, int timeout) {
             tag->write_in_flight = 0;
             tag->write_complete = 0;
             is_done = 1;
+            plc_tag_generic_op_completed(tag, 1, rc);
         }
 
         pdebug(DEBUG_INFO, "Write finshed with elapsed time %" PRId64 "ms", (time_ms() - start_time));
@@ -1907,8 +2258,15 @@ LIB_EXPORT int plc_tag_get_int_attribute(int32_t id, const char *attrib_name, in
         } else if(str_cmp_i(attrib_name, "debug_level") == 0) {
             pdebug(DEBUG_WARN, "Deprecated attribute \"debug_level\" used, use \"debug\" instead.");
             res = (int)get_debug_level();
+        } else if(str_cmp_i(attrib_name, "debug_async") == 0) {
+            res = debug_get_async();
+        } else if(str_cmp_i(attrib_name, "debug_compiled_level") == 0) {
+            res = DEBUG_COMPILED_LEVEL;
+        } else if(str_cmp_i_n(attrib_name, "lib_", 4) == 0
+                  && metrics_get_int_attrib(&library_metrics, attrib_name + 4, &res) == PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_SPEW, "Got library metric %s.", attrib_name);
         } else {
-            pdebug(DEBUG_WARN, "Attribute \"%s\" is not supported at the library level!");
+            pdebug(DEBUG_WARN, "Attribute \"%s\" is not supported at the library level!", attrib_name);
             res = default_value;
         }
     } else {
@@ -1931,6 +2289,13 @@ LIB_EXPORT int plc_tag_get_int_attribute(int32_t id, const char *attrib_name, in
             } else if(str_cmp_i(attrib_name, "auto_sync_read_ms") == 0) {
                 tag->status = PLCTAG_STATUS_OK;
                 res = (int)tag->auto_sync_read_ms;
+            } else if(str_cmp_i(attrib_name, "auto_sync_read_max_ms") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)tag->auto_sync_read_max_ms;
+            } else if(str_cmp_i(attrib_name, "auto_sync_read_period_ms") == 0) {
+                tag->status = PLCTAG_STATUS_OK;
+                res = (int)(tag->auto_sync_read_period_ms > tag->auto_sync_read_ms ? tag->auto_sync_read_period_ms
+                                                                                    : tag->auto_sync_read_ms);
             } else if(str_cmp_i(attrib_name, "auto_sync_write_ms") == 0) {
                 tag->status = PLCTAG_STATUS_OK;
                 res = (int)tag->auto_sync_write_ms;
@@ -1941,6 +2306,9 @@ LIB_EXPORT int plc_tag_get_int_attribute(int32_t id, const char *attrib_name, in
                 pdebug(DEBUG_DETAIL, "Getting the connection_group_id for tag %" PRId32 ".", id);
                 tag->status = PLCTAG_STATUS_OK;
                 res = tag->connection_group_id;
+            } else if(str_cmp_i_n(attrib_name, "tag_", 4) == 0
+                      && metrics_get_int_attrib(&tag->metrics, attrib_name + 4, &res) == PLCTAG_STATUS_OK) {
+                tag->status = PLCTAG_STATUS_OK;
             } else {
                 if(tag->vtable && tag->vtable->get_int_attrib) {
                     res = tag->vtable->get_int_attrib(tag, attrib_name, default_value);
@@ -1989,6 +2357,8 @@ LIB_EXPORT int plc_tag_set_int_attribute(int32_t id, const char *attrib_name, in
             } else {
                 res = PLCTAG_ERR_OUT_OF_BOUNDS;
             }
+        } else if(str_cmp_i(attrib_name, "debug_async") == 0) {
+            res = debug_set_async(new_value);
         } else {
             pdebug(DEBUG_WARN, "Attribute \"%s\" is not support at the library level!", attrib_name);
             return PLCTAG_ERR_UNSUPPORTED;
@@ -2017,6 +2387,19 @@ LIB_EXPORT int plc_tag_set_int_attribute(int32_t id, const char *attrib_name, in
             } else if(str_cmp_i(attrib_name, "auto_sync_read_ms") == 0) {
                 if(new_value >= 0) {
                     tag->auto_sync_read_ms = new_value;
+                    tag->auto_sync_read_period_ms = new_value;
+
+                    /* the new period may belong in a different family. */
+                    if(tag->auto_sync_planner) {
+                        poll_planner_leave(tag->auto_sync_planner, tag->auto_sync_family_id);
+                        tag->auto_sync_family_id = 0;
+
+                        if(new_value > 0) {
+                            tag->auto_sync_next_read =
+                                poll_planner_first_read(tag->auto_sync_planner, new_value, &tag->auto_sync_family_id);
+                        }
+                    }
+
                     tag->status = PLCTAG_STATUS_OK;
                     res = PLCTAG_STATUS_OK;
                 } else {
@@ -2024,6 +2407,20 @@ LIB_EXPORT int plc_tag_set_int_attribute(int32_t id, const char *attrib_name, in
                     tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
                     res = PLCTAG_ERR_OUT_OF_BOUNDS;
                 }
+            } else if(str_cmp_i(attrib_name, "auto_sync_read_max_ms") == 0) {
+                if(new_value >= 0) {
+                    tag->auto_sync_read_max_ms = new_value;
+
+                    /* do not stay backed off past the new maximum. */
+                    if(tag->auto_sync_read_period_ms > new_value) { tag->auto_sync_read_period_ms = tag->auto_sync_read_ms; }
+
+                    tag->status = PLCTAG_STATUS_OK;
+                    res = PLCTAG_STATUS_OK;
+                } else {
+                    pdebug(DEBUG_WARN, "auto_sync_read_max_ms must be greater than or equal to zero!");
+                    tag->status = PLCTAG_ERR_OUT_OF_BOUNDS;
+                    res = PLCTAG_ERR_OUT_OF_BOUNDS;
+                }
             } else if(str_cmp_i(attrib_name, "auto_sync_write_ms") == 0) {
                 if(new_value >= 0) {
                     tag->auto_sync_write_ms = new_value;
@@ -2103,6 +2500,62 @@ LIB_EXPORT int plc_tag_get_byte_array_attribute(int32_t id, const char *attrib_n
 }
 
 
+/*
+ * Copy a metrics snapshot out field by field, see libplctag.h for the order.
+ * The connection metrics are the parent of the tag's once it has a connection.
+ */
+
+LIB_EXPORT int plc_tag_get_metrics(int32_t id, const char *scope, int64_t *values, int num_values) {
+    int rc = PLCTAG_STATUS_OK;
+    plc_tag_p tag = NULL;
+    struct metrics_snapshot_t snapshot;
+    int64_t *fields = (int64_t *)(void *)&snapshot;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    if(!values || num_values < 0) {
+        pdebug(DEBUG_WARN, "Metrics buffer must not be null and the value count must not be negative!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    if(id == 0) {
+        metrics_snapshot(&library_metrics, &snapshot);
+    } else {
+        tag = lookup_tag(id);
+
+        if(!tag) {
+            pdebug(DEBUG_WARN, "Tag not found.");
+            return PLCTAG_ERR_NOT_FOUND;
+        }
+
+        critical_block(tag->api_mutex) {
+            if(!scope || str_cmp_i(scope, "tag") == 0) {
+                metrics_snapshot(&tag->metrics, &snapshot);
+            } else if(str_cmp_i(scope, "conn") != 0) {
+                pdebug(DEBUG_WARN, "Unsupported metrics scope \"%s\"!", scope);
+                rc = PLCTAG_ERR_BAD_PARAM;
+            } else if(!tag->metrics.parent || tag->metrics.parent == &library_metrics) {
+                pdebug(DEBUG_DETAIL, "Tag %" PRId32 " does not have connection metrics.", id);
+                rc = PLCTAG_ERR_UNSUPPORTED;
+            } else {
+                metrics_snapshot(tag->metrics.parent, &snapshot);
+            }
+        }
+
+        pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to tag %" PRId32 ".", tag->tag_id);
+        rc_dec(tag);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) { return rc; }
+
+    for(int i = 0; i < num_values && i < METRICS_SNAPSHOT_FIELDS; i++) { values[i] = fields[i]; }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return METRICS_SNAPSHOT_FIELDS;
+}
+
+
 LIB_EXPORT int plc_tag_get_size(int32_t id) {
     int result = 0;
     plc_tag_p tag = lookup_tag(id);
@@ -2214,7 +2667,10 @@ LIB_EXPORT int plc_tag_get_bit(int32_t id, int offset_bit) {
         return PLCTAG_ERR_NOT_FOUND;
     }
 
-    critical_block(tag->api_mutex) { res = plc_tag_get_bit_impl(tag, offset_bit); }
+    /* use the published snapshot if there is one, there is no need to wait on the API mutex. */
+    if(snapshot_get_bit(tag, offset_bit, &res) != PLCTAG_STATUS_OK) {
+        critical_block(tag->api_mutex) { res = plc_tag_get_bit_impl(tag, offset_bit); }
+    }
 
     pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to tag %" PRId32 ".", tag->tag_id);
     rc_dec(tag);
@@ -2248,6 +2704,7 @@ static int plc_tag_set_bit_impl(plc_tag_p tag, int offset_bit, int val) {
 
         if((real_offset >= 0) && ((real_offset / 8) < tag->size)) {
             if(tag->auto_sync_write_ms > 0) { tag->tag_is_dirty = 1; }
+            invalidate_snapshot(tag);
 
             if(val) {
                 tag->data[real_offset / 8] |= (uint8_t)(1 << (real_offset % 8));
@@ -2293,6 +2750,7 @@ LIB_EXPORT int plc_tag_set_bit(int32_t id, int offset_bit, int val) {
 LIB_EXPORT uint64_t plc_tag_get_uint64(int32_t id, int offset) {
     uint64_t res = UINT64_MAX;
     plc_tag_p tag = lookup_tag(id);
+    uint64_t snapshot_val = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -2301,6 +2759,16 @@ LIB_EXPORT uint64_t plc_tag_get_uint64(int32_t id, int offset) {
         return res;
     }
 
+    /* use the published snapshot if there is one, there is no need to wait on the API mutex. */
+    if(snapshot_get_uint(tag, offset, tag->byte_order->int64_order, (int)sizeof(uint64_t), &snapshot_val) == PLCTAG_STATUS_OK) {
+        res = snapshot_val;
+
+        pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to tag %" PRId32 ".", tag->tag_id);
+        rc_dec(tag);
+
+        return res;
+    }
+
     critical_block(tag->api_mutex) {
         /* is there data? */
         if(!tag->data) {
@@ -2365,6 +2833,7 @@ LIB_EXPORT int plc_tag_set_uint64(int32_t id, int offset, uint64_t val) {
         if(!tag->is_bit) {
             if((offset >= 0) && (offset + ((int)sizeof(uint64_t)) <= tag->size)) {
                 if(tag->auto_sync_write_ms > 0) { tag->tag_is_dirty = 1; }
+                invalidate_snapshot(tag);
 
                 tag->data[offset + tag->byte_order->int64_order[0]] = (uint8_t)((val >> 0) & 0xFF);
                 tag->data[offset + tag->byte_order->int64_order[1]] = (uint8_t)((val >> 8) & 0xFF);
@@ -2401,6 +2870,7 @@ LIB_EXPORT int plc_tag_set_uint64(int32_t id, int offset, uint64_t val) {
 LIB_EXPORT int64_t plc_tag_get_int64(int32_t id, int offset) {
     int64_t res = INT64_MIN;
     plc_tag_p tag = lookup_tag(id);
+    uint64_t snapshot_val = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -2409,6 +2879,16 @@ LIB_EXPORT int64_t plc_tag_get_int64(int32_t id, int offset) {
         return res;
     }
 
+    /* use the published snapshot if there is one, there is no need to wait on the API mutex. */
+    if(snapshot_get_uint(tag, offset, tag->byte_order->int64_order, (int)sizeof(int64_t), &snapshot_val) == PLCTAG_STATUS_OK) {
+        res = (int64_t)snapshot_val;
+
+        pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to tag %" PRId32 ".", tag->tag_id);
+        rc_dec(tag);
+
+        return res;
+    }
+
     critical_block(tag->api_mutex) {
         /* is there data? */
         if(!tag->data) {
@@ -2474,6 +2954,7 @@ LIB_EXPORT int plc_tag_set_int64(int32_t id, int offset, int64_t ival) {
         if(!tag->is_bit) {
             if((offset >= 0) && (offset + ((int)sizeof(int64_t)) <= tag->size)) {
                 if(tag->auto_sync_write_ms > 0) { tag->tag_is_dirty = 1; }
+                invalidate_snapshot(tag);
 
                 tag->data[offset + tag->byte_order->int64_order[0]] = (uint8_t)((val >> 0) & 0xFF);
                 tag->data[offset + tag->byte_order->int64_order[1]] = (uint8_t)((val >> 8) & 0xFF);
@@ -2509,6 +2990,7 @@ LIB_EXPORT int plc_tag_set_int64(int32_t id, int offset, int64_t ival) {
 LIB_EXPORT uint32_t plc_tag_get_uint32(int32_t id, int offset) {
     uint32_t res = UINT32_MAX;
     plc_tag_p tag = lookup_tag(id);
+    uint64_t snapshot_val = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -2517,6 +2999,16 @@ LIB_EXPORT uint32_t plc_tag_get_uint32(int32_t id, int offset) {
         return res;
     }
 
+    /* use the published snapshot if there is one, there is no need to wait on the API mutex. */
+    if(snapshot_get_uint(tag, offset, tag->byte_order->int32_order, (int)sizeof(uint32_t), &snapshot_val) == PLCTAG_STATUS_OK) {
+        res = (uint32_t)snapshot_val;
+
+        pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to tag %" PRId32 ".", tag->tag_id);
+        rc_dec(tag);
+
+        return res;
+    }
+
     critical_block(tag->api_mutex) {
         /* is there data? */
         if(!tag->data) {
@@ -2575,6 +3067,7 @@ LIB_EXPORT int plc_tag_set_uint32(int32_t id, int offset, uint32_t val) {
         if(!tag->is_bit) {
             if((offset >= 0) && (offset + ((int)sizeof(uint32_t)) <= tag->size)) {
                 if(tag->auto_sync_write_ms > 0) { tag->tag_is_dirty = 1; }
+                invalidate_snapshot(tag);
 
                 tag->data[offset + tag->byte_order->int32_order[0]] = (uint8_t)((val >> 0) & 0xFF);
                 tag->data[offset + tag->byte_order->int32_order[1]] = (uint8_t)((val >> 8) & 0xFF);
@@ -2606,6 +3099,7 @@ LIB_EXPORT int plc_tag_set_uint32(int32_t id, int offset, uint32_t val) {
 LIB_EXPORT int32_t plc_tag_get_int32(int32_t id, int offset) {
     int32_t res = INT32_MIN;
     plc_tag_p tag = lookup_tag(id);
+    uint64_t snapshot_val = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -2614,6 +3108,16 @@ LIB_EXPORT int32_t plc_tag_get_int32(int32_t id, int offset) {
         return res;
     }
 
+    /* use the published snapshot if there is one, there is no need to wait on the API mutex. */
+    if(snapshot_get_uint(tag, offset, tag->byte_order->int32_order, (int)sizeof(int32_t), &snapshot_val) == PLCTAG_STATUS_OK) {
+        res = (int32_t)(uint32_t)snapshot_val;
+
+        pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to tag %" PRId32 ".", tag->tag_id);
+        rc_dec(tag);
+
+        return res;
+    }
+
     critical_block(tag->api_mutex) {
         /* is there data? */
         if(!tag->data) {
@@ -2673,6 +3177,7 @@ LIB_EXPORT int plc_tag_set_int32(int32_t id, int offset, int32_t ival) {
         if(!tag->is_bit) {
             if((offset >= 0) && (offset + ((int)sizeof(int32_t)) <= tag->size)) {
                 if(tag->auto_sync_write_ms > 0) { tag->tag_is_dirty = 1; }
+                invalidate_snapshot(tag);
 
                 tag->data[offset + tag->byte_order->int32_order[0]] = (uint8_t)((val >> 0) & 0xFF);
                 tag->data[offset + tag->byte_order->int32_order[1]] = (uint8_t)((val >> 8) & 0xFF);
@@ -2704,6 +3209,7 @@ LIB_EXPORT int plc_tag_set_int32(int32_t id, int offset, int32_t ival) {
 LIB_EXPORT uint16_t plc_tag_get_uint16(int32_t id, int offset) {
     uint16_t res = UINT16_MAX;
     plc_tag_p tag = lookup_tag(id);
+    uint64_t snapshot_val = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -2712,6 +3218,16 @@ LIB_EXPORT uint16_t plc_tag_get_uint16(int32_t id, int offset) {
         return res;
     }
 
+    /* use the published snapshot if there is one, there is no need to wait on the API mutex. */
+    if(snapshot_get_uint(tag, offset, tag->byte_order->int16_order, (int)sizeof(uint16_t), &snapshot_val) == PLCTAG_STATUS_OK) {
+        res = (uint16_t)snapshot_val;
+
+        pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to tag %" PRId32 ".", tag->tag_id);
+        rc_dec(tag);
+
+        return res;
+    }
+
     critical_block(tag->api_mutex) {
         /* is there data? */
         if(!tag->data) {
@@ -2770,6 +3286,7 @@ LIB_EXPORT int plc_tag_set_uint16(int32_t id, int offset, uint16_t val) {
         if(!tag->is_bit) {
             if((offset >= 0) && (offset + ((int)sizeof(uint16_t)) <= tag->size)) {
                 if(tag->auto_sync_write_ms > 0) { tag->tag_is_dirty = 1; }
+                invalidate_snapshot(tag);
 
                 tag->data[offset + tag->byte_order->int16_order[0]] = (uint8_t)((val >> 0) & 0xFF);
                 tag->data[offset + tag->byte_order->int16_order[1]] = (uint8_t)((val >> 8) & 0xFF);
@@ -2800,6 +3317,7 @@ LIB_EXPORT int plc_tag_set_uint16(int32_t id, int offset, uint16_t val) {
 LIB_EXPORT int16_t plc_tag_get_int16(int32_t id, int offset) {
     int16_t res = INT16_MIN;
     plc_tag_p tag = lookup_tag(id);
+    uint64_t snapshot_val = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -2808,6 +3326,16 @@ LIB_EXPORT int16_t plc_tag_get_int16(int32_t id, int offset) {
         return res;
     }
 
+    /* use the published snapshot if there is one, there is no need to wait on the API mutex. */
+    if(snapshot_get_uint(tag, offset, tag->byte_order->int16_order, (int)sizeof(int16_t), &snapshot_val) == PLCTAG_STATUS_OK) {
+        res = (int16_t)(uint16_t)snapshot_val;
+
+        pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to tag %" PRId32 ".", tag->tag_id);
+        rc_dec(tag);
+
+        return res;
+    }
+
     critical_block(tag->api_mutex) {
         /* is there data? */
         if(!tag->data) {
@@ -2866,6 +3394,7 @@ LIB_EXPORT int plc_tag_set_int16(int32_t id, int offset, int16_t ival) {
         if(!tag->is_bit) {
             if((offset >= 0) && (offset + ((int)sizeof(int16_t)) <= tag->size)) {
                 if(tag->auto_sync_write_ms > 0) { tag->tag_is_dirty = 1; }
+                invalidate_snapshot(tag);
 
                 tag->data[offset + tag->byte_order->int16_order[0]] = (uint8_t)((val >> 0) & 0xFF);
                 tag->data[offset + tag->byte_order->int16_order[1]] = (uint8_t)((val >> 8) & 0xFF);
@@ -2896,6 +3425,7 @@ LIB_EXPORT int plc_tag_set_int16(int32_t id, int offset, int16_t ival) {
 LIB_EXPORT uint8_t plc_tag_get_uint8(int32_t id, int offset) {
     uint8_t res = UINT8_MAX;
     plc_tag_p tag = lookup_tag(id);
+    uint64_t snapshot_val = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -2904,6 +3434,16 @@ LIB_EXPORT uint8_t plc_tag_get_uint8(int32_t id, int offset) {
         return res;
     }
 
+    /* use the published snapshot if there is one, there is no need to wait on the API mutex. */
+    if(snapshot_get_uint(tag, offset, NULL, (int)sizeof(uint8_t), &snapshot_val) == PLCTAG_STATUS_OK) {
+        res = (uint8_t)snapshot_val;
+
+        pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to tag %" PRId32 ".", tag->tag_id);
+        rc_dec(tag);
+
+        return res;
+    }
+
     critical_block(tag->api_mutex) {
         /* is there data? */
         if(!tag->data) {
@@ -2960,6 +3500,7 @@ LIB_EXPORT int plc_tag_set_uint8(int32_t id, int offset, uint8_t val) {
         if(!tag->is_bit) {
             if((offset >= 0) && (offset + ((int)sizeof(uint8_t)) <= tag->size)) {
                 if(tag->auto_sync_write_ms > 0) { tag->tag_is_dirty = 1; }
+                invalidate_snapshot(tag);
 
                 tag->data[offset] = val;
 
@@ -2989,6 +3530,7 @@ LIB_EXPORT int plc_tag_set_uint8(int32_t id, int offset, uint8_t val) {
 LIB_EXPORT int8_t plc_tag_get_int8(int32_t id, int offset) {
     int8_t res = INT8_MIN;
     plc_tag_p tag = lookup_tag(id);
+    uint64_t snapshot_val = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -2997,6 +3539,16 @@ LIB_EXPORT int8_t plc_tag_get_int8(int32_t id, int offset) {
         return res;
     }
 
+    /* use the published snapshot if there is one, there is no need to wait on the API mutex. */
+    if(snapshot_get_uint(tag, offset, NULL, (int)sizeof(int8_t), &snapshot_val) == PLCTAG_STATUS_OK) {
+        res = (int8_t)(uint8_t)snapshot_val;
+
+        pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to tag %" PRId32 ".", tag->tag_id);
+        rc_dec(tag);
+
+        return res;
+    }
+
     critical_block(tag->api_mutex) {
         /* is there data? */
         if(!tag->data) {
@@ -3054,6 +3606,7 @@ LIB_EXPORT int plc_tag_set_int8(int32_t id, int offset, int8_t ival) {
         if(!tag->is_bit) {
             if((offset >= 0) && (offset + ((int)sizeof(int8_t)) <= tag->size)) {
                 if(tag->auto_sync_write_ms > 0) { tag->tag_is_dirty = 1; }
+                invalidate_snapshot(tag);
 
                 tag->data[offset] = val;
 
@@ -3082,6 +3635,7 @@ LIB_EXPORT int plc_tag_set_int8(int32_t id, int offset, int8_t ival) {
 LIB_EXPORT double plc_tag_get_float64(int32_t id, int offset) {
     double res = DBL_MIN;
     plc_tag_p tag = lookup_tag(id);
+    uint64_t snapshot_val = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -3090,6 +3644,16 @@ LIB_EXPORT double plc_tag_get_float64(int32_t id, int offset) {
         return res;
     }
 
+    /* use the published snapshot if there is one, there is no need to wait on the API mutex. */
+    if(snapshot_get_uint(tag, offset, tag->byte_order->float64_order, (int)sizeof(double), &snapshot_val) == PLCTAG_STATUS_OK) {
+        mem_copy(&res, &snapshot_val, sizeof(res));
+
+        pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to tag %" PRId32 ".", tag->tag_id);
+        rc_dec(tag);
+
+        return res;
+    }
+
     critical_block(tag->api_mutex) {
         /* is there data? */
         if(!tag->data) {
@@ -3164,6 +3728,7 @@ LIB_EXPORT int plc_tag_set_float64(int32_t id, int offset, double fval) {
 
         if((offset >= 0) && (offset + ((int)sizeof(double)) <= tag->size)) {
             if(tag->auto_sync_write_ms > 0) { tag->tag_is_dirty = 1; }
+            invalidate_snapshot(tag);
 
             uint64_t val;
             /* copy the data into the uint64 value */
@@ -3197,6 +3762,7 @@ LIB_EXPORT int plc_tag_set_float64(int32_t id, int offset, double fval) {
 LIB_EXPORT float plc_tag_get_float32(int32_t id, int offset) {
     float res = FLT_MIN;
     plc_tag_p tag = lookup_tag(id);
+    uint64_t snapshot_val = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -3205,6 +3771,18 @@ LIB_EXPORT float plc_tag_get_float32(int32_t id, int offset) {
         return res;
     }
 
+    /* use the published snapshot if there is one, there is no need to wait on the API mutex. */
+    if(snapshot_get_uint(tag, offset, tag->byte_order->float32_order, (int)sizeof(float), &snapshot_val) == PLCTAG_STATUS_OK) {
+        uint32_t ures = (uint32_t)snapshot_val;
+
+        mem_copy(&res, &ures, sizeof(res));
+
+        pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to tag %" PRId32 ".", tag->tag_id);
+        rc_dec(tag);
+
+        return res;
+    }
+
     critical_block(tag->api_mutex) {
         /* is there data? */
         if(!tag->data) {
@@ -3275,6 +3853,7 @@ LIB_EXPORT int plc_tag_set_float32(int32_t id, int offset, float fval) {
 
         if((offset >= 0) && (offset + ((int)sizeof(float)) <= tag->size)) {
             if(tag->auto_sync_write_ms > 0) { tag->tag_is_dirty = 1; }
+            invalidate_snapshot(tag);
 
             uint32_t val;
             /* copy the data into the uint32 value */
@@ -3604,6 +4183,7 @@ LIB_EXPORT int plc_tag_set_string(int32_t tag_id, int string_start_offset, const
 
         /* if this is an auto-write tag, set the dirty flag to eventually trigger a write */
         if(rc == PLCTAG_STATUS_OK && tag->auto_sync_write_ms > 0) { tag->tag_is_dirty = 1; }
+        if(rc == PLCTAG_STATUS_OK) { invalidate_snapshot(tag); }
 
         /* set the return and tag status. */
         rc = PLCTAG_STATUS_OK;
@@ -3806,6 +4386,7 @@ LIB_EXPORT int plc_tag_set_raw_bytes(int32_t id, int offset, uint8_t *buffer, in
         critical_block(tag->api_mutex) {
             if((offset >= 0) && ((offset + buffer_size) <= tag->size)) {
                 if(tag->auto_sync_write_ms > 0) { tag->tag_is_dirty = 1; }
+                invalidate_snapshot(tag);
 
                 int i;
                 for(i = 0; i < buffer_size; i++) { tag->data[offset + i] = buffer[i]; }
@@ -3864,7 +4445,10 @@ LIB_EXPORT int plc_tag_get_raw_bytes(int32_t id, int offset, uint8_t *buffer, in
         return PLCTAG_ERR_BAD_PARAM;
     }
 
-    if(!tag->is_bit) {
+    if(snapshot_copy(tag, offset, buffer, buffer_size, NULL) == PLCTAG_STATUS_OK) {
+        /* served from the published snapshot without waiting on the API mutex. */
+        rc = PLCTAG_STATUS_OK;
+    } else if(!tag->is_bit) {
         critical_block(tag->api_mutex) {
             if((offset >= 0) && ((offset + buffer_size) <= tag->size)) {
                 int i;
@@ -4215,6 +4799,46 @@ int set_tag_byte_order(plc_tag_p tag, attr attribs)
     return PLCTAG_STATUS_OK;
 }
 
+
+/*
+ * set_tag_process_image
+ *
+ * Attach the tag to a shared memory process image if the process_image
+ * attribute is set.  The size and number of entries are only used by the
+ * first tag that opens the image.
+ */
+int set_tag_process_image(plc_tag_p tag, attr attribs) {
+    const char *image_name = attr_get_str(attribs, "process_image", NULL);
+    int image_size = attr_get_int(attribs, "process_image_size", PROCESS_IMAGE_DEFAULT_SIZE);
+    int max_entries = attr_get_int(attribs, "process_image_entries", PROCESS_IMAGE_DEFAULT_ENTRIES);
+    process_image_slot_p slot = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!image_name || str_length(image_name) == 0) { return PLCTAG_STATUS_OK; }
+
+    rc = process_image_supported();
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Tag asks for process image %s, but process images are not supported here!", image_name);
+        return rc;
+    }
+
+    if(image_size <= 0 || max_entries <= 0) {
+        pdebug(DEBUG_WARN, "process_image_size and process_image_entries must be positive!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    slot = process_image_slot_create(image_name, image_size, max_entries, attr_get_str(attribs, "name", ""));
+    if(!slot) {
+        pdebug(DEBUG_WARN, "Unable to attach tag to process image %s!", image_name);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    /* the tickler may already be completing operations on the tag. */
+    critical_block(tag->api_mutex) { tag->process_image_slot = slot; }
+
+    return PLCTAG_STATUS_OK;
+}
+
 int check_byte_order_str(const char *byte_order, int length) {
     int taken[8] = {0, 0, 0, 0, 0, 0, 0, 0};
     int byte_order_len = str_length(byte_order);
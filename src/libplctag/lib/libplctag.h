@@ -470,6 +470,42 @@ LIB_EXPORT int plc_tag_set_int_attribute(int32_t tag, const char *attrib_name, i
 
 LIB_EXPORT int plc_tag_get_byte_array_attribute(int32_t tag, const char *attrib_name, uint8_t *buffer, int buffer_length);
 
+/*
+ * plc_tag_get_metrics
+ *
+ * Copy a snapshot of the operation metrics into values, one 64-bit value per
+ * PLCTAG_METRIC_ index below.  Tag ID 0 gets the totals for the whole library.
+ * For a tag, a scope of NULL or "tag" gets the tag's own metrics and "conn"
+ * gets the metrics of the connection the tag uses.  At most num_values values
+ * are copied.
+ *
+ * Returns the number of metrics the library keeps, which may be more or less
+ * than num_values, or an error.  The same values, as 32-bit integers, are
+ * also available through plc_tag_get_int_attribute() with the lib_, tag_ and
+ * conn_ prefixes.
+ */
+#define PLCTAG_METRIC_READ_COUNT        (0)
+#define PLCTAG_METRIC_WRITE_COUNT       (1)
+#define PLCTAG_METRIC_ERROR_COUNT       (2)
+#define PLCTAG_METRIC_RETRY_COUNT       (3)
+#define PLCTAG_METRIC_RECONNECT_COUNT   (4)
+#define PLCTAG_METRIC_PACKETS_SENT      (5)
+#define PLCTAG_METRIC_PACKETS_RECEIVED  (6)
+#define PLCTAG_METRIC_BYTES_SENT        (7)
+#define PLCTAG_METRIC_BYTES_RECEIVED    (8)
+#define PLCTAG_METRIC_REQUESTS_PACKED   (9)
+#define PLCTAG_METRIC_QUEUE_DEPTH       (10)
+#define PLCTAG_METRIC_LATENCY_COUNT     (11)
+#define PLCTAG_METRIC_LATENCY_AVG_US    (12)
+#define PLCTAG_METRIC_LATENCY_MAX_US    (13)
+#define PLCTAG_METRIC_LATENCY_P50_US    (14)
+#define PLCTAG_METRIC_LATENCY_P99_US    (15)
+#define PLCTAG_METRIC_LATENCY_P999_US   (16)
+#define PLCTAG_METRIC_READS_SAVED       (17)
+#define PLCTAG_METRIC_MAX               (PLCTAG_METRIC_READS_SAVED + 1)
+
+LIB_EXPORT int plc_tag_get_metrics(int32_t tag, const char *scope, int64_t *values, int num_values);
+
 LIB_EXPORT int plc_tag_get_size(int32_t tag);
 /* return the old size or negative for errors. */
 LIB_EXPORT int plc_tag_set_size(int32_t tag, int new_size);
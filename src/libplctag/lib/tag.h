@@ -40,6 +40,9 @@
 #include <utils/atomic_utils.h>
 #include <utils/attr.h>
 #include <utils/debug.h>
+#include <utils/metrics.h>
+#include <utils/poll_planner.h>
+#include <utils/process_image.h>
 
 
 typedef struct plc_tag_t *plc_tag_p;
@@ -111,11 +114,16 @@ typedef void (*tag_extended_callback_func)(int32_t tag_id, int event, int status
 /* NB: sorted by decreasing size and then alphabetically */
 
 #define TAG_BASE_STRUCT                      \
+    struct metrics_t metrics;                \
     int64_t auto_sync_next_read;             \
     int64_t auto_sync_next_write;            \
+    int64_t op_start_us;                     \
     int64_t read_cache_expire;               \
     int64_t read_cache_ms;                   \
+    poll_planner_p auto_sync_planner;        \
     uint8_t *data;                           \
+    uint8_t *snapshot_data;                  \
+    process_image_slot_p process_image_slot; \
     tag_byte_order_t *byte_order;            \
     cond_p tag_cond_wait;                    \
     mutex_p api_mutex;                       \
@@ -123,13 +131,21 @@ typedef void (*tag_extended_callback_func)(int32_t tag_id, int event, int status
     tag_extended_callback_func callback;     \
     tag_vtable_p vtable;                     \
     void *userdata;                          \
+    uint32_t auto_sync_data_hash;            \
+    uint32_t auto_sync_family_id;            \
+    int32_t auto_sync_read_max_ms;           \
     int32_t auto_sync_read_ms;               \
+    int32_t auto_sync_read_period_ms;        \
     int32_t auto_sync_write_ms;              \
     int32_t size;                            \
+    int32_t snapshot_capacity;               \
     int32_t tag_id;                          \
     int connection_group_id;                 \
     int bit;                                 \
     atomic_bool abort_requested;             \
+    atomic_int32_t snapshot_bit;             \
+    atomic_int32_t snapshot_seq;             \
+    atomic_int32_t snapshot_size;            \
     int8_t event_creation_complete_status;   \
     int8_t event_deletion_started_status;    \
     int8_t event_operation_aborted_status;   \
@@ -139,6 +155,7 @@ typedef void (*tag_extended_callback_func)(int32_t tag_id, int event, int status
     int8_t event_write_started_status;       \
     int8_t status;                           \
     uint8_t allow_field_resize : 1;          \
+    uint8_t auto_sync_data_hash_valid : 1;   \
     uint8_t event_creation_complete : 1;     \
     uint8_t event_deletion_started : 1;      \
     uint8_t event_operation_aborted : 1;     \
@@ -153,6 +170,7 @@ typedef void (*tag_extended_callback_func)(int32_t tag_id, int event, int status
     uint8_t read_complete : 1;               \
     uint8_t read_in_flight : 1;              \
     uint8_t skip_tickler : 1;                \
+    uint8_t snapshot_reads : 1;              \
     uint8_t tag_is_dirty : 1;                \
     uint8_t write_complete : 1;              \
     uint8_t write_in_flight : 1
@@ -175,6 +193,9 @@ extern void plc_tag_generic_tickler(plc_tag_p tag);
 #define plc_tag_generic_raise_event(t, e, s) plc_tag_generic_raise_event_impl(__func__, __LINE__, t, e, s)
 extern int plc_tag_generic_raise_event_impl(const char *func, int line_num, plc_tag_p tag, int8_t event_val, int8_t status);
 extern void plc_tag_generic_handle_event_callbacks(plc_tag_p tag);
+extern void plc_tag_generic_op_started(plc_tag_p tag);
+extern void plc_tag_generic_op_completed(plc_tag_p tag, int is_write, int status);
+extern void plc_tag_generic_leave_poll_planner(plc_tag_p tag);
 #define plc_tag_tickler_wake() plc_tag_tickler_wake_impl(__func__, __LINE__)
 extern int plc_tag_tickler_wake_impl(const char *func, int line_num);
 #define plc_tag_generic_wake_tag(tag) plc_tag_generic_wake_tag_impl(__func__, __LINE__, tag)
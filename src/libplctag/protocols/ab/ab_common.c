@@ -47,6 +47,7 @@
 #include <libplctag/protocols/ab/eip_plc5_pccc.h>
 #include <libplctag/protocols/ab/eip_slc_dhp.h>
 #include <libplctag/protocols/ab/eip_slc_pccc.h>
+#include <libplctag/protocols/ab/parent_read.h>
 #include <libplctag/protocols/ab/pccc.h>
 #include <libplctag/protocols/ab/session.h>
 #include <libplctag/protocols/ab/tag.h>
@@ -55,6 +56,7 @@
 #include <platform.h>
 #include <utils/attr.h>
 #include <utils/debug.h>
+#include <utils/metrics.h>
 #include <utils/vector.h>
 
 
@@ -88,6 +90,7 @@ volatile int ab_protocol_terminating = 0;
 
 /* forward declarations*/
 static int get_tag_data_type(ab_tag_p tag, attr attribs);
+static int setup_known_type(ab_tag_p tag, attr attribs);
 
 static void ab_tag_destroy(ab_tag_p tag);
 static int default_abort(plc_tag_p tag);
@@ -162,6 +165,8 @@ plc_tag_p ab_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
     ab_tag_p tag = AB_TAG_NULL;
     const char *path = NULL;
     int rc = PLCTAG_STATUS_OK;
+    int auto_sync_read_ms = 0;
+    int skip_initial_read = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -215,22 +220,23 @@ plc_tag_p ab_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
     switch(tag->plc_type) {
         case AB_PLC_PLC5:
             tag->use_connected_msg = 0;
-            tag->allow_packing = 0;
+            /* packing is off unless asked for, not every PCCC target takes Multiple Service requests. */
+            tag->allow_packing = attr_get_int(attribs, "allow_packing", 0);
             break;
 
         case AB_PLC_SLC:
             tag->use_connected_msg = 0;
-            tag->allow_packing = 0;
+            tag->allow_packing = attr_get_int(attribs, "allow_packing", 0);
             break;
 
         case AB_PLC_MLGX:
             tag->use_connected_msg = 0;
-            tag->allow_packing = 0;
+            tag->allow_packing = attr_get_int(attribs, "allow_packing", 0);
             break;
 
         case AB_PLC_LGX_PCCC:
             tag->use_connected_msg = 0;
-            tag->allow_packing = 0;
+            tag->allow_packing = attr_get_int(attribs, "allow_packing", 0);
             break;
 
         case AB_PLC_LGX:
@@ -244,8 +250,8 @@ plc_tag_p ab_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
             pdebug(DEBUG_DETAIL, "Micro800 needs connected messaging.");
             tag->use_connected_msg = 1;
 
-            /* Micro800 cannot pack requests. */
-            tag->allow_packing = 0;
+            /* older Micro800 firmware cannot pack requests, the session only packs if the PLC does. */
+            tag->allow_packing = attr_get_int(attribs, "allow_packing", 1);
             break;
 
             // case AB_PLC_OMRON_NJNX:
@@ -284,6 +290,15 @@ plc_tag_p ab_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
 
     pdebug(DEBUG_DETAIL, "using session=%p", tag->session);
 
+    metrics_set_parent(&tag->metrics, &tag->session->metrics);
+
+    /* line up automatic reads with the other tags on this session so that they are packed together. */
+    auto_sync_read_ms = attr_get_int(attribs, "auto_sync_read_ms", 0);
+    if(auto_sync_read_ms > 0) {
+        tag->auto_sync_planner = &tag->session->poll_planner;
+        tag->auto_sync_next_read = poll_planner_first_read(tag->auto_sync_planner, auto_sync_read_ms, &tag->auto_sync_family_id);
+    }
+
     /* get the tag data type, or try. */
     rc = get_tag_data_type(tag, attribs);
     if(rc != PLCTAG_STATUS_OK) {
@@ -307,12 +322,12 @@ plc_tag_p ab_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
             } else {
                 pdebug(DEBUG_DETAIL, "Setting up PLC/5 via DH+ bridge tag.");
                 tag->use_connected_msg = 1;
+                tag->allow_packing = 0;
                 tag->vtable = &eip_plc5_dhp_vtable;
             }
 
             tag->byte_order = &plc5_tag_byte_order;
 
-            tag->allow_packing = 0;
             break;
 
         case AB_PLC_SLC:
@@ -329,18 +344,17 @@ plc_tag_p ab_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
             } else {
                 pdebug(DEBUG_DETAIL, "Setting up SLC/MicroLogix via DH+ bridge tag.");
                 tag->use_connected_msg = 1;
+                tag->allow_packing = 0;
                 tag->vtable = &eip_slc_dhp_vtable;
             }
 
             tag->byte_order = &slc_tag_byte_order;
 
-            tag->allow_packing = 0;
             break;
 
         case AB_PLC_LGX_PCCC:
             pdebug(DEBUG_DETAIL, "Setting up PCCC-mapped Logix tag.");
             tag->use_connected_msg = 0;
-            tag->allow_packing = 0;
             tag->vtable = &lgx_pccc_vtable;
 
             tag->byte_order = &slc_tag_byte_order;
@@ -393,7 +407,9 @@ plc_tag_p ab_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
             }
 
             tag->use_connected_msg = 1;
-            tag->allow_packing = 0;
+
+            /* the session only packs if the PLC supports it. */
+            tag->allow_packing = attr_get_int(attribs, "allow_packing", 1);
 
             break;
 
@@ -481,17 +497,32 @@ plc_tag_p ab_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
         return (plc_tag_p)tag;
     }
 
+    /* members of the same UDT can share one read of the parent. */
+    if(!tag->special_tag && tag->plc_type == AB_PLC_LGX) {
+        rc = parent_read_setup(tag, attribs, attr_get_str(attribs, "name", NULL));
+        if(rc != PLCTAG_STATUS_OK) {
+            tag->status = (int8_t)rc;
+            return (plc_tag_p)tag;
+        }
+    }
+
+    /* a tag with a known type can be written without reading it first. */
+    if(!tag->special_tag && !attr_get_int(attribs, "initial_read", 1)) {
+        skip_initial_read = (setup_known_type(tag, attribs) == PLCTAG_STATUS_OK);
+    }
+
     /* kick off a read to get the tag type and size. */
-    if(!tag->special_tag && tag->vtable->read) {
+    if(!tag->special_tag && tag->vtable->read && !skip_initial_read) {
         /* trigger the first read. */
         pdebug(DEBUG_DETAIL, "Kicking off initial read.");
 
         tag->first_read = 1;
         tag->read_in_flight = 1;
+        plc_tag_generic_op_started((plc_tag_p)tag);
         tag->vtable->read((plc_tag_p)tag);
         // tag_raise_event((plc_tag_p)tag, PLCTAG_EVENT_READ_STARTED, tag->status);
     } else {
-        pdebug(DEBUG_DETAIL, "Not kicking off initial read: tag is special or does not have read function.");
+        pdebug(DEBUG_DETAIL, "Not kicking off initial read: tag is special, has a known type or does not have read function.");
 
         /* force the created event because we do not do an initial read here. */
         tag_raise_event((plc_tag_p)tag, PLCTAG_EVENT_CREATED, tag->status);
@@ -505,6 +536,83 @@ plc_tag_p ab_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
 }
 
 
+/*
+ * Set up the type and buffer of a Logix-class tag without reading it.  The
+ * encoded type comes from the elem_type attribute for atomic types, or from
+ * an earlier read of the same tag name on this session.  Returns
+ * PLCTAG_ERR_NOT_FOUND if the type is not known and the tag must be read.
+ */
+
+int setup_known_type(ab_tag_p tag, attr attribs) {
+    const char *elem_type = attr_get_str(attribs, "elem_type", NULL);
+    uint8_t cip_type = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if((tag->plc_type != AB_PLC_LGX && tag->plc_type != AB_PLC_MICRO800) || tag->is_bit) {
+        pdebug(DEBUG_DETAIL, "Only whole Logix-class tags can skip the initial read.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* atomic types always have the same two byte type encoding. */
+    if(elem_type) {
+        if(str_cmp_i(elem_type, "lint") == 0) {
+            cip_type = AB_CIP_DATA_LINT;
+        } else if(str_cmp_i(elem_type, "ulint") == 0) {
+            cip_type = AB_CIP_DATA_ULINT;
+        } else if(str_cmp_i(elem_type, "dint") == 0) {
+            cip_type = AB_CIP_DATA_DINT;
+        } else if(str_cmp_i(elem_type, "udint") == 0) {
+            cip_type = AB_CIP_DATA_UDINT;
+        } else if(str_cmp_i(elem_type, "int") == 0) {
+            cip_type = AB_CIP_DATA_INT;
+        } else if(str_cmp_i(elem_type, "uint") == 0) {
+            cip_type = AB_CIP_DATA_UINT;
+        } else if(str_cmp_i(elem_type, "sint") == 0) {
+            cip_type = AB_CIP_DATA_SINT;
+        } else if(str_cmp_i(elem_type, "usint") == 0) {
+            cip_type = AB_CIP_DATA_USINT;
+        } else if(str_cmp_i(elem_type, "bool") == 0) {
+            cip_type = AB_CIP_DATA_BIT;
+        } else if(str_cmp_i(elem_type, "bool array") == 0) {
+            cip_type = AB_CIP_DATA_DWORD;
+        } else if(str_cmp_i(elem_type, "real") == 0) {
+            cip_type = AB_CIP_DATA_REAL;
+        } else if(str_cmp_i(elem_type, "lreal") == 0) {
+            cip_type = AB_CIP_DATA_LREAL;
+        }
+    }
+
+    if(cip_type) {
+        tag->encoded_type_info[0] = cip_type;
+        tag->encoded_type_info[1] = 0;
+        tag->encoded_type_info_size = 2;
+    } else if(session_get_cached_type(tag->session, tag) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Type of tag is not known, it must be read first.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(tag->elem_size <= 0 || tag->elem_count <= 0) {
+        pdebug(DEBUG_DETAIL, "Element size is not known, the tag must be read first.");
+        tag->encoded_type_info_size = 0;
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    tag->size = tag->elem_count * tag->elem_size;
+    tag->data = (uint8_t *)mem_alloc(tag->size);
+    if(!tag->data) {
+        pdebug(DEBUG_WARN, "Unable to allocate tag data!");
+        tag->size = 0;
+        tag->encoded_type_info_size = 0;
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    pdebug(DEBUG_DETAIL, "Tag type is known, skipping the initial read of %d bytes.", tag->size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 /*
  * determine the tag's data type and size.  Or at least guess it.
  */
@@ -717,8 +825,25 @@ int ab_tag_abort_request_only(ab_tag_p tag) {
             pdebug(DEBUG_DETAIL, "Called without a request in flight.");
         }
 
+        /* abort the rest of a multi-packet transfer too. */
+        critical_block(tag->api_mutex) {
+            for(int i = tag->next_queued_req; i < tag->num_queued_reqs; i++) {
+                if(tag->queued_reqs[i]) {
+                    spin_block(&tag->queued_reqs[i]->lock) { tag->queued_reqs[i]->abort_request = 1; }
+                    tag->queued_reqs[i] = rc_dec(tag->queued_reqs[i]);
+                }
+            }
+
+            tag->num_queued_reqs = 0;
+            tag->next_queued_req = 0;
+        }
+
+        /* a read waiting on its parent's read has no request, but its status is still pending. */
+        if(tag->parent_read_pending) { tag->status = PLCTAG_ERR_ABORT; }
+
         tag->read_in_progress = 0;
         tag->write_in_progress = 0;
+        tag->parent_read_pending = 0;
     } else {
         pdebug(DEBUG_DETAIL, "Called with a null tag pointer.");
     }
@@ -753,6 +878,82 @@ int ab_tag_abort_request(ab_tag_p tag) {
 }
 
 
+/*
+ * ab_tag_queue_request
+ *
+ * A transfer that is larger than one packet may be split into a request per
+ * packet: PCCC has no fragmented reads or writes, and CIP fragmented writes
+ * do not need to wait on each other.  The requests are queued on the session
+ * together so that they go out back to back.  The first becomes tag->req and
+ * the rest wait here until ab_tag_next_request() moves them into tag->req in
+ * order.
+ *
+ * The caller adds the request to the session after this.
+ */
+
+int ab_tag_queue_request(ab_tag_p tag, ab_request_p req) {
+    if(!tag->req) {
+        tag->req = req;
+        return PLCTAG_STATUS_OK;
+    }
+
+    /* reuse the slots of requests that are already done. */
+    if(tag->num_queued_reqs >= tag->queued_reqs_capacity && tag->next_queued_req > 0) {
+        tag->num_queued_reqs -= tag->next_queued_req;
+        mem_move(&tag->queued_reqs[0], &tag->queued_reqs[tag->next_queued_req],
+                 tag->num_queued_reqs * (int)sizeof(ab_request_p));
+        tag->next_queued_req = 0;
+    }
+
+    if(tag->num_queued_reqs >= tag->queued_reqs_capacity) {
+        int new_capacity = tag->queued_reqs_capacity + 8;
+        ab_request_p *new_reqs = (ab_request_p *)mem_realloc(tag->queued_reqs, new_capacity * (int)sizeof(ab_request_p));
+
+        if(!new_reqs) {
+            pdebug(DEBUG_ERROR, "Unable to grow the queued request list!");
+            return PLCTAG_ERR_NO_MEM;
+        }
+
+        tag->queued_reqs = new_reqs;
+        tag->queued_reqs_capacity = new_capacity;
+    }
+
+    tag->queued_reqs[tag->num_queued_reqs] = req;
+    tag->num_queued_reqs++;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * ab_tag_next_request
+ *
+ * Release the finished request and make the next queued packet of the
+ * transfer current.  Returns PLCTAG_STATUS_PENDING if there is one, PLCTAG_STATUS_OK
+ * if the transfer is done.
+ */
+
+int ab_tag_next_request(ab_tag_p tag) {
+    ab_request_p next = NULL;
+
+    critical_block(tag->api_mutex) {
+        if(tag->next_queued_req < tag->num_queued_reqs) {
+            next = tag->queued_reqs[tag->next_queued_req];
+            tag->queued_reqs[tag->next_queued_req] = NULL;
+            tag->next_queued_req++;
+        } else {
+            tag->num_queued_reqs = 0;
+            tag->next_queued_req = 0;
+        }
+
+        tag->req = rc_dec(tag->req);
+        tag->req = next;
+    }
+
+    return (next ? PLCTAG_STATUS_PENDING : PLCTAG_STATUS_OK);
+}
+
+
 int ab_tag_abort(ab_tag_p tag) {
     pdebug(DEBUG_DETAIL, "Starting.");
 
@@ -761,18 +962,19 @@ int ab_tag_abort(ab_tag_p tag) {
 
         critical_block(tag->api_mutex) { req = rc_inc(tag->req); }
 
-        if(req) {
-            spin_block(&req->lock) { req->abort_request = 1; }
+        if(req) { spin_block(&req->lock) { req->abort_request = 1; } }
 
+        /* a read waiting on its parent's read has no request of its own. */
+        if(req || tag->read_in_progress || tag->write_in_progress) {
             /* do a real abort */
             ab_tag_abort_request(tag);
 
-            req = rc_dec(req);
+            if(req) { req = rc_dec(req); }
 
             tag->status = PLCTAG_ERR_ABORT;
             return tag->status;
         } else {
-            pdebug(DEBUG_DETAIL, "Called with a null tag pointer.");
+            pdebug(DEBUG_DETAIL, "Nothing in flight to abort.");
         }
     }
 
@@ -828,6 +1030,9 @@ void ab_tag_destroy(ab_tag_p tag) {
     /* abort anything in flight */
     ab_tag_abort(tag);
 
+    /* leave any parent read group while the session is still held. */
+    parent_read_release(tag);
+
     session = tag->session;
 
     /* tags should always have a session.  Release it. */
@@ -835,6 +1040,8 @@ void ab_tag_destroy(ab_tag_p tag) {
     if(session) {
         pdebug(DEBUG_DETAIL, "Removing tag from session.");
         pdebug(DEBUG_DETAIL, "rc_dec: Releasing session reference of tag %" PRId32 ".", tag->tag_id);
+        plc_tag_generic_leave_poll_planner((plc_tag_p)tag);
+        metrics_set_parent(&tag->metrics, &library_metrics);
         rc_dec(session);
         tag->session = NULL;
     } else {
@@ -861,6 +1068,18 @@ void ab_tag_destroy(ab_tag_p tag) {
         tag->byte_order = NULL;
     }
 
+    if(tag->snapshot_data) {
+        mem_free(tag->snapshot_data);
+        tag->snapshot_data = NULL;
+    }
+
+    if(tag->queued_reqs) {
+        mem_free(tag->queued_reqs);
+        tag->queued_reqs = NULL;
+    }
+
+    if(tag->process_image_slot) { tag->process_image_slot = rc_dec(tag->process_image_slot); }
+
     if(tag->data) {
         mem_free(tag->data);
         tag->data = NULL;
@@ -908,6 +1127,9 @@ int ab_get_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int default_va
                 break;
             default: pdebug(DEBUG_WARN, "Unsupported PLC type %d!", tag->plc_type); break;
         }
+    } else if(str_cmp_i_n(attrib_name, "conn_", 5) == 0 && tag->session
+              && metrics_get_int_attrib(&tag->session->metrics, attrib_name + 5, &res) == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_SPEW, "Got session metric %s.", attrib_name);
     } else {
         pdebug(DEBUG_WARN, "Unsupported attribute name \"%s\"!", attrib_name);
         tag->status = PLCTAG_ERR_UNSUPPORTED;
@@ -1070,6 +1292,9 @@ int check_tag_name(ab_tag_p tag, const char *name) {
                 return rc;
             }
 
+            /* transfers over more than one packet address each packet by element. */
+            tag->pccc_address = pccc_address;
+
             break;
 
         case AB_PLC_MICRO800:
@@ -1113,6 +1338,7 @@ int check_request_status(ab_tag_p tag) {
     int rc = PLCTAG_STATUS_OK;
     ab_request_p request = NULL;
     eip_encap *eip_header = NULL;
+    int nothing_in_flight = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -1146,6 +1372,7 @@ int check_request_status(ab_tag_p tag) {
                 pdebug(DEBUG_WARN, "A request was in progress, but no request in flight!");
             }
 
+            nothing_in_flight = 1;
             rc = PLCTAG_STATUS_OK;
             break;
         }
@@ -1205,7 +1432,8 @@ int check_request_status(ab_tag_p tag) {
         pdebug(DEBUG_INFO, "Response not OK with status %s.", plc_tag_decode_error(rc));
     }
 
-    tag->status = (int8_t)rc;
+    /* keep the status of the last operation, such as a failed write, until the next one starts. */
+    if(!nothing_in_flight) { tag->status = (int8_t)rc; }
 
     pdebug(DEBUG_SPEW, "Done.");
 
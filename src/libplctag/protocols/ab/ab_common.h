@@ -47,9 +47,13 @@ typedef struct ab_session_t *ab_session_p;
 typedef struct ab_request_t *ab_request_p;
 #define AB_REQUEST_NULL ((ab_request_p)NULL)
 
+typedef struct parent_read_group_t *parent_read_group_p;
+
 
 extern int ab_tag_abort_request_only(ab_tag_p tag);
 extern int ab_tag_abort_request(ab_tag_p tag);
+extern int ab_tag_queue_request(ab_tag_p tag, ab_request_p req);
+extern int ab_tag_next_request(ab_tag_p tag);
 extern int ab_tag_abort(ab_tag_p tag);
 extern int ab_tag_status(ab_tag_p tag);
 
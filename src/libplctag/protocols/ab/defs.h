@@ -52,6 +52,7 @@
 
 
 #define DEFAULT_MAX_REQUESTS (10)   /* number of requests and request sizes to allocate by default. */
+#define MAX_WRITE_FRAGS_IN_FLIGHT (8) /* fragments of one large write queued on the session at a time. */
 
 
 /* AB Constants*/
@@ -39,6 +39,7 @@
 #include <libplctag/protocols/ab/defs.h>
 #include <libplctag/protocols/ab/eip_cip.h>
 #include <libplctag/protocols/ab/error_codes.h>
+#include <libplctag/protocols/ab/parent_read.h>
 #include <libplctag/protocols/ab/session.h>
 #include <libplctag/protocols/ab/tag.h>
 #include <platform.h>
@@ -130,6 +131,7 @@ START_PACK typedef struct {
 static int build_read_request_connected(ab_tag_p tag, int byte_offset);
 // static int build_tag_list_request_connected(ab_tag_p tag);
 static int build_read_request_unconnected(ab_tag_p tag, int byte_offset);
+static int estimate_read_response_size(ab_tag_p tag, int byte_offset);
 static int build_write_request_connected(ab_tag_p tag, int byte_offset);
 static int build_write_request_unconnected(ab_tag_p tag, int byte_offset);
 static int build_write_bit_request_connected(ab_tag_p tag);
@@ -139,6 +141,7 @@ static int check_read_status_unconnected(ab_tag_p tag);
 static int check_write_status_connected(ab_tag_p tag);
 static int check_write_status_unconnected(ab_tag_p tag);
 static int calculate_write_data_per_packet(ab_tag_p tag);
+static int queue_write_requests(ab_tag_p tag);
 
 static int tag_read_start(plc_tag_p tag_arg);
 static int tag_tickler(plc_tag_p tag_arg);
@@ -209,6 +212,9 @@ int tag_tickler(plc_tag_p tag_arg) {
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    /* reads satisfied by the parent have no request of their own. */
+    if(tag->read_in_progress && tag->parent_read_pending) { return parent_read_check(tag); }
+
     rc = check_request_status(tag);
     if(rc != PLCTAG_STATUS_OK) { return rc; }
 
@@ -280,6 +286,12 @@ int tag_read_start(plc_tag_p tag_arg) {
         return PLCTAG_ERR_BUSY;
     }
 
+    /* try to piggyback on a read of the parent UDT. */
+    if(parent_read_start(tag) == PLCTAG_STATUS_PENDING) {
+        pdebug(DEBUG_INFO, "Done.  Waiting on parent read.");
+        return PLCTAG_STATUS_PENDING;
+    }
+
     /* mark the tag read in progress */
     tag->read_in_progress = 1;
 
@@ -350,15 +362,10 @@ int tag_write_start(plc_tag_p tag_arg) {
         return rc;
     }
 
-    if(tag->use_connected_msg) {
-        rc = build_write_request_connected(tag, tag->offset);
-    } else {
-        rc = build_write_request_unconnected(tag, tag->offset);
-    }
-
+    rc = queue_write_requests(tag);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to build write request!");
-        tag->write_in_progress = 0;
+        ab_tag_abort_request(tag);
 
         return rc;
     }
@@ -440,6 +447,10 @@ int build_read_request_connected(ab_tag_p tag, int byte_offset) {
 
     req->allow_packing = tag->allow_packing;
 
+    /* let the session pack by the size of the reply. */
+    req->is_read = 1;
+    req->response_size = estimate_read_response_size(tag, byte_offset);
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -577,6 +588,10 @@ int build_read_request_unconnected(ab_tag_p tag, int byte_offset) {
     /* allow packing if the tag allows it. */
     req->allow_packing = tag->allow_packing;
 
+    /* let the session pack by the size of the reply. */
+    req->is_read = 1;
+    req->response_size = estimate_read_response_size(tag, byte_offset);
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -595,6 +610,25 @@ int build_read_request_unconnected(ab_tag_p tag, int byte_offset) {
 }
 
 
+/*
+ * estimate_read_response_size
+ *
+ * The size of the reply to a fragmented read starting at byte_offset.  It
+ * is only known once the tag size is, either from the type given at creation
+ * or from an earlier read.  Returns zero if it is not known.
+ */
+
+int estimate_read_response_size(ab_tag_p tag, int byte_offset) {
+    /* the type info is two bytes, or four for a UDT, until we have seen it. */
+    int type_info_size = (tag->encoded_type_info_size > 0) ? tag->encoded_type_info_size : 4;
+
+    if(tag->size <= 0 || byte_offset >= tag->size) { return 0; }
+
+    /* service, reserved, status and extended status size, then the type and data. */
+    return 4 + type_info_size + (tag->size - byte_offset);
+}
+
+
 int build_write_bit_request_connected(ab_tag_p tag) {
     int rc = PLCTAG_STATUS_OK;
     eip_cip_co_req *cip = NULL;
@@ -729,6 +763,17 @@ int build_write_bit_request_connected(ab_tag_p tag) {
     /* allow packing if the tag allows it. */
     req->allow_packing = tag->allow_packing;
 
+    /* queued bit writes to the same integer can share one RMW. */
+    req->is_bit_write = 1;
+
+    /* save the request for later, behind any earlier fragments of this write. */
+    rc = ab_tag_queue_request(tag, req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to queue request! rc=%d", rc);
+        rc_dec(req);
+        return rc;
+    }
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -738,9 +783,6 @@ int build_write_bit_request_connected(ab_tag_p tag) {
         return rc;
     }
 
-    /* save the request for later */
-    tag->req = req;
-
     pdebug(DEBUG_INFO, "Done");
 
     return PLCTAG_STATUS_OK;
@@ -917,6 +959,17 @@ int build_write_bit_request_unconnected(ab_tag_p tag) {
     /* allow packing if the tag allows it. */
     req->allow_packing = tag->allow_packing;
 
+    /* queued bit writes to the same integer can share one RMW. */
+    req->is_bit_write = 1;
+
+    /* save the request for later, behind any earlier fragments of this write. */
+    rc = ab_tag_queue_request(tag, req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to queue request! rc=%d", rc);
+        rc_dec(req);
+        return rc;
+    }
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -926,9 +979,6 @@ int build_write_bit_request_unconnected(ab_tag_p tag) {
         return rc;
     }
 
-    /* save the request for later */
-    tag->req = req;
-
     pdebug(DEBUG_INFO, "Done");
 
     return PLCTAG_STATUS_OK;
@@ -961,7 +1011,8 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset) {
         return rc;
     }
 
-    if(tag->write_data_per_packet < tag->size) { multiple_requests = 1; }
+    /* the packet size can grow once the connection is up, a write that has started must stay fragmented. */
+    if(tag->write_data_per_packet < tag->size || byte_offset > 0) { multiple_requests = 1; }
 
     // if(multiple_requests && tag->plc_type == AB_PLC_OMRON_NJNX) {
     //     pdebug(DEBUG_WARN, "Tag too large for unfragmented request on Omron PLC!");
@@ -1064,6 +1115,14 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset) {
     /* allow packing if the tag allows it. */
     req->allow_packing = tag->allow_packing;
 
+    /* save the request for later, behind any earlier fragments of this write. */
+    rc = ab_tag_queue_request(tag, req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to queue request! rc=%d", rc);
+        rc_dec(req);
+        return rc;
+    }
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -1073,9 +1132,6 @@ int build_write_request_connected(ab_tag_p tag, int byte_offset) {
         return rc;
     }
 
-    /* save the request for later */
-    tag->req = req;
-
     pdebug(DEBUG_INFO, "Done");
 
     return PLCTAG_STATUS_OK;
@@ -1110,7 +1166,8 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset) {
         return rc;
     }
 
-    if(tag->write_data_per_packet < tag->size) { multiple_requests = 1; }
+    /* the packet size can grow once the connection is up, a write that has started must stay fragmented. */
+    if(tag->write_data_per_packet < tag->size || byte_offset > 0) { multiple_requests = 1; }
 
     // if(multiple_requests && tag->plc_type == AB_PLC_OMRON_NJNX) {
     //     pdebug(DEBUG_WARN, "Tag too large for unfragmented request on Omron PLC!");
@@ -1248,6 +1305,14 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset) {
     /* allow packing if the tag allows it. */
     req->allow_packing = tag->allow_packing;
 
+    /* save the request for later, behind any earlier fragments of this write. */
+    rc = ab_tag_queue_request(tag, req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to queue request! rc=%d", rc);
+        rc_dec(req);
+        return rc;
+    }
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, req);
 
@@ -1257,9 +1322,6 @@ int build_write_request_unconnected(ab_tag_p tag, int byte_offset) {
         return rc;
     }
 
-    /* save the request for later */
-    tag->req = req;
-
     pdebug(DEBUG_INFO, "Done");
 
     return PLCTAG_STATUS_OK;
@@ -1410,6 +1472,9 @@ static int check_read_status_connected(ab_tag_p tag) {
         } else {
             tag->offset = 0;
 
+            /* a complete read gives the full type, share it with later tags of the same name. */
+            if(!tag->pre_write_read) { session_cache_type(tag->session, tag); }
+
             /* if this is a pre-read for a write, then pass off to the write routine */
             if(tag->pre_write_read) {
                 pdebug(DEBUG_DETAIL, "Restarting write call now.");
@@ -1571,6 +1636,9 @@ static int check_read_status_unconnected(ab_tag_p tag) {
         } else {
             tag->offset = 0;
 
+            /* a complete read gives the full type, share it with later tags of the same name. */
+            if(!tag->pre_write_read) { session_cache_type(tag->session, tag); }
+
             /* if this is a pre-read for a write, then pass off to the write routine */
             if(tag->pre_write_read) {
                 pdebug(DEBUG_DETAIL, "Restarting write call now.");
@@ -1631,23 +1699,23 @@ static int check_write_status_connected(ab_tag_p tag) {
         }
     } while(0);
 
-    ab_tag_abort_request_only(tag);
-
     if(rc == PLCTAG_STATUS_OK) {
-        if(tag->offset < tag->size) {
+        /* move on to the next fragment and top up the ones in flight. */
+        ab_tag_next_request(tag);
 
-            pdebug(DEBUG_DETAIL, "Write not complete, triggering next round.");
-            rc = tag_write_start((plc_tag_p)tag);
-        } else {
-            /* only clear this if we are done. */
-            tag->offset = 0;
-        }
-    } else {
-        pdebug(DEBUG_WARN, "Write failed!");
+        rc = queue_write_requests(tag);
 
-        tag->offset = 0;
+        if(rc == PLCTAG_STATUS_OK && tag->req) {
+            pdebug(DEBUG_DETAIL, "Write not complete, waiting for the next fragment.");
+            return PLCTAG_STATUS_PENDING;
+        }
     }
 
+    if(rc != PLCTAG_STATUS_OK) { pdebug(DEBUG_WARN, "Write failed!"); }
+
+    /* done, or failed and the fragments not yet sent must not go out. */
+    ab_tag_abort_request(tag);
+
     pdebug(DEBUG_SPEW, "Done.");
 
     return rc;
@@ -1666,7 +1734,7 @@ static int check_write_status_unconnected(ab_tag_p tag) {
     cip_resp = (eip_cip_uc_resp *)(tag->req->data);
 
     do {
-        if(le2h16(cip_resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+        if(le2h16(cip_resp->encap_command) != AB_EIP_UNCONNECTED_SEND) {
             pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", cip_resp->encap_command);
             rc = PLCTAG_ERR_BAD_DATA;
             break;
@@ -1696,28 +1764,62 @@ static int check_write_status_unconnected(ab_tag_p tag) {
         }
     } while(0);
 
-    ab_tag_abort_request_only(tag);
-
     if(rc == PLCTAG_STATUS_OK) {
-        if(tag->offset < tag->size) {
+        /* move on to the next fragment and top up the ones in flight. */
+        ab_tag_next_request(tag);
 
-            pdebug(DEBUG_DETAIL, "Write not complete, triggering next round.");
-            rc = tag_write_start((plc_tag_p)tag);
-        } else {
-            /* only clear this if we are done. */
-            tag->offset = 0;
+        rc = queue_write_requests(tag);
+
+        if(rc == PLCTAG_STATUS_OK && tag->req) {
+            pdebug(DEBUG_DETAIL, "Write not complete, waiting for the next fragment.");
+            return PLCTAG_STATUS_PENDING;
         }
-    } else {
-        pdebug(DEBUG_WARN, "Write failed!");
-        tag->offset = 0;
     }
 
+    if(rc != PLCTAG_STATUS_OK) { pdebug(DEBUG_WARN, "Write failed!"); }
+
+    /* done, or failed and the fragments not yet sent must not go out. */
+    ab_tag_abort_request(tag);
+
     pdebug(DEBUG_SPEW, "Done.");
 
     return rc;
 }
 
 
+/*
+ * queue_write_requests
+ *
+ * Build write requests until all of the tag data is covered or the number of
+ * fragments in flight reaches MAX_WRITE_FRAGS_IN_FLIGHT.  Each fragment
+ * carries its own byte offset, so it does not need to wait for the reply to
+ * the one before it.  The session sends them in order.
+ */
+
+static int queue_write_requests(ab_tag_p tag) {
+    int rc = PLCTAG_STATUS_OK;
+
+    while(tag->offset < tag->size) {
+        int in_flight = (tag->req ? 1 : 0) + tag->num_queued_reqs - tag->next_queued_req;
+
+        if(in_flight >= MAX_WRITE_FRAGS_IN_FLIGHT) { break; }
+
+        if(tag->use_connected_msg) {
+            rc = build_write_request_connected(tag, tag->offset);
+        } else {
+            rc = build_write_request_unconnected(tag, tag->offset);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to build write request for byte offset %d!", tag->offset);
+            break;
+        }
+    }
+
+    return rc;
+}
+
+
 int calculate_write_data_per_packet(ab_tag_p tag) {
     int overhead = 0;
     int data_per_packet = 0;
@@ -316,6 +316,10 @@ int tag_read_start(ab_tag_p tag) {
     // req->send_request = 1;
     tag->req->allow_packing = tag->allow_packing;
 
+    /* service, status and requestor ID, the PCCC reply header, the type bytes and the data. */
+    tag->req->is_read = 1;
+    tag->req->response_size = 4 + 7 + 4 + 4 + tag->size;
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, tag->req);
 
@@ -617,6 +621,10 @@ int tag_write_start(ab_tag_p tag) {
     /* get ready to add the request to the queue for this session */
     tag->req->request_size = (int)(data - (tag->req->data));
 
+    /* service, status and requestor ID, then the PCCC reply header. */
+    tag->req->allow_packing = tag->allow_packing;
+    tag->req->response_size = 4 + 7 + 4;
+
     /* add the request to the session's list. */
     rc = session_add_request(tag->session, tag->req);
     if(rc != PLCTAG_STATUS_OK) {
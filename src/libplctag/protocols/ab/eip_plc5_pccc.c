@@ -84,6 +84,8 @@ tag_byte_order_t plc5_tag_byte_order = {.is_allocated = 0,
 
 static int check_read_status(ab_tag_p tag);
 static int check_write_status(ab_tag_p tag);
+static int build_read_request(ab_tag_p tag, int offset, int length, ab_request_p *request);
+static int build_write_request(ab_tag_p tag, int offset, int length, ab_request_p *request);
 
 START_PACK typedef struct {
     /* encap header */
@@ -197,15 +199,8 @@ int tag_tickler(ab_tag_p tag) {
 
 int tag_read_start(ab_tag_p tag) {
     int rc = PLCTAG_STATUS_OK;
-    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));
-    ;
     int overhead;
     int data_per_packet;
-    pccc_req *pccc;
-    uint8_t *data;
-    uint8_t *embed_start;
-    uint16_le transfer_offset = h2le16(0);
-    uint16_le transfer_size = h2le16(0);
 
     pdebug(DEBUG_INFO, "Starting");
 
@@ -217,12 +212,19 @@ int tag_read_start(ab_tag_p tag) {
     tag->read_in_progress = 1;
 
     /* What is the overhead in the _response_ */
-    overhead = 1    /* pccc command */
+    overhead = 4    /* CIP reply header */
+               + 7  /* PCCC requestor ID */
+               + 1  /* pccc command */
                + 1  /* pccc status */
                + 2; /* pccc sequence num */
 
     data_per_packet = session_get_max_payload(tag->session) - overhead;
 
+    /* the amount to read is one byte in the request and the transfer is in words. */
+    if(data_per_packet > 0xFE) { data_per_packet = 0xFE; }
+
+    data_per_packet &= ~1;
+
     if(data_per_packet <= 0) {
         pdebug(DEBUG_WARN, "Unable to send request.  Packet overhead, %d bytes, is too large for packet, %d bytes!", overhead,
                session_get_max_payload(tag->session));
@@ -231,22 +233,72 @@ int tag_read_start(ab_tag_p tag) {
     }
 
     if(data_per_packet < tag->size) {
-        pdebug(DEBUG_DETAIL, "Unable to send request: Tag size is %d, write overhead is %d, and write data per packet is %d!",
-               tag->size, overhead, data_per_packet);
-        tag->read_in_progress = 0;
-        return PLCTAG_ERR_TOO_LARGE;
+        pdebug(DEBUG_DETAIL, "Tag size is %d and read data per packet is %d, splitting the read into %d requests.", tag->size,
+               data_per_packet, (tag->size + data_per_packet - 1) / data_per_packet);
     }
 
+    tag->offset = 0;
+    tag->pccc_chunk_size = data_per_packet;
+
+    /* queue up all the requests at once so that they are sent back to back. */
+    for(int offset = 0; offset < tag->size && rc == PLCTAG_STATUS_OK; offset += data_per_packet) {
+        ab_request_p req = NULL;
+        int length = (tag->size - offset < data_per_packet ? tag->size - offset : data_per_packet);
+
+        rc = build_read_request(tag, offset, length, &req);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to build read request!  rc=%d", rc);
+            break;
+        }
+
+        rc = ab_tag_queue_request(tag, req);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to queue read request!  rc=%d", rc);
+            rc_dec(req);
+            break;
+        }
+
+        /* add the request to the session's list. */
+        rc = session_add_request(tag->session, req);
+        if(rc != PLCTAG_STATUS_OK) { pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc); }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        ab_tag_abort_request(tag);
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+/*
+ * build_read_request
+ *
+ * Build a range read of length bytes starting at offset bytes into the data file.
+ */
+
+static int build_read_request(ab_tag_p tag, int offset, int length, ab_request_p *request) {
+    int rc = PLCTAG_STATUS_OK;
+    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));
+    ab_request_p req = NULL;
+    pccc_req *pccc;
+    uint8_t *data;
+    uint8_t *embed_start;
+    uint16_le transfer_offset = h2le16(0);
+    uint16_le transfer_size = h2le16(0);
+
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &tag->req);
+    rc = session_create_request(tag->session, tag->tag_id, &req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to get new request.  rc=%d", rc);
-        tag->read_in_progress = 0;
         return rc;
     }
 
     /* point the struct pointers to the buffer*/
-    pccc = (pccc_req *)(tag->req->data);
+    pccc = (pccc_req *)(req->data);
 
     /* set up the embedded PCCC packet */
     embed_start = (uint8_t *)(&pccc->service_code);
@@ -269,14 +321,12 @@ int tag_read_start(ab_tag_p tag) {
     pccc->pccc_status = 0;                    /* STS 0 in request */
     pccc->pccc_seq_num = h2le16(conn_seq_id); /* FIXME - get sequence ID from session? */
     pccc->pccc_function = AB_EIP_PLC5_RANGE_READ_FUNC;
-    // pccc->pccc_transfer_offset = h2le16((uint16_t)0);
-    // pccc->pccc_transfer_size = h2le16((uint16_t)((tag->size)/2));  /* size in 2-byte words */
 
     /* point to the end of the struct */
     data = ((uint8_t *)pccc) + sizeof(pccc_req);
 
-    /* this kind of PCCC function takes an offset and size. */
-    transfer_offset = h2le16((uint16_t)0);
+    /* this kind of PCCC function takes an offset and size, both in 2-byte words. */
+    transfer_offset = h2le16((uint16_t)(offset / 2));
     mem_copy(data, &transfer_offset, (int)(unsigned int)sizeof(transfer_offset));
     data += sizeof(transfer_offset);
 
@@ -289,7 +339,7 @@ int tag_read_start(ab_tag_p tag) {
     data += tag->encoded_name_size;
 
     /* amount of data to get this time */
-    *data = (uint8_t)(tag->size); /* bytes for this transfer */
+    *data = (uint8_t)(length); /* bytes for this transfer */
     data++;
 
     /*
@@ -311,32 +361,25 @@ int tag_read_start(ab_tag_p tag) {
     pccc->cpf_udi_item_length = h2le16((uint16_t)(data - embed_start)); /* REQ: fill in with length of remaining data. */
 
     /* set the size of the request */
-    tag->req->request_size = (int)(data - (tag->req->data));
-
-    /* mark it as ready to send */
-    // req->send_request = 1;
-
-    /* add the request to the session's list. */
-    rc = session_add_request(tag->session, tag->req);
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
+    req->request_size = (int)(data - (req->data));
 
-        ab_tag_abort_request(tag);
-
-        return rc;
-    }
+    /* service, status and requestor ID, then the PCCC reply header and the data. */
+    req->allow_packing = tag->allow_packing;
+    req->is_read = 1;
+    req->response_size = 4 + 7 + 4 + length;
 
-    pdebug(DEBUG_INFO, "Done.");
+    *request = req;
 
-    return PLCTAG_STATUS_PENDING;
+    return PLCTAG_STATUS_OK;
 }
 
 
 /*
  * check_read_status
  *
- * NOTE that we can have only one outstanding request because PCCC
- * does not support fragments.
+ * PCCC does not support fragments.  Larger transfers are split into
+ * several requests that are all in flight at once.  They complete in
+ * order, so each response goes at the current offset.
  */
 
 
@@ -345,9 +388,12 @@ static int check_read_status(ab_tag_p tag) {
     uint8_t *data;
     uint8_t *data_end;
     int rc = PLCTAG_STATUS_OK;
+    int length = tag->size - tag->offset;
 
     pdebug(DEBUG_SPEW, "Starting");
 
+    if(length > tag->pccc_chunk_size) { length = tag->pccc_chunk_size; }
+
     /* the request reference is valid. */
 
     pccc = (pccc_resp *)(tag->req->data);
@@ -375,13 +421,13 @@ static int check_read_status(ab_tag_p tag) {
         }
 
         /* did we get the right amount of data? */
-        if((data_end - data) != tag->size) {
-            if((int)(data_end - data) > tag->size) {
-                pdebug(DEBUG_WARN, "Too much data received!  Expected %d bytes but got %d bytes!", tag->size,
+        if((data_end - data) != length) {
+            if((int)(data_end - data) > length) {
+                pdebug(DEBUG_WARN, "Too much data received!  Expected %d bytes but got %d bytes!", length,
                        (int)(data_end - data));
                 rc = PLCTAG_ERR_TOO_LARGE;
             } else {
-                pdebug(DEBUG_WARN, "Too little data received!  Expected %d bytes but got %d bytes!", tag->size,
+                pdebug(DEBUG_WARN, "Too little data received!  Expected %d bytes but got %d bytes!", length,
                        (int)(data_end - data));
                 rc = PLCTAG_ERR_TOO_SMALL;
             }
@@ -389,7 +435,15 @@ static int check_read_status(ab_tag_p tag) {
         }
 
         /* copy data into the tag. */
-        mem_copy(tag->data, data, (int)(data_end - data));
+        mem_copy(tag->data + tag->offset, data, length);
+
+        tag->offset += length;
+
+        /* more of the transfer to come? */
+        if(tag->offset < tag->size && ab_tag_next_request(tag) == PLCTAG_STATUS_PENDING) {
+            pdebug(DEBUG_DETAIL, "Read %d of %d bytes.", tag->offset, tag->size);
+            return PLCTAG_STATUS_PENDING;
+        }
 
         rc = PLCTAG_STATUS_OK;
     } while(0);
@@ -405,14 +459,7 @@ static int check_read_status(ab_tag_p tag) {
 
 int tag_write_start(ab_tag_p tag) {
     int rc = PLCTAG_STATUS_OK;
-    pccc_req *pccc;
-    uint8_t *data;
-    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));
-    ;
-    uint8_t *embed_start;
     int overhead, data_per_packet;
-    uint16_le transfer_offset = h2le16((uint16_t)0);
-    uint16_le transfer_size = h2le16((uint16_t)0);
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -424,7 +471,9 @@ int tag_write_start(ab_tag_p tag) {
     tag->write_in_progress = 1;
 
     /* How much overhead? */
-    overhead = 1                             /* pccc command */
+    overhead = 6                             /* CIP service and path */
+               + 7                           /* PCCC requestor ID */
+               + 1                           /* pccc command */
                + 1                           /* pccc status */
                + 2                           /* pccc sequence num */
                + 1                           /* pccc function */
@@ -434,6 +483,9 @@ int tag_write_start(ab_tag_p tag) {
 
     data_per_packet = session_get_max_payload(tag->session) - overhead;
 
+    /* the transfer is in words. */
+    data_per_packet &= ~1;
+
     if(data_per_packet <= 0) {
         pdebug(DEBUG_WARN, "Unable to send request.  Packet overhead, %d bytes, is too large for packet, %d bytes!", overhead,
                session_get_max_payload(tag->session));
@@ -442,31 +494,92 @@ int tag_write_start(ab_tag_p tag) {
     }
 
     if(data_per_packet < tag->size) {
-        pdebug(DEBUG_DETAIL, "Tag size is %d, write overhead is %d, and write data per packet is %d.",
-               session_get_max_payload(tag->session), overhead, data_per_packet);
-        tag->write_in_progress = 0;
-        return PLCTAG_ERR_TOO_LARGE;
+        /* a bit write is a single read-modify-write, it cannot be split. */
+        if(tag->is_bit) {
+            pdebug(DEBUG_DETAIL, "Tag size is %d, write overhead is %d, and write data per packet is %d.",
+                   session_get_max_payload(tag->session), overhead, data_per_packet);
+            tag->write_in_progress = 0;
+            return PLCTAG_ERR_TOO_LARGE;
+        }
+
+        pdebug(DEBUG_DETAIL, "Tag size is %d and write data per packet is %d, splitting the write into %d requests.",
+               tag->size, data_per_packet, (tag->size + data_per_packet - 1) / data_per_packet);
     }
 
+    tag->offset = 0;
+    tag->pccc_chunk_size = data_per_packet;
+
+    /* queue up all the requests at once so that they are sent back to back. */
+    for(int offset = 0; offset < tag->size && rc == PLCTAG_STATUS_OK; offset += data_per_packet) {
+        ab_request_p req = NULL;
+        int length = (tag->size - offset < data_per_packet ? tag->size - offset : data_per_packet);
+
+        rc = build_write_request(tag, offset, length, &req);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to build write request!  rc=%d", rc);
+            break;
+        }
+
+        rc = ab_tag_queue_request(tag, req);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to queue write request!  rc=%d", rc);
+            rc_dec(req);
+            break;
+        }
+
+        /* add the request to the session's list. */
+        rc = session_add_request(tag->session, req);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_ERROR, "Unable to add request to session! Error %s!", plc_tag_decode_error(rc));
+        }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        ab_tag_abort_request(tag);
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+/*
+ * build_write_request
+ *
+ * Build a range write of length bytes starting at offset bytes into the data
+ * file, or a read-modify-write for a bit tag.
+ */
+
+static int build_write_request(ab_tag_p tag, int offset, int length, ab_request_p *request) {
+    int rc = PLCTAG_STATUS_OK;
+    ab_request_p req = NULL;
+    pccc_req *pccc;
+    uint8_t *data;
+    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));
+    uint8_t *embed_start;
+    uint16_le transfer_offset = h2le16((uint16_t)0);
+    uint16_le transfer_size = h2le16((uint16_t)0);
+
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &tag->req);
+    rc = session_create_request(tag->session, tag->tag_id, &req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to get new request.  rc=%d", rc);
-        tag->write_in_progress = 0;
         return rc;
     }
 
-    pccc = (pccc_req *)(tag->req->data);
+    pccc = (pccc_req *)(req->data);
 
     /* set up the embedded PCCC packet */
     embed_start = (uint8_t *)(&pccc->service_code);
 
     /* point to the end of the struct */
-    data = (tag->req->data) + sizeof(pccc_req);
+    data = (req->data) + sizeof(pccc_req);
 
     /* this kind of PCCC function takes an offset and size.  Only if not a bit tag. */
     if(!tag->is_bit) {
-        transfer_offset = h2le16((uint16_t)0);
+        transfer_offset = h2le16((uint16_t)(offset / 2));
         mem_copy(data, &transfer_offset, (int)(unsigned int)sizeof(transfer_offset));
         data += sizeof(transfer_offset);
 
@@ -481,8 +594,8 @@ int tag_write_start(ab_tag_p tag) {
 
     /* now copy the data to write */
     if(!tag->is_bit) {
-        mem_copy(data, tag->data, tag->size);
-        data += tag->size;
+        mem_copy(data, tag->data + offset, length);
+        data += length;
     } else {
         /* AND/reset mask */
         for(int i = 0; i < tag->elem_size; i++) {
@@ -564,29 +677,23 @@ int tag_write_start(ab_tag_p tag) {
     pccc->pccc_seq_num = h2le16(conn_seq_id); /* FIXME - get sequence ID from session? */
     pccc->pccc_function = (tag->is_bit ? AB_EIP_PLC5_RMW_FUNC : AB_EIP_PLC5_RANGE_WRITE_FUNC);
 
-    /* get ready to add the request to the queue for this session */
-    tag->req->request_size = (int)(data - (tag->req->data));
-
-    /* add the request to the session's list. */
-    rc = session_add_request(tag->session, tag->req);
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to add request to session! Error %s!", plc_tag_decode_error(rc));
-
-        ab_tag_abort_request(tag);
+    req->request_size = (int)(data - (req->data));
 
-        return rc;
-    }
+    /* service, status and requestor ID, then the PCCC reply header. */
+    req->allow_packing = tag->allow_packing;
+    req->response_size = 4 + 7 + 4;
 
-    pdebug(DEBUG_INFO, "Done.");
+    *request = req;
 
-    return PLCTAG_STATUS_PENDING;
+    return PLCTAG_STATUS_OK;
 }
 
 
 /*
  * check_write_status
  *
- * Fragments are not supported.
+ * Fragments are not supported.  Larger writes are split into several
+ * requests, see check_read_status.
  */
 static int check_write_status(ab_tag_p tag) {
     pccc_resp *pccc;
@@ -626,6 +733,14 @@ static int check_write_status(ab_tag_p tag) {
             break;
         }
 
+        tag->offset += tag->pccc_chunk_size;
+
+        /* more of the transfer to come? */
+        if(tag->offset < tag->size && ab_tag_next_request(tag) == PLCTAG_STATUS_PENDING) {
+            pdebug(DEBUG_DETAIL, "Wrote %d of %d bytes.", tag->offset, tag->size);
+            return PLCTAG_STATUS_PENDING;
+        }
+
         rc = PLCTAG_STATUS_OK;
     } while(0);
 
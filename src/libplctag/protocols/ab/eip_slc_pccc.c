@@ -81,6 +81,10 @@ tag_byte_order_t slc_tag_byte_order = {.is_allocated = 0,
 
 static int check_read_status(ab_tag_p tag);
 static int check_write_status(ab_tag_p tag);
+static int get_chunk_size(ab_tag_p tag, int data_per_packet);
+static int encode_chunk_address(ab_tag_p tag, int offset, uint8_t *encoded_name, int *encoded_name_size);
+static int build_read_request(ab_tag_p tag, int offset, int length, ab_request_p *request);
+static int build_write_request(ab_tag_p tag, int offset, int length, ab_request_p *request);
 
 
 START_PACK typedef struct {
@@ -195,13 +199,8 @@ int tag_tickler(ab_tag_p tag) {
 
 int tag_read_start(ab_tag_p tag) {
     int rc = PLCTAG_STATUS_OK;
-    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));
-    ;
     int overhead;
     int data_per_packet;
-    pccc_req *pccc;
-    uint8_t *data;
-    uint8_t *embed_start;
 
     pdebug(DEBUG_INFO, "Starting");
 
@@ -212,40 +211,87 @@ int tag_read_start(ab_tag_p tag) {
 
     tag->read_in_progress = 1;
 
-    /* how many packets will we need? How much overhead? */
-    // overhead = sizeof(pccc_resp) + 4 + tag->encoded_name_size; /* MAGIC 4 = fudge */
-
     /* calculate based on the response. */
-    overhead = 1    /* PCCC CMD */
+    overhead = 4    /* CIP reply header */
+               + 7  /* PCCC requestor ID */
+               + 1  /* PCCC CMD */
                + 1  /* PCCC status */
                + 2; /* PCCC packet sequence number */
 
-    data_per_packet = session_get_max_payload(tag->session) - overhead;
+    data_per_packet = get_chunk_size(tag, session_get_max_payload(tag->session) - overhead);
 
     if(data_per_packet <= 0) {
-        pdebug(DEBUG_WARN, "Unable to send request.  Packet overhead, %d bytes, is too large for packet, %d bytes!", overhead,
-               session_get_max_payload(tag->session));
+        pdebug(DEBUG_WARN, "Unable to send request: Tag size is %d, read overhead is %d, and packet size is %d bytes!", tag->size,
+               overhead, session_get_max_payload(tag->session));
         tag->read_in_progress = 0;
         return PLCTAG_ERR_TOO_LARGE;
     }
 
-    if(data_per_packet < tag->size) {
-        pdebug(DEBUG_DETAIL, "Unable to send request: Tag size is %d, write overhead is %d, and write data per packet is %d!",
-               tag->size, overhead, data_per_packet);
-        tag->read_in_progress = 0;
-        return PLCTAG_ERR_TOO_LARGE;
+    tag->offset = 0;
+    tag->pccc_chunk_size = data_per_packet;
+
+    /* queue up all the requests at once so that they are sent back to back. */
+    for(int offset = 0; offset < tag->size && rc == PLCTAG_STATUS_OK; offset += data_per_packet) {
+        ab_request_p req = NULL;
+        int length = (tag->size - offset < data_per_packet ? tag->size - offset : data_per_packet);
+
+        rc = build_read_request(tag, offset, length, &req);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to build read request!  rc=%d", rc);
+            break;
+        }
+
+        rc = ab_tag_queue_request(tag, req);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to queue read request!  rc=%d", rc);
+            rc_dec(req);
+            break;
+        }
+
+        /* add the request to the session's list. */
+        rc = session_add_request(tag->session, req);
+        if(rc != PLCTAG_STATUS_OK) { pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc); }
     }
 
+    if(rc != PLCTAG_STATUS_OK) {
+        ab_tag_abort_request(tag);
+        return rc;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+/*
+ * build_read_request
+ *
+ * Build a range read of length bytes starting at offset bytes into the tag.
+ */
+
+static int build_read_request(ab_tag_p tag, int offset, int length, ab_request_p *request) {
+    int rc = PLCTAG_STATUS_OK;
+    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));
+    ab_request_p req = NULL;
+    pccc_req *pccc;
+    uint8_t *data;
+    uint8_t *embed_start;
+    uint8_t encoded_name[MAX_TAG_NAME];
+    int encoded_name_size = 0;
+
+    rc = encode_chunk_address(tag, offset, encoded_name, &encoded_name_size);
+    if(rc != PLCTAG_STATUS_OK) { return rc; }
+
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &tag->req);
+    rc = session_create_request(tag->session, tag->tag_id, &req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to get new request.  rc=%d", rc);
-        tag->read_in_progress = 0;
         return rc;
     }
 
     /* point the struct pointers to the buffer*/
-    pccc = (pccc_req *)(tag->req->data);
+    pccc = (pccc_req *)(req->data);
 
     /* point to the end of the struct */
     data = ((uint8_t *)pccc) + sizeof(pccc_req);
@@ -254,8 +300,8 @@ int tag_read_start(ab_tag_p tag) {
     embed_start = (uint8_t *)(&pccc->service_code);
 
     /* copy encoded tag name into the request */
-    mem_copy(data, tag->encoded_name, tag->encoded_name_size);
-    data += tag->encoded_name_size;
+    mem_copy(data, encoded_name, encoded_name_size);
+    data += encoded_name_size;
 
     /* fill in the fixed fields. */
 
@@ -290,7 +336,7 @@ int tag_read_start(ab_tag_p tag) {
     pccc->pccc_status = 0; /* STS 0 in request */
     pccc->pccc_seq_num = h2le16(conn_seq_id);
     pccc->pccc_function = AB_EIP_SLC_RANGE_READ_FUNC;
-    pccc->pccc_transfer_size = (uint8_t)(tag->elem_size * tag->elem_count); /* size to read/write in bytes. */
+    pccc->pccc_transfer_size = (uint8_t)(length); /* size to read/write in bytes. */
 
     /*
      * after the embedded packet, we need to tell the message router
@@ -298,32 +344,25 @@ int tag_read_start(ab_tag_p tag) {
      */
 
     /* set the size of the request */
-    tag->req->request_size = (int)(data - (tag->req->data));
-
-    /* mark it as ready to send */
-    // req->send_request = 1;
+    req->request_size = (int)(data - (req->data));
 
-    /* add the request to the session's list. */
-    rc = session_add_request(tag->session, tag->req);
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
-
-        ab_tag_abort_request(tag);
-
-        return rc;
-    }
+    /* service, status and requestor ID, then the PCCC reply header and the data. */
+    req->allow_packing = tag->allow_packing;
+    req->is_read = 1;
+    req->response_size = 4 + 7 + 4 + length;
 
-    pdebug(DEBUG_INFO, "Done.");
+    *request = req;
 
-    return PLCTAG_STATUS_PENDING;
+    return PLCTAG_STATUS_OK;
 }
 
 
 /*
  * check_read_status
  *
- * NOTE that we can have only one outstanding request because PCCC
- * does not support fragments.
+ * PCCC does not support fragments.  Larger transfers are split into
+ * several requests that are all in flight at once.  They complete in
+ * order, so each response goes at the current offset.
  */
 
 
@@ -332,9 +371,12 @@ static int check_read_status(ab_tag_p tag) {
     uint8_t *data;
     uint8_t *data_end;
     int rc = PLCTAG_STATUS_OK;
+    int length = tag->size - tag->offset;
 
     pdebug(DEBUG_SPEW, "Starting");
 
+    if(length > tag->pccc_chunk_size) { length = tag->pccc_chunk_size; }
+
     /* the request reference is valid. */
 
     pccc = (pccc_resp *)(tag->req->data);
@@ -373,13 +415,13 @@ static int check_read_status(ab_tag_p tag) {
         }
 
         /* did we get the right amount of data? */
-        if((data_end - data) != tag->size) {
-            if((int)(data_end - data) > tag->size) {
-                pdebug(DEBUG_WARN, "Too much data received!  Expected %d bytes but got %d bytes!", tag->size,
+        if((data_end - data) != length) {
+            if((int)(data_end - data) > length) {
+                pdebug(DEBUG_WARN, "Too much data received!  Expected %d bytes but got %d bytes!", length,
                        (int)(data_end - data));
                 rc = PLCTAG_ERR_TOO_LARGE;
             } else {
-                pdebug(DEBUG_WARN, "Too little data received!  Expected %d bytes but got %d bytes!", tag->size,
+                pdebug(DEBUG_WARN, "Too little data received!  Expected %d bytes but got %d bytes!", length,
                        (int)(data_end - data));
                 rc = PLCTAG_ERR_TOO_SMALL;
             }
@@ -387,7 +429,15 @@ static int check_read_status(ab_tag_p tag) {
         }
 
         /* copy data into the tag. */
-        mem_copy(tag->data, data, (int)(data_end - data));
+        mem_copy(tag->data + tag->offset, data, length);
+
+        tag->offset += length;
+
+        /* more of the transfer to come? */
+        if(tag->offset < tag->size && ab_tag_next_request(tag) == PLCTAG_STATUS_PENDING) {
+            pdebug(DEBUG_DETAIL, "Read %d of %d bytes.", tag->offset, tag->size);
+            return PLCTAG_STATUS_PENDING;
+        }
 
         rc = PLCTAG_STATUS_OK;
     } while(0);
@@ -405,10 +455,6 @@ static int check_read_status(ab_tag_p tag) {
 
 int tag_write_start(ab_tag_p tag) {
     int rc = PLCTAG_STATUS_OK;
-    pccc_req *pccc;
-    uint8_t *data;
-    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));
-    uint8_t *embed_start;
     int overhead, data_per_packet;
 
     pdebug(DEBUG_INFO, "Starting.");
@@ -421,7 +467,9 @@ int tag_write_start(ab_tag_p tag) {
     tag->write_in_progress = 1;
 
     /* overhead comes from the request*/
-    overhead = 1   /* PCCC command */
+    overhead = 6   /* CIP service and path */
+               + 7 /* PCCC requestor ID */
+               + 1 /* PCCC command */
                + 1 /* PCCC status */
                + 2 /* PCCC sequence number */
                + 1 /* PCCC function */
@@ -430,39 +478,93 @@ int tag_write_start(ab_tag_p tag) {
 
     data_per_packet = session_get_max_payload(tag->session) - overhead;
 
+    /* the element number in a later packet may take two more bytes to encode. */
+    if(data_per_packet < tag->size) { data_per_packet -= 2; }
+
+    data_per_packet = get_chunk_size(tag, data_per_packet);
+
     if(data_per_packet <= 0) {
-        pdebug(DEBUG_WARN, "Unable to send request.  Packet overhead, %d bytes, is too large for packet, %d bytes!", overhead,
-               session_get_max_payload(tag->session));
+        pdebug(DEBUG_WARN, "Unable to send request: Tag size is %d, write overhead is %d, and packet size is %d bytes!",
+               tag->size, overhead, session_get_max_payload(tag->session));
         tag->write_in_progress = 0;
         return PLCTAG_ERR_TOO_LARGE;
     }
 
-    if(data_per_packet < tag->size) {
-        pdebug(DEBUG_DETAIL, "Tag size is %d, write overhead is %d, and write data per packet is %d.",
-               session_get_max_payload(tag->session), overhead, data_per_packet);
-        tag->write_in_progress = 0;
-        return PLCTAG_ERR_TOO_LARGE;
+    tag->offset = 0;
+    tag->pccc_chunk_size = data_per_packet;
+
+    /* queue up all the requests at once so that they are sent back to back. */
+    for(int offset = 0; offset < tag->size && rc == PLCTAG_STATUS_OK; offset += data_per_packet) {
+        ab_request_p req = NULL;
+        int length = (tag->size - offset < data_per_packet ? tag->size - offset : data_per_packet);
+
+        rc = build_write_request(tag, offset, length, &req);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to build write request!  rc=%d", rc);
+            break;
+        }
+
+        rc = ab_tag_queue_request(tag, req);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to queue write request!  rc=%d", rc);
+            rc_dec(req);
+            break;
+        }
+
+        /* add the request to the session's list. */
+        rc = session_add_request(tag->session, req);
+        if(rc != PLCTAG_STATUS_OK) { pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc); }
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        ab_tag_abort_request(tag);
+        return rc;
     }
 
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_PENDING;
+}
+
+
+/*
+ * build_write_request
+ *
+ * Build a range write of length bytes starting at offset bytes into the tag,
+ * or a masked bit write for a bit tag.
+ */
+
+static int build_write_request(ab_tag_p tag, int offset, int length, ab_request_p *request) {
+    int rc = PLCTAG_STATUS_OK;
+    ab_request_p req = NULL;
+    pccc_req *pccc;
+    uint8_t *data;
+    uint16_t conn_seq_id = (uint16_t)(session_get_new_seq_id(tag->session));
+    uint8_t *embed_start;
+    uint8_t encoded_name[MAX_TAG_NAME];
+    int encoded_name_size = 0;
+
+    rc = encode_chunk_address(tag, offset, encoded_name, &encoded_name_size);
+    if(rc != PLCTAG_STATUS_OK) { return rc; }
+
     /* get a request buffer */
-    rc = session_create_request(tag->session, tag->tag_id, &tag->req);
+    rc = session_create_request(tag->session, tag->tag_id, &req);
     if(rc != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to get new request.  rc=%d", rc);
-        tag->write_in_progress = 0;
         return rc;
     }
 
-    pccc = (pccc_req *)(tag->req->data);
+    pccc = (pccc_req *)(req->data);
 
     /* set up the embedded PCCC packet */
     embed_start = (uint8_t *)(&pccc->service_code);
 
     /* point to the end of the struct */
-    data = (tag->req->data) + sizeof(pccc_req);
+    data = (req->data) + sizeof(pccc_req);
 
     /* copy encoded tag name into the request */
-    mem_copy(data, tag->encoded_name, tag->encoded_name_size);
-    data += tag->encoded_name_size;
+    mem_copy(data, encoded_name, encoded_name_size);
+    data += encoded_name_size;
 
     /* write the mask if this is a bit tag */
     if(tag->is_bit) {
@@ -485,8 +587,8 @@ int tag_write_start(ab_tag_p tag) {
     }
 
     /* now copy the data to write */
-    mem_copy(data, tag->data, tag->size);
-    data += tag->size;
+    mem_copy(data, tag->data + offset, length);
+    data += length;
 
     /* now fill in the rest of the structure. */
 
@@ -524,31 +626,25 @@ int tag_write_start(ab_tag_p tag) {
     pccc->pccc_status = 0;                    /* STS 0 in request */
     pccc->pccc_seq_num = h2le16(conn_seq_id); /* FIXME - get sequence ID from session? */
     pccc->pccc_function = (tag->is_bit ? AB_EIP_SLC_RANGE_BIT_WRITE_FUNC : AB_EIP_SLC_RANGE_WRITE_FUNC);
-    pccc->pccc_transfer_size = (uint8_t)(tag->size);
-
-    /* get ready to add the request to the queue for this session */
-    tag->req->request_size = (int)(data - (tag->req->data));
+    pccc->pccc_transfer_size = (uint8_t)(length);
 
-    /* add the request to the session's list. */
-    rc = session_add_request(tag->session, tag->req);
-    if(rc != PLCTAG_STATUS_OK) {
-        pdebug(DEBUG_ERROR, "Unable to add request to session! rc=%d", rc);
+    req->request_size = (int)(data - (req->data));
 
-        ab_tag_abort_request(tag);
+    /* service, status and requestor ID, then the PCCC reply header. */
+    req->allow_packing = tag->allow_packing;
+    req->response_size = 4 + 7 + 4;
 
-        return rc;
-    }
+    *request = req;
 
-    pdebug(DEBUG_INFO, "Done.");
-
-    return PLCTAG_STATUS_PENDING;
+    return PLCTAG_STATUS_OK;
 }
 
 
 /*
  * check_write_status
  *
- * Fragments are not supported.
+ * Fragments are not supported.  Larger writes are split into several
+ * requests, see check_read_status.
  */
 static int check_write_status(ab_tag_p tag) {
     pccc_resp *pccc;
@@ -588,6 +684,14 @@ static int check_write_status(ab_tag_p tag) {
             break;
         }
 
+        tag->offset += tag->pccc_chunk_size;
+
+        /* more of the transfer to come? */
+        if(tag->offset < tag->size && ab_tag_next_request(tag) == PLCTAG_STATUS_PENDING) {
+            pdebug(DEBUG_DETAIL, "Wrote %d of %d bytes.", tag->offset, tag->size);
+            return PLCTAG_STATUS_PENDING;
+        }
+
         rc = PLCTAG_STATUS_OK;
     } while(0);
 
@@ -599,3 +703,55 @@ static int check_write_status(ab_tag_p tag) {
     /* Success! */
     return rc;
 }
+
+
+/*
+ * get_chunk_size
+ *
+ * Find how many bytes of the tag go in each request.  Larger tags are split
+ * on element boundaries and each packet addresses its first element, so
+ * bit and sub-element tags must fit in one packet.
+ */
+
+static int get_chunk_size(ab_tag_p tag, int data_per_packet) {
+    /* the transfer size is a single byte. */
+    if(data_per_packet > 0xFF) { data_per_packet = 0xFF; }
+
+    if(data_per_packet >= tag->size) { return tag->size; }
+
+    if(tag->is_bit || tag->pccc_address.sub_element > 0 || tag->elem_size <= 0) {
+        pdebug(DEBUG_DETAIL, "Tag of %d bytes cannot be split into %d byte packets.", tag->size, data_per_packet);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    data_per_packet = (data_per_packet / tag->elem_size) * tag->elem_size;
+
+    if(data_per_packet <= 0) { return PLCTAG_ERR_TOO_LARGE; }
+
+    pdebug(DEBUG_DETAIL, "Tag size is %d and data per packet is %d, splitting the transfer into %d requests.", tag->size,
+           data_per_packet, (tag->size + data_per_packet - 1) / data_per_packet);
+
+    return data_per_packet;
+}
+
+
+/*
+ * encode_chunk_address
+ *
+ * The first packet uses the tag address.  Later ones start at the element
+ * that is offset bytes into the tag.
+ */
+
+static int encode_chunk_address(ab_tag_p tag, int offset, uint8_t *encoded_name, int *encoded_name_size) {
+    pccc_addr_t address = tag->pccc_address;
+
+    if(offset == 0) {
+        mem_copy(encoded_name, tag->encoded_name, tag->encoded_name_size);
+        *encoded_name_size = tag->encoded_name_size;
+        return PLCTAG_STATUS_OK;
+    }
+
+    address.element += offset / tag->elem_size;
+
+    return slc_encode_address(encoded_name, encoded_name_size, MAX_TAG_NAME, &address);
+}
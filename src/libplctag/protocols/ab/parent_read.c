@@ -0,0 +1,1581 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <libplctag/lib/libplctag.h>
+#include <libplctag/lib/tag.h>
+#include <libplctag/protocols/ab/ab_common.h>
+#include <libplctag/protocols/ab/defs.h>
+#include <libplctag/protocols/ab/parent_read.h>
+#include <libplctag/protocols/ab/session.h>
+#include <libplctag/protocols/ab/tag.h>
+#include <platform.h>
+#include <stdio.h>
+#include <utils/attr.h>
+#include <utils/debug.h>
+#include <utils/rc.h>
+#include <utils/vector.h>
+
+
+#define PARENT_OFFSET_UNRESOLVED (-1)
+#define PARENT_OFFSET_INELIGIBLE (-2)
+
+/* type word bits used by the tag listing and the UDT templates. */
+#define TYPE_IS_STRUCT ((uint16_t)0x8000)
+#define TYPE_UDT_ID_MASK ((uint16_t)0x0FFF)
+#define TYPE_BOOL ((uint16_t)0x00C1)
+
+/* each tag listing entry is 22 bytes followed by the name. */
+#define LISTING_ENTRY_HEADER_SIZE (22)
+
+/* the @udt tags have a 14-byte header, then 8 bytes per field, then the names. */
+#define UDT_HEADER_SIZE (14)
+#define UDT_FIELD_SIZE (8)
+
+typedef enum { PARENT_READ_UDT, PARENT_READ_ARRAY } parent_read_kind_t;
+typedef enum { PARENT_READ_LISTING, PARENT_READ_RESOLVED, PARENT_READ_FAILED } parent_read_state_t;
+
+/* one entry of a controller tag listing. */
+struct parent_read_symbol_t {
+    const char *name; /* points into the listing data, not terminated. */
+    int name_len;
+    uint32_t instance_id;
+    uint16_t type;
+};
+
+/*
+ * A controller tag listing (@tags or Program:Main.@tags), read once and shared by all
+ * the groups of the session that look up their parents in it.  Only the session thread
+ * adds and removes listings, under the session's listing mutex.  The listings are
+ * dropped when the session reconnects.
+ *
+ * The internal tag of a listing holds the session.  The session thread only destroys it
+ * while some group is left, so that it is never the one letting go of the last
+ * reference.  The last member out of the last group destroys it instead.
+ */
+struct parent_read_listing_t {
+    char *name;
+    int status; /* PLCTAG_STATUS_PENDING while the listing is being read. */
+    int32_t tag_id;
+    uint8_t *data;
+    int num_symbols;
+    struct parent_read_symbol_t *symbols;
+};
+
+struct parent_read_template_t {
+    uint16_t id;
+    int pending;   /* the read of the template has not finished. */
+    int size;
+    uint8_t *data; /* NULL if the template could not be read. */
+};
+
+/*
+ * Member tags only change the state of the group under the group mutex.  The internal
+ * tags are created, read and destroyed by the session thread with no other lock held
+ * than the service mutex, so that no library lock is ever taken under a member's API
+ * mutex or the group mutex.
+ */
+struct parent_read_group_t {
+    /* not a reference, every member tag holds the session. */
+    ab_session_p session;
+    mutex_p mutex;
+    mutex_p service_mutex;
+
+    /* the member tags, not references.  The session's list holds a reference until the last one leaves. */
+    vector_p members;
+    int retired;
+
+    parent_read_kind_t kind;
+    char *parent_name;
+    char *symbol_name;
+    char *listing_name;
+    char *attrib_prefix;
+
+    /* finding the template of the parent. */
+    parent_read_state_t state;
+    int listing_requested;
+    int listing_wanted;
+    uint16_t root_template_id;
+
+    /* templates are read one at a time as members need them. */
+    int num_templates;
+    struct parent_read_template_t templates[PARENT_READ_MAX_TEMPLATES];
+
+    /* array elements wanted by the members. */
+    int elem_size;
+    int range_first;
+    int range_count;
+
+    /* reads of the parent, counted so that members only take data read after they asked. */
+    int parent_read_in_flight;
+    int parent_read_wanted;
+    uint64_t issued_gen;
+    uint64_t done_gen;
+    int last_status;
+
+    /* bytes from the last good read, data_offset is where they start in the parent. */
+    uint8_t *data;
+    int data_size;
+    int data_capacity;
+    int data_offset;
+
+    /* only used by the session thread. */
+    int listing_pending;
+    int32_t template_tag_id;
+    int template_index;
+    int32_t parent_tag_id;
+    int parent_read_started;
+    int read_first;
+    int read_count;
+    uint8_t *read_buf;
+    int read_buf_capacity;
+};
+
+
+static void parent_read_group_destroy(void *group_arg);
+static void retire_group(parent_read_group_p group);
+static int add_member_unsafe(parent_read_group_p group, ab_tag_p tag);
+static void remove_member_unsafe(parent_read_group_p group, ab_tag_p tag);
+static int split_name(const char *name, char **parent_name, char **symbol_name, char **listing_name, char **member_path);
+static int split_array_name(const char *name, char **parent_name, int *index);
+static char *dup_substring(const char *str, int len);
+static char *make_attrib_prefix(attr attribs);
+static int32_t create_internal_tag(parent_read_group_p group, const char *name, int elem_count);
+static void internal_tag_callback(int32_t tag_id, int event, int status, void *userdata);
+static uint8_t *get_internal_tag_data(int32_t tag_id, int *size);
+static void service_group(parent_read_group_p group);
+static void service_listings(ab_session_p session);
+static void abandon_listings(ab_session_p session);
+static struct parent_read_listing_t *get_listing_unsafe(parent_read_group_p group);
+static void free_listing(struct parent_read_listing_t *listing);
+static void find_root_template(parent_read_group_p group);
+static void service_template(parent_read_group_p group);
+static void start_parent_read(parent_read_group_p group, int first, int count);
+static void service_parent_read(parent_read_group_p group);
+static void finish_parent_read(parent_read_group_p group, int rc);
+static int parse_listing(struct parent_read_listing_t *listing, int size);
+static struct parent_read_symbol_t *find_symbol(struct parent_read_listing_t *listing, const char *name);
+static struct parent_read_template_t *find_template_unsafe(parent_read_group_p group, uint16_t template_id);
+static void resolve_member_unsafe(parent_read_group_p group, ab_tag_p tag);
+static void resolve_element_unsafe(parent_read_group_p group, ab_tag_p tag);
+static void update_range_unsafe(parent_read_group_p group);
+static int find_field(struct parent_read_template_t *tmpl, const char *field_name, int field_name_len, uint16_t *field_type,
+                      uint32_t *field_offset);
+static uint16_t get_u16(const uint8_t *data, int offset);
+static uint32_t get_u32(const uint8_t *data, int offset);
+
+
+/*
+ * parent_read_setup
+ *
+ * Called when a Logix tag is created.  If the tag asked for it and the name is a
+ * plain member of a structure or a single array element, join or create the group
+ * for the parent.  Tags that do not qualify are left alone and read as usual.
+ */
+int parent_read_setup(ab_tag_p tag, attr attribs, const char *name) {
+    int rc = PLCTAG_STATUS_OK;
+    parent_read_group_p group = NULL;
+    ab_session_p session = tag->session;
+    char *parent_name = NULL;
+    char *symbol_name = NULL;
+    char *listing_name = NULL;
+    char *member_path = NULL;
+    int array_index = 0;
+    parent_read_kind_t kind = PARENT_READ_UDT;
+    int udt_parent_read = attr_get_int(attribs, "udt_parent_read", 0);
+    int array_parent_read = attr_get_int(attribs, "array_parent_read", 0);
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    tag->parent_offset = PARENT_OFFSET_INELIGIBLE;
+
+    if(!udt_parent_read && !array_parent_read) {
+        pdebug(DEBUG_DETAIL, "Parent reads not requested.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    /* the internal tags must land on the same session. */
+    if(!attr_get_int(attribs, "share_session", 1) || !session) {
+        pdebug(DEBUG_INFO, "Parent reads need a shared session.");
+        return PLCTAG_STATUS_OK;
+    }
+
+    if(array_parent_read && split_array_name(name, &parent_name, &array_index) == PLCTAG_STATUS_OK) {
+        kind = PARENT_READ_ARRAY;
+    } else if(!udt_parent_read || split_name(name, &parent_name, &symbol_name, &listing_name, &member_path) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_INFO, "Tag %s is not a plain UDT member or array element, it will be read on its own.", name);
+        return PLCTAG_STATUS_OK;
+    }
+
+    tag->parent_index = array_index;
+
+    critical_block(session->session_mutex) {
+        /* groups in the list always have members, the last member takes the group out under this mutex. */
+        for(int i = 0; i < vector_length(session->parent_read_groups); i++) {
+            parent_read_group_p tmp = vector_get(session->parent_read_groups, i);
+
+            if(tmp->kind == kind && str_cmp_i(tmp->parent_name, parent_name) == 0) {
+                group = rc_inc(tmp);
+
+                critical_block(group->mutex) { rc = add_member_unsafe(group, tag); }
+
+                break;
+            }
+        }
+
+        if(group) { break; }
+
+        group = (parent_read_group_p)rc_alloc((int)sizeof(struct parent_read_group_t), parent_read_group_destroy);
+        if(!group) {
+            pdebug(DEBUG_WARN, "Unable to allocate parent read group!");
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
+
+        group->session = session;
+        group->kind = kind;
+
+        /* arrays need no template, the element size comes from the members. */
+        group->state = (kind == PARENT_READ_ARRAY) ? PARENT_READ_RESOLVED : PARENT_READ_LISTING;
+        group->last_status = PLCTAG_STATUS_OK;
+        group->parent_name = parent_name;
+        group->symbol_name = symbol_name;
+        group->listing_name = listing_name;
+        parent_name = symbol_name = listing_name = NULL;
+
+        group->attrib_prefix = make_attrib_prefix(attribs);
+        if(!group->attrib_prefix) {
+            pdebug(DEBUG_WARN, "Unable to allocate attribute string!");
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
+
+        rc = mutex_create(&(group->mutex));
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to create parent read group mutex!");
+            break;
+        }
+
+        rc = mutex_create(&(group->service_mutex));
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to create parent read group service mutex!");
+            break;
+        }
+
+        group->members = vector_create(PARENT_READ_MIN_MEMBERS, PARENT_READ_INC_MEMBERS);
+        if(!group->members) {
+            pdebug(DEBUG_WARN, "Unable to allocate parent read group member list!");
+            rc = PLCTAG_ERR_NO_MEM;
+            break;
+        }
+
+        rc = add_member_unsafe(group, tag);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to add tag to parent read group!");
+            break;
+        }
+
+        rc = vector_insert(session->parent_read_groups, vector_length(session->parent_read_groups), group);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to add parent read group to session!");
+            break;
+        }
+
+        /* the session's reference. */
+        rc_inc(group);
+    }
+
+    if(parent_name) { mem_free(parent_name); }
+    if(symbol_name) { mem_free(symbol_name); }
+    if(listing_name) { mem_free(listing_name); }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error %s setting up parent read!", plc_tag_decode_error(rc));
+        if(group) { rc_dec(group); }
+        if(member_path) { mem_free(member_path); }
+        return rc;
+    }
+
+    tag->parent_group = group;
+    tag->parent_member = member_path;
+
+    /* other members look at the element when the range changes. */
+    critical_block(group->mutex) { tag->parent_offset = PARENT_OFFSET_UNRESOLVED; }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * parent_read_start
+ *
+ * Called with the tag API mutex held when a read starts.  Returns PLCTAG_STATUS_PENDING
+ * if the read will be satisfied by a read of the parent.  Anything else means the caller
+ * should read the tag itself.
+ */
+int parent_read_start(ab_tag_p tag) {
+    int rc = PLCTAG_ERR_UNSUPPORTED;
+    parent_read_group_p group = tag->parent_group;
+
+    if(!group || tag->parent_offset == PARENT_OFFSET_INELIGIBLE) { return PLCTAG_ERR_UNSUPPORTED; }
+
+    /* the first read sizes the tag, and partial or pre-write reads need the tag's own request. */
+    if(tag->first_read || tag->pre_write_read || tag->offset || !tag->data || tag->size <= 0) {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    critical_block(group->mutex) {
+        if(group->state == PARENT_READ_FAILED) { tag->parent_offset = PARENT_OFFSET_INELIGIBLE; }
+
+        if(tag->parent_offset == PARENT_OFFSET_UNRESOLVED) {
+            if(group->kind == PARENT_READ_ARRAY) {
+                resolve_element_unsafe(group, tag);
+            } else {
+                resolve_member_unsafe(group, tag);
+            }
+        }
+
+        if(tag->parent_offset < 0) {
+            /* still resolving or not possible. */
+            break;
+        }
+
+        /* a read already on the wire may have started before this request, wait for the next one. */
+        group->parent_read_wanted = 1;
+        tag->parent_read_gen = group->issued_gen + 1;
+        rc = PLCTAG_STATUS_PENDING;
+    }
+
+    /* the session thread does the work. */
+    cond_signal(group->session->session_wait_cond);
+
+    if(rc == PLCTAG_STATUS_PENDING) {
+        tag->read_in_progress = 1;
+        tag->parent_read_pending = 1;
+    }
+
+    pdebug(DEBUG_SPEW, "Done with status %s.", plc_tag_decode_error(rc));
+
+    return rc;
+}
+
+
+/*
+ * parent_read_check
+ *
+ * Called from the tickler while a parent read is pending for the tag.  Copies the
+ * member's bytes out of the saved parent data once a new enough read is done.
+ */
+int parent_read_check(ab_tag_p tag) {
+    int rc = PLCTAG_STATUS_PENDING;
+    parent_read_group_p group = tag->parent_group;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    critical_block(group->mutex) {
+        if(group->done_gen < tag->parent_read_gen) { break; }
+
+        rc = group->last_status;
+
+        if(rc == PLCTAG_STATUS_OK) {
+            int start = tag->parent_offset - group->data_offset;
+
+            if(start < 0 || start + tag->size > group->data_size) {
+                rc = PLCTAG_ERR_OUT_OF_BOUNDS;
+            } else {
+                mem_copy(tag->data, group->data + start, tag->size);
+            }
+        }
+    }
+
+    tag->status = (int8_t)rc;
+
+    if(rc != PLCTAG_STATUS_PENDING) {
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Parent read for tag %" PRId32 " failed with %s!", tag->tag_id, plc_tag_decode_error(rc));
+        }
+
+        tag->parent_read_pending = 0;
+        tag->read_in_progress = 0;
+        tag->read_complete = 1;
+    }
+
+    pdebug(DEBUG_SPEW, "Done with status %s.", plc_tag_decode_error(rc));
+
+    return rc;
+}
+
+
+/*
+ * parent_read_release
+ *
+ * Drop the tag's hold on its group.  The last member out takes the group off the
+ * session and gets rid of the internal tags.  This is called from the tag destructor,
+ * before the tag lets go of the session and without any tag locks held.
+ */
+void parent_read_release(ab_tag_p tag) {
+    parent_read_group_p group = tag->parent_group;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    tag->parent_read_pending = 0;
+
+    if(group) {
+        ab_session_p session = group->session;
+        int last = 0;
+        int last_group = 0;
+
+        critical_block(session->session_mutex) {
+            critical_block(group->mutex) {
+                remove_member_unsafe(group, tag);
+                last = (vector_length(group->members) == 0);
+            }
+
+            if(!last) { break; }
+
+            for(int i = 0; i < vector_length(session->parent_read_groups); i++) {
+                if(vector_get(session->parent_read_groups, i) == group) {
+                    vector_remove(session->parent_read_groups, i);
+                    break;
+                }
+            }
+
+            last_group = (vector_length(session->parent_read_groups) == 0);
+        }
+
+        if(last) {
+            retire_group(group);
+
+            /* the session's reference. */
+            rc_dec(group);
+        }
+
+        /* after the group is retired, it may have started a listing read. */
+        if(last_group) { abandon_listings(session); }
+
+        rc_dec(group);
+        tag->parent_group = NULL;
+    }
+
+    if(tag->parent_member) {
+        mem_free(tag->parent_member);
+        tag->parent_member = NULL;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+}
+
+
+/*
+ * parent_read_service
+ *
+ * Called by the session thread on every pass, with no locks held.  Creates, polls and
+ * destroys the internal tags of the session's groups.
+ */
+void parent_read_service(ab_session_p session) {
+    service_listings(session);
+
+    for(int i = 0;; i++) {
+        parent_read_group_p group = NULL;
+
+        critical_block(session->session_mutex) {
+            if(i < vector_length(session->parent_read_groups)) { group = rc_inc(vector_get(session->parent_read_groups, i)); }
+        }
+
+        if(!group) { break; }
+
+        critical_block(group->service_mutex) {
+            if(!group->retired) { service_group(group); }
+        }
+
+        /* the internal tags are already gone if this is the last reference. */
+        rc_dec(group);
+    }
+}
+
+
+/*
+ * parent_read_forget_listings
+ *
+ * Drop the tag listings of the session.  Called by the session thread when it
+ * reconnects, since the PLC may have been given a new program, and when the session
+ * is destroyed.  Groups still looking for their parent read the listing again.  A
+ * listing still being read is left to the last member if no group is left.
+ */
+void parent_read_forget_listings(ab_session_p session) {
+    if(!session->parent_read_listings || !session->parent_read_listings_mutex) { return; }
+
+    critical_block(session->parent_read_listings_mutex) {
+        int has_groups = 0;
+
+        critical_block(session->session_mutex) { has_groups = (vector_length(session->parent_read_groups) > 0); }
+
+        for(int i = vector_length(session->parent_read_listings) - 1; i >= 0; i--) {
+            struct parent_read_listing_t *listing = vector_get(session->parent_read_listings, i);
+
+            if(listing->tag_id > 0 && !has_groups) { continue; }
+
+            free_listing(vector_remove(session->parent_read_listings, i));
+        }
+    }
+}
+
+
+/***********************************************************************
+ ************************ Helper Functions *****************************
+ **********************************************************************/
+
+
+void parent_read_group_destroy(void *group_arg) {
+    parent_read_group_p group = (parent_read_group_p)group_arg;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!group) {
+        pdebug(DEBUG_WARN, "Null group pointer!");
+        return;
+    }
+
+    for(int i = 0; i < group->num_templates; i++) {
+        if(group->templates[i].data) { mem_free(group->templates[i].data); }
+    }
+
+    if(group->data) { mem_free(group->data); }
+    if(group->read_buf) { mem_free(group->read_buf); }
+    if(group->members) { vector_destroy(group->members); }
+
+    if(group->mutex) { mutex_destroy(&(group->mutex)); }
+    if(group->service_mutex) { mutex_destroy(&(group->service_mutex)); }
+
+    if(group->parent_name) { mem_free(group->parent_name); }
+    if(group->symbol_name) { mem_free(group->symbol_name); }
+    if(group->listing_name) { mem_free(group->listing_name); }
+    if(group->attrib_prefix) { mem_free(group->attrib_prefix); }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+/*
+ * retire_group
+ *
+ * The internal tags are ordinary library tags.  Waits for the session thread to be
+ * done with the group before destroying them.
+ */
+void retire_group(parent_read_group_p group) {
+    critical_block(group->service_mutex) {
+        group->retired = 1;
+
+        if(group->template_tag_id > 0) { plc_tag_destroy(group->template_tag_id); }
+        if(group->parent_tag_id > 0) { plc_tag_destroy(group->parent_tag_id); }
+
+        group->template_tag_id = 0;
+        group->parent_tag_id = 0;
+    }
+}
+
+
+int add_member_unsafe(parent_read_group_p group, ab_tag_p tag) {
+    return vector_insert(group->members, vector_length(group->members), tag);
+}
+
+
+/*
+ * remove_member_unsafe
+ *
+ * A leaving array element may have been the one holding the range open at either
+ * end.  The parent tag is replaced on the next read if the range got smaller.
+ */
+void remove_member_unsafe(parent_read_group_p group, ab_tag_p tag) {
+    for(int i = 0; i < vector_length(group->members); i++) {
+        if(vector_get(group->members, i) == tag) {
+            vector_remove(group->members, i);
+            break;
+        }
+    }
+
+    if(group->kind == PARENT_READ_ARRAY) { update_range_unsafe(group); }
+}
+
+
+/*
+ * split_name
+ *
+ * Split Program:Main.Motor[3].Drive.Speed into the parent (Program:Main.Motor[3]),
+ * the symbol to look for in the listing (Motor), the listing tag (Program:Main.@tags)
+ * and the member path (Drive.Speed).  Member paths with indexes or bit numbers are
+ * not handled.
+ */
+int split_name(const char *name, char **parent_name, char **symbol_name, char **listing_name, char **member_path) {
+    int name_len = str_length(name);
+    int prefix_len = 0;
+    int symbol_end = 0;
+    int root_end = 0;
+    int component_start = 0;
+
+    if(name_len <= 0) { return PLCTAG_ERR_BAD_PARAM; }
+
+    /* program tags are listed under their program. */
+    if(str_cmp_i_n(name, "Program:", str_length("Program:")) == 0) {
+        while(prefix_len < name_len && name[prefix_len] != '.') { prefix_len++; }
+
+        if(prefix_len >= name_len) { return PLCTAG_ERR_UNSUPPORTED; }
+
+        /* keep the dot. */
+        prefix_len++;
+    }
+
+    root_end = prefix_len;
+    while(root_end < name_len && name[root_end] != '.') { root_end++; }
+
+    /* must have a root and at least one member. */
+    if(root_end == prefix_len || root_end >= name_len - 1) { return PLCTAG_ERR_UNSUPPORTED; }
+
+    symbol_end = prefix_len;
+    while(symbol_end < root_end && name[symbol_end] != '[') { symbol_end++; }
+
+    if(symbol_end == prefix_len) { return PLCTAG_ERR_UNSUPPORTED; }
+
+    component_start = root_end + 1;
+    for(int i = component_start; i < name_len; i++) {
+        char c = name[i];
+
+        if(c == '.') {
+            if(i == component_start || i == name_len - 1) { return PLCTAG_ERR_UNSUPPORTED; }
+
+            component_start = i + 1;
+            continue;
+        }
+
+        /* bit numbers start with a digit. */
+        if(i == component_start && isdigit((unsigned char)c)) { return PLCTAG_ERR_UNSUPPORTED; }
+
+        if(!isalnum((unsigned char)c) && c != '_') { return PLCTAG_ERR_UNSUPPORTED; }
+    }
+
+    *parent_name = dup_substring(name, root_end);
+    *symbol_name = dup_substring(name + prefix_len, symbol_end - prefix_len);
+    *member_path = dup_substring(name + root_end + 1, name_len - root_end - 1);
+
+    if(prefix_len) {
+        char *prefix = dup_substring(name, prefix_len);
+
+        *listing_name = prefix ? str_concat(prefix, "@tags") : NULL;
+
+        if(prefix) { mem_free(prefix); }
+    } else {
+        *listing_name = str_dup("@tags");
+    }
+
+    if(!*parent_name || !*symbol_name || !*member_path || !*listing_name) {
+        if(*parent_name) { mem_free(*parent_name); }
+        if(*symbol_name) { mem_free(*symbol_name); }
+        if(*member_path) { mem_free(*member_path); }
+        if(*listing_name) { mem_free(*listing_name); }
+
+        *parent_name = *symbol_name = *member_path = *listing_name = NULL;
+
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * split_array_name
+ *
+ * Split Program:Main.Data[7] into the array (Program:Main.Data) and the index.
+ * Only single dimension element tags are handled.
+ */
+int split_array_name(const char *name, char **parent_name, int *index) {
+    int name_len = str_length(name);
+    int base_start = 0;
+    int bracket = 0;
+    int64_t value = 0;
+
+    if(name_len < 4 || name[name_len - 1] != ']') { return PLCTAG_ERR_UNSUPPORTED; }
+
+    if(str_cmp_i_n(name, "Program:", str_length("Program:")) == 0) {
+        while(base_start < name_len && name[base_start] != '.') { base_start++; }
+
+        base_start++;
+    }
+
+    bracket = base_start;
+    while(bracket < name_len && (isalnum((unsigned char)name[bracket]) || name[bracket] == '_')) { bracket++; }
+
+    if(bracket == base_start || bracket >= name_len || name[bracket] != '[' || bracket + 1 >= name_len - 1) {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    for(int i = bracket + 1; i < name_len - 1; i++) {
+        if(!isdigit((unsigned char)name[i])) { return PLCTAG_ERR_UNSUPPORTED; }
+
+        value = (value * 10) + (name[i] - '0');
+
+        if(value > INT_MAX) { return PLCTAG_ERR_OUT_OF_BOUNDS; }
+    }
+
+    *parent_name = dup_substring(name, bracket);
+    if(!*parent_name) { return PLCTAG_ERR_NO_MEM; }
+
+    *index = (int)value;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+char *dup_substring(const char *str, int len) {
+    char *result = mem_alloc(len + 1);
+
+    /* the allocation is zeroed, so the terminator is already there. */
+    if(result) { str_copy(result, len, str); }
+
+    return result;
+}
+
+
+/*
+ * make_attrib_prefix
+ *
+ * The internal tags use the member's PLC type, gateway, path, connection group and
+ * packing so that they find the member's session and behave like the member.
+ */
+char *make_attrib_prefix(attr attribs) {
+    char group_buf[16];
+    char connected_buf[16];
+    char packing_buf[16];
+
+    snprintf_platform(group_buf, sizeof(group_buf), "%d", attr_get_int(attribs, "connection_group_id", 0));
+    snprintf_platform(connected_buf, sizeof(connected_buf), "%d", attr_get_int(attribs, "use_connected_msg", 1));
+    snprintf_platform(packing_buf, sizeof(packing_buf), "%d", attr_get_int(attribs, "allow_packing", 1));
+
+    return str_concat("protocol=ab-eip&plc=", attr_get_str(attribs, "plc", attr_get_str(attribs, "cpu", "ControlLogix")),
+                      "&gateway=", attr_get_str(attribs, "gateway", ""), "&path=", attr_get_str(attribs, "path", ""),
+                      "&connection_group_id=", group_buf, "&use_connected_msg=", connected_buf, "&allow_packing=", packing_buf);
+}
+
+
+int32_t create_internal_tag(parent_read_group_p group, const char *name, int elem_count) {
+    int32_t tag_id = PLCTAG_ERR_NO_MEM;
+    char count_buf[16];
+    char *attrib_str = NULL;
+
+    if(elem_count > 1) {
+        snprintf_platform(count_buf, sizeof(count_buf), "%d", elem_count);
+        attrib_str = str_concat(group->attrib_prefix, "&elem_count=", count_buf, "&name=", name);
+    } else {
+        attrib_str = str_concat(group->attrib_prefix, "&name=", name);
+    }
+
+    if(attrib_str) {
+        tag_id = plc_tag_create_ex(attrib_str, internal_tag_callback, group->session, 0);
+        mem_free(attrib_str);
+    }
+
+    if(tag_id <= 0) { pdebug(DEBUG_WARN, "Unable to create internal tag %s, error %s!", name, plc_tag_decode_error(tag_id)); }
+
+    return tag_id;
+}
+
+
+/*
+ * internal_tag_callback
+ *
+ * Wake the session thread when an internal tag finishes so the group moves along
+ * without waiting for the idle timeout.  The internal tag holds the session.
+ */
+void internal_tag_callback(int32_t tag_id, int event, int status, void *userdata) {
+    ab_session_p session = (ab_session_p)userdata;
+
+    (void)tag_id;
+    (void)status;
+
+    if(event == PLCTAG_EVENT_READ_COMPLETED || event == PLCTAG_EVENT_CREATED) { cond_signal(session->session_wait_cond); }
+}
+
+
+uint8_t *get_internal_tag_data(int32_t tag_id, int *size) {
+    uint8_t *data = NULL;
+
+    *size = plc_tag_get_size(tag_id);
+
+    if(*size <= 0 || !(data = mem_alloc(*size))) { return NULL; }
+
+    if(plc_tag_get_raw_bytes(tag_id, 0, data, *size) != PLCTAG_STATUS_OK) {
+        mem_free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+
+/*
+ * service_group
+ *
+ * Move the listing, template and parent reads along.  Called by the session thread
+ * with the service mutex held.  The group mutex is only held to trade state with the
+ * members, never across a call into the library.
+ */
+void service_group(parent_read_group_p group) {
+    int template_index = -1;
+    int want_read = 0;
+    int read_first = 0;
+    int read_count = 0;
+
+    if(group->template_tag_id > 0) { service_template(group); }
+    if(group->parent_read_in_flight) { service_parent_read(group); }
+
+    critical_block(group->mutex) {
+        if(group->listing_wanted) {
+            group->listing_wanted = 0;
+            group->listing_pending = 1;
+        }
+
+        if(group->template_tag_id <= 0) {
+            for(int i = 0; i < group->num_templates; i++) {
+                if(group->templates[i].pending) {
+                    template_index = i;
+                    break;
+                }
+            }
+        }
+
+        if(!group->parent_read_in_flight && group->parent_read_wanted) {
+            /* members asking from here on wait for the read after this one. */
+            group->parent_read_wanted = 0;
+            group->parent_read_in_flight = 1;
+            group->issued_gen++;
+
+            read_first = group->range_first;
+            read_count = group->range_count;
+            want_read = 1;
+        }
+    }
+
+    if(group->listing_pending) { find_root_template(group); }
+
+    if(template_index >= 0) {
+        char name[16];
+        int32_t tag_id = 0;
+        int rc = PLCTAG_STATUS_OK;
+
+        snprintf_platform(name, sizeof(name), "@udt/%u", (unsigned int)group->templates[template_index].id);
+
+        tag_id = create_internal_tag(group, name, 1);
+        rc = (tag_id > 0) ? plc_tag_read(tag_id, 0) : tag_id;
+
+        if(rc != PLCTAG_STATUS_PENDING && rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to start reading UDT template %u, error %s!",
+                   (unsigned int)group->templates[template_index].id, plc_tag_decode_error(rc));
+
+            if(tag_id > 0) { plc_tag_destroy(tag_id); }
+
+            /* the entry stays empty, members that need it read on their own. */
+            critical_block(group->mutex) { group->templates[template_index].pending = 0; }
+        } else {
+            group->template_tag_id = tag_id;
+            group->template_index = template_index;
+        }
+    }
+
+    if(want_read) { start_parent_read(group, read_first, read_count); }
+}
+
+
+/*
+ * service_listings
+ *
+ * Poll the listings being read and drop the ones the last member abandoned.  Nothing
+ * is polled once no group is left, the member taking out the last group destroys the
+ * internal tags while it still holds the session.
+ */
+void service_listings(ab_session_p session) {
+    critical_block(session->parent_read_listings_mutex) {
+        int has_groups = 0;
+
+        critical_block(session->session_mutex) { has_groups = (vector_length(session->parent_read_groups) > 0); }
+
+        for(int i = 0; i < vector_length(session->parent_read_listings); i++) {
+            struct parent_read_listing_t *listing = vector_get(session->parent_read_listings, i);
+            int rc = PLCTAG_STATUS_OK;
+            int size = 0;
+
+            if(listing->status == PLCTAG_ERR_ABORT) {
+                pdebug(DEBUG_DETAIL, "No group wanted listing %s any more.", listing->name);
+                free_listing(vector_remove(session->parent_read_listings, i));
+                i--;
+                continue;
+            }
+
+            if(listing->tag_id <= 0 || !has_groups) { continue; }
+
+            rc = plc_tag_status(listing->tag_id);
+            if(rc == PLCTAG_STATUS_PENDING) { continue; }
+
+            if(rc == PLCTAG_STATUS_OK) {
+                listing->data = get_internal_tag_data(listing->tag_id, &size);
+                rc = listing->data ? parse_listing(listing, size) : PLCTAG_ERR_NO_DATA;
+            }
+
+            plc_tag_destroy(listing->tag_id);
+            listing->tag_id = 0;
+
+            if(rc == PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_INFO, "Listing %s has %d tags.", listing->name, listing->num_symbols);
+            } else {
+                pdebug(DEBUG_WARN, "Unable to read listing %s, error %s.", listing->name, plc_tag_decode_error(rc));
+            }
+
+            listing->status = rc;
+        }
+    }
+}
+
+
+/*
+ * abandon_listings
+ *
+ * Called by the member that took the last group off the session, after the group is
+ * retired and before the member lets go of the session.  Destroys the internal tags of
+ * the listings still being read unless a new group has come along in the meantime.
+ * The session thread drops the abandoned listings.
+ */
+void abandon_listings(ab_session_p session) {
+    critical_block(session->parent_read_listings_mutex) {
+        int has_groups = 0;
+
+        critical_block(session->session_mutex) { has_groups = (vector_length(session->parent_read_groups) > 0); }
+
+        if(has_groups) { break; }
+
+        for(int i = 0; i < vector_length(session->parent_read_listings); i++) {
+            struct parent_read_listing_t *listing = vector_get(session->parent_read_listings, i);
+
+            if(listing->tag_id <= 0) { continue; }
+
+            pdebug(DEBUG_DETAIL, "No group wants listing %s any more.", listing->name);
+
+            plc_tag_destroy(listing->tag_id);
+            listing->tag_id = 0;
+            listing->status = PLCTAG_ERR_ABORT;
+        }
+    }
+}
+
+
+/*
+ * get_listing_unsafe
+ *
+ * Find the listing the group looks up its parent in, or start reading it if no group
+ * of the session has asked for it yet.  Returns NULL if it could not be started.
+ * Called by the session thread with the listing mutex held.
+ */
+struct parent_read_listing_t *get_listing_unsafe(parent_read_group_p group) {
+    ab_session_p session = group->session;
+    struct parent_read_listing_t *listing = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    for(int i = 0; i < vector_length(session->parent_read_listings); i++) {
+        listing = vector_get(session->parent_read_listings, i);
+
+        if(listing->status != PLCTAG_ERR_ABORT && str_cmp_i(listing->name, group->listing_name) == 0) { return listing; }
+    }
+
+    listing = mem_alloc((int)sizeof(*listing));
+    if(!listing) {
+        pdebug(DEBUG_WARN, "Unable to allocate listing!");
+        return NULL;
+    }
+
+    listing->status = PLCTAG_STATUS_PENDING;
+    listing->name = str_dup(group->listing_name);
+    listing->tag_id = listing->name ? create_internal_tag(group, listing->name, 1) : PLCTAG_ERR_NO_MEM;
+
+    /* special tags do not read when created. */
+    rc = (listing->tag_id > 0) ? plc_tag_read(listing->tag_id, 0) : listing->tag_id;
+
+    if(rc >= PLCTAG_STATUS_OK) { rc = vector_insert(session->parent_read_listings, vector_length(session->parent_read_listings), listing); }
+
+    if(rc < PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to start reading listing %s, error %s!", group->listing_name, plc_tag_decode_error(rc));
+        free_listing(listing);
+        return NULL;
+    }
+
+    pdebug(DEBUG_DETAIL, "Reading listing %s for parent %s.", listing->name, group->parent_name);
+
+    return listing;
+}
+
+
+void free_listing(struct parent_read_listing_t *listing) {
+    if(!listing) { return; }
+
+    if(listing->tag_id > 0) { plc_tag_destroy(listing->tag_id); }
+    if(listing->symbols) { mem_free(listing->symbols); }
+    if(listing->data) { mem_free(listing->data); }
+    if(listing->name) { mem_free(listing->name); }
+
+    mem_free(listing);
+}
+
+
+/*
+ * find_root_template
+ *
+ * Look the parent up in the session's listing once it has been read.
+ */
+void find_root_template(parent_read_group_p group) {
+    struct parent_read_listing_t *listing = NULL;
+    struct parent_read_symbol_t *symbol = NULL;
+    int rc = PLCTAG_ERR_NO_MEM;
+
+    /* only the session thread removes listings, so the listing stays put after this. */
+    critical_block(group->session->parent_read_listings_mutex) {
+        listing = get_listing_unsafe(group);
+        if(listing) { rc = listing->status; }
+    }
+
+    if(rc == PLCTAG_STATUS_PENDING) { return; }
+
+    group->listing_pending = 0;
+
+    if(rc == PLCTAG_STATUS_OK) {
+        symbol = find_symbol(listing, group->symbol_name);
+
+        if(!symbol) {
+            rc = PLCTAG_ERR_NOT_FOUND;
+        } else if(!(symbol->type & TYPE_IS_STRUCT)) {
+            pdebug(DEBUG_INFO, "Tag %s is not a structure.", group->symbol_name);
+            rc = PLCTAG_ERR_UNSUPPORTED;
+        }
+    }
+
+    critical_block(group->mutex) {
+        if(rc == PLCTAG_STATUS_OK) {
+            group->root_template_id = (uint16_t)(symbol->type & TYPE_UDT_ID_MASK);
+
+            pdebug(DEBUG_DETAIL, "Parent %s (instance %" PRIu32 ") uses UDT template %u.", group->parent_name,
+                   symbol->instance_id, (unsigned int)group->root_template_id);
+            group->state = PARENT_READ_RESOLVED;
+        } else {
+            pdebug(DEBUG_WARN, "Unable to find a UDT template for %s, error %s.", group->parent_name, plc_tag_decode_error(rc));
+            group->state = PARENT_READ_FAILED;
+        }
+    }
+}
+
+
+void service_template(parent_read_group_p group) {
+    int rc = plc_tag_status(group->template_tag_id);
+    uint8_t *data = NULL;
+    int size = 0;
+
+    if(rc == PLCTAG_STATUS_PENDING) { return; }
+
+    if(rc == PLCTAG_STATUS_OK) { data = get_internal_tag_data(group->template_tag_id, &size); }
+
+    if(data && size < UDT_HEADER_SIZE) {
+        mem_free(data);
+        data = NULL;
+    }
+
+    plc_tag_destroy(group->template_tag_id);
+    group->template_tag_id = 0;
+
+    critical_block(group->mutex) {
+        struct parent_read_template_t *tmpl = &(group->templates[group->template_index]);
+
+        if(!data) { pdebug(DEBUG_WARN, "Unable to read UDT template %u.", (unsigned int)tmpl->id); }
+
+        tmpl->data = data;
+        tmpl->size = data ? size : 0;
+        tmpl->pending = 0;
+    }
+}
+
+
+/*
+ * start_parent_read
+ *
+ * Start a read of the parent.  The parent tag is created on first use, or again for
+ * arrays when the range of wanted elements changed.  The initial read of a new parent
+ * tag counts as the read.
+ */
+void start_parent_read(parent_read_group_p group, int first, int count) {
+    if(group->kind == PARENT_READ_ARRAY && group->parent_tag_id > 0 && (group->read_first != first || group->read_count != count)) {
+        pdebug(DEBUG_DETAIL, "Range of %s changed, replacing the parent tag.", group->parent_name);
+        plc_tag_destroy(group->parent_tag_id);
+        group->parent_tag_id = 0;
+    }
+
+    if(group->parent_tag_id > 0) {
+        group->parent_read_started = 0;
+        service_parent_read(group);
+        return;
+    }
+
+    if(group->kind == PARENT_READ_ARRAY) {
+        char index_buf[16];
+        char *range_name = NULL;
+
+        snprintf_platform(index_buf, sizeof(index_buf), "%d", first);
+
+        range_name = str_concat(group->parent_name, "[", index_buf, "]");
+        group->parent_tag_id = range_name ? create_internal_tag(group, range_name, count) : PLCTAG_ERR_NO_MEM;
+
+        if(range_name) { mem_free(range_name); }
+
+        group->read_first = first;
+        group->read_count = count;
+    } else {
+        group->parent_tag_id = create_internal_tag(group, group->parent_name, 1);
+    }
+
+    if(group->parent_tag_id <= 0) {
+        int rc = group->parent_tag_id;
+
+        group->parent_tag_id = 0;
+
+        /* fail anyone who was waiting and stop trying. */
+        critical_block(group->mutex) {
+            group->parent_read_in_flight = 0;
+            group->parent_read_wanted = 0;
+            group->done_gen = group->issued_gen;
+            group->last_status = rc;
+            group->state = PARENT_READ_FAILED;
+        }
+
+        plc_tag_tickler_wake();
+
+        return;
+    }
+
+    group->parent_read_started = 1;
+}
+
+
+void service_parent_read(parent_read_group_p group) {
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!group->parent_read_started) {
+        rc = plc_tag_read(group->parent_tag_id, 0);
+
+        /* the library has not finished with the last read yet, try on the next pass. */
+        if(rc == PLCTAG_ERR_BUSY) { return; }
+
+        group->parent_read_started = 1;
+    } else {
+        rc = plc_tag_status(group->parent_tag_id);
+    }
+
+    if(rc != PLCTAG_STATUS_PENDING) { finish_parent_read(group, rc); }
+}
+
+
+/*
+ * finish_parent_read
+ *
+ * Keep the bytes of a finished read.  Members copy from the saved data, so the parent
+ * tag can be replaced before every member has picked up its data.  The bytes are read
+ * into the spare buffer first and swapped in under the group mutex.
+ */
+void finish_parent_read(parent_read_group_p group, int rc) {
+    int size = 0;
+
+    if(rc == PLCTAG_STATUS_OK) {
+        size = plc_tag_get_size(group->parent_tag_id);
+
+        if(size <= 0) {
+            pdebug(DEBUG_WARN, "Parent %s returned no data!", group->parent_name);
+            rc = (size < 0) ? size : PLCTAG_ERR_NO_DATA;
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK && size > group->read_buf_capacity) {
+        uint8_t *new_buf = (uint8_t *)mem_realloc(group->read_buf, size);
+
+        if(new_buf) {
+            group->read_buf = new_buf;
+            group->read_buf_capacity = size;
+        } else {
+            pdebug(DEBUG_WARN, "Unable to allocate memory for parent data!");
+            rc = PLCTAG_ERR_NO_MEM;
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = plc_tag_get_raw_bytes(group->parent_tag_id, 0, group->read_buf, size);
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Error %s copying data from parent %s!", plc_tag_decode_error(rc), group->parent_name);
+        }
+    }
+
+    critical_block(group->mutex) {
+        if(rc == PLCTAG_STATUS_OK && group->kind == PARENT_READ_ARRAY && size != group->read_count * group->elem_size) {
+            /* the elements are not what the members said, stop reading them together. */
+            pdebug(DEBUG_WARN, "Parent %s returned %d bytes, expected %d!", group->parent_name, size,
+                   group->read_count * group->elem_size);
+            group->state = PARENT_READ_FAILED;
+            rc = PLCTAG_ERR_BAD_DATA;
+        }
+
+        if(rc == PLCTAG_STATUS_OK) {
+            uint8_t *old_data = group->data;
+            int old_capacity = group->data_capacity;
+
+            group->data = group->read_buf;
+            group->data_capacity = group->read_buf_capacity;
+            group->data_size = size;
+            group->data_offset = (group->kind == PARENT_READ_ARRAY) ? group->read_first * group->elem_size : 0;
+
+            group->read_buf = old_data;
+            group->read_buf_capacity = old_capacity;
+        }
+
+        group->parent_read_in_flight = 0;
+        group->done_gen = group->issued_gen;
+        group->last_status = rc;
+    }
+
+    /* get the members to pick up their data. */
+    plc_tag_tickler_wake();
+}
+
+
+/*
+ * parse_listing
+ *
+ * Each listing entry is the instance ID (4 bytes), the type (2 bytes), the element
+ * length (2 bytes), three dimensions (4 bytes each), the name length (2 bytes) and
+ * the name.  The entries are counted first so the table is allocated once.
+ */
+int parse_listing(struct parent_read_listing_t *listing, int size) {
+    uint8_t *data = listing->data;
+    int offset = 0;
+    int count = 0;
+
+    while(offset + LISTING_ENTRY_HEADER_SIZE <= size) {
+        int name_len = (int)get_u16(data, offset + 20);
+
+        if(offset + LISTING_ENTRY_HEADER_SIZE + name_len > size) { break; }
+
+        count++;
+        offset += LISTING_ENTRY_HEADER_SIZE + name_len;
+    }
+
+    if(count == 0) { return PLCTAG_ERR_NOT_FOUND; }
+
+    listing->symbols = mem_alloc(count * (int)sizeof(struct parent_read_symbol_t));
+    if(!listing->symbols) {
+        pdebug(DEBUG_WARN, "Unable to allocate the listing table!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    offset = 0;
+
+    for(int i = 0; i < count; i++) {
+        struct parent_read_symbol_t *symbol = &(listing->symbols[i]);
+
+        symbol->instance_id = get_u32(data, offset);
+        symbol->type = get_u16(data, offset + 4);
+        symbol->name_len = (int)get_u16(data, offset + 20);
+        symbol->name = (const char *)(data + offset + LISTING_ENTRY_HEADER_SIZE);
+
+        offset += LISTING_ENTRY_HEADER_SIZE + symbol->name_len;
+    }
+
+    listing->num_symbols = count;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+struct parent_read_symbol_t *find_symbol(struct parent_read_listing_t *listing, const char *name) {
+    int name_len = str_length(name);
+
+    for(int i = 0; i < listing->num_symbols; i++) {
+        struct parent_read_symbol_t *symbol = &(listing->symbols[i]);
+
+        if(symbol->name_len == name_len && str_cmp_i_n(symbol->name, name, name_len) == 0) { return symbol; }
+    }
+
+    return NULL;
+}
+
+
+struct parent_read_template_t *find_template_unsafe(parent_read_group_p group, uint16_t template_id) {
+    for(int i = 0; i < group->num_templates; i++) {
+        if(group->templates[i].id == template_id) { return &(group->templates[i]); }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * resolve_member_unsafe
+ *
+ * Walk the member path through the templates to find the member's offset in the
+ * parent.  The offset stays unresolved while the listing or templates are still
+ * being read.
+ */
+void resolve_member_unsafe(parent_read_group_p group, ab_tag_p tag) {
+    struct parent_read_template_t *root = NULL;
+    uint16_t template_id = 0;
+    uint32_t offset = 0;
+    const char *component = tag->parent_member;
+
+    if(group->state == PARENT_READ_FAILED) {
+        tag->parent_offset = PARENT_OFFSET_INELIGIBLE;
+        return;
+    }
+
+    if(group->state == PARENT_READ_LISTING) {
+        if(!group->listing_requested) {
+            /* the session thread reads the listing. */
+            group->listing_requested = 1;
+            group->listing_wanted = 1;
+        }
+
+        return;
+    }
+
+    template_id = group->root_template_id;
+
+    while(component) {
+        struct parent_read_template_t *tmpl = find_template_unsafe(group, template_id);
+        const char *next = component;
+        uint16_t field_type = 0;
+        uint32_t field_offset = 0;
+
+        if(!tmpl) {
+            if(group->num_templates >= PARENT_READ_MAX_TEMPLATES) {
+                pdebug(DEBUG_INFO, "Too many UDT templates for parent %s.", group->parent_name);
+                tag->parent_offset = PARENT_OFFSET_INELIGIBLE;
+                return;
+            }
+
+            /* the session thread reads the template, the entry stays empty if that fails. */
+            tmpl = &(group->templates[group->num_templates++]);
+            tmpl->id = template_id;
+            tmpl->pending = 1;
+            tmpl->size = 0;
+            tmpl->data = NULL;
+
+            return;
+        }
+
+        if(tmpl->pending) { return; }
+
+        if(!tmpl->data) {
+            tag->parent_offset = PARENT_OFFSET_INELIGIBLE;
+            return;
+        }
+
+        while(*next && *next != '.') { next++; }
+
+        if(find_field(tmpl, component, (int)(next - component), &field_type, &field_offset) != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_INFO, "Field %s not found in UDT template %u.", component, (unsigned int)template_id);
+            tag->parent_offset = PARENT_OFFSET_INELIGIBLE;
+            return;
+        }
+
+        offset += field_offset;
+
+        if(*next) {
+            if(!(field_type & TYPE_IS_STRUCT)) {
+                tag->parent_offset = PARENT_OFFSET_INELIGIBLE;
+                return;
+            }
+
+            template_id = (uint16_t)(field_type & TYPE_UDT_ID_MASK);
+            component = next + 1;
+        } else {
+            /* bits share a byte with other members, leave them to their own reads. */
+            if(field_type == TYPE_BOOL) {
+                tag->parent_offset = PARENT_OFFSET_INELIGIBLE;
+                return;
+            }
+
+            component = NULL;
+        }
+    }
+
+    root = find_template_unsafe(group, group->root_template_id);
+    if(!root || !root->data || (uint64_t)offset + (uint64_t)(unsigned int)tag->size > (uint64_t)get_u32(root->data, 6)) {
+        pdebug(DEBUG_INFO, "Member %s does not fit inside parent %s.", tag->parent_member, group->parent_name);
+        tag->parent_offset = PARENT_OFFSET_INELIGIBLE;
+        return;
+    }
+
+    pdebug(DEBUG_DETAIL, "Member %s is at offset %u in parent %s.", tag->parent_member, (unsigned int)offset, group->parent_name);
+
+    tag->parent_offset = (int)offset;
+}
+
+
+/*
+ * find_field
+ *
+ * The field definitions are followed by the template name, which ends in a zero
+ * byte, and then the zero-terminated field names in the same order.
+ */
+int find_field(struct parent_read_template_t *tmpl, const char *field_name, int field_name_len, uint16_t *field_type,
+               uint32_t *field_offset) {
+    int num_fields = (int)get_u16(tmpl->data, 10);
+    int name_offset = UDT_HEADER_SIZE + (num_fields * UDT_FIELD_SIZE);
+
+    /* skip the template name. */
+    while(name_offset < tmpl->size && tmpl->data[name_offset]) { name_offset++; }
+    name_offset++;
+
+    for(int i = 0; i < num_fields && name_offset < tmpl->size; i++) {
+        int name_end = name_offset;
+
+        while(name_end < tmpl->size && tmpl->data[name_end]) { name_end++; }
+
+        if(name_end - name_offset == field_name_len
+           && str_cmp_i_n((const char *)(tmpl->data + name_offset), field_name, field_name_len) == 0) {
+            int field_def = UDT_HEADER_SIZE + (i * UDT_FIELD_SIZE);
+
+            *field_type = get_u16(tmpl->data, field_def + 2);
+            *field_offset = get_u32(tmpl->data, field_def + 4);
+
+            return PLCTAG_STATUS_OK;
+        }
+
+        name_offset = name_end + 1;
+    }
+
+    return PLCTAG_ERR_NOT_FOUND;
+}
+
+
+/*
+ * resolve_element_unsafe
+ *
+ * Array elements are at a fixed stride.  Widen the range the group reads to cover
+ * the element unless that makes the range too large.
+ */
+void resolve_element_unsafe(parent_read_group_p group, ab_tag_p tag) {
+    int64_t first = tag->parent_index;
+    int64_t last = first + tag->elem_count - 1;
+    int64_t new_first = first;
+    int64_t new_last = last;
+
+    /* a BOOL array element comes back as a bit, the array itself as 32-bit words. */
+    if(tag->elem_size <= 0 || tag->encoded_type_info_size < 1 || tag->encoded_type_info[0] == AB_CIP_DATA_BIT) {
+        tag->parent_offset = PARENT_OFFSET_INELIGIBLE;
+        return;
+    }
+
+    if(!group->elem_size) { group->elem_size = tag->elem_size; }
+
+    if(group->elem_size != tag->elem_size || (last + 1) * group->elem_size > INT_MAX) {
+        pdebug(DEBUG_INFO, "Element tag does not line up with the other elements of %s.", group->parent_name);
+        tag->parent_offset = PARENT_OFFSET_INELIGIBLE;
+        return;
+    }
+
+    if(group->range_count > 0) {
+        if(group->range_first < new_first) { new_first = group->range_first; }
+        if(group->range_first + group->range_count - 1 > new_last) { new_last = group->range_first + group->range_count - 1; }
+    }
+
+    if((new_last - new_first + 1) * group->elem_size > PARENT_READ_MAX_ARRAY_SPAN) {
+        pdebug(DEBUG_INFO, "Element %d is too far from the other elements of %s.", tag->parent_index, group->parent_name);
+        tag->parent_offset = PARENT_OFFSET_INELIGIBLE;
+        return;
+    }
+
+    /* the parent tag is replaced on the next read if this changed the range. */
+    group->range_first = (int)new_first;
+    group->range_count = (int)(new_last - new_first + 1);
+
+    pdebug(DEBUG_DETAIL, "Element %d of %s joins reads of %d elements from %d.", tag->parent_index, group->parent_name,
+           group->range_count, group->range_first);
+
+    tag->parent_offset = (int)(first * group->elem_size);
+}
+
+
+/*
+ * update_range_unsafe
+ *
+ * Recompute the range from the elements of the members that are still in the group.
+ */
+void update_range_unsafe(parent_read_group_p group) {
+    int first = INT_MAX;
+    int last = -1;
+
+    for(int i = 0; i < vector_length(group->members); i++) {
+        ab_tag_p member = vector_get(group->members, i);
+
+        if(member->parent_offset < 0) { continue; }
+
+        if(member->parent_index < first) { first = member->parent_index; }
+        if(member->parent_index + member->elem_count - 1 > last) { last = member->parent_index + member->elem_count - 1; }
+    }
+
+    if(last < 0) {
+        group->range_first = 0;
+        group->range_count = 0;
+    } else {
+        group->range_first = first;
+        group->range_count = last - first + 1;
+    }
+
+    pdebug(DEBUG_DETAIL, "Group for %s now reads %d elements from %d.", group->parent_name, group->range_count, group->range_first);
+}
+
+
+uint16_t get_u16(const uint8_t *data, int offset) {
+    return (uint16_t)((unsigned int)data[offset] | ((unsigned int)data[offset + 1] << 8));
+}
+
+
+uint32_t get_u32(const uint8_t *data, int offset) {
+    return (uint32_t)data[offset] | ((uint32_t)data[offset + 1] << 8) | ((uint32_t)data[offset + 2] << 16)
+           | ((uint32_t)data[offset + 3] << 24);
+}
@@ -0,0 +1,62 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+#include <libplctag/protocols/ab/ab_common.h>
+#include <utils/attr.h>
+
+/*
+ * Members of a UDT on the same session, such as Motor[3].Speed and Motor[3].Current,
+ * can be read with one read of the parent (Motor[3]).  The member offsets come from
+ * the controller's UDT templates.  Tags opt in with udt_parent_read=1.
+ *
+ * Element tags of the same array, such as Data[0] and Data[7], can likewise be read
+ * with one ranged read of the array covering all of them.  Tags opt in with
+ * array_parent_read=1.
+ */
+
+#define PARENT_READ_MAX_TEMPLATES (16)
+
+/* elements further apart than this are not worth reading together. */
+#define PARENT_READ_MAX_ARRAY_SPAN (16384)
+
+#define PARENT_READ_MIN_MEMBERS (8)
+#define PARENT_READ_INC_MEMBERS (8)
+
+extern int parent_read_setup(ab_tag_p tag, attr attribs, const char *name);
+extern int parent_read_start(ab_tag_p tag);
+extern int parent_read_check(ab_tag_p tag);
+extern void parent_read_release(ab_tag_p tag);
+extern void parent_read_service(ab_session_p session);
+extern void parent_read_forget_listings(ab_session_p session);
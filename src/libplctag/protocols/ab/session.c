@@ -36,14 +36,17 @@
 #include <libplctag/protocols/ab/cip.h>
 #include <libplctag/protocols/ab/defs.h>
 #include <libplctag/protocols/ab/error_codes.h>
+#include <libplctag/protocols/ab/parent_read.h>
 #include <libplctag/protocols/ab/session.h>
 #include <libplctag/protocols/ab/tag.h>
+#include <libplctag/protocols/eip/transport.h>
 #include <limits.h>
 #include <platform.h>
 #include <stdlib.h>
 #include <time.h>
 #include <utils/atomic_utils.h>
 #include <utils/debug.h>
+#include <utils/metrics.h>
 #include <utils/random_utils.h>
 
 #define MAX_REQUESTS (200)
@@ -75,9 +78,51 @@
 #define RETRY_WAIT_MAX_MS (10000)
 
 #define SESSION_DISCONNECT_TIMEOUT (5000)
-#define SOCKET_WAIT_TIMEOUT_MS (20)
 #define SESSION_IDLE_WAIT_TIME (100)
 
+/* one entry in the session type cache. */
+typedef struct {
+    uint8_t encoded_name[MAX_TAG_NAME];
+    int encoded_name_size;
+
+    uint8_t encoded_type_info[MAX_TAG_TYPE_INFO];
+    int encoded_type_info_size;
+
+    int elem_size;
+} session_type_entry_t;
+
+typedef session_type_entry_t *session_type_entry_p;
+
+/* what probing a PLC found, kept per host and path so that later sessions start with it. */
+typedef struct {
+    char *host;
+    char *path;
+
+    bool supports_packing;
+    bool only_use_old_forward_open;
+    uint16_t max_payload_size;
+
+    /* from the Identity object, zero if the PLC did not answer. */
+    uint16_t vendor_id;
+    uint16_t device_type;
+    uint16_t product_code;
+    uint8_t revision_major;
+    uint8_t revision_minor;
+    char product_name[33];
+} session_profile_t;
+
+typedef session_profile_t *session_profile_p;
+
+/* Get Attributes All of Identity instance 1, alone and inside a Multiple Service request to the Message Router. */
+static const uint8_t identity_request[] = {0x01, 0x02, 0x20, 0x01, 0x24, 0x01};
+static const uint8_t packed_identity_request[] = {0x0A, 0x02, 0x20, 0x02, 0x24, 0x01, 0x01, 0x00,
+                                                  0x04, 0x00, 0x01, 0x02, 0x20, 0x01, 0x24, 0x01};
+
+#define AB_EIP_CMD_CIP_GET_ATTRIBUTES_ALL ((uint8_t)0x01)
+
+/* vendor, device type, product code, revision, status, serial number and the product name size. */
+#define IDENTITY_MIN_SIZE (15)
+
 /* make sure we try hard to get a good payload size */
 #define GET_MAX_PAYLOAD_SIZE(session)                                \
     ((session->max_payload_size > 0) ? (session->max_payload_size) : \
@@ -117,14 +162,28 @@ static int session_unregister(ab_session_p session);
 static int64_t calc_retry_time(unsigned int retry_count);
 static THREAD_FUNC(session_handler);
 static int purge_aborted_requests_unsafe(ab_session_p session);
+static int merge_bit_writes_unsafe(ab_session_p session);
+static void unmerge_bit_writes_unsafe(ab_session_p session, int index);
+static int save_unmerged_data(ab_request_p request);
 static int process_requests(ab_session_p session);
+static int select_requests(void *session_arg, void **requests);
+static void get_request_data(void *request_arg, uint8_t **data, int *data_size);
+static void complete_request(void *session_arg, void *request_arg, uint8_t *reply, int reply_size, int sub_packet);
+static void requeue_requests(void *session_arg, void **requests, int num_requests, int alone);
+static void apply_profile_unsafe(ab_session_p session);
+static void forget_profile(ab_session_p session);
+static int save_profile(ab_session_p session, session_profile_p found);
+static int probe_plc(ab_session_p session);
+static int send_probe_request(ab_session_p session, bool packed);
+static int receive_probe_response(ab_session_p session, bool packed, session_profile_p found);
+static bool parse_identity(uint8_t *reply, int reply_size, session_profile_p found);
+static int select_requests_unsafe(ab_session_p session, ab_request_p *requests, int max_payload_size);
+static int get_response_size(ab_request_p request);
 // static int check_packing(ab_session_p session, ab_request_p request);
-static int get_payload_size(ab_request_p request);
-static int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests);
 static int prepare_request(ab_session_p session);
 static int send_eip_request(ab_session_p session, int timeout);
 static int recv_eip_response(ab_session_p session, int timeout);
-static int unpack_response(ab_session_p session, ab_request_p request, int sub_packet);
+static int unpack_response(ab_session_p session, ab_request_p request, uint8_t *reply, int reply_size, int sub_packet);
 // static int perform_forward_open(ab_session_p session);
 static int perform_forward_close(ab_session_p session);
 // static int try_forward_open_ex(ab_session_p session, int *max_payload_size_guess);
@@ -135,16 +194,24 @@ static int perform_forward_close(ab_session_p session);
 static int send_forward_close_req(ab_session_p session);
 static int recv_forward_close_resp(ab_session_p session);
 static int send_forward_open_request(ab_session_p session);
-static int send_old_forward_open_request(ab_session_p session);
-static int send_extended_forward_open_request(ab_session_p session);
+static void fill_forward_open(ab_session_p session, struct eip_forward_open_t *fo);
 static int receive_forward_open_response(ab_session_p session);
 static void request_destroy(void *req_arg);
 static int session_request_increase_buffer(ab_request_p request, int new_capacity);
 
+/* how the EIP request loop gets at the session's request queue. */
+static const struct eip_request_ops_t session_request_ops = {.select_requests = select_requests,
+                                                             .get_request_data = get_request_data,
+                                                             .complete_request = complete_request,
+                                                             .requeue_requests = requeue_requests};
+
 
 static volatile mutex_p session_mutex = NULL;
 static volatile vector_p sessions = NULL;
 
+/* what earlier sessions learned about each PLC, guarded by session_mutex. */
+static volatile vector_p profiles = NULL;
+
 
 int session_startup(void) {
     int rc = PLCTAG_STATUS_OK;
@@ -159,6 +226,11 @@ int session_startup(void) {
         return PLCTAG_ERR_NO_MEM;
     }
 
+    if((profiles = vector_create(SESSION_MIN_PROFILES, SESSION_INC_PROFILES)) == NULL) {
+        pdebug(DEBUG_ERROR, "Unable to create PLC profile vector!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
     return rc;
 }
 
@@ -213,6 +285,19 @@ void session_teardown(void) {
         sessions = NULL;
     }
 
+    if(profiles) {
+        for(int i = 0; i < vector_length(profiles); i++) {
+            session_profile_p profile = vector_get(profiles, i);
+
+            mem_free(profile->host);
+            mem_free(profile->path);
+            mem_free(profile);
+        }
+
+        vector_destroy(profiles);
+        profiles = NULL;
+    }
+
     pdebug(DEBUG_DETAIL, "Destroying session mutex.");
 
     if(session_mutex) {
@@ -270,6 +355,109 @@ int session_get_max_payload(ab_session_p session) {
     return result;
 }
 
+/*
+ * session_get_cached_type
+ *
+ * Fill in the encoded type and element size of the tag from an earlier read
+ * of a tag with the same name on this session.  Returns PLCTAG_ERR_NOT_FOUND
+ * if no tag by that name has been read yet.
+ */
+
+int session_get_cached_type(ab_session_p session, ab_tag_p tag) {
+    int rc = PLCTAG_ERR_NOT_FOUND;
+
+    if(!session || !tag) {
+        pdebug(DEBUG_WARN, "Called with null session or tag pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(session->session_mutex) {
+        for(int i = 0; i < vector_length(session->type_cache); i++) {
+            session_type_entry_p entry = vector_get(session->type_cache, i);
+
+            if(entry->encoded_name_size == tag->encoded_name_size
+               && mem_cmp(entry->encoded_name, entry->encoded_name_size, tag->encoded_name, tag->encoded_name_size) == 0) {
+                mem_copy(tag->encoded_type_info, entry->encoded_type_info, entry->encoded_type_info_size);
+                tag->encoded_type_info_size = entry->encoded_type_info_size;
+                tag->elem_size = entry->elem_size;
+
+                rc = PLCTAG_STATUS_OK;
+                break;
+            }
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Tag type is %sin the session cache.", (rc == PLCTAG_STATUS_OK ? "" : "not "));
+
+    return rc;
+}
+
+
+/*
+ * session_cache_type
+ *
+ * Remember the encoded type and element size of a tag that has been read
+ * so that other tags with the same name can skip reading the type.  When the
+ * cache is full the oldest entry is dropped.
+ */
+
+int session_cache_type(ab_session_p session, ab_tag_p tag) {
+    int rc = PLCTAG_STATUS_OK;
+    session_type_entry_p entry = NULL;
+
+    if(!session || !tag) {
+        pdebug(DEBUG_WARN, "Called with null session or tag pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(tag->encoded_name_size <= 0 || tag->encoded_type_info_size <= 0 || tag->elem_size <= 0) {
+        pdebug(DEBUG_DETAIL, "Tag %" PRId32 " does not have a complete type yet.", tag->tag_id);
+        return PLCTAG_STATUS_OK;
+    }
+
+    critical_block(session->session_mutex) {
+        for(int i = 0; i < vector_length(session->type_cache); i++) {
+            session_type_entry_p tmp = vector_get(session->type_cache, i);
+
+            if(tmp->encoded_name_size == tag->encoded_name_size
+               && mem_cmp(tmp->encoded_name, tmp->encoded_name_size, tag->encoded_name, tag->encoded_name_size) == 0) {
+                entry = tmp;
+                break;
+            }
+        }
+
+        if(!entry) {
+            if(vector_length(session->type_cache) >= SESSION_MAX_TYPE_CACHE) {
+                entry = vector_remove(session->type_cache, 0);
+            } else {
+                entry = mem_alloc((int)sizeof(*entry));
+                if(!entry) {
+                    pdebug(DEBUG_WARN, "Unable to allocate type cache entry!");
+                    rc = PLCTAG_ERR_NO_MEM;
+                    break;
+                }
+            }
+
+            mem_copy(entry->encoded_name, tag->encoded_name, tag->encoded_name_size);
+            entry->encoded_name_size = tag->encoded_name_size;
+
+            rc = vector_insert(session->type_cache, vector_length(session->type_cache), entry);
+            if(rc != PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_WARN, "Unable to add type cache entry!");
+                mem_free(entry);
+                break;
+            }
+        }
+
+        mem_copy(entry->encoded_type_info, tag->encoded_type_info, tag->encoded_type_info_size);
+        entry->encoded_type_info_size = tag->encoded_type_info_size;
+        entry->elem_size = tag->elem_size;
+    }
+
+    return rc;
+}
+
+
 int session_find_or_create(ab_session_p *tag_session, attr attribs) {
     /*int debug = attr_get_int(attribs,"debug",0);*/
     const char *session_gw = attr_get_str(attribs, "gateway", "");
@@ -285,9 +473,23 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs) {
     int auto_disconnect_timeout_ms = INT_MAX;
     int connection_group_id = attr_get_int(attribs, "connection_group_id", 0);
     int only_use_old_forward_open = attr_get_int(attribs, "conn_only_use_old_forward_open", 0);
+    int max_requests_in_flight = attr_get_int(attribs, "max_requests_in_flight", 1);
 
     pdebug(DEBUG_DETAIL, "Starting");
 
+    /* clamp maximum requests in flight. */
+    if(max_requests_in_flight > SESSION_MAX_REQUESTS_IN_FLIGHT) {
+        pdebug(DEBUG_WARN, "max_requests_in_flight set to %d which is higher than the limit of %d.", max_requests_in_flight,
+               SESSION_MAX_REQUESTS_IN_FLIGHT);
+        max_requests_in_flight = SESSION_MAX_REQUESTS_IN_FLIGHT;
+    }
+
+    if(max_requests_in_flight < 1) {
+        pdebug(DEBUG_WARN, "max_requests_in_flight must be between 1 and %d, inclusive, was %d.",
+               SESSION_MAX_REQUESTS_IN_FLIGHT, max_requests_in_flight);
+        max_requests_in_flight = 1;
+    }
+
     auto_disconnect_timeout_ms = attr_get_int(attribs, "auto_disconnect_ms", INT_MAX);
     if(auto_disconnect_timeout_ms != INT_MAX) {
         pdebug(DEBUG_DETAIL, "Setting auto-disconnect after %dms.", auto_disconnect_timeout_ms);
@@ -353,6 +555,10 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs) {
             } else {
                 session->auto_disconnect_enabled = auto_disconnect_enabled;
                 session->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
+                session->max_requests_in_flight = max_requests_in_flight;
+
+                /* start with what an earlier session learned about this PLC. */
+                apply_profile_unsafe(session);
 
                 /* see if we have an attribute set for forcing the use of the older ForwardOpen */
                 pdebug(DEBUG_DETAIL, "Passed attribute to prohibit use of extended ForwardOpen is %d.",
@@ -360,6 +566,7 @@ int session_find_or_create(ab_session_p *tag_session, attr attribs) {
                 pdebug(DEBUG_DETAIL, "Existing attribute to prohibit use of extended ForwardOpen is %d.",
                        session->only_use_old_forward_open);
                 session->only_use_old_forward_open = (session->only_use_old_forward_open ? 1 : only_use_old_forward_open);
+                session->forced_old_forward_open = (only_use_old_forward_open ? true : false);
 
                 new_session = 1;
             }
@@ -595,6 +802,8 @@ ab_session_p create_lgx_session_unsafe(const char *host, const char *path, int *
             session->fo_conn_size = MAX_CIP_LGX_MSG_SIZE;
             session->fo_ex_conn_size = MAX_CIP_LGX_MSG_SIZE_EX;
             session->max_payload_size = (uint16_t)session->fo_conn_size;
+            session->profile_known = false;
+            session->supports_packing = true;
         } else {
             pdebug(DEBUG_WARN, "Unable to create *Logix session!");
         }
@@ -639,10 +848,13 @@ ab_session_p create_micro800_session_unsafe(const char *host, const char *path,
         session = session_create_unsafe(MAX_CIP_MICRO800_MSG_SIZE_EX, true, host, path, AB_PLC_MICRO800, use_connected_msg,
                                         connection_group_id);
         if(session != NULL) {
-            session->only_use_old_forward_open = true;
+            /* older firmware only takes the old Forward Open and cannot pack requests, the probe finds out. */
+            session->only_use_old_forward_open = false;
             session->fo_conn_size = MAX_CIP_MICRO800_MSG_SIZE;
             session->fo_ex_conn_size = MAX_CIP_MICRO800_MSG_SIZE_EX;
             session->max_payload_size = (uint16_t)session->fo_conn_size;
+            session->profile_known = false;
+            session->supports_packing = false;
         } else {
             pdebug(DEBUG_WARN, "Unable to create Micrologix session!");
         }
@@ -775,6 +987,30 @@ ab_session_p session_create_unsafe(int max_payload_capacity, bool data_buffer_is
         return NULL;
     }
 
+    session->parent_read_groups = vector_create(SESSION_MIN_PARENT_READ_GROUPS, SESSION_INC_PARENT_READ_GROUPS);
+    if(!session->parent_read_groups) {
+        pdebug(DEBUG_WARN, "Unable to allocate vector for parent read groups!");
+        pdebug(DEBUG_DETAIL, "rc:dec: Releasing session reference.");
+        rc_dec(session);
+        return NULL;
+    }
+
+    session->parent_read_listings = vector_create(SESSION_MIN_PARENT_READ_LISTINGS, SESSION_INC_PARENT_READ_LISTINGS);
+    if(!session->parent_read_listings) {
+        pdebug(DEBUG_WARN, "Unable to allocate vector for tag listings!");
+        pdebug(DEBUG_DETAIL, "rc:dec: Releasing session reference.");
+        rc_dec(session);
+        return NULL;
+    }
+
+    session->type_cache = vector_create(SESSION_MIN_TYPE_CACHE, SESSION_INC_TYPE_CACHE);
+    if(!session->type_cache) {
+        pdebug(DEBUG_WARN, "Unable to allocate vector for the type cache!");
+        pdebug(DEBUG_DETAIL, "rc:dec: Releasing session reference.");
+        rc_dec(session);
+        return NULL;
+    }
+
     /* check for ID set up. This does not need to be thread safe since we just need a random value. */
     if(connection_id == 0) { connection_id = (uint32_t)(random_u64(UINT32_MAX) + 1); }
 
@@ -787,6 +1023,13 @@ ab_session_p session_create_unsafe(int max_payload_capacity, bool data_buffer_is
     session->is_dhp = is_dhp;
     session->dhp_dest = dhp_dest;
 
+    /* only Logix-class PLCs are probed, the creators of those sessions clear this. */
+    session->profile_known = true;
+    session->supports_packing = true;
+
+    metrics_init(&session->metrics, &library_metrics);
+    poll_planner_init(&session->poll_planner);
+
     pdebug(DEBUG_DETAIL, "Setting connection_group_id to %d.", connection_group_id);
     session->connection_group_id = connection_group_id;
 
@@ -822,6 +1065,13 @@ int session_init(ab_session_p session) {
 
     pdebug(DEBUG_INFO, "Starting.");
 
+    /* the first tag sets how many packets may wait for replies at once. */
+    if((rc = eip_in_flight_init(&session->in_flight, session->max_requests_in_flight)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to allocate the packets in flight!");
+        session->failed = 1;
+        return rc;
+    }
+
     /* create the session mutex. */
     if((rc = mutex_create(&(session->session_mutex))) != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to create session mutex!");
@@ -829,6 +1079,12 @@ int session_init(ab_session_p session) {
         return rc;
     }
 
+    if((rc = mutex_create(&(session->parent_read_listings_mutex))) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create tag listing mutex!");
+        session->failed = 1;
+        return rc;
+    }
+
     /* create the session condition variable. */
     if((rc = cond_create(&(session->session_wait_cond))) != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to create session condition var!");
@@ -913,42 +1169,23 @@ int session_open_socket(ab_session_p session) {
 
 
 int session_register(ab_session_p session) {
-    eip_session_reg_req *req;
-    eip_encap *resp;
+    int data_size = 0;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting.");
 
     /*
-     * clear the session data.
-     *
      * We use the receiving buffer because we do not have a request and nothing can
      * be coming in (we hope) on the socket yet.
      */
-    mem_set(session->data, 0, sizeof(eip_session_reg_req));
-
-    req = (eip_session_reg_req *)(session->data);
-
-    /* fill in the fields of the request */
-    req->encap_command = h2le16(AB_EIP_REGISTER_SESSION);
-    req->encap_length = h2le16(sizeof(eip_session_reg_req) - sizeof(eip_encap));
-    req->encap_session_handle = h2le32(/*session->session_handle*/ 0);
-    req->encap_status = h2le32(0);
-    req->encap_sender_context = h2le64((uint64_t)0);
-    req->encap_options = h2le32(0);
-
-    req->eip_version = h2le16(AB_EIP_VERSION);
-    req->option_flags = h2le16(0);
-
-    /*
-     * socket ops here are _ASYNCHRONOUS_!
-     *
-     * This is done this way because we do not have everything
-     * set up for a request to be handled by the thread.  I think.
-     */
+    rc = eip_build_register_session(session->data, (int)session->data_capacity, &data_size);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to build session registration request %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
 
     /* send registration to the gateway */
-    session->data_size = sizeof(eip_session_reg_req);
+    session->data_size = (uint32_t)data_size;
     session->data_offset = 0;
 
     rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT);
@@ -964,26 +1201,13 @@ int session_register(ab_session_p session) {
         return rc;
     }
 
-    /* encap header is at the start of the buffer */
-    resp = (eip_encap *)(session->data);
-
-    /* check the response status */
-    if(le2h16(resp->encap_command) != AB_EIP_REGISTER_SESSION) {
-        pdebug(DEBUG_WARN, "EIP unexpected response packet type: %d!", resp->encap_command);
-        return PLCTAG_ERR_BAD_DATA;
-    }
-
-    if(le2h32(resp->encap_status) != AB_EIP_OK) {
-        pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(resp->encap_status));
-        return PLCTAG_ERR_REMOTE_ERR;
+    /* save the session handle, we will use it in future packets. */
+    rc = eip_check_register_session_response(session->data, (int)session->data_size, &session->session_handle);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Session registration failed %s!", plc_tag_decode_error(rc));
+        return rc;
     }
 
-    /*
-     * after all that, save the session handle, we will
-     * use it in future packets.
-     */
-    session->session_handle = le2h32(resp->encap_session_handle);
-
     pdebug(DEBUG_INFO, "Done.");
 
     return PLCTAG_STATUS_OK;
@@ -1034,6 +1258,9 @@ void session_destroy(void *session_arg) {
 
     pdebug(DEBUG_INFO, "Session sent %" PRId64 " packets.", session->packet_count);
 
+    /* take this session's queue out of the library total. */
+    metrics_set_queue_depth(&session->metrics, 0);
+
     /* terminate the session thread first. */
     session->terminating = 1;
 
@@ -1083,6 +1310,36 @@ void session_destroy(void *session_arg) {
             vector_destroy(session->requests);
             session->requests = NULL;
         }
+
+        /* the session thread is gone, release anything it still had on the wire. */
+        for(int p = 0; p < session->in_flight.num_packets; p++) {
+            for(int i = 0; i < session->in_flight.packets[p].num_requests; i++) {
+                pdebug(DEBUG_DETAIL, "rc_dec: Releasing request reference.");
+                rc_dec(session->in_flight.packets[p].requests[i]);
+            }
+        }
+
+        eip_in_flight_destroy(&session->in_flight);
+
+        /* the groups belong to their member tags, which are all gone by now. */
+        if(session->parent_read_groups) {
+            vector_destroy(session->parent_read_groups);
+            session->parent_read_groups = NULL;
+        }
+
+        /* the listing tags hold the session, so none is still being read. */
+        if(session->parent_read_listings) {
+            parent_read_forget_listings(session);
+            vector_destroy(session->parent_read_listings);
+            session->parent_read_listings = NULL;
+        }
+
+        if(session->type_cache) {
+            for(int i = 0; i < vector_length(session->type_cache); i++) { mem_free(vector_get(session->type_cache, i)); }
+
+            vector_destroy(session->type_cache);
+            session->type_cache = NULL;
+        }
     }
 
     /* we are done with the condition variable, finally destroy it. */
@@ -1092,6 +1349,11 @@ void session_destroy(void *session_arg) {
         session->session_wait_cond = NULL;
     }
 
+    if(session->parent_read_listings_mutex) {
+        mutex_destroy(&(session->parent_read_listings_mutex));
+        session->parent_read_listings_mutex = NULL;
+    }
+
     /* we are done with the mutex, finally destroy it. */
     pdebug(DEBUG_DETAIL, "Destroying session mutex.");
     if(session->session_mutex) {
@@ -1187,6 +1449,7 @@ typedef enum {
     SESSION_REGISTER,
     SESSION_SEND_FORWARD_OPEN,
     SESSION_RECEIVE_FORWARD_OPEN,
+    SESSION_PROBE,
     SESSION_IDLE,
     SESSION_DISCONNECT,
     SESSION_UNREGISTER,
@@ -1208,6 +1471,7 @@ THREAD_FUNC(session_handler) {
     unsigned int retry_count = 0;
     int64_t retry_wait_ms = 0;
     int auto_disconnect = 0;
+    int has_registered = 0;
 
 
     pdebug(DEBUG_INFO, "Starting thread for session %p", session);
@@ -1228,6 +1492,9 @@ THREAD_FUNC(session_handler) {
         pdebug(DEBUG_SPEW, "Critical block.");
         critical_block(session->session_mutex) { purge_aborted_requests_unsafe(session); }
 
+        /* the parent read groups create and read their internal tags from here, outside any tag lock. */
+        parent_read_service(session);
+
         switch(state) {
             case SESSION_OPEN_SOCKET_START:
                 pdebug(DEBUG_DETAIL, "in SESSION_OPEN_SOCKET_START state.");
@@ -1296,6 +1563,13 @@ THREAD_FUNC(session_handler) {
                 } else {
                     retry_wait_ms = RETRY_WAIT_INITIAL_MS;
 
+                    /* the PLC may have a new program, read the tag listings again. */
+                    if(has_registered) {
+                        metrics_record_reconnect(&session->metrics);
+                        parent_read_forget_listings(session);
+                    }
+                    has_registered = 1;
+
                     if(session->use_connected_msg) {
                         state = SESSION_SEND_FORWARD_OPEN;
                     } else {
@@ -1333,15 +1607,49 @@ THREAD_FUNC(session_handler) {
                     } else if(rc == PLCTAG_ERR_UNSUPPORTED && !session->only_use_old_forward_open) {
                         /* if we got an unsupported error and we are trying with ForwardOpenEx, then try the old command. */
                         pdebug(DEBUG_DETAIL, "PLC does not support ForwardOpenEx, trying old ForwardOpen.");
+                        forget_profile(session);
                         session->only_use_old_forward_open = 1;
+                        session->old_forward_open_reported = true;
                         state = SESSION_SEND_FORWARD_OPEN;
+                    } else if(!session->only_use_old_forward_open
+                              && (rc == PLCTAG_ERR_REMOTE_ERR || session->plc_type == AB_PLC_MICRO800)) {
+                        /*
+                         * Some PLCs refuse ForwardOpenEx with other errors and older Micro800 firmware may
+                         * just drop the connection, so fall back to the old ForwardOpen.  A dropped
+                         * connection could be anything, so only an error from the PLC is remembered.
+                         */
+                        pdebug(DEBUG_DETAIL, "ForwardOpenEx failed with %s, trying old ForwardOpen.", plc_tag_decode_error(rc));
+                        forget_profile(session);
+                        session->only_use_old_forward_open = 1;
+                        session->old_forward_open_reported = (rc == PLCTAG_ERR_REMOTE_ERR);
+                        state = (rc == PLCTAG_ERR_REMOTE_ERR) ? SESSION_SEND_FORWARD_OPEN : SESSION_UNREGISTER;
                     } else {
                         pdebug(DEBUG_WARN, "Receive Forward Open failed %s!", plc_tag_decode_error(rc));
+                        forget_profile(session);
                         state = SESSION_UNREGISTER;
                     }
                 } else {
                     retry_wait_ms = RETRY_WAIT_INITIAL_MS;
-                    pdebug(DEBUG_DETAIL, "Send Forward Open succeeded, going to SESSION_IDLE state.");
+
+                    if(session->profile_known) {
+                        pdebug(DEBUG_DETAIL, "Send Forward Open succeeded, going to SESSION_IDLE state.");
+                        state = SESSION_IDLE;
+                    } else {
+                        pdebug(DEBUG_DETAIL, "Send Forward Open succeeded, going to SESSION_PROBE state.");
+                        state = SESSION_PROBE;
+                    }
+                }
+                cond_signal(session->session_wait_cond);
+                break;
+
+            case SESSION_PROBE:
+                pdebug(DEBUG_DETAIL, "in SESSION_PROBE state.");
+
+                if((rc = probe_plc(session)) != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Probing the PLC failed %s!", plc_tag_decode_error(rc));
+                    forget_profile(session);
+                    state = SESSION_DISCONNECT;
+                } else {
                     state = SESSION_IDLE;
                 }
                 cond_signal(session->session_wait_cond);
@@ -1353,7 +1661,7 @@ THREAD_FUNC(session_handler) {
                 /* if there is work to do, make sure we do not disconnect. */
                 critical_block(session->session_mutex) {
                     int num_reqs = vector_length(session->requests);
-                    if(num_reqs > 0) {
+                    if(num_reqs > 0 || session->in_flight.num_packets > 0) {
                         pdebug(DEBUG_DETAIL, "There are %d requests pending before cleanup and sending.", num_reqs);
                         auto_disconnect_time = now + SESSION_DISCONNECT_TIMEOUT;
                     }
@@ -1387,7 +1695,7 @@ THREAD_FUNC(session_handler) {
                 /* if there is work to do, make sure we signal the condition var. */
                 critical_block(session->session_mutex) {
                     int num_reqs = vector_length(session->requests);
-                    if(num_reqs > 0) {
+                    if(num_reqs > 0 || session->in_flight.num_packets > 0) {
                         pdebug(DEBUG_DETAIL, "There are %d requests still pending after abort purge and sending.", num_reqs);
                         cond_signal(session->session_wait_cond);
                     }
@@ -1439,6 +1747,8 @@ THREAD_FUNC(session_handler) {
                 timeout_time = now + calc_retry_time(retry_count);
                 retry_count++;
 
+                metrics_record_retry(&session->metrics);
+
                 pdebug(DEBUG_DETAIL, "Waiting %dms before trying to reconnect.", (int)(retry_wait_ms));
 
                 /* start waiting. */
@@ -1531,6 +1841,14 @@ int purge_aborted_requests_unsafe(ab_session_p session) {
     for(int i = 0; i < vector_length(session->requests); i++) {
         request = vector_get(session->requests, i);
 
+        /* an abort anywhere in a merged chain breaks it up, the rest get merged again. */
+        for(ab_request_p merged = request; merged; merged = merged->merged_next) {
+            if(merged->abort_request) {
+                unmerge_bit_writes_unsafe(session, i);
+                break;
+            }
+        }
+
         /* filter out the aborts. */
         if(request && request->abort_request) {
             purge_count++;
@@ -1564,36 +1882,56 @@ int purge_aborted_requests_unsafe(ab_session_p session) {
 }
 
 
+/*
+ * process_requests
+ *
+ * Hand the queue to the EIP request loop, see eip_process_requests().
+ */
+
 int process_requests(ab_session_p session) {
-    int rc = PLCTAG_STATUS_OK;
-    ab_request_p request = NULL;
-    ab_request_p bundled_requests[MAX_REQUESTS] = {NULL};
-    int num_bundled_requests = 0;
-    int remaining_space = 0;
+    struct eip_request_loop_t loop = {0};
 
     debug_set_tag_id(0);
 
-    pdebug(DEBUG_SPEW, "Starting.");
-
     if(!session) {
         pdebug(DEBUG_WARN, "Null session pointer!");
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    pdebug(DEBUG_SPEW, "Checking for requests to process.");
+    loop.owner = session;
+    loop.ops = &session_request_ops;
+    loop.sock = session->sock;
+    loop.terminating = &session->terminating;
+    loop.timeout = SESSION_DEFAULT_TIMEOUT;
+    loop.buf = session->data;
+    loop.buf_capacity = (int)session->data_capacity;
+    loop.session_handle = session->session_handle;
+    loop.session_seq_id = &session->session_seq_id;
+    loop.targ_connection_id = session->targ_connection_id;
+    loop.conn_seq_num = &session->conn_seq_num;
+    loop.in_flight = &session->in_flight;
+    loop.metrics = &session->metrics;
+
+    return eip_process_requests(&loop);
+}
 
-    rc = PLCTAG_STATUS_OK;
-    request = NULL;
-    session->data_size = 0;
-    session->data_offset = 0;
 
-    /* grab a request off the front of the list. */
+/*
+ * select_requests
+ *
+ * Request loop hook.  Get rid of aborted requests, merge bit writes and take
+ * the requests for the next packet off the queue.
+ */
+
+int select_requests(void *session_arg, void **requests) {
+    ab_session_p session = (ab_session_p)session_arg;
+    ab_request_p selected[MAX_REQUESTS];
+    int num_selected = 0;
+    int num_merged_requests = 0;
+
     critical_block(session->session_mutex) {
         int max_payload_size = GET_MAX_PAYLOAD_SIZE(session);
 
-        // FIXME - no logging in a mutex!
-        // pdebug(DEBUG_DETAIL, "FIXME: max payload size %d", max_payload_size);
-
         /* is there anything to do? */
         if(vector_length(session->requests)) {
             /* get rid of all aborted requests. */
@@ -1601,576 +1939,677 @@ int process_requests(ab_session_p session) {
 
             /* if there are still requests after purging all the aborted requests, process them. */
 
-            /* how much space do we have to work with. */
-            remaining_space = max_payload_size - (int)sizeof(cip_multi_req_header);
-
             if(vector_length(session->requests)) {
-                do {
-                    request = vector_get(session->requests, 0);
-
-                    remaining_space = remaining_space - get_payload_size(request);
-
-                    /*
-                     * If we have a non-packable request, only queue it if it is the first one.
-                     * If the request is packable, keep queuing as long as there is space.
-                     */
-
-                    if(num_bundled_requests == 0 || (request->allow_packing && remaining_space > 0)) {
-                        // pdebug(DEBUG_DETAIL, "packed %d requests with remaining space %d", num_bundled_requests+1,
-                        // remaining_space);
-                        bundled_requests[num_bundled_requests] = request;
-                        num_bundled_requests++;
-
-                        /* remove it from the queue. */
-                        vector_remove(session->requests, 0);
-                    }
-                } while(vector_length(session->requests) && remaining_space > 0 && num_bundled_requests < MAX_REQUESTS
-                        && request->allow_packing);
+                num_merged_requests = merge_bit_writes_unsafe(session);
+                num_selected = select_requests_unsafe(session, selected, max_payload_size);
             } else {
                 pdebug(DEBUG_DETAIL, "All requests in queue were aborted, nothing to do.");
             }
         }
+
+        metrics_set_queue_depth(&session->metrics, vector_length(session->requests));
     }
 
-    /* output debug display as no particular tag. */
     debug_set_tag_id(0);
 
-    if(num_bundled_requests > 0) {
-
-        pdebug(DEBUG_INFO, "%d requests to process.", num_bundled_requests);
+    if(num_merged_requests > 0) { pdebug(DEBUG_DETAIL, "Merged %d bit writes into earlier ones.", num_merged_requests); }
 
-        do {
-            /* copy and pack the requests into the session buffer. */
-            /* FIXME - pack_requests() only returns PLCTAG_STATUS_OK */
-            rc = pack_requests(session, bundled_requests, num_bundled_requests);
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error while packing requests, %s!", plc_tag_decode_error(rc));
-                break;
-            }
+    for(int i = 0; i < num_selected; i++) { requests[i] = selected[i]; }
 
-            /* fill in all the necessary parts to the request. */
-            if((rc = prepare_request(session)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unable to prepare request, %s!", plc_tag_decode_error(rc));
-                break;
-            }
+    return num_selected;
+}
 
-            /* send the request */
-            if((rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error sending packet %s!", plc_tag_decode_error(rc));
-                break;
-            }
 
-            /* wait for the response */
-            if((rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error receiving packet response %s!", plc_tag_decode_error(rc));
-                break;
-            }
+void get_request_data(void *request_arg, uint8_t **data, int *data_size) {
+    ab_request_p request = (ab_request_p)request_arg;
 
-            /*
-             * check the CIP status, but only if this is a bundled
-             * response.   If it is a singleton, then we pass the
-             * status back to the tag.
-             */
-            if(num_bundled_requests > 1) {
-                cip_multi_resp_header *multi_resp = NULL;
+    *data = request->data;
+    *data_size = request->request_size;
+}
 
-                if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_UNCONNECTED_SEND) {
-                    eip_cip_uc_resp *resp = (eip_cip_uc_resp *)(session->data);
-                    uint16_t udi_item_length = le2h16(resp->cpf_udi_item_length);
-                    size_t response_overhead = 0;
-                    size_t response_size = 0;
 
-                    multi_resp = (cip_multi_resp_header *)(&(resp->reply_service));
+/*
+ * complete_request
+ *
+ * Request loop hook.  Give the request its reply and release it.  Bit writes
+ * merged into it get the same reply.
+ */
 
-                    pdebug(DEBUG_INFO, "Received unconnected packet with session sequence ID %llx", resp->encap_sender_context);
+void complete_request(void *session_arg, void *request_arg, uint8_t *reply, int reply_size, int sub_packet) {
+    ab_session_p session = (ab_session_p)session_arg;
+    ab_request_p request = (ab_request_p)request_arg;
 
-                    /* punt if we got an overall error or it is not a partial/bundled error. */
-                    if(resp->status != AB_EIP_OK && resp->status != AB_CIP_ERR_PARTIAL_ERROR) {
-                        rc = decode_cip_error_code(&(resp->status));
-                        pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
-                        break;
-                    }
+    debug_set_tag_id(request->tag_id);
 
-                    response_overhead = (size_t)((uint8_t *)multi_resp - session->data);
-                    response_size = (size_t)session->data_size - response_overhead;
+    while(request) {
+        ab_request_p merged = request->merged_next;
+        int rc = unpack_response(session, request, reply, reply_size, sub_packet);
 
-                    /* check the passed UDI data item size against what we really got. */
-                    if((size_t)udi_item_length != response_size) {
-                        pdebug(DEBUG_WARN,
-                               "Incorrectly constructed response! UDI data length field is %zu but actual size is %zu!",
-                               (size_t)udi_item_length, response_size);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to unpack response!");
 
-                        rc = PLCTAG_ERR_BAD_DATA;
-                        break;
-                    }
-                } else if(le2h16(((eip_encap *)(session->data))->encap_command) == AB_EIP_CONNECTED_SEND) {
-                    eip_cip_co_resp *resp = (eip_cip_co_resp *)(session->data);
-                    uint16_t cdi_item_length = le2h16(resp->cpf_cdi_item_length);
-                    size_t response_overhead = 0;
-                    size_t response_size = 0;
-
-                    multi_resp = (cip_multi_resp_header *)(&(resp->reply_service));
-
-                    pdebug(DEBUG_INFO, "Received connected packet with connection ID %x and sequence ID %u(%x)",
-                           le2h32(resp->cpf_orig_conn_id), le2h16(resp->cpf_conn_seq_num), le2h16(resp->cpf_conn_seq_num));
-
-                    /* punt if we got an overall error or it is not a partial/bundled error. */
-                    if(resp->status != AB_EIP_OK && resp->status != AB_CIP_ERR_PARTIAL_ERROR) {
-                        rc = decode_cip_error_code(&(resp->status));
-                        pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
-                        break;
-                    }
+            /* let the tag see the error instead of waiting for a timeout. */
+            spin_block(&request->lock) {
+                request->status = rc;
+                request->request_size = 0;
+                request->resp_received = 1;
+            }
+        }
 
-                    response_overhead = (size_t)((uint8_t *)(&resp->cpf_conn_seq_num) - session->data);
-                    response_size = (size_t)session->data_size - response_overhead;
+        request->merged_next = NULL;
 
-                    pdebug(DEBUG_DETAIL, "response_overhead=%zu", response_overhead);
-                    pdebug(DEBUG_DETAIL, "response_size=%zu", response_size);
+        /* release our reference */
+        pdebug(DEBUG_DETAIL, "rc_dec: Releasing request reference.");
+        rc_dec(request);
 
-                    /* check the passed CDI data item size against what we really got. */
-                    if((size_t)cdi_item_length != response_size) {
-                        pdebug(DEBUG_WARN,
-                               "Incorrectly constructed response! CDI data length field is %zu but actual size is %zu!",
-                               (size_t)cdi_item_length, response_size);
+        request = merged;
+    }
+}
 
-                        rc = PLCTAG_ERR_BAD_DATA;
-                        break;
-                    }
-                } else {
-                    pdebug(DEBUG_WARN, "Unexpected EIP packet type, %04x!",
-                           le2h16(((eip_encap *)(session->data))->encap_command));
-                    rc = PLCTAG_ERR_BAD_DATA;
-                    break;
-                }
 
-                /* we have multiple requests, sanity check the data. */
-                if(le2h16(multi_resp->request_count) == num_bundled_requests) {
-                    size_t offset_base = (size_t)((uint8_t *)(&multi_resp->request_count) - session->data);
+/*
+ * requeue_requests
+ *
+ * Request loop hook.  Put requests back at the head of the queue in order.
+ */
 
-                    pdebug(DEBUG_DETAIL, "offset_base=%zu", offset_base);
+void requeue_requests(void *session_arg, void **requests, int num_requests, int alone) {
+    ab_session_p session = (ab_session_p)session_arg;
 
-                    /* check all the offsets */
-                    for(int resp_index = 0; resp_index < num_bundled_requests; resp_index++) {
-                        size_t resp_offset = (size_t)le2h16(multi_resp->request_offsets[resp_index]) + offset_base;
+    critical_block(session->session_mutex) {
+        for(int i = num_requests - 1; i >= 0; i--) {
+            ab_request_p request = (ab_request_p)requests[i];
 
-                        pdebug(DEBUG_DETAIL, "Response %d starts at byte offset %zu", resp_offset);
+            if(alone) { request->allow_packing = 0; }
 
-                        if(resp_offset >= (size_t)session->data_size) {
-                            pdebug(DEBUG_WARN, "Response %d has offset %zu which is outside the session data!", resp_offset);
-                            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
-                            break;
-                        }
-                    }
-                } else {
-                    pdebug(DEBUG_WARN, "Expected %d packed responses back but got %zu!", num_bundled_requests,
-                           (size_t)le2h16(multi_resp->request_count));
-                    rc = PLCTAG_ERR_BAD_DATA;
-                    break;
-                }
+            vector_insert(session->requests, 0, request);
+        }
+    }
+}
 
-                /* we have multiple requests, sanity check the data. */
-                if(le2h16(multi_resp->request_count) == num_bundled_requests) {
-                    size_t offset_base = (size_t)((uint8_t *)(&multi_resp->request_count) - session->data);
 
-                    pdebug(DEBUG_DETAIL, "offset_base=%zu", offset_base);
+int unpack_response(ab_session_p session, ab_request_p request, uint8_t *reply, int reply_size, int sub_packet) {
+    int rc = PLCTAG_STATUS_OK;
+    int new_eip_len = 0;
 
-                    /* check all the offsets */
-                    for(int resp_index = 0; resp_index < num_bundled_requests; resp_index++) {
-                        size_t resp_offset = (size_t)le2h16(multi_resp->request_offsets[resp_index]) + offset_base;
+    pdebug(DEBUG_INFO, "Starting.");
 
-                        pdebug(DEBUG_DETAIL, "Response %d starts at byte offset %zu", resp_offset);
+    /* clear out the request data. */
+    mem_set(request->data, 0, request->request_capacity);
 
-                        if(resp_offset >= (size_t)session->data_size) {
-                            pdebug(DEBUG_WARN, "Response %d has offset %zu which is outside the session data!", resp_offset);
-                            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
-                            break;
-                        }
-                    }
-                } else {
-                    pdebug(DEBUG_WARN, "Expected %d packed responses back but got %zu!", num_bundled_requests,
-                           (size_t)le2h16(multi_resp->request_count));
-                    rc = PLCTAG_ERR_BAD_DATA;
-                    break;
-                }
-            }
+    rc = eip_unpack_response(reply, reply_size, sub_packet, request->data, request->request_capacity, &new_eip_len);
 
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Got error %s when processing incoming response(s)!", plc_tag_decode_error(rc));
-                break;
-            }
+    /* replace the request buffer if it is not big enough. */
+    if(rc == PLCTAG_ERR_TOO_SMALL) {
+        int request_capacity = 0;
 
-            /* copy the results back out. Every request gets a copy. */
-            for(int i = 0; i < num_bundled_requests; i++) {
-                debug_set_tag_id(bundled_requests[i]->tag_id);
+        pdebug(DEBUG_INFO, "Request buffer too small, allocating larger buffer.");
 
-                rc = unpack_response(session, bundled_requests[i], i);
-                if(rc != PLCTAG_STATUS_OK) {
-                    pdebug(DEBUG_WARN, "Unable to unpack response!");
-                    break;
-                }
+        critical_block(session->session_mutex) {
+            int max_payload_size = GET_MAX_PAYLOAD_SIZE(session);
 
-                /* release our reference */
-                pdebug(DEBUG_DETAIL, "rc_dec: Releasing request reference.");
-                bundled_requests[i] = rc_dec(bundled_requests[i]);
-            }
+            request_capacity = (int)(max_payload_size + EIP_CIP_PREFIX_SIZE);
+        }
 
-            rc = PLCTAG_STATUS_OK;
-        } while(0);
+        /* make sure it will fit. */
+        if(new_eip_len > request_capacity) {
+            pdebug(DEBUG_WARN, "something is very wrong, packet length is %d but allowable capacity is %d!", new_eip_len,
+                   request_capacity);
+            return PLCTAG_ERR_TOO_LARGE;
+        }
 
-        /* problem? push the requests back on the queue. */
+        rc = session_request_increase_buffer(request, request_capacity);
         if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Error sending or receiving requests!");
-
-            pdebug(DEBUG_INFO, "Pushing %d requests back into the queue.", num_bundled_requests);
-
-            for(int i = num_bundled_requests - 1; i >= 0; i--) {
-                if(bundled_requests[i]) { vector_insert(session->requests, 0, bundled_requests[i]); }
-            }
+            pdebug(DEBUG_WARN, "Unable to increase request buffer size to %d bytes!", request_capacity);
+            return rc;
         }
 
-        /* tickle the main tickler thread to note that we have responses. */
-        plc_tag_tickler_wake();
+        rc = eip_unpack_response(reply, reply_size, sub_packet, request->data, request->request_capacity, &new_eip_len);
     }
 
-    debug_set_tag_id(0);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to unpack response %d, %s!", sub_packet, plc_tag_decode_error(rc));
+        return rc;
+    }
 
-    pdebug(DEBUG_SPEW, "Done.");
+    pdebug(DEBUG_INFO, "Unpacked packet:");
+    pdebug_dump_bytes(DEBUG_INFO, request->data, new_eip_len);
 
-    return rc;
+    /* notify the reading thread that the request is ready */
+    spin_block(&request->lock) {
+        request->status = PLCTAG_STATUS_OK;
+        request->request_size = new_eip_len;
+        request->resp_received = 1;
+    }
+
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return PLCTAG_STATUS_OK;
 }
 
 
-int unpack_response(ab_session_p session, ab_request_p request, int sub_packet) {
-    int rc = PLCTAG_STATUS_OK;
-    eip_cip_co_resp *packed_resp = (eip_cip_co_resp *)(session->data);
-    eip_cip_co_resp *unpacked_resp = NULL;
-    uint8_t *pkt_start = NULL;
-    uint8_t *pkt_end = NULL;
-    int new_eip_len = 0;
+/*
+ * merge_bit_writes_unsafe
+ *
+ * Fold queued bit writes into the first queued bit write to the same
+ * integer, so that one Read-Modify-Write sets and clears the bits of all of
+ * them.  The merged requests come off the queue and hang off the one they
+ * were merged into until its reply comes back.
+ *
+ * A bit write only moves ahead of reads and bit writes of other tags.
+ * Anything else may depend on the order of the writes, so it ends the search.
+ * The request keeps a copy of its own data so that the chain can be taken
+ * apart again if one of the merged requests is aborted.
+ *
+ * Returns the number of requests merged.  Must be called with the session mutex held.
+ */
 
-    pdebug(DEBUG_INFO, "Starting.");
+int merge_bit_writes_unsafe(ab_session_p session) {
+    int window = vector_length(session->requests);
+    int merge_count = 0;
 
-    /* clear out the request data. */
-    mem_set(request->data, 0, request->request_capacity);
+    if(window > MAX_REQUESTS) { window = MAX_REQUESTS; }
 
-    /* change what we do depending on the type. */
-    if(packed_resp->reply_service != (AB_EIP_CMD_CIP_MULTI | AB_EIP_CMD_CIP_OK)) {
-        /* copy the data back into the request buffer. */
-        new_eip_len = (int)session->data_size;
-        pdebug(DEBUG_INFO, "Got single response packet.  Copying %d bytes unchanged.", new_eip_len);
+    for(int i = 0; i < window; i++) {
+        ab_request_p request = vector_get(session->requests, i);
+        ab_request_p *tail = NULL;
 
-        if(new_eip_len > request->request_capacity) {
-            int request_capacity = 0;
+        if(!request->is_bit_write || !request->allow_packing) { continue; }
 
-            pdebug(DEBUG_INFO, "Request buffer too small, allocating larger buffer.");
+        tail = &request->merged_next;
 
-            critical_block(session->session_mutex) {
-                int max_payload_size = GET_MAX_PAYLOAD_SIZE(session);
+        for(int j = i + 1; j < window; j++) {
+            ab_request_p other = vector_get(session->requests, j);
 
-                // FIXME - no logging in a mutex!
-                // pdebug(DEBUG_DETAIL, "FIXME: max payload size %d", max_payload_size);
+            if(!other->is_bit_write || !other->allow_packing || save_unmerged_data(request) != PLCTAG_STATUS_OK
+               || eip_merge_rmw_requests(request->data, request->request_size, other->data, other->request_size)
+                      != PLCTAG_STATUS_OK) {
+                /* the writes may not pass anything else, or anything that touches the same tag. */
+                if(!(other->is_read || (other->is_bit_write && other->allow_packing))
+                   || eip_requests_overlap(request->data, request->request_size, other->data, other->request_size)) {
+                    break;
+                }
 
-                request_capacity = (int)(max_payload_size + EIP_CIP_PREFIX_SIZE);
+                continue;
             }
 
-            /* make sure it will fit. */
-            if(new_eip_len > request_capacity) {
-                pdebug(DEBUG_WARN, "something is very wrong, packet length is %d but allowable capacity is %d!", new_eip_len,
-                       request_capacity);
-                return PLCTAG_ERR_TOO_LARGE;
-            }
+            /* the queue's reference moves to the chain, with anything already merged into it. */
+            vector_remove(session->requests, j);
+            j--;
+            window--;
 
-            rc = session_request_increase_buffer(request, request_capacity);
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unable to increase request buffer size to %d bytes!", request_capacity);
-                return rc;
-            }
+            while(*tail) { tail = &(*tail)->merged_next; }
+
+            *tail = other;
+
+            merge_count++;
         }
+    }
+
+    return merge_count;
+}
 
-        mem_copy(request->data, session->data, new_eip_len);
-    } else {
-        cip_multi_resp_header *multi = (cip_multi_resp_header *)(&packed_resp->reply_service);
-        uint16_t total_responses = le2h16(multi->request_count);
-        int pkt_len = 0;
 
-        /* this is a packed response. */
-        pdebug(DEBUG_INFO, "Got multiple response packet, subpacket %d", sub_packet);
 
-        pdebug(DEBUG_INFO, "Our result offset is %d bytes.", (int)le2h16(multi->request_offsets[sub_packet]));
+/*
+ * unmerge_bit_writes_unsafe
+ *
+ * Take apart the chain of bit writes merged into the request at index.
+ * Every request in it gets its own data back and returns to the queue, in
+ * order, right after the one it was merged into.
+ *
+ * Must be called with the session mutex held.
+ */
+
+void unmerge_bit_writes_unsafe(ab_session_p session, int index) {
+    ab_request_p request = vector_get(session->requests, index);
 
-        pkt_start = ((uint8_t *)(&multi->request_count) + le2h16(multi->request_offsets[sub_packet]));
+    for(int pos = index; request; pos++) {
+        ab_request_p merged = request->merged_next;
 
-        /* calculate the end of the data. */
-        if((sub_packet + 1) < total_responses) {
-            /* not the last response */
-            pkt_end = (uint8_t *)(&multi->request_count) + le2h16(multi->request_offsets[sub_packet + 1]);
-        } else {
-            pkt_end = (session->data + le2h16(packed_resp->encap_length) + sizeof(eip_encap));
+        if(request->unmerged_data) {
+            mem_copy(request->data, request->unmerged_data, request->request_size);
+            mem_free(request->unmerged_data);
+            request->unmerged_data = NULL;
         }
 
-        pkt_len = (int)(pkt_end - pkt_start);
+        request->merged_next = NULL;
+
+        /* the queue's reference moves back from the chain. */
+        if(pos > index) { vector_insert(session->requests, pos, request); }
 
-        /* replace the request buffer if it is not big enough. */
-        new_eip_len = pkt_len + (int)sizeof(eip_cip_co_generic_response);
-        if(new_eip_len > request->request_capacity) {
-            int request_capacity = 0;
+        request = merged;
+    }
+}
+
+
+/*
+ * save_unmerged_data
+ *
+ * Keep a copy of the request before the first merge changes it.
+ */
+
+int save_unmerged_data(ab_request_p request) {
+    if(request->unmerged_data) { return PLCTAG_STATUS_OK; }
+
+    request->unmerged_data = mem_alloc(request->request_size);
+    if(!request->unmerged_data) {
+        pdebug(DEBUG_WARN, "Unable to allocate a copy of the request!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    mem_copy(request->unmerged_data, request->data, request->request_size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * apply_profile_unsafe
+ *
+ * Set up a new session with what an earlier session to the same host and path
+ * found.  The session then skips probing the PLC.  Must be called with the
+ * global session mutex held.
+ */
+
+void apply_profile_unsafe(ab_session_p session) {
+    if(session->profile_known || !profiles) { return; }
 
-            pdebug(DEBUG_INFO, "Request buffer too small, allocating larger buffer.");
+    for(int i = 0; i < vector_length(profiles); i++) {
+        session_profile_p profile = vector_get(profiles, i);
 
-            critical_block(session->session_mutex) {
-                int max_payload_size = GET_MAX_PAYLOAD_SIZE(session);
+        if(str_cmp_i(profile->host, session->host) || str_cmp_i(profile->path, session->path)) { continue; }
 
-                // FIXME: no logging in a mutex!
-                // pdebug(DEBUG_DETAIL, "max payload size %d", max_payload_size);
+        session->supports_packing = profile->supports_packing;
+        session->only_use_old_forward_open = profile->only_use_old_forward_open;
+        session->old_forward_open_reported = profile->only_use_old_forward_open;
+        session->max_payload_guess = profile->max_payload_size;
+        session->profile_known = true;
 
-                request_capacity = (int)(max_payload_size + EIP_CIP_PREFIX_SIZE);
+        break;
+    }
+}
+
+
+/*
+ * forget_profile
+ *
+ * The PLC did not behave the way the profile for its host and path says, or
+ * it could not be probed.  Remove the profile and go back to the Forward Open
+ * the tag attributes asked for, so the next connection finds out again.  Only
+ * Logix and Micro800 sessions have profiles.
+ */
+
+void forget_profile(ab_session_p session) {
+    if(session->plc_type != AB_PLC_LGX && session->plc_type != AB_PLC_MICRO800) { return; }
+
+    critical_block(session_mutex) {
+        if(!profiles) { break; }
+
+        for(int i = 0; i < vector_length(profiles); i++) {
+            session_profile_p profile = vector_get(profiles, i);
+
+            if(str_cmp_i(profile->host, session->host) || str_cmp_i(profile->path, session->path)) { continue; }
+
+            pdebug(DEBUG_INFO, "Dropping the profile for PLC %s.", session->host);
+
+            vector_remove(profiles, i);
+
+            mem_free(profile->host);
+            mem_free(profile->path);
+            mem_free(profile);
+
+            break;
+        }
+    }
+
+    critical_block(session->session_mutex) {
+        session->profile_known = false;
+        session->only_use_old_forward_open = session->forced_old_forward_open;
+        session->old_forward_open_reported = false;
+        session->max_payload_guess = 0;
+    }
+}
+
+
+/*
+ * save_profile
+ *
+ * Remember what the probe found and the Forward Open that worked for the
+ * host and path of the session.  The old Forward Open and its smaller packet
+ * size are only remembered if the PLC refused the extended one.
+ */
+
+int save_profile(ab_session_p session, session_profile_p found) {
+    int rc = PLCTAG_STATUS_OK;
+    session_profile_p profile = NULL;
+
+    critical_block(session_mutex) {
+        if(!profiles) {
+            rc = PLCTAG_ERR_NULL_PTR;
+            break;
+        }
+
+        for(int i = 0; i < vector_length(profiles); i++) {
+            session_profile_p tmp = vector_get(profiles, i);
+
+            if(!str_cmp_i(tmp->host, session->host) && !str_cmp_i(tmp->path, session->path)) {
+                profile = tmp;
+                break;
             }
+        }
+
+        if(!profile) {
+            profile = mem_alloc((int)sizeof(*profile));
+            if(!profile) {
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
+            }
+
+            *profile = *found;
+            profile->host = str_dup(session->host);
+            profile->path = str_dup(session->path ? session->path : "");
 
-            /* make sure it will fit. */
-            if(new_eip_len > request_capacity) {
-                pdebug(DEBUG_WARN, "something is very wrong, packet length is %d but allowable capacity is %d!", new_eip_len,
-                       request_capacity);
-                return PLCTAG_ERR_TOO_LARGE;
+            if(!profile->host || !profile->path) {
+                mem_free(profile->host);
+                mem_free(profile->path);
+                mem_free(profile);
+                rc = PLCTAG_ERR_NO_MEM;
+                break;
             }
 
-            rc = session_request_increase_buffer(request, request_capacity);
+            rc = vector_insert(profiles, vector_length(profiles), profile);
             if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unable to increase request buffer size to %d bytes!", request_capacity);
-                return rc;
+                mem_free(profile->host);
+                mem_free(profile->path);
+                mem_free(profile);
+                break;
             }
         }
 
-        /* point to the response buffer in a structured way. */
-        unpacked_resp = (eip_cip_co_resp *)(request->data);
+        /* only keep what the PLC told us, not what the tag attributes or a guess chose. */
+        profile->supports_packing = found->supports_packing;
+        profile->only_use_old_forward_open = session->old_forward_open_reported;
+        profile->max_payload_size =
+            (uint16_t)((!session->only_use_old_forward_open || session->old_forward_open_reported) ? session->max_payload_size : 0);
+    }
 
-        /* copy the header down */
-        mem_copy(request->data, session->data, (int)sizeof(eip_cip_co_resp));
+    if(rc != PLCTAG_STATUS_OK) { pdebug(DEBUG_WARN, "Unable to save the PLC profile, %s!", plc_tag_decode_error(rc)); }
 
-        /* size of the new packet */
-        new_eip_len = (uint16_t)(((uint8_t *)(&unpacked_resp->reply_service) + pkt_len) /* end of the packet */
-                                 - (uint8_t *)(request->data));                         /* start of the packet */
+    return rc;
+}
 
-        /* now copy the packet over that. */
-        mem_copy(&unpacked_resp->reply_service, pkt_start, pkt_len);
 
-        /* stitch up the packet sizes. */
-        unpacked_resp->cpf_cdi_item_length =
-            h2le16((uint16_t)(pkt_len + (int)sizeof(uint16_le))); /* extra for the connection sequence */
-        unpacked_resp->encap_length = h2le16((uint16_t)(new_eip_len - (uint16_t)sizeof(eip_encap)));
+/*
+ * probe_plc
+ *
+ * Find out what the PLC at the other end of a new connection can do.  The
+ * Identity object is read inside a Multiple Service request, so one round
+ * trip tells whether requests can be packed and which PLC this is.  If the
+ * PLC refuses the Multiple Service request, the Identity object is read on
+ * its own.  A PLC without an Identity object is still used.
+ *
+ * Only errors talking to the PLC are returned.
+ */
+
+int probe_plc(ab_session_p session) {
+    session_profile_t found = {0};
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    found.supports_packing = true;
+
+    rc = send_probe_request(session, true);
+    if(rc == PLCTAG_STATUS_OK) { rc = receive_probe_response(session, true, &found); }
+
+    if(rc == PLCTAG_ERR_UNSUPPORTED) {
+        pdebug(DEBUG_INFO, "PLC does not support Multiple Service requests, requests will not be packed.");
+
+        found.supports_packing = false;
+
+        rc = send_probe_request(session, false);
+        if(rc == PLCTAG_STATUS_OK) { rc = receive_probe_response(session, false, &found); }
+
+        if(rc == PLCTAG_ERR_UNSUPPORTED) { rc = PLCTAG_STATUS_OK; }
     }
 
-    pdebug(DEBUG_INFO, "Unpacked packet:");
-    pdebug_dump_bytes(DEBUG_INFO, request->data, new_eip_len);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to probe the PLC, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
 
-    /* notify the reading thread that the request is ready */
-    spin_block(&request->lock) {
-        request->status = PLCTAG_STATUS_OK;
-        request->request_size = new_eip_len;
-        request->resp_received = 1;
+    if(found.vendor_id) {
+        pdebug(DEBUG_INFO, "PLC is a \"%s\", vendor %u, device type %u, product code %u, revision %u.%u.", found.product_name,
+               found.vendor_id, found.device_type, found.product_code, found.revision_major, found.revision_minor);
     }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    critical_block(session->session_mutex) {
+        session->supports_packing = found.supports_packing;
+        session->profile_known = true;
+    }
+
+    save_profile(session, &found);
+
+    pdebug(DEBUG_INFO, "Done.");
 
     return PLCTAG_STATUS_OK;
 }
 
 
-int get_payload_size(ab_request_p request) {
-    int request_data_size = 0;
-    eip_encap *header = (eip_encap *)(request->data);
-    eip_cip_co_req *co_req = NULL;
+int send_probe_request(ab_session_p session, bool packed) {
+    eip_cip_co_req *cip = NULL;
+    uint8_t *data = NULL;
+    int rc = PLCTAG_STATUS_OK;
 
-    pdebug(DEBUG_DETAIL, "Starting.");
+    pdebug(DEBUG_INFO, "Starting.");
+
+    mem_set(session->data, 0, (int)sizeof(*cip));
+
+    cip = (eip_cip_co_req *)(session->data);
+    data = session->data + sizeof(*cip);
 
-    if(le2h16(header->encap_command) == AB_EIP_CONNECTED_SEND) {
-        co_req = (eip_cip_co_req *)(request->data);
-        /* get length of new request */
-        request_data_size = le2h16(co_req->cpf_cdi_item_length) - 2 /* for connection sequence ID */
-                            + 2                                     /* for multipacket offset */
-            ;
+    if(packed) {
+        mem_copy(data, (void *)packed_identity_request, (int)sizeof(packed_identity_request));
+        data += sizeof(packed_identity_request);
     } else {
-        pdebug(DEBUG_DETAIL, "Not a supported type EIP packet type %d to get the payload size.", le2h16(header->encap_command));
-        request_data_size = INT_MAX;
+        mem_copy(data, (void *)identity_request, (int)sizeof(identity_request));
+        data += sizeof(identity_request);
     }
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    cip->encap_command = h2le16(AB_EIP_CONNECTED_SEND);
+    cip->router_timeout = h2le16(1);
+    cip->cpf_item_count = h2le16(2);
+    cip->cpf_cai_item_type = h2le16(AB_EIP_ITEM_CAI);
+    cip->cpf_cai_item_length = h2le16(4);
+    cip->cpf_cdi_item_type = h2le16(AB_EIP_ITEM_CDI);
+    cip->cpf_cdi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&cip->cpf_conn_seq_num)));
 
-    return request_data_size;
-}
+    session->data_size = (uint32_t)(data - session->data);
 
+    rc = prepare_request(session);
+    if(rc == PLCTAG_STATUS_OK) { rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT); }
 
-int pack_requests(ab_session_p session, ab_request_p *requests, int num_requests) {
-    eip_cip_co_req *new_req = NULL;
-    eip_cip_co_req *packed_req = NULL;
-    /* FIXME - is this the right way to check? */
-    int header_size = 0;
-    cip_multi_req_header *multi_header = NULL;
-    int current_offset = 0;
-    uint8_t *pkt_start = NULL;
-    int pkt_len = 0;
-    uint8_t *first_pkt_data = NULL;
-    uint8_t *next_pkt_data = NULL;
+    pdebug(DEBUG_INFO, "Done.");
 
-    pdebug(DEBUG_INFO, "Starting.");
+    return rc;
+}
 
-    debug_set_tag_id(requests[0]->tag_id);
 
-    /* get the header info from the first request. Just copy the whole thing. */
-    mem_copy(session->data, requests[0]->data, requests[0]->request_size);
-    session->data_size = (uint32_t)requests[0]->request_size;
+/*
+ * receive_probe_response
+ *
+ * Returns PLCTAG_ERR_UNSUPPORTED if the PLC refused the request.
+ */
 
-    /* special case the case where there is just one request. */
-    if(num_requests == 1) {
-        pdebug(DEBUG_INFO, "Only one request, so done.");
+int receive_probe_response(ab_session_p session, bool packed, session_profile_p found) {
+    eip_cip_co_resp *resp = NULL;
+    uint8_t reply[sizeof(eip_cip_co_resp) + 64];
+    int reply_size = 0;
+    uint8_t *cip_status = NULL;
+    int rc = PLCTAG_STATUS_OK;
 
-        debug_set_tag_id(0);
+    pdebug(DEBUG_INFO, "Starting.");
 
-        return PLCTAG_STATUS_OK;
+    rc = recv_eip_response(session, SESSION_DEFAULT_TIMEOUT);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to receive the probe response, %s!", plc_tag_decode_error(rc));
+        return rc;
     }
 
-    /* set up multi-packet header. */
+    resp = (eip_cip_co_resp *)(session->data);
 
-    header_size =
-        (int)(sizeof(cip_multi_req_header) + (sizeof(uint16_le) * (size_t)num_requests)); /* offsets for each request. */
+    if(session->data_size < sizeof(*resp) || le2h16(resp->encap_command) != AB_EIP_CONNECTED_SEND) {
+        pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", le2h16(resp->encap_command));
+        return PLCTAG_ERR_BAD_DATA;
+    }
 
-    pdebug(DEBUG_INFO, "header size %d", header_size);
+    if(!packed) {
+        if(resp->status != AB_CIP_STATUS_OK) { return PLCTAG_ERR_UNSUPPORTED; }
 
-    packed_req = (eip_cip_co_req *)(session->data);
+        parse_identity(session->data, (int)session->data_size, found);
 
-    /* make room in the request packet in the session for the header. */
-    pkt_start = (uint8_t *)(&packed_req->cpf_conn_seq_num) + sizeof(packed_req->cpf_conn_seq_num);
-    pkt_len = (int)le2h16(packed_req->cpf_cdi_item_length) - (int)sizeof(packed_req->cpf_conn_seq_num);
+        return PLCTAG_STATUS_OK;
+    }
 
-    pdebug(DEBUG_INFO, "packet 0 is of length %d.", pkt_len);
+    if(resp->reply_service != (AB_EIP_CMD_CIP_MULTI | AB_EIP_CMD_CIP_OK)) { return PLCTAG_ERR_UNSUPPORTED; }
 
-    /* point to where we want the current packet to start. */
-    first_pkt_data = pkt_start + header_size;
+    rc = eip_check_packed_response(session->data, (int)session->data_size, 1, &cip_status);
+    if(rc == PLCTAG_ERR_REMOTE_ERR) { return PLCTAG_ERR_UNSUPPORTED; }
 
-    /* move the data over to make room */
-    mem_move(first_pkt_data, pkt_start, pkt_len);
+    if(rc == PLCTAG_STATUS_OK) {
+        rc = eip_unpack_response(session->data, (int)session->data_size, 0, reply, (int)sizeof(reply), &reply_size);
+    }
 
-    /* now fill in the header. Use pkt_start as it is pointing to the right location. */
-    multi_header = (cip_multi_req_header *)pkt_start;
-    multi_header->service_code = AB_EIP_CMD_CIP_MULTI;
-    multi_header->req_path_size = 0x02; /* length of path in words */
-    multi_header->req_path[0] = 0x20;   /* Class */
-    multi_header->req_path[1] = 0x02;   /* CM */
-    multi_header->req_path[2] = 0x24;   /* Instance */
-    multi_header->req_path[3] = 0x01;   /* #1 */
-    multi_header->request_count = h2le16((uint16_t)num_requests);
+    /* the PLC packs requests even if its Identity object is odd. */
+    if(rc == PLCTAG_STATUS_OK) { parse_identity(reply, reply_size, found); }
 
-    /* set up the offset for the first request. */
-    current_offset = (int)(sizeof(uint16_le) + (sizeof(uint16_le) * (size_t)num_requests));
-    multi_header->request_offsets[0] = h2le16((uint16_t)current_offset);
+    pdebug(DEBUG_INFO, "Done.");
 
-    next_pkt_data = first_pkt_data + pkt_len;
-    current_offset = current_offset + pkt_len;
+    return (rc == PLCTAG_ERR_TOO_SMALL) ? PLCTAG_STATUS_OK : rc;
+}
 
-    /* now process the rest of the requests. */
-    for(int i = 1; i < num_requests; i++) {
-        debug_set_tag_id(requests[i]->tag_id);
 
-        /* set up the offset */
-        multi_header->request_offsets[i] = h2le16((uint16_t)current_offset);
+bool parse_identity(uint8_t *reply, int reply_size, session_profile_p found) {
+    eip_cip_co_resp *resp = (eip_cip_co_resp *)reply;
+    uint8_t *data = reply + sizeof(*resp);
+    int data_size = 0;
+    int name_size = 0;
 
-        /* get a pointer to the request. */
-        new_req = (eip_cip_co_req *)(requests[i]->data);
+    if(reply_size < (int)sizeof(*resp) || resp->reply_service != (AB_EIP_CMD_CIP_GET_ATTRIBUTES_ALL | AB_EIP_CMD_CIP_OK)
+       || resp->status != AB_CIP_STATUS_OK) {
+        pdebug(DEBUG_INFO, "PLC did not return its identity.");
+        return false;
+    }
 
-        /* calculate the request start and length */
-        pkt_start = (uint8_t *)(&new_req->cpf_conn_seq_num) + sizeof(new_req->cpf_conn_seq_num);
-        pkt_len = (int)le2h16(new_req->cpf_cdi_item_length) - (int)sizeof(new_req->cpf_conn_seq_num);
+    data += resp->num_status_words * 2;
+    data_size = (int)(reply + reply_size - data);
 
-        pdebug(DEBUG_INFO, "packet %d is of length %d.", i, pkt_len);
+    if(data_size < IDENTITY_MIN_SIZE) {
+        pdebug(DEBUG_INFO, "Identity of %d bytes is too short.", data_size);
+        return false;
+    }
 
-        /* copy the request into the session buffer. */
-        mem_copy(next_pkt_data, pkt_start, pkt_len);
+    found->vendor_id = (uint16_t)(data[0] | (data[1] << 8));
+    found->device_type = (uint16_t)(data[2] | (data[3] << 8));
+    found->product_code = (uint16_t)(data[4] | (data[5] << 8));
+    found->revision_major = data[6];
+    found->revision_minor = data[7];
 
-        /* calculate the next packet info. */
-        next_pkt_data += pkt_len;
-        current_offset += pkt_len;
-    }
+    /* skip the status and serial number. */
+    name_size = data[14];
 
-    /* stitch up the CPF packet length */
-    packed_req->cpf_cdi_item_length = h2le16((uint16_t)(next_pkt_data - (uint8_t *)(&packed_req->cpf_conn_seq_num)));
+    if(name_size > data_size - IDENTITY_MIN_SIZE) { name_size = data_size - IDENTITY_MIN_SIZE; }
+    if(name_size > (int)sizeof(found->product_name) - 1) { name_size = (int)sizeof(found->product_name) - 1; }
 
-    /* stick up the EIP packet length */
-    packed_req->encap_length = h2le16((uint16_t)((size_t)(next_pkt_data - session->data) - sizeof(eip_encap)));
+    mem_copy(found->product_name, data + IDENTITY_MIN_SIZE, name_size);
+    found->product_name[name_size] = 0;
 
-    /* set the total data size */
-    session->data_size = (uint32_t)(next_pkt_data - session->data);
+    return true;
+}
 
-    debug_set_tag_id(0);
 
-    pdebug(DEBUG_INFO, "Done.");
+/*
+ * select_requests_unsafe
+ *
+ * Pick the requests for the next packet and take them off the queue.  See
+ * eip_select_requests() for how they are picked.
+ *
+ * Returns the number of requests selected.  Must be called with the session mutex held.
+ */
 
-    return PLCTAG_STATUS_OK;
-}
+int select_requests_unsafe(ab_session_p session, ab_request_p *requests, int max_payload_size) {
+    int request_space = max_payload_size - (int)sizeof(cip_multi_req_header);
+    int response_space = max_payload_size - (int)sizeof(cip_multi_resp_header);
+    int window = vector_length(session->requests);
+    struct eip_request_info_t info[MAX_REQUESTS];
+    uint8_t selected[MAX_REQUESTS] = {0};
+    int num_selected = 0;
 
+    if(window > MAX_REQUESTS) { window = MAX_REQUESTS; }
 
-int prepare_request(ab_session_p session) {
-    eip_encap *encap = NULL;
-    int payload_size = 0;
+    for(int i = 0; i < window; i++) {
+        ab_request_p request = vector_get(session->requests, i);
 
-    pdebug(DEBUG_INFO, "Starting.");
+        eip_get_request_info(request->data, request->request_size, &info[i]);
 
-    encap = (eip_encap *)(session->data);
-    payload_size = (int)session->data_size - (int)sizeof(eip_encap);
+        info[i].allow_packing = request->allow_packing && session->supports_packing;
+        info[i].is_read = request->is_read;
+        info[i].response_size = get_response_size(request);
 
-    /* FIXME - why is this check here? Haven't we checked this up the call chain? */
-    if(!session) {
-        pdebug(DEBUG_WARN, "Called with null session!");
-        return PLCTAG_ERR_NULL_PTR;
+        /* the head decides whether anything else goes, no need to look further. */
+        if(i == 0 && !info[i].allow_packing) {
+            window = 1;
+            break;
+        }
     }
 
-    /* fill in the fields of the request. */
+    eip_select_requests(info, window, request_space, response_space, selected);
+
+    /* copy out in queue order and take them off the queue. */
+    for(int i = 0; i < window; i++) {
+        if(selected[i]) { requests[num_selected++] = vector_get(session->requests, i); }
+    }
 
-    encap->encap_length = h2le16((uint16_t)payload_size);
-    encap->encap_session_handle = h2le32(session->session_handle);
-    encap->encap_status = h2le32(0);
-    encap->encap_options = h2le32(0);
+    for(int i = window - 1; i >= 0; i--) {
+        if(selected[i]) { vector_remove(session->requests, i); }
+    }
 
-    /* FIXME - support other kinds of requests? */
+    return num_selected;
+}
 
-    /* set up the session sequence ID for this transaction */
-    if(le2h16(encap->encap_command) == AB_EIP_UNCONNECTED_SEND) {
-        /* get new ID */
-        session->session_seq_id++;
 
-        // request->session_seq_id = session->session_seq_id;
-        encap->encap_sender_context = h2le64(session->session_seq_id); /* link up the request seq ID and the packet seq ID */
+/*
+ * get_response_size
+ *
+ * The space the reply to a request takes in a Multiple Service reply,
+ * including its offset entry.  Requests that do not know the size of their
+ * reply are counted as a bare reply header.
+ */
 
-        pdebug(DEBUG_INFO, "Preparing unconnected packet with session sequence ID %llx", session->session_seq_id);
-    } else if(le2h16(encap->encap_command) == AB_EIP_CONNECTED_SEND) {
-        eip_cip_co_req *conn_req = (eip_cip_co_req *)(session->data);
+int get_response_size(ab_request_p request) {
+    int response_size = (request->response_size > 0) ? request->response_size : 4; /* service, reserved, status, ext status size */
 
-        pdebug(DEBUG_DETAIL, "cpf_targ_conn_id=%x", session->targ_connection_id);
+    return response_size + 2; /* for multipacket offset */
+}
 
-        /* set up the connection information */
-        conn_req->cpf_targ_conn_id = h2le32(session->targ_connection_id);
 
-        session->conn_seq_num++;
-        conn_req->cpf_conn_seq_num = h2le16(session->conn_seq_num);
+int prepare_request(ab_session_p session) {
+    int rc = PLCTAG_STATUS_OK;
 
-        pdebug(DEBUG_INFO, "Preparing connected packet with connection ID %x and sequence ID %u(%x)", session->orig_connection_id,
-               session->conn_seq_num, session->conn_seq_num);
-    } else {
-        pdebug(DEBUG_WARN, "Unsupported packet type %x!", le2h16(encap->encap_command));
-        return PLCTAG_ERR_UNSUPPORTED;
-    }
+    pdebug(DEBUG_INFO, "Starting.");
 
-    /* display the data */
-    pdebug(DEBUG_INFO, "Prepared packet of size %d", session->data_size);
-    pdebug_dump_bytes(DEBUG_INFO, session->data, (int)session->data_size);
+    rc = eip_prepare_packet(session->data, (int)session->data_size, session->session_handle, &session->session_seq_id,
+                            session->targ_connection_id, &session->conn_seq_num);
 
     pdebug(DEBUG_INFO, "Done.");
 
-    return PLCTAG_STATUS_OK;
+    return rc;
 }
 
 
 int send_eip_request(ab_session_p session, int timeout) {
     int rc = PLCTAG_STATUS_OK;
-    int64_t timeout_time = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -2179,52 +2618,14 @@ int send_eip_request(ab_session_p session, int timeout) {
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    if(timeout > 0) {
-        timeout_time = time_ms() + timeout;
-    } else {
-        timeout_time = INT64_MAX;
-    }
-
-    pdebug(DEBUG_INFO, "Sending packet of size %d", session->data_size);
-    pdebug_dump_bytes(DEBUG_INFO, session->data, (int)(session->data_size));
-
-    session->data_offset = 0;
     session->packet_count++;
 
-    /* send the packet */
-    do {
-        rc = socket_write(session->sock, session->data + session->data_offset,
-                          (int)session->data_size - (int)session->data_offset, SOCKET_WAIT_TIMEOUT_MS);
+    rc = eip_send_packet(session->sock, session->data, (int)session->data_size, &session->terminating, timeout);
+    if(rc != PLCTAG_STATUS_OK) { return rc; }
 
-        if(rc >= 0) {
-            session->data_offset += (uint32_t)rc;
-        } else {
-            if(rc == PLCTAG_ERR_TIMEOUT) {
-                pdebug(DEBUG_DETAIL, "Socket not yet ready to write.");
-                rc = 0;
-            }
-        }
-
-        /* give up the CPU if we still are looping */
-        // if(!session->terminating && rc >= 0 && session->data_offset < session->data_size) {
-        //     sleep_ms(1);
-        // }
-    } while(!session->terminating && rc >= 0 && session->data_offset < session->data_size && timeout_time > time_ms());
+    session->data_offset = session->data_size;
 
-    if(session->terminating) {
-        pdebug(DEBUG_WARN, "Session is terminating.");
-        return PLCTAG_ERR_ABORT;
-    }
-
-    if(rc < 0) {
-        pdebug(DEBUG_WARN, "Error, %d, writing socket!", rc);
-        return rc;
-    }
-
-    if(timeout_time <= time_ms()) {
-        pdebug(DEBUG_WARN, "Timed out waiting to send data!");
-        return PLCTAG_ERR_TIMEOUT;
-    }
+    metrics_record_packet_sent(&session->metrics, session->data_size);
 
     pdebug(DEBUG_INFO, "Done.");
 
@@ -2240,9 +2641,8 @@ int send_eip_request(ab_session_p session, int timeout) {
  * punt.
  */
 int recv_eip_response(ab_session_p session, int timeout) {
-    uint32_t data_needed = 0;
+    int data_size = 0;
     int rc = PLCTAG_STATUS_OK;
-    int64_t timeout_time = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -2251,68 +2651,17 @@ int recv_eip_response(ab_session_p session, int timeout) {
         return PLCTAG_ERR_NULL_PTR;
     }
 
-
-    if(timeout > 0) {
-        timeout_time = time_ms() + timeout;
-    } else {
-        timeout_time = INT64_MAX;
-    }
-
     session->data_offset = 0;
     session->data_size = 0;
-    data_needed = sizeof(eip_encap);
-
-    do {
-        rc = socket_read(session->sock, session->data + session->data_offset, (int)(data_needed - session->data_offset),
-                         SOCKET_WAIT_TIMEOUT_MS);
 
-        if(rc >= 0) {
-            session->data_offset += (uint32_t)rc;
-
-            /*pdebug_dump_bytes(session->debug, session->data, session->data_offset);*/
-
-            /* recalculate the amount of data needed if we have just completed the read of an encap header */
-            if(session->data_offset >= sizeof(eip_encap)) {
-                data_needed = (uint32_t)(sizeof(eip_encap) + le2h16(((eip_encap *)(session->data))->encap_length));
-
-                if(data_needed > session->data_capacity) {
-                    pdebug(DEBUG_WARN, "Packet response (%d) is larger than possible buffer size (%d)!", data_needed,
-                           session->data_capacity);
-                    return PLCTAG_ERR_TOO_LARGE;
-                }
-            }
-        } else {
-            if(rc == PLCTAG_ERR_TIMEOUT) {
-                pdebug(DEBUG_DETAIL, "Socket not yet ready to read.");
-            } else {
-                /* error! */
-                pdebug(DEBUG_WARN, "Error reading socket! rc=%d", rc);
-                return rc;
-            }
-        }
-    } while(!session->terminating && session->data_offset < data_needed && timeout_time > time_ms());
-
-    if(session->terminating) {
-        pdebug(DEBUG_INFO, "Session is terminating, returning...");
-        return PLCTAG_ERR_ABORT;
-    }
-
-    if(timeout_time <= time_ms()) {
-        pdebug(DEBUG_WARN, "Timed out waiting for data to read!");
-        return PLCTAG_ERR_TIMEOUT;
-    }
+    rc = eip_recv_packet(session->sock, session->data, (int)session->data_capacity, &data_size, &session->terminating, timeout);
+    if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_ERR_BAD_STATUS) { return rc; }
 
     session->resp_seq_id = le2h64(((eip_encap *)(session->data))->encap_sender_context);
-    session->data_size = data_needed;
-
-    rc = PLCTAG_STATUS_OK;
-
-    pdebug(DEBUG_INFO, "request received all needed data (%d bytes of %d).", session->data_offset, data_needed);
+    session->data_size = (uint32_t)data_size;
+    session->data_offset = (uint32_t)data_size;
 
-    pdebug_dump_bytes(DEBUG_INFO, session->data, (int)(session->data_offset));
-
-    /* check status. */
-    if(le2h32(((eip_encap *)(session->data))->encap_status) != AB_EIP_OK) { rc = PLCTAG_ERR_BAD_STATUS; }
+    metrics_record_packet_received(&session->metrics, session->data_size);
 
     pdebug(DEBUG_INFO, "Done.");
 
@@ -2346,6 +2695,8 @@ int perform_forward_close(ab_session_p session) {
 
 
 int send_forward_open_request(ab_session_p session) {
+    struct eip_forward_open_t fo;
+    int data_size = 0;
     int rc = PLCTAG_STATUS_OK;
     uint16_t max_payload;
 
@@ -2362,102 +2713,20 @@ int send_forward_open_request(ab_session_p session) {
 
     pdebug(DEBUG_DETAIL, "Set Forward Open maximum payload size guess to %d bytes.", session->max_payload_guess);
 
-    if(session->only_use_old_forward_open) {
-        rc = send_old_forward_open_request(session);
-    } else {
-        rc = send_extended_forward_open_request(session);
-    }
-
-    pdebug(DEBUG_INFO, "Done");
-
-    return rc;
-}
-
-
-int send_old_forward_open_request(ab_session_p session) {
-    eip_forward_open_request_t *fo = NULL;
-    uint8_t *data;
-    int rc = PLCTAG_STATUS_OK;
-
-    pdebug(DEBUG_INFO, "Starting");
-
-    mem_set(session->data, 0, (int)(sizeof(*fo) + session->conn_path_size));
-
-    fo = (eip_forward_open_request_t *)(session->data);
-
-    /* point to the end of the struct */
-    data = (session->data) + sizeof(eip_forward_open_request_t);
-
-    /* set up the path information. */
-    mem_copy(data, session->conn_path, session->conn_path_size);
-    data += session->conn_path_size;
-
-    /* fill in the static parts */
-
-    /* encap header parts */
-    fo->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND); /* 0x006F EIP Send RR Data command */
-    fo->encap_length =
-        h2le16((uint16_t)(data - (uint8_t *)(&fo->interface_handle))); /* total length of packet except for encap header */
-    fo->encap_session_handle = h2le32(session->session_handle);
-    fo->encap_sender_context = h2le64(++session->session_seq_id);
-    fo->router_timeout = h2le16(1); /* one second is enough ? */
-
-    /* CPF parts */
-    fo->cpf_item_count = h2le16(2);                  /* ALWAYS 2 */
-    fo->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI); /* null address item type */
-    fo->cpf_nai_item_length = h2le16(0);             /* no data, zero length */
-    fo->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI); /* unconnected data item, 0x00B2 */
-    fo->cpf_udi_item_length =
-        h2le16((uint16_t)(data - (uint8_t *)(&fo->cm_service_code))); /* length of remaining data in UC data item */
-
-    /* Connection Manager parts */
-    fo->cm_service_code = AB_EIP_CMD_FORWARD_OPEN; /* 0x54 Forward Open Request or 0x5B for Forward Open Extended */
-    fo->cm_req_path_size = 2;                      /* size of path in 16-bit words */
-    fo->cm_req_path[0] = 0x20;                     /* class */
-    fo->cm_req_path[1] = 0x06;                     /* CM class */
-    fo->cm_req_path[2] = 0x24;                     /* instance */
-    fo->cm_req_path[3] = 0x01;                     /* instance 1 */
-
-    /* Forward Open Params */
-    fo->secs_per_tick = AB_EIP_SECS_PER_TICK; /* seconds per tick, no used? */
-    fo->timeout_ticks = AB_EIP_TIMEOUT_TICKS; /* timeout = srd_secs_per_tick * src_timeout_ticks, not used? */
-    fo->orig_to_targ_conn_id = h2le32(0);     /* is this right?  Our connection id on the other machines? */
-    fo->targ_to_orig_conn_id = h2le32(session->orig_connection_id); /* Our connection id in the other direction. */
     /* this might need to be globally unique */
-    fo->conn_serial_number = h2le16(++(session->conn_serial_number)); /* our connection SEQUENCE number. */
-    fo->orig_vendor_id = h2le16(AB_EIP_VENDOR_ID);                    /* our unique :-) vendor ID */
-    fo->orig_serial_number = h2le32(AB_EIP_VENDOR_SN);                /* our serial number. */
-    fo->conn_timeout_multiplier = AB_EIP_TIMEOUT_MULTIPLIER;          /* timeout = mult * RPI */
-
-    fo->orig_to_targ_rpi = h2le32(AB_EIP_RPI); /* us to target RPI - Request Packet Interval in microseconds */
-
-    /* screwy logic if this is a DH+ route! */
-    if((session->plc_type == AB_PLC_PLC5 || session->plc_type == AB_PLC_SLC || session->plc_type == AB_PLC_MLGX)
-       && session->is_dhp) {
-        fo->orig_to_targ_conn_params = h2le16(AB_EIP_PLC5_PARAM);
-    } else {
-        fo->orig_to_targ_conn_params = h2le16(
-            AB_EIP_CONN_PARAM | session->max_payload_guess); /* packet size and some other things, based on protocol/cpu type */
-    }
+    ++(session->conn_serial_number);
 
-    fo->targ_to_orig_rpi = h2le32(AB_EIP_RPI); /* target to us RPI - not really used for explicit messages? */
+    fill_forward_open(session, &fo);
 
-    /* screwy logic if this is a DH+ route! */
-    if((session->plc_type == AB_PLC_PLC5 || session->plc_type == AB_PLC_SLC || session->plc_type == AB_PLC_MLGX)
-       && session->is_dhp) {
-        fo->targ_to_orig_conn_params = h2le16(AB_EIP_PLC5_PARAM);
-    } else {
-        fo->targ_to_orig_conn_params = h2le16(
-            AB_EIP_CONN_PARAM | session->max_payload_guess); /* packet size and some other things, based on protocol/cpu type */
+    rc = eip_build_forward_open(session->data, (int)session->data_capacity, &fo, &data_size);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to build Forward Open request %s!", plc_tag_decode_error(rc));
+        return rc;
     }
 
-    fo->transport_class = AB_EIP_TRANSPORT_CLASS_T3; /* 0xA3, server transport, class 3, application trigger */
-    fo->path_size = session->conn_path_size / 2;     /* size in 16-bit words */
-
-    /* set the size of the request */
-    session->data_size = (uint32_t)(data - (session->data));
+    session->data_size = (uint32_t)data_size;
 
-    rc = send_eip_request(session, 0);
+    rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT);
 
     pdebug(DEBUG_INFO, "Done");
 
@@ -2465,83 +2734,35 @@ int send_old_forward_open_request(ab_session_p session) {
 }
 
 
-/* new version of Forward Open */
-int send_extended_forward_open_request(ab_session_p session) {
-    eip_forward_open_request_ex_t *fo = NULL;
-    uint8_t *data;
-    int rc = PLCTAG_STATUS_OK;
-
-    pdebug(DEBUG_INFO, "Starting");
-
-    mem_set(session->data, 0, (int)(sizeof(*fo) + session->conn_path_size));
-
-    fo = (eip_forward_open_request_ex_t *)(session->data);
-
-    /* point to the end of the struct */
-    data = (session->data) + sizeof(*fo);
-
-    /* set up the path information. */
-    mem_copy(data, session->conn_path, session->conn_path_size);
-    data += session->conn_path_size;
-
-    /* fill in the static parts */
-
-    /* encap header parts */
-    fo->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND); /* 0x006F EIP Send RR Data command */
-    fo->encap_length =
-        h2le16((uint16_t)(data - (uint8_t *)(&fo->interface_handle))); /* total length of packet except for encap header */
-    fo->encap_session_handle = h2le32(session->session_handle);
-    fo->encap_sender_context = h2le64(++session->session_seq_id);
-    fo->router_timeout = h2le16(1); /* one second is enough ? */
-
-    /* CPF parts */
-    fo->cpf_item_count = h2le16(2);                  /* ALWAYS 2 */
-    fo->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI); /* null address item type */
-    fo->cpf_nai_item_length = h2le16(0);             /* no data, zero length */
-    fo->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI); /* unconnected data item, 0x00B2 */
-    fo->cpf_udi_item_length =
-        h2le16((uint16_t)(data - (uint8_t *)(&fo->cm_service_code))); /* length of remaining data in UC data item */
-
-    /* Connection Manager parts */
-    fo->cm_service_code = AB_EIP_CMD_FORWARD_OPEN_EX; /* 0x54 Forward Open Request or 0x5B for Forward Open Extended */
-    fo->cm_req_path_size = 2;                         /* size of path in 16-bit words */
-    fo->cm_req_path[0] = 0x20;                        /* class */
-    fo->cm_req_path[1] = 0x06;                        /* CM class */
-    fo->cm_req_path[2] = 0x24;                        /* instance */
-    fo->cm_req_path[3] = 0x01;                        /* instance 1 */
-
-    /* Forward Open Params */
-    fo->secs_per_tick = AB_EIP_SECS_PER_TICK; /* seconds per tick, no used? */
-    fo->timeout_ticks = AB_EIP_TIMEOUT_TICKS; /* timeout = srd_secs_per_tick * src_timeout_ticks, not used? */
-    fo->orig_to_targ_conn_id = h2le32(0);     /* is this right?  Our connection id on the other machines? */
-    fo->targ_to_orig_conn_id = h2le32(session->orig_connection_id); /* Our connection id in the other direction. */
-    /* this might need to be globally unique */
-    fo->conn_serial_number = h2le16(++(session->conn_serial_number)); /* our connection ID/serial number. */
-    fo->orig_vendor_id = h2le16(AB_EIP_VENDOR_ID);                    /* our unique :-) vendor ID */
-    fo->orig_serial_number = h2le32(AB_EIP_VENDOR_SN);                /* our serial number. */
-    fo->conn_timeout_multiplier = AB_EIP_TIMEOUT_MULTIPLIER;          /* timeout = mult * RPI */
-    fo->orig_to_targ_rpi = h2le32(AB_EIP_RPI); /* us to target RPI - Request Packet Interval in microseconds */
-    fo->orig_to_targ_conn_params_ex = h2le32(
-        AB_EIP_CONN_PARAM_EX | session->max_payload_guess); /* packet size and some other things, based on protocol/cpu type */
-    fo->targ_to_orig_rpi = h2le32(AB_EIP_RPI);              /* target to us RPI - not really used for explicit messages? */
-    fo->targ_to_orig_conn_params_ex = h2le32(
-        AB_EIP_CONN_PARAM_EX | session->max_payload_guess); /* packet size and some other things, based on protocol/cpu type */
-    fo->transport_class = AB_EIP_TRANSPORT_CLASS_T3;        /* 0xA3, server transport, class 3, application trigger */
-    fo->path_size = session->conn_path_size / 2;            /* size in 16-bit words */
-
-    /* set the size of the request */
-    session->data_size = (uint32_t)(data - (session->data));
+/*
+ * fill_forward_open
+ *
+ * What the shared Forward Open and Forward Close builders need from the session.
+ */
 
-    rc = send_eip_request(session, SESSION_DEFAULT_TIMEOUT);
+void fill_forward_open(ab_session_p session, struct eip_forward_open_t *fo) {
+    mem_set(fo, 0, sizeof(*fo));
 
-    pdebug(DEBUG_INFO, "Done");
+    fo->session_handle = session->session_handle;
+    fo->sender_context = ++session->session_seq_id;
+    fo->orig_connection_id = session->orig_connection_id;
+    fo->conn_serial_number = session->conn_serial_number;
+    fo->use_extended = !session->only_use_old_forward_open;
+    fo->max_payload = session->max_payload_guess;
+    fo->conn_path = session->conn_path;
+    fo->conn_path_size = session->conn_path_size;
 
-    return rc;
+    /* screwy logic if this is a DH+ route! */
+    if((session->plc_type == AB_PLC_PLC5 || session->plc_type == AB_PLC_SLC || session->plc_type == AB_PLC_MLGX)
+       && session->is_dhp) {
+        fo->conn_params = AB_EIP_PLC5_PARAM;
+    }
 }
 
 
 int receive_forward_open_response(ab_session_p session) {
-    eip_forward_open_response_t *fo_resp;
+    uint8_t *cip_status = NULL;
+    uint16_t supported_size = 0;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting");
@@ -2552,69 +2773,21 @@ int receive_forward_open_response(ab_session_p session) {
         return rc;
     }
 
-    fo_resp = (eip_forward_open_response_t *)(session->data);
-
-    do {
-        if(le2h16(fo_resp->encap_command) != AB_EIP_UNCONNECTED_SEND) {
-            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", fo_resp->encap_command);
-            rc = PLCTAG_ERR_BAD_DATA;
-            break;
-        }
-
-        if(le2h32(fo_resp->encap_status) != AB_EIP_OK) {
-            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", fo_resp->encap_status);
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
-        if(fo_resp->general_status != AB_EIP_OK) {
-            pdebug(DEBUG_WARN, "Forward Open command failed, response code: %s (%d)",
-                   decode_cip_error_short(&fo_resp->general_status), fo_resp->general_status);
-            if(fo_resp->general_status == AB_CIP_ERR_UNSUPPORTED_SERVICE) {
-                /* this type of command is not supported! */
-                pdebug(DEBUG_WARN, "Received CIP command unsupported error from the PLC!");
-                rc = PLCTAG_ERR_UNSUPPORTED;
-            } else {
-                rc = PLCTAG_ERR_REMOTE_ERR;
-
-                if(fo_resp->general_status == 0x01 && fo_resp->status_size >= 2) {
-                    /* we might have an error that tells us the actual size to use. */
-                    uint8_t *data = &fo_resp->status_size;
-                    int extended_status = data[1] | (data[2] << 8);
-                    uint16_t supported_size = (uint16_t)((uint16_t)data[3] | (uint16_t)((uint16_t)data[4] << (uint16_t)8));
-
-                    if(extended_status == 0x109) { /* MAGIC */
-                        pdebug(DEBUG_WARN, "Error from forward open request, unsupported size, but size %d is supported.",
-                               supported_size);
-                        session->max_payload_guess = supported_size;
-                        rc = PLCTAG_ERR_TOO_LARGE;
-                    } else if(extended_status == 0x100) { /* MAGIC */
-                        pdebug(DEBUG_WARN, "Error from forward open request, duplicate connection ID.  Need to try again.");
-                        rc = PLCTAG_ERR_DUPLICATE;
-                    } else {
-                        pdebug(DEBUG_WARN, "CIP extended error %s (%s)!", decode_cip_error_short(&fo_resp->general_status),
-                               decode_cip_error_long(&fo_resp->general_status));
-                    }
-                } else {
-                    pdebug(DEBUG_WARN, "CIP error code %s (%s)!", decode_cip_error_short(&fo_resp->general_status),
-                           decode_cip_error_long(&fo_resp->general_status));
-                }
-            }
-
-            break;
-        }
-
-        /* success! */
-        session->targ_connection_id = le2h32(fo_resp->orig_to_targ_conn_id);
-        session->orig_connection_id = le2h32(fo_resp->targ_to_orig_conn_id);
+    rc = eip_check_forward_open_response(session->data, (int)session->data_size, &session->targ_connection_id,
+                                         &session->orig_connection_id, &supported_size, &cip_status);
+    if(rc == PLCTAG_ERR_TOO_LARGE) {
+        session->max_payload_guess = supported_size;
+    } else if(rc != PLCTAG_STATUS_OK && cip_status) {
+        pdebug(DEBUG_WARN, "Forward Open command failed, response code: %s (%s)!", decode_cip_error_short(cip_status),
+               decode_cip_error_long(cip_status));
+    }
 
+    if(rc == PLCTAG_STATUS_OK) {
         session->max_payload_size = session->max_payload_guess;
 
         pdebug(DEBUG_INFO, "ForwardOpen succeeded with our connection ID %x and the PLC connection ID %x with packet size %u.",
                session->orig_connection_id, session->targ_connection_id, session->max_payload_size);
-
-        rc = PLCTAG_STATUS_OK;
-    } while(0);
+    }
 
     pdebug(DEBUG_INFO, "Done.");
 
@@ -2623,61 +2796,24 @@ int receive_forward_open_response(ab_session_p session) {
 
 
 int send_forward_close_req(ab_session_p session) {
-    eip_forward_close_req_t *fc;
-    uint8_t *data;
+    struct eip_forward_open_t fo;
+    int data_size = 0;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting");
 
-    fc = (eip_forward_close_req_t *)(session->data);
-
-    /* point to the end of the struct */
-    data = (session->data) + sizeof(*fc);
-
-    /* set up the path information. */
-    mem_copy(data, session->conn_path, session->conn_path_size);
-    data += session->conn_path_size;
-
-    /* FIXME DEBUG */
     pdebug(DEBUG_DETAIL, "Forward Close connection path:");
     pdebug_dump_bytes(DEBUG_DETAIL, session->conn_path, session->conn_path_size);
 
-    /* fill in the static parts */
-
-    /* encap header parts */
-    fc->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND); /* 0x006F EIP Send RR Data command */
-    fc->encap_length =
-        h2le16((uint16_t)(data - (uint8_t *)(&fc->interface_handle))); /* total length of packet except for encap header */
-    fc->encap_sender_context = h2le64(++session->session_seq_id);
-    fc->router_timeout = h2le16(1); /* one second is enough ? */
-
-    /* CPF parts */
-    fc->cpf_item_count = h2le16(2);                  /* ALWAYS 2 */
-    fc->cpf_nai_item_type = h2le16(AB_EIP_ITEM_NAI); /* null address item type */
-    fc->cpf_nai_item_length = h2le16(0);             /* no data, zero length */
-    fc->cpf_udi_item_type = h2le16(AB_EIP_ITEM_UDI); /* unconnected data item, 0x00B2 */
-    fc->cpf_udi_item_length =
-        h2le16((uint16_t)(data - (uint8_t *)(&fc->cm_service_code))); /* length of remaining data in UC data item */
-
-    /* Connection Manager parts */
-    fc->cm_service_code = AB_EIP_CMD_FORWARD_CLOSE; /* 0x4E Forward Close Request */
-    fc->cm_req_path_size = 2;                       /* size of path in 16-bit words */
-    fc->cm_req_path[0] = 0x20;                      /* class */
-    fc->cm_req_path[1] = 0x06;                      /* CM class */
-    fc->cm_req_path[2] = 0x24;                      /* instance */
-    fc->cm_req_path[3] = 0x01;                      /* instance 1 */
-
-    /* Forward Open Params */
-    fc->secs_per_tick = AB_EIP_SECS_PER_TICK;                     /* seconds per tick, no used? */
-    fc->timeout_ticks = AB_EIP_TIMEOUT_TICKS;                     /* timeout = srd_secs_per_tick * src_timeout_ticks, not used? */
-    fc->conn_serial_number = h2le16(session->conn_serial_number); /* our connection SEQUENCE number. */
-    fc->orig_vendor_id = h2le16(AB_EIP_VENDOR_ID);                /* our unique :-) vendor ID */
-    fc->orig_serial_number = h2le32(AB_EIP_VENDOR_SN);            /* our serial number. */
-    fc->path_size = session->conn_path_size / 2;                  /* size in 16-bit words */
-    fc->reserved = (uint8_t)0;                                    /* padding for the path. */
-
-    /* set the size of the request */
-    session->data_size = (uint32_t)(data - (session->data));
+    fill_forward_open(session, &fo);
+
+    rc = eip_build_forward_close(session->data, (int)session->data_capacity, &fo, &data_size);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to build Forward Close request %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    session->data_size = (uint32_t)data_size;
 
     rc = send_eip_request(session, 100);
 
@@ -2688,7 +2824,7 @@ int send_forward_close_req(ab_session_p session) {
 
 
 int recv_forward_close_resp(ab_session_p session) {
-    eip_forward_close_resp_t *fo_resp;
+    uint8_t *cip_status = NULL;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting");
@@ -2699,31 +2835,12 @@ int recv_forward_close_resp(ab_session_p session) {
         return rc;
     }
 
-    fo_resp = (eip_forward_close_resp_t *)(session->data);
-
-    do {
-        if(le2h16(fo_resp->encap_command) != AB_EIP_UNCONNECTED_SEND) {
-            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", fo_resp->encap_command);
-            rc = PLCTAG_ERR_BAD_DATA;
-            break;
-        }
-
-        if(le2h32(fo_resp->encap_status) != AB_EIP_OK) {
-            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", fo_resp->encap_status);
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
-        if(fo_resp->general_status != AB_EIP_OK) {
-            pdebug(DEBUG_WARN, "Forward Close command failed, response code: %d", fo_resp->general_status);
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
+    rc = eip_check_forward_close_response(session->data, (int)session->data_size, &cip_status);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Forward Close command failed, response code: %d", (cip_status ? *cip_status : -1));
+    } else {
         pdebug(DEBUG_INFO, "Connection close succeeded.");
-
-        rc = PLCTAG_STATUS_OK;
-    } while(0);
+    }
 
     pdebug(DEBUG_INFO, "Done.");
 
@@ -2788,6 +2905,14 @@ void request_destroy(void *req_arg) {
 
     req->abort_request = 1;
 
+    /* bit writes merged into this one that never got a reply. */
+    if(req->merged_next) { req->merged_next = rc_dec(req->merged_next); }
+
+    if(req->unmerged_data) {
+        mem_free(req->unmerged_data);
+        req->unmerged_data = NULL;
+    }
+
     if(req->data) {
         mem_free(req->data);
         req->data = NULL;
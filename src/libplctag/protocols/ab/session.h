@@ -38,6 +38,9 @@
 
 #include <libplctag/protocols/ab/ab_common.h>
 #include <libplctag/protocols/ab/defs.h>
+#include <libplctag/protocols/eip/transport.h>
+#include <utils/metrics.h>
+#include <utils/poll_planner.h>
 #include <utils/rc.h>
 #include <utils/vector.h>
 
@@ -50,6 +53,21 @@
 #define SESSION_MIN_REQUESTS (10)
 #define SESSION_INC_REQUESTS (10)
 
+#define SESSION_MIN_PARENT_READ_GROUPS (4)
+#define SESSION_INC_PARENT_READ_GROUPS (4)
+
+#define SESSION_MIN_PARENT_READ_LISTINGS (2)
+#define SESSION_INC_PARENT_READ_LISTINGS (2)
+
+#define SESSION_MIN_PROFILES (4)
+#define SESSION_INC_PROFILES (4)
+
+#define SESSION_MAX_REQUESTS_IN_FLIGHT (8) /* packets sent without waiting for the reply to the one before. */
+
+#define SESSION_MIN_TYPE_CACHE (16)
+#define SESSION_INC_TYPE_CACHE (16)
+#define SESSION_MAX_TYPE_CACHE (256)
+
 #define MAX_CONN_PATH (260) /* 256 plus padding. */
 #define MAX_IP_ADDR_SEG_LEN (16)
 
@@ -80,6 +98,12 @@ struct ab_session_t {
 
     plc_type_t plc_type;
 
+    /* what the PLC supports, from the cached profile for the host or from probing it after the Forward Open. */
+    bool profile_known;
+    bool supports_packing;
+    bool forced_old_forward_open;     /* the tag attributes asked for the old Forward Open. */
+    bool old_forward_open_reported;   /* the PLC refused the extended Forward Open. */
+
     uint8_t *conn_path;
     uint8_t conn_path_size;
     uint16_t dhp_dest;
@@ -97,8 +121,29 @@ struct ab_session_t {
     /* list of outstanding requests for this session */
     vector_p requests;
 
+    /*
+     * Packets sent and waiting for their replies, oldest first.  Only the
+     * session thread touches these.  Replies are matched by connection
+     * sequence number or sender context.
+     */
+    int max_requests_in_flight;
+    struct eip_in_flight_t in_flight;
+
     uint64_t resp_seq_id;
 
+    /* UDT parents whose members share one read, guarded by session_mutex. */
+    vector_p parent_read_groups;
+
+    /*
+     * tag listings read to find the parents' UDT templates, guarded by parent_read_listings_mutex.
+     * Only the session thread adds or removes listings.
+     */
+    mutex_p parent_read_listings_mutex;
+    vector_p parent_read_listings;
+
+    /* encoded types learned from reads, keyed by encoded tag name, guarded by session_mutex. */
+    vector_p type_cache;
+
     /* data for receiving messages */
     uint32_t data_offset;
     uint32_t data_capacity;
@@ -109,6 +154,12 @@ struct ab_session_t {
 
     uint64_t packet_count;
 
+    /* traffic and latency statistics, rolled up into the library totals. */
+    struct metrics_t metrics;
+
+    /* phases for automatic reads of the tags on this session. */
+    struct poll_planner_t poll_planner;
+
     thread_p handler_thread;
     volatile int terminating;
     mutex_p session_mutex;
@@ -137,6 +188,21 @@ struct ab_request_t {
     int allow_packing;
     int packing_num;
 
+    /* reads may be reordered among themselves when packing. */
+    int is_read;
+
+    /* estimated size of the reply in bytes, zero if not known. */
+    int response_size;
+
+    /* bit writes to the same integer can be merged into one Read-Modify-Write. */
+    int is_bit_write;
+
+    /* bit writes merged into this one, they get a copy of its reply. */
+    ab_request_p merged_next;
+
+    /* the request as it was before anything was merged into it. */
+    uint8_t *unmerged_data;
+
     /* time stamp for debugging output */
     int64_t time_sent;
 
@@ -157,5 +223,7 @@ extern int session_find_or_create(ab_session_p *session, attr attribs);
 extern int session_get_max_payload(ab_session_p session);
 extern int session_create_request(ab_session_p session, int tag_id, ab_request_p *request);
 extern int session_add_request(ab_session_p sess, ab_request_p req);
+extern int session_get_cached_type(ab_session_p session, ab_tag_p tag);
+extern int session_cache_type(ab_session_p session, ab_tag_p tag);
 
 #endif
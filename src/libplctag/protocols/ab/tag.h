@@ -112,8 +112,26 @@ struct ab_tag_t {
     ab_request_p req;
     int offset;
 
+    /* requests queued behind req for transfers that take more than one packet. */
+    ab_request_p *queued_reqs;
+    int queued_reqs_capacity;
+    int num_queued_reqs;
+    int next_queued_req;
+
+    /* used for PCCC transfers that take more than one packet. */
+    pccc_addr_t pccc_address;
+    int pccc_chunk_size;
+
     int allow_packing;
 
+    /* used for UDT members read through a shared read of their parent. */
+    parent_read_group_p parent_group;
+    char *parent_member;
+    int parent_index;
+    int parent_offset;
+    uint64_t parent_read_gen;
+    int parent_read_pending;
+
     /* flags for operations */
     int read_in_progress;
     int write_in_progress;
@@ -0,0 +1,1729 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <inttypes.h>
+#include <libplctag/lib/libplctag.h>
+#include <libplctag/lib/tag.h>
+#include <libplctag/protocols/eip/transport.h>
+#include <limits.h>
+#include <platform.h>
+#include <utils/debug.h>
+
+/*
+ * The packets are read and written by byte offset so that this does not
+ * depend on the packed structure definitions of either PLC family.
+ */
+
+/* encapsulation header */
+#define ENCAP_COMMAND (0)
+#define ENCAP_LENGTH (2)
+#define ENCAP_SESSION_HANDLE (4)
+#define ENCAP_STATUS (8)
+#define ENCAP_SENDER_CONTEXT (12)
+#define ENCAP_OPTIONS (20)
+#define ENCAP_SIZE (24)
+
+#define ENCAP_REGISTER_SESSION ((uint16_t)0x0065)
+#define ENCAP_UNCONNECTED_SEND ((uint16_t)0x006F)
+#define ENCAP_CONNECTED_SEND ((uint16_t)0x0070)
+
+/* connected data item, the CIP request follows the connection sequence number. */
+#define CO_TARG_CONN_ID (36)
+#define CO_CDI_LENGTH (42)
+#define CO_CONN_SEQ_NUM (44)
+#define CO_CIP (46)
+
+/* unconnected packet header after the encapsulation header. */
+#define UC_ROUTER_TIMEOUT (28)
+#define UC_ITEM_COUNT (30)
+#define UC_NAI_TYPE (32)
+#define UC_UDI_TYPE (36)
+
+/* unconnected data item. */
+#define UC_UDI_LENGTH (38)
+#define UC_CIP (40)
+
+/* Connection Manager Unconnected Send wrapper around a routed request. */
+#define UC_ROUTED_LENGTH (48)
+#define UC_ROUTED_CIP (50)
+
+#define CIP_CMD_UNCONNECTED_SEND ((uint8_t)0x52)
+#define CIP_CMD_MULTI ((uint8_t)0x0A)
+#define CIP_CMD_RMW ((uint8_t)0x4E)
+#define CIP_CMD_OK ((uint8_t)0x80)
+#define CIP_STATUS_OK ((uint8_t)0x00)
+#define CIP_ERR_PARTIAL_ERROR ((uint8_t)0x1E)
+
+/* Session registration, after the encapsulation header. */
+#define REG_EIP_VERSION (24)
+#define REG_SIZE (28)
+
+#define EIP_VERSION ((uint16_t)0x0001)
+#define EIP_ITEM_NAI ((uint16_t)0x0000)
+#define EIP_ITEM_UDI ((uint16_t)0x00B2)
+
+/*
+ * Forward Open and Forward Close requests, from the CIP service code.  The
+ * extended Forward Open has 32-bit connection parameters, so everything after
+ * the first of them moves by two bytes and the second by four.
+ */
+#define CM_SERVICE (0)
+#define CM_SECS_PER_TICK (6)
+#define CM_TIMEOUT_TICKS (7)
+#define FO_TARG_TO_ORIG_CONN_ID (12)
+#define FO_CONN_SERIAL_NUMBER (16)
+#define FO_VENDOR_ID (18)
+#define FO_VENDOR_SN (20)
+#define FO_TIMEOUT_MULTIPLIER (24)
+#define FO_ORIG_TO_TARG_RPI (28)
+#define FO_ORIG_TO_TARG_PARAMS (32)
+
+/* the connection parameters and everything after them. */
+#define FO_TARG_TO_ORIG_RPI (34)
+#define FO_TARG_TO_ORIG_PARAMS (38)
+#define FO_EX_TARG_TO_ORIG_RPI (36)
+#define FO_EX_TARG_TO_ORIG_PARAMS (40)
+
+/* both end with the transport class and the size of the connection path. */
+#define FO_SIZE (42)
+#define FO_EX_SIZE (46)
+
+#define FC_CONN_SERIAL_NUMBER (8)
+#define FC_VENDOR_ID (10)
+#define FC_VENDOR_SN (12)
+#define FC_PATH_SIZE (16)
+#define FC_SIZE (18)
+
+/* replies from the Connection Manager, from the CIP reply service code. */
+#define CM_RESP_STATUS (2)
+#define CM_RESP_STATUS_SIZE (3)
+#define CM_RESP_EXT_STATUS (4)
+#define CM_RESP_SUPPORTED_SIZE (6)
+#define FO_RESP_ORIG_TO_TARG_CONN_ID (4)
+#define FO_RESP_TARG_TO_ORIG_CONN_ID (8)
+#define FO_RESP_MIN_SIZE (12)
+
+#define CIP_CMD_FORWARD_CLOSE ((uint8_t)0x4E)
+#define CIP_CMD_FORWARD_OPEN ((uint8_t)0x54)
+#define CIP_CMD_FORWARD_OPEN_EX ((uint8_t)0x5B)
+#define CIP_ERR_UNSUPPORTED_SERVICE ((uint8_t)0x08)
+#define CIP_ERR_CONNECTION_FAILURE ((uint8_t)0x01)
+#define CIP_EXT_ERR_DUPLICATE_CONN ((uint16_t)0x0100)
+#define CIP_EXT_ERR_INVALID_SIZE ((uint16_t)0x0109)
+
+/* the values both PLC families have always sent in a Forward Open. */
+#define FO_SECS_PER_TICK ((uint8_t)0x0A)
+#define FO_TIMEOUT_TICKS ((uint8_t)0x05)
+#define FO_VENDOR_ID_VAL ((uint16_t)0xF33D)
+#define FO_VENDOR_SN_VAL ((uint32_t)0x21504345)
+#define FO_TIMEOUT_MULTIPLIER_VAL ((uint8_t)0x01)
+#define FO_RPI ((uint32_t)1000000)
+#define FO_CONN_PARAM ((uint16_t)0x4200)
+#define FO_CONN_PARAM_EX ((uint32_t)0x42000000)
+#define FO_TRANSPORT_CLASS_T3 ((uint8_t)0xA3)
+
+/* service, path size, four bytes of path to the Message Router, count. */
+#define MULTI_REQ_HEADER_SIZE (8)
+
+/* reply service, reserved, status, extended status size, count. */
+#define MULTI_RESP_HEADER_SIZE (6)
+#define MULTI_RESP_COUNT (4)
+
+/* a reply that failed as a whole may stop after the status. */
+#define MULTI_RESP_STATUS_SIZE (4)
+
+/* the route of a routed request, a byte of size, a pad byte and up to 256 bytes of path. */
+#define MAX_ROUTE_SIZE (260)
+
+/* how long each socket call waits before checking for termination and timeout. */
+#define SOCKET_WAIT_TIMEOUT_MS (20)
+
+
+static uint16_t get_u16(uint8_t *data, int offset);
+static void set_u16(uint8_t *data, int offset, uint16_t val);
+static uint32_t get_u32(uint8_t *data, int offset);
+static void set_u32(uint8_t *data, int offset, uint32_t val);
+static uint64_t get_u64(uint8_t *data, int offset);
+static void set_u64(uint8_t *data, int offset, uint64_t val);
+static int get_cip_request(uint8_t *packet, int packet_size, int *body_offset, int *body_size, int *is_routed);
+static int get_reply_offset(uint8_t *packet, int packet_size);
+static int get_rmw_masks(uint8_t *body, int body_size, int *mask_offset, int *mask_size);
+static int get_tag_segment(uint8_t *body, int body_size, uint8_t **segment, int *segment_size);
+static int build_cm_request(uint8_t *buf, int buf_capacity, struct eip_forward_open_t *fo, uint8_t service, int cip_size,
+                            int *packet_size);
+static int check_cm_response(uint8_t *packet, int packet_size, uint8_t **cip_status);
+static int send_packet(struct eip_request_loop_t *loop, struct eip_packet_t *packet);
+static int receive_packet(struct eip_request_loop_t *loop);
+static void requeue_in_flight(struct eip_request_loop_t *loop);
+
+
+/*
+ * eip_get_request_info
+ *
+ * Fill in the parts of the request info that come from the packet itself.
+ * The caller fills in allow_packing, is_read and response_size.
+ */
+
+int eip_get_request_info(uint8_t *packet, int packet_size, struct eip_request_info_t *info) {
+    int body_offset = 0;
+    int body_size = 0;
+    int is_routed = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    info->pack_class = 0;
+    info->payload_size = INT_MAX;
+    info->overhead = 0;
+
+    rc = get_cip_request(packet, packet_size, &body_offset, &body_size, &is_routed);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Not a supported type EIP packet type %d to get the payload size.", get_u16(packet, ENCAP_COMMAND));
+        return rc;
+    }
+
+    /* only requests sent the same way can share a packet. */
+    info->pack_class = (get_u16(packet, ENCAP_COMMAND) << 1) | is_routed;
+
+    /* each packed request also needs an offset. */
+    info->payload_size = body_size + 2;
+
+    /* a routed request keeps its Unconnected Send wrapper and route, plus a possible pad byte. */
+    if(is_routed) { info->overhead = (UC_ROUTED_CIP - UC_CIP) + 1 + (packet_size - body_offset - body_size); }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_select_requests
+ *
+ * Pick the requests for the next packet from the first num_queued queued
+ * requests.  The request at the head of the queue always goes.  The packet
+ * must hold the requests and the reply must hold their responses, otherwise
+ * the PLC truncates the reply and the reads need more fragments.
+ *
+ * Reads can be done in any order relative to each other, so the reads queued
+ * before the next request that is not a read are packed smallest first.  That
+ * fits as many as possible into each round trip.  Reads that do not fit stay
+ * queued for the next packet, where they move toward the head.  The following
+ * requests are then packed in queue order, passing over reads that do not fit,
+ * so one large read does not hold back the small requests behind it.  A write
+ * that does not fit ends the packet, so nothing is sent ahead of a write.
+ *
+ * selected[i] is set for each request picked.  Returns the number picked.
+ */
+
+int eip_select_requests(struct eip_request_info_t *info, int num_queued, int request_space, int response_space,
+                        uint8_t *selected) {
+    int candidates[num_queued > 0 ? num_queued : 1];
+    int num_candidates = 0;
+    int num_selected = 1;
+    int read_run_end = 1;
+
+    if(num_queued <= 0) { return 0; }
+
+    mem_set(selected, 0, num_queued);
+
+    request_space -= info[0].payload_size + info[0].overhead;
+    response_space -= info[0].response_size;
+    selected[0] = 1;
+
+    if(!info[0].allow_packing) { return num_selected; }
+
+    /* find the run of reads after the head. */
+    while(read_run_end < num_queued && info[read_run_end].is_read) { read_run_end++; }
+
+    /* sort the packable reads by the space they need, smallest first. */
+    for(int i = 1; i < read_run_end; i++) {
+        int pos = num_candidates;
+
+        if(!info[i].allow_packing || info[i].payload_size == INT_MAX || info[i].pack_class != info[0].pack_class) { continue; }
+
+        while(pos > 0
+              && info[candidates[pos - 1]].payload_size + info[candidates[pos - 1]].response_size
+                     > info[i].payload_size + info[i].response_size) {
+            candidates[pos] = candidates[pos - 1];
+            pos--;
+        }
+
+        candidates[pos] = i;
+        num_candidates++;
+    }
+
+    for(int i = 0; i < num_candidates; i++) {
+        int index = candidates[i];
+
+        if(info[index].payload_size < request_space && info[index].response_size <= response_space) {
+            request_space -= info[index].payload_size;
+            response_space -= info[index].response_size;
+            selected[index] = 1;
+            num_selected++;
+        }
+    }
+
+    /* keep going in queue order, only reads may be left behind. */
+    for(int i = read_run_end; i < num_queued; i++) {
+        if(!info[i].allow_packing || info[i].payload_size >= request_space || info[i].response_size > response_space
+           || info[i].pack_class != info[0].pack_class) {
+            if(!info[i].is_read) { break; }
+
+            continue;
+        }
+
+        request_space -= info[i].payload_size;
+        response_space -= info[i].response_size;
+        selected[i] = 1;
+        num_selected++;
+    }
+
+    return num_selected;
+}
+
+
+/*
+ * eip_merge_rmw_requests
+ *
+ * Fold the Read-Modify-Write request in other into the one in packet, so that
+ * sending packet alone has the same effect as sending packet and then other.
+ * Both must be sent the same way, with the same route, and must modify the
+ * same tag with masks of the same size.
+ *
+ * Each bit of an RMW is set (OR 1, AND 1), cleared (OR 0, AND 0) or left
+ * alone (OR 0, AND 1).  A bit that other leaves alone keeps what packet does
+ * to it, any other bit takes what other does to it.
+ *
+ * Returns PLCTAG_ERR_NO_MATCH, and changes nothing, if the requests cannot be
+ * merged.
+ */
+
+int eip_merge_rmw_requests(uint8_t *packet, int packet_size, uint8_t *other, int other_size) {
+    int body_offset = 0;
+    int body_size = 0;
+    int is_routed = 0;
+    int other_body_offset = 0;
+    int other_body_size = 0;
+    int other_is_routed = 0;
+    int mask_offset = 0;
+    int mask_size = 0;
+    int other_mask_offset = 0;
+    int other_mask_size = 0;
+    uint8_t *or_mask = NULL;
+    uint8_t *and_mask = NULL;
+    uint8_t *other_or_mask = NULL;
+    uint8_t *other_and_mask = NULL;
+
+    if(get_cip_request(packet, packet_size, &body_offset, &body_size, &is_routed) != PLCTAG_STATUS_OK
+       || get_cip_request(other, other_size, &other_body_offset, &other_body_size, &other_is_routed) != PLCTAG_STATUS_OK) {
+        return PLCTAG_ERR_NO_MATCH;
+    }
+
+    if(get_u16(packet, ENCAP_COMMAND) != get_u16(other, ENCAP_COMMAND) || is_routed != other_is_routed) {
+        return PLCTAG_ERR_NO_MATCH;
+    }
+
+    /* a routed request must go to the same place, the route follows the request. */
+    if(is_routed
+       && mem_cmp(packet + body_offset + body_size, packet_size - (body_offset + body_size),
+                  other + other_body_offset + other_body_size, other_size - (other_body_offset + other_body_size))) {
+        return PLCTAG_ERR_NO_MATCH;
+    }
+
+    if(get_rmw_masks(packet + body_offset, body_size, &mask_offset, &mask_size) != PLCTAG_STATUS_OK
+       || get_rmw_masks(other + other_body_offset, other_body_size, &other_mask_offset, &other_mask_size)
+              != PLCTAG_STATUS_OK) {
+        return PLCTAG_ERR_NO_MATCH;
+    }
+
+    /* the service, tag path and mask size must all be the same. */
+    if(mem_cmp(packet + body_offset, mask_offset, other + other_body_offset, other_mask_offset)) {
+        return PLCTAG_ERR_NO_MATCH;
+    }
+
+    or_mask = packet + body_offset + mask_offset;
+    and_mask = or_mask + mask_size;
+    other_or_mask = other + other_body_offset + other_mask_offset;
+    other_and_mask = other_or_mask + other_mask_size;
+
+    for(int i = 0; i < mask_size; i++) {
+        uint8_t keep = (uint8_t)(~other_or_mask[i] & other_and_mask[i]);
+
+        or_mask[i] = (uint8_t)((or_mask[i] & keep) | (other_or_mask[i] & ~keep));
+        and_mask[i] = (uint8_t)((and_mask[i] & keep) | (other_and_mask[i] & ~keep));
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_requests_overlap
+ *
+ * Whether two requests may touch the same tag.  Only the first segment of
+ * each path is compared, so any member or element of a tag overlaps the
+ * whole tag.  Symbolic names are compared without regard to case, as the
+ * PLC does.  Requests that cannot be taken apart are assumed to overlap.
+ */
+
+int eip_requests_overlap(uint8_t *packet, int packet_size, uint8_t *other, int other_size) {
+    int body_offset = 0;
+    int body_size = 0;
+    int is_routed = 0;
+    int other_body_offset = 0;
+    int other_body_size = 0;
+    int other_is_routed = 0;
+    uint8_t *segment = NULL;
+    int segment_size = 0;
+    uint8_t *other_segment = NULL;
+    int other_segment_size = 0;
+
+    if(get_cip_request(packet, packet_size, &body_offset, &body_size, &is_routed) != PLCTAG_STATUS_OK
+       || get_cip_request(other, other_size, &other_body_offset, &other_body_size, &other_is_routed) != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    if(get_tag_segment(packet + body_offset, body_size, &segment, &segment_size) != PLCTAG_STATUS_OK
+       || get_tag_segment(other + other_body_offset, other_body_size, &other_segment, &other_segment_size)
+              != PLCTAG_STATUS_OK) {
+        return 1;
+    }
+
+    /* a name and an instance number could be the same tag. */
+    if(segment[0] != other_segment[0]) { return 1; }
+
+    if(segment_size != other_segment_size) { return 0; }
+
+    for(int i = 0; i < segment_size; i++) {
+        uint8_t c = segment[i];
+        uint8_t other_c = other_segment[i];
+
+        if(segment[0] == 0x91 && i >= 2) {
+            if(c >= 'a' && c <= 'z') { c = (uint8_t)(c - 'a' + 'A'); }
+            if(other_c >= 'a' && other_c <= 'z') { other_c = (uint8_t)(other_c - 'a' + 'A'); }
+        }
+
+        if(c != other_c) { return 0; }
+    }
+
+    return 1;
+}
+
+
+/*
+ * eip_pack_requests
+ *
+ * Copy the requests into buf.  A single request is copied as is.  More than
+ * one are put into a Multiple Service request that uses the framing of the
+ * first one, including its route if it is routed.  The requests must all be
+ * of the same pack class.
+ */
+
+int eip_pack_requests(uint8_t *buf, int buf_capacity, uint8_t **requests, int *request_sizes, int num_requests,
+                      int *packed_size) {
+    uint8_t route[MAX_ROUTE_SIZE];
+    int route_size = 0;
+    int pkt_offset = 0;
+    int pkt_len = 0;
+    int is_routed = 0;
+    int header_size = 0;
+    int current_offset = 0;
+    uint8_t *pkt_start = NULL;
+    uint8_t *next_pkt_data = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    if(num_requests < 1 || request_sizes[0] > buf_capacity) {
+        pdebug(DEBUG_WARN, "No requests or the first request does not fit!");
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    /* get the header info from the first request. Just copy the whole thing. */
+    mem_copy(buf, requests[0], request_sizes[0]);
+    *packed_size = request_sizes[0];
+
+    /* special case the case where there is just one request. */
+    if(num_requests == 1) { return PLCTAG_STATUS_OK; }
+
+    rc = get_cip_request(buf, request_sizes[0], &pkt_offset, &pkt_len, &is_routed);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to find the request to pack, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    /*
+     * a routed request has the route after the embedded request, save it for the end.
+     * The route is always an even number of bytes, so an odd remainder means a pad byte.
+     */
+    if(is_routed) {
+        int route_offset = pkt_offset + pkt_len;
+
+        route_size = request_sizes[0] - route_offset;
+
+        if(route_size & 1) {
+            route_offset++;
+            route_size--;
+        }
+
+        if(route_size < 0 || route_size > (int)sizeof(route)) {
+            pdebug(DEBUG_WARN, "Route of %d bytes is not valid!", route_size);
+            return PLCTAG_ERR_BAD_DATA;
+        }
+
+        mem_copy(route, buf + route_offset, route_size);
+    }
+
+    /* the header has an offset for each request. */
+    header_size = MULTI_REQ_HEADER_SIZE + (2 * num_requests);
+
+    pdebug(DEBUG_INFO, "header size %d", header_size);
+
+    if(pkt_offset + header_size + pkt_len > buf_capacity) {
+        pdebug(DEBUG_WARN, "Packed requests do not fit in %d bytes!", buf_capacity);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
+
+    /* move the first request over to make room for the header. */
+    pkt_start = buf + pkt_offset;
+    mem_move(pkt_start + header_size, pkt_start, pkt_len);
+
+    pkt_start[0] = CIP_CMD_MULTI;
+    pkt_start[1] = 0x02; /* length of path in words */
+    pkt_start[2] = 0x20; /* Class */
+    pkt_start[3] = 0x02; /* Message Router */
+    pkt_start[4] = 0x24; /* Instance */
+    pkt_start[5] = 0x01; /* #1 */
+    set_u16(pkt_start, 6, (uint16_t)num_requests);
+
+    /* the offsets are from the count. */
+    current_offset = 2 + (2 * num_requests);
+    set_u16(pkt_start, MULTI_REQ_HEADER_SIZE, (uint16_t)current_offset);
+
+    next_pkt_data = pkt_start + header_size + pkt_len;
+    current_offset += pkt_len;
+
+    pdebug(DEBUG_INFO, "packet 0 is of length %d.", pkt_len);
+
+    /* now process the rest of the requests. */
+    for(int i = 1; i < num_requests; i++) {
+        int new_is_routed = 0;
+
+        set_u16(pkt_start, MULTI_REQ_HEADER_SIZE + (2 * i), (uint16_t)current_offset);
+
+        rc = get_cip_request(requests[i], request_sizes[i], &pkt_offset, &pkt_len, &new_is_routed);
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Unable to find the request to pack, %s!", plc_tag_decode_error(rc));
+            return rc;
+        }
+
+        pdebug(DEBUG_INFO, "packet %d is of length %d.", i, pkt_len);
+
+        if((int)(next_pkt_data - buf) + pkt_len + 1 + route_size > buf_capacity) {
+            pdebug(DEBUG_WARN, "Packed requests do not fit in %d bytes!", buf_capacity);
+            return PLCTAG_ERR_TOO_LARGE;
+        }
+
+        mem_copy(next_pkt_data, requests[i] + pkt_offset, pkt_len);
+
+        next_pkt_data += pkt_len;
+        current_offset += pkt_len;
+    }
+
+    /* stitch up the lengths of the framing. */
+    if(get_u16(buf, ENCAP_COMMAND) == ENCAP_CONNECTED_SEND) {
+        set_u16(buf, CO_CDI_LENGTH, (uint16_t)((next_pkt_data - buf) - CO_CONN_SEQ_NUM));
+    } else {
+        if(is_routed) {
+            int embedded_size = (int)(next_pkt_data - pkt_start);
+
+            set_u16(buf, UC_ROUTED_LENGTH, (uint16_t)embedded_size);
+
+            /* the route starts on a 16-bit boundary. */
+            if(embedded_size & 1) {
+                *next_pkt_data = 0;
+                next_pkt_data++;
+            }
+
+            mem_copy(next_pkt_data, route, route_size);
+            next_pkt_data += route_size;
+        }
+
+        set_u16(buf, UC_UDI_LENGTH, (uint16_t)((next_pkt_data - buf) - UC_CIP));
+    }
+
+    set_u16(buf, ENCAP_LENGTH, (uint16_t)((next_pkt_data - buf) - ENCAP_SIZE));
+
+    *packed_size = (int)(next_pkt_data - buf);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_prepare_packet
+ *
+ * Fill in the session parts of a packet about to be sent.  Unconnected
+ * packets get the next session sequence ID as the sender context, connected
+ * packets get the connection ID and the next connection sequence number.
+ */
+
+int eip_prepare_packet(uint8_t *packet, int packet_size, uint32_t session_handle, uint64_t *session_seq_id,
+                       uint32_t targ_connection_id, uint16_t *conn_seq_num) {
+    uint16_t command = get_u16(packet, ENCAP_COMMAND);
+
+    set_u16(packet, ENCAP_LENGTH, (uint16_t)(packet_size - ENCAP_SIZE));
+    set_u32(packet, ENCAP_SESSION_HANDLE, session_handle);
+    set_u32(packet, ENCAP_STATUS, 0);
+    set_u32(packet, ENCAP_OPTIONS, 0);
+
+    if(command == ENCAP_UNCONNECTED_SEND) {
+        (*session_seq_id)++;
+
+        /* link up the request seq ID and the packet seq ID */
+        set_u64(packet, ENCAP_SENDER_CONTEXT, *session_seq_id);
+
+        pdebug(DEBUG_INFO, "Preparing unconnected packet with session sequence ID %llx", *session_seq_id);
+    } else if(command == ENCAP_CONNECTED_SEND) {
+        pdebug(DEBUG_DETAIL, "cpf_targ_conn_id=%x", targ_connection_id);
+
+        set_u32(packet, CO_TARG_CONN_ID, targ_connection_id);
+
+        (*conn_seq_num)++;
+        set_u16(packet, CO_CONN_SEQ_NUM, *conn_seq_num);
+
+        pdebug(DEBUG_INFO, "Preparing connected packet with connection ID %x and sequence ID %u(%x)", targ_connection_id,
+               *conn_seq_num, *conn_seq_num);
+    } else {
+        pdebug(DEBUG_WARN, "Unsupported packet type %x!", command);
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    pdebug(DEBUG_INFO, "Prepared packet of size %d", packet_size);
+    pdebug_dump_bytes(DEBUG_INFO, packet, packet_size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_get_seq_id
+ *
+ * Get what ties a reply to its request.  A connected reply carries the
+ * connection sequence number of its request and an unconnected reply carries
+ * the sender context of its request.  Works on requests and replies alike.
+ */
+
+int eip_get_seq_id(uint8_t *packet, int packet_size, uint16_t *command, uint64_t *seq_id) {
+    if(packet_size < ENCAP_SIZE) { return PLCTAG_ERR_TOO_SMALL; }
+
+    *command = get_u16(packet, ENCAP_COMMAND);
+
+    if(*command == ENCAP_CONNECTED_SEND) {
+        if(packet_size < CO_CIP) { return PLCTAG_ERR_TOO_SMALL; }
+
+        *seq_id = get_u16(packet, CO_CONN_SEQ_NUM);
+    } else if(*command == ENCAP_UNCONNECTED_SEND) {
+        *seq_id = get_u64(packet, ENCAP_SENDER_CONTEXT);
+    } else {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_in_flight_init
+ *
+ * Set up room for max_packets packets waiting for replies.
+ */
+
+int eip_in_flight_init(struct eip_in_flight_t *in_flight, int max_packets) {
+    if(max_packets < 1) { return PLCTAG_ERR_BAD_PARAM; }
+
+    in_flight->packets = (struct eip_packet_t *)mem_alloc(max_packets * (int)sizeof(struct eip_packet_t));
+    if(!in_flight->packets) { return PLCTAG_ERR_NO_MEM; }
+
+    in_flight->max_packets = max_packets;
+    in_flight->num_packets = 0;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_in_flight_destroy
+ *
+ * The caller must have released the requests of any packets still in flight.
+ */
+
+void eip_in_flight_destroy(struct eip_in_flight_t *in_flight) {
+    if(in_flight->packets) { mem_free(in_flight->packets); }
+
+    in_flight->packets = NULL;
+    in_flight->max_packets = 0;
+    in_flight->num_packets = 0;
+}
+
+
+/*
+ * eip_in_flight_reserve
+ *
+ * Get an empty packet to fill with requests, or NULL if as many packets as
+ * allowed are already waiting for replies.  The packet is not counted until
+ * eip_in_flight_add() is called.
+ */
+
+struct eip_packet_t *eip_in_flight_reserve(struct eip_in_flight_t *in_flight) {
+    struct eip_packet_t *packet = NULL;
+
+    if(!in_flight->packets || in_flight->num_packets >= in_flight->max_packets) { return NULL; }
+
+    packet = &in_flight->packets[in_flight->num_packets];
+    packet->num_requests = 0;
+
+    return packet;
+}
+
+
+/*
+ * eip_in_flight_add
+ *
+ * Count the reserved packet.  Do this before sending it, so that its requests
+ * are put back on the queue with the others if sending fails.
+ */
+
+void eip_in_flight_add(struct eip_in_flight_t *in_flight) {
+    if(in_flight->num_packets < in_flight->max_packets) { in_flight->num_packets++; }
+}
+
+
+/*
+ * eip_in_flight_sent
+ *
+ * Remember what the reply to the packet will carry and when to give up on it.
+ */
+
+int eip_in_flight_sent(struct eip_packet_t *sent, uint8_t *packet, int packet_size, int timeout_ms) {
+    sent->deadline = time_ms() + timeout_ms;
+
+    return eip_get_seq_id(packet, packet_size, &sent->command, &sent->seq_id);
+}
+
+
+/*
+ * eip_in_flight_find
+ *
+ * Find the packet that a reply answers.  This is checked even with only one
+ * packet in flight, so that a late reply to a packet that was given up on is
+ * not taken for the answer to the next.  Returns -1 if there is none.
+ */
+
+int eip_in_flight_find(struct eip_in_flight_t *in_flight, uint8_t *reply, int reply_size) {
+    uint16_t command = 0;
+    uint64_t seq_id = 0;
+
+    if(eip_get_seq_id(reply, reply_size, &command, &seq_id) != PLCTAG_STATUS_OK) { return -1; }
+
+    for(int i = 0; i < in_flight->num_packets; i++) {
+        if(in_flight->packets[i].command == command && in_flight->packets[i].seq_id == seq_id) { return i; }
+    }
+
+    return -1;
+}
+
+
+/*
+ * eip_in_flight_remove
+ *
+ * The packet has been answered, close up the gap.
+ */
+
+void eip_in_flight_remove(struct eip_in_flight_t *in_flight, int index) {
+    if(index < 0 || index >= in_flight->num_packets) { return; }
+
+    in_flight->num_packets--;
+
+    for(int i = index; i < in_flight->num_packets; i++) { in_flight->packets[i] = in_flight->packets[i + 1]; }
+}
+
+
+/*
+ * eip_in_flight_check_deadlines
+ *
+ * A packet that has had no reply by its deadline is not going to get one.
+ * Returns PLCTAG_ERR_TIMEOUT if any packet is past its deadline so that the
+ * caller puts the requests back on the queue and reconnects.
+ */
+
+int eip_in_flight_check_deadlines(struct eip_in_flight_t *in_flight) {
+    int64_t now = time_ms();
+
+    for(int i = 0; i < in_flight->num_packets; i++) {
+        if(in_flight->packets[i].deadline < now) {
+            pdebug(DEBUG_WARN, "Packet with sequence ID %" PRIu64 " had no reply by its deadline.", in_flight->packets[i].seq_id);
+            return PLCTAG_ERR_TIMEOUT;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_process_requests
+ *
+ * One turn of the request loop of a session or connection.  Send packets of
+ * queued requests until as many as allowed are waiting for replies, then
+ * handle the reply to one of them.
+ *
+ * A packet the PLC turns down as a whole, for instance because a first read
+ * guessed its reply size too small, does not break the connection.  Its
+ * requests go back on the queue to be sent alone, so that each gets its own
+ * answer.  Any other error puts the requests of all packets in flight back on
+ * the queue and is returned so that the caller reconnects.
+ */
+
+int eip_process_requests(struct eip_request_loop_t *loop) {
+    int rc = PLCTAG_STATUS_OK;
+    int num_sent = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    /* keep up to max_requests_in_flight packets on the wire. */
+    while(1) {
+        struct eip_packet_t *packet = eip_in_flight_reserve(loop->in_flight);
+
+        if(!packet) { break; }
+
+        packet->num_requests = loop->ops->select_requests(loop->owner, packet->requests);
+
+        /* output debug display as no particular tag. */
+        debug_set_tag_id(0);
+
+        if(packet->num_requests == 0) { break; }
+
+        pdebug(DEBUG_INFO, "%d requests to process.", packet->num_requests);
+
+        /* count it first so that it is pushed back with the others if sending fails. */
+        eip_in_flight_add(loop->in_flight);
+        num_sent++;
+
+        rc = send_packet(loop, packet);
+        if(rc != PLCTAG_STATUS_OK) { break; }
+    }
+
+    /* handle the reply to one of the packets. */
+    if(rc == PLCTAG_STATUS_OK && loop->in_flight->num_packets > 0) { rc = receive_packet(loop); }
+
+    /* replies to other packets must not keep one that was never answered waiting forever. */
+    if(rc == PLCTAG_STATUS_OK) { rc = eip_in_flight_check_deadlines(loop->in_flight); }
+
+    /* problem? push the requests back on the queue. */
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error sending or receiving requests!");
+
+        metrics_record_error(loop->metrics);
+
+        requeue_in_flight(loop);
+    }
+
+    /* tickle the main tickler thread to note that we have responses. */
+    if(num_sent > 0 || rc != PLCTAG_STATUS_OK) { plc_tag_tickler_wake(); }
+
+    debug_set_tag_id(0);
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return rc;
+}
+
+
+/*
+ * eip_check_packed_response
+ *
+ * Sanity check the reply to a Multiple Service request.  If the PLC failed
+ * the whole request, *cip_status points to the CIP status in the packet for
+ * the caller to decode and PLCTAG_ERR_REMOTE_ERR is returned.
+ */
+
+int eip_check_packed_response(uint8_t *packet, int packet_size, int num_requests, uint8_t **cip_status) {
+    int reply_offset = get_reply_offset(packet, packet_size);
+    int item_length = 0;
+    int item_start = 0;
+    uint8_t *multi_resp = NULL;
+
+    *cip_status = NULL;
+
+    if(reply_offset < 0 || reply_offset + MULTI_RESP_STATUS_SIZE > packet_size) {
+        pdebug(DEBUG_WARN, "Unexpected EIP packet type, %04x!", get_u16(packet, ENCAP_COMMAND));
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    multi_resp = packet + reply_offset;
+
+    if(get_u16(packet, ENCAP_COMMAND) == ENCAP_UNCONNECTED_SEND) {
+        pdebug(DEBUG_INFO, "Received unconnected packet with session sequence ID %x", get_u32(packet, ENCAP_SENDER_CONTEXT));
+
+        item_length = get_u16(packet, UC_UDI_LENGTH);
+        item_start = UC_CIP;
+    } else {
+        pdebug(DEBUG_INFO, "Received connected packet with sequence ID %u", get_u16(packet, CO_CONN_SEQ_NUM));
+
+        item_length = get_u16(packet, CO_CDI_LENGTH);
+        item_start = CO_CONN_SEQ_NUM;
+    }
+
+    /* punt if we got an overall error or it is not a partial/bundled error. */
+    if(multi_resp[2] != CIP_STATUS_OK && multi_resp[2] != CIP_ERR_PARTIAL_ERROR) {
+        *cip_status = &multi_resp[2];
+        return PLCTAG_ERR_REMOTE_ERR;
+    }
+
+    if(reply_offset + MULTI_RESP_HEADER_SIZE > packet_size) {
+        pdebug(DEBUG_WARN, "Packed response is too short, %d bytes!", packet_size - reply_offset);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    /* check the passed data item size against what we really got. */
+    if(item_length != packet_size - item_start) {
+        pdebug(DEBUG_WARN, "Incorrectly constructed response! Data item length field is %d but actual size is %d!", item_length,
+               packet_size - item_start);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if(get_u16(multi_resp, MULTI_RESP_COUNT) != num_requests
+       || reply_offset + MULTI_RESP_COUNT + 2 + (2 * num_requests) > packet_size) {
+        pdebug(DEBUG_WARN, "Expected %d packed responses back but got %d!", num_requests, get_u16(multi_resp, MULTI_RESP_COUNT));
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    /* check all the offsets */
+    for(int i = 0; i < num_requests; i++) {
+        int resp_offset = reply_offset + MULTI_RESP_COUNT + get_u16(multi_resp, MULTI_RESP_COUNT + 2 + (2 * i));
+
+        pdebug(DEBUG_DETAIL, "Response %d starts at byte offset %d", i, resp_offset);
+
+        if(resp_offset >= packet_size) {
+            pdebug(DEBUG_WARN, "Response %d has offset %d which is outside the packet!", i, resp_offset);
+            return PLCTAG_ERR_OUT_OF_BOUNDS;
+        }
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_unpack_response
+ *
+ * Copy the reply for one request into buf as if it had been sent alone.  A
+ * reply that is not a Multiple Service reply is copied unchanged.  If buf is
+ * too small, *unpacked_size is set to the size needed and
+ * PLCTAG_ERR_TOO_SMALL is returned.
+ */
+
+int eip_unpack_response(uint8_t *packet, int packet_size, int sub_packet, uint8_t *buf, int buf_capacity,
+                        int *unpacked_size) {
+    int reply_offset = get_reply_offset(packet, packet_size);
+    uint8_t *multi = NULL;
+    int total_responses = 0;
+    int pkt_start = 0;
+    int pkt_end = 0;
+    int pkt_len = 0;
+
+    /* not a packed reply? */
+    if(reply_offset < 0 || packet[reply_offset] != (CIP_CMD_MULTI | CIP_CMD_OK)) {
+        pdebug(DEBUG_INFO, "Got single response packet.  Copying %d bytes unchanged.", packet_size);
+
+        *unpacked_size = packet_size;
+
+        if(packet_size > buf_capacity) { return PLCTAG_ERR_TOO_SMALL; }
+
+        mem_copy(buf, packet, packet_size);
+
+        return PLCTAG_STATUS_OK;
+    }
+
+    multi = packet + reply_offset;
+    total_responses = get_u16(multi, MULTI_RESP_COUNT);
+
+    pdebug(DEBUG_INFO, "Got multiple response packet, subpacket %d", sub_packet);
+
+    if(sub_packet >= total_responses) {
+        pdebug(DEBUG_WARN, "Response %d is not in a packet of %d responses!", sub_packet, total_responses);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    /* the offsets are from the count. */
+    pkt_start = reply_offset + MULTI_RESP_COUNT + get_u16(multi, MULTI_RESP_COUNT + 2 + (2 * sub_packet));
+
+    if((sub_packet + 1) < total_responses) {
+        pkt_end = reply_offset + MULTI_RESP_COUNT + get_u16(multi, MULTI_RESP_COUNT + 2 + (2 * (sub_packet + 1)));
+    } else {
+        pkt_end = ENCAP_SIZE + get_u16(packet, ENCAP_LENGTH);
+    }
+
+    if(pkt_start > pkt_end || pkt_end > packet_size) {
+        pdebug(DEBUG_WARN, "Response %d from %d to %d is outside the packet of %d bytes!", sub_packet, pkt_start, pkt_end,
+               packet_size);
+        return PLCTAG_ERR_OUT_OF_BOUNDS;
+    }
+
+    pkt_len = pkt_end - pkt_start;
+
+    pdebug(DEBUG_INFO, "Our result offset is %d bytes.", pkt_start - (reply_offset + MULTI_RESP_COUNT));
+
+    *unpacked_size = reply_offset + pkt_len;
+
+    if(*unpacked_size > buf_capacity) { return PLCTAG_ERR_TOO_SMALL; }
+
+    /* copy the header down and the reply after it. */
+    mem_copy(buf, packet, reply_offset);
+    mem_copy(buf + reply_offset, packet + pkt_start, pkt_len);
+
+    /* stitch up the packet sizes. */
+    if(get_u16(buf, ENCAP_COMMAND) == ENCAP_UNCONNECTED_SEND) {
+        set_u16(buf, UC_UDI_LENGTH, (uint16_t)pkt_len);
+    } else {
+        set_u16(buf, CO_CDI_LENGTH, (uint16_t)(pkt_len + 2)); /* extra for the connection sequence */
+    }
+
+    set_u16(buf, ENCAP_LENGTH, (uint16_t)(*unpacked_size - ENCAP_SIZE));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_build_register_session
+ *
+ * Build the Register Session request that starts every EIP session.
+ */
+
+int eip_build_register_session(uint8_t *buf, int buf_capacity, int *packet_size) {
+    if(buf_capacity < REG_SIZE) { return PLCTAG_ERR_TOO_SMALL; }
+
+    mem_set(buf, 0, REG_SIZE);
+
+    set_u16(buf, ENCAP_COMMAND, ENCAP_REGISTER_SESSION);
+    set_u16(buf, ENCAP_LENGTH, (uint16_t)(REG_SIZE - ENCAP_SIZE));
+    set_u16(buf, REG_EIP_VERSION, EIP_VERSION);
+
+    *packet_size = REG_SIZE;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_check_register_session_response
+ *
+ * Check the reply to a Register Session request and get the session handle
+ * to use in all later packets.
+ */
+
+int eip_check_register_session_response(uint8_t *packet, int packet_size, uint32_t *session_handle) {
+    if(packet_size < ENCAP_SIZE) {
+        pdebug(DEBUG_WARN, "Session registration response is too short, %d bytes!", packet_size);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if(get_u16(packet, ENCAP_COMMAND) != ENCAP_REGISTER_SESSION) {
+        pdebug(DEBUG_WARN, "EIP unexpected response packet type: %d!", get_u16(packet, ENCAP_COMMAND));
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if(get_u32(packet, ENCAP_STATUS) != 0) {
+        pdebug(DEBUG_WARN, "EIP command failed, response code: %u", get_u32(packet, ENCAP_STATUS));
+        return PLCTAG_ERR_REMOTE_ERR;
+    }
+
+    *session_handle = get_u32(packet, ENCAP_SESSION_HANDLE);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_build_forward_open
+ *
+ * Build a Forward Open, or an extended Forward Open if fo->use_extended is
+ * set, for a class 3 explicit messaging connection.
+ */
+
+int eip_build_forward_open(uint8_t *buf, int buf_capacity, struct eip_forward_open_t *fo, int *packet_size) {
+    int cip_size = (fo->use_extended ? FO_EX_SIZE : FO_SIZE);
+    uint8_t *cip = buf + UC_CIP;
+    int rc = PLCTAG_STATUS_OK;
+
+    rc = build_cm_request(buf, buf_capacity, fo, (fo->use_extended ? CIP_CMD_FORWARD_OPEN_EX : CIP_CMD_FORWARD_OPEN), cip_size,
+                          packet_size);
+    if(rc != PLCTAG_STATUS_OK) { return rc; }
+
+    /* the PLC picks its own connection ID and returns it in the reply. */
+    set_u32(cip, FO_TARG_TO_ORIG_CONN_ID, fo->orig_connection_id);
+    set_u16(cip, FO_CONN_SERIAL_NUMBER, fo->conn_serial_number);
+    set_u16(cip, FO_VENDOR_ID, FO_VENDOR_ID_VAL);
+    set_u32(cip, FO_VENDOR_SN, FO_VENDOR_SN_VAL);
+    cip[FO_TIMEOUT_MULTIPLIER] = FO_TIMEOUT_MULTIPLIER_VAL;
+    set_u32(cip, FO_ORIG_TO_TARG_RPI, FO_RPI);
+
+    if(fo->use_extended) {
+        set_u32(cip, FO_ORIG_TO_TARG_PARAMS, FO_CONN_PARAM_EX | fo->max_payload);
+        set_u32(cip, FO_EX_TARG_TO_ORIG_RPI, FO_RPI);
+        set_u32(cip, FO_EX_TARG_TO_ORIG_PARAMS, FO_CONN_PARAM_EX | fo->max_payload);
+    } else {
+        uint16_t conn_params = (fo->conn_params ? fo->conn_params : (uint16_t)(FO_CONN_PARAM | fo->max_payload));
+
+        set_u16(cip, FO_ORIG_TO_TARG_PARAMS, conn_params);
+        set_u32(cip, FO_TARG_TO_ORIG_RPI, FO_RPI);
+        set_u16(cip, FO_TARG_TO_ORIG_PARAMS, conn_params);
+    }
+
+    cip[cip_size - 2] = FO_TRANSPORT_CLASS_T3;
+    cip[cip_size - 1] = (uint8_t)(fo->conn_path_size / 2);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_check_forward_open_response
+ *
+ * Check the reply to a Forward Open and get the connection IDs.
+ *
+ * Returns PLCTAG_ERR_UNSUPPORTED if the PLC does not know the service,
+ * PLCTAG_ERR_TOO_LARGE with *supported_size set if it refused the payload
+ * size, PLCTAG_ERR_DUPLICATE if the connection ID is in use and
+ * PLCTAG_ERR_REMOTE_ERR for any other refusal.  If the PLC refused the
+ * request, *cip_status points to its CIP status.
+ */
+
+int eip_check_forward_open_response(uint8_t *packet, int packet_size, uint32_t *targ_connection_id,
+                                    uint32_t *orig_connection_id, uint16_t *supported_size, uint8_t **cip_status) {
+    uint8_t *cip = packet + UC_CIP;
+    int rc = PLCTAG_STATUS_OK;
+
+    rc = check_cm_response(packet, packet_size, cip_status);
+    if(rc == PLCTAG_ERR_REMOTE_ERR && *cip_status) {
+        int status_end = UC_CIP + CM_RESP_EXT_STATUS + (2 * cip[CM_RESP_STATUS_SIZE]);
+
+        if(cip[CM_RESP_STATUS] == CIP_ERR_UNSUPPORTED_SERVICE) { return PLCTAG_ERR_UNSUPPORTED; }
+
+        /* the extended status may say why. */
+        if(cip[CM_RESP_STATUS] == CIP_ERR_CONNECTION_FAILURE && cip[CM_RESP_STATUS_SIZE] >= 2 && status_end <= packet_size) {
+            uint16_t extended_status = get_u16(cip, CM_RESP_EXT_STATUS);
+
+            if(extended_status == CIP_EXT_ERR_INVALID_SIZE) {
+                *supported_size = get_u16(cip, CM_RESP_SUPPORTED_SIZE);
+                pdebug(DEBUG_WARN, "Error from forward open request, unsupported size, but size %d is supported.", *supported_size);
+                return PLCTAG_ERR_TOO_LARGE;
+            }
+
+            if(extended_status == CIP_EXT_ERR_DUPLICATE_CONN) {
+                pdebug(DEBUG_WARN, "Error from forward open request, duplicate connection ID.  Need to try again.");
+                return PLCTAG_ERR_DUPLICATE;
+            }
+        }
+
+        return rc;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) { return rc; }
+
+    if(packet_size < UC_CIP + FO_RESP_MIN_SIZE) {
+        pdebug(DEBUG_WARN, "Forward Open response is too short, %d bytes!", packet_size);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    *targ_connection_id = get_u32(cip, FO_RESP_ORIG_TO_TARG_CONN_ID);
+    *orig_connection_id = get_u32(cip, FO_RESP_TARG_TO_ORIG_CONN_ID);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_build_forward_close
+ *
+ * Build a Forward Close for the connection opened with the same serial
+ * number and path.
+ */
+
+int eip_build_forward_close(uint8_t *buf, int buf_capacity, struct eip_forward_open_t *fo, int *packet_size) {
+    uint8_t *cip = buf + UC_CIP;
+    int rc = PLCTAG_STATUS_OK;
+
+    rc = build_cm_request(buf, buf_capacity, fo, CIP_CMD_FORWARD_CLOSE, FC_SIZE, packet_size);
+    if(rc != PLCTAG_STATUS_OK) { return rc; }
+
+    set_u16(cip, FC_CONN_SERIAL_NUMBER, fo->conn_serial_number);
+    set_u16(cip, FC_VENDOR_ID, FO_VENDOR_ID_VAL);
+    set_u32(cip, FC_VENDOR_SN, FO_VENDOR_SN_VAL);
+    cip[FC_PATH_SIZE] = (uint8_t)(fo->conn_path_size / 2);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_check_forward_close_response
+ *
+ * Check the reply to a Forward Close.  If the PLC refused the request,
+ * *cip_status points to its CIP status.
+ */
+
+int eip_check_forward_close_response(uint8_t *packet, int packet_size, uint8_t **cip_status) {
+    return check_cm_response(packet, packet_size, cip_status);
+}
+
+
+/*
+ * eip_send_packet
+ *
+ * Write the whole packet to the socket, waiting up to timeout milliseconds.
+ */
+
+int eip_send_packet(sock_p sock, uint8_t *data, int data_size, volatile int *terminating, int timeout) {
+    int rc = PLCTAG_STATUS_OK;
+    int data_offset = 0;
+    int64_t timeout_time = 0;
+
+    if(timeout > 0) {
+        timeout_time = time_ms() + timeout;
+    } else {
+        timeout_time = INT64_MAX;
+    }
+
+    pdebug(DEBUG_INFO, "Sending packet of size %d", data_size);
+    pdebug_dump_bytes(DEBUG_INFO, data, data_size);
+
+    /* send the packet */
+    do {
+        rc = socket_write(sock, data + data_offset, data_size - data_offset, SOCKET_WAIT_TIMEOUT_MS);
+
+        if(rc >= 0) {
+            data_offset += rc;
+        } else {
+            if(rc == PLCTAG_ERR_TIMEOUT) {
+                pdebug(DEBUG_DETAIL, "Socket not yet ready to write.");
+                rc = 0;
+            }
+        }
+    } while(!*terminating && rc >= 0 && data_offset < data_size && timeout_time > time_ms());
+
+    if(*terminating) {
+        pdebug(DEBUG_WARN, "Session is terminating.");
+        return PLCTAG_ERR_ABORT;
+    }
+
+    if(rc < 0) {
+        pdebug(DEBUG_WARN, "Error, %d, writing socket!", rc);
+        return rc;
+    }
+
+    if(timeout_time <= time_ms()) {
+        pdebug(DEBUG_WARN, "Timed out waiting to send data!");
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * eip_recv_packet
+ *
+ * Read one whole packet from the socket, waiting up to timeout milliseconds.
+ * Returns PLCTAG_ERR_BAD_STATUS if the packet was read but its
+ * encapsulation status is not OK.
+ */
+
+int eip_recv_packet(sock_p sock, uint8_t *data, int data_capacity, int *data_size, volatile int *terminating, int timeout) {
+    int data_needed = ENCAP_SIZE;
+    int data_offset = 0;
+    int rc = PLCTAG_STATUS_OK;
+    int64_t timeout_time = 0;
+
+    if(timeout > 0) {
+        timeout_time = time_ms() + timeout;
+    } else {
+        timeout_time = INT64_MAX;
+    }
+
+    *data_size = 0;
+
+    do {
+        rc = socket_read(sock, data + data_offset, data_needed - data_offset, SOCKET_WAIT_TIMEOUT_MS);
+
+        if(rc >= 0) {
+            data_offset += rc;
+
+            /* recalculate the amount of data needed if we have just completed the read of an encap header */
+            if(data_offset >= ENCAP_SIZE) {
+                data_needed = ENCAP_SIZE + get_u16(data, ENCAP_LENGTH);
+
+                if(data_needed > data_capacity) {
+                    pdebug(DEBUG_WARN, "Packet response (%d) is larger than possible buffer size (%d)!", data_needed,
+                           data_capacity);
+                    return PLCTAG_ERR_TOO_LARGE;
+                }
+            }
+        } else {
+            if(rc == PLCTAG_ERR_TIMEOUT) {
+                pdebug(DEBUG_DETAIL, "Socket not yet ready to read.");
+            } else {
+                /* error! */
+                pdebug(DEBUG_WARN, "Error reading socket! rc=%d", rc);
+                return rc;
+            }
+        }
+    } while(!*terminating && data_offset < data_needed && timeout_time > time_ms());
+
+    if(*terminating) {
+        pdebug(DEBUG_INFO, "Session is terminating, returning...");
+        return PLCTAG_ERR_ABORT;
+    }
+
+    if(timeout_time <= time_ms()) {
+        pdebug(DEBUG_WARN, "Timed out waiting for data to read!");
+        return PLCTAG_ERR_TIMEOUT;
+    }
+
+    *data_size = data_needed;
+
+    pdebug(DEBUG_INFO, "request received all needed data (%d bytes of %d).", data_offset, data_needed);
+
+    pdebug_dump_bytes(DEBUG_INFO, data, data_offset);
+
+    /* check status. */
+    if(get_u32(data, ENCAP_STATUS) != 0) { return PLCTAG_ERR_BAD_STATUS; }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * send_packet
+ *
+ * Pack the requests of a packet into the buffer and send it.  The buffer is
+ * free again as soon as the packet is on the wire, so the next packet can be
+ * built before this one has its reply.
+ */
+
+int send_packet(struct eip_request_loop_t *loop, struct eip_packet_t *packet) {
+    uint8_t *request_data[EIP_MAX_PACKET_REQUESTS];
+    int request_sizes[EIP_MAX_PACKET_REQUESTS];
+    int packet_size = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    for(int i = 0; i < packet->num_requests; i++) {
+        loop->ops->get_request_data(packet->requests[i], &request_data[i], &request_sizes[i]);
+    }
+
+    /* copy and pack the requests into the buffer. */
+    rc = eip_pack_requests(loop->buf, loop->buf_capacity, request_data, request_sizes, packet->num_requests, &packet_size);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to pack %d requests, %s!", packet->num_requests, plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    /* fill in all the necessary parts to the request. */
+    rc = eip_prepare_packet(loop->buf, packet_size, loop->session_handle, loop->session_seq_id, loop->targ_connection_id,
+                            loop->conn_seq_num);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to prepare request, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    /* remember what the reply will carry. */
+    rc = eip_in_flight_sent(packet, loop->buf, packet_size, loop->timeout);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to get the sequence ID of the packet, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    rc = eip_send_packet(loop->sock, loop->buf, packet_size, loop->terminating, loop->timeout);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error sending packet %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    metrics_record_packet_sent(loop->metrics, packet_size);
+    metrics_record_requests_packed(loop->metrics, packet->num_requests);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * receive_packet
+ *
+ * Wait for the next reply and hand it out to the requests of the packet it
+ * answers.  A reply that answers none of the packets in flight is dropped.
+ */
+
+int receive_packet(struct eip_request_loop_t *loop) {
+    struct eip_packet_t *packet = NULL;
+    int reply_size = 0;
+    int index = 0;
+    int rc = PLCTAG_STATUS_OK;
+
+    /* wait for the response */
+    rc = eip_recv_packet(loop->sock, loop->buf, loop->buf_capacity, &reply_size, loop->terminating, loop->timeout);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Error receiving packet response %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    metrics_record_packet_received(loop->metrics, reply_size);
+
+    index = eip_in_flight_find(loop->in_flight, loop->buf, reply_size);
+    if(index < 0) {
+        pdebug(DEBUG_WARN, "Dropping a reply that does not match any of the %d packets in flight.", loop->in_flight->num_packets);
+        return PLCTAG_STATUS_OK;
+    }
+
+    packet = &loop->in_flight->packets[index];
+
+    /*
+     * check the CIP status, but only if this is a bundled
+     * response.   If it is a singleton, then we pass the
+     * status back to the tag.
+     */
+    if(packet->num_requests > 1) {
+        uint8_t *cip_status = NULL;
+
+        rc = eip_check_packed_response(loop->buf, reply_size, packet->num_requests, &cip_status);
+        if(rc == PLCTAG_ERR_REMOTE_ERR && cip_status) {
+            pdebug(DEBUG_WARN, "Packed request failed with status 0x%02x, sending the requests alone.", *cip_status);
+
+            loop->ops->requeue_requests(loop->owner, packet->requests, packet->num_requests, 1);
+
+            packet->num_requests = 0;
+            eip_in_flight_remove(loop->in_flight, index);
+
+            return PLCTAG_STATUS_OK;
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            pdebug(DEBUG_WARN, "Got error %s when processing incoming response(s)!", plc_tag_decode_error(rc));
+            return rc;
+        }
+    }
+
+    /* copy the results back out. Every request gets a copy. */
+    for(int i = 0; i < packet->num_requests; i++) {
+        loop->ops->complete_request(loop->owner, packet->requests[i], loop->buf, reply_size, i);
+    }
+
+    debug_set_tag_id(0);
+
+    /* the packet is done. */
+    eip_in_flight_remove(loop->in_flight, index);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * requeue_in_flight
+ *
+ * Put the requests of all packets in flight back at the head of the queue,
+ * in the order they were sent, so that they go again after a reconnect.
+ */
+
+void requeue_in_flight(struct eip_request_loop_t *loop) {
+    int num_requeued = 0;
+
+    for(int p = loop->in_flight->num_packets - 1; p >= 0; p--) {
+        struct eip_packet_t *packet = &loop->in_flight->packets[p];
+
+        loop->ops->requeue_requests(loop->owner, packet->requests, packet->num_requests, 0);
+        num_requeued += packet->num_requests;
+
+        packet->num_requests = 0;
+    }
+
+    loop->in_flight->num_packets = 0;
+
+    pdebug(DEBUG_INFO, "Pushed %d requests back into the queue.", num_requeued);
+}
+
+
+/*
+ * get_cip_request
+ *
+ * Find the CIP request that goes into a Multiple Service packet.  Connected
+ * requests carry it after the connection sequence number.  Unconnected
+ * requests carry it directly in the data item, or embedded in a Connection
+ * Manager Unconnected Send when they are routed.  The route follows the
+ * embedded request.
+ */
+
+int get_cip_request(uint8_t *packet, int packet_size, int *body_offset, int *body_size, int *is_routed) {
+    uint16_t command = 0;
+
+    *is_routed = 0;
+
+    if(packet_size < ENCAP_SIZE) { return PLCTAG_ERR_TOO_SMALL; }
+
+    command = get_u16(packet, ENCAP_COMMAND);
+
+    if(command == ENCAP_CONNECTED_SEND && packet_size >= CO_CIP) {
+        *body_offset = CO_CIP;
+        *body_size = (int)get_u16(packet, CO_CDI_LENGTH) - 2; /* for the connection sequence number */
+    } else if(command == ENCAP_UNCONNECTED_SEND && packet_size > UC_CIP) {
+        if(packet[UC_CIP] == CIP_CMD_UNCONNECTED_SEND && packet_size >= UC_ROUTED_CIP) {
+            *is_routed = 1;
+            *body_offset = UC_ROUTED_CIP;
+            *body_size = (int)get_u16(packet, UC_ROUTED_LENGTH);
+        } else {
+            *body_offset = UC_CIP;
+            *body_size = (int)get_u16(packet, UC_UDI_LENGTH);
+        }
+    } else {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(*body_size <= 0 || *body_offset + *body_size > packet_size) {
+        pdebug(DEBUG_WARN, "Request body of %d bytes at offset %d does not fit in the request of %d bytes!", *body_size,
+               *body_offset, packet_size);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * get_rmw_masks
+ *
+ * Find the masks of a Read-Modify-Write request body.  The body is the
+ * service, the path size in words, the path, the size of each mask and then
+ * the OR mask followed by the AND mask.  *mask_offset is where the OR mask
+ * starts.
+ */
+
+int get_rmw_masks(uint8_t *body, int body_size, int *mask_offset, int *mask_size) {
+    int path_size = 0;
+
+    if(body_size < 2 || body[0] != CIP_CMD_RMW) { return PLCTAG_ERR_NO_MATCH; }
+
+    path_size = body[1] * 2;
+
+    if(2 + path_size + 2 > body_size) { return PLCTAG_ERR_BAD_DATA; }
+
+    *mask_size = get_u16(body, 2 + path_size);
+    *mask_offset = 2 + path_size + 2;
+
+    if(*mask_size <= 0 || *mask_offset + (2 * *mask_size) != body_size) { return PLCTAG_ERR_BAD_DATA; }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * get_tag_segment
+ *
+ * Find the first segment of the request path, the one that picks the tag.
+ * Only symbolic names and logical segments are understood.
+ */
+
+int get_tag_segment(uint8_t *body, int body_size, uint8_t **segment, int *segment_size) {
+    int path_size = 0;
+    uint8_t *path = body + 2;
+
+    if(body_size < 2) { return PLCTAG_ERR_TOO_SMALL; }
+
+    path_size = body[1] * 2;
+
+    if(path_size < 2 || 2 + path_size > body_size) { return PLCTAG_ERR_BAD_DATA; }
+
+    if(path[0] == 0x91) {
+        /* ANSI extended symbolic segment, the name is padded to an even length. */
+        *segment_size = 2 + path[1];
+    } else if((path[0] & 0xE0) == 0x20) {
+        /* logical segment, 8, 16 or 32 bit value. */
+        switch(path[0] & 0x03) {
+            case 0: *segment_size = 2; break;
+            case 1: *segment_size = 4; break;
+            case 2: *segment_size = 6; break;
+            default: return PLCTAG_ERR_UNSUPPORTED;
+        }
+    } else {
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    if(*segment_size > path_size) { return PLCTAG_ERR_BAD_DATA; }
+
+    *segment = path;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * get_reply_offset
+ *
+ * Where the CIP reply starts, or -1 if this is not a CIP reply packet.
+ */
+
+int get_reply_offset(uint8_t *packet, int packet_size) {
+    uint16_t command = 0;
+
+    if(packet_size < ENCAP_SIZE) { return -1; }
+
+    command = get_u16(packet, ENCAP_COMMAND);
+
+    if(command == ENCAP_CONNECTED_SEND && packet_size > CO_CIP) { return CO_CIP; }
+
+    if(command == ENCAP_UNCONNECTED_SEND && packet_size > UC_CIP) { return UC_CIP; }
+
+    return -1;
+}
+
+
+/*
+ * build_cm_request
+ *
+ * Fill in the encapsulation header, the unconnected data item and the start
+ * of a request to the Connection Manager.  The connection path goes after
+ * the cip_size bytes of the request.
+ */
+
+int build_cm_request(uint8_t *buf, int buf_capacity, struct eip_forward_open_t *fo, uint8_t service, int cip_size,
+                     int *packet_size) {
+    int total_size = UC_CIP + cip_size + fo->conn_path_size;
+    uint8_t *cip = buf + UC_CIP;
+
+    if(total_size > buf_capacity) {
+        pdebug(DEBUG_WARN, "Connection Manager request of %d bytes does not fit in %d bytes!", total_size, buf_capacity);
+        return PLCTAG_ERR_TOO_SMALL;
+    }
+
+    mem_set(buf, 0, total_size);
+
+    set_u16(buf, ENCAP_COMMAND, ENCAP_UNCONNECTED_SEND);
+    set_u16(buf, ENCAP_LENGTH, (uint16_t)(total_size - ENCAP_SIZE));
+    set_u32(buf, ENCAP_SESSION_HANDLE, fo->session_handle);
+    set_u64(buf, ENCAP_SENDER_CONTEXT, fo->sender_context);
+    set_u16(buf, UC_ROUTER_TIMEOUT, 1); /* one second is enough ? */
+
+    set_u16(buf, UC_ITEM_COUNT, 2);
+    set_u16(buf, UC_NAI_TYPE, EIP_ITEM_NAI);
+    set_u16(buf, UC_UDI_TYPE, EIP_ITEM_UDI);
+    set_u16(buf, UC_UDI_LENGTH, (uint16_t)(total_size - UC_CIP));
+
+    /* the Connection Manager, class 6 instance 1. */
+    cip[CM_SERVICE] = service;
+    cip[1] = 2;
+    cip[2] = 0x20;
+    cip[3] = 0x06;
+    cip[4] = 0x24;
+    cip[5] = 0x01;
+    cip[CM_SECS_PER_TICK] = FO_SECS_PER_TICK;
+    cip[CM_TIMEOUT_TICKS] = FO_TIMEOUT_TICKS;
+
+    mem_copy(cip + cip_size, fo->conn_path, fo->conn_path_size);
+
+    *packet_size = total_size;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * check_cm_response
+ *
+ * Check the encapsulation and CIP status of a reply from the Connection
+ * Manager.
+ */
+
+int check_cm_response(uint8_t *packet, int packet_size, uint8_t **cip_status) {
+    *cip_status = NULL;
+
+    if(packet_size < UC_CIP + CM_RESP_EXT_STATUS) {
+        pdebug(DEBUG_WARN, "Connection Manager response is too short, %d bytes!", packet_size);
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if(get_u16(packet, ENCAP_COMMAND) != ENCAP_UNCONNECTED_SEND) {
+        pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", get_u16(packet, ENCAP_COMMAND));
+        return PLCTAG_ERR_BAD_DATA;
+    }
+
+    if(get_u32(packet, ENCAP_STATUS) != 0) {
+        pdebug(DEBUG_WARN, "EIP command failed, response code: %u", get_u32(packet, ENCAP_STATUS));
+        return PLCTAG_ERR_REMOTE_ERR;
+    }
+
+    if(packet[UC_CIP + CM_RESP_STATUS] != CIP_STATUS_OK) {
+        *cip_status = packet + UC_CIP + CM_RESP_STATUS;
+        return PLCTAG_ERR_REMOTE_ERR;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+uint16_t get_u16(uint8_t *data, int offset) { return (uint16_t)(data[offset] | (data[offset + 1] << 8)); }
+
+
+void set_u16(uint8_t *data, int offset, uint16_t val) {
+    data[offset] = (uint8_t)(val & 0xFF);
+    data[offset + 1] = (uint8_t)((val >> 8) & 0xFF);
+}
+
+
+uint32_t get_u32(uint8_t *data, int offset) {
+    return (uint32_t)data[offset] | ((uint32_t)data[offset + 1] << 8) | ((uint32_t)data[offset + 2] << 16)
+           | ((uint32_t)data[offset + 3] << 24);
+}
+
+
+void set_u32(uint8_t *data, int offset, uint32_t val) {
+    for(int i = 0; i < 4; i++) { data[offset + i] = (uint8_t)((val >> (8 * i)) & 0xFF); }
+}
+
+
+uint64_t get_u64(uint8_t *data, int offset) {
+    uint64_t val = 0;
+
+    for(int i = 7; i >= 0; i--) { val = (val << 8) | data[offset + i]; }
+
+    return val;
+}
+
+
+void set_u64(uint8_t *data, int offset, uint64_t val) {
+    for(int i = 0; i < 8; i++) { data[offset + i] = (uint8_t)((val >> (8 * i)) & 0xFF); }
+}
@@ -0,0 +1,175 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef __PLCTAG_EIP_TRANSPORT_H__
+#define __PLCTAG_EIP_TRANSPORT_H__ 1
+
+#include <platform.h>
+#include <stdint.h>
+#include <utils/metrics.h>
+
+/*
+ * The parts of an EIP/CIP session that do not depend on the PLC family.
+ *
+ * The AB session and the Omron connection keep their own request queues,
+ * state machines and tag-facing API.  Both build and check their session
+ * registration, Forward Open and Forward Close packets through these
+ * functions and hand their queues to eip_process_requests(), so the packet
+ * I/O, the packing of requests into CIP Multiple Service packets, the
+ * tracking of packets that are waiting for replies, the handling of
+ * rejected packets and the unpacking of the replies are done one way.
+ *
+ * All functions work on complete EIP packets, starting at the encapsulation
+ * header.  Connected (SendUnitData) and unconnected (SendRRData) packets are
+ * supported.  Unconnected packets may carry the request directly or embedded
+ * in a Connection Manager Unconnected Send with a route.
+ */
+
+/* what the request selection needs to know about one queued request. */
+struct eip_request_info_t {
+    int allow_packing;
+    int is_read;       /* reads may be reordered among themselves. */
+    int pack_class;    /* requests only share a packet with requests of the same class. */
+    int payload_size;  /* space in a Multiple Service request, INT_MAX if it cannot be packed. */
+    int response_size; /* space in a Multiple Service reply. */
+    int overhead;      /* space the packet needs beyond the packed requests. */
+};
+
+#define EIP_MAX_PACKET_REQUESTS (200)
+
+/* a packet that has been sent and is waiting for its reply.  The requests belong to the caller. */
+struct eip_packet_t {
+    uint16_t command;
+    uint64_t seq_id;
+    int64_t deadline;
+    int num_requests;
+    void *requests[EIP_MAX_PACKET_REQUESTS];
+};
+
+/* the packets a connection has sent without waiting for the replies, oldest first. */
+struct eip_in_flight_t {
+    int max_packets;
+    int num_packets;
+    struct eip_packet_t *packets;
+};
+
+/*
+ * what the request loop needs from the session or connection that owns the
+ * request queue.  The hooks take the owner's locks themselves.
+ */
+struct eip_request_ops_t {
+    /* take the requests for the next packet off the head of the queue, returns how many. */
+    int (*select_requests)(void *owner, void **requests);
+
+    /* the encoded request, as it goes into the packet. */
+    void (*get_request_data)(void *request, uint8_t **data, int *data_size);
+
+    /* hand the reply at sub_packet to the request, or the error if it cannot be unpacked, and release it. */
+    void (*complete_request)(void *owner, void *request, uint8_t *reply, int reply_size, int sub_packet);
+
+    /* put requests back at the head of the queue in order.  If alone is set, they must not be packed again. */
+    void (*requeue_requests)(void *owner, void **requests, int num_requests, int alone);
+};
+
+/* the connection the request loop works on, filled in by the owner before each call. */
+struct eip_request_loop_t {
+    void *owner;
+    const struct eip_request_ops_t *ops;
+
+    sock_p sock;
+    volatile int *terminating;
+    int timeout;
+
+    /* packets are built in and replies are read into this buffer. */
+    uint8_t *buf;
+    int buf_capacity;
+
+    uint32_t session_handle;
+    uint64_t *session_seq_id;
+    uint32_t targ_connection_id;
+    uint16_t *conn_seq_num;
+
+    struct eip_in_flight_t *in_flight;
+    metrics_p metrics;
+};
+
+/* what a Forward Open or Forward Close needs to know about the connection. */
+struct eip_forward_open_t {
+    uint32_t session_handle;
+    uint64_t sender_context;
+    uint32_t orig_connection_id;
+    uint16_t conn_serial_number;
+    int use_extended;
+    uint16_t max_payload;
+    uint16_t conn_params; /* fixed Forward Open connection parameters, zero to build them from max_payload. */
+    uint8_t *conn_path;
+    int conn_path_size;
+};
+
+extern int eip_get_request_info(uint8_t *packet, int packet_size, struct eip_request_info_t *info);
+extern int eip_select_requests(struct eip_request_info_t *info, int num_queued, int request_space, int response_space,
+                               uint8_t *selected);
+extern int eip_merge_rmw_requests(uint8_t *packet, int packet_size, uint8_t *other, int other_size);
+extern int eip_requests_overlap(uint8_t *packet, int packet_size, uint8_t *other, int other_size);
+extern int eip_pack_requests(uint8_t *buf, int buf_capacity, uint8_t **requests, int *request_sizes, int num_requests,
+                             int *packed_size);
+extern int eip_prepare_packet(uint8_t *packet, int packet_size, uint32_t session_handle, uint64_t *session_seq_id,
+                              uint32_t targ_connection_id, uint16_t *conn_seq_num);
+extern int eip_get_seq_id(uint8_t *packet, int packet_size, uint16_t *command, uint64_t *seq_id);
+extern int eip_in_flight_init(struct eip_in_flight_t *in_flight, int max_packets);
+extern void eip_in_flight_destroy(struct eip_in_flight_t *in_flight);
+extern struct eip_packet_t *eip_in_flight_reserve(struct eip_in_flight_t *in_flight);
+extern void eip_in_flight_add(struct eip_in_flight_t *in_flight);
+extern int eip_in_flight_sent(struct eip_packet_t *sent, uint8_t *packet, int packet_size, int timeout_ms);
+extern int eip_in_flight_find(struct eip_in_flight_t *in_flight, uint8_t *reply, int reply_size);
+extern void eip_in_flight_remove(struct eip_in_flight_t *in_flight, int index);
+extern int eip_in_flight_check_deadlines(struct eip_in_flight_t *in_flight);
+extern int eip_process_requests(struct eip_request_loop_t *loop);
+extern int eip_check_packed_response(uint8_t *packet, int packet_size, int num_requests, uint8_t **cip_status);
+extern int eip_unpack_response(uint8_t *packet, int packet_size, int sub_packet, uint8_t *buf, int buf_capacity,
+                               int *unpacked_size);
+
+extern int eip_build_register_session(uint8_t *buf, int buf_capacity, int *packet_size);
+extern int eip_check_register_session_response(uint8_t *packet, int packet_size, uint32_t *session_handle);
+extern int eip_build_forward_open(uint8_t *buf, int buf_capacity, struct eip_forward_open_t *fo, int *packet_size);
+extern int eip_check_forward_open_response(uint8_t *packet, int packet_size, uint32_t *targ_connection_id,
+                                           uint32_t *orig_connection_id, uint16_t *supported_size, uint8_t **cip_status);
+extern int eip_build_forward_close(uint8_t *buf, int buf_capacity, struct eip_forward_open_t *fo, int *packet_size);
+extern int eip_check_forward_close_response(uint8_t *packet, int packet_size, uint8_t **cip_status);
+
+extern int eip_send_packet(sock_p sock, uint8_t *data, int data_size, volatile int *terminating, int timeout);
+extern int eip_recv_packet(sock_p sock, uint8_t *data, int data_capacity, int *data_size, volatile int *terminating,
+                           int timeout);
+
+#endif
@@ -0,0 +1,149 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <libplctag/protocols/mb/merge.h>
+
+
+/*
+ * mb_merge_in_reach
+ *
+ * Whether a queued write of count registers from base could end up in a
+ * merged request that starts out covering low up to, but not including,
+ * high.  This is only a quick filter over the queue, mb_merge_writes() makes
+ * the real choice.
+ */
+
+int mb_merge_in_reach(int low, int high, int max_count, int base, int count) {
+    return (base + count) > (high - max_count) && base < (low + max_count);
+}
+
+
+/*
+ * mb_merge_writes
+ *
+ * Grow the range low to high by merging queued writes right next to it.
+ * The candidates are sorted by base register, then taken going up from the
+ * top of the range and then going down from the bottom of it.  The range
+ * stops growing at the first gap or when it would be larger than max_count.
+ * Gaps are not filled as that would need a read of the registers in between
+ * first.  Writes that overlap the range are left for their own request.
+ *
+ * take() is called for each write that fits.  It returns non-zero if the
+ * write was merged and zero if it could not be, for instance because its tag
+ * is busy.  Returns the number of writes merged.
+ */
+
+int mb_merge_writes(int *low, int *high, int max_count, struct mb_merge_candidate_t *candidates, int num_candidates,
+                    int (*take)(void *tag, void *arg), void *arg) {
+    int num_merged = 0;
+
+    /* sort by base register, there are not many. */
+    for(int i = 1; i < num_candidates; i++) {
+        struct mb_merge_candidate_t tmp = candidates[i];
+        int j = i - 1;
+
+        while(j >= 0 && candidates[j].base > tmp.base) {
+            candidates[j + 1] = candidates[j];
+            j--;
+        }
+
+        candidates[j + 1] = tmp;
+    }
+
+    for(int pass = 0; pass < 2; pass++) {
+        for(int n = 0; n < num_candidates; n++) {
+            struct mb_merge_candidate_t *candidate = &candidates[(pass == 0 ? n : num_candidates - 1 - n)];
+            int cand_low = candidate->base;
+            int cand_high = candidate->base + candidate->count;
+
+            if(pass == 0) {
+                if(cand_low < *high) { continue; }
+                if(cand_low > *high || (cand_high - *low) > max_count) { break; }
+            } else {
+                if(cand_high > *low) { continue; }
+                if(cand_high < *low || (*high - cand_low) > max_count) { break; }
+            }
+
+            if(!take(candidate->tag, arg)) { continue; }
+
+            if(pass == 0) {
+                *high = cand_high;
+            } else {
+                *low = cand_low;
+            }
+
+            num_merged++;
+        }
+    }
+
+    return num_merged;
+}
+
+
+/*
+ * mb_fuse_fits
+ *
+ * Whether a queued register write can go along with a register read in one
+ * read/write multiple registers request.  The write must fit in the request
+ * and must not touch the registers being read, otherwise the read would see
+ * the new values before the caller expects it to.
+ */
+
+int mb_fuse_fits(int read_base, int read_count, int write_base, int write_count, int max_count) {
+    if(write_count > max_count) { return 0; }
+
+    return (write_base + write_count) <= read_base || write_base >= (read_base + read_count);
+}
+
+
+/*
+ * mb_copy_bits
+ *
+ * Copy count coils, packed eight to a byte with the lowest coil in the
+ * lowest bit, from bit src_bit of src to bit dest_bit of dest.  The other
+ * bits of dest are left alone.
+ */
+
+void mb_copy_bits(uint8_t *dest, int dest_bit, const uint8_t *src, int src_bit, int count) {
+    for(int i = 0; i < count; i++) {
+        int from = src_bit + i;
+        int to = dest_bit + i;
+        uint8_t mask = (uint8_t)(1 << (to % 8));
+
+        if(src[from / 8] & (1 << (from % 8))) {
+            dest[to / 8] |= mask;
+        } else {
+            dest[to / 8] &= (uint8_t)~mask;
+        }
+    }
+}
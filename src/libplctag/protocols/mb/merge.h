@@ -0,0 +1,62 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef __PLCTAG_MB_MERGE_H__
+#define __PLCTAG_MB_MERGE_H__ 1
+
+#include <stdint.h>
+
+/*
+ * The parts of Modbus write merging and read/write fusion that only look at
+ * register ranges.
+ *
+ * The PLC handler in modbus.c walks the queue of ready tags, locks them and
+ * builds the requests.  It asks these functions which queued writes may go
+ * into a request, so that the choice can be checked without a device.
+ * Ranges are in registers for holding registers and in coils for coils.
+ */
+
+/* a queued write that might be merged into another write. */
+struct mb_merge_candidate_t {
+    int base;
+    int count;
+    void *tag;
+};
+
+extern int mb_merge_in_reach(int low, int high, int max_count, int base, int count);
+extern int mb_merge_writes(int *low, int *high, int max_count, struct mb_merge_candidate_t *candidates, int num_candidates,
+                           int (*take)(void *tag, void *arg), void *arg);
+extern int mb_fuse_fits(int read_base, int read_count, int write_base, int write_count, int max_count);
+extern void mb_copy_bits(uint8_t *dest, int dest_bit, const uint8_t *src, int src_bit, int count);
+
+#endif
@@ -35,6 +35,7 @@
 #include <float.h>
 #include <inttypes.h>
 #include <libplctag/lib/libplctag.h>
+#include <libplctag/protocols/mb/merge.h>
 #include <libplctag/protocols/mb/modbus.h>
 #include <limits.h>
 #include <platform.h>
@@ -42,6 +43,8 @@
 #include <utils/atomic_utils.h>
 #include <utils/attr.h>
 #include <utils/debug.h>
+#include <utils/metrics.h>
+#include <utils/poll_planner.h>
 #include <utils/random_utils.h>
 #include <utils/rc.h>
 
@@ -51,11 +54,11 @@
 #define PLC_SOCKET_ERR_START_DELAY (50)
 #define PLC_SOCKET_ERR_DELAY_WAIT_INCREMENT (10)
 #define MODBUS_DEFAULT_PORT (502)
-#define PLC_READ_DATA_LEN (300)
-#define PLC_WRITE_DATA_LEN (300)
 #define MODBUS_MBAP_SIZE (6)
+#define MODBUS_MAX_ADU_SIZE (260) /* MBAP, unit ID and the largest PDU. */
 #define MAX_MODBUS_REQUEST_PAYLOAD (246)
 #define MAX_MODBUS_RESPONSE_PAYLOAD (250)
+#define MAX_MODBUS_FUSED_WRITE_PAYLOAD (242) /* write part of a read/write multiple registers request */
 #define MAX_MODBUS_PDU_PAYLOAD (253) /* everything after the server address */
 #define MODBUS_INACTIVITY_TIMEOUT (5000)
 #define SOCKET_READ_TIMEOUT (20)       /* read timeout in milliseconds */
@@ -63,6 +66,11 @@
 #define SOCKET_CONNECT_TIMEOUT (20)    /* connect timeout step in milliseconds */
 #define MODBUS_IDLE_WAIT_TIMEOUT (100) /* idle wait timeout in milliseconds */
 #define MAX_MODBUS_REQUESTS (16)       /* per the Modbus specification */
+#define MAX_COALESCE_CANDIDATES (256)  /* queued writes looked at when merging */
+
+/* the buffers hold one ADU per request in flight so that requests and responses can be batched. */
+#define PLC_READ_DATA_LEN (MAX_MODBUS_REQUESTS * MODBUS_MAX_ADU_SIZE)
+#define PLC_WRITE_DATA_LEN (MAX_MODBUS_REQUESTS * MODBUS_MAX_ADU_SIZE)
 
 typedef struct modbus_tag_t *modbus_tag_p;
 typedef struct modbus_tag_list_t *modbus_tag_list_p;
@@ -78,8 +86,18 @@ struct modbus_plc_t {
 
     /* keep a list of tags for this PLC. */
     struct modbus_tag_list_t tag_list;
-    // struct modbus_tag_list_t request_tag_list;
-    // struct modbus_tag_list_t response_tag_list;
+
+    /*
+     * Tags waiting for a request slot, oldest first.  Tag threads add to
+     * this while holding only the tag API mutex, so it has its own lock.
+     */
+    lock_t ready_lock;
+    struct modbus_tag_list_t ready_list;
+    int ready_count;
+
+    /* the whole tag list is only walked when asked or when a timer is due. */
+    atomic_bool sweep_requested;
+    int64_t next_sweep_ms;
 
     /* hostname/ip and possibly port of the server. */
     char *server;
@@ -110,20 +128,53 @@ struct modbus_plc_t {
         PLC_ERR_WAIT
     } state;
     int max_requests_in_flight;
-    int32_t tags_with_requests[MAX_MODBUS_REQUESTS];
+
+    /* responses are routed by sequence ID to the tag holding the request slot. */
+    struct modbus_tag_t *tags_with_requests[MAX_MODBUS_REQUESTS];
+
+    /* queue all ready requests in the write buffer and send them together.  Off unless batch_requests=1. */
+    int batch_requests;
+
+    /* merge queued writes to adjacent registers or coils into one request.  Off unless coalesce_writes=1. */
+    int coalesce_writes;
+
+    /* send a queued register write along with a register read using function 0x17. */
+    int fuse_read_write;
+
+    /* tags whose writes were merged into the request in the matching slot. */
+    struct modbus_tag_t *coalesced_tags[MAX_MODBUS_REQUESTS];
+
+    /* merged writes whose response just arrived, completed outside the owner's API mutex. */
+    struct modbus_tag_t *finished_writes;
+    uint16_t finished_write_seq_id;
+    int finished_write_status;
 
     /* comms timeout/disconnect. */
     int64_t inactivity_timeout_ms;
 
-    /* data */
+    /*
+     * data
+     *
+     * The read buffer can hold several responses.  The first response_len
+     * bytes are the complete response at the front of the buffer.
+     */
     int read_data_len;
+    int response_len;
+    uint32_t responses_consumed;
     uint8_t read_data[PLC_READ_DATA_LEN];
     int32_t response_tag_id;
 
     int write_data_len;
     int write_data_offset;
+    int write_data_requests;
     uint8_t write_data[PLC_WRITE_DATA_LEN];
     int32_t request_tag_id;
+
+    /* traffic and latency statistics, rolled up into the library totals. */
+    struct metrics_t metrics;
+
+    /* phases for automatic reads of the tags on this PLC. */
+    struct poll_planner_t poll_planner;
 };
 
 typedef struct modbus_plc_t *modbus_plc_p;
@@ -144,7 +195,8 @@ typedef enum {
     MB_CMD_WRITE_COIL_SINGLE = 0x05,
     MB_CMD_WRITE_HOLDING_REGISTER_SINGLE = 0x06,
     MB_CMD_WRITE_COIL_MULTI = 0x0F,
-    MB_CMD_WRITE_HOLDING_REGISTER_MULTI = 0x10
+    MB_CMD_WRITE_HOLDING_REGISTER_MULTI = 0x10,
+    MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI = 0x17
 } modbug_cmd_t;
 
 
@@ -164,6 +216,14 @@ struct modbus_tag_t {
     /* next one in the list for this PLC */
     struct modbus_tag_t *next;
 
+    /* next one in the PLC's ready list, only valid if on_ready_list is set. */
+    struct modbus_tag_t *next_ready;
+    int on_ready_list;
+
+    /* set while this tag's write rides along in another tag's request. */
+    struct modbus_tag_t *next_coalesced;
+    int coalesced_slot;
+
     /* register type. */
     modbus_reg_type_t reg_type;
     uint16_t reg_base;
@@ -178,12 +238,25 @@ struct modbus_tag_t {
     /* which request slot are we using? */
     int request_slot;
 
+    /* set when an abort could not get the PLC mutex to give up the slot. */
+    atomic_bool release_slot;
+
     /* data for the tag. */
     int elem_count;
     int elem_size;
 };
 
 
+/* where the writes merged into a request go, passed to take_coalesced_write(). */
+struct coalesce_state_t {
+    uint16_t seq_id;
+    int slot;
+    modbus_tag_p *last;
+    uint8_t *staging;
+    int staging_base;
+};
+
+
 /* default string types used for Modbus PLCs. */
 tag_byte_order_t modbus_tag_byte_order = {.is_allocated = 0,
 
@@ -221,15 +294,31 @@ static THREAD_FUNC(modbus_plc_handler);
 static void wake_plc_thread(modbus_plc_p plc);
 static int connect_plc(modbus_plc_p plc);
 static int tickle_all_tags(modbus_plc_p plc);
+static int sweep_all_tags(modbus_plc_p plc);
+static void dispatch_responses(modbus_plc_p plc);
+static void start_ready_requests(modbus_plc_p plc);
 static int tickle_tag(modbus_plc_p plc, modbus_tag_p tag);
+static void tickle_one_tag(modbus_plc_p plc, modbus_tag_p tag);
+static int request_slot_available(modbus_plc_p plc);
 static int find_request_slot(modbus_plc_p plc, modbus_tag_p tag);
 static void clear_request_slot(modbus_plc_p plc, modbus_tag_p tag);
 static int receive_response(modbus_plc_p plc);
+static int find_complete_response(modbus_plc_p plc);
+static void consume_response(modbus_plc_p plc);
 static int send_request(modbus_plc_p plc);
 static int check_read_response(modbus_plc_p plc, modbus_tag_p tag);
 static int create_read_request(modbus_plc_p plc, modbus_tag_p tag);
 static int check_write_response(modbus_plc_p plc, modbus_tag_p tag);
 static int create_write_request(modbus_plc_p plc, modbus_tag_p tag);
+static int coalesce_writes(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id, int *base_register, int *register_count,
+                           uint8_t *staging, int staging_base);
+static int take_coalesced_write(void *candidate_arg, void *arg);
+static void copy_coalesced_data(uint8_t *payload, int base_register, modbus_tag_p tag);
+static modbus_tag_p fuse_write(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id, int read_base, int read_count,
+                               uint8_t *write_data);
+static void finish_coalesced_writes(modbus_plc_p plc);
+static void restart_coalesced_writes(modbus_plc_p plc, int slot);
+static void remove_coalesced_tag(modbus_plc_p plc, modbus_tag_p tag);
 static int translate_modbus_error(uint8_t err_code);
 
 /* tag list functions */
@@ -239,6 +328,11 @@ static void push_tag(modbus_tag_list_p list, modbus_tag_p tag);
 static struct modbus_tag_list_t merge_lists(modbus_tag_list_p first, modbus_tag_list_p last);
 static int remove_tag(modbus_tag_list_p list, modbus_tag_p tag);
 
+/* ready list functions */
+static void push_ready_tag(modbus_plc_p plc, modbus_tag_p tag);
+static modbus_tag_p pop_ready_tag(modbus_plc_p plc);
+static void remove_ready_tag(modbus_plc_p plc, modbus_tag_p tag);
+
 
 /* tag vtable functions. */
 
@@ -276,6 +370,7 @@ plc_tag_p mb_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
                         void *userdata) {
     int rc = PLCTAG_STATUS_OK;
     modbus_tag_p tag = NULL;
+    int auto_sync_read_ms = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -299,6 +394,15 @@ plc_tag_p mb_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_id,
     if(rc == PLCTAG_STATUS_OK) {
         /* put the tag on the PLC's list. */
         critical_block(tag->plc->mutex) { push_tag(&(tag->plc->tag_list), tag); }
+
+        metrics_set_parent(&tag->metrics, &tag->plc->metrics);
+
+        /* line up automatic reads with the other tags on this PLC. */
+        auto_sync_read_ms = attr_get_int(attribs, "auto_sync_read_ms", 0);
+        if(auto_sync_read_ms > 0) {
+            tag->auto_sync_planner = &tag->plc->poll_planner;
+            tag->auto_sync_next_read = poll_planner_first_read(tag->auto_sync_planner, auto_sync_read_ms, &tag->auto_sync_family_id);
+        }
     } else {
         pdebug(DEBUG_WARN, "Unable to create new tag!  Error %s!", plc_tag_decode_error(rc));
         tag->status = (int8_t)rc;
@@ -388,6 +492,7 @@ int create_tag_object(attr attribs, modbus_tag_p *tag) {
 
     /* initialize the current request slot */
     (*tag)->request_slot = -1;
+    (*tag)->coalesced_slot = -1;
 
     /* make sure the generic tag tickler thread does not call the generic tickler. */
     (*tag)->skip_tickler = 1;
@@ -422,9 +527,16 @@ void modbus_tag_destructor(void *tag_arg) {
             } else {
                 pdebug(DEBUG_WARN, "Error %s while trying to remove the tag from the PLC's list!", plc_tag_decode_error(rc));
             }
+
+            /* the handler thread must not find this tag again. */
+            remove_ready_tag(tag->plc, tag);
+            remove_coalesced_tag(tag->plc, tag);
+            clear_request_slot(tag->plc, tag);
         }
 
         pdebug(DEBUG_DETAIL, "rc_dec: Releasing the reference to the PLC.");
+        plc_tag_generic_leave_poll_planner((plc_tag_p)tag);
+        metrics_set_parent(&tag->metrics, &library_metrics);
         tag->plc = rc_dec(tag->plc);
     }
 
@@ -448,6 +560,13 @@ void modbus_tag_destructor(void *tag_arg) {
         tag->byte_order = NULL;
     }
 
+    if(tag->snapshot_data) {
+        mem_free(tag->snapshot_data);
+        tag->snapshot_data = NULL;
+    }
+
+    if(tag->process_image_slot) { tag->process_image_slot = rc_dec(tag->process_image_slot); }
+
     pdebug(DEBUG_INFO, "Done.");
 }
 
@@ -457,6 +576,9 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc) {
     int server_id = attr_get_int(attribs, "path", -1);
     int connection_group_id = attr_get_int(attribs, "connection_group_id", 0);
     int max_requests_in_flight = attr_get_int(attribs, "max_requests_in_flight", 1);
+    int batch_requests = attr_get_int(attribs, "batch_requests", 0);
+    int coalesce_writes = attr_get_int(attribs, "coalesce_writes", 0);
+    int fuse_read_write = attr_get_int(attribs, "fuse_read_write", 0);
     int is_new = 0;
     int rc = PLCTAG_STATUS_OK;
 
@@ -505,6 +627,9 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc) {
 
             *plc = (modbus_plc_p)rc_alloc((int)(unsigned int)sizeof(struct modbus_plc_t), modbus_plc_destructor);
             if(*plc) {
+                metrics_init(&((*plc)->metrics), &library_metrics);
+                poll_planner_init(&((*plc)->poll_planner));
+
                 pdebug(DEBUG_DETAIL, "Setting connection_group_id to %d.", connection_group_id);
                 (*plc)->connection_group_id = connection_group_id;
 
@@ -532,6 +657,9 @@ int find_or_create_plc(attr attribs, modbus_plc_p *plc) {
 
                     /* set up the maximum request depth. */
                     (*plc)->max_requests_in_flight = max_requests_in_flight;
+                    (*plc)->batch_requests = (batch_requests ? 1 : 0);
+                    (*plc)->coalesce_writes = (coalesce_writes ? 1 : 0);
+                    (*plc)->fuse_read_write = (fuse_read_write ? 1 : 0);
 
                     /* link up the the PLC into the global list. */
                     (*plc)->next = plcs;
@@ -641,6 +769,9 @@ void modbus_plc_destructor(void *plc_arg) {
         plc->server = NULL;
     }
 
+    /* take this PLC's queue out of the library total. */
+    metrics_set_queue_depth(&plc->metrics, 0);
+
     /* check to make sure we have no tags left. */
     if(plc->tag_list.head) { pdebug(DEBUG_WARN, "There are tags still remaining in the tag list, memory leak possible!"); }
 
@@ -652,6 +783,7 @@ void modbus_plc_destructor(void *plc_arg) {
         err_delay = err_delay * 2;                                                         \
         if(err_delay > PLC_SOCKET_ERR_MAX_DELAY) { err_delay = PLC_SOCKET_ERR_MAX_DELAY; } \
         err_delay_until = (int64_t)random_u64((uint64_t)err_delay) + time_ms();            \
+        metrics_record_retry(&plc->metrics);                                               \
     } while(0)
 
 
@@ -662,6 +794,7 @@ THREAD_FUNC(modbus_plc_handler) {
     int64_t err_delay_until = 0;
     int sock_events = SOCK_EVENT_NONE;
     int waitable_events = SOCK_EVENT_NONE;
+    int has_connected = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -677,13 +810,6 @@ THREAD_FUNC(modbus_plc_handler) {
             /* FIXME - what should we do here? */
         }
 
-        /* if there is still a response marked ready, clean it up. */
-        if(plc->flags.response_ready) {
-            pdebug(DEBUG_DETAIL, "Orphan response found.");
-            plc->flags.response_ready = 0;
-            plc->read_data_len = 0;
-        }
-
         switch(plc->state) {
             case PLC_CONNECT_START:
                 pdebug(DEBUG_DETAIL, "in PLC_CONNECT_START state.");
@@ -699,6 +825,9 @@ THREAD_FUNC(modbus_plc_handler) {
                     /* reset err_delay */
                     err_delay = PLC_SOCKET_ERR_START_DELAY;
 
+                    if(has_connected) { metrics_record_reconnect(&plc->metrics); }
+                    has_connected = 1;
+
                     plc->state = PLC_READY;
                 } else {
                     pdebug(DEBUG_WARN, "Error %s received while starting socket connection.", plc_tag_decode_error(rc));
@@ -727,6 +856,9 @@ THREAD_FUNC(modbus_plc_handler) {
                     /* reset err_delay */
                     err_delay = PLC_SOCKET_ERR_START_DELAY;
 
+                    if(has_connected) { metrics_record_reconnect(&plc->metrics); }
+                    has_connected = 1;
+
                     plc->state = PLC_READY;
                 } else if(rc == PLCTAG_ERR_TIMEOUT) {
                     pdebug(DEBUG_DETAIL, "Still waiting for socket to connect.");
@@ -757,8 +889,15 @@ THREAD_FUNC(modbus_plc_handler) {
                 /* if there is a request queued for sending, send it. */
                 if(plc->flags.request_ready) { waitable_events |= SOCK_EVENT_CAN_WRITE; }
 
+                /* do not idle while buffered responses are waiting for their tags. */
+                if(plc->flags.response_ready && !plc->flags.request_ready) {
+                    pdebug(DEBUG_DETAIL, "Buffered response waiting, skipping socket wait.");
+                    break;
+                }
+
                 /* this will wait if nothing wakes it up or until it times out. */
-                sock_events = socket_wait_event(plc->sock, waitable_events, MODBUS_IDLE_WAIT_TIMEOUT);
+                sock_events = socket_wait_event(plc->sock, waitable_events,
+                                                (plc->flags.response_ready ? 1 : MODBUS_IDLE_WAIT_TIMEOUT));
 
                 /* check for socket errors or disconnects. */
                 if((sock_events & SOCK_EVENT_ERROR) || (sock_events & SOCK_EVENT_DISCONNECT)) {
@@ -772,6 +911,18 @@ THREAD_FUNC(modbus_plc_handler) {
 
                     socket_destroy(&(plc->sock));
 
+                    /* nothing from the old connection is any good now. */
+                    plc->flags.response_ready = 0;
+                    plc->flags.request_ready = 0;
+                    plc->read_data_len = 0;
+                    plc->response_len = 0;
+                    plc->write_data_len = 0;
+                    plc->write_data_offset = 0;
+                    plc->write_data_requests = 0;
+
+                    /* tags waiting on responses from the old connection need to restart. */
+                    atomic_set_bool(&plc->sweep_requested, true);
+
                     plc->state = PLC_CONNECT_START;
                     break;
                 }
@@ -814,6 +965,7 @@ THREAD_FUNC(modbus_plc_handler) {
                     plc->flags.request_ready = 0;
                     plc->write_data_len = 0;
                     plc->write_data_offset = 0;
+                    plc->write_data_requests = 0;
 
                     plc->state = PLC_READY;
                 } else if(rc == PLCTAG_STATUS_PENDING) {
@@ -821,14 +973,21 @@ THREAD_FUNC(modbus_plc_handler) {
                 } else {
                     pdebug(DEBUG_WARN, "Closing socket due to write error %s.", plc_tag_decode_error(rc));
 
+                    metrics_record_error(&plc->metrics);
+
                     socket_destroy(&(plc->sock));
 
                     /* set up the state. */
                     plc->flags.response_ready = 0;
                     plc->flags.request_ready = 0;
                     plc->read_data_len = 0;
+                    plc->response_len = 0;
                     plc->write_data_len = 0;
                     plc->write_data_offset = 0;
+                    plc->write_data_requests = 0;
+
+                    /* tags waiting on responses from the old connection need to restart. */
+                    atomic_set_bool(&plc->sweep_requested, true);
 
                     /* try to reconnect immediately. */
                     plc->state = PLC_CONNECT_START;
@@ -848,21 +1007,27 @@ THREAD_FUNC(modbus_plc_handler) {
                 rc = receive_response(plc);
                 if(rc == PLCTAG_STATUS_OK) {
                     pdebug(DEBUG_DETAIL, "Response ready, going back to PLC_READY state.");
-                    plc->flags.response_ready = 1;
                     plc->state = PLC_READY;
                 } else if(rc == PLCTAG_STATUS_PENDING) {
                     pdebug(DEBUG_DETAIL, "Response not complete, continue reading data.");
                 } else {
                     pdebug(DEBUG_WARN, "Closing socket due to read error %s.", plc_tag_decode_error(rc));
 
+                    metrics_record_error(&plc->metrics);
+
                     socket_destroy(&(plc->sock));
 
                     /* set up the state. */
                     plc->flags.response_ready = 0;
                     plc->flags.request_ready = 0;
                     plc->read_data_len = 0;
+                    plc->response_len = 0;
                     plc->write_data_len = 0;
                     plc->write_data_offset = 0;
+                    plc->write_data_requests = 0;
+
+                    /* tags waiting on responses from the old connection need to restart. */
+                    atomic_set_bool(&plc->sweep_requested, true);
 
                     /* try to reconnect immediately. */
                     plc->state = PLC_CONNECT_START;
@@ -890,6 +1055,7 @@ THREAD_FUNC(modbus_plc_handler) {
 
             default:
                 pdebug(DEBUG_WARN, "Unknown state %d!", plc->state);
+                atomic_set_bool(&plc->sweep_requested, true);
                 plc->state = PLC_CONNECT_START;
                 break;
         }
@@ -989,8 +1155,10 @@ int connect_plc(modbus_plc_p plc) {
     plc->flags.request_ready = 0;
     plc->flags.response_ready = 0;
     plc->read_data_len = 0;
+    plc->response_len = 0;
     plc->write_data_len = 0;
     plc->write_data_offset = 0;
+    plc->write_data_requests = 0;
 
     pdebug(DEBUG_DETAIL, "Done with status %s.", plc_tag_decode_error(rc));
 
@@ -998,11 +1166,16 @@ int connect_plc(modbus_plc_p plc) {
 }
 
 
+/*
+ * Process the tags that have work to do.
+ *
+ * Walking every tag costs O(n) and is only done when something asked for it
+ * (new tags, aborts, reconnects) or an automatic read or write is due.
+ * Otherwise only the tags owning buffered responses and the tags waiting in
+ * the ready list are touched.
+ */
 int tickle_all_tags(modbus_plc_p plc) {
     int rc = PLCTAG_STATUS_OK;
-    struct modbus_tag_list_t idle_list = {NULL, NULL};
-    struct modbus_tag_list_t active_list = {NULL, NULL};
-    modbus_tag_p tag = NULL;
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
@@ -1011,54 +1184,196 @@ int tickle_all_tags(modbus_plc_p plc) {
      * from being freed, and the tags from being freed.
      */
     critical_block(plc->mutex) {
-        while((tag = pop_tag(&(plc->tag_list)))) {
-            int tag_pushed = 0;
+        int queue_depth = 0;
 
-            debug_set_tag_id(tag->tag_id);
+        /* merged writes whose owning tag gave up its slot have to be sent again. */
+        for(int slot = 0; slot < plc->max_requests_in_flight; slot++) {
+            if(!plc->tags_with_requests[slot] && plc->coalesced_tags[slot]) { restart_coalesced_writes(plc, slot); }
+        }
 
-            /* make sure nothing else can modify the tag while we are */
-            critical_block(tag->api_mutex) {
-                // if(mutex_try_lock(tag->api_mutex) == PLCTAG_STATUS_OK) {
-                rc = tickle_tag(plc, tag);
-                if(rc == PLCTAG_STATUS_OK) {
-                    pdebug(DEBUG_SPEW, "Pushing tag onto idle list.");
-                    push_tag(&idle_list, tag);
-                    tag_pushed = 1;
-                } else if(rc == PLCTAG_STATUS_PENDING) {
-                    pdebug(DEBUG_SPEW, "Pushing tag onto active list.");
-                    push_tag(&active_list, tag);
-                    tag_pushed = 1;
-                } else {
-                    pdebug(DEBUG_WARN, "Error %s tickling tag! Pushing tag onto idle list.", plc_tag_decode_error(rc));
-                    push_tag(&idle_list, tag);
-                    tag_pushed = 1;
-                }
-            }
+        if(atomic_get_bool(&plc->sweep_requested) || plc->next_sweep_ms <= time_ms()) {
+            atomic_set_bool(&plc->sweep_requested, false);
+            rc = sweep_all_tags(plc);
+        }
+
+        dispatch_responses(plc);
+        start_ready_requests(plc);
+
+        /* requests in flight plus requests waiting for a slot. */
+        for(int slot = 0; slot < plc->max_requests_in_flight; slot++) {
+            if(plc->tags_with_requests[slot]) { queue_depth++; }
+        }
+
+        spin_block(&plc->ready_lock) { queue_depth += plc->ready_count; }
+
+        metrics_set_queue_depth(&plc->metrics, queue_depth);
+    }
+
+    pdebug(DEBUG_DETAIL, "Done: %s", plc_tag_decode_error(rc));
+
+    return rc;
+}
+
+
+/* must be called with the PLC mutex held. */
+int sweep_all_tags(modbus_plc_p plc) {
+    int rc = PLCTAG_STATUS_OK;
+    struct modbus_tag_list_t idle_list = {NULL, NULL};
+    struct modbus_tag_list_t active_list = {NULL, NULL};
+    modbus_tag_p tag = NULL;
+    int64_t now = time_ms();
+    int64_t next_sweep_ms = now + MODBUS_IDLE_WAIT_TIMEOUT;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
 
-            if(tag_pushed) {
-                /* call the callbacks outside the API mutex. */
-                plc_tag_generic_handle_event_callbacks((plc_tag_p)tag);
+    while((tag = pop_tag(&(plc->tag_list)))) {
+        int tag_pushed = 0;
+
+        debug_set_tag_id(tag->tag_id);
+
+        /* make sure nothing else can modify the tag while we are */
+        critical_block(tag->api_mutex) {
+            rc = tickle_tag(plc, tag);
+            if(rc == PLCTAG_STATUS_OK) {
+                pdebug(DEBUG_SPEW, "Pushing tag onto idle list.");
+                push_tag(&idle_list, tag);
+                tag_pushed = 1;
+            } else if(rc == PLCTAG_STATUS_PENDING) {
+                pdebug(DEBUG_SPEW, "Pushing tag onto active list.");
+                push_tag(&active_list, tag);
+                tag_pushed = 1;
             } else {
-                pdebug(DEBUG_WARN, "Tag mutex not taken!  Doing emergency push of tag onto idle list.");
+                pdebug(DEBUG_WARN, "Error %s tickling tag! Pushing tag onto idle list.", plc_tag_decode_error(rc));
                 push_tag(&idle_list, tag);
+                tag_pushed = 1;
             }
 
-            rc = PLCTAG_STATUS_OK;
+            /*
+             * Come back when the next automatic operation is due.  Deadlines
+             * already passed are blocked by an operation in flight and are
+             * picked up when that operation completes.
+             */
+            if(tag->auto_sync_read_ms > 0 && tag->auto_sync_next_read > now && tag->auto_sync_next_read < next_sweep_ms) {
+                next_sweep_ms = tag->auto_sync_next_read;
+            }
+
+            if(tag->auto_sync_write_ms > 0) {
+                int64_t write_check_ms = (tag->auto_sync_next_write ? tag->auto_sync_next_write : now + tag->auto_sync_write_ms);
 
-            debug_set_tag_id(0);
+                if(write_check_ms > now && write_check_ms < next_sweep_ms) { next_sweep_ms = write_check_ms; }
+            }
+        }
+
+        finish_coalesced_writes(plc);
+
+        if(tag_pushed) {
+            /* call the callbacks outside the API mutex. */
+            plc_tag_generic_handle_event_callbacks((plc_tag_p)tag);
+        } else {
+            pdebug(DEBUG_WARN, "Tag mutex not taken!  Doing emergency push of tag onto idle list.");
+            push_tag(&idle_list, tag);
         }
 
-        /* merge the lists and replace the old list. */
-        pdebug(DEBUG_SPEW, "Merging active and idle lists.");
-        plc->tag_list = merge_lists(&active_list, &idle_list);
+        rc = PLCTAG_STATUS_OK;
+
+        debug_set_tag_id(0);
     }
 
+    /* merge the lists and replace the old list. */
+    pdebug(DEBUG_SPEW, "Merging active and idle lists.");
+    plc->tag_list = merge_lists(&active_list, &idle_list);
+
+    plc->next_sweep_ms = next_sweep_ms;
+
     pdebug(DEBUG_DETAIL, "Done: %s", plc_tag_decode_error(rc));
 
     return rc;
 }
 
 
+/*
+ * Hand each buffered response to the tag that owns its sequence ID.  There
+ * are at most max_requests_in_flight candidates, so this does not depend on
+ * the number of tags.  Must be called with the PLC mutex held.
+ */
+void dispatch_responses(modbus_plc_p plc) {
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    while(plc->flags.response_ready) {
+        uint16_t seq_id = (uint16_t)((uint16_t)plc->read_data[1] + (uint16_t)(plc->read_data[0] << 8));
+        uint32_t responses_consumed = plc->responses_consumed;
+        modbus_tag_p tag = NULL;
+
+        for(int slot = 0; slot < plc->max_requests_in_flight; slot++) {
+            modbus_tag_p slot_tag = plc->tags_with_requests[slot];
+
+            if(slot_tag && slot_tag->seq_id == seq_id
+               && (slot_tag->op == TAG_OP_READ_RESPONSE || slot_tag->op == TAG_OP_WRITE_RESPONSE)) {
+                tag = slot_tag;
+                break;
+            }
+        }
+
+        if(tag) {
+            pdebug(DEBUG_DETAIL, "Dispatching response %u to tag %" PRId32 ".", (unsigned int)seq_id, tag->tag_id);
+            tickle_one_tag(plc, tag);
+        }
+
+        /* nobody took it, so nobody wants it. */
+        if(plc->flags.response_ready && plc->responses_consumed == responses_consumed) {
+            pdebug(DEBUG_DETAIL, "Orphan response %u found.", (unsigned int)seq_id);
+            consume_response(plc);
+        }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+}
+
+
+/* give free request slots to waiting tags in order.  Must be called with the PLC mutex held. */
+void start_ready_requests(modbus_plc_p plc) {
+    modbus_tag_p tag = NULL;
+    int tags_left = 0;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    /* only look at each waiting tag once, tags that cannot start go to the back. */
+    spin_block(&plc->ready_lock) { tags_left = plc->ready_count; }
+
+    while(tags_left > 0 && request_slot_available(plc) && (tag = pop_ready_tag(plc))) {
+        tags_left--;
+
+        /* lazily drop tags whose operation was aborted or restarted elsewhere. */
+        if(tag->op != TAG_OP_READ_REQUEST && tag->op != TAG_OP_WRITE_REQUEST) { continue; }
+
+        tickle_one_tag(plc, tag);
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+}
+
+
+/* tickle a single tag outside of a sweep.  Must be called with the PLC mutex held. */
+void tickle_one_tag(modbus_plc_p plc, modbus_tag_p tag) {
+    debug_set_tag_id(tag->tag_id);
+
+    critical_block(tag->api_mutex) {
+        int rc = tickle_tag(plc, tag);
+
+        if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_STATUS_PENDING) {
+            pdebug(DEBUG_WARN, "Error %s tickling tag!", plc_tag_decode_error(rc));
+        }
+    }
+
+    finish_coalesced_writes(plc);
+
+    /* call the callbacks outside the API mutex. */
+    plc_tag_generic_handle_event_callbacks((plc_tag_p)tag);
+
+    debug_set_tag_id(0);
+}
+
+
 static int tag_op_read_request(modbus_plc_p plc, modbus_tag_p tag) {
     int rc = PLCTAG_STATUS_OK;
     bool event_raised = false;
@@ -1083,6 +1398,7 @@ static int tag_op_read_request(modbus_plc_p plc, modbus_tag_p tag) {
             tag->read_in_flight = 0;
             tag->status = (int8_t)rc;
 
+            plc_tag_generic_op_completed((plc_tag_p)tag, 0, rc);
             tag_raise_event((plc_tag_p)tag, PLCTAG_EVENT_READ_COMPLETED, (int8_t)rc);
             event_raised = true;
 
@@ -1109,12 +1425,14 @@ static int tag_op_read_response(modbus_plc_p plc, modbus_tag_p tag) {
     /* cross check the state. */
     if(plc->state == PLC_CONNECT_START || plc->state == PLC_CONNECT_WAIT || plc->state == PLC_ERR_WAIT) {
         pdebug(DEBUG_WARN, "PLC changed state, restarting request.");
+        clear_request_slot(plc, tag);
         tag->op = TAG_OP_READ_REQUEST;
         return PLCTAG_STATUS_OK;
     }
 
     if(plc->flags.response_ready) {
         rc = check_read_response(plc, tag);
+
         switch(rc) {
             case PLCTAG_ERR_PARTIAL:
                 /* partial response, keep going */
@@ -1123,10 +1441,9 @@ static int tag_op_read_response(modbus_plc_p plc, modbus_tag_p tag) {
                 /* remove the tag from the request slot. */
                 clear_request_slot(plc, tag);
 
-                plc->flags.response_ready = 0;
+                /* queue the next request now rather than waiting for the next pass. */
                 tag->op = TAG_OP_READ_REQUEST;
-
-                rc = PLCTAG_STATUS_OK;
+                rc = tag_op_read_request(plc, tag);
                 break;
 
             case PLCTAG_ERR_NO_MATCH:
@@ -1137,29 +1454,27 @@ static int tag_op_read_response(modbus_plc_p plc, modbus_tag_p tag) {
             case PLCTAG_STATUS_OK:
                 /* fall through */
             default:
-                /* set the status before we might change it. */
-                tag->status = (int8_t)rc;
-
                 if(rc == PLCTAG_STATUS_OK) {
                     pdebug(DEBUG_DETAIL, "Found our response.");
-                    plc->flags.response_ready = 0;
                 } else {
                     pdebug(DEBUG_WARN, "Error %s checking read response!", plc_tag_decode_error(rc));
-                    rc = PLCTAG_STATUS_OK;
                 }
 
                 /* remove the tag from the request slot. */
                 clear_request_slot(plc, tag);
 
-                plc->flags.response_ready = 0;
                 tag->op = TAG_OP_IDLE;
                 tag->read_in_flight = 0;
                 tag->read_complete = 1;
                 tag->status = (int8_t)rc;
 
+                plc_tag_generic_op_completed((plc_tag_p)tag, 0, rc);
                 tag_raise_event((plc_tag_p)tag, PLCTAG_EVENT_READ_COMPLETED, (int8_t)rc);
                 event_raised = true;
 
+                /* the error belongs to the tag, not to the handler. */
+                rc = PLCTAG_STATUS_OK;
+
                 break;
         }
     } else {
@@ -1200,6 +1515,7 @@ static int tag_op_write_request(modbus_plc_p plc, modbus_tag_p tag) {
             tag->write_in_flight = 0;
             tag->status = (int8_t)rc;
 
+            plc_tag_generic_op_completed((plc_tag_p)tag, 1, rc);
             tag_raise_event((plc_tag_p)tag, PLCTAG_EVENT_WRITE_COMPLETED, (int8_t)rc);
             event_raised = true;
 
@@ -1226,24 +1542,27 @@ static int tag_op_write_response(modbus_plc_p plc, modbus_tag_p tag) {
 
     if(plc->state == PLC_CONNECT_START || plc->state == PLC_CONNECT_WAIT || plc->state == PLC_ERR_WAIT) {
         pdebug(DEBUG_WARN, "PLC changed state, restarting request.");
+        clear_request_slot(plc, tag);
         tag->op = TAG_OP_WRITE_REQUEST;
         return PLCTAG_STATUS_OK;
     }
 
-    if(plc->flags.response_ready) {
+    /* tags merged into another tag's request have no slot and wait for that tag. */
+    if(plc->flags.response_ready && tag->request_slot >= 0) {
         rc = check_write_response(plc, tag);
+
         if(rc == PLCTAG_STATUS_OK) {
             pdebug(DEBUG_DETAIL, "Found our response.");
 
             /* remove the tag from the request slot. */
             clear_request_slot(plc, tag);
 
-            plc->flags.response_ready = 0;
             tag->op = TAG_OP_IDLE;
             tag->write_complete = 1;
             tag->write_in_flight = 0;
             tag->status = (int8_t)rc;
 
+            plc_tag_generic_op_completed((plc_tag_p)tag, 1, rc);
             tag_raise_event((plc_tag_p)tag, PLCTAG_EVENT_WRITE_COMPLETED, (int8_t)rc);
             event_raised = true;
 
@@ -1251,10 +1570,12 @@ static int tag_op_write_response(modbus_plc_p plc, modbus_tag_p tag) {
         } else if(rc == PLCTAG_ERR_PARTIAL) {
             pdebug(DEBUG_DETAIL, "Found our response, but we are not done.");
 
-            plc->flags.response_ready = 0;
-            tag->op = TAG_OP_WRITE_REQUEST;
+            /* remove the tag from the request slot. */
+            clear_request_slot(plc, tag);
 
-            rc = PLCTAG_STATUS_OK;
+            /* queue the next request now rather than waiting for the next pass. */
+            tag->op = TAG_OP_WRITE_REQUEST;
+            rc = tag_op_write_request(plc, tag);
         } else if(rc == PLCTAG_ERR_NO_MATCH) {
             pdebug(DEBUG_SPEW, "Not our response.");
             rc = PLCTAG_STATUS_PENDING;
@@ -1264,12 +1585,12 @@ static int tag_op_write_response(modbus_plc_p plc, modbus_tag_p tag) {
             /* remove the tag from the request slot. */
             clear_request_slot(plc, tag);
 
-            plc->flags.response_ready = 0;
             tag->op = TAG_OP_IDLE;
             tag->write_complete = 1;
             tag->write_in_flight = 0;
             tag->status = (int8_t)rc;
 
+            plc_tag_generic_op_completed((plc_tag_p)tag, 1, rc);
             tag_raise_event((plc_tag_p)tag, PLCTAG_EVENT_WRITE_COMPLETED, (int8_t)rc);
             event_raised = true;
 
@@ -1295,6 +1616,12 @@ int tickle_tag(modbus_plc_p plc, modbus_tag_p tag) {
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    /* an abort from another thread left the slot for us to release. */
+    if(atomic_get_bool(&tag->release_slot)) {
+        atomic_set_bool(&tag->release_slot, false);
+        clear_request_slot(plc, tag);
+    }
+
     /* until we refactor the other protocols, deal with this here. */
     if(atomic_get_bool(&tag->abort_requested)) {
         atomic_set_bool(&tag->abort_requested, false);
@@ -1335,16 +1662,39 @@ int tickle_tag(modbus_plc_p plc, modbus_tag_p tag) {
      */
     plc_tag_generic_tickler((plc_tag_p)tag);
 
+    /* tags still waiting for a request slot go back in line. */
+    if(tag->op == TAG_OP_READ_REQUEST || tag->op == TAG_OP_WRITE_REQUEST) { push_ready_tag(plc, tag); }
+
     pdebug(DEBUG_SPEW, "Done.");
 
     return rc;
 }
 
 
+/* check whether a new request could be queued right now. */
+int request_slot_available(modbus_plc_p plc) {
+    if(plc->state != PLC_READY) { return 0; }
+
+    /* when batching, requests are added to the write buffer until it is sent. */
+    if(plc->flags.request_ready
+       && (!plc->batch_requests || (plc->write_data_len + MODBUS_MAX_ADU_SIZE) > PLC_WRITE_DATA_LEN)) {
+        return 0;
+    }
+
+    for(int slot = 0; slot < plc->max_requests_in_flight; slot++) {
+        if(!plc->tags_with_requests[slot] && !plc->coalesced_tags[slot]) { return 1; }
+    }
+
+    return 0;
+}
+
+
 int find_request_slot(modbus_plc_p plc, modbus_tag_p tag) {
     pdebug(DEBUG_SPEW, "Starting.");
 
-    if(plc->flags.request_ready) {
+    /* when batching, requests are added to the write buffer until it is sent. */
+    if(plc->flags.request_ready
+       && (!plc->batch_requests || (plc->write_data_len + MODBUS_MAX_ADU_SIZE) > PLC_WRITE_DATA_LEN)) {
         pdebug(DEBUG_DETAIL, "There is a request already queued for sending.");
         return PLCTAG_ERR_BUSY;
     }
@@ -1361,9 +1711,9 @@ int find_request_slot(modbus_plc_p plc, modbus_tag_p tag) {
 
     /* search for a slot. */
     for(int slot = 0; slot < plc->max_requests_in_flight; slot++) {
-        if(plc->tags_with_requests[slot] == 0) {
+        if(!plc->tags_with_requests[slot] && !plc->coalesced_tags[slot]) {
             pdebug(DEBUG_DETAIL, "Found request slot %d for tag %" PRId32 ".", slot, tag->tag_id);
-            plc->tags_with_requests[slot] = tag->tag_id;
+            plc->tags_with_requests[slot] = tag;
             tag->request_slot = slot;
             return PLCTAG_STATUS_OK;
         }
@@ -1390,12 +1740,12 @@ void clear_request_slot(modbus_plc_p plc, modbus_tag_p tag) {
 
     /* find the tag in the slots. */
     for(int slot = 0; slot < plc->max_requests_in_flight; slot++) {
-        if(plc->tags_with_requests[slot] == tag->tag_id) {
+        if(plc->tags_with_requests[slot] == tag) {
             pdebug(DEBUG_DETAIL, "Found tag %" PRId32 " in slot %d.", tag->tag_id, slot);
 
             if(slot != tag->request_slot) { pdebug(DEBUG_DETAIL, "Tag was not in expected slot %d!", tag->request_slot); }
 
-            plc->tags_with_requests[slot] = 0;
+            plc->tags_with_requests[slot] = NULL;
             tag->request_slot = -1;
         }
     }
@@ -1406,7 +1756,7 @@ void clear_request_slot(modbus_plc_p plc, modbus_tag_p tag) {
 
 int receive_response(modbus_plc_p plc) {
     int rc = 0;
-    int data_needed = 0;
+    int space_left = 0;
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
@@ -1416,73 +1766,103 @@ int receive_response(modbus_plc_p plc) {
         return PLCTAG_STATUS_OK;
     }
 
-    do {
-        /* how much data do we need? */
-        if(plc->read_data_len >= MODBUS_MBAP_SIZE) {
-            int packet_size = plc->read_data[5] + (plc->read_data[4] << 8);
-            data_needed = (MODBUS_MBAP_SIZE + packet_size) - plc->read_data_len;
+    /* there may already be a complete response in the buffer. */
+    rc = find_complete_response(plc);
+    if(rc != PLCTAG_STATUS_PENDING) {
+        pdebug(DEBUG_DETAIL, "Done with buffered data, status %s.", plc_tag_decode_error(rc));
+        return rc;
+    }
 
-            pdebug(DEBUG_DETAIL, "Packet header read, data_needed=%d, packet_size=%d, read_data_len=%d", data_needed, packet_size,
-                   plc->read_data_len);
+    /* read as much as fits.  The PLC may have sent several responses. */
+    space_left = PLC_READ_DATA_LEN - plc->read_data_len;
 
-            if(data_needed > PLC_READ_DATA_LEN) {
-                pdebug(DEBUG_WARN, "Error, packet size, %d, greater than buffer size, %d!", data_needed, PLC_READ_DATA_LEN);
-                return PLCTAG_ERR_TOO_LARGE;
-            } else if(data_needed < 0) {
-                pdebug(DEBUG_WARN, "Read more than a packet!  Expected %d bytes, but got %d bytes!",
-                       (MODBUS_MBAP_SIZE + packet_size), plc->read_data_len);
-                return PLCTAG_ERR_TOO_LARGE;
-            }
-        } else {
-            data_needed = MODBUS_MBAP_SIZE - plc->read_data_len;
-            pdebug(DEBUG_DETAIL, "Still reading packet header, data_needed=%d, read_data_len=%d", data_needed,
-                   plc->read_data_len);
-        }
+    rc = socket_read(plc->sock, plc->read_data + plc->read_data_len, space_left, SOCKET_READ_TIMEOUT);
+    if(rc >= 0) {
+        /* got data! Or got nothing, but no error. */
+        plc->read_data_len += rc;
 
-        if(data_needed == 0) {
-            pdebug(DEBUG_DETAIL, "Got all data needed.");
-            break;
-        }
+        pdebug(DEBUG_DETAIL, "Read %d bytes, %d bytes buffered.", rc, plc->read_data_len);
+        pdebug_dump_bytes(DEBUG_SPEW, plc->read_data, plc->read_data_len);
+    } else if(rc == PLCTAG_ERR_TIMEOUT) {
+        pdebug(DEBUG_DETAIL, "Done. Socket read timed out.");
+        return PLCTAG_STATUS_PENDING;
+    } else {
+        pdebug(DEBUG_WARN, "Error, %s, reading socket!", plc_tag_decode_error(rc));
+        return rc;
+    }
 
-        /* read the socket. */
-        rc = socket_read(plc->sock, plc->read_data + plc->read_data_len, data_needed, SOCKET_READ_TIMEOUT);
-        if(rc >= 0) {
-            /* got data! Or got nothing, but no error. */
-            plc->read_data_len += rc;
+    /* if we have some data in the buffer, keep the connection open. */
+    if(plc->read_data_len > 0) { plc->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms(); }
 
-            pdebug_dump_bytes(DEBUG_SPEW, plc->read_data, plc->read_data_len);
-        } else if(rc == PLCTAG_ERR_TIMEOUT) {
-            pdebug(DEBUG_DETAIL, "Done. Socket read timed out.");
-            return PLCTAG_STATUS_PENDING;
-        } else {
-            pdebug(DEBUG_WARN, "Error, %s, reading socket!", plc_tag_decode_error(rc));
-            return rc;
-        }
+    rc = find_complete_response(plc);
 
-        pdebug(DEBUG_DETAIL, "After reading the socket, total read=%d and data needed=%d.", plc->read_data_len, data_needed);
-    } while(rc > 0);
+    pdebug(DEBUG_DETAIL, "Done.");
+
+    return rc;
+}
 
 
-    if(data_needed == 0) {
-        /* we got our packet. */
-        pdebug(DEBUG_DETAIL, "Received full packet.");
-        pdebug_dump_bytes(DEBUG_DETAIL, plc->read_data, plc->read_data_len);
+/*
+ * Check whether there is a complete response at the front of the read
+ * buffer.  Returns PLCTAG_STATUS_OK and sets response_ready if there is,
+ * PLCTAG_STATUS_PENDING if more data is needed.
+ */
+int find_complete_response(modbus_plc_p plc) {
+    int packet_size = 0;
+
+    /* already found? */
+    if(plc->response_len > 0) {
         plc->flags.response_ready = 1;
+        return PLCTAG_STATUS_OK;
+    }
 
-        rc = PLCTAG_STATUS_OK;
-    } else {
-        /* data_needed is greater than zero. */
-        pdebug(DEBUG_DETAIL, "Received partial packet of %d bytes of %d.", plc->read_data_len,
-               (data_needed + plc->read_data_len));
-        rc = PLCTAG_STATUS_PENDING;
+    if(plc->read_data_len < MODBUS_MBAP_SIZE) {
+        pdebug(DEBUG_DETAIL, "Still reading packet header, read_data_len=%d", plc->read_data_len);
+        return PLCTAG_STATUS_PENDING;
     }
 
-    /* if we have some data in the buffer, keep the connection open. */
-    if(plc->read_data_len > 0) { plc->inactivity_timeout_ms = MODBUS_INACTIVITY_TIMEOUT + time_ms(); }
+    packet_size = plc->read_data[5] + (plc->read_data[4] << 8);
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    if(packet_size < 2 || (MODBUS_MBAP_SIZE + packet_size) > MODBUS_MAX_ADU_SIZE) {
+        pdebug(DEBUG_WARN, "Error, packet size, %d, is not valid!", packet_size);
+        return PLCTAG_ERR_TOO_LARGE;
+    }
 
-    return rc;
+    if(plc->read_data_len < (MODBUS_MBAP_SIZE + packet_size)) {
+        pdebug(DEBUG_DETAIL, "Received partial packet of %d bytes of %d.", plc->read_data_len, MODBUS_MBAP_SIZE + packet_size);
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    /* we got our packet. */
+    plc->response_len = MODBUS_MBAP_SIZE + packet_size;
+    plc->flags.response_ready = 1;
+
+    pdebug(DEBUG_DETAIL, "Received full packet.");
+    pdebug_dump_bytes(DEBUG_DETAIL, plc->read_data, plc->response_len);
+
+    metrics_record_packet_received(&plc->metrics, plc->response_len);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/* drop the response at the front of the read buffer and look for the next one. */
+void consume_response(modbus_plc_p plc) {
+    int remaining = plc->read_data_len - plc->response_len;
+
+    if(remaining > 0 && plc->response_len > 0) {
+        mem_move(plc->read_data, plc->read_data + plc->response_len, remaining);
+        plc->read_data_len = remaining;
+    } else {
+        plc->read_data_len = 0;
+    }
+
+    plc->response_len = 0;
+    plc->flags.response_ready = 0;
+    plc->responses_consumed++;
+
+    /* errors in the next response are picked up when we next receive. */
+    find_complete_response(plc);
 }
 
 
@@ -1524,9 +1904,15 @@ int send_request(modbus_plc_p plc) {
         pdebug(DEBUG_DETAIL, "Full packet written.");
         pdebug_dump_bytes(DEBUG_DETAIL, plc->write_data, plc->write_data_len);
 
+        metrics_record_packet_sent(&plc->metrics, plc->write_data_len);
+        metrics_record_requests_packed(&plc->metrics, plc->write_data_requests);
+
+        pdebug(DEBUG_DETAIL, "Sent %d requests in %d bytes.", plc->write_data_requests, plc->write_data_len);
+
         // plc->flags.request_ready = 0;
         plc->write_data_len = 0;
         plc->write_data_offset = 0;
+        plc->write_data_requests = 0;
         plc->response_tag_id = plc->request_tag_id;
         plc->request_tag_id = 0;
 
@@ -1548,6 +1934,10 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag) {
     int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
     int base_register = tag->reg_base + (tag->request_num * registers_per_request);
     int register_count = tag->elem_count - (tag->request_num * registers_per_request);
+    int adu_start = 0;
+    modbus_tag_p write_tag = NULL;
+    int write_count = 0;
+    uint8_t write_data[MAX_MODBUS_FUSED_WRITE_PAYLOAD];
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
@@ -1562,6 +1952,13 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag) {
     pdebug(DEBUG_INFO, "preparing read request for %d registers (of %d total) from base register %d.", register_count,
            tag->elem_count, base_register);
 
+    /* a register read that fits in one request can carry a queued register write. */
+    if(plc->fuse_read_write && tag->reg_type == MB_REG_HOLDING_REGISTER && tag->request_num == 0
+       && tag->elem_count <= registers_per_request && tag->request_slot >= 0) {
+        write_tag = fuse_write(plc, tag, seq_id, base_register, register_count, write_data);
+        if(write_tag) { write_count = write_tag->elem_count; }
+    }
+
     /* build the read request.
      *    Byte  Meaning
      *      0    High byte of request sequence ID.
@@ -1578,7 +1975,13 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag) {
      *     11    Low byte of the register count.
      */
 
-    plc->write_data_len = 0;
+    /* start a new buffer unless we are adding to a batch. */
+    if(!plc->flags.request_ready) {
+        plc->write_data_len = 0;
+        plc->write_data_requests = 0;
+    }
+
+    adu_start = plc->write_data_len;
 
     /* build the request sequence ID */
     plc->write_data[plc->write_data_len] = (uint8_t)((seq_id >> 8) & 0xFF);
@@ -1595,32 +1998,80 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag) {
     /* request packet length */
     plc->write_data[plc->write_data_len] = 0;
     plc->write_data_len++;
-    plc->write_data[plc->write_data_len] = 6;
+    plc->write_data[plc->write_data_len] = (uint8_t)(write_tag ? 11 + (write_count * 2) : 6);
     plc->write_data_len++;
 
     /* device address */
     plc->write_data[plc->write_data_len] = plc->server_id;
     plc->write_data_len++;
 
+    /*
+     * Read/write multiple registers.  The read part has the same layout as
+     * function 0x03, followed by the write base, count, byte count and data.
+     * The device writes before it reads.
+     */
+    if(write_tag) {
+        plc->write_data[plc->write_data_len] = MB_CMD_READ_WRITE_HOLDING_REGISTER_MULTI;
+        plc->write_data_len++;
+
+        plc->write_data[plc->write_data_len] = (uint8_t)((base_register >> 8) & 0xFF);
+        plc->write_data_len++;
+        plc->write_data[plc->write_data_len] = (uint8_t)((base_register >> 0) & 0xFF);
+        plc->write_data_len++;
+
+        plc->write_data[plc->write_data_len] = (uint8_t)((register_count >> 8) & 0xFF);
+        plc->write_data_len++;
+        plc->write_data[plc->write_data_len] = (uint8_t)((register_count >> 0) & 0xFF);
+        plc->write_data_len++;
+
+        plc->write_data[plc->write_data_len] = (uint8_t)((write_tag->reg_base >> 8) & 0xFF);
+        plc->write_data_len++;
+        plc->write_data[plc->write_data_len] = (uint8_t)((write_tag->reg_base >> 0) & 0xFF);
+        plc->write_data_len++;
+
+        plc->write_data[plc->write_data_len] = (uint8_t)((write_count >> 8) & 0xFF);
+        plc->write_data_len++;
+        plc->write_data[plc->write_data_len] = (uint8_t)((write_count >> 0) & 0xFF);
+        plc->write_data_len++;
+
+        plc->write_data[plc->write_data_len] = (uint8_t)(unsigned int)(write_count * 2);
+        plc->write_data_len++;
+
+        mem_copy(&plc->write_data[plc->write_data_len], write_data, write_count * 2);
+        plc->write_data_len += write_count * 2;
+
+        tag->seq_id = seq_id;
+        plc->flags.request_ready = 1;
+        plc->request_tag_id = tag->tag_id;
+        plc->write_data_requests++;
+
+        pdebug(DEBUG_DETAIL, "Created read/write request:");
+        pdebug_dump_bytes(DEBUG_DETAIL, plc->write_data + adu_start, plc->write_data_len - adu_start);
+
+        pdebug(DEBUG_DETAIL, "Done.");
+
+        return rc;
+    }
+
     /* function code depends on the register type. */
     switch(tag->reg_type) {
         case MB_REG_COIL:
-            plc->write_data[7] = MB_CMD_READ_COIL_MULTI;
+            plc->write_data[plc->write_data_len] = MB_CMD_READ_COIL_MULTI;
             plc->write_data_len++;
             break;
 
         case MB_REG_DISCRETE_INPUT:
-            plc->write_data[7] = MB_CMD_READ_DISCRETE_INPUT_MULTI;
+            plc->write_data[plc->write_data_len] = MB_CMD_READ_DISCRETE_INPUT_MULTI;
             plc->write_data_len++;
             break;
 
         case MB_REG_HOLDING_REGISTER:
-            plc->write_data[7] = MB_CMD_READ_HOLDING_REGISTER_MULTI;
+            plc->write_data[plc->write_data_len] = MB_CMD_READ_HOLDING_REGISTER_MULTI;
             plc->write_data_len++;
             break;
 
         case MB_REG_INPUT_REGISTER:
-            plc->write_data[7] = MB_CMD_READ_INPUT_REGISTER_MULTI;
+            plc->write_data[plc->write_data_len] = MB_CMD_READ_INPUT_REGISTER_MULTI;
             plc->write_data_len++;
             break;
 
@@ -1645,9 +2096,10 @@ int create_read_request(modbus_plc_p plc, modbus_tag_p tag) {
     tag->seq_id = seq_id;
     plc->flags.request_ready = 1;
     plc->request_tag_id = tag->tag_id;
+    plc->write_data_requests++;
 
     pdebug(DEBUG_DETAIL, "Created read request:");
-    pdebug_dump_bytes(DEBUG_DETAIL, plc->write_data, plc->write_data_len);
+    pdebug_dump_bytes(DEBUG_DETAIL, plc->write_data + adu_start, plc->write_data_len - adu_start);
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -1687,7 +2139,7 @@ int check_read_response(modbus_plc_p plc, modbus_tag_p tag) {
             rc = translate_modbus_error(plc->read_data[8]);
 
             pdebug(DEBUG_WARN, "Got read response %ud, with error %s, of length %d.", (int)(unsigned int)seq_id,
-                   plc_tag_decode_error(rc), plc->read_data_len);
+                   plc_tag_decode_error(rc), plc->response_len);
         } else {
             int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
             int register_offset = (tag->request_num * registers_per_request);
@@ -1697,7 +2149,7 @@ int check_read_response(modbus_plc_p plc, modbus_tag_p tag) {
 
             /* no error. So copy the data. */
             pdebug(DEBUG_DETAIL, "Got read response %u of length %d with payload of size %d.", (int)(unsigned int)seq_id,
-                   plc->read_data_len, payload_size);
+                   plc->response_len, payload_size);
             pdebug(DEBUG_DETAIL, "registers_per_request = %d", registers_per_request);
             pdebug(DEBUG_DETAIL, "register_offset = %d", register_offset);
             pdebug(DEBUG_DETAIL, "byte_offset = %d", byte_offset);
@@ -1719,9 +2171,16 @@ int check_read_response(modbus_plc_p plc, modbus_tag_p tag) {
             rc = PLCTAG_STATUS_OK;
         }
 
-        /* either way, clean up the PLC buffer. */
-        plc->read_data_len = 0;
-        plc->flags.response_ready = 0;
+        /* a write sent along with this read gets the same result. */
+        if(tag->request_slot >= 0 && plc->coalesced_tags[tag->request_slot]) {
+            plc->finished_writes = plc->coalesced_tags[tag->request_slot];
+            plc->finished_write_seq_id = seq_id;
+            plc->finished_write_status = rc;
+            plc->coalesced_tags[tag->request_slot] = NULL;
+        }
+
+        /* either way, we are done with this response. */
+        consume_response(plc);
 
         /* clean up tag*/
         if(!partial_read) {
@@ -1776,6 +2235,10 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag) {
     int register_offset = (tag->request_num * registers_per_request);
     int byte_offset = (register_offset * tag->elem_size) / 8;
     int request_payload_size = 0;
+    int adu_start = 0;
+    uint8_t staging[2 * MAX_MODBUS_REQUEST_PAYLOAD];
+    int staging_base = base_register - registers_per_request;
+    int num_coalesced = 0;
 
     pdebug(DEBUG_DETAIL, "Starting.");
 
@@ -1789,6 +2252,13 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag) {
     /* clamp the number of registers we ask for to what will fit. */
     if(register_count > registers_per_request) { register_count = registers_per_request; }
 
+    /* a write that fits in one request can pick up queued writes next to it. */
+    if(plc->coalesce_writes && tag->request_num == 0 && tag->elem_count <= registers_per_request && tag->request_slot >= 0
+       && (tag->reg_type == MB_REG_HOLDING_REGISTER || tag->reg_type == MB_REG_COIL)) {
+        mem_set(staging, 0, (int)sizeof(staging));
+        num_coalesced = coalesce_writes(plc, tag, seq_id, &base_register, &register_count, staging, staging_base);
+    }
+
     /* how many bytes, rounded up to the nearest byte. */
     request_payload_size = ((register_count * tag->elem_size) + 7) / 8;
 
@@ -1796,8 +2266,13 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag) {
            "preparing write request for %d registers (of %d total) from base register %d of payload size %d in bytes.",
            register_count, tag->elem_count, base_register, request_payload_size);
 
-    /* FIXME - remove this when we figure out how to push multiple requests. */
-    plc->write_data_len = 0;
+    /* start a new buffer unless we are adding to a batch. */
+    if(!plc->flags.request_ready) {
+        plc->write_data_len = 0;
+        plc->write_data_requests = 0;
+    }
+
+    adu_start = plc->write_data_len;
 
     /* build the request sequence ID */
     plc->write_data[plc->write_data_len] = (uint8_t)((seq_id >> 8) & 0xFF);
@@ -1824,7 +2299,7 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag) {
     /* function code depends on the register type. */
     switch(tag->reg_type) {
         case MB_REG_COIL:
-            plc->write_data[7] = MB_CMD_WRITE_COIL_MULTI;
+            plc->write_data[plc->write_data_len] = MB_CMD_WRITE_COIL_MULTI;
             plc->write_data_len++;
             break;
 
@@ -1834,7 +2309,7 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag) {
             break;
 
         case MB_REG_HOLDING_REGISTER:
-            plc->write_data[7] = MB_CMD_WRITE_HOLDING_REGISTER_MULTI;
+            plc->write_data[plc->write_data_len] = MB_CMD_WRITE_HOLDING_REGISTER_MULTI;
             plc->write_data_len++;
             break;
 
@@ -1865,16 +2340,32 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag) {
     plc->write_data[plc->write_data_len] = (uint8_t)(unsigned int)(request_payload_size);
     plc->write_data_len++;
 
-    /* copy the tag data. */
-    mem_copy(&plc->write_data[plc->write_data_len], &tag->data[byte_offset], request_payload_size);
+    /* copy the tag data, merged writes were copied when they were picked up. */
+    if(num_coalesced > 0) {
+        uint8_t *payload = &plc->write_data[plc->write_data_len];
+        int offset = base_register - staging_base;
+
+        copy_coalesced_data(staging, staging_base, tag);
+
+        if(tag->reg_type == MB_REG_COIL) {
+            mem_set(payload, 0, request_payload_size);
+            mb_copy_bits(payload, 0, staging, offset, register_count);
+        } else {
+            mem_copy(payload, staging + (offset * 2), request_payload_size);
+        }
+    } else {
+        mem_copy(&plc->write_data[plc->write_data_len], &tag->data[byte_offset], request_payload_size);
+    }
+
     plc->write_data_len += request_payload_size;
 
     tag->seq_id = (uint16_t)(unsigned int)seq_id;
     plc->flags.request_ready = 1;
     plc->request_tag_id = tag->tag_id;
+    plc->write_data_requests++;
 
     pdebug(DEBUG_DETAIL, "Created write request:");
-    pdebug_dump_bytes(DEBUG_DETAIL, plc->write_data, plc->write_data_len);
+    pdebug_dump_bytes(DEBUG_DETAIL, plc->write_data + adu_start, plc->write_data_len - adu_start);
 
     pdebug(DEBUG_DETAIL, "Done.");
 
@@ -1882,6 +2373,264 @@ int create_write_request(modbus_plc_p plc, modbus_tag_p tag) {
 }
 
 
+/*
+ * Pull queued writes to the registers or coils right next to this tag's
+ * range into the same request, up to the request size limit.  The choice is
+ * made by mb_merge_writes().  The merged tags are chained off the request
+ * slot and complete when the response to this tag's request arrives.
+ *
+ * The data of each merged tag is copied into staging while we hold its API
+ * mutex, register staging_base at the start.  Staging must hold twice the
+ * request size.  Returns the number of writes merged.
+ *
+ * Must be called with the PLC mutex and the tag's API mutex held.
+ */
+int coalesce_writes(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id, int *base_register, int *register_count,
+                    uint8_t *staging, int staging_base) {
+    struct mb_merge_candidate_t candidates[MAX_COALESCE_CANDIDATES];
+    struct coalesce_state_t state;
+    int num_candidates = 0;
+    int num_merged = 0;
+    int max_count = (MAX_MODBUS_REQUEST_PAYLOAD * 8) / tag->elem_size;
+    int low = *base_register;
+    int high = *base_register + *register_count;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    /* find queued writes of the same type that could end up in range. */
+    spin_block(&plc->ready_lock) {
+        for(modbus_tag_p walker = plc->ready_list.head; walker && num_candidates < MAX_COALESCE_CANDIDATES;
+            walker = walker->next_ready) {
+            if(walker != tag && walker->tag_id != 0 && walker->op == TAG_OP_WRITE_REQUEST && walker->reg_type == tag->reg_type
+               && walker->request_num == 0 && walker->coalesced_slot < 0
+               && mb_merge_in_reach(low, high, max_count, walker->reg_base, walker->elem_count)) {
+                candidates[num_candidates].base = walker->reg_base;
+                candidates[num_candidates].count = walker->elem_count;
+                candidates[num_candidates].tag = walker;
+                num_candidates++;
+            }
+        }
+    }
+
+    if(num_candidates == 0) {
+        pdebug(DEBUG_SPEW, "No queued writes to merge.");
+        return 0;
+    }
+
+    state.seq_id = seq_id;
+    state.slot = tag->request_slot;
+    state.last = &(plc->coalesced_tags[tag->request_slot]);
+    state.staging = staging;
+    state.staging_base = staging_base;
+
+    num_merged = mb_merge_writes(&low, &high, max_count, candidates, num_candidates, take_coalesced_write, &state);
+
+    pdebug(DEBUG_DETAIL, "Merged %d queued writes into request %u for registers %d to %d.", num_merged, (unsigned int)seq_id,
+           low, high - 1);
+
+    *base_register = low;
+    *register_count = high - low;
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return num_merged;
+}
+
+
+/*
+ * Called by mb_merge_writes() for each queued write that fits.  Tags that are
+ * busy in another thread are skipped rather than waited for.
+ */
+int take_coalesced_write(void *candidate_arg, void *arg) {
+    modbus_tag_p candidate = (modbus_tag_p)candidate_arg;
+    struct coalesce_state_t *state = (struct coalesce_state_t *)arg;
+    int merged = 0;
+
+    if(mutex_try_lock(candidate->api_mutex) != PLCTAG_STATUS_OK) { return 0; }
+
+    /* check again now that nothing else can change the tag. */
+    if(candidate->op == TAG_OP_WRITE_REQUEST && candidate->request_num == 0 && candidate->coalesced_slot < 0) {
+        candidate->op = TAG_OP_WRITE_RESPONSE;
+        candidate->seq_id = state->seq_id;
+        candidate->coalesced_slot = state->slot;
+        candidate->next_coalesced = NULL;
+
+        copy_coalesced_data(state->staging, state->staging_base, candidate);
+
+        *(state->last) = candidate;
+        state->last = &(candidate->next_coalesced);
+
+        merged = 1;
+    }
+
+    mutex_unlock(candidate->api_mutex);
+
+    return merged;
+}
+
+
+/*
+ * Find a queued holding register write that can go along with this read in
+ * one read/write multiple registers request, as mb_fuse_fits() decides.  The write tag
+ * is chained off the request slot like a merged write.  Its data is copied
+ * into write_data while we hold its API mutex.
+ *
+ * Must be called with the PLC mutex and the tag's API mutex held.
+ */
+modbus_tag_p fuse_write(modbus_plc_p plc, modbus_tag_p tag, uint16_t seq_id, int read_base, int read_count,
+                        uint8_t *write_data) {
+    modbus_tag_p candidates[MAX_COALESCE_CANDIDATES];
+    int num_candidates = 0;
+    int max_count = (MAX_MODBUS_FUSED_WRITE_PAYLOAD * 8) / tag->elem_size;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    spin_block(&plc->ready_lock) {
+        for(modbus_tag_p walker = plc->ready_list.head; walker && num_candidates < MAX_COALESCE_CANDIDATES;
+            walker = walker->next_ready) {
+            if(walker != tag && walker->tag_id != 0 && walker->op == TAG_OP_WRITE_REQUEST
+               && walker->reg_type == MB_REG_HOLDING_REGISTER && walker->request_num == 0 && walker->coalesced_slot < 0
+               && mb_fuse_fits(read_base, read_count, walker->reg_base, walker->elem_count, max_count)) {
+                candidates[num_candidates] = walker;
+                num_candidates++;
+            }
+        }
+    }
+
+    /* take the first one that is not busy, in queue order. */
+    for(int i = 0; i < num_candidates; i++) {
+        modbus_tag_p candidate = candidates[i];
+        int fused = 0;
+
+        if(mutex_try_lock(candidate->api_mutex) != PLCTAG_STATUS_OK) { continue; }
+
+        if(candidate->op == TAG_OP_WRITE_REQUEST && candidate->request_num == 0 && candidate->coalesced_slot < 0) {
+            candidate->op = TAG_OP_WRITE_RESPONSE;
+            candidate->seq_id = seq_id;
+            candidate->coalesced_slot = tag->request_slot;
+            candidate->next_coalesced = NULL;
+
+            plc->coalesced_tags[tag->request_slot] = candidate;
+
+            mem_copy(write_data, candidate->data, candidate->elem_count * 2);
+
+            fused = 1;
+        }
+
+        mutex_unlock(candidate->api_mutex);
+
+        if(fused) {
+            pdebug(DEBUG_DETAIL, "Sending write of tag %" PRId32 " with read request %u.", candidate->tag_id, (unsigned int)seq_id);
+            return candidate;
+        }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return NULL;
+}
+
+
+/* put a tag's data at its place in a merged write payload. */
+void copy_coalesced_data(uint8_t *payload, int base_register, modbus_tag_p tag) {
+    int offset = tag->reg_base - base_register;
+
+    if(tag->reg_type == MB_REG_COIL) {
+        mb_copy_bits(payload, offset, tag->data, 0, tag->elem_count);
+    } else {
+        mem_copy(payload + (offset * 2), tag->data, tag->size);
+    }
+}
+
+
+/* complete the merged writes whose response was just handled.  Must be called with the PLC mutex held. */
+void finish_coalesced_writes(modbus_plc_p plc) {
+    modbus_tag_p follower = plc->finished_writes;
+
+    plc->finished_writes = NULL;
+
+    while(follower) {
+        modbus_tag_p next = follower->next_coalesced;
+        bool event_raised = false;
+
+        follower->next_coalesced = NULL;
+        follower->coalesced_slot = -1;
+
+        debug_set_tag_id(follower->tag_id);
+
+        critical_block(follower->api_mutex) {
+            /* the tag might have been aborted in the meantime. */
+            if(follower->op == TAG_OP_WRITE_RESPONSE && follower->seq_id == plc->finished_write_seq_id) {
+                int rc = plc->finished_write_status;
+
+                pdebug(DEBUG_DETAIL, "Merged write complete with status %s.", plc_tag_decode_error(rc));
+
+                follower->op = TAG_OP_IDLE;
+                follower->seq_id = 0;
+                follower->write_complete = 1;
+                follower->write_in_flight = 0;
+                follower->status = (int8_t)rc;
+
+                plc_tag_generic_op_completed((plc_tag_p)follower, 1, rc);
+                tag_raise_event((plc_tag_p)follower, PLCTAG_EVENT_WRITE_COMPLETED, (int8_t)rc);
+                event_raised = true;
+            }
+        }
+
+        if(event_raised) {
+            plc_tag_generic_handle_event_callbacks((plc_tag_p)follower);
+            plc_tag_generic_wake_tag((plc_tag_p)follower);
+        }
+
+        debug_set_tag_id(0);
+
+        follower = next;
+    }
+}
+
+
+/* the tag owning a merged request went away, so queue the merged writes again.  Must be called with the PLC mutex held. */
+void restart_coalesced_writes(modbus_plc_p plc, int slot) {
+    modbus_tag_p follower = plc->coalesced_tags[slot];
+
+    plc->coalesced_tags[slot] = NULL;
+
+    while(follower) {
+        modbus_tag_p next = follower->next_coalesced;
+
+        follower->next_coalesced = NULL;
+        follower->coalesced_slot = -1;
+
+        critical_block(follower->api_mutex) {
+            if(follower->op == TAG_OP_WRITE_RESPONSE && follower->request_slot < 0) {
+                pdebug(DEBUG_DETAIL, "Requeueing merged write for tag %" PRId32 ".", follower->tag_id);
+                follower->op = TAG_OP_WRITE_REQUEST;
+                push_ready_tag(plc, follower);
+            }
+        }
+
+        follower = next;
+    }
+}
+
+
+/* unlink a tag from the merged write chain it is on, if any.  Must be called with the PLC mutex held. */
+void remove_coalesced_tag(modbus_plc_p plc, modbus_tag_p tag) {
+    modbus_tag_p *walker = NULL;
+
+    if(tag->coalesced_slot < 0 || tag->coalesced_slot >= MAX_MODBUS_REQUESTS) { return; }
+
+    walker = &(plc->coalesced_tags[tag->coalesced_slot]);
+
+    while(*walker && *walker != tag) { walker = &((*walker)->next_coalesced); }
+
+    if(*walker) { *walker = tag->next_coalesced; }
+
+    tag->next_coalesced = NULL;
+    tag->coalesced_slot = -1;
+}
+
+
 /* Write response.
  *    Byte  Meaning
  *      0    High byte of request sequence ID.
@@ -1915,9 +2664,9 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag) {
             rc = translate_modbus_error(plc->read_data[8]);
 
             pdebug(DEBUG_WARN, "Got write response %ud, with error %s, of length %d.", (int)(unsigned int)seq_id,
-                   plc_tag_decode_error(rc), plc->read_data_len);
+                   plc_tag_decode_error(rc), plc->response_len);
         } else {
-            int registers_per_request = (MAX_MODBUS_RESPONSE_PAYLOAD * 8) / tag->elem_size;
+            int registers_per_request = (MAX_MODBUS_REQUEST_PAYLOAD * 8) / tag->elem_size;
             int next_register_offset = ((tag->request_num + 1) * registers_per_request);
             int next_byte_offset = (next_register_offset * tag->elem_size) / 8;
 
@@ -1940,9 +2689,16 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag) {
             rc = PLCTAG_STATUS_OK;
         }
 
-        /* either way, clean up the PLC buffer. */
-        plc->read_data_len = 0;
-        plc->flags.response_ready = 0;
+        /* tags that rode along in this request get the same result once we are out of this tag's mutex. */
+        if(tag->request_slot >= 0 && plc->coalesced_tags[tag->request_slot]) {
+            plc->finished_writes = plc->coalesced_tags[tag->request_slot];
+            plc->finished_write_seq_id = seq_id;
+            plc->finished_write_status = rc;
+            plc->coalesced_tags[tag->request_slot] = NULL;
+        }
+
+        /* either way, we are done with this response. */
+        consume_response(plc);
 
         /* clean up tag*/
         if(!partial_write) {
@@ -1961,7 +2717,7 @@ int check_write_response(modbus_plc_p plc, modbus_tag_p tag) {
     } else {
         pdebug(DEBUG_SPEW, "Not our response.");
 
-        rc = PLCTAG_STATUS_PENDING;
+        rc = PLCTAG_ERR_NO_MATCH;
     }
 
     pdebug(DEBUG_SPEW, "Done.");
@@ -2206,6 +2962,93 @@ int remove_tag(modbus_tag_list_p list, modbus_tag_p tag) {
 }
 
 
+/*
+ * The ready list is linked through next_ready so that a tag can be on it and
+ * on the PLC's tag list at the same time.  A tag is only ever on it once.
+ */
+
+void push_ready_tag(modbus_plc_p plc, modbus_tag_p tag) {
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    spin_block(&plc->ready_lock) {
+        if(!tag->on_ready_list) {
+            tag->next_ready = NULL;
+            tag->on_ready_list = 1;
+
+            if(plc->ready_list.tail) {
+                plc->ready_list.tail->next_ready = tag;
+                plc->ready_list.tail = tag;
+            } else {
+                plc->ready_list.head = tag;
+                plc->ready_list.tail = tag;
+            }
+
+            plc->ready_count++;
+        }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+}
+
+
+modbus_tag_p pop_ready_tag(modbus_plc_p plc) {
+    modbus_tag_p tmp = NULL;
+
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    spin_block(&plc->ready_lock) {
+        tmp = plc->ready_list.head;
+
+        if(tmp) {
+            plc->ready_list.head = tmp->next_ready;
+            tmp->next_ready = NULL;
+            tmp->on_ready_list = 0;
+            plc->ready_count--;
+        }
+
+        if(!plc->ready_list.head) { plc->ready_list.tail = NULL; }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+
+    return tmp;
+}
+
+
+void remove_ready_tag(modbus_plc_p plc, modbus_tag_p tag) {
+    pdebug(DEBUG_SPEW, "Starting.");
+
+    spin_block(&plc->ready_lock) {
+        if(tag->on_ready_list) {
+            modbus_tag_p cur = plc->ready_list.head;
+            modbus_tag_p prev = NULL;
+
+            while(cur && cur != tag) {
+                prev = cur;
+                cur = cur->next_ready;
+            }
+
+            if(cur) {
+                if(prev) {
+                    prev->next_ready = tag->next_ready;
+                } else {
+                    plc->ready_list.head = tag->next_ready;
+                }
+
+                if(plc->ready_list.tail == tag) { plc->ready_list.tail = prev; }
+
+                plc->ready_count--;
+            }
+
+            tag->next_ready = NULL;
+            tag->on_ready_list = 0;
+        }
+    }
+
+    pdebug(DEBUG_SPEW, "Done.");
+}
+
+
 /****** Tag Control Functions ******/
 
 /* These must all be called with the API mutex on the tag held. */
@@ -2233,7 +3076,20 @@ int mb_abort(plc_tag_p p_tag) {
     tag->status = (int8_t)PLCTAG_STATUS_OK;
     tag->op = TAG_OP_IDLE;
 
-    clear_request_slot(tag->plc, tag);
+    /*
+     * The request slots belong to the PLC mutex.  The PLC thread takes that
+     * before the tag's API mutex, so we must not wait for it here.  If it is
+     * busy, the PLC thread releases the slot the next time it tickles the tag.
+     */
+    if(tag->plc) {
+        if(mutex_try_lock(tag->plc->mutex) == PLCTAG_STATUS_OK) {
+            clear_request_slot(tag->plc, tag);
+            mutex_unlock(tag->plc->mutex);
+        } else {
+            atomic_set_bool(&tag->release_slot, true);
+            atomic_set_bool(&tag->plc->sweep_requested, true);
+        }
+    }
 
     /* wake the PLC loop if we need to. */
     wake_plc_thread(tag->plc);
@@ -2269,6 +3125,9 @@ int mb_read_start(plc_tag_p p_tag) {
         return PLCTAG_ERR_BUSY;
     }
 
+    /* get in line for a request slot. */
+    if(tag->plc) { push_ready_tag(tag->plc, tag); }
+
     /* wake the PLC loop if we need to. */
     wake_plc_thread(tag->plc);
 
@@ -2337,6 +3196,9 @@ int mb_write_start(plc_tag_p p_tag) {
         return PLCTAG_ERR_BUSY;
     }
 
+    /* get in line for a request slot. */
+    if(tag->plc) { push_ready_tag(tag->plc, tag); }
+
     /* wake the PLC loop if we need to. */
     wake_plc_thread(tag->plc);
 
@@ -2356,6 +3218,9 @@ int mb_wake_plc(plc_tag_p p_tag) {
         return PLCTAG_ERR_NULL_PTR;
     }
 
+    /* something changed that the ready list does not track, such as an abort or a new tag. */
+    if(tag->plc) { atomic_set_bool(&tag->plc->sweep_requested, true); }
+
     /* wake the PLC thread. */
     wake_plc_thread(tag->plc);
 
@@ -2380,6 +3245,9 @@ int mb_get_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int default_va
         res = (tag->elem_size + 7) / 8; /* return size in bytes! */
     } else if(str_cmp_i(attrib_name, "elem_count") == 0) {
         res = tag->elem_count;
+    } else if(str_cmp_i_n(attrib_name, "conn_", 5) == 0 && tag->plc
+              && metrics_get_int_attrib(&tag->plc->metrics, attrib_name + 5, &res) == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_SPEW, "Got PLC metric %s.", attrib_name);
     } else {
         pdebug(DEBUG_WARN, "Attribute \"%s\" is not supported.", attrib_name);
         tag->status = PLCTAG_ERR_UNSUPPORTED;
@@ -37,12 +37,15 @@
 #include <libplctag/protocols/omron/defs.h>
 #include <libplctag/protocols/omron/omron_common.h>
 #include <libplctag/protocols/omron/tag.h>
+#include <libplctag/protocols/eip/transport.h>
 #include <limits.h>
 #include <platform.h>
 #include <stdlib.h>
 #include <time.h>
 #include <utils/atomic_utils.h>
 #include <utils/debug.h>
+#include <utils/hash.h>
+#include <utils/metrics.h>
 #include <utils/random_utils.h>
 
 #define MAX_REQUESTS (200)
@@ -74,9 +77,61 @@
 
 #define CONN_DISCONNECT_TIMEOUT (5000)
 
-#define SOCKET_WAIT_TIMEOUT_MS (20)
 #define CONN_IDLE_WAIT_TIME (100)
 
+/* a tag type learned from a read, shared with later tags of the same name. */
+typedef struct conn_type_entry_t {
+    /* other names with the same hash key. */
+    struct conn_type_entry_t *next_same_key;
+
+    /* the entries in order of use, for eviction. */
+    struct conn_type_entry_t *newer;
+    struct conn_type_entry_t *older;
+
+    int64_t key;
+
+    uint8_t encoded_name[MAX_TAG_NAME];
+    int encoded_name_size;
+
+    uint8_t encoded_type_info[MAX_TAG_TYPE_INFO];
+    int encoded_type_info_size;
+
+    int elem_size;
+} conn_type_entry_t;
+
+typedef conn_type_entry_t *conn_type_entry_p;
+
+/*
+ * The variable table comes from the Tag Name Server object.  Its class
+ * attributes give the highest instance ID, each instance gives a variable
+ * name, and Get Attributes All on the name gives the type and size.
+ */
+#define OMRON_TAG_NAME_SERVER_CLASS (0x6A)
+
+#define TAG_TABLE_GET_COUNT (0)
+#define TAG_TABLE_GET_NAME (1)
+#define TAG_TABLE_GET_TYPE (2)
+
+/* guesses at the reply sizes, a packet whose replies do not fit is sent again one request at a time. */
+#define TAG_TABLE_COUNT_RESPONSE_SIZE (4 + 6)
+#define TAG_TABLE_NAME_RESPONSE_SIZE (4 + 5 + 64)
+#define TAG_TABLE_TYPE_RESPONSE_SIZE (4 + 48)
+
+struct conn_tag_table_request_t {
+    omron_request_p req;
+    int step;
+    uint8_t encoded_name[MAX_TAG_NAME];
+    int encoded_name_size;
+};
+
+struct conn_tag_table_t {
+    uint32_t next_instance;
+    uint32_t max_instance;
+    int num_types;
+    int num_requests;
+    struct conn_tag_table_request_t requests[CONN_TAG_TABLE_WINDOW];
+};
+
 /* make sure we try hard to get a good payload size */
 #define GET_MAX_PAYLOAD_SIZE(conn)                             \
     ((conn->max_payload_size > 0) ? (conn->max_payload_size) : \
@@ -104,13 +159,15 @@ static int conn_unregister(omron_conn_p conn);
 static THREAD_FUNC(conn_handler);
 static int purge_aborted_requests_unsafe(omron_conn_p conn);
 static int process_requests(omron_conn_p conn);
+static int select_requests(void *conn_arg, void **requests);
+static void get_request_data(void *request_arg, uint8_t **data, int *data_size);
+static void complete_request(void *conn_arg, void *request_arg, uint8_t *reply, int reply_size, int sub_packet);
+static void requeue_requests(void *conn_arg, void **requests, int num_requests, int alone);
 // static int check_packing(omron_conn_p conn, omron_request_p request);
-static int get_payload_size(omron_request_p request);
-static int pack_requests(omron_conn_p conn, omron_request_p *requests, int num_requests);
-static int prepare_request(omron_conn_p conn);
+static int select_requests_unsafe(omron_conn_p conn, omron_request_p *requests, int max_payload_size);
 static int send_eip_request(omron_conn_p conn, int timeout);
 static int recv_eip_response(omron_conn_p conn, int timeout);
-static int unpack_response(omron_conn_p conn, omron_request_p request, int sub_packet);
+static int unpack_response(omron_conn_p conn, omron_request_p request, uint8_t *reply, int reply_size, int sub_packet);
 // static int perform_forward_open(omron_conn_p conn);
 static int perform_forward_close(omron_conn_p conn);
 // static int try_forward_open_ex(omron_conn_p conn, int *max_payload_size_guess);
@@ -121,11 +178,28 @@ static int perform_forward_close(omron_conn_p conn);
 static int send_forward_close_req(omron_conn_p conn);
 static int recv_forward_close_resp(omron_conn_p conn);
 static int send_forward_open_request(omron_conn_p conn);
-static int send_old_forward_open_request(omron_conn_p conn);
-static int send_extended_forward_open_request(omron_conn_p conn);
+static void fill_forward_open(omron_conn_p conn, struct eip_forward_open_t *fo);
 static int receive_forward_open_response(omron_conn_p conn);
 static void request_destroy(void *req_arg);
 static int conn_request_increase_buffer(omron_request_p request, int new_capacity);
+static int64_t get_type_cache_key(uint8_t *encoded_name, int encoded_name_size);
+static conn_type_entry_p find_type_entry_unsafe(omron_conn_p conn, uint8_t *encoded_name, int encoded_name_size);
+static int cache_type_unsafe(omron_conn_p conn, uint8_t *encoded_name, int encoded_name_size, uint8_t *encoded_type_info,
+                             int encoded_type_info_size, int elem_size);
+static void use_type_entry_unsafe(omron_conn_p conn, conn_type_entry_p entry);
+static void remove_type_entry_unsafe(omron_conn_p conn, conn_type_entry_p entry);
+static void clear_type_cache_unsafe(omron_conn_p conn);
+static void tag_table_tickler(omron_conn_p conn);
+static int queue_tag_table_request(omron_conn_p conn, struct conn_tag_table_request_t *table_req, int step, uint32_t instance);
+static int handle_tag_table_reply(omron_conn_p conn, struct conn_tag_table_t *table, struct conn_tag_table_request_t *table_req);
+static int get_atomic_type_size(uint8_t cip_type);
+static void release_tag_table(omron_conn_p conn);
+
+/* how the EIP request loop gets at the connection's request queue. */
+static const struct eip_request_ops_t conn_request_ops = {.select_requests = select_requests,
+                                                          .get_request_data = get_request_data,
+                                                          .complete_request = complete_request,
+                                                          .requeue_requests = requeue_requests};
 
 
 static volatile mutex_p conn_mutex = NULL;
@@ -230,6 +304,169 @@ int conn_get_max_payload(omron_conn_p conn) {
     return result;
 }
 
+int conn_get_fragmented_read_support(omron_conn_p conn) {
+    int result = CONN_FRAGMENTED_READ_UNKNOWN;
+
+    if(!conn) {
+        pdebug(DEBUG_WARN, "Called with null conn pointer!");
+        return result;
+    }
+
+    critical_block(conn->mutex) { result = conn->fragmented_read_support; }
+
+    return result;
+}
+
+
+void conn_set_fragmented_read_support(omron_conn_p conn, int support) {
+    if(!conn) {
+        pdebug(DEBUG_WARN, "Called with null conn pointer!");
+        return;
+    }
+
+    critical_block(conn->mutex) {
+        if(conn->fragmented_read_support != support) {
+            pdebug(DEBUG_INFO, "PLC %s Read Tag Fragmented.",
+                   (support == CONN_FRAGMENTED_READ_SUPPORTED ? "supports" : "does not support"));
+            conn->fragmented_read_support = support;
+        }
+    }
+}
+
+
+/*
+ * conn_get_cached_type
+ *
+ * Fill in the encoded type and element size of the tag from an earlier read
+ * of a tag with the same name on this connection.  Returns
+ * PLCTAG_ERR_NOT_FOUND if no tag by that name has been read yet.
+ */
+
+int conn_get_cached_type(omron_conn_p conn, omron_tag_p tag) {
+    int rc = PLCTAG_ERR_NOT_FOUND;
+
+    if(!conn || !tag) {
+        pdebug(DEBUG_WARN, "Called with null conn or tag pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(conn->mutex) {
+        conn_type_entry_p entry = find_type_entry_unsafe(conn, tag->encoded_name, tag->encoded_name_size);
+
+        if(entry) {
+            mem_copy(tag->encoded_type_info, entry->encoded_type_info, entry->encoded_type_info_size);
+            tag->encoded_type_info_size = entry->encoded_type_info_size;
+            tag->elem_size = entry->elem_size;
+
+            use_type_entry_unsafe(conn, entry);
+
+            rc = PLCTAG_STATUS_OK;
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Tag type is %sin the connection cache.", (rc == PLCTAG_STATUS_OK ? "" : "not "));
+
+    return rc;
+}
+
+
+/*
+ * conn_cache_type
+ *
+ * Remember the encoded type and element size of a tag that has been read
+ * so that other tags with the same name can skip reading the type.  Once
+ * the cache is full the least recently used name is dropped.
+ */
+
+int conn_cache_type(omron_conn_p conn, omron_tag_p tag) {
+    int rc = PLCTAG_STATUS_OK;
+
+    if(!conn || !tag) {
+        pdebug(DEBUG_WARN, "Called with null conn or tag pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(tag->encoded_name_size <= 0 || tag->encoded_type_info_size <= 0 || tag->elem_size <= 0) {
+        pdebug(DEBUG_DETAIL, "Tag %" PRId32 " does not have a complete type yet.", tag->tag_id);
+        return PLCTAG_STATUS_OK;
+    }
+
+    critical_block(conn->mutex) {
+        rc = cache_type_unsafe(conn, tag->encoded_name, tag->encoded_name_size, tag->encoded_type_info, tag->encoded_type_info_size,
+                               tag->elem_size);
+    }
+
+    if(rc != PLCTAG_STATUS_OK) { pdebug(DEBUG_DETAIL, "Type of tag %" PRId32 " not cached, %s.", tag->tag_id, plc_tag_decode_error(rc)); }
+
+    return rc;
+}
+
+
+/*
+ * conn_uncache_type
+ *
+ * Forget the type of the tag's name, used when a read shows that the type
+ * the tag started with is no longer right.
+ */
+
+int conn_uncache_type(omron_conn_p conn, omron_tag_p tag) {
+    int rc = PLCTAG_ERR_NOT_FOUND;
+
+    if(!conn || !tag) {
+        pdebug(DEBUG_WARN, "Called with null conn or tag pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(conn->mutex) {
+        conn_type_entry_p entry = find_type_entry_unsafe(conn, tag->encoded_name, tag->encoded_name_size);
+
+        if(entry) {
+            remove_type_entry_unsafe(conn, entry);
+            rc = PLCTAG_STATUS_OK;
+        }
+    }
+
+    pdebug(DEBUG_DETAIL, "Type of tag %" PRId32 " was %sin the connection cache.", tag->tag_id,
+           (rc == PLCTAG_STATUS_OK ? "" : "not "));
+
+    return rc;
+}
+
+
+/*
+ * conn_load_tag_table
+ *
+ * Ask the connection to load the controller's variable table into the type
+ * cache.  The table is only fetched once per registration, however many
+ * tags ask.  Returns PLCTAG_STATUS_PENDING while it loads, PLCTAG_STATUS_OK
+ * once it is loaded and PLCTAG_ERR_NOT_FOUND if the PLC did not give it.
+ */
+
+int conn_load_tag_table(omron_conn_p conn) {
+    int state = CONN_TAG_TABLE_NONE;
+
+    if(!conn) {
+        pdebug(DEBUG_WARN, "Called with null conn pointer!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    critical_block(conn->mutex) {
+        conn->tag_table_wanted = 1;
+
+        if(conn->tag_table_state == CONN_TAG_TABLE_NONE) { conn->tag_table_state = CONN_TAG_TABLE_LOADING; }
+
+        state = conn->tag_table_state;
+    }
+
+    if(state == CONN_TAG_TABLE_LOADING) {
+        cond_signal(conn->wait_cond);
+        return PLCTAG_STATUS_PENDING;
+    }
+
+    return (state == CONN_TAG_TABLE_LOADED ? PLCTAG_STATUS_OK : PLCTAG_ERR_NOT_FOUND);
+}
+
+
 int conn_find_or_create(omron_conn_p *tag_conn, attr attribs) {
     /*int debug = attr_get_int(attribs,"debug",0);*/
     const char *conn_gw = attr_get_str(attribs, "gateway", "");
@@ -245,9 +482,23 @@ int conn_find_or_create(omron_conn_p *tag_conn, attr attribs) {
     int auto_disconnect_timeout_ms = INT_MAX;
     int connection_group_id = attr_get_int(attribs, "connection_group_id", 0);
     int only_use_old_forward_open = attr_get_int(attribs, "conn_only_use_old_forward_open", 0);
+    int max_requests_in_flight = attr_get_int(attribs, "max_requests_in_flight", 1);
 
     pdebug(DEBUG_DETAIL, "Starting");
 
+    /* clamp maximum requests in flight. */
+    if(max_requests_in_flight > CONN_MAX_REQUESTS_IN_FLIGHT) {
+        pdebug(DEBUG_WARN, "max_requests_in_flight set to %d which is higher than the limit of %d.", max_requests_in_flight,
+               CONN_MAX_REQUESTS_IN_FLIGHT);
+        max_requests_in_flight = CONN_MAX_REQUESTS_IN_FLIGHT;
+    }
+
+    if(max_requests_in_flight < 1) {
+        pdebug(DEBUG_WARN, "max_requests_in_flight must be between 1 and %d, inclusive, was %d.", CONN_MAX_REQUESTS_IN_FLIGHT,
+               max_requests_in_flight);
+        max_requests_in_flight = 1;
+    }
+
     auto_disconnect_timeout_ms = attr_get_int(attribs, "auto_disconnect_ms", INT_MAX);
     if(auto_disconnect_timeout_ms != INT_MAX) {
         pdebug(DEBUG_DETAIL, "Setting auto-disconnect after %dms.", auto_disconnect_timeout_ms);
@@ -279,6 +530,7 @@ int conn_find_or_create(omron_conn_p *tag_conn, attr attribs) {
             } else {
                 conn->auto_disconnect_enabled = auto_disconnect_enabled;
                 conn->auto_disconnect_timeout_ms = auto_disconnect_timeout_ms;
+                conn->max_requests_in_flight = max_requests_in_flight;
 
                 /* see if we have an attribute set for forcing the use of the older ForwardOpen */
                 pdebug(DEBUG_DETAIL, "Passed attribute to prohibit use of extended ForwardOpen is %d.",
@@ -533,7 +785,7 @@ omron_conn_p conn_create_unsafe(int max_payload_capacity, bool data_buffer_is_st
 
     /* fix up the data buffer. */
     conn->data_buffer_is_static = data_buffer_is_static;
-    conn->data_capacity = (uint32_t)(unsigned int)max_payload_capacity;
+    conn->data_capacity = (uint32_t)data_buffer_capacity;
 
     if(data_buffer_is_static) {
         conn->data = (uint8_t *)(conn) + data_buffer_offset;
@@ -577,6 +829,14 @@ omron_conn_p conn_create_unsafe(int max_payload_capacity, bool data_buffer_is_st
         return NULL;
     }
 
+    conn->type_cache = hashtable_create(CONN_MIN_TYPE_CACHE);
+    if(!conn->type_cache) {
+        pdebug(DEBUG_WARN, "Unable to allocate type cache!");
+        pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to the PLC connection.");
+        rc_dec(conn);
+        return NULL;
+    }
+
     /* check for ID set up. This does not need to be thread safe since we just need a random value. */
     if(connection_id == 0) { connection_id = (uint32_t)random_u64(UINT32_MAX) + 1; }
 
@@ -587,8 +847,12 @@ omron_conn_p conn_create_unsafe(int max_payload_capacity, bool data_buffer_is_st
     conn->conn_serial_number = (uint16_t)(random_u64(UINT16_MAX) + 1);
     conn->conn_seq_id = (random_u64(UINT32_MAX) + 1);
     conn->is_dhp = is_dhp;
+    conn->fragmented_read_support = CONN_FRAGMENTED_READ_UNKNOWN;
     conn->dhp_dest = dhp_dest;
 
+    metrics_init(&conn->metrics, &library_metrics);
+    poll_planner_init(&conn->poll_planner);
+
     pdebug(DEBUG_DETAIL, "Setting connection_group_id to %d.", connection_group_id);
     conn->connection_group_id = connection_group_id;
 
@@ -624,6 +888,13 @@ int conn_init(omron_conn_p conn) {
 
     pdebug(DEBUG_INFO, "Starting.");
 
+    /* the first tag sets how many packets may wait for replies at once. */
+    if((rc = eip_in_flight_init(&conn->in_flight, conn->max_requests_in_flight)) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to allocate the packets in flight!");
+        conn->failed = 1;
+        return rc;
+    }
+
     /* create the conn mutex. */
     if((rc = mutex_create(&(conn->mutex))) != PLCTAG_STATUS_OK) {
         pdebug(DEBUG_WARN, "Unable to create conn mutex!");
@@ -715,42 +986,23 @@ int conn_open_socket(omron_conn_p conn) {
 
 
 int conn_register(omron_conn_p conn) {
-    eip_conn_reg_req *req;
-    eip_encap *resp;
+    int data_size = 0;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting.");
 
     /*
-     * clear the conn data.
-     *
      * We use the receiving buffer because we do not have a request and nothing can
      * be coming in (we hope) on the socket yet.
      */
-    mem_set(conn->data, 0, sizeof(eip_conn_reg_req));
-
-    req = (eip_conn_reg_req *)(conn->data);
-
-    /* fill in the fields of the request */
-    req->encap_command = h2le16(OMRON_EIP_REGISTER_CONN);
-    req->encap_length = h2le16(sizeof(eip_conn_reg_req) - sizeof(eip_encap));
-    req->encap_conn_handle = h2le32(/*conn->conn_handle*/ 0);
-    req->encap_status = h2le32(0);
-    req->encap_sender_context = h2le64((uint64_t)0);
-    req->encap_options = h2le32(0);
-
-    req->eip_version = h2le16(OMRON_EIP_VERSION);
-    req->option_flags = h2le16(0);
-
-    /*
-     * socket ops here are _ASYNCHRONOUS_!
-     *
-     * This is done this way because we do not have everything
-     * set up for a request to be handled by the thread.  I think.
-     */
+    rc = eip_build_register_session(conn->data, (int)conn->data_capacity, &data_size);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to build conn registration request %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
 
     /* send registration to the gateway */
-    conn->data_size = sizeof(eip_conn_reg_req);
+    conn->data_size = (uint32_t)data_size;
     conn->data_offset = 0;
 
     rc = send_eip_request(conn, CONN_DEFAULT_TIMEOUT);
@@ -766,26 +1018,13 @@ int conn_register(omron_conn_p conn) {
         return rc;
     }
 
-    /* encap header is at the start of the buffer */
-    resp = (eip_encap *)(conn->data);
-
-    /* check the response status */
-    if(le2h16(resp->encap_command) != OMRON_EIP_REGISTER_CONN) {
-        pdebug(DEBUG_WARN, "EIP unexpected response packet type: %d!", resp->encap_command);
-        return PLCTAG_ERR_BAD_DATA;
-    }
-
-    if(le2h32(resp->encap_status) != OMRON_EIP_OK) {
-        pdebug(DEBUG_WARN, "EIP command failed, response code: %d", le2h32(resp->encap_status));
-        return PLCTAG_ERR_REMOTE_ERR;
+    /* save the conn handle, we will use it in future packets. */
+    rc = eip_check_register_session_response(conn->data, (int)conn->data_size, &conn->conn_handle);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Conn registration failed %s!", plc_tag_decode_error(rc));
+        return rc;
     }
 
-    /*
-     * after all that, save the conn handle, we will
-     * use it in future packets.
-     */
-    conn->conn_handle = le2h32(resp->encap_conn_handle);
-
     pdebug(DEBUG_INFO, "Done.");
 
     return PLCTAG_STATUS_OK;
@@ -836,6 +1075,9 @@ void conn_destroy(void *conn_arg) {
 
     pdebug(DEBUG_INFO, "Connection sent %" PRId64 " packets.", conn->packet_count);
 
+    /* take this connection's queue out of the library total. */
+    metrics_set_queue_depth(&conn->metrics, 0);
+
     /* terminate the conn thread first. */
     conn->terminating = 1;
 
@@ -855,6 +1097,9 @@ void conn_destroy(void *conn_arg) {
         }
     }
 
+    /* the conn thread is gone, drop any variable table load it had going. */
+    release_tag_table(conn);
+
     /* this needs to be handled in the mutex to prevent double frees due to queued requests. */
     critical_block(conn->mutex) {
         /* close off the connection if is one. This helps the PLC clean up. */
@@ -885,6 +1130,22 @@ void conn_destroy(void *conn_arg) {
             vector_destroy(conn->requests);
             conn->requests = NULL;
         }
+
+        /* the conn thread is gone, release anything it still had on the wire. */
+        for(int p = 0; p < conn->in_flight.num_packets; p++) {
+            for(int i = 0; i < conn->in_flight.packets[p].num_requests; i++) {
+                pdebug(DEBUG_DETAIL, "rc_dec: Releasing request reference.");
+                rc_dec(conn->in_flight.packets[p].requests[i]);
+            }
+        }
+
+        eip_in_flight_destroy(&conn->in_flight);
+
+        if(conn->type_cache) {
+            clear_type_cache_unsafe(conn);
+            hashtable_destroy(conn->type_cache);
+            conn->type_cache = NULL;
+        }
     }
 
     /* we are done with the condition variable, finally destroy it. */
@@ -1011,6 +1272,7 @@ THREAD_FUNC(conn_handler) {
     int64_t wait_until_time = 0;
     int64_t auto_disconnect_time = time_ms() + CONN_DISCONNECT_TIMEOUT;
     int auto_disconnect = 0;
+    int has_registered = 0;
 
 
     pdebug(DEBUG_INFO, "Starting thread for conn %p", conn);
@@ -1092,6 +1354,20 @@ THREAD_FUNC(conn_handler) {
                     pdebug(DEBUG_WARN, "conn registration failed %s!", plc_tag_decode_error(rc));
                     state = CONN_CLOSE_SOCKET;
                 } else {
+                    if(has_registered) {
+                        metrics_record_reconnect(&conn->metrics);
+
+                        /* the PLC may have been given a new program while we were away. */
+                        release_tag_table(conn);
+
+                        critical_block(conn->mutex) {
+                            clear_type_cache_unsafe(conn);
+
+                            if(conn->tag_table_wanted) { conn->tag_table_state = CONN_TAG_TABLE_LOADING; }
+                        }
+                    }
+                    has_registered = 1;
+
                     if(conn->use_connected_msg) {
                         state = CONN_SEND_FORWARD_OPEN;
                     } else {
@@ -1146,12 +1422,15 @@ THREAD_FUNC(conn_handler) {
                 /* if there is work to do, make sure we do not disconnect. */
                 critical_block(conn->mutex) {
                     int num_reqs = vector_length(conn->requests);
-                    if(num_reqs > 0) {
+                    if(num_reqs > 0 || conn->in_flight.num_packets > 0 || conn->tag_table_state == CONN_TAG_TABLE_LOADING) {
                         pdebug(DEBUG_DETAIL, "There are %d requests pending before cleanup and sending.", num_reqs);
                         auto_disconnect_time = time_ms() + CONN_DISCONNECT_TIMEOUT;
                     }
                 }
 
+                /* take in the variable table replies and queue the next requests for it. */
+                tag_table_tickler(conn);
+
                 if((rc = process_requests(conn)) != PLCTAG_STATUS_OK) {
                     pdebug(DEBUG_WARN, "Error while processing requests %s!", plc_tag_decode_error(rc));
                     if(conn->use_connected_msg) {
@@ -1179,7 +1458,7 @@ THREAD_FUNC(conn_handler) {
                 /* if there is work to do, make sure we signal the condition var. */
                 critical_block(conn->mutex) {
                     int num_reqs = vector_length(conn->requests);
-                    if(num_reqs > 0) {
+                    if(num_reqs > 0 || conn->in_flight.num_packets > 0 || conn->tag_table_state == CONN_TAG_TABLE_LOADING) {
                         pdebug(DEBUG_DETAIL, "There are %d requests still pending after abort purge and sending.", num_reqs);
                         cond_signal(conn->wait_cond);
                     }
@@ -1230,6 +1509,8 @@ THREAD_FUNC(conn_handler) {
                 /* FIXME - make this a tag attribute. */
                 timeout_time = time_ms() + RETRY_WAIT_MS;
 
+                metrics_record_retry(&conn->metrics);
+
                 /* start waiting. */
                 state = CONN_WAIT_RETRY;
 
@@ -1256,7 +1537,7 @@ THREAD_FUNC(conn_handler) {
                 /* if there is work to do, reconnect.. */
                 pdebug(DEBUG_SPEW, "Critical block.");
                 critical_block(conn->mutex) {
-                    if(vector_length(conn->requests) > 0) {
+                    if(vector_length(conn->requests) > 0 || conn->tag_table_state == CONN_TAG_TABLE_LOADING) {
                         pdebug(DEBUG_DETAIL, "There are requests waiting, reopening connection to PLC.");
 
                         state = CONN_OPEN_SOCKET_START;
@@ -1349,38 +1630,55 @@ int purge_aborted_requests_unsafe(omron_conn_p conn) {
 }
 
 
+/*
+ * process_requests
+ *
+ * Hand the queue to the EIP request loop, see eip_process_requests().
+ */
+
 int process_requests(omron_conn_p conn) {
-    int rc = PLCTAG_STATUS_OK;
-    omron_request_p request = NULL;
-    omron_request_p bundled_requests[MAX_REQUESTS] = {NULL};
-    int num_bundled_requests = 0;
-    int remaining_request_space = 0;
-    int remaining_response_space = 0;
-    int allow_packing = 0;
+    struct eip_request_loop_t loop = {0};
 
     debug_set_tag_id(0);
 
-    pdebug(DEBUG_SPEW, "Starting.");
-
     if(!conn) {
         pdebug(DEBUG_WARN, "Null conn pointer!");
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    pdebug(DEBUG_SPEW, "Checking for requests to process.");
+    loop.owner = conn;
+    loop.ops = &conn_request_ops;
+    loop.sock = conn->sock;
+    loop.terminating = &conn->terminating;
+    loop.timeout = CONN_DEFAULT_TIMEOUT;
+    loop.buf = conn->data;
+    loop.buf_capacity = (int)conn->data_capacity;
+    loop.session_handle = conn->conn_handle;
+    loop.session_seq_id = &conn->conn_seq_id;
+    loop.targ_connection_id = conn->targ_connection_id;
+    loop.conn_seq_num = &conn->conn_seq_num;
+    loop.in_flight = &conn->in_flight;
+    loop.metrics = &conn->metrics;
+
+    return eip_process_requests(&loop);
+}
 
-    rc = PLCTAG_STATUS_OK;
-    request = NULL;
-    conn->data_size = 0;
-    conn->data_offset = 0;
 
-    /* grab a request off the front of the list. */
+/*
+ * select_requests
+ *
+ * Request loop hook.  Get rid of aborted requests and take the requests for
+ * the next packet off the queue.
+ */
+
+int select_requests(void *conn_arg, void **requests) {
+    omron_conn_p conn = (omron_conn_p)conn_arg;
+    omron_request_p selected[MAX_REQUESTS];
+    int num_selected = 0;
+
     critical_block(conn->mutex) {
         int max_payload_size = GET_MAX_PAYLOAD_SIZE(conn);
 
-        // FIXME - no logging in a mutex!
-        // pdebug(DEBUG_DETAIL, "FIXME: max payload size %d", max_payload_size);
-
         /* is there anything to do? */
         if(vector_length(conn->requests)) {
             /* get rid of all aborted requests. */
@@ -1388,383 +1686,128 @@ int process_requests(omron_conn_p conn) {
 
             /* if there are still requests after purging all the aborted requests, process them. */
 
-            /* how much space do we have to work with. */
-            remaining_request_space = max_payload_size - (int)sizeof(cip_multi_req_header);
-
-            /* -2 bytes for the msp (multi service packet) number of packets and -4 bytes for the cip response header,
-             * we later subtract 2 bytes for each packet, this is to allow for the INT offset to the packet within the msp
-             * finally we subtract 10 bytes just to give a comfort blanket as I had seen PLC_TAG_TOO_LARGE issue without it due to
-             * too much data being packed into a single packet */
-            remaining_response_space = max_payload_size - 2 - 4 - 10;
-
             if(vector_length(conn->requests)) {
-                do {
-                    request = vector_get(conn->requests, 0);
-
-                    remaining_request_space = remaining_request_space - get_payload_size(request);
-
-                    /* calculate if all of the response data from the packed requests will fit into a single response packet.
-                     * the -8 bytes is the maximum padding between packets, the -2 bytes is from the offset integer which stores
-                     * the offset to this packet */
-                    remaining_response_space = remaining_response_space - request->response_size - 8 - 2;
-
-                    /* The tag must have packing enabled and the plc must either support fragmented reads or this tag must have
-                     * been read before, so that its response size is known */
-                    allow_packing = request->allow_packing && (request->supports_fragmented_read || !request->first_read);
-
-                    /*
-                     * If we have a non-packable request, only queue it if it is the first one.
-                     * If the request is packable, keep queuing as long as there is space in both the
-                     * request packet and if fragmented reads are not supported then also in the expected response packet.
-                     */
-
-                    if((num_bundled_requests == 0)
-                       || ((allow_packing && (remaining_request_space > 0))
-                           && ((remaining_response_space >= 0) || (request->supports_fragmented_read)))) {
-                        // pdebug(DEBUG_DETAIL, "packed %d requests with remaining space %d", num_bundled_requests+1,
-                        // remaining_request_space);
-                        bundled_requests[num_bundled_requests] = request;
-                        num_bundled_requests++;
-
-                        /* remove it from the queue. */
-                        vector_remove(conn->requests, 0);
-                    }
-                } while(vector_length(conn->requests) && (remaining_request_space > 0) && (num_bundled_requests < MAX_REQUESTS)
-                        && allow_packing && ((remaining_response_space >= 0) || (request->supports_fragmented_read)));
+                num_selected = select_requests_unsafe(conn, selected, max_payload_size);
             } else {
                 pdebug(DEBUG_DETAIL, "All requests in queue were aborted, nothing to do.");
             }
         }
-    }
-
-    /* output debug display as no particular tag. */
-    debug_set_tag_id(0);
-
-    if(num_bundled_requests > 0) {
-
-        pdebug(DEBUG_INFO, "%d requests to process.", num_bundled_requests);
-
-        do {
-            /* copy and pack the requests into the conn buffer. */
-            rc = pack_requests(conn, bundled_requests, num_bundled_requests);
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error while packing requests, %s!", plc_tag_decode_error(rc));
-                break;
-            }
-
-            /* fill in all the necessary parts to the request. */
-            if((rc = prepare_request(conn)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unable to prepare request, %s!", plc_tag_decode_error(rc));
-                break;
-            }
 
-            /* send the request */
-            if((rc = send_eip_request(conn, CONN_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error sending packet %s!", plc_tag_decode_error(rc));
-                break;
-            }
-
-            /* wait for the response */
-            if((rc = recv_eip_response(conn, CONN_DEFAULT_TIMEOUT)) != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Error receiving packet response %s!", plc_tag_decode_error(rc));
-                break;
-            }
+        metrics_set_queue_depth(&conn->metrics, vector_length(conn->requests));
+    }
 
-            /*
-             * check the CIP status, but only if this is a bundled
-             * response.   If it is a singleton, then we pass the
-             * status back to the tag.
-             */
-            if(num_bundled_requests > 1) {
-                cip_multi_resp_header *multi_resp = NULL;
+    for(int i = 0; i < num_selected; i++) {
+        /* let the tag know whether its reply shared the packet. */
+        selected[i]->packing_num = num_selected;
+        requests[i] = selected[i];
+    }
 
-                if(le2h16(((eip_encap *)(conn->data))->encap_command) == OMRON_EIP_UNCONNECTED_SEND) {
-                    eip_cip_uc_resp *resp = (eip_cip_uc_resp *)(conn->data);
-                    uint16_t udi_item_length = le2h16(resp->cpf_udi_item_length);
-                    size_t response_overhead = 0;
-                    size_t response_size = 0;
+    return num_selected;
+}
 
-                    multi_resp = (cip_multi_resp_header *)(&(resp->reply_service));
 
-                    pdebug(DEBUG_INFO, "Received unconnected packet with conn sequence ID %llx", resp->encap_sender_context);
+void get_request_data(void *request_arg, uint8_t **data, int *data_size) {
+    omron_request_p request = (omron_request_p)request_arg;
 
-                    /* punt if we got an overall error or it is not a partial/bundled error. */
-                    if(resp->status != OMRON_EIP_OK && resp->status != OMRON_CIP_ERR_PARTIAL_ERROR) {
-                        rc = CIP.decode_cip_error_code(&(resp->status));
-                        pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
-                        break;
-                    }
+    *data = request->data;
+    *data_size = request->request_size;
+}
 
-                    response_overhead = (size_t)((uint8_t *)multi_resp - conn->data);
-                    response_size = (size_t)conn->data_size - response_overhead;
 
-                    /* check the passed UDI data item size against what we really got. */
-                    if((size_t)udi_item_length != response_size) {
-                        pdebug(DEBUG_WARN,
-                               "Incorrectly constructed response! UDI data length field is %zu but actual size is %zu!",
-                               (size_t)udi_item_length, response_size);
+/*
+ * complete_request
+ *
+ * Request loop hook.  Give the request its reply and release it.
+ */
 
-                        rc = PLCTAG_ERR_BAD_DATA;
-                        break;
-                    }
-                } else if(le2h16(((eip_encap *)(conn->data))->encap_command) == OMRON_EIP_CONNECTED_SEND) {
-                    eip_cip_co_resp *resp = (eip_cip_co_resp *)(conn->data);
-                    uint16_t cdi_item_length = le2h16(resp->cpf_cdi_item_length);
-                    size_t response_overhead = 0;
-                    size_t response_size = 0;
-
-                    multi_resp = (cip_multi_resp_header *)(&(resp->reply_service));
-
-                    pdebug(DEBUG_INFO, "Received connected packet with connection ID %x and sequence ID %u(%x)",
-                           le2h32(resp->cpf_orig_conn_id), le2h16(resp->cpf_conn_seq_num), le2h16(resp->cpf_conn_seq_num));
-
-                    /* punt if we got an overall error or it is not a partial/bundled error. */
-                    if(resp->status != OMRON_EIP_OK && resp->status != OMRON_CIP_ERR_PARTIAL_ERROR) {
-                        rc = CIP.decode_cip_error_code(&(resp->status));
-                        pdebug(DEBUG_WARN, "Command failed! (%d/%d) %s", resp->status, rc, plc_tag_decode_error(rc));
-                        break;
-                    }
+void complete_request(void *conn_arg, void *request_arg, uint8_t *reply, int reply_size, int sub_packet) {
+    omron_conn_p conn = (omron_conn_p)conn_arg;
+    omron_request_p request = (omron_request_p)request_arg;
+    int rc = PLCTAG_STATUS_OK;
 
-                    response_overhead = (size_t)((uint8_t *)(&resp->cpf_conn_seq_num) - conn->data);
-                    response_size = (size_t)conn->data_size - response_overhead;
+    debug_set_tag_id(request->tag_id);
 
-                    pdebug(DEBUG_DETAIL, "response_overhead=%zu", response_overhead);
-                    pdebug(DEBUG_DETAIL, "response_size=%zu", response_size);
+    rc = unpack_response(conn, request, reply, reply_size, sub_packet);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to unpack response!");
 
-                    /* check the passed CDI data item size against what we really got. */
-                    if((size_t)cdi_item_length != response_size) {
-                        pdebug(DEBUG_WARN,
-                               "Incorrectly constructed response! CDI data length field is %zu but actual size is %zu!",
-                               (size_t)cdi_item_length, response_size);
+        /* let the tag see the error instead of waiting for a timeout. */
+        spin_block(&request->lock) {
+            request->status = rc;
+            request->request_size = 0;
+            request->resp_received = 1;
+        }
+    }
 
-                        rc = PLCTAG_ERR_BAD_DATA;
-                        break;
-                    }
-                } else {
-                    pdebug(DEBUG_WARN, "Unexpected EIP packet type, %04x!", le2h16(((eip_encap *)(conn->data))->encap_command));
-                    rc = PLCTAG_ERR_BAD_DATA;
-                    break;
-                }
+    /* release our reference */
+    pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference request for tag %" PRId32 ".", request->tag_id);
+    rc_dec(request);
+}
 
-                /* we have multiple requests, sanity check the data. */
-                if(le2h16(multi_resp->request_count) == num_bundled_requests) {
-                    size_t offset_base = (size_t)((uint8_t *)(&multi_resp->request_count) - conn->data);
 
-                    pdebug(DEBUG_DETAIL, "offset_base=%zu", offset_base);
+/*
+ * requeue_requests
+ *
+ * Request loop hook.  Put requests back at the head of the queue in order.
+ */
 
-                    /* check all the offsets */
-                    for(int resp_index = 0; resp_index < num_bundled_requests; resp_index++) {
-                        size_t resp_offset = (size_t)le2h16(multi_resp->request_offsets[resp_index]) + offset_base;
+void requeue_requests(void *conn_arg, void **requests, int num_requests, int alone) {
+    omron_conn_p conn = (omron_conn_p)conn_arg;
 
-                        pdebug(DEBUG_DETAIL, "Response %d starts at byte offset %zu", resp_offset);
+    critical_block(conn->mutex) {
+        for(int i = num_requests - 1; i >= 0; i--) {
+            omron_request_p request = (omron_request_p)requests[i];
 
-                        if(resp_offset >= (size_t)conn->data_size) {
-                            pdebug(DEBUG_WARN, "Response %d has offset %zu which is outside the conn data!", resp_offset);
-                            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
-                            break;
-                        }
-                    }
-                } else {
-                    pdebug(DEBUG_WARN, "Expected %d packed responses back but got %zu!", num_bundled_requests,
-                           (size_t)le2h16(multi_resp->request_count));
-                    rc = PLCTAG_ERR_BAD_DATA;
-                    break;
-                }
+            if(alone) { request->allow_packing = 0; }
 
-                /* we have multiple requests, sanity check the data. */
-                if(le2h16(multi_resp->request_count) == num_bundled_requests) {
-                    size_t offset_base = (size_t)((uint8_t *)(&multi_resp->request_count) - conn->data);
+            vector_insert(conn->requests, 0, request);
+        }
+    }
+}
 
-                    pdebug(DEBUG_DETAIL, "offset_base=%zu", offset_base);
 
-                    /* check all the offsets */
-                    for(int resp_index = 0; resp_index < num_bundled_requests; resp_index++) {
-                        size_t resp_offset = (size_t)le2h16(multi_resp->request_offsets[resp_index]) + offset_base;
+int unpack_response(omron_conn_p conn, omron_request_p request, uint8_t *reply, int reply_size, int sub_packet) {
+    int rc = PLCTAG_STATUS_OK;
+    int new_eip_len = 0;
 
-                        pdebug(DEBUG_DETAIL, "Response %d starts at byte offset %zu", resp_offset);
+    pdebug(DEBUG_INFO, "Starting.");
 
-                        if(resp_offset >= (size_t)conn->data_size) {
-                            pdebug(DEBUG_WARN, "Response %d has offset %zu which is outside the conn data!", resp_offset);
-                            rc = PLCTAG_ERR_OUT_OF_BOUNDS;
-                            break;
-                        }
-                    }
-                } else {
-                    pdebug(DEBUG_WARN, "Expected %d packed responses back but got %zu!", num_bundled_requests,
-                           (size_t)le2h16(multi_resp->request_count));
-                    rc = PLCTAG_ERR_BAD_DATA;
-                    break;
-                }
-            }
+    /* clear out the request data. */
+    mem_set(request->data, 0, request->request_capacity);
 
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Got error %s when processing incoming response(s)!", plc_tag_decode_error(rc));
-                break;
-            }
+    rc = eip_unpack_response(reply, reply_size, sub_packet, request->data, request->request_capacity, &new_eip_len);
 
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Got error %s when processing incoming response(s)!", plc_tag_decode_error(rc));
-                break;
-            }
+    /* replace the request buffer if it is not big enough. */
+    if(rc == PLCTAG_ERR_TOO_SMALL) {
+        int request_capacity = 0;
 
-            /* copy the results back out. Every request gets a copy. */
-            for(int i = 0; i < num_bundled_requests; i++) {
-                debug_set_tag_id(bundled_requests[i]->tag_id);
+        pdebug(DEBUG_INFO, "Request buffer too small, allocating larger buffer.");
 
-                rc = unpack_response(conn, bundled_requests[i], i);
-                if(rc != PLCTAG_STATUS_OK) {
-                    pdebug(DEBUG_WARN, "Unable to unpack response!");
-                    break;
-                }
+        critical_block(conn->mutex) {
+            int max_payload_size = GET_MAX_PAYLOAD_SIZE(conn);
 
-                /* release our reference */
-                pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference request for tag %" PRId32 ".", bundled_requests[i]->tag_id);
-                bundled_requests[i] = rc_dec(bundled_requests[i]);
-            }
+            request_capacity = (int)(max_payload_size + EIP_CIP_PREFIX_SIZE);
+        }
 
-            rc = PLCTAG_STATUS_OK;
-        } while(0);
+        /* make sure it will fit. */
+        if(new_eip_len > request_capacity) {
+            pdebug(DEBUG_WARN, "something is very wrong, packet length is %d but allowable capacity is %d!", new_eip_len,
+                   request_capacity);
+            return PLCTAG_ERR_TOO_LARGE;
+        }
 
-        /* problem? push the requests back on the queue. */
+        rc = conn_request_increase_buffer(request, request_capacity);
         if(rc != PLCTAG_STATUS_OK) {
-            pdebug(DEBUG_WARN, "Error sending or receiving requests!");
-
-            pdebug(DEBUG_INFO, "Pushing %d requests back into the queue.", num_bundled_requests);
-
-            for(int i = num_bundled_requests - 1; i >= 0; i--) {
-                if(bundled_requests[i]) { vector_insert(conn->requests, 0, bundled_requests[i]); }
-            }
+            pdebug(DEBUG_WARN, "Unable to increase request buffer size to %d bytes!", request_capacity);
+            return rc;
         }
 
-        /* tickle the main tickler thread to note that we have responses. */
-        plc_tag_tickler_wake();
+        rc = eip_unpack_response(reply, reply_size, sub_packet, request->data, request->request_capacity, &new_eip_len);
     }
 
-    debug_set_tag_id(0);
-
-    pdebug(DEBUG_SPEW, "Done.");
-
-    return rc;
-}
-
-
-int unpack_response(omron_conn_p conn, omron_request_p request, int sub_packet) {
-    int rc = PLCTAG_STATUS_OK;
-    eip_cip_co_resp *packed_resp = (eip_cip_co_resp *)(conn->data);
-    eip_cip_co_resp *unpacked_resp = NULL;
-    uint8_t *pkt_start = NULL;
-    uint8_t *pkt_end = NULL;
-    int new_eip_len = 0;
-
-    pdebug(DEBUG_INFO, "Starting.");
-
-    /* clear out the request data. */
-    mem_set(request->data, 0, request->request_capacity);
-
-    /* change what we do depending on the type. */
-    if(packed_resp->reply_service != (OMRON_EIP_CMD_CIP_MULTI | OMRON_EIP_CMD_CIP_OK)) {
-        /* copy the data back into the request buffer. */
-        new_eip_len = (int)conn->data_size;
-        pdebug(DEBUG_INFO, "Got single response packet.  Copying %d bytes unchanged.", new_eip_len);
-
-        if(new_eip_len > request->request_capacity) {
-            int request_capacity = 0;
-
-            pdebug(DEBUG_INFO, "Request buffer too small, allocating larger buffer.");
-
-            critical_block(conn->mutex) {
-                int max_payload_size = GET_MAX_PAYLOAD_SIZE(conn);
-
-                // FIXME - no logging in a mutex!
-                // pdebug(DEBUG_DETAIL, "FIXME: max payload size %d", max_payload_size);
-
-                request_capacity = (int)(max_payload_size + EIP_CIP_PREFIX_SIZE);
-            }
-
-            /* make sure it will fit. */
-            if(new_eip_len > request_capacity) {
-                pdebug(DEBUG_WARN, "something is very wrong, packet length is %d but allowable capacity is %d!", new_eip_len,
-                       request_capacity);
-                return PLCTAG_ERR_TOO_LARGE;
-            }
-
-            rc = conn_request_increase_buffer(request, request_capacity);
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unable to increase request buffer size to %d bytes!", request_capacity);
-                return rc;
-            }
-        }
-
-        mem_copy(request->data, conn->data, new_eip_len);
-    } else {
-        cip_multi_resp_header *multi = (cip_multi_resp_header *)(&packed_resp->reply_service);
-        uint16_t total_responses = le2h16(multi->request_count);
-        int pkt_len = 0;
-
-        /* this is a packed response. */
-        pdebug(DEBUG_INFO, "Got multiple response packet, subpacket %d", sub_packet);
-
-        pdebug(DEBUG_INFO, "Our result offset is %d bytes.", (int)le2h16(multi->request_offsets[sub_packet]));
-
-        pkt_start = ((uint8_t *)(&multi->request_count) + le2h16(multi->request_offsets[sub_packet]));
-
-        /* calculate the end of the data. */
-        if((sub_packet + 1) < total_responses) {
-            /* not the last response */
-            pkt_end = (uint8_t *)(&multi->request_count) + le2h16(multi->request_offsets[sub_packet + 1]);
-        } else {
-            pkt_end = (conn->data + le2h16(packed_resp->encap_length) + sizeof(eip_encap));
-        }
-
-        pkt_len = (int)(pkt_end - pkt_start);
-
-        /* replace the request buffer if it is not big enough. */
-        new_eip_len = pkt_len + (int)sizeof(eip_cip_co_generic_response);
-        if(new_eip_len > request->request_capacity) {
-            int request_capacity = 0;
-
-            pdebug(DEBUG_INFO, "Request buffer too small, allocating larger buffer.");
-
-            critical_block(conn->mutex) {
-                int max_payload_size = GET_MAX_PAYLOAD_SIZE(conn);
-
-                // FIXME: no logging in a mutex!
-                // pdebug(DEBUG_DETAIL, "max payload size %d", max_payload_size);
-
-                request_capacity = (int)(max_payload_size + EIP_CIP_PREFIX_SIZE);
-            }
-
-            /* make sure it will fit. */
-            if(new_eip_len > request_capacity) {
-                pdebug(DEBUG_WARN, "something is very wrong, packet length is %d but allowable capacity is %d!", new_eip_len,
-                       request_capacity);
-                return PLCTAG_ERR_TOO_LARGE;
-            }
-
-            rc = conn_request_increase_buffer(request, request_capacity);
-            if(rc != PLCTAG_STATUS_OK) {
-                pdebug(DEBUG_WARN, "Unable to increase request buffer size to %d bytes!", request_capacity);
-                return rc;
-            }
-        }
-
-        /* point to the response buffer in a structured way. */
-        unpacked_resp = (eip_cip_co_resp *)(request->data);
-
-        /* copy the header down */
-        mem_copy(request->data, conn->data, (int)sizeof(eip_cip_co_resp));
-
-        /* size of the new packet */
-        new_eip_len = (uint16_t)(((uint8_t *)(&unpacked_resp->reply_service) + pkt_len) /* end of the packet */
-                                 - (uint8_t *)(request->data));                         /* start of the packet */
-
-        /* now copy the packet over that. */
-        mem_copy(&unpacked_resp->reply_service, pkt_start, pkt_len);
-
-        /* stitch up the packet sizes. */
-        unpacked_resp->cpf_cdi_item_length =
-            h2le16((uint16_t)(pkt_len + (int)sizeof(uint16_le))); /* extra for the connection sequence */
-        unpacked_resp->encap_length = h2le16((uint16_t)(new_eip_len - (uint16_t)sizeof(eip_encap)));
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to unpack response %d, %s!", sub_packet, plc_tag_decode_error(rc));
+        return rc;
     }
 
     pdebug(DEBUG_INFO, "Unpacked packet:");
@@ -1783,199 +1826,69 @@ int unpack_response(omron_conn_p conn, omron_request_p request, int sub_packet)
 }
 
 
-int get_payload_size(omron_request_p request) {
-    int request_data_size = 0;
-    eip_encap *header = (eip_encap *)(request->data);
-    eip_cip_co_req *co_req = NULL;
-
-    pdebug(DEBUG_DETAIL, "Starting.");
+/*
+ * select_requests_unsafe
+ *
+ * Pick the requests for the next packet and take them off the queue.  The
+ * requests are packed in queue order.  A tag only packs if the PLC supports
+ * fragmented reads or the tag has been read before, so that its response size
+ * is known.  If the PLC does not support fragmented reads, the responses must
+ * also fit in one reply.
+ *
+ * Returns the number of requests selected.  Must be called with the conn mutex held.
+ */
 
-    if(le2h16(header->encap_command) == OMRON_EIP_CONNECTED_SEND) {
-        co_req = (eip_cip_co_req *)(request->data);
-        /* get length of new request */
-        request_data_size = le2h16(co_req->cpf_cdi_item_length) - 2 /* for connection sequence ID */
-                            + 2                                     /* for multipacket offset */
-            ;
-    } else {
-        pdebug(DEBUG_DETAIL, "Not a supported type EIP packet type %d to get the payload size.", le2h16(header->encap_command));
-        request_data_size = INT_MAX;
-    }
+int select_requests_unsafe(omron_conn_p conn, omron_request_p *requests, int max_payload_size) {
+    int request_space = max_payload_size - (int)sizeof(cip_multi_req_header);
 
-    pdebug(DEBUG_DETAIL, "Done.");
+    /* -2 bytes for the msp (multi service packet) number of packets and -4 bytes for the cip response header,
+     * we later subtract 2 bytes for each packet, this is to allow for the INT offset to the packet within the msp
+     * finally we subtract 10 bytes just to give a comfort blanket as I had seen PLC_TAG_TOO_LARGE issue without it due to
+     * too much data being packed into a single packet */
+    int response_space = max_payload_size - 2 - 4 - 10;
+    int window = vector_length(conn->requests);
+    struct eip_request_info_t info[MAX_REQUESTS];
+    uint8_t selected[MAX_REQUESTS] = {0};
+    int num_selected = 0;
 
-    return request_data_size;
-}
+    if(window > MAX_REQUESTS) { window = MAX_REQUESTS; }
 
+    for(int i = 0; i < window; i++) {
+        omron_request_p request = vector_get(conn->requests, i);
 
-int pack_requests(omron_conn_p conn, omron_request_p *requests, int num_requests) {
-    eip_cip_co_req *new_req = NULL;
-    eip_cip_co_req *packed_req = NULL;
-    /* FIXME - is this the right way to check? */
-    int header_size = 0;
-    cip_multi_req_header *multi_header = NULL;
-    int current_offset = 0;
-    uint8_t *pkt_start = NULL;
-    int pkt_len = 0;
-    uint8_t *first_pkt_data = NULL;
-    uint8_t *next_pkt_data = NULL;
+        eip_get_request_info(request->data, request->request_size, &info[i]);
 
-    pdebug(DEBUG_INFO, "Starting.");
+        info[i].allow_packing = request->allow_packing;
 
-    debug_set_tag_id(requests[0]->tag_id);
+        /* keep queue order. */
+        info[i].is_read = 0;
 
-    /* get the header info from the first request. Just copy the whole thing. */
-    mem_copy(conn->data, requests[0]->data, requests[0]->request_size);
-    conn->data_size = (uint32_t)requests[0]->request_size;
+        /* the -8 bytes is the maximum padding between packets, the -2 bytes is the offset to this packet. */
+        info[i].response_size = request->supports_fragmented_read ? 0 : request->response_size + 8 + 2;
 
-    /* special case the case where there is just one request. */
-    if(num_requests == 1) {
-        pdebug(DEBUG_INFO, "Only one request, so done.");
-
-        debug_set_tag_id(0);
-
-        return PLCTAG_STATUS_OK;
+        if(!info[i].allow_packing) {
+            window = i + 1;
+            break;
+        }
     }
 
-    /* set up multi-packet header. */
-
-    header_size =
-        (int)(sizeof(cip_multi_req_header) + (sizeof(uint16_le) * (size_t)num_requests)); /* offsets for each request. */
-
-    pdebug(DEBUG_INFO, "header size %d", header_size);
-
-    packed_req = (eip_cip_co_req *)(conn->data);
-
-    /* make room in the request packet in the conn for the header. */
-    pkt_start = (uint8_t *)(&packed_req->cpf_conn_seq_num) + sizeof(packed_req->cpf_conn_seq_num);
-    pkt_len = (int)le2h16(packed_req->cpf_cdi_item_length) - (int)sizeof(packed_req->cpf_conn_seq_num);
-
-    pdebug(DEBUG_INFO, "packet 0 is of length %d.", pkt_len);
-
-    /* point to where we want the current packet to start. */
-    first_pkt_data = pkt_start + header_size;
-
-    /* move the data over to make room */
-    mem_move(first_pkt_data, pkt_start, pkt_len);
+    eip_select_requests(info, window, request_space, response_space, selected);
 
-    /* now fill in the header. Use pkt_start as it is pointing to the right location. */
-    multi_header = (cip_multi_req_header *)pkt_start;
-    multi_header->service_code = OMRON_EIP_CMD_CIP_MULTI;
-    multi_header->req_path_size = 0x02; /* length of path in words */
-    multi_header->req_path[0] = 0x20;   /* Class */
-    multi_header->req_path[1] = 0x02;   /* CM */
-    multi_header->req_path[2] = 0x24;   /* Instance */
-    multi_header->req_path[3] = 0x01;   /* #1 */
-    multi_header->request_count = h2le16((uint16_t)num_requests);
-
-    /* set up the offset for the first request. */
-    current_offset = (int)(sizeof(uint16_le) + (sizeof(uint16_le) * (size_t)num_requests));
-    multi_header->request_offsets[0] = h2le16((uint16_t)current_offset);
-
-    next_pkt_data = first_pkt_data + pkt_len;
-    current_offset = current_offset + pkt_len;
-
-    /* now process the rest of the requests. */
-    for(int i = 1; i < num_requests; i++) {
-        debug_set_tag_id(requests[i]->tag_id);
-
-        /* set up the offset */
-        multi_header->request_offsets[i] = h2le16((uint16_t)current_offset);
-
-        /* get a pointer to the request. */
-        new_req = (eip_cip_co_req *)(requests[i]->data);
-
-        /* calculate the request start and length */
-        pkt_start = (uint8_t *)(&new_req->cpf_conn_seq_num) + sizeof(new_req->cpf_conn_seq_num);
-        pkt_len = (int)le2h16(new_req->cpf_cdi_item_length) - (int)sizeof(new_req->cpf_conn_seq_num);
-
-        pdebug(DEBUG_INFO, "packet %d is of length %d.", i, pkt_len);
-
-        /* copy the request into the conn buffer. */
-        mem_copy(next_pkt_data, pkt_start, pkt_len);
-
-        /* calculate the next packet info. */
-        next_pkt_data += pkt_len;
-        current_offset += pkt_len;
+    /* copy out in queue order and take them off the queue. */
+    for(int i = 0; i < window; i++) {
+        if(selected[i]) { requests[num_selected++] = vector_get(conn->requests, i); }
     }
 
-    /* stitch up the CPF packet length */
-    packed_req->cpf_cdi_item_length = h2le16((uint16_t)(next_pkt_data - (uint8_t *)(&packed_req->cpf_conn_seq_num)));
-
-    /* stick up the EIP packet length */
-    packed_req->encap_length = h2le16((uint16_t)((size_t)(next_pkt_data - conn->data) - sizeof(eip_encap)));
-
-    /* set the total data size */
-    conn->data_size = (uint32_t)(next_pkt_data - conn->data);
-
-    debug_set_tag_id(0);
-
-    pdebug(DEBUG_INFO, "Done.");
-
-    return PLCTAG_STATUS_OK;
-}
-
-
-int prepare_request(omron_conn_p conn) {
-    eip_encap *encap = NULL;
-    int payload_size = 0;
-
-    pdebug(DEBUG_INFO, "Starting.");
-
-    encap = (eip_encap *)(conn->data);
-    payload_size = (int)conn->data_size - (int)sizeof(eip_encap);
-
-    if(!conn) {
-        pdebug(DEBUG_WARN, "Called with null conn!");
-        return PLCTAG_ERR_NULL_PTR;
-    }
-
-    /* fill in the fields of the request. */
-
-    encap->encap_length = h2le16((uint16_t)payload_size);
-    encap->encap_conn_handle = h2le32(conn->conn_handle);
-    encap->encap_status = h2le32(0);
-    encap->encap_options = h2le32(0);
-
-    /* set up the conn sequence ID for this transaction */
-    if(le2h16(encap->encap_command) == OMRON_EIP_UNCONNECTED_SEND) {
-        /* get new ID */
-        conn->conn_seq_id++;
-
-        // request->conn_seq_id = conn->conn_seq_id;
-        encap->encap_sender_context = h2le64(conn->conn_seq_id); /* link up the request seq ID and the packet seq ID */
-
-        pdebug(DEBUG_INFO, "Preparing unconnected packet with conn sequence ID %llx", conn->conn_seq_id);
-    } else if(le2h16(encap->encap_command) == OMRON_EIP_CONNECTED_SEND) {
-        eip_cip_co_req *conn_req = (eip_cip_co_req *)(conn->data);
-
-        pdebug(DEBUG_DETAIL, "cpf_targ_conn_id=%x", conn->targ_connection_id);
-
-        /* set up the connection information */
-        conn_req->cpf_targ_conn_id = h2le32(conn->targ_connection_id);
-
-        conn->conn_seq_num++;
-        conn_req->cpf_conn_seq_num = h2le16(conn->conn_seq_num);
-
-        pdebug(DEBUG_INFO, "Preparing connected packet with connection ID %x and sequence ID %u(%x)", conn->orig_connection_id,
-               conn->conn_seq_num, conn->conn_seq_num);
-    } else {
-        pdebug(DEBUG_WARN, "Unsupported packet type %x!", le2h16(encap->encap_command));
-        return PLCTAG_ERR_UNSUPPORTED;
+    for(int i = window - 1; i >= 0; i--) {
+        if(selected[i]) { vector_remove(conn->requests, i); }
     }
 
-    /* display the data */
-    pdebug(DEBUG_INFO, "Prepared packet of size %d", conn->data_size);
-    pdebug_dump_bytes(DEBUG_INFO, conn->data, (int)conn->data_size);
-
-    pdebug(DEBUG_INFO, "Done.");
-
-    return PLCTAG_STATUS_OK;
+    return num_selected;
 }
 
 
 int send_eip_request(omron_conn_p conn, int timeout) {
     int rc = PLCTAG_STATUS_OK;
-    int64_t timeout_time = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -1984,52 +1897,14 @@ int send_eip_request(omron_conn_p conn, int timeout) {
         return PLCTAG_ERR_NULL_PTR;
     }
 
-    if(timeout > 0) {
-        timeout_time = time_ms() + timeout;
-    } else {
-        timeout_time = INT64_MAX;
-    }
-
-    pdebug(DEBUG_INFO, "Sending packet of size %d", conn->data_size);
-    pdebug_dump_bytes(DEBUG_INFO, conn->data, (int)(conn->data_size));
-
-    conn->data_offset = 0;
     conn->packet_count++;
 
-    /* send the packet */
-    do {
-        rc = socket_write(conn->sock, conn->data + conn->data_offset, (int)conn->data_size - (int)conn->data_offset,
-                          SOCKET_WAIT_TIMEOUT_MS);
-
-        if(rc >= 0) {
-            conn->data_offset += (uint32_t)rc;
-        } else {
-            if(rc == PLCTAG_ERR_TIMEOUT) {
-                pdebug(DEBUG_DETAIL, "Socket not yet ready to write.");
-                rc = 0;
-            }
-        }
+    rc = eip_send_packet(conn->sock, conn->data, (int)conn->data_size, &conn->terminating, timeout);
+    if(rc != PLCTAG_STATUS_OK) { return rc; }
 
-        /* give up the CPU if we still are looping */
-        // if(!conn->terminating && rc >= 0 && conn->data_offset < conn->data_size) {
-        //     sleep_ms(1);
-        // }
-    } while(!conn->terminating && rc >= 0 && conn->data_offset < conn->data_size && timeout_time > time_ms());
+    conn->data_offset = conn->data_size;
 
-    if(conn->terminating) {
-        pdebug(DEBUG_WARN, "Connection is terminating.");
-        return PLCTAG_ERR_ABORT;
-    }
-
-    if(rc < 0) {
-        pdebug(DEBUG_WARN, "Error, %d, writing socket!", rc);
-        return rc;
-    }
-
-    if(timeout_time <= time_ms()) {
-        pdebug(DEBUG_WARN, "Timed out waiting to send data!");
-        return PLCTAG_ERR_TIMEOUT;
-    }
+    metrics_record_packet_sent(&conn->metrics, conn->data_size);
 
     pdebug(DEBUG_INFO, "Done.");
 
@@ -2045,9 +1920,8 @@ int send_eip_request(omron_conn_p conn, int timeout) {
  * punt.
  */
 int recv_eip_response(omron_conn_p conn, int timeout) {
-    uint32_t data_needed = 0;
+    int data_size = 0;
     int rc = PLCTAG_STATUS_OK;
-    int64_t timeout_time = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -2056,68 +1930,17 @@ int recv_eip_response(omron_conn_p conn, int timeout) {
         return PLCTAG_ERR_NULL_PTR;
     }
 
-
-    if(timeout > 0) {
-        timeout_time = time_ms() + timeout;
-    } else {
-        timeout_time = INT64_MAX;
-    }
-
     conn->data_offset = 0;
     conn->data_size = 0;
-    data_needed = sizeof(eip_encap);
-
-    do {
-        rc = socket_read(conn->sock, conn->data + conn->data_offset, (int)(data_needed - conn->data_offset),
-                         SOCKET_WAIT_TIMEOUT_MS);
-
-        if(rc >= 0) {
-            conn->data_offset += (uint32_t)rc;
-
-            /*pdebug_dump_bytes(conn->debug, conn->data, conn->data_offset);*/
-
-            /* recalculate the amount of data needed if we have just completed the read of an encap header */
-            if(conn->data_offset >= sizeof(eip_encap)) {
-                data_needed = (uint32_t)(sizeof(eip_encap) + le2h16(((eip_encap *)(conn->data))->encap_length));
-
-                if(data_needed > conn->data_capacity) {
-                    pdebug(DEBUG_WARN, "Packet response (%d) is larger than possible buffer size (%d)!", data_needed,
-                           conn->data_capacity);
-                    return PLCTAG_ERR_TOO_LARGE;
-                }
-            }
-        } else {
-            if(rc == PLCTAG_ERR_TIMEOUT) {
-                pdebug(DEBUG_DETAIL, "Socket not yet ready to read.");
-            } else {
-                /* error! */
-                pdebug(DEBUG_WARN, "Error reading socket! rc=%d", rc);
-                return rc;
-            }
-        }
-    } while(!conn->terminating && conn->data_offset < data_needed && timeout_time > time_ms());
-
-    if(conn->terminating) {
-        pdebug(DEBUG_INFO, "Connection is terminating, returning...");
-        return PLCTAG_ERR_ABORT;
-    }
 
-    if(timeout_time <= time_ms()) {
-        pdebug(DEBUG_WARN, "Timed out waiting for data to read!");
-        return PLCTAG_ERR_TIMEOUT;
-    }
+    rc = eip_recv_packet(conn->sock, conn->data, (int)conn->data_capacity, &data_size, &conn->terminating, timeout);
+    if(rc != PLCTAG_STATUS_OK && rc != PLCTAG_ERR_BAD_STATUS) { return rc; }
 
     conn->resp_seq_id = le2h64(((eip_encap *)(conn->data))->encap_sender_context);
-    conn->data_size = data_needed;
-
-    rc = PLCTAG_STATUS_OK;
-
-    pdebug(DEBUG_INFO, "request received all needed data (%d bytes of %d).", conn->data_offset, data_needed);
-
-    pdebug_dump_bytes(DEBUG_INFO, conn->data, (int)(conn->data_offset));
+    conn->data_size = (uint32_t)data_size;
+    conn->data_offset = (uint32_t)data_size;
 
-    /* check status. */
-    if(le2h32(((eip_encap *)(conn->data))->encap_status) != OMRON_EIP_OK) { rc = PLCTAG_ERR_BAD_STATUS; }
+    metrics_record_packet_received(&conn->metrics, conn->data_size);
 
     pdebug(DEBUG_INFO, "Done.");
 
@@ -2151,6 +1974,8 @@ int perform_forward_close(omron_conn_p conn) {
 
 
 int send_forward_open_request(omron_conn_p conn) {
+    struct eip_forward_open_t fo;
+    int data_size = 0;
     int rc = PLCTAG_STATUS_OK;
     uint16_t max_payload;
 
@@ -2166,90 +1991,20 @@ int send_forward_open_request(omron_conn_p conn) {
 
     pdebug(DEBUG_DETAIL, "Set Forward Open maximum payload size guess to %d bytes.", conn->max_payload_guess);
 
-    if(conn->only_use_old_forward_open) {
-        rc = send_old_forward_open_request(conn);
-    } else {
-        rc = send_extended_forward_open_request(conn);
-    }
-
-    pdebug(DEBUG_INFO, "Done");
-
-    return rc;
-}
-
-
-int send_old_forward_open_request(omron_conn_p conn) {
-    eip_forward_open_request_t *fo = NULL;
-    uint8_t *data;
-    int rc = PLCTAG_STATUS_OK;
-
-    pdebug(DEBUG_INFO, "Starting");
-
-    mem_set(conn->data, 0, (int)(sizeof(*fo) + conn->conn_path_size));
-
-    fo = (eip_forward_open_request_t *)(conn->data);
-
-    /* point to the end of the struct */
-    data = (conn->data) + sizeof(eip_forward_open_request_t);
-
-    /* set up the path information. */
-    mem_copy(data, conn->conn_path, conn->conn_path_size);
-    data += conn->conn_path_size;
-
-    /* fill in the static parts */
-
-    /* encap header parts */
-    fo->encap_command = h2le16(OMRON_EIP_UNCONNECTED_SEND); /* 0x006F EIP Send RR Data command */
-    fo->encap_length =
-        h2le16((uint16_t)(data - (uint8_t *)(&fo->interface_handle))); /* total length of packet except for encap header */
-    fo->encap_conn_handle = h2le32(conn->conn_handle);
-    fo->encap_sender_context = h2le64(++conn->conn_seq_id);
-    fo->router_timeout = h2le16(1); /* one second is enough ? */
-
-    /* CPF parts */
-    fo->cpf_item_count = h2le16(2);                     /* ALWAYS 2 */
-    fo->cpf_nai_item_type = h2le16(OMRON_EIP_ITEM_NAI); /* null address item type */
-    fo->cpf_nai_item_length = h2le16(0);                /* no data, zero length */
-    fo->cpf_udi_item_type = h2le16(OMRON_EIP_ITEM_UDI); /* unconnected data item, 0x00B2 */
-    fo->cpf_udi_item_length =
-        h2le16((uint16_t)(data - (uint8_t *)(&fo->cm_service_code))); /* length of remaining data in UC data item */
-
-    /* Connection Manager parts */
-    fo->cm_service_code = OMRON_EIP_CMD_FORWARD_OPEN; /* 0x54 Forward Open Request or 0x5B for Forward Open Extended */
-    fo->cm_req_path_size = 2;                         /* size of path in 16-bit words */
-    fo->cm_req_path[0] = 0x20;                        /* class */
-    fo->cm_req_path[1] = 0x06;                        /* CM class */
-    fo->cm_req_path[2] = 0x24;                        /* instance */
-    fo->cm_req_path[3] = 0x01;                        /* instance 1 */
-
-    /* Forward Open Params */
-    fo->secs_per_tick = OMRON_EIP_SECS_PER_TICK;                 /* seconds per tick, no used? */
-    fo->timeout_ticks = OMRON_EIP_TIMEOUT_TICKS;                 /* timeout = srd_secs_per_tick * src_timeout_ticks, not used? */
-    fo->orig_to_targ_conn_id = h2le32(0);                        /* is this right?  Our connection id on the other machines? */
-    fo->targ_to_orig_conn_id = h2le32(conn->orig_connection_id); /* Our connection id in the other direction. */
     /* this might need to be globally unique */
-    fo->conn_serial_number = h2le16(++(conn->conn_serial_number)); /* our connection SEQUENCE number. */
-    fo->orig_vendor_id = h2le16(OMRON_EIP_VENDOR_ID);              /* our unique :-) vendor ID */
-    fo->orig_serial_number = h2le32(OMRON_EIP_VENDOR_SN);          /* our serial number. */
-    fo->conn_timeout_multiplier = OMRON_EIP_TIMEOUT_MULTIPLIER;    /* timeout = mult * RPI */
-
-    fo->orig_to_targ_rpi = h2le32(OMRON_EIP_RPI); /* us to target RPI - Request Packet Interval in microseconds */
-
-    fo->orig_to_targ_conn_params = h2le16(
-        OMRON_EIP_CONN_PARAM | conn->max_payload_guess); /* packet size and some other things, based on protocol/cpu type */
+    ++(conn->conn_serial_number);
 
-    fo->targ_to_orig_rpi = h2le32(OMRON_EIP_RPI); /* target to us RPI - not really used for explicit messages? */
+    fill_forward_open(conn, &fo);
 
-    fo->targ_to_orig_conn_params = h2le16(
-        OMRON_EIP_CONN_PARAM | conn->max_payload_guess); /* packet size and some other things, based on protocol/cpu type */
-
-    fo->transport_class = OMRON_EIP_TRANSPORT_CLASS_T3; /* 0xA3, server transport, class 3, application trigger */
-    fo->path_size = conn->conn_path_size / 2;           /* size in 16-bit words */
+    rc = eip_build_forward_open(conn->data, (int)conn->data_capacity, &fo, &data_size);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to build Forward Open request %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
 
-    /* set the size of the request */
-    conn->data_size = (uint32_t)(data - (conn->data));
+    conn->data_size = (uint32_t)data_size;
 
-    rc = send_eip_request(conn, 0);
+    rc = send_eip_request(conn, CONN_DEFAULT_TIMEOUT);
 
     pdebug(DEBUG_INFO, "Done");
 
@@ -2257,83 +2012,29 @@ int send_old_forward_open_request(omron_conn_p conn) {
 }
 
 
-/* new version of Forward Open */
-int send_extended_forward_open_request(omron_conn_p conn) {
-    eip_forward_open_request_ex_t *fo = NULL;
-    uint8_t *data;
-    int rc = PLCTAG_STATUS_OK;
-
-    pdebug(DEBUG_INFO, "Starting");
-
-    mem_set(conn->data, 0, (int)(sizeof(*fo) + conn->conn_path_size));
-
-    fo = (eip_forward_open_request_ex_t *)(conn->data);
-
-    /* point to the end of the struct */
-    data = (conn->data) + sizeof(*fo);
-
-    /* set up the path information. */
-    mem_copy(data, conn->conn_path, conn->conn_path_size);
-    data += conn->conn_path_size;
-
-    /* fill in the static parts */
-
-    /* encap header parts */
-    fo->encap_command = h2le16(OMRON_EIP_UNCONNECTED_SEND); /* 0x006F EIP Send RR Data command */
-    fo->encap_length =
-        h2le16((uint16_t)(data - (uint8_t *)(&fo->interface_handle))); /* total length of packet except for encap header */
-    fo->encap_conn_handle = h2le32(conn->conn_handle);
-    fo->encap_sender_context = h2le64(++conn->conn_seq_id);
-    fo->router_timeout = h2le16(1); /* one second is enough ? */
-
-    /* CPF parts */
-    fo->cpf_item_count = h2le16(2);                     /* ALWAYS 2 */
-    fo->cpf_nai_item_type = h2le16(OMRON_EIP_ITEM_NAI); /* null address item type */
-    fo->cpf_nai_item_length = h2le16(0);                /* no data, zero length */
-    fo->cpf_udi_item_type = h2le16(OMRON_EIP_ITEM_UDI); /* unconnected data item, 0x00B2 */
-    fo->cpf_udi_item_length =
-        h2le16((uint16_t)(data - (uint8_t *)(&fo->cm_service_code))); /* length of remaining data in UC data item */
-
-    /* Connection Manager parts */
-    fo->cm_service_code = OMRON_EIP_CMD_FORWARD_OPEN_EX; /* 0x54 Forward Open Request or 0x5B for Forward Open Extended */
-    fo->cm_req_path_size = 2;                            /* size of path in 16-bit words */
-    fo->cm_req_path[0] = 0x20;                           /* class */
-    fo->cm_req_path[1] = 0x06;                           /* CM class */
-    fo->cm_req_path[2] = 0x24;                           /* instance */
-    fo->cm_req_path[3] = 0x01;                           /* instance 1 */
-
-    /* Forward Open Params */
-    fo->secs_per_tick = OMRON_EIP_SECS_PER_TICK;                 /* seconds per tick, no used? */
-    fo->timeout_ticks = OMRON_EIP_TIMEOUT_TICKS;                 /* timeout = srd_secs_per_tick * src_timeout_ticks, not used? */
-    fo->orig_to_targ_conn_id = h2le32(0);                        /* is this right?  Our connection id on the other machines? */
-    fo->targ_to_orig_conn_id = h2le32(conn->orig_connection_id); /* Our connection id in the other direction. */
-    /* this might need to be globally unique */
-    fo->conn_serial_number = h2le16(++(conn->conn_serial_number)); /* our connection ID/serial number. */
-    fo->orig_vendor_id = h2le16(OMRON_EIP_VENDOR_ID);              /* our unique :-) vendor ID */
-    fo->orig_serial_number = h2le32(OMRON_EIP_VENDOR_SN);          /* our serial number. */
-    fo->conn_timeout_multiplier = OMRON_EIP_TIMEOUT_MULTIPLIER;    /* timeout = mult * RPI */
-    fo->orig_to_targ_rpi = h2le32(OMRON_EIP_RPI); /* us to target RPI - Request Packet Interval in microseconds */
-    fo->orig_to_targ_conn_params_ex = h2le32(
-        OMRON_EIP_CONN_PARAM_EX | conn->max_payload_guess); /* packet size and some other things, based on protocol/cpu type */
-    fo->targ_to_orig_rpi = h2le32(OMRON_EIP_RPI);           /* target to us RPI - not really used for explicit messages? */
-    fo->targ_to_orig_conn_params_ex = h2le32(
-        OMRON_EIP_CONN_PARAM_EX | conn->max_payload_guess); /* packet size and some other things, based on protocol/cpu type */
-    fo->transport_class = OMRON_EIP_TRANSPORT_CLASS_T3;     /* 0xA3, server transport, class 3, application trigger */
-    fo->path_size = conn->conn_path_size / 2;               /* size in 16-bit words */
-
-    /* set the size of the request */
-    conn->data_size = (uint32_t)(data - (conn->data));
-
-    rc = send_eip_request(conn, CONN_DEFAULT_TIMEOUT);
-
-    pdebug(DEBUG_INFO, "Done");
+/*
+ * fill_forward_open
+ *
+ * What the shared Forward Open and Forward Close builders need from the connection.
+ */
 
-    return rc;
+void fill_forward_open(omron_conn_p conn, struct eip_forward_open_t *fo) {
+    mem_set(fo, 0, sizeof(*fo));
+
+    fo->session_handle = conn->conn_handle;
+    fo->sender_context = ++conn->conn_seq_id;
+    fo->orig_connection_id = conn->orig_connection_id;
+    fo->conn_serial_number = conn->conn_serial_number;
+    fo->use_extended = !conn->only_use_old_forward_open;
+    fo->max_payload = conn->max_payload_guess;
+    fo->conn_path = conn->conn_path;
+    fo->conn_path_size = conn->conn_path_size;
 }
 
 
 int receive_forward_open_response(omron_conn_p conn) {
-    eip_forward_open_response_t *fo_resp;
+    uint8_t *cip_status = NULL;
+    uint16_t supported_size = 0;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting");
@@ -2344,69 +2045,21 @@ int receive_forward_open_response(omron_conn_p conn) {
         return rc;
     }
 
-    fo_resp = (eip_forward_open_response_t *)(conn->data);
-
-    do {
-        if(le2h16(fo_resp->encap_command) != OMRON_EIP_UNCONNECTED_SEND) {
-            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", fo_resp->encap_command);
-            rc = PLCTAG_ERR_BAD_DATA;
-            break;
-        }
-
-        if(le2h32(fo_resp->encap_status) != OMRON_EIP_OK) {
-            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", fo_resp->encap_status);
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
-        if(fo_resp->general_status != OMRON_EIP_OK) {
-            pdebug(DEBUG_WARN, "Forward Open command failed, response code: %s (%d)",
-                   CIP.decode_cip_error_short(&fo_resp->general_status), fo_resp->general_status);
-            if(fo_resp->general_status == OMRON_CIP_ERR_UNSUPPORTED_SERVICE) {
-                /* this type of command is not supported! */
-                pdebug(DEBUG_WARN, "Received CIP command unsupported error from the PLC!");
-                rc = PLCTAG_ERR_UNSUPPORTED;
-            } else {
-                rc = PLCTAG_ERR_REMOTE_ERR;
-
-                if(fo_resp->general_status == 0x01 && fo_resp->status_size >= 2) {
-                    /* we might have an error that tells us the actual size to use. */
-                    uint8_t *data = &fo_resp->status_size;
-                    int extended_status = data[1] | (data[2] << 8);
-                    uint16_t supported_size = (uint16_t)((uint16_t)data[3] | (uint16_t)((uint16_t)data[4] << (uint16_t)8));
-
-                    if(extended_status == 0x109) { /* MAGIC */
-                        pdebug(DEBUG_WARN, "Error from forward open request, unsupported size, but size %d is supported.",
-                               supported_size);
-                        conn->max_payload_guess = supported_size;
-                        rc = PLCTAG_ERR_TOO_LARGE;
-                    } else if(extended_status == 0x100) { /* MAGIC */
-                        pdebug(DEBUG_WARN, "Error from forward open request, duplicate connection ID.  Need to try again.");
-                        rc = PLCTAG_ERR_DUPLICATE;
-                    } else {
-                        pdebug(DEBUG_WARN, "CIP extended error %s (%s)!", CIP.decode_cip_error_short(&fo_resp->general_status),
-                               CIP.decode_cip_error_long(&fo_resp->general_status));
-                    }
-                } else {
-                    pdebug(DEBUG_WARN, "CIP error code %s (%s)!", CIP.decode_cip_error_short(&fo_resp->general_status),
-                           CIP.decode_cip_error_long(&fo_resp->general_status));
-                }
-            }
-
-            break;
-        }
-
-        /* success! */
-        conn->targ_connection_id = le2h32(fo_resp->orig_to_targ_conn_id);
-        conn->orig_connection_id = le2h32(fo_resp->targ_to_orig_conn_id);
+    rc = eip_check_forward_open_response(conn->data, (int)conn->data_size, &conn->targ_connection_id,
+                                         &conn->orig_connection_id, &supported_size, &cip_status);
+    if(rc == PLCTAG_ERR_TOO_LARGE) {
+        conn->max_payload_guess = supported_size;
+    } else if(rc != PLCTAG_STATUS_OK && cip_status) {
+        pdebug(DEBUG_WARN, "Forward Open command failed, response code: %s (%s)!", CIP.decode_cip_error_short(cip_status),
+               CIP.decode_cip_error_long(cip_status));
+    }
 
+    if(rc == PLCTAG_STATUS_OK) {
         conn->max_payload_size = conn->max_payload_guess;
 
         pdebug(DEBUG_INFO, "ForwardOpen succeeded with our connection ID %x and the PLC connection ID %x with packet size %u.",
                conn->orig_connection_id, conn->targ_connection_id, conn->max_payload_size);
-
-        rc = PLCTAG_STATUS_OK;
-    } while(0);
+    }
 
     pdebug(DEBUG_INFO, "Done.");
 
@@ -2415,61 +2068,24 @@ int receive_forward_open_response(omron_conn_p conn) {
 
 
 int send_forward_close_req(omron_conn_p conn) {
-    eip_forward_close_req_t *fc;
-    uint8_t *data;
+    struct eip_forward_open_t fo;
+    int data_size = 0;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting");
 
-    fc = (eip_forward_close_req_t *)(conn->data);
-
-    /* point to the end of the struct */
-    data = (conn->data) + sizeof(*fc);
-
-    /* set up the path information. */
-    mem_copy(data, conn->conn_path, conn->conn_path_size);
-    data += conn->conn_path_size;
-
-    /* FIXME DEBUG */
     pdebug(DEBUG_DETAIL, "Forward Close connection path:");
     pdebug_dump_bytes(DEBUG_DETAIL, conn->conn_path, conn->conn_path_size);
 
-    /* fill in the static parts */
-
-    /* encap header parts */
-    fc->encap_command = h2le16(OMRON_EIP_UNCONNECTED_SEND); /* 0x006F EIP Send RR Data command */
-    fc->encap_length =
-        h2le16((uint16_t)(data - (uint8_t *)(&fc->interface_handle))); /* total length of packet except for encap header */
-    fc->encap_sender_context = h2le64(++conn->conn_seq_id);
-    fc->router_timeout = h2le16(1); /* one second is enough ? */
-
-    /* CPF parts */
-    fc->cpf_item_count = h2le16(2);                     /* ALWAYS 2 */
-    fc->cpf_nai_item_type = h2le16(OMRON_EIP_ITEM_NAI); /* null address item type */
-    fc->cpf_nai_item_length = h2le16(0);                /* no data, zero length */
-    fc->cpf_udi_item_type = h2le16(OMRON_EIP_ITEM_UDI); /* unconnected data item, 0x00B2 */
-    fc->cpf_udi_item_length =
-        h2le16((uint16_t)(data - (uint8_t *)(&fc->cm_service_code))); /* length of remaining data in UC data item */
-
-    /* Connection Manager parts */
-    fc->cm_service_code = OMRON_EIP_CMD_FORWARD_CLOSE; /* 0x4E Forward Close Request */
-    fc->cm_req_path_size = 2;                          /* size of path in 16-bit words */
-    fc->cm_req_path[0] = 0x20;                         /* class */
-    fc->cm_req_path[1] = 0x06;                         /* CM class */
-    fc->cm_req_path[2] = 0x24;                         /* instance */
-    fc->cm_req_path[3] = 0x01;                         /* instance 1 */
-
-    /* Forward Open Params */
-    fc->secs_per_tick = OMRON_EIP_SECS_PER_TICK;               /* seconds per tick, no used? */
-    fc->timeout_ticks = OMRON_EIP_TIMEOUT_TICKS;               /* timeout = srd_secs_per_tick * src_timeout_ticks, not used? */
-    fc->conn_serial_number = h2le16(conn->conn_serial_number); /* our connection SEQUENCE number. */
-    fc->orig_vendor_id = h2le16(OMRON_EIP_VENDOR_ID);          /* our unique :-) vendor ID */
-    fc->orig_serial_number = h2le32(OMRON_EIP_VENDOR_SN);      /* our serial number. */
-    fc->path_size = conn->conn_path_size / 2;                  /* size in 16-bit words */
-    fc->reserved = (uint8_t)0;                                 /* padding for the path. */
-
-    /* set the size of the request */
-    conn->data_size = (uint32_t)(data - (conn->data));
+    fill_forward_open(conn, &fo);
+
+    rc = eip_build_forward_close(conn->data, (int)conn->data_capacity, &fo, &data_size);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to build Forward Close request %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    conn->data_size = (uint32_t)data_size;
 
     rc = send_eip_request(conn, 100);
 
@@ -2480,7 +2096,7 @@ int send_forward_close_req(omron_conn_p conn) {
 
 
 int recv_forward_close_resp(omron_conn_p conn) {
-    eip_forward_close_resp_t *fo_resp;
+    uint8_t *cip_status = NULL;
     int rc = PLCTAG_STATUS_OK;
 
     pdebug(DEBUG_INFO, "Starting");
@@ -2491,31 +2107,12 @@ int recv_forward_close_resp(omron_conn_p conn) {
         return rc;
     }
 
-    fo_resp = (eip_forward_close_resp_t *)(conn->data);
-
-    do {
-        if(le2h16(fo_resp->encap_command) != OMRON_EIP_UNCONNECTED_SEND) {
-            pdebug(DEBUG_WARN, "Unexpected EIP packet type received: %d!", fo_resp->encap_command);
-            rc = PLCTAG_ERR_BAD_DATA;
-            break;
-        }
-
-        if(le2h32(fo_resp->encap_status) != OMRON_EIP_OK) {
-            pdebug(DEBUG_WARN, "EIP command failed, response code: %d", fo_resp->encap_status);
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
-        if(fo_resp->general_status != OMRON_EIP_OK) {
-            pdebug(DEBUG_WARN, "Forward Close command failed, response code: %d", fo_resp->general_status);
-            rc = PLCTAG_ERR_REMOTE_ERR;
-            break;
-        }
-
+    rc = eip_check_forward_close_response(conn->data, (int)conn->data_size, &cip_status);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Forward Close command failed, response code: %d", (cip_status ? *cip_status : -1));
+    } else {
         pdebug(DEBUG_INFO, "Connection close succeeded.");
-
-        rc = PLCTAG_STATUS_OK;
-    } while(0);
+    }
 
     pdebug(DEBUG_INFO, "Done.");
 
@@ -2613,3 +2210,429 @@ int conn_request_increase_buffer(omron_request_p request, int new_capacity) {
 
     return PLCTAG_STATUS_OK;
 }
+
+
+int64_t get_type_cache_key(uint8_t *encoded_name, int encoded_name_size) {
+    return (int64_t)hash(encoded_name, (size_t)(unsigned int)encoded_name_size, 0);
+}
+
+
+conn_type_entry_p find_type_entry_unsafe(omron_conn_p conn, uint8_t *encoded_name, int encoded_name_size) {
+    conn_type_entry_p entry = hashtable_get(conn->type_cache, get_type_cache_key(encoded_name, encoded_name_size));
+
+    while(entry
+          && (entry->encoded_name_size != encoded_name_size
+              || mem_cmp(entry->encoded_name, entry->encoded_name_size, encoded_name, encoded_name_size) != 0)) {
+        entry = entry->next_same_key;
+    }
+
+    return entry;
+}
+
+
+/* add or update the type of a name.  Once the cache is full the least recently used name is dropped. */
+int cache_type_unsafe(omron_conn_p conn, uint8_t *encoded_name, int encoded_name_size, uint8_t *encoded_type_info,
+                      int encoded_type_info_size, int elem_size) {
+    conn_type_entry_p entry = find_type_entry_unsafe(conn, encoded_name, encoded_name_size);
+
+    if(!entry) {
+        int64_t key = get_type_cache_key(encoded_name, encoded_name_size);
+        conn_type_entry_p same_key = NULL;
+        int rc = PLCTAG_STATUS_OK;
+
+        if(conn->num_types >= CONN_MAX_TYPE_CACHE) { remove_type_entry_unsafe(conn, conn->oldest_type); }
+
+        entry = mem_alloc((int)sizeof(*entry));
+        if(!entry) { return PLCTAG_ERR_NO_MEM; }
+
+        /* names that hash the same are chained behind the newest one. */
+        same_key = hashtable_remove(conn->type_cache, key);
+
+        rc = hashtable_put(conn->type_cache, key, entry);
+        if(rc != PLCTAG_STATUS_OK) {
+            if(same_key) { hashtable_put(conn->type_cache, key, same_key); }
+            mem_free(entry);
+            return rc;
+        }
+
+        entry->key = key;
+        entry->next_same_key = same_key;
+        mem_copy(entry->encoded_name, encoded_name, encoded_name_size);
+        entry->encoded_name_size = encoded_name_size;
+
+        conn->num_types++;
+    }
+
+    mem_copy(entry->encoded_type_info, encoded_type_info, encoded_type_info_size);
+    entry->encoded_type_info_size = encoded_type_info_size;
+    entry->elem_size = elem_size;
+
+    use_type_entry_unsafe(conn, entry);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/* move the entry to the newest end of the use order. */
+void use_type_entry_unsafe(omron_conn_p conn, conn_type_entry_p entry) {
+    if(conn->newest_type == entry) { return; }
+
+    /* unlink it if it is already in the list. */
+    if(entry->older) { entry->older->newer = entry->newer; }
+    if(entry->newer) { entry->newer->older = entry->older; }
+    if(conn->oldest_type == entry) { conn->oldest_type = entry->newer; }
+
+    entry->older = conn->newest_type;
+    entry->newer = NULL;
+
+    if(conn->newest_type) { conn->newest_type->newer = entry; }
+    conn->newest_type = entry;
+
+    if(!conn->oldest_type) { conn->oldest_type = entry; }
+}
+
+
+void remove_type_entry_unsafe(omron_conn_p conn, conn_type_entry_p entry) {
+    conn_type_entry_p head = hashtable_get(conn->type_cache, entry->key);
+
+    if(head == entry) {
+        hashtable_remove(conn->type_cache, entry->key);
+        if(entry->next_same_key) { hashtable_put(conn->type_cache, entry->key, entry->next_same_key); }
+    } else {
+        while(head && head->next_same_key != entry) { head = head->next_same_key; }
+        if(head) { head->next_same_key = entry->next_same_key; }
+    }
+
+    if(entry->older) { entry->older->newer = entry->newer; }
+    if(entry->newer) { entry->newer->older = entry->older; }
+    if(conn->oldest_type == entry) { conn->oldest_type = entry->newer; }
+    if(conn->newest_type == entry) { conn->newest_type = entry->older; }
+
+    conn->num_types--;
+
+    mem_free(entry);
+}
+
+
+void clear_type_cache_unsafe(omron_conn_p conn) {
+    while(conn->oldest_type) { remove_type_entry_unsafe(conn, conn->oldest_type); }
+}
+
+
+/*
+ * tag_table_tickler
+ *
+ * Move the variable table load along.  The table requests go through the
+ * request queue like tag requests, so they are packed and pipelined, but no
+ * more than CONN_TAG_TABLE_WINDOW of them are queued at once.  Only called
+ * from the conn thread.
+ */
+
+void tag_table_tickler(omron_conn_p conn) {
+    struct conn_tag_table_t *table = NULL;
+    int state = CONN_TAG_TABLE_NONE;
+    int rc = PLCTAG_STATUS_OK;
+
+    critical_block(conn->mutex) { state = conn->tag_table_state; }
+
+    if(state != CONN_TAG_TABLE_LOADING) { return; }
+
+    if(!conn->tag_table) {
+        pdebug(DEBUG_INFO, "Loading the variable table of the PLC.");
+
+        conn->tag_table = mem_alloc((int)sizeof(*(conn->tag_table)));
+        if(!conn->tag_table) {
+            pdebug(DEBUG_WARN, "Unable to allocate the variable table state!");
+            rc = PLCTAG_ERR_NO_MEM;
+        } else {
+            rc = queue_tag_table_request(conn, &conn->tag_table->requests[0], TAG_TABLE_GET_COUNT, 0);
+            if(rc == PLCTAG_STATUS_OK) { conn->tag_table->num_requests = 1; }
+        }
+    }
+
+    table = conn->tag_table;
+
+    /* take in the replies, a name reply reuses its slot to ask for the type. */
+    for(int i = 0; table && rc == PLCTAG_STATUS_OK && i < table->num_requests; i++) {
+        struct conn_tag_table_request_t *table_req = &table->requests[i];
+        int resp_received = 0;
+
+        spin_block(&table_req->req->lock) { resp_received = table_req->req->resp_received; }
+
+        if(!resp_received) { continue; }
+
+        rc = handle_tag_table_reply(conn, table, table_req);
+
+        if(rc == PLCTAG_STATUS_OK && table_req->req == NULL) {
+            /* the slot is done, fill the hole with the last one. */
+            table->num_requests--;
+            *table_req = table->requests[table->num_requests];
+            i--;
+        }
+    }
+
+    /* keep the window full of name requests. */
+    while(table && rc == PLCTAG_STATUS_OK && table->num_requests < CONN_TAG_TABLE_WINDOW
+          && table->next_instance > 0 && table->next_instance <= table->max_instance) {
+        rc = queue_tag_table_request(conn, &table->requests[table->num_requests], TAG_TABLE_GET_NAME, table->next_instance);
+        if(rc == PLCTAG_STATUS_OK) {
+            table->num_requests++;
+            table->next_instance++;
+        }
+    }
+
+    if(rc == PLCTAG_STATUS_OK && table && table->num_requests > 0) { return; }
+
+    if(rc == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_INFO, "Loaded %d variable types from %" PRIu32 " table entries.", table->num_types, table->max_instance);
+    } else {
+        pdebug(DEBUG_WARN, "Unable to load the variable table, %s.  Tags will read their types.", plc_tag_decode_error(rc));
+    }
+
+    release_tag_table(conn);
+
+    critical_block(conn->mutex) {
+        conn->tag_table_state = (rc == PLCTAG_STATUS_OK ? CONN_TAG_TABLE_LOADED : CONN_TAG_TABLE_FAILED);
+    }
+
+    /* let the waiting tags look in the cache. */
+    plc_tag_tickler_wake();
+}
+
+
+/* build one Get Attributes All request of the variable table and queue it. */
+int queue_tag_table_request(omron_conn_p conn, struct conn_tag_table_request_t *table_req, int step, uint32_t instance) {
+    eip_cip_co_req *cip = NULL;
+    uint8_t *data = NULL;
+    omron_request_p req = NULL;
+    int rc = PLCTAG_STATUS_OK;
+
+    rc = conn_create_request(conn, 0, &req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to get a new request, %s!", plc_tag_decode_error(rc));
+        return rc;
+    }
+
+    cip = (eip_cip_co_req *)(req->data);
+    data = (req->data) + sizeof(eip_cip_co_req);
+
+    *data = GET_ATTRIBUTES_ALL;
+    data++;
+
+    if(step == TAG_TABLE_GET_TYPE) {
+        /* the encoded name starts with its length in words. */
+        mem_copy(data, table_req->encoded_name, table_req->encoded_name_size);
+        data += table_req->encoded_name_size;
+
+        req->response_size = TAG_TABLE_TYPE_RESPONSE_SIZE;
+    } else {
+        /* Tag Name Server class, 16-bit instance.  Instance 0 is the class itself. */
+        *data = 3; /* path length in words */
+        data++;
+        *data = 0x20;
+        data++;
+        *data = OMRON_TAG_NAME_SERVER_CLASS;
+        data++;
+        *data = 0x25;
+        data++;
+        *data = 0x00; /* padding */
+        data++;
+        *data = (uint8_t)(instance & 0xFF);
+        data++;
+        *data = (uint8_t)((instance >> 8) & 0xFF);
+        data++;
+
+        req->response_size = (step == TAG_TABLE_GET_COUNT ? TAG_TABLE_COUNT_RESPONSE_SIZE : TAG_TABLE_NAME_RESPONSE_SIZE);
+    }
+
+    cip->encap_command = h2le16(OMRON_EIP_CONNECTED_SEND);
+    cip->router_timeout = h2le16(1);
+    cip->cpf_item_count = h2le16(2);
+    cip->cpf_cai_item_type = h2le16(OMRON_EIP_ITEM_CAI);
+    cip->cpf_cai_item_length = h2le16(4);
+    cip->cpf_cdi_item_type = h2le16(OMRON_EIP_ITEM_CDI);
+    cip->cpf_cdi_item_length = h2le16((uint16_t)(data - (uint8_t *)(&cip->cpf_conn_seq_num)));
+
+    req->request_size = (int)(data - (req->data));
+    req->allow_packing = 1;
+
+    rc = conn_add_request(conn, req);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to queue the variable table request, %s!", plc_tag_decode_error(rc));
+        rc_dec(req);
+        return rc;
+    }
+
+    table_req->req = req;
+    table_req->step = step;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * handle_tag_table_reply
+ *
+ * Use one variable table reply.  The count reply sets the range of
+ * instances.  A name reply asks for the type of the name in the same slot.
+ * A type reply puts the type in the cache if it is an atomic type or an
+ * array of one, and its size adds up.  Missing instances and other types
+ * are skipped, those tags read their type.  Only a failed count fails the
+ * load.
+ */
+
+int handle_tag_table_reply(omron_conn_p conn, struct conn_tag_table_t *table, struct conn_tag_table_request_t *table_req) {
+    omron_request_p req = table_req->req;
+    eip_cip_co_resp *cip_resp = (eip_cip_co_resp *)(req->data);
+    uint8_t *data = NULL;
+    int data_size = 0;
+    int status = PLCTAG_STATUS_OK;
+    int rc = PLCTAG_STATUS_OK;
+
+    spin_block(&req->lock) { status = req->status; }
+
+    if(status == PLCTAG_STATUS_OK && req->request_size >= (int)sizeof(eip_cip_co_resp)) {
+        data = (req->data) + sizeof(eip_cip_co_resp) + (cip_resp->num_status_words * 2);
+        data_size = (int)((req->data + le2h16(cip_resp->encap_length) + sizeof(eip_encap)) - data);
+
+        if(cip_resp->reply_service != (GET_ATTRIBUTES_ALL | OMRON_EIP_CMD_CIP_OK)) {
+            pdebug(DEBUG_WARN, "Unexpected reply service 0x%02x to a variable table request!", cip_resp->reply_service);
+            status = PLCTAG_ERR_BAD_REPLY;
+        } else if(cip_resp->status != OMRON_CIP_STATUS_OK) {
+            status = CIP.decode_cip_error_code((uint8_t *)&cip_resp->status);
+        }
+    } else if(status == PLCTAG_STATUS_OK) {
+        status = PLCTAG_ERR_BAD_REPLY;
+    }
+
+    table_req->req = NULL;
+
+    switch(table_req->step) {
+        case TAG_TABLE_GET_COUNT:
+            /* revision, number of instances and the highest instance ID. */
+            if(status != PLCTAG_STATUS_OK || data_size < 6) {
+                pdebug(DEBUG_WARN, "The PLC did not give the size of its variable table, %s.", plc_tag_decode_error(status));
+                rc = (status != PLCTAG_STATUS_OK ? status : PLCTAG_ERR_TOO_SMALL);
+                break;
+            }
+
+            table->max_instance = (uint32_t)data[4] + ((uint32_t)data[5] << 8);
+            table->next_instance = 1;
+
+            pdebug(DEBUG_DETAIL, "The variable table has %u entries with IDs up to %" PRIu32 ".",
+                   (unsigned int)data[2] + ((unsigned int)data[3] << 8), table->max_instance);
+            break;
+
+        case TAG_TABLE_GET_NAME:
+            /* four bytes we do not use, then the counted name. */
+            if(status != PLCTAG_STATUS_OK || data_size < 5 || data[4] == 0 || data_size < 5 + data[4]) {
+                pdebug(DEBUG_DETAIL, "Skipping a variable table entry, %s.", plc_tag_decode_error(status));
+                break;
+            }
+
+            table_req->encoded_name_size = 0;
+            table_req->encoded_name[table_req->encoded_name_size++] = 0; /* length in words, filled in below. */
+            table_req->encoded_name[table_req->encoded_name_size++] = 0x91;
+            table_req->encoded_name[table_req->encoded_name_size++] = data[4];
+            mem_copy(&table_req->encoded_name[table_req->encoded_name_size], &data[5], data[4]);
+            table_req->encoded_name_size += data[4];
+            if(data[4] & 0x01) { table_req->encoded_name[table_req->encoded_name_size++] = 0; }
+            table_req->encoded_name[0] = (uint8_t)((table_req->encoded_name_size - 1) / 2);
+
+            rc = queue_tag_table_request(conn, table_req, TAG_TABLE_GET_TYPE, 0);
+            break;
+
+        case TAG_TABLE_GET_TYPE: {
+            /* total size, type, element type for arrays, dimension count, a pad byte, then the dimensions. */
+            uint8_t cip_type = 0;
+            int elem_size = 0;
+            uint32_t num_elems = 1;
+
+            if(status != PLCTAG_STATUS_OK || data_size < 8 || data_size < 8 + (4 * data[6])) {
+                pdebug(DEBUG_DETAIL, "Skipping a variable whose type the PLC did not give, %s.", plc_tag_decode_error(status));
+                break;
+            }
+
+            cip_type = data[4];
+            if(cip_type == OMRON_CIP_DATA_ABREV_ARRAY || cip_type == OMRON_CIP_DATA_FULL_ARRAY) { cip_type = data[5]; }
+
+            elem_size = get_atomic_type_size(cip_type);
+
+            for(int dim = 0; dim < data[6]; dim++) {
+                num_elems *= (uint32_t)data[8 + (4 * dim)] + ((uint32_t)data[9 + (4 * dim)] << 8)
+                             + ((uint32_t)data[10 + (4 * dim)] << 16) + ((uint32_t)data[11 + (4 * dim)] << 24);
+            }
+
+            /* a size that does not add up means we do not understand the reply, leave it to a read. */
+            if(elem_size <= 0
+               || ((uint32_t)data[0] + ((uint32_t)data[1] << 8) + ((uint32_t)data[2] << 16) + ((uint32_t)data[3] << 24))
+                      != num_elems * (uint32_t)elem_size) {
+                pdebug(DEBUG_DETAIL, "Variable has type 0x%02x that is not cached.", (unsigned int)data[4]);
+                break;
+            }
+
+            critical_block(conn->mutex) {
+                uint8_t encoded_type_info[2] = {cip_type, 0};
+
+                if(cache_type_unsafe(conn, table_req->encoded_name, table_req->encoded_name_size, encoded_type_info,
+                                     (int)sizeof(encoded_type_info), elem_size)
+                   == PLCTAG_STATUS_OK) {
+                    table->num_types++;
+                }
+            }
+        } break;
+
+        default: pdebug(DEBUG_WARN, "Unknown variable table step %d!", table_req->step); break;
+    }
+
+    pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to the variable table request.");
+    rc_dec(req);
+
+    return rc;
+}
+
+
+/* the element size of the types that always have the same two byte encoding, zero for any other type. */
+int get_atomic_type_size(uint8_t cip_type) {
+    switch(cip_type) {
+        case OMRON_CIP_DATA_SINT:
+        case OMRON_CIP_DATA_USINT:
+        case OMRON_CIP_DATA_BYTE: return 1;
+
+        case OMRON_CIP_DATA_INT:
+        case OMRON_CIP_DATA_UINT:
+        case OMRON_CIP_DATA_WORD: return 2;
+
+        case OMRON_CIP_DATA_DINT:
+        case OMRON_CIP_DATA_UDINT:
+        case OMRON_CIP_DATA_REAL:
+        case OMRON_CIP_DATA_DWORD: return 4;
+
+        case OMRON_CIP_DATA_LINT:
+        case OMRON_CIP_DATA_ULINT:
+        case OMRON_CIP_DATA_LREAL:
+        case OMRON_CIP_DATA_LWORD: return 8;
+
+        default: return 0;
+    }
+}
+
+
+/* abort any variable table requests still out and drop the load.  Only called from the conn thread. */
+void release_tag_table(omron_conn_p conn) {
+    if(!conn->tag_table) { return; }
+
+    for(int i = 0; i < conn->tag_table->num_requests; i++) {
+        omron_request_p req = conn->tag_table->requests[i].req;
+
+        if(req) {
+            spin_block(&req->lock) { req->abort_request = 1; }
+
+            pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to the variable table request.");
+            rc_dec(req);
+        }
+    }
+
+    mem_free(conn->tag_table);
+    conn->tag_table = NULL;
+}
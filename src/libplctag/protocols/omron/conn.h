@@ -38,6 +38,10 @@
 
 #include <libplctag/protocols/omron/defs.h>
 #include <libplctag/protocols/omron/omron_common.h>
+#include <libplctag/protocols/eip/transport.h>
+#include <utils/hashtable.h>
+#include <utils/metrics.h>
+#include <utils/poll_planner.h>
 #include <utils/rc.h>
 #include <utils/vector.h>
 
@@ -45,11 +49,29 @@
 
 #define CONN_DEFAULT_TIMEOUT (2000)
 
+#define CONN_MAX_REQUESTS_IN_FLIGHT (8) /* packets sent without waiting for the reply to the one before. */
+
 #define MAX_PACKET_SIZE_EX (44 + 4002)
 
 #define CONN_MIN_REQUESTS (10)
 #define CONN_INC_REQUESTS (10)
 
+#define CONN_MIN_TYPE_CACHE (64)
+#define CONN_MAX_TYPE_CACHE (8192)
+
+/* loading the controller's variable table into the type cache. */
+#define CONN_TAG_TABLE_NONE (0)
+#define CONN_TAG_TABLE_LOADING (1)
+#define CONN_TAG_TABLE_LOADED (2)
+#define CONN_TAG_TABLE_FAILED (3)
+
+#define CONN_TAG_TABLE_WINDOW (32) /* table requests queued at once, so that they are packed together. */
+
+/* what the PLC has shown about Read Tag Fragmented on this connection. */
+#define CONN_FRAGMENTED_READ_UNKNOWN (0)
+#define CONN_FRAGMENTED_READ_SUPPORTED (1)
+#define CONN_FRAGMENTED_READ_UNSUPPORTED (2)
+
 #define MAX_CONN_PATH (260) /* 256 plus padding. */
 #define MAX_IP_ADDR_SEG_LEN (16)
 
@@ -73,6 +95,9 @@ struct omron_conn_t {
     uint16_t max_payload_guess;
     uint16_t max_payload_size;
 
+    /* whether the PLC takes Read Tag Fragmented, learned from the first reply to one. */
+    int fragmented_read_support;
+
     uint32_t orig_connection_id;
     uint32_t targ_connection_id;
     uint16_t conn_seq_num;
@@ -96,8 +121,23 @@ struct omron_conn_t {
     /* list of outstanding requests for this conn */
     vector_p requests;
 
+    /* packets sent and waiting for their replies, oldest first.  Only the conn thread touches these. */
+    int max_requests_in_flight;
+    struct eip_in_flight_t in_flight;
+
     uint64_t resp_seq_id;
 
+    /* encoded types learned from reads, keyed by a hash of the encoded tag name, guarded by mutex. */
+    hashtable_p type_cache;
+    struct conn_type_entry_t *newest_type;
+    struct conn_type_entry_t *oldest_type;
+    int num_types;
+
+    /* the controller's variable table, loaded into the type cache when a tag asks and again after a reconnect. */
+    int tag_table_wanted;
+    int tag_table_state;
+    struct conn_tag_table_t *tag_table; /* the load in progress, only the conn thread touches it. */
+
     /* data for receiving messages */
     uint32_t data_offset;
     uint32_t data_capacity;
@@ -108,6 +148,12 @@ struct omron_conn_t {
 
     uint64_t packet_count;
 
+    /* traffic and latency statistics, rolled up into the library totals. */
+    struct metrics_t metrics;
+
+    /* phases for automatic reads of the tags on this connection. */
+    struct poll_planner_t poll_planner;
+
     thread_p handler_thread;
     volatile int terminating;
     mutex_p mutex;
@@ -134,7 +180,7 @@ struct omron_request_t {
 
     /* allow requests to be packed in the conn */
     int allow_packing;
-    int packing_num;
+    int packing_num; /* number of requests in the packet this request was sent in. */
 
     /* time stamp for debugging output */
     int64_t time_sent;
@@ -144,7 +190,6 @@ struct omron_request_t {
     int request_capacity;
     int response_size; /* size of data we expect to be returned by this request */
 
-    int first_read;               /* whether this tag is being read for the first time and its size is therefor unknown*/
     int supports_fragmented_read; /* if fragmented read is supported then we do not need to worry about the response*/
     uint8_t *data;
 };
@@ -158,7 +203,13 @@ extern void conn_teardown(void);
 
 extern int conn_find_or_create(omron_conn_p *conn, attr attribs);
 extern int conn_get_max_payload(omron_conn_p conn);
+extern int conn_get_fragmented_read_support(omron_conn_p conn);
+extern void conn_set_fragmented_read_support(omron_conn_p conn, int support);
 extern int conn_create_request(omron_conn_p conn, int tag_id, omron_request_p *request);
 extern int conn_add_request(omron_conn_p sess, omron_request_p req);
+extern int conn_get_cached_type(omron_conn_p conn, omron_tag_p tag);
+extern int conn_cache_type(omron_conn_p conn, omron_tag_p tag);
+extern int conn_uncache_type(omron_conn_p conn, omron_tag_p tag);
+extern int conn_load_tag_table(omron_conn_p conn);
 
 #endif
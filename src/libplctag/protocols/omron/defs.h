@@ -83,6 +83,7 @@
 #define OMRON_EIP_CMD_CIP_READ             ((uint8_t)0x4C)
 #define OMRON_EIP_CMD_CIP_WRITE            ((uint8_t)0x4D)
 #define OMRON_EIP_CMD_CIP_RMW              ((uint8_t)0x4E)
+#define OMRON_EIP_CMD_CIP_READ_FRAG        ((uint8_t)0x52)
 #define OMRON_EIP_CMD_CIP_LIST_TAGS        ((uint8_t)0x55)
 
 /* flag set when command is OK */
@@ -49,6 +49,7 @@
 #include <utils/atomic_utils.h>
 #include <utils/attr.h>
 #include <utils/debug.h>
+#include <utils/metrics.h>
 #include <utils/vector.h>
 
 
@@ -83,6 +84,8 @@ volatile int omron_protocol_terminating = 0;
 /* forward declarations*/
 static plc_type_t get_plc_type(attr attribs);
 static int get_tag_data_type(omron_tag_p tag, attr attribs);
+static int setup_known_type(omron_tag_p tag, attr attribs);
+static int setup_tag_buffer(omron_tag_p tag);
 static int check_cpu(omron_tag_p tag, attr attribs);
 static int check_tag_name(omron_tag_p tag, const char *name);
 
@@ -159,6 +162,8 @@ plc_tag_p omron_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_i
     omron_tag_p tag = OMRON_TAG_NULL;
     const char *path = NULL;
     int rc = PLCTAG_STATUS_OK;
+    int auto_sync_read_ms = 0;
+    int skip_initial_read = 0;
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -226,6 +231,15 @@ plc_tag_p omron_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_i
 
     pdebug(DEBUG_DETAIL, "using conn=%p", tag->conn);
 
+    metrics_set_parent(&tag->metrics, &tag->conn->metrics);
+
+    /* line up automatic reads with the other tags on this connection so that they are packed together. */
+    auto_sync_read_ms = attr_get_int(attribs, "auto_sync_read_ms", 0);
+    if(auto_sync_read_ms > 0) {
+        tag->auto_sync_planner = &tag->conn->poll_planner;
+        tag->auto_sync_next_read = poll_planner_first_read(tag->auto_sync_planner, auto_sync_read_ms, &tag->auto_sync_family_id);
+    }
+
     /* get the tag data type, or try. */
     rc = get_tag_data_type(tag, attribs);
     if(rc != PLCTAG_STATUS_OK) {
@@ -255,8 +269,7 @@ plc_tag_p omron_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_i
     }
 
     tag->use_connected_msg = 1;
-    tag->allow_packing = attr_get_int(attribs, "allow_packing", 0);
-    tag->supports_fragmented_read = 0; /* fragmented read is not currently supported */
+    tag->allow_packing = attr_get_int(attribs, "allow_packing", 1);
 
     /* pass the connection requirement since it may be overridden above. */
     attr_set_int(attribs, "use_connected_msg", tag->use_connected_msg);
@@ -277,17 +290,33 @@ plc_tag_p omron_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_i
         return (plc_tag_p)tag;
     }
 
+    /* a tag with a known type can be written without reading it first. */
+    if(!tag->special_tag && !attr_get_int(attribs, "initial_read", 1)) {
+        skip_initial_read = (setup_known_type(tag, attribs) == PLCTAG_STATUS_OK);
+
+        /* the type may be in the variable table, wait for the connection to load it instead of reading. */
+        if(!skip_initial_read && !tag->is_bit && attr_get_int(attribs, "fetch_tag_table", 0)
+           && conn_load_tag_table(tag->conn) == PLCTAG_STATUS_PENDING) {
+            pdebug(DEBUG_DETAIL, "Waiting for the variable table to get the tag type.");
+            tag->first_read = 1;
+            tag->wait_for_tag_table = 1;
+            tag->status = PLCTAG_STATUS_PENDING;
+            skip_initial_read = 1;
+        }
+    }
+
     /* kick off a read to get the tag type and size. */
-    if(!tag->special_tag && tag->vtable->read) {
+    if(!tag->special_tag && tag->vtable->read && !skip_initial_read) {
         /* trigger the first read. */
         pdebug(DEBUG_DETAIL, "Kicking off initial read.");
 
         tag->first_read = 1;
         tag->read_in_flight = 1;
+        plc_tag_generic_op_started((plc_tag_p)tag);
         tag->vtable->read((plc_tag_p)tag);
         // tag_raise_event((plc_tag_p)tag, PLCTAG_EVENT_READ_STARTED, tag->status);
-    } else {
-        pdebug(DEBUG_DETAIL, "Not kicking off initial read: tag is special or does not have read function.");
+    } else if(!tag->wait_for_tag_table) {
+        pdebug(DEBUG_DETAIL, "Not kicking off initial read: tag is special, has a known type or does not have read function.");
 
         /* force the created event because we do not do an initial read here. */
         tag_raise_event((plc_tag_p)tag, PLCTAG_EVENT_CREATED, tag->status);
@@ -301,6 +330,103 @@ plc_tag_p omron_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_i
 }
 
 
+/*
+ * Set up the type and buffer of a tag without reading it.  The encoded
+ * type comes from the elem_type attribute for atomic types, or from the
+ * connection's type cache.  Returns PLCTAG_ERR_NOT_FOUND if the type is not
+ * known and the tag must be read.
+ */
+
+int setup_known_type(omron_tag_p tag, attr attribs) {
+    const char *elem_type = attr_get_str(attribs, "elem_type", NULL);
+    uint8_t cip_type = 0;
+
+    pdebug(DEBUG_DETAIL, "Starting.");
+
+    if(tag->is_bit) {
+        pdebug(DEBUG_DETAIL, "Bit tags cannot skip the initial read.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    /* atomic types always have the same two byte type encoding. */
+    if(elem_type) {
+        if(str_cmp_i(elem_type, "lint") == 0) {
+            cip_type = OMRON_CIP_DATA_LINT;
+        } else if(str_cmp_i(elem_type, "ulint") == 0) {
+            cip_type = OMRON_CIP_DATA_ULINT;
+        } else if(str_cmp_i(elem_type, "dint") == 0) {
+            cip_type = OMRON_CIP_DATA_DINT;
+        } else if(str_cmp_i(elem_type, "udint") == 0) {
+            cip_type = OMRON_CIP_DATA_UDINT;
+        } else if(str_cmp_i(elem_type, "int") == 0) {
+            cip_type = OMRON_CIP_DATA_INT;
+        } else if(str_cmp_i(elem_type, "uint") == 0) {
+            cip_type = OMRON_CIP_DATA_UINT;
+        } else if(str_cmp_i(elem_type, "sint") == 0) {
+            cip_type = OMRON_CIP_DATA_SINT;
+        } else if(str_cmp_i(elem_type, "usint") == 0) {
+            cip_type = OMRON_CIP_DATA_USINT;
+        } else if(str_cmp_i(elem_type, "real") == 0) {
+            cip_type = OMRON_CIP_DATA_REAL;
+        } else if(str_cmp_i(elem_type, "lreal") == 0) {
+            cip_type = OMRON_CIP_DATA_LREAL;
+        }
+    }
+
+    if(!cip_type) { return omron_setup_cached_type(tag); }
+
+    tag->encoded_type_info[0] = cip_type;
+    tag->encoded_type_info[1] = 0;
+    tag->encoded_type_info_size = 2;
+
+    return setup_tag_buffer(tag);
+}
+
+
+/*
+ * Set up the type and buffer of a tag from the connection's type cache,
+ * which holds the types of earlier reads and of the variable table.
+ * Returns PLCTAG_ERR_NOT_FOUND if the name is not in the cache.
+ */
+
+int omron_setup_cached_type(omron_tag_p tag) {
+    if(tag->is_bit) {
+        pdebug(DEBUG_DETAIL, "Bit tags cannot skip the initial read.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    if(conn_get_cached_type(tag->conn, tag) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Type of tag is not known, it must be read first.");
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    return setup_tag_buffer(tag);
+}
+
+
+/* allocate the data buffer of a tag whose encoded type is set. */
+int setup_tag_buffer(omron_tag_p tag) {
+    if(tag->elem_size <= 0 || tag->elem_count <= 0) {
+        pdebug(DEBUG_DETAIL, "Element size is not known, the tag must be read first.");
+        tag->encoded_type_info_size = 0;
+        return PLCTAG_ERR_NOT_FOUND;
+    }
+
+    tag->size = tag->elem_count * tag->elem_size;
+    tag->data = (uint8_t *)mem_alloc(tag->size);
+    if(!tag->data) {
+        pdebug(DEBUG_WARN, "Unable to allocate tag data!");
+        tag->size = 0;
+        tag->encoded_type_info_size = 0;
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    pdebug(DEBUG_DETAIL, "Tag type is known, skipping the initial read of %d bytes.", tag->size);
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 /*
  * determine the tag's data type and size.  Or at least guess it.
  */
@@ -536,6 +662,7 @@ int omron_tag_abort(omron_tag_p tag) {
         /* do a real abort */
         omron_tag_abort_request(tag);
 
+        tag->wait_for_tag_table = 0;
         tag->status = PLCTAG_ERR_ABORT;
         return tag->status;
     } else {
@@ -556,6 +683,8 @@ int omron_tag_abort(omron_tag_p tag) {
 int omron_tag_status(omron_tag_p tag) {
     int rc = PLCTAG_STATUS_OK;
 
+    if(tag->wait_for_tag_table) { return PLCTAG_STATUS_PENDING; }
+
     if(tag->read_in_progress) { return PLCTAG_STATUS_PENDING; }
 
     if(tag->write_in_progress) { return PLCTAG_STATUS_PENDING; }
@@ -600,6 +729,8 @@ void omron_tag_destroy(omron_tag_p tag) {
     pdebug(DEBUG_DETAIL, "Getting ready to release tag conn %p", tag->conn);
     if(conn) {
         pdebug(DEBUG_DETAIL, "rc_dec: Releasing reference to conn of tag %" PRId32 ".", tag->tag_id);
+        plc_tag_generic_leave_poll_planner((plc_tag_p)tag);
+        metrics_set_parent(&tag->metrics, &library_metrics);
         tag->conn = rc_dec(tag->conn);
     } else {
         pdebug(DEBUG_WARN, "No conn pointer!");
@@ -625,6 +756,13 @@ void omron_tag_destroy(omron_tag_p tag) {
         tag->byte_order = NULL;
     }
 
+    if(tag->snapshot_data) {
+        mem_free(tag->snapshot_data);
+        tag->snapshot_data = NULL;
+    }
+
+    if(tag->process_image_slot) { tag->process_image_slot = rc_dec(tag->process_image_slot); }
+
     if(tag->data) {
         mem_free(tag->data);
         tag->data = NULL;
@@ -654,6 +792,9 @@ int omron_get_int_attrib(plc_tag_p raw_tag, const char *attrib_name, int default
         res = (int)(tag->elem_type);
     } else if(str_cmp_i(attrib_name, "raw_tag_type_bytes.length") == 0) {
         res = (int)(tag->encoded_type_info_size);
+    } else if(str_cmp_i_n(attrib_name, "conn_", 5) == 0 && tag->conn
+              && metrics_get_int_attrib(&tag->conn->metrics, attrib_name + 5, &res) == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_SPEW, "Got connection metric %s.", attrib_name);
     } else {
         pdebug(DEBUG_WARN, "Unsupported attribute name \"%s\"!", attrib_name);
         tag->status = PLCTAG_ERR_UNSUPPORTED;
@@ -64,4 +64,6 @@ extern int omron_get_byte_array_attrib(plc_tag_p tag, const char *attrib_name, u
 /* helpers for checking request status. */
 extern int omron_check_request_status(omron_tag_p tag);
 
+extern int omron_setup_cached_type(omron_tag_p tag);
+
 #define rc_is_error(rc) (rc < PLCTAG_STATUS_OK)
@@ -59,11 +59,17 @@ static int check_read_status_unconnected(omron_tag_p tag);
 static int check_write_status_connected(omron_tag_p tag);
 static int check_write_status_unconnected(omron_tag_p tag);
 static int calculate_write_data_per_packet(omron_tag_p tag);
+static void set_read_plan(omron_tag_p tag, omron_request_p req, int byte_offset, int frag_support);
+
+static int check_tag_table_status(omron_tag_p tag);
 
 static int tag_read_start(omron_tag_p tag);
 static int tag_tickler(omron_tag_p tag);
 static int tag_write_start(omron_tag_p tag);
 
+/* guess at the bytes per element for a tag that has not been read yet. */
+#define FIRST_READ_ELEM_SIZE_GUESS (8)
+
 /* define the exported vtable for this tag type. */
 struct tag_vtable_t omron_standard_tag_vtable = {(tag_vtable_func)omron_tag_abort,                                   /* shared */
                                                  (tag_vtable_func)tag_read_start, (tag_vtable_func)omron_tag_status, /* shared */
@@ -153,6 +159,8 @@ int tag_tickler(omron_tag_p tag) {
 
     pdebug(DEBUG_SPEW, "Starting.");
 
+    if(tag->wait_for_tag_table) { return check_tag_table_status(tag); }
+
     rc = omron_check_request_status(tag);
     if(rc != PLCTAG_STATUS_OK) { return rc; }
 
@@ -204,6 +212,53 @@ int tag_tickler(omron_tag_p tag) {
 }
 
 
+/*
+ * check_tag_table_status
+ *
+ * A tag created without a read waits here for the connection to load the
+ * variable table.  If the name is in the table, the tag is created without
+ * reading.  If it is not, or the table could not be loaded, the tag reads
+ * its type as usual.
+ */
+
+int check_tag_table_status(omron_tag_p tag) {
+    int rc = conn_load_tag_table(tag->conn);
+
+    if(rc == PLCTAG_STATUS_PENDING) { return rc; }
+
+    tag->wait_for_tag_table = 0;
+
+    if(omron_setup_cached_type(tag) == PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_DETAIL, "Tag type came from the variable table.");
+
+        tag->first_read = 0;
+        tag->status = PLCTAG_STATUS_OK;
+        tag_raise_event((plc_tag_p)tag, PLCTAG_EVENT_CREATED, PLCTAG_STATUS_OK);
+        cond_signal(tag->tag_cond_wait);
+
+        return PLCTAG_STATUS_OK;
+    }
+
+    pdebug(DEBUG_DETAIL, "Tag is not in the variable table, reading its type.");
+
+    tag->read_in_flight = 1;
+    plc_tag_generic_op_started((plc_tag_p)tag);
+
+    rc = tag_read_start(tag);
+    if(rc != PLCTAG_STATUS_PENDING) {
+        pdebug(DEBUG_WARN, "Unable to start the read of the tag type, %s!", plc_tag_decode_error(rc));
+
+        tag->read_in_flight = 0;
+        tag->first_read = 0;
+        tag_raise_event((plc_tag_p)tag, PLCTAG_EVENT_CREATED, (int8_t)rc);
+    }
+
+    tag->status = (int8_t)rc;
+
+    return rc;
+}
+
+
 /*
  * tag_read_common_start
  *
@@ -223,8 +278,9 @@ int tag_read_start(omron_tag_p tag) {
         return PLCTAG_ERR_BUSY;
     }
 
-    /* mark the tag read in progress */
+    /* mark the tag read in progress, a read also stands in for waiting on the variable table. */
     tag->read_in_progress = 1;
+    tag->wait_for_tag_table = 0;
 
     /* i is the index of the first new request */
     if(tag->use_connected_msg) {
@@ -321,8 +377,7 @@ int build_read_request_connected(omron_tag_p tag, int byte_offset) {
     omron_request_p req = NULL;
     int rc = PLCTAG_STATUS_OK;
     uint8_t read_cmd = OMRON_EIP_CMD_CIP_READ;
-
-    (void)byte_offset;
+    int frag_support = conn_get_fragmented_read_support(tag->conn);
 
     pdebug(DEBUG_INFO, "Starting.");
 
@@ -346,12 +401,13 @@ int build_read_request_connected(omron_tag_p tag, int byte_offset) {
      * uint8_t cmd
      * LLA formatted name
      * uint16_t # of elements to read
+     * uint32_t byte offset (Read Tag Fragmented only)
      */
 
     // embed_start = data;
 
     /* set up the CIP Read request */
-    read_cmd = OMRON_EIP_CMD_CIP_READ;
+    read_cmd = (frag_support == CONN_FRAGMENTED_READ_UNSUPPORTED ? OMRON_EIP_CMD_CIP_READ : OMRON_EIP_CMD_CIP_READ_FRAG);
 
     *data = read_cmd;
     data++;
@@ -364,13 +420,11 @@ int build_read_request_connected(omron_tag_p tag, int byte_offset) {
     *((uint16_le *)data) = h2le16((uint16_t)(tag->elem_count));
     data += sizeof(uint16_le);
 
-    /* here is where we need to add the data segment that controls Omron fragmentation */
-
-    // if (read_cmd == OMRON_EIP_CMD_CIP_READ_FRAG) {
-    //     /* add the byte offset for this request */
-    //     *((uint32_le*)data) = h2le32((uint32_t)byte_offset);
-    //     data += sizeof(uint32_le);
-    // }
+    if(read_cmd == OMRON_EIP_CMD_CIP_READ_FRAG) {
+        /* add the byte offset for this request */
+        *((uint32_le *)data) = h2le32((uint32_t)byte_offset);
+        data += sizeof(uint32_le);
+    }
 
     /* now we go back and fill in the fields of the static part */
 
@@ -394,15 +448,7 @@ int build_read_request_connected(omron_tag_p tag, int byte_offset) {
     /* set the conn so that we know what conn the request is aiming at */
     // req->conn = tag->conn;
 
-    req->allow_packing = tag->allow_packing;
-
-    /* set the response size to the size of data from the previous read */
-    req->response_size = tag->size;
-
-    /* if this is the first read of the tag then we do not know the size of the response data and cannot use packing unless the
-     * plc supports fragmented reads*/
-    req->first_read = tag->first_read;
-    req->supports_fragmented_read = tag->supports_fragmented_read;
+    set_read_plan(tag, req, byte_offset, frag_support);
 
     /* add the request to the conn's list. */
     rc = conn_add_request(tag->conn, req);
@@ -430,10 +476,9 @@ int build_read_request_unconnected(omron_tag_p tag, int byte_offset) {
     omron_request_p req = NULL;
     int rc = PLCTAG_STATUS_OK;
     uint8_t read_cmd = OMRON_EIP_CMD_CIP_READ;
+    int frag_support = conn_get_fragmented_read_support(tag->conn);
     uint16_le tmp_uint16_le;
 
-    (void)byte_offset;
-
     pdebug(DEBUG_INFO, "Starting.");
 
     /* get a request buffer */
@@ -457,12 +502,13 @@ int build_read_request_unconnected(omron_tag_p tag, int byte_offset) {
      * uint8_t cmd
      * LLA formatted name
      * uint16_t # of elements to read
+     * uint32_t byte offset (Read Tag Fragmented only)
      */
 
     embed_start = data;
 
     /* set up the CIP Read request */
-    read_cmd = OMRON_EIP_CMD_CIP_READ;
+    read_cmd = (frag_support == CONN_FRAGMENTED_READ_UNSUPPORTED ? OMRON_EIP_CMD_CIP_READ : OMRON_EIP_CMD_CIP_READ_FRAG);
 
     *data = read_cmd;
     data++;
@@ -476,9 +522,12 @@ int build_read_request_unconnected(omron_tag_p tag, int byte_offset) {
     mem_copy(data, &tmp_uint16_le, (int)(unsigned int)sizeof(tmp_uint16_le));
     data += sizeof(tmp_uint16_le);
 
-    /* add the byte offset for this request */
-
-    /* here is where we put the data segment fragmentation information */
+    if(read_cmd == OMRON_EIP_CMD_CIP_READ_FRAG) {
+        /* add the byte offset for this request */
+        uint32_le tmp_uint32_le = h2le32((uint32_t)byte_offset);
+        mem_copy(data, &tmp_uint32_le, (int)(unsigned int)sizeof(tmp_uint32_le));
+        data += sizeof(tmp_uint32_le);
+    }
 
     /* mark the end of the embedded packet */
     embed_end = data;
@@ -534,16 +583,7 @@ int build_read_request_unconnected(omron_tag_p tag, int byte_offset) {
     /* set the size of the request */
     req->request_size = (int)(data - (req->data));
 
-    /* allow packing if the tag allows it. */
-    req->allow_packing = tag->allow_packing;
-
-    /* set the response size to the size of data from the previous read */
-    req->response_size = tag->size;
-
-    /* if this is the first read of the tag then we do not know the size of the response data and cannot use packing unless the
-     * plc supports fragmented reads*/
-    req->first_read = tag->first_read;
-    req->supports_fragmented_read = tag->supports_fragmented_read;
+    set_read_plan(tag, req, byte_offset, frag_support);
 
     /* add the request to the conn's list. */
     rc = conn_add_request(tag->conn, req);
@@ -1256,6 +1296,9 @@ static int check_read_status_connected(omron_tag_p tag) {
     uint8_t *data;
     uint8_t *data_end;
     int partial_data = 0;
+    int is_frag_read = 0;
+    int continue_read = 0;
+    int restart_read = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -1274,12 +1317,24 @@ static int check_read_status_connected(omron_tag_p tag) {
     do {
         ptrdiff_t payload_size = 0;
 
-        if(cip_resp->reply_service != (OMRON_EIP_CMD_CIP_READ | OMRON_EIP_CMD_CIP_OK)) {
+        if(cip_resp->reply_service != (OMRON_EIP_CMD_CIP_READ | OMRON_EIP_CMD_CIP_OK)
+           && cip_resp->reply_service != (OMRON_EIP_CMD_CIP_READ_FRAG | OMRON_EIP_CMD_CIP_OK)) {
             pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
             rc = PLCTAG_ERR_BAD_DATA;
             break;
         }
 
+        is_frag_read = (cip_resp->reply_service == (OMRON_EIP_CMD_CIP_READ_FRAG | OMRON_EIP_CMD_CIP_OK));
+
+        /* the PLC turned down Read Tag Fragmented, remember that for the connection and use Read Tag. */
+        if(is_frag_read && cip_resp->status == OMRON_CIP_ERR_UNSUPPORTED_SERVICE) {
+            pdebug(DEBUG_DETAIL, "Read Tag Fragmented is not supported, reading again with Read Tag.");
+            conn_set_fragmented_read_support(tag->conn, CONN_FRAGMENTED_READ_UNSUPPORTED);
+            restart_read = 1;
+            rc = PLCTAG_STATUS_OK;
+            break;
+        }
+
         if(cip_resp->status != OMRON_CIP_STATUS_OK && cip_resp->status != OMRON_CIP_STATUS_FRAG) {
             pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status,
                    CIP.decode_cip_error_short((uint8_t *)&cip_resp->status));
@@ -1293,12 +1348,50 @@ static int check_read_status_connected(omron_tag_p tag) {
         /* check to see if this is a partial response. */
         partial_data = (cip_resp->status == OMRON_CIP_STATUS_FRAG);
 
+        if(is_frag_read) {
+            if(!tag->req->supports_fragmented_read) {
+                conn_set_fragmented_read_support(tag->conn, CONN_FRAGMENTED_READ_SUPPORTED);
+            }
+
+            continue_read = partial_data;
+        } else if(partial_data && !tag->pre_write_read) {
+            /* a Read Tag reply that was cut short cannot be continued. */
+            if(tag->req->packing_num > 1) {
+                pdebug(DEBUG_DETAIL, "Packed reply was cut short, reading again in a packet of its own.");
+                tag->read_alone = 1;
+                restart_read = 1;
+                rc = PLCTAG_STATUS_OK;
+                break;
+            }
+
+            pdebug(DEBUG_WARN, "Tag data does not fit in one reply and the PLC does not support fragmented reads!");
+            rc = PLCTAG_ERR_TOO_LARGE;
+            break;
+        }
+
         /*
          * check to see if there is any data to process.  If this is a packed
          * response, there might not be.
          */
         payload_size = (data_end - data);
         if(payload_size > 0) {
+            /* a type the tag already has, perhaps from the connection cache, must match the reply. */
+            if(tag->encoded_type_info_size
+               && (payload_size < tag->encoded_type_info_size
+                   || mem_cmp(data, tag->encoded_type_info_size, tag->encoded_type_info, tag->encoded_type_info_size) != 0)) {
+                pdebug(DEBUG_WARN, "Tag type in the reply does not match the type the tag had, learning it again.");
+
+                conn_uncache_type(tag->conn, tag);
+                tag->encoded_type_info_size = 0;
+
+                /* data already read was taken apart with the wrong type. */
+                if(tag->offset > 0) {
+                    restart_read = 1;
+                    rc = PLCTAG_STATUS_OK;
+                    break;
+                }
+            }
+
             /* skip the copy if we already have type data */
             if(tag->encoded_type_info_size == 0) {
                 int type_length = 0;
@@ -1371,22 +1464,39 @@ static int check_read_status_connected(omron_tag_p tag) {
         rc = PLCTAG_STATUS_OK;
     } while(0);
 
-    /* clean up the request */
-    omron_tag_abort(tag);
+    /* clean up the request, keeping the offset. */
+    omron_tag_abort_request_only(tag);
 
     /* are we actually done? */
     if(rc == PLCTAG_STATUS_OK) {
         /* this particular read is done. */
         tag->read_in_progress = 0;
 
-        /* skip if we are doing a pre-write read. */
-        if(!tag->pre_write_read && partial_data) {
-            /* call read start again to get the next piece */
+        if(restart_read) {
+            /* start over from the beginning of the tag. */
+            tag->offset = 0;
+            rc = tag_read_start(tag);
+        } else if(continue_read) {
+            /* call read start again to get the next piece, a pre-write read needs the whole size too. */
             pdebug(DEBUG_DETAIL, "calling tag_read_start() to get the next chunk.");
-            /* FIXNE - the abort function above resets the offset. */
             rc = tag_read_start(tag);
         } else {
+            int read_size = tag->offset;
+
             tag->offset = 0;
+            tag->read_alone = 0;
+
+            /*
+             * a complete read gives the full type, share it with later tags of the same name.
+             * If it did not fill the tag, the size the tag started with was wrong.
+             */
+            if(!tag->pre_write_read) {
+                if(read_size == tag->size) {
+                    conn_cache_type(tag->conn, tag);
+                } else {
+                    conn_uncache_type(tag->conn, tag);
+                }
+            }
 
             /* if this is a pre-read for a write, then pass off to the write routine */
             if(tag->pre_write_read) {
@@ -1418,6 +1528,9 @@ static int check_read_status_unconnected(omron_tag_p tag) {
     uint8_t *data;
     uint8_t *data_end;
     int partial_data = 0;
+    int is_frag_read = 0;
+    int continue_read = 0;
+    int restart_read = 0;
 
     pdebug(DEBUG_SPEW, "Starting.");
 
@@ -1455,12 +1568,24 @@ static int check_read_status_unconnected(omron_tag_p tag) {
          * than fragmented is error-prone.
          */
 
-        if(cip_resp->reply_service != (OMRON_EIP_CMD_CIP_READ | OMRON_EIP_CMD_CIP_OK)) {
+        if(cip_resp->reply_service != (OMRON_EIP_CMD_CIP_READ | OMRON_EIP_CMD_CIP_OK)
+           && cip_resp->reply_service != (OMRON_EIP_CMD_CIP_READ_FRAG | OMRON_EIP_CMD_CIP_OK)) {
             pdebug(DEBUG_WARN, "CIP response reply service unexpected: %d", cip_resp->reply_service);
             rc = PLCTAG_ERR_BAD_DATA;
             break;
         }
 
+        is_frag_read = (cip_resp->reply_service == (OMRON_EIP_CMD_CIP_READ_FRAG | OMRON_EIP_CMD_CIP_OK));
+
+        /* the PLC turned down Read Tag Fragmented, remember that for the connection and use Read Tag. */
+        if(is_frag_read && cip_resp->status == OMRON_CIP_ERR_UNSUPPORTED_SERVICE) {
+            pdebug(DEBUG_DETAIL, "Read Tag Fragmented is not supported, reading again with Read Tag.");
+            conn_set_fragmented_read_support(tag->conn, CONN_FRAGMENTED_READ_UNSUPPORTED);
+            restart_read = 1;
+            rc = PLCTAG_STATUS_OK;
+            break;
+        }
+
         if(cip_resp->status != OMRON_CIP_STATUS_OK && cip_resp->status != OMRON_CIP_STATUS_FRAG) {
             pdebug(DEBUG_WARN, "CIP read failed with status: 0x%x %s", cip_resp->status,
                    CIP.decode_cip_error_short((uint8_t *)&cip_resp->status));
@@ -1474,12 +1599,50 @@ static int check_read_status_unconnected(omron_tag_p tag) {
         /* check to see if this is a partial response. */
         partial_data = (cip_resp->status == OMRON_CIP_STATUS_FRAG);
 
+        if(is_frag_read) {
+            if(!tag->req->supports_fragmented_read) {
+                conn_set_fragmented_read_support(tag->conn, CONN_FRAGMENTED_READ_SUPPORTED);
+            }
+
+            continue_read = partial_data;
+        } else if(partial_data && !tag->pre_write_read) {
+            /* a Read Tag reply that was cut short cannot be continued. */
+            if(tag->req->packing_num > 1) {
+                pdebug(DEBUG_DETAIL, "Packed reply was cut short, reading again in a packet of its own.");
+                tag->read_alone = 1;
+                restart_read = 1;
+                rc = PLCTAG_STATUS_OK;
+                break;
+            }
+
+            pdebug(DEBUG_WARN, "Tag data does not fit in one reply and the PLC does not support fragmented reads!");
+            rc = PLCTAG_ERR_TOO_LARGE;
+            break;
+        }
+
         /*
          * check to see if there is any data to process.  If this is a packed
          * response, there might not be.
          */
         payload_size = (data_end - data);
         if(payload_size > 0) {
+            /* a type the tag already has, perhaps from the connection cache, must match the reply. */
+            if(tag->encoded_type_info_size
+               && (payload_size < tag->encoded_type_info_size
+                   || mem_cmp(data, tag->encoded_type_info_size, tag->encoded_type_info, tag->encoded_type_info_size) != 0)) {
+                pdebug(DEBUG_WARN, "Tag type in the reply does not match the type the tag had, learning it again.");
+
+                conn_uncache_type(tag->conn, tag);
+                tag->encoded_type_info_size = 0;
+
+                /* data already read was taken apart with the wrong type. */
+                if(tag->offset > 0) {
+                    restart_read = 1;
+                    rc = PLCTAG_STATUS_OK;
+                    break;
+                }
+            }
+
             /* skip the copy if we already have type data */
             if(tag->encoded_type_info_size == 0) {
                 int type_length = 0;
@@ -1553,22 +1716,39 @@ static int check_read_status_unconnected(omron_tag_p tag) {
     } while(0);
 
 
-    /* clean up the request */
-    omron_tag_abort(tag);
+    /* clean up the request, keeping the offset. */
+    omron_tag_abort_request_only(tag);
 
     /* are we actually done? */
     if(rc == PLCTAG_STATUS_OK) {
         /* this read is done. */
         tag->read_in_progress = 0;
 
-        /* skip if we are doing a pre-write read. */
-        if(!tag->pre_write_read && partial_data) {
-            /* call read start again to get the next piece */
+        if(restart_read) {
+            /* start over from the beginning of the tag. */
+            tag->offset = 0;
+            rc = tag_read_start(tag);
+        } else if(continue_read) {
+            /* call read start again to get the next piece, a pre-write read needs the whole size too. */
             pdebug(DEBUG_DETAIL, "calling tag_read_start() to get the next chunk.");
-            /* FIXME - the abort function above resets the offset! */
             rc = tag_read_start(tag);
         } else {
+            int read_size = tag->offset;
+
             tag->offset = 0;
+            tag->read_alone = 0;
+
+            /*
+             * a complete read gives the full type, share it with later tags of the same name.
+             * If it did not fill the tag, the size the tag started with was wrong.
+             */
+            if(!tag->pre_write_read) {
+                if(read_size == tag->size) {
+                    conn_cache_type(tag->conn, tag);
+                } else {
+                    conn_uncache_type(tag->conn, tag);
+                }
+            }
 
             /* if this is a pre-read for a write, then pass off to the write routine */
             if(tag->pre_write_read) {
@@ -1772,3 +1952,30 @@ int calculate_write_data_per_packet(omron_tag_p tag) {
 
     return PLCTAG_STATUS_OK;
 }
+
+
+/*
+ * set_read_plan
+ *
+ * Tell the connection how a read may be packed.  Reads pack by default.
+ * The reply size is what is left of the tag from the previous read or,
+ * before the first read, a guess from the element count.  If the PLC is
+ * known to do fragmented reads then a reply that does not fit is simply
+ * continued in the next request.
+ *
+ * Read Tag Fragmented is used unless the PLC has turned it down on this
+ * connection.  While support is still unknown the read doubles as the
+ * probe.
+ */
+
+void set_read_plan(omron_tag_p tag, omron_request_p req, int byte_offset, int frag_support) {
+    req->allow_packing = tag->allow_packing && !tag->read_alone;
+
+    if(tag->size > 0) {
+        req->response_size = tag->size - byte_offset;
+    } else {
+        req->response_size = tag->elem_count * FIRST_READ_ELEM_SIZE_GUESS;
+    }
+
+    req->supports_fragmented_read = (frag_support == CONN_FRAGMENTED_READ_SUPPORTED);
+}
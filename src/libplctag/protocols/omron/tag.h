@@ -105,11 +105,12 @@ struct omron_tag_t {
     /* requests */
     int pre_write_read;
     int first_read;
+    int wait_for_tag_table; /* the type is coming from the connection's variable table. */
     omron_request_p req;
     int offset;
 
     int allow_packing;
-    int supports_fragmented_read;
+    int read_alone; /* a packed read was cut short, read again in a packet of its own. */
 
     /* flags for operations */
     // int abort_requested;
@@ -41,6 +41,7 @@
 #include <platform.h>
 #include <utils/attr.h>
 #include <utils/debug.h>
+#include <utils/metrics.h>
 #include <utils/rc.h>
 
 
@@ -140,7 +141,12 @@ plc_tag_p system_tag_create(attr attribs, void (*tag_callback_func)(int32_t tag_
 
     /* point data at the backing store. */
     tag->data = &tag->backing_data[0];
-    tag->size = (int)sizeof(tag->backing_data);
+
+    if(str_cmp_i(tag->name, "metrics") == 0) {
+        tag->size = SYSTEM_METRICS_TAG_SIZE;
+    } else {
+        tag->size = MAX_SYSTEM_TAG_SIZE;
+    }
 
     pdebug(DEBUG_INFO, "Done");
 
@@ -171,6 +177,13 @@ static void system_tag_destroy(plc_tag_p ptag) {
         tag->byte_order = NULL;
     }
 
+    if(tag->snapshot_data) {
+        mem_free(tag->snapshot_data);
+        tag->snapshot_data = NULL;
+    }
+
+    if(tag->process_image_slot) { tag->process_image_slot = rc_dec(tag->process_image_slot); }
+
     return;
 }
 
@@ -194,6 +207,22 @@ static int system_tag_read(plc_tag_p ptag) {
         tag->data[1] = (uint8_t)((debug_level >> 8) & 0xFF);
         tag->data[2] = (uint8_t)((debug_level >> 16) & 0xFF);
         tag->data[3] = (uint8_t)((debug_level >> 24) & 0xFF);
+        rc = PLCTAG_STATUS_OK;
+    } else if(str_cmp_i(&tag->name[0], "metrics") == 0) {
+        struct metrics_snapshot_t snapshot;
+        int64_t *fields = (int64_t *)(void *)&snapshot;
+
+        /* library-wide totals as little-endian 64-bit values in snapshot field order. */
+        metrics_snapshot(&library_metrics, &snapshot);
+
+        for(int i = 0; i < METRICS_SNAPSHOT_FIELDS; i++) {
+            uint64_t val = (uint64_t)fields[i];
+
+            for(int byte_index = 0; byte_index < 8; byte_index++) {
+                tag->data[(i * 8) + byte_index] = (uint8_t)((val >> (byte_index * 8)) & 0xFF);
+            }
+        }
+
         rc = PLCTAG_STATUS_OK;
     } else {
         pdebug(DEBUG_WARN, "Unsupported system tag %s!", tag->name);
@@ -234,7 +263,7 @@ static int system_tag_write(plc_tag_p ptag) {
                         + ((uint32_t)(tag->data[3]) << 24));
         set_debug_level(res);
         rc = PLCTAG_STATUS_OK;
-    } else if(str_cmp_i(&tag->name[0], "version") == 0) {
+    } else if(str_cmp_i(&tag->name[0], "version") == 0 || str_cmp_i(&tag->name[0], "metrics") == 0) {
         rc = PLCTAG_ERR_NOT_IMPLEMENTED;
     } else {
         pdebug(DEBUG_WARN, "Unsupported system tag %s!", tag->name);
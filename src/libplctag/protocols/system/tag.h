@@ -37,16 +37,20 @@
 #include <utils/debug.h>
 #include <platform.h>
 #include <libplctag/lib/tag.h>
+#include <utils/metrics.h>
 
 #define MAX_SYSTEM_TAG_NAME (20)
 #define MAX_SYSTEM_TAG_SIZE (30)
 
+/* the metrics tag holds one 64-bit value per snapshot field. */
+#define SYSTEM_METRICS_TAG_SIZE ((int)sizeof(struct metrics_snapshot_t))
+
 struct system_tag_t {
     /*struct plc_tag_t p_tag;*/
     TAG_BASE_STRUCT;
 
     char name[MAX_SYSTEM_TAG_NAME];
-    uint8_t backing_data[MAX_SYSTEM_TAG_SIZE];
+    uint8_t backing_data[sizeof(struct metrics_snapshot_t)];
 };
 
 typedef struct system_tag_t *system_tag_p;
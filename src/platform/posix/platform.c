@@ -49,6 +49,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -835,6 +836,64 @@ extern int thread_destroy(thread_p *t) {
 }
 
 
+/*
+ * thread_at_exit
+ *
+ * Call func(arg) in the current thread when it exits.  The functions are
+ * called most recent first.  This does not work for the main thread if it
+ * returns from main().
+ */
+
+struct thread_exit_func_t {
+    struct thread_exit_func_t *next;
+    void (*func)(void *arg);
+    void *arg;
+};
+
+static pthread_once_t thread_exit_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_exit_key;
+static int thread_exit_key_rc = 0;
+
+static void thread_exit_key_destructor(void *value) {
+    struct thread_exit_func_t *exit_func = (struct thread_exit_func_t *)value;
+
+    while(exit_func) {
+        struct thread_exit_func_t *next = exit_func->next;
+
+        exit_func->func(exit_func->arg);
+        mem_free(exit_func);
+
+        exit_func = next;
+    }
+}
+
+static void thread_exit_key_init(void) { thread_exit_key_rc = pthread_key_create(&thread_exit_key, thread_exit_key_destructor); }
+
+extern int thread_at_exit(void (*func)(void *arg), void *arg) {
+    struct thread_exit_func_t *exit_func = NULL;
+
+    if(!func) { return PLCTAG_ERR_NULL_PTR; }
+
+    pthread_once(&thread_exit_key_once, thread_exit_key_init);
+
+    if(thread_exit_key_rc) { return PLCTAG_ERR_CREATE; }
+
+    exit_func = (struct thread_exit_func_t *)mem_alloc((int)(unsigned int)sizeof(*exit_func));
+    if(!exit_func) { return PLCTAG_ERR_NO_MEM; }
+
+    exit_func->func = func;
+    exit_func->arg = arg;
+    exit_func->next = (struct thread_exit_func_t *)pthread_getspecific(thread_exit_key);
+
+    if(pthread_setspecific(thread_exit_key, exit_func)) {
+        mem_free(exit_func);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 /***************************************************************************
  ******************************* Atomic Ops ********************************
  **************************************************************************/
@@ -1680,6 +1739,10 @@ int socket_read(sock_p s, uint8_t *buf, int size, int timeout_ms) {
             pdebug(DEBUG_WARN, "Socket read error: rc=%d, errno=%d", rc, errno);
             return PLCTAG_ERR_READ;
         }
+    } else if(rc == 0 && size > 0) {
+        /* a non-blocking read only returns zero when the other end closed the connection. */
+        pdebug(DEBUG_WARN, "Socket closed by the other end!");
+        return PLCTAG_ERR_READ;
     }
 
     /* only wait if we have a timeout and no error and no data. */
@@ -1749,6 +1812,9 @@ int socket_read(sock_p s, uint8_t *buf, int size, int timeout_ms) {
                 pdebug(DEBUG_WARN, "Socket read error: rc=%d, errno=%d", rc, errno);
                 return PLCTAG_ERR_READ;
             }
+        } else if(rc == 0 && size > 0) {
+            pdebug(DEBUG_WARN, "Socket closed by the other end!");
+            return PLCTAG_ERR_READ;
         }
     }
 
@@ -2067,6 +2133,130 @@ int sock_create_event_wakeup_channel(sock_p sock) {
 }
 
 
+/***************************************************************************
+ ***************************** Shared Memory *******************************
+ **************************************************************************/
+
+
+struct shared_mem_t {
+    char *name;
+    int fd;
+    uint8_t *data;
+    int size;
+};
+
+
+/*
+ * shared_mem_create
+ *
+ * Create a named shared memory region of the given size and map it into
+ * this process.  The contents are zeroed.  POSIX names must start with a
+ * slash, so one is added if it is missing.
+ *
+ * A region left under the name by an earlier owner is unlinked rather than
+ * resized.  Other processes that still map it keep their mapping and do not
+ * get SIGBUS, and nothing left in it carries over into the new region.
+ */
+int shared_mem_create(shared_mem_p *shm, const char *name, int size, uint8_t **data) {
+    shared_mem_p new_shm = NULL;
+    void *mapping = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!shm || !name || !data) {
+        pdebug(DEBUG_WARN, "Null pointer passed!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    if(str_length(name) < 1 || size <= 0) {
+        pdebug(DEBUG_WARN, "Shared memory name must not be empty and size must be positive!");
+        return PLCTAG_ERR_BAD_PARAM;
+    }
+
+    new_shm = (shared_mem_p)mem_alloc((int)sizeof(struct shared_mem_t));
+    if(!new_shm) {
+        pdebug(DEBUG_ERROR, "Unable to allocate shared memory struct!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    new_shm->name = (name[0] == '/') ? str_dup(name) : str_concat("/", name);
+    if(!new_shm->name) {
+        pdebug(DEBUG_ERROR, "Unable to allocate shared memory name!");
+        mem_free(new_shm);
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    /* the old region stays alive for anyone still mapping it. */
+    if(shm_unlink(new_shm->name) == 0) { pdebug(DEBUG_INFO, "Removed old shared memory %s.", new_shm->name); }
+
+    new_shm->fd = shm_open(new_shm->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(new_shm->fd < 0) {
+        pdebug(DEBUG_WARN, "Unable to open shared memory %s, errno=%d!", new_shm->name, errno);
+        mem_free(new_shm->name);
+        mem_free(new_shm);
+        return PLCTAG_ERR_OPEN;
+    }
+
+    if(ftruncate(new_shm->fd, (off_t)size) != 0) {
+        pdebug(DEBUG_WARN, "Unable to size shared memory %s to %d bytes, errno=%d!", new_shm->name, size, errno);
+        close(new_shm->fd);
+        shm_unlink(new_shm->name);
+        mem_free(new_shm->name);
+        mem_free(new_shm);
+        return PLCTAG_ERR_NO_RESOURCES;
+    }
+
+    mapping = mmap(NULL, (size_t)(unsigned int)size, PROT_READ | PROT_WRITE, MAP_SHARED, new_shm->fd, 0);
+    if(mapping == MAP_FAILED) {
+        pdebug(DEBUG_WARN, "Unable to map shared memory %s, errno=%d!", new_shm->name, errno);
+        close(new_shm->fd);
+        shm_unlink(new_shm->name);
+        mem_free(new_shm->name);
+        mem_free(new_shm);
+        return PLCTAG_ERR_NO_RESOURCES;
+    }
+
+    new_shm->data = (uint8_t *)mapping;
+    new_shm->size = size;
+
+    *shm = new_shm;
+    *data = new_shm->data;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+/*
+ * shared_mem_destroy
+ *
+ * Unmap the region.  If remove_name is set, the name is removed as well.
+ * Other processes that have the region mapped keep their mappings.
+ */
+int shared_mem_destroy(shared_mem_p *shm, int remove_name) {
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!shm || !*shm) {
+        pdebug(DEBUG_WARN, "Null pointer passed!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    munmap((*shm)->data, (size_t)(unsigned int)(*shm)->size);
+    close((*shm)->fd);
+
+    if(remove_name) { shm_unlink((*shm)->name); }
+
+    mem_free((*shm)->name);
+    mem_free(*shm);
+    *shm = NULL;
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 /***************************************************************************
  ***************************** Miscellaneous *******************************
  **************************************************************************/
@@ -2140,3 +2330,33 @@ int64_t time_ms(void) {
 
     return ((int64_t)tv.tv_sec * 1000) + ((int64_t)tv.tv_usec / 1000);
 }
+
+
+/*
+ * time_monotonic_ms
+ *
+ * Return a time in milliseconds that never goes backward.  It has no relation
+ * to the wall clock, use it for ordering and intervals.
+ */
+int64_t time_monotonic_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t)ts.tv_sec * 1000) + ((int64_t)ts.tv_nsec / 1000000);
+}
+
+
+/*
+ * time_monotonic_us
+ *
+ * The same clock as time_monotonic_ms() in microseconds, for timing short
+ * operations.
+ */
+int64_t time_monotonic_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((int64_t)ts.tv_sec * 1000000) + ((int64_t)ts.tv_nsec / 1000);
+}
@@ -152,6 +152,7 @@ extern void thread_kill(thread_p t);
 extern int thread_join(thread_p t);
 extern int thread_detach(void);
 extern int thread_destroy(thread_p *t);
+extern int thread_at_exit(void (*func)(void *arg), void *arg);
 
 #define THREAD_FUNC(func) void *func(void *arg)
 #define THREAD_RETURN(val) return (void *)val;
@@ -209,6 +210,11 @@ extern int socket_write(sock_p s, uint8_t *buf, int size, int timeout_ms);
 extern int socket_close(sock_p s);
 extern int socket_destroy(sock_p *s);
 
+/* shared memory */
+typedef struct shared_mem_t *shared_mem_p;
+extern int shared_mem_create(shared_mem_p *shm, const char *name, int size, uint8_t **data);
+extern int shared_mem_destroy(shared_mem_p *shm, int remove_name);
+
 /* serial handling */
 /* FIXME - either implement this or remove it. */
 typedef struct serial_port_t *serial_port_p;
@@ -221,6 +227,8 @@ extern int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, i
 /* misc functions */
 extern int sleep_ms(int ms);
 extern int64_t time_ms(void);
+extern int64_t time_monotonic_ms(void);
+extern int64_t time_monotonic_us(void);
 
 #define snprintf_platform snprintf
 
@@ -909,6 +909,65 @@ extern int thread_destroy(thread_p *t) {
 }
 
 
+/*
+ * thread_at_exit
+ *
+ * Call func(arg) in the current thread when it exits.  The functions are
+ * called most recent first.  This uses fiber local storage because that is
+ * the only storage with a cleanup callback.
+ */
+
+struct thread_exit_func_t {
+    struct thread_exit_func_t *next;
+    void (*func)(void *arg);
+    void *arg;
+};
+
+static lock_t thread_exit_index_lock = LOCK_INIT;
+static DWORD thread_exit_index = FLS_OUT_OF_INDEXES;
+
+static VOID NTAPI thread_exit_callback(PVOID value) {
+    struct thread_exit_func_t *exit_func = (struct thread_exit_func_t *)value;
+
+    while(exit_func) {
+        struct thread_exit_func_t *next = exit_func->next;
+
+        exit_func->func(exit_func->arg);
+        mem_free(exit_func);
+
+        exit_func = next;
+    }
+}
+
+extern int thread_at_exit(void (*func)(void *arg), void *arg) {
+    struct thread_exit_func_t *exit_func = NULL;
+    DWORD index = FLS_OUT_OF_INDEXES;
+
+    if(!func) { return PLCTAG_ERR_NULL_PTR; }
+
+    lock_acquire(&thread_exit_index_lock);
+    if(thread_exit_index == FLS_OUT_OF_INDEXES) { thread_exit_index = FlsAlloc(thread_exit_callback); }
+    index = thread_exit_index;
+    lock_release(&thread_exit_index_lock);
+
+    if(index == FLS_OUT_OF_INDEXES) { return PLCTAG_ERR_CREATE; }
+
+    exit_func = (struct thread_exit_func_t *)mem_alloc((int)(unsigned int)sizeof(*exit_func));
+    if(!exit_func) { return PLCTAG_ERR_NO_MEM; }
+
+    exit_func->func = func;
+    exit_func->arg = arg;
+    exit_func->next = (struct thread_exit_func_t *)FlsGetValue(index);
+
+    if(!FlsSetValue(index, exit_func)) {
+        mem_free(exit_func);
+        return PLCTAG_ERR_CREATE;
+    }
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 /***************************************************************************
  ******************************* Atomic Ops ********************************
  **************************************************************************/
@@ -1692,6 +1751,10 @@ int socket_read(sock_p s, uint8_t *buf, int size, int timeout_ms) {
             pdebug(DEBUG_WARN, "socket read error rc=%d, errno=%d", rc, err);
             return PLCTAG_ERR_READ;
         }
+    } else if(rc == 0 && size > 0) {
+        /* a non-blocking read only returns zero when the other end closed the connection. */
+        pdebug(DEBUG_WARN, "Socket closed by the other end!");
+        return PLCTAG_ERR_READ;
     }
 
     /* only wait if we have a timeout and no data and no error. */
@@ -1777,6 +1840,9 @@ int socket_read(sock_p s, uint8_t *buf, int size, int timeout_ms) {
                 pdebug(DEBUG_WARN, "socket read error rc=%d, errno=%d", rc, err);
                 return PLCTAG_ERR_READ;
             }
+        } else if(rc == 0 && size > 0) {
+            pdebug(DEBUG_WARN, "Socket closed by the other end!");
+            return PLCTAG_ERR_READ;
         }
     }
 
@@ -2151,6 +2217,56 @@ int sock_create_event_wakeup_channel(sock_p sock) {
 }
 
 
+/***************************************************************************
+ ***************************** Shared Memory *******************************
+ **************************************************************************/
+
+
+struct shared_mem_t {
+    int unused;
+};
+
+
+/*
+ * shared_mem_create
+ *
+ * Process images are not supported on Windows yet.  The shared counters need
+ * atomics that are known to work across processes here and nothing has been
+ * built or tested, so refuse rather than ship a mapping that may misbehave.
+ */
+int shared_mem_create(shared_mem_p *shm, const char *name, int size, uint8_t **data) {
+    (void)name;
+    (void)size;
+
+    if(shm) { *shm = NULL; }
+    if(data) { *data = NULL; }
+
+    pdebug(DEBUG_WARN, "Shared memory is not supported on Windows!");
+
+    return PLCTAG_ERR_UNSUPPORTED;
+}
+
+
+/*
+ * shared_mem_destroy
+ *
+ * Nothing is ever created, see shared_mem_create.
+ */
+int shared_mem_destroy(shared_mem_p *shm, int remove_name) {
+    (void)remove_name;
+
+    if(!shm || !*shm) {
+        pdebug(DEBUG_WARN, "Null pointer passed!");
+        return PLCTAG_ERR_NULL_PTR;
+    }
+
+    mem_free(*shm);
+    *shm = NULL;
+
+    return PLCTAG_STATUS_OK;
+}
+
+
 /***************************************************************************
  ****************************** Serial Port ********************************
  **************************************************************************/
@@ -2388,6 +2504,34 @@ int64_t time_ms(void) {
 }
 
 
+/*
+ * time_monotonic_ms
+ *
+ * Return a time in milliseconds that never goes backward.  It has no relation
+ * to the wall clock, use it for ordering and intervals.
+ */
+int64_t time_monotonic_ms(void) { return (int64_t)GetTickCount64(); }
+
+
+/*
+ * time_monotonic_us
+ *
+ * A time in microseconds that never goes backward, for timing short
+ * operations.  The tick count is only good to about 16ms, so this uses the
+ * performance counter.
+ */
+int64_t time_monotonic_us(void) {
+    LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+
+    /* split the division so the multiply does not overflow. */
+    return ((count.QuadPart / freq.QuadPart) * 1000000) + (((count.QuadPart % freq.QuadPart) * 1000000) / freq.QuadPart);
+}
+
+
 struct tm *localtime_r(const time_t *timep, struct tm *result) {
     time_t t = *timep;
 
@@ -210,6 +210,7 @@ extern void thread_kill(thread_p t);
 extern int thread_join(thread_p t);
 extern int thread_detach();
 extern int thread_destroy(thread_p *t);
+extern int thread_at_exit(void (*func)(void *arg), void *arg);
 
 #define THREAD_FUNC(func) DWORD __stdcall func(LPVOID arg)
 #define THREAD_RETURN(val) return (DWORD)val;
@@ -281,6 +282,11 @@ extern int socket_close(sock_p s);
 extern int socket_destroy(sock_p *s);
 
 
+/* shared memory */
+typedef struct shared_mem_t *shared_mem_p;
+extern int shared_mem_create(shared_mem_p *shm, const char *name, int size, uint8_t **data);
+extern int shared_mem_destroy(shared_mem_p *shm, int remove_name);
+
 /* serial handling */
 typedef struct serial_port_t *serial_port_p;
 #define PLC_SERIAL_PORT_NULL ((plc_serial_port)NULL)
@@ -293,6 +299,8 @@ extern int plc_lib_serial_port_write(serial_port_p serial_port, uint8_t *data, i
 /* time functions */
 extern int sleep_ms(int ms);
 extern int64_t time_ms(void);
+extern int64_t time_monotonic_ms(void);
+extern int64_t time_monotonic_us(void);
 extern struct tm *localtime_r(const time_t *timep, struct tm *result);
 
 /* some functions can be simply replaced */
@@ -44,11 +44,13 @@
 
 
 /* tag commands */
+#define CIP_SRV_GET_ATTRIBUTES_ALL ((uint8_t)0x01)
 #define CIP_SRV_MULTI ((uint8_t)0x0a)
 #define CIP_SRV_PCCC_EXECUTE ((uint8_t)0x4b)
 #define CIP_SRV_READ_NAMED_TAG ((uint8_t)0x4c)
 #define CIP_SRV_WRITE_NAMED_TAG ((uint8_t)0x4d)
 #define CIP_SRV_FORWARD_CLOSE ((uint8_t)0x4e)
+#define CIP_SRV_READ_MODIFY_WRITE ((uint8_t)0x4e) /* same code as Forward Close, but sent to a tag. */
 #define CIP_SRV_READ_NAMED_TAG_FRAG ((uint8_t)0x52)
 #define CIP_SRV_WRITE_NAMED_TAG_FRAG ((uint8_t)0x53)
 #define CIP_SRV_FORWARD_OPEN ((uint8_t)0x54)
@@ -62,6 +64,8 @@
 //  const uint8_t CIP_PCCC_PREFIX[] = { 0x07, 0x3d, 0xf3, 0x45, 0x43, 0x50, 0x21 };
 //  const uint8_t CIP_FORWARD_CLOSE[] = { 0x4E, 0x02, 0x20, 0x06, 0x24, 0x01 };
 const uint8_t CIP_OBJ_CONNECTION_MANAGER[] = {0x20, 0x06, 0x24, 0x01};
+const uint8_t CIP_OBJ_IDENTITY[] = {0x20, 0x01, 0x24, 0x01};
+#define CIP_CLASS_OMRON_TAG_NAME_SERVER ((uint8_t)0x6a)
 // const uint8_t CIP_LIST_TAGS[] = { 0x55, 0x02, 0x20, 0x02, 0x24, 0x01 };
 // const uint8_t CIP_FORWARD_OPEN_EX[] = { 0x5B, 0x02, 0x20, 0x06, 0x24, 0x01 };
 
@@ -84,6 +88,7 @@ const uint8_t CIP_OBJ_CONNECTION_MANAGER[] = {0x20, 0x06, 0x24, 0x01};
 #define CIP_ERR_UNSUPPORTED ((uint8_t)0x08)
 #define CIP_ERR_INSUFFICIENT_DATA ((uint8_t)0x13)
 #define CIP_ERR_TOO_MUCH_DATA ((uint8_t)0x15)
+#define CIP_ERR_EMBEDDED ((uint8_t)0x1e)
 #define CIP_ERR_EXTENDED ((uint8_t)0xff)
 
 #define CIP_ERR_EX_DUPLICATE_CONN ((uint16_t)0x0100)
@@ -127,6 +132,14 @@ static slice_s handle_read_request(uint8_t cip_service, slice_s cip_service_path
                                    plc_s *plc);
 static slice_s handle_write_request(uint8_t cip_service, slice_s cip_service_path, slice_s cip_service_payload, slice_s output,
                                     plc_s *plc);
+static slice_s handle_rmw_request(uint8_t cip_service, slice_s cip_service_path, slice_s cip_service_payload, slice_s output,
+                                  plc_s *plc);
+static slice_s handle_multi_request(uint8_t cip_service, slice_s cip_service_path, slice_s cip_service_payload, slice_s output,
+                                    plc_s *plc);
+static slice_s handle_identity_request(uint8_t cip_service, slice_s cip_service_path, slice_s cip_service_payload,
+                                       slice_s output, plc_s *plc);
+static slice_s handle_omron_tag_table_request(uint8_t cip_service, slice_s cip_service_path, slice_s cip_service_payload,
+                                              slice_s output, plc_s *plc);
 
 static bool parse_cip_request(slice_s input, uint8_t *cip_service, slice_s *cip_service_path, slice_s *cip_service_payload);
 static bool extract_cip_path(slice_s input, size_t *offset, bool padded, slice_s *output);
@@ -162,6 +175,10 @@ slice_s cip_dispatch_request(slice_s input, slice_s output, plc_s *plc) {
             break;
 
         case CIP_SRV_FORWARD_CLOSE:
+            if(!slice_match_data_exact(cip_service_path, CIP_OBJ_CONNECTION_MANAGER, sizeof(CIP_OBJ_CONNECTION_MANAGER))) {
+                return handle_rmw_request(cip_service, cip_service_path, cip_service_payload, output, plc);
+            }
+
             return handle_forward_close(cip_service, cip_service_path, cip_service_payload, output, plc);
             break;
 
@@ -177,6 +194,16 @@ slice_s cip_dispatch_request(slice_s input, slice_s output, plc_s *plc) {
 
         case CIP_SRV_PCCC_EXECUTE: return dispatch_pccc_request(input, output, plc); break;
 
+        case CIP_SRV_MULTI: return handle_multi_request(cip_service, cip_service_path, cip_service_payload, output, plc); break;
+
+        case CIP_SRV_GET_ATTRIBUTES_ALL:
+            if(plc->plc_type == PLC_OMRON) {
+                return handle_omron_tag_table_request(cip_service, cip_service_path, cip_service_payload, output, plc);
+            }
+
+            return handle_identity_request(cip_service, cip_service_path, cip_service_payload, output, plc);
+            break;
+
         default: return make_cip_error(output, cip_service, CIP_ERR_UNSUPPORTED, false, 0); break;
     }
 }
@@ -779,6 +806,343 @@ slice_s handle_write_request(uint8_t cip_service, slice_s cip_service_path, slic
 }
 
 
+#define CIP_RMW_PAYLOAD_MIN_SIZE ((size_t)4) /* two bytes for the mask size, at least one byte for each mask */
+
+/*
+ * Handle a Read Modify Write Tag request.  The payload is the size of each
+ * mask followed by the OR mask and the AND mask.  The masks apply to one
+ * element of the tag, OR first.
+ */
+
+slice_s handle_rmw_request(uint8_t cip_service, slice_s cip_service_path, slice_s cip_service_payload, slice_s output,
+                           plc_s *plc) {
+    tag_def_s *tag = NULL;
+    uint32_t num_indexes = CIP_TAG_MAX_INDEXES;
+    uint32_t indexes[CIP_TAG_MAX_INDEXES] = {0};
+    size_t mask_size = 0;
+    size_t request_start_byte_offset = 0;
+    size_t request_end_byte_offset = 0;
+    slice_s cip_response_header_slice = {0};
+
+    info("Processing Read Modify Write Tag request.");
+
+    if(plc->plc_type != PLC_CONTROL_LOGIX) {
+        info("Only ControlLogix PLCs support the Read Modify Write Tag service!");
+        return make_cip_error(output, cip_service, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    if(!parse_tag_path(cip_service_path, plc, &tag, &num_indexes, &(indexes[0]))) {
+        info("Unable to parse tag path:");
+        slice_dump(cip_service_path);
+        return make_cip_error(output, cip_service, CIP_ERR_INVALID_PARAM, false, 0);
+    }
+
+    if(num_indexes > 0 && num_indexes != tag->num_dimensions) {
+        info("Wrong number of indexes passed.   Must be zero or %zu indexes.", tag->num_dimensions);
+        return make_cip_error(output, cip_service, CIP_ERR_INVALID_PARAM, false, 0);
+    }
+
+    if(slice_len(cip_service_payload) < CIP_RMW_PAYLOAD_MIN_SIZE) {
+        info("Insufficient data in the CIP read modify write request payload!");
+        return make_cip_error(output, cip_service, CIP_ERR_INSUFFICIENT_DATA, false, 0);
+    }
+
+    mask_size = slice_get_uint16_le(cip_service_payload, 0);
+
+    if(mask_size == 0 || mask_size > tag->elem_size || slice_len(cip_service_payload) != 2 + (2 * mask_size)) {
+        info("Mask size %zu does not match the payload or the tag element size %zu!", mask_size, tag->elem_size);
+        return make_cip_error(output, cip_service, CIP_ERR_INVALID_PARAM, false, 0);
+    }
+
+    if(!calculate_request_start_and_end_offsets(tag, num_indexes, indexes, 1, &request_start_byte_offset,
+                                                &request_end_byte_offset)) {
+        info("Unable to calculate the offset of the read modify write request!");
+        return make_cip_error(output, cip_service, CIP_ERR_INVALID_PARAM, false, 0);
+    }
+
+    critical_block(tag->data_mutex) {
+        for(size_t i = 0; i < mask_size; i++) {
+            uint8_t or_mask = slice_get_uint8(cip_service_payload, 2 + i);
+            uint8_t and_mask = slice_get_uint8(cip_service_payload, 2 + mask_size + i);
+
+            tag->data[request_start_byte_offset + i] = (uint8_t)((tag->data[request_start_byte_offset + i] | or_mask) & and_mask);
+        }
+    }
+
+    cip_response_header_slice = slice_from_slice(output, 0, CIP_RESPONSE_HEADER_SIZE);
+
+    slice_set_uint8(cip_response_header_slice, 0, cip_service | CIP_DONE);
+    slice_set_uint8(cip_response_header_slice, 1, 0);      /* reserved */
+    slice_set_uint8(cip_response_header_slice, 2, CIP_OK); /* status */
+    slice_set_uint8(cip_response_header_slice, 3, 0);      /* no extended error */
+
+    return cip_response_header_slice;
+}
+
+
+/* vendor, device type, product code, revision, status, serial number and the name length. */
+#define CIP_IDENTITY_FIXED_SIZE ((size_t)15)
+
+/*
+ * Handle Get Attributes All on the Identity object.  The client reads it to
+ * find out which PLC it is talking to.
+ */
+
+slice_s handle_identity_request(uint8_t cip_service, slice_s cip_service_path, slice_s cip_service_payload,
+                                slice_s output, plc_s *plc) {
+    const char *product_name = NULL;
+    uint16_t product_code = 0;
+    size_t name_len = 0;
+    slice_s identity_slice = {0};
+
+    (void)cip_service_payload;
+
+    info("Processing Identity request.");
+
+    if(!slice_match_data_exact(cip_service_path, CIP_OBJ_IDENTITY, sizeof(CIP_OBJ_IDENTITY))) {
+        info("Only the Identity object supports Get Attributes All!");
+        return make_cip_error(output, cip_service, CIP_ERR_PATH_DEST_UNKNOWN, false, 0);
+    }
+
+    switch(plc->plc_type) {
+        case PLC_CONTROL_LOGIX:
+            product_name = "1756-L81E/B";
+            product_code = 166;
+            break;
+
+        case PLC_MICRO800:
+            product_name = "2080-LC50-48QWB";
+            product_code = 191;
+            break;
+
+        default:
+            info("Only ControlLogix and Micro800 PLCs support the Identity object!");
+            return make_cip_error(output, cip_service, CIP_ERR_UNSUPPORTED, false, 0);
+    }
+
+    name_len = strlen(product_name);
+
+    identity_slice = slice_from_slice(output, 0, CIP_RESPONSE_HEADER_SIZE + CIP_IDENTITY_FIXED_SIZE + name_len);
+    if(slice_len(identity_slice) < CIP_RESPONSE_HEADER_SIZE + CIP_IDENTITY_FIXED_SIZE + name_len) {
+        info("Not enough room for the Identity response!");
+        return make_cip_error(output, cip_service, CIP_ERR_TOO_MUCH_DATA, false, 0);
+    }
+
+    slice_set_uint8(identity_slice, 0, cip_service | CIP_DONE);
+    slice_set_uint8(identity_slice, 1, 0);      /* reserved */
+    slice_set_uint8(identity_slice, 2, CIP_OK); /* status */
+    slice_set_uint8(identity_slice, 3, 0);      /* no extended error */
+
+    slice_set_uint16_le(identity_slice, 4, 1);            /* vendor, Rockwell */
+    slice_set_uint16_le(identity_slice, 6, 0x0E);         /* device type, PLC */
+    slice_set_uint16_le(identity_slice, 8, product_code); /* product code */
+    slice_set_uint8(identity_slice, 10, 33);              /* major revision */
+    slice_set_uint8(identity_slice, 11, 11);              /* minor revision */
+    slice_set_uint16_le(identity_slice, 12, 0x3060);      /* status */
+    slice_set_uint32_le(identity_slice, 14, 0x12345678);  /* serial number */
+    slice_set_uint8(identity_slice, 18, (uint8_t)name_len);
+
+    for(size_t i = 0; i < name_len; i++) { slice_set_uint8(identity_slice, 19 + i, (uint8_t)product_name[i]); }
+
+    return identity_slice;
+}
+
+
+/* the fixed part of a variable type reply: size, type, element type, dimension count and a pad byte. */
+#define CIP_OMRON_TAG_TYPE_FIXED_SIZE ((size_t)8)
+
+/*
+ * Handle Get Attributes All on an Omron variable.  A request to the Tag
+ * Name Server class gets the size of the variable table (instance 0) or
+ * the name of one variable.  A request to a symbolic path gets the type
+ * and dimensions of the variable.  Instance IDs follow the order of the
+ * tag list.
+ */
+
+slice_s handle_omron_tag_table_request(uint8_t cip_service, slice_s cip_service_path, slice_s cip_service_payload,
+                                       slice_s output, plc_s *plc) {
+    slice_s reply_slice = {0};
+    size_t reply_size = 0;
+    size_t offset = CIP_RESPONSE_HEADER_SIZE;
+
+    (void)cip_service_payload;
+
+    info("Processing Omron variable table request.");
+
+    if(slice_len(cip_service_path) >= 2 && slice_get_uint8(cip_service_path, 0) == 0x20
+       && slice_get_uint8(cip_service_path, 1) == CIP_CLASS_OMRON_TAG_NAME_SERVER) {
+        uint32_t instance = 0;
+        uint16_t tag_count = 0;
+        tag_def_s *tag = NULL;
+
+        if(slice_len(cip_service_path) == 4 && slice_get_uint8(cip_service_path, 2) == 0x24) {
+            instance = slice_get_uint8(cip_service_path, 3);
+        } else if(slice_len(cip_service_path) == 6 && slice_get_uint8(cip_service_path, 2) == 0x25) {
+            instance = slice_get_uint16_le(cip_service_path, 4);
+        } else {
+            info("Unsupported Tag Name Server path!");
+            return make_cip_error(output, cip_service, CIP_ERR_PATH_DEST_UNKNOWN, false, 0);
+        }
+
+        for(tag = plc->tags; tag; tag = tag->next_tag) {
+            tag_count++;
+            if(instance == tag_count) { break; }
+        }
+
+        if(instance == 0) {
+            reply_size = CIP_RESPONSE_HEADER_SIZE + 6;
+        } else if(tag) {
+            reply_size = CIP_RESPONSE_HEADER_SIZE + 5 + strlen(tag->name);
+        } else {
+            info("No variable with instance ID %u!", (unsigned int)instance);
+            return make_cip_error(output, cip_service, CIP_ERR_PATH_DEST_UNKNOWN, false, 0);
+        }
+
+        reply_slice = slice_from_slice(output, 0, reply_size);
+        if(slice_len(reply_slice) < reply_size) {
+            info("Not enough room for the variable table response!");
+            return make_cip_error(output, cip_service, CIP_ERR_TOO_MUCH_DATA, false, 0);
+        }
+
+        if(instance == 0) {
+            slice_set_uint16_le(reply_slice, offset, 1);             /* revision */
+            slice_set_uint16_le(reply_slice, offset + 2, tag_count); /* number of instances */
+            slice_set_uint16_le(reply_slice, offset + 4, tag_count); /* highest instance ID */
+        } else {
+            size_t name_len = strlen(tag->name);
+
+            slice_set_uint32_le(reply_slice, offset, (uint32_t)(tag->elem_size * tag->elem_count));
+            slice_set_uint8(reply_slice, offset + 4, (uint8_t)name_len);
+
+            for(size_t i = 0; i < name_len; i++) { slice_set_uint8(reply_slice, offset + 5 + i, (uint8_t)tag->name[i]); }
+        }
+    } else {
+        tag_def_s *tag = NULL;
+        uint32_t num_indexes = 3;
+        uint32_t indexes[3] = {0};
+
+        if(!parse_tag_path(cip_service_path, plc, &tag, &num_indexes, &(indexes[0])) || num_indexes > 0) {
+            info("Unable to find the variable!");
+            return make_cip_error(output, cip_service, CIP_ERR_PATH_DEST_UNKNOWN, false, 0);
+        }
+
+        reply_size = CIP_RESPONSE_HEADER_SIZE + CIP_OMRON_TAG_TYPE_FIXED_SIZE + (tag->num_dimensions * 4);
+
+        reply_slice = slice_from_slice(output, 0, reply_size);
+        if(slice_len(reply_slice) < reply_size) {
+            info("Not enough room for the variable type response!");
+            return make_cip_error(output, cip_service, CIP_ERR_TOO_MUCH_DATA, false, 0);
+        }
+
+        slice_set_uint32_le(reply_slice, offset, (uint32_t)(tag->elem_size * tag->elem_count));
+        slice_set_uint8(reply_slice, offset + 4, (uint8_t)(tag->num_dimensions > 0 ? 0xA3 : (tag->tag_type & 0xFF)));
+        slice_set_uint8(reply_slice, offset + 5, (uint8_t)(tag->tag_type & 0xFF));
+        slice_set_uint8(reply_slice, offset + 6, (uint8_t)tag->num_dimensions);
+        slice_set_uint8(reply_slice, offset + 7, 0); /* pad */
+
+        for(size_t i = 0; i < tag->num_dimensions; i++) {
+            slice_set_uint32_le(reply_slice, offset + CIP_OMRON_TAG_TYPE_FIXED_SIZE + (i * 4), (uint32_t)tag->dimensions[i]);
+        }
+    }
+
+    slice_set_uint8(reply_slice, 0, cip_service | CIP_DONE);
+    slice_set_uint8(reply_slice, 1, 0);      /* reserved */
+    slice_set_uint8(reply_slice, 2, CIP_OK); /* status */
+    slice_set_uint8(reply_slice, 3, 0);      /* no extended error */
+
+    return reply_slice;
+}
+
+
+/* the reply header and the service count. */
+#define CIP_MULTI_RESP_HEADER_SIZE (6)
+
+/*
+ * Handle a Multiple Service Packet.  Each embedded request is dispatched
+ * on its own and the replies are packed in the same order.  The request
+ * and the response share a buffer, so the request is copied out first.
+ */
+
+slice_s handle_multi_request(uint8_t cip_service, slice_s cip_service_path, slice_s cip_service_payload, slice_s output,
+                             plc_s *plc) {
+    uint16_t service_count = 0;
+    size_t output_offset = 0;
+    uint8_t cip_err = CIP_OK;
+    uint8_t *request_copy = NULL;
+    slice_s requests = {0};
+
+    (void)cip_service_path;
+
+    if(slice_len(cip_service_payload) < 2) {
+        info("Multiple Service request is too short!");
+        return make_cip_error(output, cip_service, CIP_ERR_INSUFFICIENT_DATA, false, 0);
+    }
+
+    service_count = slice_get_uint16_le(cip_service_payload, 0);
+
+    if(service_count == 0 || slice_len(cip_service_payload) < 2 + ((size_t)service_count * 2)) {
+        info("Multiple Service request has a bad service count %u!", (unsigned int)service_count);
+        return make_cip_error(output, cip_service, CIP_ERR_INVALID_PARAM, false, 0);
+    }
+
+    output_offset = CIP_MULTI_RESP_HEADER_SIZE + ((size_t)service_count * 2);
+
+    if(slice_len(output) < output_offset) {
+        info("Not enough room for the Multiple Service response!");
+        return make_cip_error(output, cip_service, CIP_ERR_TOO_MUCH_DATA, false, 0);
+    }
+
+    request_copy = malloc(slice_len(cip_service_payload));
+    if(!request_copy) {
+        info("Unable to allocate memory for the Multiple Service request!");
+        return make_cip_error(output, cip_service, CIP_ERR_INVALID_PARAM, false, 0);
+    }
+
+    slice_copy_data_out(request_copy, slice_len(cip_service_payload), cip_service_payload);
+    requests = slice_make(request_copy, (ssize_t)slice_len(cip_service_payload));
+
+    for(uint16_t i = 0; i < service_count; i++) {
+        size_t start = slice_get_uint16_le(requests, 2 + ((size_t)i * 2));
+        size_t end = (i + 1 < service_count) ? slice_get_uint16_le(requests, 2 + ((size_t)(i + 1) * 2)) : slice_len(requests);
+        slice_s sub_response = {0};
+
+        if(start < 2 + ((size_t)service_count * 2) || end <= start || end > slice_len(requests)) {
+            info("Multiple Service request has a bad offset for service %u!", (unsigned int)i);
+            cip_err = CIP_ERR_INVALID_PARAM;
+            break;
+        }
+
+        sub_response = cip_dispatch_request(slice_from_slice(requests, start, end - start),
+                                            slice_from_slice(output, output_offset, slice_len(output) - output_offset), plc);
+
+        if(slice_has_err(sub_response) || slice_len(sub_response) < 4) {
+            info("Unable to process service %u of the Multiple Service request!", (unsigned int)i);
+            cip_err = CIP_ERR_TOO_MUCH_DATA;
+            break;
+        }
+
+        /* the reply offsets count from the service count. */
+        slice_set_uint16_le(output, 4 + 2 + ((size_t)i * 2), (uint16_t)(output_offset - 4));
+
+        if(slice_get_uint8(sub_response, 2) != CIP_OK) { cip_err = CIP_ERR_EMBEDDED; }
+
+        output_offset += slice_len(sub_response);
+    }
+
+    free(request_copy);
+
+    if(cip_err != CIP_OK && cip_err != CIP_ERR_EMBEDDED) { return make_cip_error(output, cip_service, cip_err, false, 0); }
+
+    slice_set_uint8(output, 0, cip_service | CIP_DONE);
+    slice_set_uint8(output, 1, 0); /* reserved */
+    slice_set_uint8(output, 2, cip_err);
+    slice_set_uint8(output, 3, 0); /* no extended error */
+    slice_set_uint16_le(output, 4, service_count);
+
+    return slice_from_slice(output, 0, output_offset);
+}
+
+
 slice_s make_cip_error(slice_s output, uint8_t cip_cmd, uint8_t cip_err, bool extend, uint16_t extended_error) {
     size_t result_size = 0;
 
@@ -838,18 +1202,11 @@ bool parse_tag_path(slice_s tag_path, plc_s *plc, tag_def_s **tag, uint32_t *num
     if(offset % 2 != 0) { offset++; }
 
     /* find the tag */
-    *tag = plc->tags;
+    *tag = plc_find_tag(plc, slice_get_bytes(tag_name_slice, 0), slice_len(tag_name_slice));
 
-    while(*tag) {
-        if(slice_match_string_exact(tag_name_slice, (*tag)->name)) {
-            info("Found tag %s", (*tag)->name);
-            break;
-        }
-
-        (*tag) = (*tag)->next_tag;
-    }
-
-    if(!*tag) {
+    if(*tag) {
+        info("Found tag %s", (*tag)->name);
+    } else {
         info("Tag %.*s not found!", slice_len(tag_name_slice), (const char *)(tag_name_slice.data));
         return false;
     }
@@ -213,15 +213,17 @@ slice_s handle_cpf_connected(slice_s input, slice_s output, plc_s *plc) {
 
     if(!slice_has_err(result)) {
         /* build outbound header. */
-        slice_set_uint16_le(output, 0, 2);            /* two items. */
-        slice_set_uint16_le(output, 2, CPF_ITEM_CAI); /* connected address type. */
-        slice_set_uint16_le(output, 4, 4);            /* connection ID is 4 bytes. */
-        slice_set_uint32_le(output, 6, plc->client_connection_id);
-        slice_set_uint16_le(output, 10, CPF_ITEM_CDI); /* connected data type */
+        slice_set_uint32_le(output, 0, header.interface_handle);
+        slice_set_uint16_le(output, 4, header.router_timeout);
+        slice_set_uint16_le(output, 6, 2);            /* two items. */
+        slice_set_uint16_le(output, 8, CPF_ITEM_CAI); /* connected address type. */
+        slice_set_uint16_le(output, 10, 4);           /* connection ID is 4 bytes. */
+        slice_set_uint32_le(output, 12, plc->client_connection_id);
+        slice_set_uint16_le(output, 16, CPF_ITEM_CDI); /* connected data type */
         slice_set_uint16_le(
-            output, 12,
+            output, 18,
             (uint16_t)(slice_len(result) + 2)); /* result from CIP processing downstream.  Plus 2 bytes for sequence number. */
-        slice_set_uint16_le(output, 14, plc->client_connection_seq);
+        slice_set_uint16_le(output, 20, header.conn_seq); /* echo the sequence number of the request. */
 
         /* create a new slice with the CPF header and the response packet in it. */
         result = slice_from_slice(output, (size_t)0, (size_t)(slice_len(result) + CPF_CONN_HEADER_SIZE));
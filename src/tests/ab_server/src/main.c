@@ -56,11 +56,19 @@
 #include "utils.h"
 #include "mutex.h"
 
+/*
+ * PCCC PLCs take up to 244 bytes of PCCC command.  The packet limits cover
+ * the whole frame, so add the EIP header, the unconnected CPF header and the
+ * PCCC execute response prefix.
+ */
+#define PCCC_MAX_PACKET (EIP_HEADER_SIZE + 16 + 11 + 244)
+
 static void usage(void);
 static void process_args(int argc, const char **argv, plc_s *plc);
 static void parse_path(const char *path, plc_s *plc);
 static void parse_pccc_tag(const char *tag, plc_s *plc);
 static void parse_cip_tag(const char *tag, plc_s *plc);
+static void parse_tag_file(const char *file_name, plc_s *plc);
 static slice_s request_handler(slice_s input, slice_s output, void *plc);
 
 
@@ -156,10 +164,18 @@ int main(int argc, const char **argv) {
 
     process_args(argc, argv, &plc);
 
+    if(!plc_build_tag_index(&plc)) { exit(1); }
+
     /* open a server connection and listen on the right port. */
     server = tcp_server_create("0.0.0.0", (plc.port_str ? plc.port_str : "44818"), request_handler, &plc, sizeof(plc));
 
-    tcp_server_start(server, &done);
+    if(plc.response_delay > 0 || plc.response_jitter > 0) { tcp_server_set_delay_func(server, plc_response_delay_ms); }
+
+    if(plc.use_event_loop) {
+        tcp_server_start_event_loop(server, &done);
+    } else {
+        tcp_server_start(server, &done);
+    }
 
     tcp_server_destroy(server);
 
@@ -169,7 +185,8 @@ int main(int argc, const char **argv) {
 
 void usage(void) {
     // NOLINTNEXTLINE
-    fprintf(stderr, "Usage: ab_server --plc=<plc_type> [--path=<path>] [--port=<port>] --tag=<tag>\n"
+    fprintf(stderr, "Usage: ab_server --plc=<plc_type> [--path=<path>] [--port=<port>] --tag=<tag> [--tag_file=<file>]\n"
+                    "                 [--delay=<ms>] [--jitter=<ms>] [--delay_dist=<dist>] [--event_loop] [--debug]\n"
                     "   <plc type> = one of the CIP PLCs: \"ControlLogix\", \"Micro800\" or \"Omron\",\n"
                     "                or one of the PCCC PLCs: \"PLC/5\", \"SLC500\" or \"Micrologix\".\n"
                     "\n"
@@ -201,6 +218,17 @@ void usage(void) {
                     "\n"
                     "        <sizes> field is one or more (up to 3) numbers separated by commas.\n"
                     "\n"
+                    "   <file> = file with one tag definition per line in the same format as --tag.\n"
+                    "            Blank lines and lines starting with # are ignored.\n"
+                    "\n"
+                    "   --delay=<ms> delays each response by a fixed time.  --jitter=<ms> adds a random\n"
+                    "   extra delay drawn from <dist>, one of \"uniform\" (0 to jitter, the default),\n"
+                    "   \"normal\" (standard deviation jitter, negative samples add nothing) or\n"
+                    "   \"exponential\" (mean jitter).  The delay is never less than --delay.\n"
+                    "\n"
+                    "   --event_loop handles all client connections from one epoll-driven thread\n"
+                    "   instead of one thread per connection.  Linux only.\n"
+                    "\n"
                     "Example: ab_server --plc=ControlLogix --path=1,0 --tag=MyTag:DINT[10,10]\n");
 
     exit(1);
@@ -287,8 +315,8 @@ void process_args(int argc, const char **argv, plc_s *plc) {
                 plc->path[2] = (uint8_t)0x24;
                 plc->path[3] = (uint8_t)0x01;
                 plc->path_len = 4;
-                plc->client_to_server_max_packet = 244;
-                plc->server_to_client_max_packet = 244;
+                plc->client_to_server_max_packet = PCCC_MAX_PACKET;
+                plc->server_to_client_max_packet = PCCC_MAX_PACKET;
                 needs_path = false;
                 has_plc = true;
             } else if(str_cmp_i(&(argv[i][6]), "SLC500") == 0) {
@@ -300,8 +328,8 @@ void process_args(int argc, const char **argv, plc_s *plc) {
                 plc->path[2] = (uint8_t)0x24;
                 plc->path[3] = (uint8_t)0x01;
                 plc->path_len = 4;
-                plc->client_to_server_max_packet = 244;
-                plc->server_to_client_max_packet = 244;
+                plc->client_to_server_max_packet = PCCC_MAX_PACKET;
+                plc->server_to_client_max_packet = PCCC_MAX_PACKET;
                 needs_path = false;
                 has_plc = true;
             } else if(str_cmp_i(&(argv[i][6]), "Micrologix") == 0) {
@@ -313,8 +341,8 @@ void process_args(int argc, const char **argv, plc_s *plc) {
                 plc->path[2] = (uint8_t)0x24;
                 plc->path[3] = (uint8_t)0x01;
                 plc->path_len = 4;
-                plc->client_to_server_max_packet = 244;
-                plc->server_to_client_max_packet = 244;
+                plc->client_to_server_max_packet = PCCC_MAX_PACKET;
+                plc->server_to_client_max_packet = PCCC_MAX_PACKET;
                 needs_path = false;
                 has_plc = true;
             } else {
@@ -340,8 +368,15 @@ void process_args(int argc, const char **argv, plc_s *plc) {
             has_tag = true;
         }
 
+        if(strncmp(argv[i], "--tag_file=", 11) == 0) {
+            parse_tag_file(&(argv[i][11]), plc);
+            has_tag = true;
+        }
+
         if(strcmp(argv[i], "--debug") == 0) { debug_on(); }
 
+        if(strcmp(argv[i], "--event_loop") == 0) { plc->use_event_loop = true; }
+
         if(strncmp(argv[i], "--reject_fo=", 12) == 0) {
             if(plc) {
                 info("Setting reject ForwardOpen count to %d.", atoi(&argv[i][12]));
@@ -355,6 +390,25 @@ void process_args(int argc, const char **argv, plc_s *plc) {
                 plc->response_delay = atoi(&argv[i][8]);
             }
         }
+
+        if(strncmp(argv[i], "--jitter=", 9) == 0) {
+            info("Setting response jitter to %dms.", atoi(&argv[i][9]));
+            plc->response_jitter = atoi(&argv[i][9]);
+        }
+
+        if(strncmp(argv[i], "--delay_dist=", 13) == 0) {
+            if(str_cmp_i(&(argv[i][13]), "uniform") == 0) {
+                plc->delay_dist = DELAY_DIST_UNIFORM;
+            } else if(str_cmp_i(&(argv[i][13]), "normal") == 0) {
+                plc->delay_dist = DELAY_DIST_NORMAL;
+            } else if(str_cmp_i(&(argv[i][13]), "exponential") == 0) {
+                plc->delay_dist = DELAY_DIST_EXPONENTIAL;
+            } else {
+                // NOLINTNEXTLINE
+                fprintf(stderr, "Unsupported delay distribution %s!\n", &(argv[i][13]));
+                usage();
+            }
+        }
     }
 
     if(needs_path && !has_path) {
@@ -586,10 +640,6 @@ void parse_cip_tag(const char *tag_str, plc_s *plc) {
     if(mutex_create(&(tag->data_mutex)) != MUTEX_STATUS_OK) { error("Unable to create tag data mutex!"); }
 
 
-    /* create the tag data mutex */
-    if(mutex_create(&(tag->data_mutex)) != MUTEX_STATUS_OK) { error("Unable to create tag data mutex!"); }
-
-
     /* try to match the three parts of a tag definition string. */
 
     /* first match the name. */
@@ -751,6 +801,60 @@ void parse_cip_tag(const char *tag_str, plc_s *plc) {
 }
 
 
+/*
+ * Tag files hold one tag definition per line, in the same format as the
+ * --tag argument.  This makes it practical to define tens of thousands
+ * of tags for load testing.
+ */
+
+void parse_tag_file(const char *file_name, plc_s *plc) {
+    FILE *tag_file = NULL;
+    char line[256] = {0};
+    int line_num = 0;
+    int tag_count = 0;
+
+    // NOLINTNEXTLINE
+    tag_file = fopen(file_name, "r");
+    if(!tag_file) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Unable to open tag file \"%s\"!\n", file_name);
+        usage();
+        return;
+    }
+
+    while(fgets(line, (int)sizeof(line), tag_file)) {
+        size_t len = strlen(line);
+        char *start = line;
+
+        line_num++;
+
+        /* trim trailing and leading white space. */
+        while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t')) {
+            line[len - 1] = 0;
+            len--;
+        }
+
+        while(*start == ' ' || *start == '\t') { start++; }
+
+        if(*start == 0 || *start == '#') { continue; }
+
+        if(plc->plc_type == PLC_PLC5 || plc->plc_type == PLC_SLC || plc->plc_type == PLC_MICROLOGIX) {
+            parse_pccc_tag(start, plc);
+        } else {
+            parse_cip_tag(start, plc);
+        }
+
+        tag_count++;
+    }
+
+    // NOLINTNEXTLINE
+    fclose(tag_file);
+
+    // NOLINTNEXTLINE
+    fprintf(stderr, "Loaded %d tags from %d lines of \"%s\".\n", tag_count, line_num, file_name);
+}
+
+
 /*
  * Process each request.  Dispatch to the correct
  * request type handler.
@@ -766,12 +870,8 @@ slice_s request_handler(slice_s input, slice_s output, void *plc_arg) {
         uint16_t eip_len = slice_get_uint16_le(input, 2);
 
         if(slice_len(input) >= (size_t)(EIP_HEADER_SIZE + eip_len)) {
-            slice_s resp = eip_dispatch_request(input, output, plc);
-
-            /* if there is a response delay requested, then wait a bit. */
-            if(plc->response_delay > 0) { util_sleep_ms(plc->response_delay); }
-
-            return resp;
+            /* any response delay is applied by the TCP server. */
+            return eip_dispatch_request(input, output, plc);
         }
     }
 
@@ -127,6 +127,7 @@ slice_s handle_plc5_read_request(slice_s input, slice_s output, plc_s *plc) {
     uint16_t offset = 0;
     size_t start_byte_offset = 0;
     uint16_t transfer_size = 0;
+    uint8_t packet_size = 0;
     size_t end_byte_offset = 0;
     size_t tag_size = 0;
     size_t data_file_num = 0;
@@ -155,6 +156,9 @@ slice_s handle_plc5_read_request(slice_s input, slice_s output, plc_s *plc) {
     /* get the data element number. */
     data_file_element = slice_get_uint8(input, 7);
 
+    /* the number of bytes to return in this packet. */
+    packet_size = slice_get_uint8(input, 8);
+
     /* find the tag. */
     while(tag && tag->data_file_num != data_file_num) { tag = tag->next_tag; }
 
@@ -163,10 +167,10 @@ slice_s handle_plc5_read_request(slice_s input, slice_s output, plc_s *plc) {
         return make_pccc_error(output, PCCC_ERR_ADDR_NOT_USABLE, plc);
     }
 
-    /* now we can check the start and end offsets. */
+    /* now we can check the start and end offsets.  The offset is in 2-byte words. */
     tag_size = tag->elem_count * tag->elem_size;
-    start_byte_offset = offset + (data_file_element * tag->elem_size);
-    end_byte_offset = start_byte_offset + (transfer_size * tag->elem_size);
+    start_byte_offset = ((size_t)offset * 2) + (data_file_element * tag->elem_size);
+    end_byte_offset = start_byte_offset + packet_size;
 
     if(start_byte_offset >= tag_size) {
         info("Starting offset, %u, is greater than tag size, %d!", (unsigned int)start_byte_offset, (unsigned int)tag_size);
@@ -185,22 +189,22 @@ slice_s handle_plc5_read_request(slice_s input, slice_s output, plc_s *plc) {
         return make_pccc_error(output, PCCC_ERR_FILE_IS_WRONG_SIZE, plc);
     }
 
-    info("Transfer size %u, tag elem size %u, bytes to transfer %d.", transfer_size, tag->elem_size,
-         transfer_size * tag->elem_size);
+    info("Transfer size %u words, tag elem size %u, bytes to transfer %u.", transfer_size, tag->elem_size,
+         (unsigned int)packet_size);
 
     /* build the response. */
     slice_set_uint8(output, 0, 0x4f);
     slice_set_uint8(output, 1, 0); /* no error */
     slice_set_uint16_le(output, 2, plc->pccc_seq_id);
 
-    for(size_t i = 0; i < (transfer_size * tag->elem_size); i++) {
+    for(size_t i = 0; i < packet_size; i++) {
         info("setting byte %d to value %d.", 4 + i, tag->data[start_byte_offset + i]);
         slice_set_uint8(output, 4 + i, tag->data[start_byte_offset + i]);
     }
 
-    info("Output slice length %d.", slice_len(slice_from_slice(output, 0, 4 + (transfer_size * tag->elem_size))));
+    info("Output slice length %d.", slice_len(slice_from_slice(output, 0, (size_t)4 + (size_t)packet_size)));
 
-    return slice_from_slice(output, 0, 4 + (transfer_size * tag->elem_size));
+    return slice_from_slice(output, 0, (size_t)4 + (size_t)packet_size);
 }
 
 
@@ -251,9 +255,13 @@ slice_s handle_plc5_write_request(slice_s input, slice_s output, plc_s *plc) {
      * needs to be less than the tag size.
      */
 
+    /* the offset and total transfer size are in 2-byte words, this packet may carry only part of it. */
+    data_start_byte_offset = 8;
+    data_len = slice_len(input) - 8;
+
     tag_size = tag->elem_count * tag->elem_size;
-    start_byte_offset = offset + (data_file_element * tag->elem_size);
-    end_byte_offset = start_byte_offset + (transfer_size * tag->elem_size);
+    start_byte_offset = ((size_t)offset * 2) + (data_file_element * tag->elem_size);
+    end_byte_offset = start_byte_offset + data_len;
 
     if(start_byte_offset >= tag_size) {
         info("Starting offset, %u, is greater than tag size, %d!", (unsigned int)start_byte_offset, (unsigned int)tag_size);
@@ -265,23 +273,19 @@ slice_s handle_plc5_write_request(slice_s input, slice_s output, plc_s *plc) {
         return make_pccc_error(output, PCCC_ERR_FILE_IS_WRONG_SIZE, plc);
     }
 
-    data_start_byte_offset = 8;
-    data_len = slice_len(input) - 8;
-
-    if(data_len != (transfer_size * tag->elem_size)) {
-        info("Data in packet is not the same length, %u, as the requested transfer, %d!", data_len,
-             (transfer_size * tag->elem_size));
+    if(data_len > ((size_t)transfer_size * 2)) {
+        info("Data in packet, %u bytes, is larger than the requested transfer, %d words!", data_len, transfer_size);
         return make_pccc_error(output, PCCC_ERR_FILE_IS_WRONG_SIZE, plc);
     }
 
     /* copy the data into the tag. */
-    for(size_t i = 0; i < (transfer_size * tag->elem_size); i++) {
+    for(size_t i = 0; i < data_len; i++) {
         info("setting byte %d to value %d.", start_byte_offset + i, slice_get_uint8(input, data_start_byte_offset + i));
         tag->data[start_byte_offset + i] = slice_get_uint8(input, data_start_byte_offset + i);
     }
 
-    info("Transfer size %u, tag elem size %u, bytes to transfer %d.", transfer_size, tag->elem_size,
-         transfer_size * tag->elem_size);
+    info("Transfer size %u words, tag elem size %u, bytes to transfer %u.", transfer_size, tag->elem_size,
+         (unsigned int)data_len);
 
     /* build the response. */
     slice_set_uint8(output, 0, 0x4f);
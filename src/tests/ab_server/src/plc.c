@@ -0,0 +1,164 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "compat.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plc.h"
+#include "utils.h"
+
+
+#define TAG_INDEX_MIN_SIZE (16)
+
+
+static uint32_t hash_name(const uint8_t *name, size_t name_len);
+static double random_unit(void);
+
+
+/*
+ * Build a hash index over the tag list so that lookups by name do not need
+ * to walk the whole list.  Names are matched exactly, as before.
+ */
+bool plc_build_tag_index(plc_s *plc) {
+    size_t tag_count = 0;
+    size_t index_size = TAG_INDEX_MIN_SIZE;
+
+    for(tag_def_s *tag = plc->tags; tag; tag = tag->next_tag) { tag_count++; }
+
+    /* keep the load factor at or below one half. */
+    while(index_size < tag_count * 2) { index_size *= 2; }
+
+    plc->tag_index = calloc(index_size, sizeof(*plc->tag_index));
+    if(!plc->tag_index) {
+        error("Unable to allocate memory for the tag index!");
+        return false;
+    }
+
+    plc->tag_index_size = index_size;
+
+    for(tag_def_s *tag = plc->tags; tag; tag = tag->next_tag) {
+        size_t name_len = strlen(tag->name);
+        size_t bucket = hash_name((const uint8_t *)tag->name, name_len) & (index_size - 1);
+
+        /* the CIP lookup is by name so names must be unique. */
+        if(tag->data_file_num == 0 && plc_find_tag(plc, (const uint8_t *)tag->name, name_len)) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Tag %s is defined more than once!\n", tag->name);
+            return false;
+        }
+
+        tag->next_in_bucket = plc->tag_index[bucket];
+        plc->tag_index[bucket] = tag;
+    }
+
+    info("Indexed %zu tags in %zu buckets.", tag_count, index_size);
+
+    return true;
+}
+
+
+tag_def_s *plc_find_tag(plc_s *plc, const uint8_t *name, size_t name_len) {
+    tag_def_s *tag = NULL;
+
+    if(!plc->tag_index || !name || name_len == 0) { return NULL; }
+
+    tag = plc->tag_index[hash_name(name, name_len) & (plc->tag_index_size - 1)];
+
+    while(tag) {
+        if(strlen(tag->name) == name_len && memcmp(tag->name, name, name_len) == 0) { return tag; }
+
+        tag = tag->next_in_bucket;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Calculate the delay before sending the next response.  This is the base
+ * delay plus a random amount drawn from the configured distribution.
+ */
+int plc_response_delay_ms(void *plc_arg) {
+    plc_s *plc = (plc_s *)plc_arg;
+    double extra = 0.0;
+    double delay = 0.0;
+
+    if(plc->response_jitter <= 0) { return plc->response_delay; }
+
+    switch(plc->delay_dist) {
+        case DELAY_DIST_NORMAL: {
+            /* Box-Muller. */
+            double u1 = random_unit();
+            double u2 = random_unit();
+
+            extra = sqrt(-2.0 * log(u1)) * cos(2.0 * 3.14159265358979323846 * u2) * (double)plc->response_jitter;
+
+            /* a negative sample must not eat into the base delay. */
+            if(extra < 0.0) { extra = 0.0; }
+            break;
+        }
+
+        case DELAY_DIST_EXPONENTIAL: extra = -log(random_unit()) * (double)plc->response_jitter; break;
+
+        case DELAY_DIST_UNIFORM:
+        default: extra = (double)random_u64((uint64_t)plc->response_jitter + 1); break;
+    }
+
+    delay = (double)plc->response_delay + extra;
+
+    if(delay < 0.0) { delay = 0.0; }
+    if(delay > 60000.0) { delay = 60000.0; }
+
+    return (int)(delay + 0.5);
+}
+
+
+/* FNV-1a */
+uint32_t hash_name(const uint8_t *name, size_t name_len) {
+    uint32_t hash = 2166136261u;
+
+    for(size_t i = 0; i < name_len; i++) {
+        hash ^= (uint32_t)name[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+/* uniform in (0, 1], never zero so that it is safe to take the log. */
+double random_unit(void) { return ((double)random_u64(1000000) + 1.0) / 1000000.0; }
@@ -33,6 +33,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -62,6 +63,7 @@ typedef uint16_t tag_type_t;
 
 struct tag_def_s {
     struct tag_def_s *next_tag;
+    struct tag_def_s *next_in_bucket; /* chain in the tag name hash index. */
     char *name;
     tag_type_t tag_type;
     size_t elem_size;
@@ -79,6 +81,13 @@ struct tag_def_s {
 
 typedef struct tag_def_s tag_def_s;
 
+/* how the per-request response delay varies around the base delay. */
+typedef enum {
+    DELAY_DIST_UNIFORM,     /* base + uniform(0, jitter) */
+    DELAY_DIST_NORMAL,      /* base + normal(0, jitter), jitter clamped at zero */
+    DELAY_DIST_EXPONENTIAL  /* base + exponential with mean jitter */
+} delay_dist_t;
+
 typedef enum {
     PLC_CONTROL_LOGIX,
     PLC_MICRO800,
@@ -92,6 +101,7 @@ typedef enum {
 typedef struct {
     plc_type_t plc_type;
     const char* port_str;
+    bool use_event_loop;
     uint8_t path[20];
     uint8_t path_len;
 
@@ -119,7 +129,18 @@ typedef struct {
 
     /* response delay */
     int response_delay;
+    int response_jitter;
+    delay_dist_t delay_dist;
 
     /* list of tags served by this "PLC" */
     struct tag_def_s *tags;
+
+    /* hash index over the tag list, built once after the tags are defined. */
+    struct tag_def_s **tag_index;
+    size_t tag_index_size;
 } plc_s;
+
+
+extern bool plc_build_tag_index(plc_s *plc);
+extern tag_def_s *plc_find_tag(plc_s *plc, const uint8_t *name, size_t name_len);
+extern int plc_response_delay_ms(void *plc_arg);
@@ -40,14 +40,36 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef IS_LINUX
+#    include <errno.h>
+#    include <fcntl.h>
+#    include <netinet/in.h>
+#    include <netinet/tcp.h>
+#    include <sys/epoll.h>
+#    include <sys/socket.h>
+#    include <unistd.h>
+#endif
+
+
+/*
+ * Clients may send a request before the reply to the one before it.  Only
+ * read to the end of the packet in hand, so that the next request waits in
+ * the socket until this one has its reply.  The server only speaks
+ * EtherNet/IP, and the encapsulation header carries the length of the rest.
+ */
+#define ENCAP_HEADER_SIZE (24)
 
 
 static THREAD_FUNC(conn_handler);
+static size_t packet_bytes_wanted(const uint8_t *buf, size_t have);
 
 
 struct tcp_server {
     SOCKET sock_fd;
     slice_s (*handler)(slice_s input, slice_s output, void *context);
+    int (*delay_func)(void *context);
     void *context;
     size_t context_size;
 };
@@ -87,6 +109,11 @@ tcp_server_p tcp_server_create(const char *host, const char *port,
     return server;
 }
 
+void tcp_server_set_delay_func(tcp_server_p server, int (*delay_func)(void *context)) {
+    if(server) { server->delay_func = delay_func; }
+}
+
+
 void tcp_server_start(tcp_server_p server, volatile sig_atomic_t *terminate) {
     static bool done; /* static so it doesn't go out of scope, since it's passed to sub-threads. */
     done = false;     /* initialised every invocation for logic sake, even though that's once. */
@@ -158,6 +185,7 @@ THREAD_FUNC(conn_handler) {
     tcp_server_p server = (tcp_server_p)session->server; /* need to cast for C++ */
     slice_s tmp_input = {0};
     slice_s tmp_output = {0};
+    size_t have = 0;
     int rc = TCP_SERVER_DONE;
 
     info("Got new client connection, going into processing loop.");
@@ -166,10 +194,17 @@ THREAD_FUNC(conn_handler) {
     thread_detach();
 
     session->buffer = slice_make(buf, sizeof(buf));
-    tmp_input = session->buffer;
 
     do {
-        socket_slice_result slice_res = socket_read(session->client_fd, tmp_input, 1000); /* MAGIC */
+        size_t wanted = packet_bytes_wanted(buf, have);
+        socket_slice_result slice_res;
+
+        if(wanted == 0 || have + wanted > sizeof(buf)) {
+            info("WARN: Request is too large for the buffer!");
+            break;
+        }
+
+        slice_res = socket_read(session->client_fd, slice_from_slice(session->buffer, have, wanted), 1000); /* MAGIC */
 
         if(socket_slice_result_is_err(slice_res)) {
             if(socket_slice_result_get_err(slice_res) == SOCKET_ERR_TIMEOUT) {
@@ -189,13 +224,20 @@ THREAD_FUNC(conn_handler) {
             break;
         }
 
+        have += slice_len(tmp_input);
+
         /* try to process the packet. */
         /* FIXME - convert to RESULT types */
-        tmp_output = server->handler(tmp_input, session->buffer, session->server_context);
+        tmp_output = server->handler(slice_from_slice(session->buffer, 0, have), session->buffer, session->server_context);
 
         /* check the response. */
         if(!slice_has_err(tmp_output)) {
-            socket_slice_result write_res = socket_write(session->client_fd, tmp_output, 1000); /* MAGIC*/
+            socket_slice_result write_res;
+
+            /* if there is a response delay requested, then wait a bit. */
+            if(server->delay_func) { util_sleep_ms(server->delay_func(session->server_context)); }
+
+            write_res = socket_write(session->client_fd, tmp_output, 1000); /* MAGIC*/
 
             if(socket_slice_result_is_err(write_res)) {
                 info("Error, %d, writing packet!", socket_slice_result_get_err(write_res));
@@ -203,7 +245,7 @@ THREAD_FUNC(conn_handler) {
             }
 
             /* all good. Reset the buffers etc. */
-            tmp_input = session->buffer;
+            have = 0;
             rc = TCP_SERVER_PROCESSED;
         } else {
             /* there was some sort of error or exceptional condition. */
@@ -216,16 +258,14 @@ THREAD_FUNC(conn_handler) {
                     *(session->server_done) = true;
                     break;
 
-                case TCP_SERVER_INCOMPLETE:
-                    tmp_input = slice_from_slice(session->buffer, slice_len(tmp_input),
-                                                 slice_len(session->buffer) - slice_len(tmp_input));
-                    break;
+                case TCP_SERVER_INCOMPLETE: break;
 
-                case TCP_SERVER_PROCESSED: break;
+                case TCP_SERVER_PROCESSED: have = 0; break;
 
                 case TCP_SERVER_UNSUPPORTED:
                     info("WARN: Unsupported packet!");
-                    slice_dump(tmp_input);
+                    slice_dump(slice_from_slice(session->buffer, 0, have));
+                    have = 0;
                     break;
 
                 default: info("WARN: Unsupported return code %d!", rc); break;
@@ -242,3 +282,378 @@ THREAD_FUNC(conn_handler) {
 
     THREAD_RETURN(0);
 }
+
+
+/* the bytes still needed to complete the packet at the start of buf. */
+size_t packet_bytes_wanted(const uint8_t *buf, size_t have) {
+    size_t packet_size = ENCAP_HEADER_SIZE;
+
+    if(have >= ENCAP_HEADER_SIZE) { packet_size += (size_t)buf[2] | ((size_t)buf[3] << 8); }
+
+    return (packet_size > have ? packet_size - have : 0);
+}
+
+
+#ifdef IS_LINUX
+
+/*
+ * Event loop mode.
+ *
+ * All client connections are handled from the calling thread with epoll
+ * and non-blocking sockets.  This avoids a thread per client and scales to
+ * many more connections.  Response delays are handled with timers so that
+ * a slow response to one client does not hold up the others.
+ */
+
+#define EVENT_LOOP_MAX_EVENTS (64)
+#define EVENT_LOOP_IDLE_WAIT_MS (1000)
+#define EVENT_CLIENT_BUF_SIZE (65536 + 128)
+
+typedef enum {
+    EVENT_CLIENT_READING,
+    EVENT_CLIENT_DELAYED,
+    EVENT_CLIENT_WRITING
+} event_client_state_t;
+
+struct event_client {
+    struct event_client *next;
+    struct event_client *prev;
+    SOCKET client_fd;
+    event_client_state_t state;
+    void *server_context;
+    size_t in_len;
+    slice_s output;
+    size_t out_offset;
+    int64_t send_at_ms;
+    uint8_t buf[EVENT_CLIENT_BUF_SIZE];
+};
+typedef struct event_client *event_client_p;
+
+struct event_loop {
+    tcp_server_p server;
+    int epoll_fd;
+    event_client_p clients;
+    int num_delayed;
+    bool done;
+};
+
+
+static void event_loop_accept(struct event_loop *loop);
+static void event_client_close(struct event_loop *loop, event_client_p client);
+static void event_client_read(struct event_loop *loop, event_client_p client);
+static void event_client_write(struct event_loop *loop, event_client_p client);
+static bool event_client_watch(struct event_loop *loop, event_client_p client, uint32_t events);
+static int event_loop_wait_ms(struct event_loop *loop, int64_t now);
+static void event_loop_send_delayed(struct event_loop *loop, int64_t now);
+
+
+void tcp_server_start_event_loop(tcp_server_p server, volatile sig_atomic_t *terminate) {
+    struct event_loop loop;
+    struct epoll_event listen_event;
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    int flags = 0;
+
+    // NOLINTNEXTLINE
+    memset(&loop, 0, sizeof(loop));
+    loop.server = server;
+
+    loop.epoll_fd = epoll_create1(0);
+    if(loop.epoll_fd < 0) {
+        error("ERROR: Unable to create epoll instance, error %d!", errno);
+        return;
+    }
+
+    /* the listen socket must not block when several clients race to connect. */
+    flags = fcntl(server->sock_fd, F_GETFL, 0);
+    fcntl(server->sock_fd, F_SETFL, flags | O_NONBLOCK);
+
+    // NOLINTNEXTLINE
+    memset(&listen_event, 0, sizeof(listen_event));
+    listen_event.events = EPOLLIN;
+    listen_event.data.ptr = NULL; /* NULL marks the listen socket. */
+
+    if(epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, server->sock_fd, &listen_event) < 0) {
+        error("ERROR: Unable to add the listen socket to epoll, error %d!", errno);
+        return;
+    }
+
+    info("Waiting for client connections in event loop mode.");
+
+    while(!loop.done && !*terminate) {
+        int num_events = epoll_wait(loop.epoll_fd, events, EVENT_LOOP_MAX_EVENTS, event_loop_wait_ms(&loop, util_time_ms()));
+
+        if(num_events < 0) {
+            if(errno == EINTR) { continue; }
+
+            info("Error %d waiting for events!", errno);
+            break;
+        }
+
+        for(int i = 0; i < num_events && !loop.done; i++) {
+            event_client_p client = (event_client_p)events[i].data.ptr;
+
+            if(!client) {
+                event_loop_accept(&loop);
+                continue;
+            }
+
+            if(events[i].events & (EPOLLERR | EPOLLHUP)) {
+                event_client_close(&loop, client);
+                continue;
+            }
+
+            if(client->state == EVENT_CLIENT_READING && (events[i].events & EPOLLIN)) {
+                event_client_read(&loop, client);
+            } else if(client->state == EVENT_CLIENT_WRITING && (events[i].events & EPOLLOUT)) {
+                event_client_write(&loop, client);
+            }
+        }
+
+        if(loop.num_delayed > 0) { event_loop_send_delayed(&loop, util_time_ms()); }
+    }
+
+    while(loop.clients) { event_client_close(&loop, loop.clients); }
+
+    close(loop.epoll_fd);
+}
+
+
+void event_loop_accept(struct event_loop *loop) {
+    tcp_server_p server = loop->server;
+
+    /* accept everything that is waiting. */
+    while(1) {
+        SOCKET client_fd = accept(server->sock_fd, NULL, NULL);
+        event_client_p client = NULL;
+        int flags = 0;
+        int sock_opt = 1;
+
+        if(client_fd == INVALID_SOCKET) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                info("Error %d accepting new client connection!", errno);
+            }
+
+            return;
+        }
+
+        info("Got new client connection on socket %d.", client_fd);
+
+        flags = fcntl(client_fd, F_GETFL, 0);
+        fcntl(client_fd, F_SETFL, flags | O_NONBLOCK);
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, (char *)&sock_opt, sizeof(sock_opt));
+
+        client = calloc(1, sizeof(*client));
+        if(client) { client->server_context = malloc(server->context_size); }
+
+        if(!client || !client->server_context) {
+            error("Unable to allocate memory for the client!");
+            if(client) { free(client); }
+            socket_close(client_fd);
+            continue;
+        }
+
+        /* Make a copy of the server context for this client, as in thread mode. */
+        // NOLINTNEXTLINE
+        memcpy(client->server_context, server->context, server->context_size);
+        client->client_fd = client_fd;
+        client->state = EVENT_CLIENT_READING;
+
+        /* link it in. */
+        client->next = loop->clients;
+        if(loop->clients) { loop->clients->prev = client; }
+        loop->clients = client;
+
+        if(!event_client_watch(loop, client, EPOLLIN)) { event_client_close(loop, client); }
+    }
+}
+
+
+void event_client_close(struct event_loop *loop, event_client_p client) {
+    info("Closing client connection on socket %d.", client->client_fd);
+
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, client->client_fd, NULL);
+    socket_close(client->client_fd);
+
+    if(client->state == EVENT_CLIENT_DELAYED) { loop->num_delayed--; }
+
+    if(client->prev) {
+        client->prev->next = client->next;
+    } else {
+        loop->clients = client->next;
+    }
+
+    if(client->next) { client->next->prev = client->prev; }
+
+    free(client->server_context);
+    free(client);
+}
+
+
+void event_client_read(struct event_loop *loop, event_client_p client) {
+    tcp_server_p server = loop->server;
+    slice_s buffer = slice_make(client->buf, sizeof(client->buf));
+    slice_s output = {0};
+    size_t wanted = packet_bytes_wanted(client->buf, client->in_len);
+    ssize_t rc = 0;
+    int status = 0;
+
+    if(wanted == 0 || client->in_len + wanted > sizeof(client->buf)) {
+        info("WARN: Request is too large for the buffer!");
+        event_client_close(loop, client);
+        return;
+    }
+
+    rc = recv(client->client_fd, &client->buf[client->in_len], wanted, 0);
+    if(rc == 0) {
+        info("Client closed the connection.");
+        event_client_close(loop, client);
+        return;
+    }
+
+    if(rc < 0) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) { return; }
+
+        info("Error, %d, reading data from the client!", errno);
+        event_client_close(loop, client);
+        return;
+    }
+
+    client->in_len += (size_t)rc;
+
+    /* the handler builds the response in the same buffer it reads from. */
+    output = server->handler(slice_from_slice(buffer, 0, client->in_len), buffer, client->server_context);
+
+    if(!slice_has_err(output)) {
+        int delay_ms = (server->delay_func ? server->delay_func(client->server_context) : 0);
+
+        client->output = output;
+        client->out_offset = 0;
+        client->in_len = 0;
+
+        if(delay_ms > 0) {
+            /* stop watching the socket until the response goes out. */
+            client->state = EVENT_CLIENT_DELAYED;
+            client->send_at_ms = util_time_ms() + delay_ms;
+            loop->num_delayed++;
+
+            if(!event_client_watch(loop, client, 0)) { event_client_close(loop, client); }
+        } else {
+            client->state = EVENT_CLIENT_WRITING;
+            event_client_write(loop, client);
+        }
+
+        return;
+    }
+
+    switch((status = slice_get_err(output))) {
+        case TCP_SERVER_DONE: loop->done = true; break;
+
+        case TCP_SERVER_INCOMPLETE: break;
+
+        case TCP_SERVER_PROCESSED: client->in_len = 0; break;
+
+        case TCP_SERVER_UNSUPPORTED:
+            info("WARN: Unsupported packet!");
+            slice_dump(slice_from_slice(buffer, 0, client->in_len));
+            event_client_close(loop, client);
+            break;
+
+        default:
+            info("WARN: Unsupported return code %d!", status);
+            event_client_close(loop, client);
+            break;
+    }
+}
+
+
+void event_client_write(struct event_loop *loop, event_client_p client) {
+    size_t out_len = slice_len(client->output);
+
+    while(client->out_offset < out_len) {
+        ssize_t rc = send(client->client_fd, slice_get_bytes(client->output, client->out_offset), out_len - client->out_offset,
+                          MSG_NOSIGNAL);
+
+        if(rc < 0) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                /* wait for the socket to drain. */
+                if(!event_client_watch(loop, client, EPOLLOUT)) { event_client_close(loop, client); }
+                return;
+            }
+
+            if(errno == EINTR) { continue; }
+
+            info("Error, %d, writing packet!", errno);
+            event_client_close(loop, client);
+            return;
+        }
+
+        client->out_offset += (size_t)rc;
+    }
+
+    /* all sent, wait for the next request. */
+    client->state = EVENT_CLIENT_READING;
+
+    if(!event_client_watch(loop, client, EPOLLIN)) { event_client_close(loop, client); }
+}
+
+
+bool event_client_watch(struct event_loop *loop, event_client_p client, uint32_t events) {
+    struct epoll_event event;
+    int rc = 0;
+
+    // NOLINTNEXTLINE
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = client;
+
+    rc = epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, client->client_fd, &event);
+    if(rc < 0 && errno == ENOENT) { rc = epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, client->client_fd, &event); }
+
+    if(rc < 0) {
+        info("Error, %d, updating epoll for socket %d!", errno, client->client_fd);
+        return false;
+    }
+
+    return true;
+}
+
+
+/* wait until the next delayed response is due, or the idle time if there is none. */
+int event_loop_wait_ms(struct event_loop *loop, int64_t now) {
+    int64_t wait_ms = EVENT_LOOP_IDLE_WAIT_MS;
+
+    if(loop->num_delayed == 0) { return (int)wait_ms; }
+
+    for(event_client_p client = loop->clients; client; client = client->next) {
+        if(client->state == EVENT_CLIENT_DELAYED && client->send_at_ms - now < wait_ms) { wait_ms = client->send_at_ms - now; }
+    }
+
+    return (wait_ms < 0 ? 0 : (int)wait_ms);
+}
+
+
+void event_loop_send_delayed(struct event_loop *loop, int64_t now) {
+    event_client_p client = loop->clients;
+
+    while(client) {
+        /* writing can close the client, so get the next one first. */
+        event_client_p next = client->next;
+
+        if(client->state == EVENT_CLIENT_DELAYED && client->send_at_ms <= now) {
+            loop->num_delayed--;
+            client->state = EVENT_CLIENT_WRITING;
+            event_client_write(loop, client);
+        }
+
+        client = next;
+    }
+}
+
+#else
+
+void tcp_server_start_event_loop(tcp_server_p server, volatile sig_atomic_t *terminate) {
+    info("WARN: Event loop mode is only supported on Linux, using a thread per connection.");
+    tcp_server_start(server, terminate);
+}
+
+#endif
@@ -48,5 +48,7 @@ typedef enum {
 typedef struct tcp_server *tcp_server_p;
 
 extern tcp_server_p tcp_server_create(const char *host, const char *port, slice_s (*handler)(slice_s input, slice_s output, void *context), void *context, size_t context_size);
+extern void tcp_server_set_delay_func(tcp_server_p server, int (*delay_func)(void *context));
 extern void tcp_server_start(tcp_server_p server, volatile sig_atomic_t *terminate);
+extern void tcp_server_start_event_loop(tcp_server_p server, volatile sig_atomic_t *terminate);
 extern void tcp_server_destroy(tcp_server_p server);
@@ -0,0 +1,238 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Measure the per-call cost of the tag data accessors.
+ *
+ * The accessors are called on the library "metrics" system tag, so no PLC
+ * or simulator is needed and the result is only the library overhead: the
+ * tag lookup, the API mutex and the debug calls.  Build the library with
+ * different DEBUG_COMPILED_LEVEL settings and compare the output to see
+ * what the DETAIL and SPEW calls cost when they are filtered at runtime
+ * and when they are compiled out.
+ *
+ * With --debug set, messages are sent to a logger that drops them, which
+ * shows the cost of formatting without the cost of output.
+ *
+ * Example:
+ *
+ *   accessor_bench --iterations=10000000 --label=release
+ */
+
+#include "../../examples/compat_utils.h"
+#include <inttypes.h>
+#include <libplctag/lib/libplctag.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(POSIX_PLATFORM)
+#    include <time.h>
+#endif
+
+#define REQUIRED_VERSION 2, 6, 4
+
+#define TAG_STRING "make=system&family=library&name=metrics"
+#define DEFAULT_ITERATIONS (1000000)
+
+typedef int (*accessor_func)(int32_t tag, int i);
+
+static int iterations = DEFAULT_ITERATIONS;
+static int debug_level = PLCTAG_DEBUG_NONE;
+static const char *label = "";
+
+static volatile int64_t sink = 0;
+
+static void usage(void);
+static int parse_args(int argc, char **argv);
+static double time_accessor(int32_t tag, accessor_func func);
+static int64_t bench_time_us(void);
+static void discard_log(int32_t tag_id, int level, const char *message);
+
+static int get_int32_op(int32_t tag, int i);
+static int set_int32_op(int32_t tag, int i);
+static int get_float64_op(int32_t tag, int i);
+static int get_size_op(int32_t tag, int i);
+static int status_op(int32_t tag, int i);
+
+
+int main(int argc, char **argv) {
+    int32_t tag = 0;
+    int compiled_level = 0;
+    double get_int32_ns = 0.0;
+    double set_int32_ns = 0.0;
+    double get_float64_ns = 0.0;
+    double get_size_ns = 0.0;
+    double status_ns = 0.0;
+
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        return 1;
+    }
+
+    if(parse_args(argc, argv) != 0) {
+        usage();
+        return 1;
+    }
+
+    tag = plc_tag_create(TAG_STRING, 0);
+    if(tag < 0) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Unable to create the metrics tag, error %s!\n", plc_tag_decode_error(tag));
+        return 1;
+    }
+
+    if(debug_level != PLCTAG_DEBUG_NONE) {
+        plc_tag_register_logger(discard_log);
+        plc_tag_set_debug_level(debug_level);
+    }
+
+    compiled_level = plc_tag_get_int_attribute(0, "debug_compiled_level", -1);
+
+    /* warm up the caches and the branch predictors. */
+    time_accessor(tag, get_int32_op);
+
+    get_int32_ns = time_accessor(tag, get_int32_op);
+    set_int32_ns = time_accessor(tag, set_int32_op);
+    get_float64_ns = time_accessor(tag, get_float64_op);
+    get_size_ns = time_accessor(tag, get_size_op);
+    status_ns = time_accessor(tag, status_op);
+
+    plc_tag_set_debug_level(PLCTAG_DEBUG_NONE);
+    plc_tag_destroy(tag);
+
+    // NOLINTNEXTLINE
+    printf("{\"label\":\"%s\",\"compiled_level\":%d,\"debug\":%d,\"iterations\":%d,"
+           "\"get_int32_ns\":%.1f,\"set_int32_ns\":%.1f,\"get_float64_ns\":%.1f,\"get_size_ns\":%.1f,\"status_ns\":%.1f}\n",
+           label, compiled_level, debug_level, iterations, get_int32_ns, set_int32_ns, get_float64_ns, get_size_ns, status_ns);
+
+    plc_tag_shutdown();
+
+    return 0;
+}
+
+
+void usage(void) {
+    // NOLINTNEXTLINE
+    fprintf(stderr, "Usage: accessor_bench [options]\n"
+                    "  --iterations=<n>  Calls per accessor.  Default 1000000.\n"
+                    "  --debug=<level>   Runtime debug level.  Messages are discarded.  Default 0.\n"
+                    "  --label=<text>    Label copied into the output record.\n");
+}
+
+
+int parse_args(int argc, char **argv) {
+    for(int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+
+        if(strncmp(arg, "--iterations=", 13) == 0) {
+            iterations = atoi(&arg[13]);
+            if(iterations < 1) { return -1; }
+        } else if(strncmp(arg, "--debug=", 8) == 0) {
+            debug_level = atoi(&arg[8]);
+            if(debug_level < PLCTAG_DEBUG_NONE || debug_level > PLCTAG_DEBUG_SPEW) { return -1; }
+        } else if(strncmp(arg, "--label=", 8) == 0) {
+            label = &arg[8];
+        } else {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Unknown argument \"%s\"!\n", arg);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/* returns the average nanoseconds per call. */
+double time_accessor(int32_t tag, accessor_func func) {
+    int64_t start_us = bench_time_us();
+    int64_t total = 0;
+
+    for(int i = 0; i < iterations; i++) { total += func(tag, i); }
+
+    sink = total;
+
+    return (double)(bench_time_us() - start_us) * 1000.0 / (double)iterations;
+}
+
+
+int get_int32_op(int32_t tag, int i) { return (int)plc_tag_get_int32(tag, (i & 7) * 4); }
+
+int set_int32_op(int32_t tag, int i) { return plc_tag_set_int32(tag, (i & 7) * 4, i); }
+
+int get_float64_op(int32_t tag, int i) { return (int)plc_tag_get_float64(tag, (i & 3) * 8); }
+
+int get_size_op(int32_t tag, int i) {
+    (void)i;
+    return plc_tag_get_size(tag);
+}
+
+int status_op(int32_t tag, int i) {
+    (void)i;
+    return plc_tag_status(tag);
+}
+
+
+void discard_log(int32_t tag_id, int level, const char *message) {
+    (void)tag_id;
+    (void)level;
+    (void)message;
+}
+
+
+#if defined(POSIX_PLATFORM)
+
+int64_t bench_time_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000 + (int64_t)ts.tv_nsec / 1000;
+}
+
+#else
+
+int64_t bench_time_us(void) {
+    static LARGE_INTEGER freq = {0};
+    LARGE_INTEGER counter;
+
+    if(freq.QuadPart == 0) { QueryPerformanceFrequency(&freq); }
+
+    QueryPerformanceCounter(&counter);
+
+    return (int64_t)((counter.QuadPart * 1000000) / freq.QuadPart);
+}
+
+#endif
@@ -0,0 +1,791 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Reproducible throughput and latency benchmark against the bundled simulators.
+ *
+ * The benchmark creates a set of tags that each cover a slice of one large array tag
+ * in ab_server or the Modbus test server and then drives reads (and optionally writes)
+ * from a configurable number of threads for a fixed time.  Each operation's latency is
+ * recorded in microseconds and the run is summarized as one JSON object on stdout so
+ * that runs can be collected and compared over time.  Progress and errors go to stderr.
+ *
+ * The operation schedule is deterministic: tag N is always the same slice, writes are
+ * every Kth operation of a thread and write data is derived from the operation count.
+ *
+ * Example:
+ *
+ *   ab_server --plc=ControlLogix --path=1,0 --tag=BenchArray:DINT[10000] &
+ *   benchmark --protocol=ab --tags=100 --elems=10 --threads=4 --groups=2 --mode=batch --duration=10000
+ */
+
+#include "../../examples/compat_utils.h"
+#include <inttypes.h>
+#include <libplctag/lib/libplctag.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(POSIX_PLATFORM)
+#    include <time.h>
+#endif
+
+#define REQUIRED_VERSION 2, 6, 4
+
+#define MAX_THREADS (256)
+#define MAX_TAG_STRING (512)
+#define TAG_CREATE_TIMEOUT_MS (5000)
+#define DEFAULT_OP_TIMEOUT_MS (2000)
+#define LATENCY_INITIAL_CAPACITY (4096)
+
+typedef enum { BENCH_PROTOCOL_AB, BENCH_PROTOCOL_MODBUS } bench_protocol_t;
+
+typedef enum { BENCH_MODE_SYNC, BENCH_MODE_BATCH } bench_mode_t;
+
+typedef enum { BENCH_OP_NONE, BENCH_OP_READ, BENCH_OP_WRITE } bench_op_t;
+
+struct bench_config_t {
+    bench_protocol_t protocol;
+    bench_mode_t mode;
+    const char *gateway;
+    const char *path;
+    const char *plc;
+    const char *tag_name;
+    const char *label;
+    int num_tags;
+    int elems;
+    int threads;
+    int groups;
+    int packing;
+    int inflight;
+    int fuse;
+    int poll_ms;
+    int write_every;
+    int duration_ms;
+    int warmup_ms;
+    int timeout_ms;
+    int debug;
+};
+
+struct latency_buf_t {
+    uint32_t *samples;
+    size_t count;
+    size_t capacity;
+};
+
+struct bench_thread_t {
+    compat_thread_t thread;
+    int thread_index;
+    int first_tag;
+    int num_tags;
+    int32_t *tags;
+    int64_t *next_poll_ms;
+    bench_op_t *pending_op;
+    uint64_t op_count;
+    uint64_t start_count;
+    uint64_t read_count;
+    uint64_t write_count;
+    uint64_t error_count;
+    uint64_t timeout_count;
+    struct latency_buf_t latency;
+};
+
+
+static struct bench_config_t config = {.protocol = BENCH_PROTOCOL_AB,
+                                       .mode = BENCH_MODE_SYNC,
+                                       .gateway = NULL,
+                                       .path = NULL,
+                                       .plc = NULL,
+                                       .tag_name = NULL,
+                                       .label = "",
+                                       .num_tags = 10,
+                                       .elems = 1,
+                                       .threads = 1,
+                                       .groups = 1,
+                                       .packing = 0,
+                                       .inflight = 1,
+                                       .fuse = 0,
+                                       .poll_ms = 0,
+                                       .write_every = 0,
+                                       .duration_ms = 5000,
+                                       .warmup_ms = 1000,
+                                       .timeout_ms = DEFAULT_OP_TIMEOUT_MS,
+                                       .debug = PLCTAG_DEBUG_NONE};
+
+static volatile int terminate = 0;
+static volatile int recording = 0;
+static volatile int end_run = 0;
+
+static struct bench_thread_t bench_threads[MAX_THREADS];
+
+
+static void usage(void);
+static int parse_args(int argc, char **argv);
+static int create_tags(struct bench_thread_t *bt);
+static void destroy_tags(struct bench_thread_t *bt);
+static void *bench_thread_func(void *arg);
+static int run_sync_pass(struct bench_thread_t *bt);
+static int run_batch_pass(struct bench_thread_t *bt);
+static int is_write_op(struct bench_thread_t *bt);
+static void fill_write_data(struct bench_thread_t *bt, int32_t tag);
+static void record_result(struct bench_thread_t *bt, int is_write, int rc, int64_t start_us);
+static int latency_add(struct latency_buf_t *buf, uint32_t sample);
+static int compare_u32(const void *a, const void *b);
+static uint32_t percentile(const uint32_t *sorted, size_t count, int per_mille);
+static int64_t lib_metric(const char *name);
+static int64_t bench_time_us(void);
+static void handle_interrupt(void) { terminate = 1; }
+
+
+int main(int argc, char **argv) {
+    int64_t start_us = 0;
+    int64_t end_us = 0;
+    int64_t run_until_ms = 0;
+    int64_t packets_sent_start = 0;
+    int64_t requests_packed_start = 0;
+    int64_t bytes_sent_start = 0;
+    int64_t bytes_received_start = 0;
+    int64_t packets_sent = 0;
+    int64_t requests_packed = 0;
+    int64_t bytes_sent = 0;
+    int64_t bytes_received = 0;
+    uint64_t total_ops = 0;
+    uint64_t total_reads = 0;
+    uint64_t total_writes = 0;
+    uint64_t total_errors = 0;
+    uint64_t total_timeouts = 0;
+    uint64_t latency_sum = 0;
+    size_t latency_count = 0;
+    uint32_t *all_samples = NULL;
+    double elapsed_s = 0.0;
+    int tags_per_thread = 0;
+    int extra_tags = 0;
+    int next_tag = 0;
+
+    if(plc_tag_check_lib_version(REQUIRED_VERSION) != PLCTAG_STATUS_OK) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Required compatible library version %d.%d.%d not available!\n", REQUIRED_VERSION);
+        return 1;
+    }
+
+    if(parse_args(argc, argv) != 0) {
+        usage();
+        return 1;
+    }
+
+    plc_tag_set_debug_level(config.debug);
+
+    compat_set_interrupt_handler(handle_interrupt);
+
+    /* spread the tags as evenly as possible over the threads. */
+    tags_per_thread = config.num_tags / config.threads;
+    extra_tags = config.num_tags % config.threads;
+
+    for(int i = 0; i < config.threads; i++) {
+        struct bench_thread_t *bt = &bench_threads[i];
+
+        bt->thread_index = i;
+        bt->first_tag = next_tag;
+        bt->num_tags = tags_per_thread + (i < extra_tags ? 1 : 0);
+        next_tag += bt->num_tags;
+
+        if(create_tags(bt) != 0) {
+            for(int j = 0; j <= i; j++) { destroy_tags(&bench_threads[j]); }
+            return 1;
+        }
+    }
+
+    // NOLINTNEXTLINE
+    fprintf(stderr, "Created %d tags across %d threads, warming up for %dms.\n", config.num_tags, config.threads,
+            config.warmup_ms);
+
+    for(int i = 0; i < config.threads; i++) {
+        compat_thread_create(&bench_threads[i].thread, bench_thread_func, &bench_threads[i]);
+    }
+
+    /* warm up to get connections and packet sizes settled. */
+    run_until_ms = compat_time_ms() + config.warmup_ms;
+    while(!terminate && compat_time_ms() < run_until_ms) { compat_sleep_ms(10, NULL); }
+
+    packets_sent_start = lib_metric("lib_packets_sent");
+    requests_packed_start = lib_metric("lib_requests_packed");
+    bytes_sent_start = lib_metric("lib_bytes_sent");
+    bytes_received_start = lib_metric("lib_bytes_received");
+
+    start_us = bench_time_us();
+    recording = 1;
+
+    run_until_ms = compat_time_ms() + config.duration_ms;
+    while(!terminate && compat_time_ms() < run_until_ms) { compat_sleep_ms(10, NULL); }
+
+    recording = 0;
+    end_us = bench_time_us();
+
+    packets_sent = lib_metric("lib_packets_sent") - packets_sent_start;
+    requests_packed = lib_metric("lib_requests_packed") - requests_packed_start;
+    bytes_sent = lib_metric("lib_bytes_sent") - bytes_sent_start;
+    bytes_received = lib_metric("lib_bytes_received") - bytes_received_start;
+
+    end_run = 1;
+
+    for(int i = 0; i < config.threads; i++) {
+        void *ignored = NULL;
+        compat_thread_join(bench_threads[i].thread, &ignored);
+    }
+
+    /* merge the results. */
+    for(int i = 0; i < config.threads; i++) {
+        struct bench_thread_t *bt = &bench_threads[i];
+
+        total_reads += bt->read_count;
+        total_writes += bt->write_count;
+        total_errors += bt->error_count;
+        total_timeouts += bt->timeout_count;
+        latency_count += bt->latency.count;
+    }
+
+    total_ops = total_reads + total_writes;
+
+    if(latency_count > 0) {
+        size_t offset = 0;
+
+        all_samples = (uint32_t *)malloc(latency_count * sizeof(uint32_t));
+        if(!all_samples) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Unable to allocate memory for latency samples!\n");
+            return 1;
+        }
+
+        for(int i = 0; i < config.threads; i++) {
+            struct latency_buf_t *buf = &bench_threads[i].latency;
+
+            if(buf->count > 0) {
+                memcpy(&all_samples[offset], buf->samples, buf->count * sizeof(uint32_t));
+                offset += buf->count;
+            }
+        }
+
+        qsort(all_samples, latency_count, sizeof(uint32_t), compare_u32);
+
+        for(size_t i = 0; i < latency_count; i++) { latency_sum += all_samples[i]; }
+    }
+
+    elapsed_s = (double)(end_us - start_us) / 1000000.0;
+    if(elapsed_s <= 0.0) { elapsed_s = 1.0; }
+
+    // NOLINTNEXTLINE
+    printf("{\"label\":\"%s\",\"protocol\":\"%s\",\"mode\":\"%s\",\"tags\":%d,\"elems\":%d,\"threads\":%d,\"groups\":%d,"
+           "\"packing\":%d,\"inflight\":%d,\"fuse\":%d,\"poll_ms\":%d,\"write_every\":%d,\"duration_ms\":%" PRId64 ","
+           "\"ops\":%" PRIu64 ",\"reads\":%" PRIu64 ",\"writes\":%" PRIu64 ",\"errors\":%" PRIu64 ",\"timeouts\":%" PRIu64
+           ",\"ops_per_sec\":%.1f,"
+           "\"lat_avg_us\":%" PRIu64 ",\"lat_p50_us\":%" PRIu32 ",\"lat_p99_us\":%" PRIu32 ",\"lat_p999_us\":%" PRIu32
+           ",\"lat_max_us\":%" PRIu32 ","
+           "\"packets_sent\":%" PRId64 ",\"requests_packed\":%" PRId64 ",\"bytes_sent\":%" PRId64
+           ",\"bytes_received\":%" PRId64 "}\n",
+           config.label, (config.protocol == BENCH_PROTOCOL_AB ? "ab-eip" : "modbus-tcp"),
+           (config.mode == BENCH_MODE_SYNC ? "sync" : "batch"), config.num_tags, config.elems, config.threads, config.groups,
+           config.packing, config.inflight, config.fuse, config.poll_ms, config.write_every, (end_us - start_us) / 1000,
+           total_ops, total_reads, total_writes, total_errors, total_timeouts, (double)total_ops / elapsed_s,
+           (latency_count > 0 ? latency_sum / (uint64_t)latency_count : 0), percentile(all_samples, latency_count, 500),
+           percentile(all_samples, latency_count, 990), percentile(all_samples, latency_count, 999),
+           (latency_count > 0 ? all_samples[latency_count - 1] : 0), packets_sent, requests_packed, bytes_sent,
+           bytes_received);
+    fflush(stdout);
+
+    for(int i = 0; i < config.threads; i++) {
+        destroy_tags(&bench_threads[i]);
+        free(bench_threads[i].latency.samples);
+    }
+
+    free(all_samples);
+
+    plc_tag_shutdown();
+
+    return (terminate ? 1 : 0);
+}
+
+
+void usage(void) {
+    // NOLINTNEXTLINE
+    fprintf(stderr,
+            "Usage: benchmark [options]\n"
+            "  --protocol=ab|modbus   Protocol to drive.  Default ab.\n"
+            "  --gateway=<host[:port]> Simulator address.  Default 127.0.0.1 (ab) or 127.0.0.1:5020 (modbus).\n"
+            "  --path=<path>          CIP path or Modbus unit.  Default 1,0 (ab) or 0 (modbus).\n"
+            "  --plc=<type>           AB PLC type.  Default ControlLogix.\n"
+            "  --name=<tag>           Array tag/register base to slice.  Default BenchArray (ab) or hr (modbus).\n"
+            "  --tags=<n>             Number of tags.  Default 10.\n"
+            "  --elems=<n>            Elements per tag.  Default 1.\n"
+            "  --threads=<n>          Worker threads.  Default 1.\n"
+            "  --groups=<n>           Connection groups the tags are spread over.  Default 1.\n"
+            "  --packing=0|1          Allow request packing (ab only, the PLC must support it).  Default 0.\n"
+            "  --inflight=<n>         Modbus requests in flight per connection, 1-16.  Default 1.\n"
+            "  --fuse=0|1             Send Modbus register writes with reads using function 0x17.  Default 0.\n"
+            "  --mode=sync|batch      Blocking reads per tag or start all then wait.  Default sync.\n"
+            "  --poll=<ms>            Minimum time between operations on one tag.  Default 0.\n"
+            "  --write-every=<n>      Make every nth operation a write.  Default 0, never.\n"
+            "  --duration=<ms>        Measured run time.  Default 5000.\n"
+            "  --warmup=<ms>          Unmeasured run time before measuring.  Default 1000.\n"
+            "  --timeout=<ms>         Operation timeout.  Default 2000.\n"
+            "  --label=<text>         Label copied into the output record.\n"
+            "  --debug=<level>        Library debug level.  Default 0.\n");
+}
+
+
+static int parse_int_arg(const char *arg, const char *prefix, int min_val, int *val) {
+    size_t prefix_len = strlen(prefix);
+
+    if(strncmp(arg, prefix, prefix_len) != 0) { return 0; }
+
+    *val = atoi(&arg[prefix_len]);
+
+    if(*val < min_val) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Argument \"%s\" must be at least %d!\n", arg, min_val);
+        return -1;
+    }
+
+    return 1;
+}
+
+
+int parse_args(int argc, char **argv) {
+    for(int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        int rc = 0;
+
+        if(strncmp(arg, "--protocol=", 11) == 0) {
+            if(compat_strcasecmp(&arg[11], "ab") == 0 || compat_strcasecmp(&arg[11], "ab-eip") == 0) {
+                config.protocol = BENCH_PROTOCOL_AB;
+            } else if(compat_strcasecmp(&arg[11], "modbus") == 0 || compat_strcasecmp(&arg[11], "modbus-tcp") == 0) {
+                config.protocol = BENCH_PROTOCOL_MODBUS;
+            } else {
+                // NOLINTNEXTLINE
+                fprintf(stderr, "Unknown protocol \"%s\"!\n", &arg[11]);
+                return -1;
+            }
+            continue;
+        }
+
+        if(strncmp(arg, "--mode=", 7) == 0) {
+            if(compat_strcasecmp(&arg[7], "sync") == 0) {
+                config.mode = BENCH_MODE_SYNC;
+            } else if(compat_strcasecmp(&arg[7], "batch") == 0) {
+                config.mode = BENCH_MODE_BATCH;
+            } else {
+                // NOLINTNEXTLINE
+                fprintf(stderr, "Unknown mode \"%s\"!\n", &arg[7]);
+                return -1;
+            }
+            continue;
+        }
+
+        if(strncmp(arg, "--gateway=", 10) == 0) {
+            config.gateway = &arg[10];
+            continue;
+        }
+        if(strncmp(arg, "--path=", 7) == 0) {
+            config.path = &arg[7];
+            continue;
+        }
+        if(strncmp(arg, "--plc=", 6) == 0) {
+            config.plc = &arg[6];
+            continue;
+        }
+        if(strncmp(arg, "--name=", 7) == 0) {
+            config.tag_name = &arg[7];
+            continue;
+        }
+        if(strncmp(arg, "--label=", 8) == 0) {
+            config.label = &arg[8];
+            continue;
+        }
+
+        if((rc = parse_int_arg(arg, "--tags=", 1, &config.num_tags)) != 0
+           || (rc = parse_int_arg(arg, "--elems=", 1, &config.elems)) != 0
+           || (rc = parse_int_arg(arg, "--threads=", 1, &config.threads)) != 0
+           || (rc = parse_int_arg(arg, "--groups=", 1, &config.groups)) != 0
+           || (rc = parse_int_arg(arg, "--packing=", 0, &config.packing)) != 0
+           || (rc = parse_int_arg(arg, "--inflight=", 1, &config.inflight)) != 0
+           || (rc = parse_int_arg(arg, "--fuse=", 0, &config.fuse)) != 0
+           || (rc = parse_int_arg(arg, "--poll=", 0, &config.poll_ms)) != 0
+           || (rc = parse_int_arg(arg, "--write-every=", 0, &config.write_every)) != 0
+           || (rc = parse_int_arg(arg, "--duration=", 1, &config.duration_ms)) != 0
+           || (rc = parse_int_arg(arg, "--warmup=", 0, &config.warmup_ms)) != 0
+           || (rc = parse_int_arg(arg, "--timeout=", 1, &config.timeout_ms)) != 0
+           || (rc = parse_int_arg(arg, "--debug=", 0, &config.debug)) != 0) {
+            if(rc < 0) { return -1; }
+            continue;
+        }
+
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Unknown argument \"%s\"!\n", arg);
+        return -1;
+    }
+
+    if(config.threads > MAX_THREADS) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "At most %d threads are supported!\n", MAX_THREADS);
+        return -1;
+    }
+
+    if(config.threads > config.num_tags) { config.threads = config.num_tags; }
+
+    /* fill in the protocol-specific defaults. */
+    if(config.protocol == BENCH_PROTOCOL_AB) {
+        if(!config.gateway) { config.gateway = "127.0.0.1"; }
+        if(!config.path) { config.path = "1,0"; }
+        if(!config.plc) { config.plc = "ControlLogix"; }
+        if(!config.tag_name) { config.tag_name = "BenchArray"; }
+    } else {
+        if(!config.gateway) { config.gateway = "127.0.0.1:5020"; }
+        if(!config.path) { config.path = "0"; }
+        if(!config.tag_name) { config.tag_name = "hr"; }
+    }
+
+    return 0;
+}
+
+
+int create_tags(struct bench_thread_t *bt) {
+    int rc = PLCTAG_STATUS_OK;
+
+    bt->tags = (int32_t *)calloc((size_t)bt->num_tags, sizeof(int32_t));
+    bt->next_poll_ms = (int64_t *)calloc((size_t)bt->num_tags, sizeof(int64_t));
+    bt->pending_op = (bench_op_t *)calloc((size_t)bt->num_tags, sizeof(bench_op_t));
+    bt->latency.samples = (uint32_t *)malloc(LATENCY_INITIAL_CAPACITY * sizeof(uint32_t));
+    bt->latency.capacity = LATENCY_INITIAL_CAPACITY;
+
+    if(!bt->tags || !bt->next_poll_ms || !bt->pending_op || !bt->latency.samples) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Unable to allocate memory for thread %d!\n", bt->thread_index);
+        return -1;
+    }
+
+    /* start all the creates so that tags connect in parallel. */
+    for(int i = 0; i < bt->num_tags; i++) {
+        char tag_string[MAX_TAG_STRING] = {0};
+        int tag_num = bt->first_tag + i;
+        int first_elem = tag_num * config.elems;
+
+        if(config.protocol == BENCH_PROTOCOL_AB) {
+            compat_snprintf(tag_string, sizeof(tag_string),
+                            "protocol=ab-eip&gateway=%s&path=%s&plc=%s&name=%s[%d]&elem_count=%d&allow_packing=%d"
+                            "&connection_group_id=%d",
+                            config.gateway, config.path, config.plc, config.tag_name, first_elem, config.elems,
+                            config.packing, tag_num % config.groups);
+        } else {
+            compat_snprintf(tag_string, sizeof(tag_string),
+                            "protocol=modbus-tcp&gateway=%s&path=%s&name=%s%d&elem_count=%d&connection_group_id=%d"
+                            "&max_requests_in_flight=%d&fuse_read_write=%d",
+                            config.gateway, config.path, config.tag_name, first_elem, config.elems,
+                            tag_num % config.groups, config.inflight, config.fuse);
+        }
+
+        bt->tags[i] = plc_tag_create(tag_string, 0);
+        if(bt->tags[i] < 0) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Error %s creating tag \"%s\"!\n", plc_tag_decode_error(bt->tags[i]), tag_string);
+            return -1;
+        }
+    }
+
+    /* wait for them all to finish creating. */
+    for(int i = 0; i < bt->num_tags; i++) {
+        int64_t timeout_time = compat_time_ms() + TAG_CREATE_TIMEOUT_MS;
+
+        while((rc = plc_tag_status(bt->tags[i])) == PLCTAG_STATUS_PENDING && compat_time_ms() < timeout_time) {
+            compat_sleep_ms(1, NULL);
+        }
+
+        if(rc != PLCTAG_STATUS_OK) {
+            // NOLINTNEXTLINE
+            fprintf(stderr, "Error %s waiting for tag %d to be created!\n", plc_tag_decode_error(rc), bt->first_tag + i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+void destroy_tags(struct bench_thread_t *bt) {
+    if(bt->tags) {
+        for(int i = 0; i < bt->num_tags; i++) {
+            if(bt->tags[i] > 0) { plc_tag_destroy(bt->tags[i]); }
+        }
+
+        free(bt->tags);
+        bt->tags = NULL;
+    }
+
+    free(bt->next_poll_ms);
+    bt->next_poll_ms = NULL;
+
+    free(bt->pending_op);
+    bt->pending_op = NULL;
+}
+
+
+void *bench_thread_func(void *arg) {
+    struct bench_thread_t *bt = (struct bench_thread_t *)arg;
+
+    while(!end_run && !terminate) {
+        int did_work = 0;
+
+        if(config.mode == BENCH_MODE_SYNC) {
+            did_work = run_sync_pass(bt);
+        } else {
+            did_work = run_batch_pass(bt);
+        }
+
+        /* nothing was due, wait for the next poll time. */
+        if(!did_work) { compat_sleep_ms(1, NULL); }
+    }
+
+    return NULL;
+}
+
+
+/* one blocking operation per due tag, in order. */
+int run_sync_pass(struct bench_thread_t *bt) {
+    int did_work = 0;
+
+    for(int i = 0; i < bt->num_tags && !end_run; i++) {
+        int64_t now_ms = compat_time_ms();
+        int64_t start_us = 0;
+        int is_write = 0;
+        int rc = PLCTAG_STATUS_OK;
+
+        if(bt->next_poll_ms[i] > now_ms) { continue; }
+
+        bt->next_poll_ms[i] = now_ms + config.poll_ms;
+        did_work = 1;
+
+        is_write = is_write_op(bt);
+
+        start_us = bench_time_us();
+
+        if(is_write) {
+            fill_write_data(bt, bt->tags[i]);
+            rc = plc_tag_write(bt->tags[i], config.timeout_ms);
+        } else {
+            rc = plc_tag_read(bt->tags[i], config.timeout_ms);
+        }
+
+        record_result(bt, is_write, rc, start_us);
+    }
+
+    return did_work;
+}
+
+
+/* start operations on every due tag and then wait for all of them so that the library can pack requests. */
+int run_batch_pass(struct bench_thread_t *bt) {
+    int64_t now_ms = compat_time_ms();
+    int64_t start_us = bench_time_us();
+    int64_t timeout_ms = now_ms + config.timeout_ms;
+    int outstanding = 0;
+    int did_work = 0;
+
+    for(int i = 0; i < bt->num_tags; i++) {
+        int rc = PLCTAG_STATUS_OK;
+        int is_write = 0;
+
+        bt->pending_op[i] = BENCH_OP_NONE;
+
+        if(bt->next_poll_ms[i] > now_ms) { continue; }
+
+        bt->next_poll_ms[i] = now_ms + config.poll_ms;
+        did_work = 1;
+
+        is_write = is_write_op(bt);
+
+        if(is_write) {
+            fill_write_data(bt, bt->tags[i]);
+            rc = plc_tag_write(bt->tags[i], 0);
+        } else {
+            rc = plc_tag_read(bt->tags[i], 0);
+        }
+
+        if(rc == PLCTAG_STATUS_PENDING) {
+            bt->pending_op[i] = (is_write ? BENCH_OP_WRITE : BENCH_OP_READ);
+            outstanding++;
+        } else {
+            record_result(bt, is_write, rc, start_us);
+        }
+    }
+
+    /* poll for completion, recording each tag as it finishes. */
+    while(outstanding > 0) {
+        for(int i = 0; i < bt->num_tags; i++) {
+            int rc = PLCTAG_STATUS_OK;
+
+            if(bt->pending_op[i] == BENCH_OP_NONE) { continue; }
+
+            rc = plc_tag_status(bt->tags[i]);
+            if(rc == PLCTAG_STATUS_PENDING) {
+                if(compat_time_ms() < timeout_ms) { continue; }
+
+                plc_tag_abort(bt->tags[i]);
+                rc = PLCTAG_ERR_TIMEOUT;
+            }
+
+            record_result(bt, (bt->pending_op[i] == BENCH_OP_WRITE), rc, start_us);
+            bt->pending_op[i] = BENCH_OP_NONE;
+            outstanding--;
+        }
+
+        if(outstanding > 0) { compat_thread_yield(); }
+    }
+
+    return did_work;
+}
+
+
+int is_write_op(struct bench_thread_t *bt) {
+    /* count started operations, batch mode starts several before any complete. */
+    uint64_t op_num = bt->start_count++;
+
+    if(config.write_every <= 0) { return 0; }
+
+    return (((op_num + 1) % (uint64_t)config.write_every) == 0);
+}
+
+
+void fill_write_data(struct bench_thread_t *bt, int32_t tag) {
+    int size = plc_tag_get_size(tag);
+    uint8_t val = (uint8_t)(bt->op_count & 0xFF);
+
+    for(int offset = 0; offset < size; offset++) { plc_tag_set_uint8(tag, offset, val); }
+}
+
+
+void record_result(struct bench_thread_t *bt, int is_write, int rc, int64_t start_us) {
+    int64_t elapsed_us = bench_time_us() - start_us;
+
+    /* the schedule advances during warm up too so that runs line up. */
+    bt->op_count++;
+
+    if(!recording) { return; }
+
+    if(is_write) {
+        bt->write_count++;
+    } else {
+        bt->read_count++;
+    }
+
+    if(rc != PLCTAG_STATUS_OK) {
+        if(rc == PLCTAG_ERR_TIMEOUT) { bt->timeout_count++; }
+        bt->error_count++;
+        return;
+    }
+
+    if(elapsed_us < 0) { elapsed_us = 0; }
+    if(elapsed_us > (int64_t)UINT32_MAX) { elapsed_us = (int64_t)UINT32_MAX; }
+
+    if(latency_add(&bt->latency, (uint32_t)elapsed_us) != 0) {
+        // NOLINTNEXTLINE
+        fprintf(stderr, "Unable to grow latency buffer for thread %d!\n", bt->thread_index);
+        terminate = 1;
+    }
+}
+
+
+int latency_add(struct latency_buf_t *buf, uint32_t sample) {
+    if(buf->count >= buf->capacity) {
+        size_t new_capacity = buf->capacity * 2;
+        uint32_t *new_samples = (uint32_t *)realloc(buf->samples, new_capacity * sizeof(uint32_t));
+
+        if(!new_samples) { return -1; }
+
+        buf->samples = new_samples;
+        buf->capacity = new_capacity;
+    }
+
+    buf->samples[buf->count] = sample;
+    buf->count++;
+
+    return 0;
+}
+
+
+int compare_u32(const void *a, const void *b) {
+    uint32_t val_a = *(const uint32_t *)a;
+    uint32_t val_b = *(const uint32_t *)b;
+
+    return (val_a > val_b) - (val_a < val_b);
+}
+
+
+/* nearest-rank percentile over sorted samples. */
+uint32_t percentile(const uint32_t *sorted, size_t count, int per_mille) {
+    size_t rank = 0;
+
+    if(!sorted || count == 0) { return 0; }
+
+    rank = (count * (size_t)per_mille + 999) / 1000;
+    if(rank < 1) { rank = 1; }
+    if(rank > count) { rank = count; }
+
+    return sorted[rank - 1];
+}
+
+
+int64_t lib_metric(const char *name) { return (int64_t)plc_tag_get_int_attribute(0, name, 0); }
+
+
+#if defined(POSIX_PLATFORM)
+
+int64_t bench_time_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000 + (int64_t)ts.tv_nsec / 1000;
+}
+
+#else
+
+int64_t bench_time_us(void) {
+    static LARGE_INTEGER freq = {0};
+    LARGE_INTEGER counter;
+
+    if(freq.QuadPart == 0) { QueryPerformanceFrequency(&freq); }
+
+    QueryPerformanceCounter(&counter);
+
+    return (int64_t)((counter.QuadPart * 1000000) / freq.QuadPart);
+}
+
+#endif
@@ -0,0 +1,225 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <libplctag/lib/libplctag.h>
+#include <libplctag/protocols/eip/transport.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* assert() is compiled out of release builds. */
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if(!(cond)) {                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                 \
+        }                                                                            \
+    } while(0)
+
+/*
+ * The AB session folds queued bit writes into one Read-Modify-Write with
+ * eip_merge_rmw_requests() and stops at anything eip_requests_overlap() says
+ * may touch the same tag.  This builds real connected requests for both.
+ */
+
+#define MAX_PACKET (256)
+
+#define ENCAP_CONNECTED_SEND (0x70)
+#define CO_CDI_LENGTH (42)
+#define CO_CIP (46)
+
+#define CIP_READ (0x4C)
+#define CIP_RMW (0x4E)
+
+struct packet_t {
+    uint8_t data[MAX_PACKET];
+    int size;
+};
+
+
+static void set_u16(uint8_t *data, int offset, int val) {
+    data[offset] = (uint8_t)(val & 0xFF);
+    data[offset + 1] = (uint8_t)((val >> 8) & 0xFF);
+}
+
+
+/* a symbolic path to name, with an element index if index is not negative. */
+static int build_path(uint8_t *path, const char *name, int index) {
+    int len = (int)strlen(name);
+    int size = 0;
+
+    path[size++] = 0x91;
+    path[size++] = (uint8_t)len;
+    memcpy(path + size, name, (size_t)len);
+    size += len;
+    if(size & 0x01) { path[size++] = 0; }
+
+    if(index >= 0) {
+        path[size++] = 0x28;
+        path[size++] = (uint8_t)index;
+    }
+
+    return size;
+}
+
+
+/* wrap a CIP body of body_size bytes, already at CO_CIP, in a connected send. */
+static void finish(struct packet_t *packet, int body_size) {
+    set_u16(packet->data, 0, ENCAP_CONNECTED_SEND);
+    set_u16(packet->data, CO_CDI_LENGTH, body_size + 2);
+    packet->size = CO_CIP + body_size;
+}
+
+
+static void build_read(struct packet_t *packet, const char *name, int index) {
+    uint8_t *body = packet->data + CO_CIP;
+    int path_size = 0;
+
+    memset(packet, 0, sizeof(*packet));
+
+    body[0] = CIP_READ;
+    path_size = build_path(body + 2, name, index);
+    body[1] = (uint8_t)(path_size / 2);
+    set_u16(body, 2 + path_size, 1);
+
+    finish(packet, 2 + path_size + 2);
+}
+
+
+/* a one byte RMW that sets the bits in set_bits and clears the bits in clear_bits. */
+static void build_rmw(struct packet_t *packet, const char *name, int index, uint8_t set_bits, uint8_t clear_bits) {
+    uint8_t *body = packet->data + CO_CIP;
+    int path_size = 0;
+
+    memset(packet, 0, sizeof(*packet));
+
+    body[0] = CIP_RMW;
+    path_size = build_path(body + 2, name, index);
+    body[1] = (uint8_t)(path_size / 2);
+    set_u16(body, 2 + path_size, 1);
+    body[2 + path_size + 2] = set_bits;
+    body[2 + path_size + 3] = (uint8_t)~clear_bits;
+
+    finish(packet, 2 + path_size + 4);
+}
+
+
+static uint8_t or_mask(struct packet_t *packet) { return packet->data[packet->size - 2]; }
+
+static uint8_t and_mask(struct packet_t *packet) { return packet->data[packet->size - 1]; }
+
+
+static void test_merge(void) {
+    struct packet_t first;
+    struct packet_t second;
+
+    /* set bit 0, clear bit 1, then clear bit 0 and set bit 2, the later write wins bit 0. */
+    build_rmw(&first, "Bits", -1, 0x01, 0x02);
+    build_rmw(&second, "Bits", -1, 0x04, 0x01);
+
+    CHECK(eip_merge_rmw_requests(first.data, first.size, second.data, second.size) == PLCTAG_STATUS_OK);
+    CHECK(or_mask(&first) == 0x04);
+    CHECK(and_mask(&first) == (uint8_t)~0x03);
+
+    /* the request merged in is left alone. */
+    CHECK(or_mask(&second) == 0x04);
+    CHECK(and_mask(&second) == (uint8_t)~0x01);
+}
+
+
+static void test_no_merge(void) {
+    struct packet_t first;
+    struct packet_t second;
+
+    build_rmw(&first, "Bits", 0, 0x01, 0x00);
+    build_rmw(&second, "Bits", 1, 0x02, 0x00);
+
+    /* different elements are different integers. */
+    CHECK(eip_merge_rmw_requests(first.data, first.size, second.data, second.size) == PLCTAG_ERR_NO_MATCH);
+    CHECK(or_mask(&first) == 0x01);
+    CHECK(and_mask(&first) == 0xFF);
+
+    /* a read is not a bit write. */
+    build_read(&second, "Bits", 0);
+    CHECK(eip_merge_rmw_requests(first.data, first.size, second.data, second.size) == PLCTAG_ERR_NO_MATCH);
+    CHECK(or_mask(&first) == 0x01);
+}
+
+
+static void test_overlap(void) {
+    struct packet_t write;
+    struct packet_t other;
+
+    build_rmw(&write, "Bits", 3, 0x01, 0x00);
+
+    /* a read of the same element, another element or the whole tag must not be passed. */
+    build_read(&other, "Bits", 3);
+    CHECK(eip_requests_overlap(write.data, write.size, other.data, other.size));
+    build_read(&other, "Bits", 4);
+    CHECK(eip_requests_overlap(write.data, write.size, other.data, other.size));
+    build_read(&other, "Bits", -1);
+    CHECK(eip_requests_overlap(write.data, write.size, other.data, other.size));
+
+    /* the PLC does not care about the case of tag names. */
+    build_read(&other, "bITS", -1);
+    CHECK(eip_requests_overlap(write.data, write.size, other.data, other.size));
+
+    /* other tags can be passed. */
+    build_read(&other, "Bit", 3);
+    CHECK(!eip_requests_overlap(write.data, write.size, other.data, other.size));
+    build_read(&other, "Bytes", 3);
+    CHECK(!eip_requests_overlap(write.data, write.size, other.data, other.size));
+    build_rmw(&other, "Bots", 3, 0x01, 0x00);
+    CHECK(!eip_requests_overlap(write.data, write.size, other.data, other.size));
+
+    /* a tag by instance number could be any tag. */
+    build_read(&other, "Bits", -1);
+    other.data[CO_CIP + 2] = 0x20;
+    other.data[CO_CIP + 3] = 0x6B;
+    CHECK(eip_requests_overlap(write.data, write.size, other.data, other.size));
+
+    /* nor can anything that does not parse. */
+    build_read(&other, "Bits", -1);
+    other.data[CO_CIP + 1] = 40;
+    CHECK(eip_requests_overlap(write.data, write.size, other.data, other.size));
+}
+
+
+int main(void) {
+    test_merge();
+    test_no_merge();
+    test_overlap();
+
+    return 0;
+}
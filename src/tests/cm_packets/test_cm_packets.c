@@ -0,0 +1,323 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <libplctag/lib/libplctag.h>
+#include <libplctag/protocols/ab/defs.h>
+#include <libplctag/protocols/eip/transport.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* assert() is compiled out of release builds. */
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if(!(cond)) {                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                 \
+        }                                                                            \
+    } while(0)
+
+/*
+ * The AB session and the Omron connection build their session registration,
+ * Forward Open and Forward Close packets with the shared transport.  These
+ * check the packets field by field against the packed structures the AB
+ * session used to fill in, and check how Forward Open replies are read.
+ */
+
+#define MAX_PACKET (600)
+#define UC_CIP (40)
+
+/* port 1 slot 0, then the Message Router. */
+static uint8_t conn_path[] = {0x01, 0x00, 0x20, 0x02, 0x24, 0x01};
+
+
+static void fill_fo(struct eip_forward_open_t *fo, int use_extended) {
+    memset(fo, 0, sizeof(*fo));
+
+    fo->session_handle = 0x11223344;
+    fo->sender_context = 0x0102030405060708ULL;
+    fo->orig_connection_id = 0xCAFEF00D;
+    fo->conn_serial_number = 0x4321;
+    fo->use_extended = use_extended;
+    fo->max_payload = 504;
+    fo->conn_path = conn_path;
+    fo->conn_path_size = (int)sizeof(conn_path);
+}
+
+
+static void check_cpf(uint8_t *packet, int packet_size, int cip_size) {
+    eip_forward_open_request_t *req = (eip_forward_open_request_t *)packet;
+
+    CHECK(packet_size == UC_CIP + cip_size + (int)sizeof(conn_path));
+    CHECK(le2h16(req->encap_command) == AB_EIP_UNCONNECTED_SEND);
+    CHECK(le2h16(req->encap_length) == packet_size - (int)sizeof(eip_encap));
+    CHECK(le2h32(req->encap_session_handle) == 0x11223344);
+    CHECK(le2h32(req->encap_status) == 0);
+    CHECK(le2h64(req->encap_sender_context) == 0x0102030405060708ULL);
+    CHECK(le2h32(req->interface_handle) == 0);
+    CHECK(le2h16(req->router_timeout) == 1);
+    CHECK(le2h16(req->cpf_item_count) == 2);
+    CHECK(le2h16(req->cpf_nai_item_type) == AB_EIP_ITEM_NAI);
+    CHECK(le2h16(req->cpf_nai_item_length) == 0);
+    CHECK(le2h16(req->cpf_udi_item_type) == AB_EIP_ITEM_UDI);
+    CHECK(le2h16(req->cpf_udi_item_length) == packet_size - UC_CIP);
+    CHECK(req->cm_req_path_size == 2);
+    CHECK(req->cm_req_path[0] == 0x20 && req->cm_req_path[1] == 0x06);
+    CHECK(req->cm_req_path[2] == 0x24 && req->cm_req_path[3] == 0x01);
+    CHECK(memcmp(packet + UC_CIP + cip_size, conn_path, sizeof(conn_path)) == 0);
+}
+
+
+static void test_register_session(void) {
+    uint8_t packet[MAX_PACKET];
+    eip_session_reg_req *req = (eip_session_reg_req *)packet;
+    int packet_size = 0;
+    uint32_t handle = 0;
+
+    memset(packet, 0xFF, sizeof(packet));
+
+    CHECK(eip_build_register_session(packet, 10, &packet_size) == PLCTAG_ERR_TOO_SMALL);
+    CHECK(eip_build_register_session(packet, MAX_PACKET, &packet_size) == PLCTAG_STATUS_OK);
+    CHECK(packet_size == (int)sizeof(eip_session_reg_req));
+    CHECK(le2h16(req->encap_command) == AB_EIP_REGISTER_SESSION);
+    CHECK(le2h16(req->encap_length) == sizeof(eip_session_reg_req) - sizeof(eip_encap));
+    CHECK(le2h32(req->encap_session_handle) == 0);
+    CHECK(le2h64(req->encap_sender_context) == 0);
+    CHECK(le2h16(req->eip_version) == AB_EIP_VERSION);
+    CHECK(le2h16(req->option_flags) == 0);
+
+    /* the reply is the request with a handle. */
+    req->encap_session_handle = h2le32(0xABCD1234);
+    CHECK(eip_check_register_session_response(packet, packet_size, &handle) == PLCTAG_STATUS_OK);
+    CHECK(handle == 0xABCD1234);
+
+    req->encap_status = h2le32(1);
+    CHECK(eip_check_register_session_response(packet, packet_size, &handle) == PLCTAG_ERR_REMOTE_ERR);
+
+    req->encap_status = h2le32(0);
+    req->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND);
+    CHECK(eip_check_register_session_response(packet, packet_size, &handle) == PLCTAG_ERR_BAD_DATA);
+
+    CHECK(eip_check_register_session_response(packet, 10, &handle) == PLCTAG_ERR_BAD_DATA);
+}
+
+
+static void test_forward_open(void) {
+    uint8_t packet[MAX_PACKET];
+    eip_forward_open_request_t *req = (eip_forward_open_request_t *)packet;
+    struct eip_forward_open_t fo;
+    int packet_size = 0;
+
+    fill_fo(&fo, 0);
+    memset(packet, 0xFF, sizeof(packet));
+
+    CHECK(eip_build_forward_open(packet, 50, &fo, &packet_size) == PLCTAG_ERR_TOO_SMALL);
+    CHECK(eip_build_forward_open(packet, MAX_PACKET, &fo, &packet_size) == PLCTAG_STATUS_OK);
+
+    check_cpf(packet, packet_size, (int)sizeof(*req) - UC_CIP);
+    CHECK(req->cm_service_code == AB_EIP_CMD_FORWARD_OPEN);
+    CHECK(req->secs_per_tick == AB_EIP_SECS_PER_TICK);
+    CHECK(req->timeout_ticks == AB_EIP_TIMEOUT_TICKS);
+    CHECK(le2h32(req->orig_to_targ_conn_id) == 0);
+    CHECK(le2h32(req->targ_to_orig_conn_id) == 0xCAFEF00D);
+    CHECK(le2h16(req->conn_serial_number) == 0x4321);
+    CHECK(le2h16(req->orig_vendor_id) == AB_EIP_VENDOR_ID);
+    CHECK(le2h32(req->orig_serial_number) == AB_EIP_VENDOR_SN);
+    CHECK(req->conn_timeout_multiplier == AB_EIP_TIMEOUT_MULTIPLIER);
+    CHECK(req->reserved[0] == 0 && req->reserved[1] == 0 && req->reserved[2] == 0);
+    CHECK(le2h32(req->orig_to_targ_rpi) == AB_EIP_RPI);
+    CHECK(le2h16(req->orig_to_targ_conn_params) == (AB_EIP_CONN_PARAM | 504));
+    CHECK(le2h32(req->targ_to_orig_rpi) == AB_EIP_RPI);
+    CHECK(le2h16(req->targ_to_orig_conn_params) == (AB_EIP_CONN_PARAM | 504));
+    CHECK(req->transport_class == AB_EIP_TRANSPORT_CLASS_T3);
+    CHECK(req->path_size == sizeof(conn_path) / 2);
+
+    /* DH+ routes use fixed connection parameters. */
+    fo.conn_params = AB_EIP_PLC5_PARAM;
+    CHECK(eip_build_forward_open(packet, MAX_PACKET, &fo, &packet_size) == PLCTAG_STATUS_OK);
+    CHECK(le2h16(req->orig_to_targ_conn_params) == AB_EIP_PLC5_PARAM);
+    CHECK(le2h16(req->targ_to_orig_conn_params) == AB_EIP_PLC5_PARAM);
+}
+
+
+static void test_forward_open_ex(void) {
+    uint8_t packet[MAX_PACKET];
+    eip_forward_open_request_ex_t *req = (eip_forward_open_request_ex_t *)packet;
+    struct eip_forward_open_t fo;
+    int packet_size = 0;
+
+    fill_fo(&fo, 1);
+    fo.max_payload = 4002;
+    memset(packet, 0xFF, sizeof(packet));
+
+    CHECK(eip_build_forward_open(packet, MAX_PACKET, &fo, &packet_size) == PLCTAG_STATUS_OK);
+
+    check_cpf(packet, packet_size, (int)sizeof(*req) - UC_CIP);
+    CHECK(req->cm_service_code == AB_EIP_CMD_FORWARD_OPEN_EX);
+    CHECK(req->secs_per_tick == AB_EIP_SECS_PER_TICK);
+    CHECK(req->timeout_ticks == AB_EIP_TIMEOUT_TICKS);
+    CHECK(le2h32(req->orig_to_targ_conn_id) == 0);
+    CHECK(le2h32(req->targ_to_orig_conn_id) == 0xCAFEF00D);
+    CHECK(le2h16(req->conn_serial_number) == 0x4321);
+    CHECK(le2h16(req->orig_vendor_id) == AB_EIP_VENDOR_ID);
+    CHECK(le2h32(req->orig_serial_number) == AB_EIP_VENDOR_SN);
+    CHECK(req->conn_timeout_multiplier == AB_EIP_TIMEOUT_MULTIPLIER);
+    CHECK(le2h32(req->orig_to_targ_rpi) == AB_EIP_RPI);
+    CHECK(le2h32(req->orig_to_targ_conn_params_ex) == (AB_EIP_CONN_PARAM_EX | 4002));
+    CHECK(le2h32(req->targ_to_orig_rpi) == AB_EIP_RPI);
+    CHECK(le2h32(req->targ_to_orig_conn_params_ex) == (AB_EIP_CONN_PARAM_EX | 4002));
+    CHECK(req->transport_class == AB_EIP_TRANSPORT_CLASS_T3);
+    CHECK(req->path_size == sizeof(conn_path) / 2);
+}
+
+
+static void test_forward_close(void) {
+    uint8_t packet[MAX_PACKET];
+    eip_forward_close_req_t *req = (eip_forward_close_req_t *)packet;
+    struct eip_forward_open_t fo;
+    int packet_size = 0;
+
+    fill_fo(&fo, 1);
+    memset(packet, 0xFF, sizeof(packet));
+
+    CHECK(eip_build_forward_close(packet, MAX_PACKET, &fo, &packet_size) == PLCTAG_STATUS_OK);
+
+    check_cpf(packet, packet_size, (int)sizeof(*req) - UC_CIP);
+    CHECK(req->cm_service_code == AB_EIP_CMD_FORWARD_CLOSE);
+    CHECK(req->secs_per_tick == AB_EIP_SECS_PER_TICK);
+    CHECK(req->timeout_ticks == AB_EIP_TIMEOUT_TICKS);
+    CHECK(le2h16(req->conn_serial_number) == 0x4321);
+    CHECK(le2h16(req->orig_vendor_id) == AB_EIP_VENDOR_ID);
+    CHECK(le2h32(req->orig_serial_number) == AB_EIP_VENDOR_SN);
+    CHECK(req->path_size == sizeof(conn_path) / 2);
+    CHECK(req->reserved == 0);
+}
+
+
+static int make_fo_reply(uint8_t *packet, uint8_t status, const uint8_t *ext_status, int ext_words) {
+    eip_forward_open_response_t *resp = (eip_forward_open_response_t *)packet;
+    int packet_size = (int)sizeof(*resp);
+
+    memset(packet, 0, MAX_PACKET);
+
+    resp->encap_command = h2le16(AB_EIP_UNCONNECTED_SEND);
+    resp->resp_service_code = AB_EIP_CMD_FORWARD_OPEN_EX | AB_EIP_CMD_CIP_OK;
+    resp->general_status = status;
+
+    if(status == AB_EIP_OK) {
+        resp->orig_to_targ_conn_id = h2le32(0x10203040);
+        resp->targ_to_orig_conn_id = h2le32(0xCAFEF00D);
+    } else {
+        /* a refusal carries the extended status words in place of the reply. */
+        resp->status_size = (uint8_t)ext_words;
+        memcpy(&resp->status_size + 1, ext_status, (size_t)(2 * ext_words));
+        packet_size = UC_CIP + 4 + (2 * ext_words);
+    }
+
+    resp->encap_length = h2le16((uint16_t)(packet_size - (int)sizeof(eip_encap)));
+
+    return packet_size;
+}
+
+
+static void test_forward_open_response(void) {
+    static const uint8_t too_large[] = {0x09, 0x01, 0xF6, 0x01};
+    static const uint8_t duplicate[] = {0x00, 0x01, 0x00, 0x00};
+    static const uint8_t other[] = {0x13, 0x01};
+    uint8_t packet[MAX_PACKET];
+    uint8_t *cip_status = NULL;
+    uint32_t targ_id = 0;
+    uint32_t orig_id = 0;
+    uint16_t supported_size = 0;
+    int packet_size = 0;
+
+    packet_size = make_fo_reply(packet, AB_EIP_OK, NULL, 0);
+    CHECK(eip_check_forward_open_response(packet, packet_size, &targ_id, &orig_id, &supported_size, &cip_status)
+          == PLCTAG_STATUS_OK);
+    CHECK(targ_id == 0x10203040);
+    CHECK(orig_id == 0xCAFEF00D);
+    CHECK(cip_status == NULL);
+
+    /* cut off before the connection IDs. */
+    CHECK(eip_check_forward_open_response(packet, UC_CIP + 8, &targ_id, &orig_id, &supported_size, &cip_status)
+          == PLCTAG_ERR_BAD_DATA);
+
+    packet_size = make_fo_reply(packet, 0x01, too_large, 2);
+    CHECK(eip_check_forward_open_response(packet, packet_size, &targ_id, &orig_id, &supported_size, &cip_status)
+          == PLCTAG_ERR_TOO_LARGE);
+    CHECK(supported_size == 502);
+    CHECK(cip_status && *cip_status == 0x01);
+
+    /* the supported size is missing. */
+    CHECK(eip_check_forward_open_response(packet, packet_size - 2, &targ_id, &orig_id, &supported_size, &cip_status)
+          == PLCTAG_ERR_REMOTE_ERR);
+
+    packet_size = make_fo_reply(packet, 0x01, duplicate, 2);
+    CHECK(eip_check_forward_open_response(packet, packet_size, &targ_id, &orig_id, &supported_size, &cip_status)
+          == PLCTAG_ERR_DUPLICATE);
+
+    packet_size = make_fo_reply(packet, 0x08, NULL, 0);
+    CHECK(eip_check_forward_open_response(packet, packet_size, &targ_id, &orig_id, &supported_size, &cip_status)
+          == PLCTAG_ERR_UNSUPPORTED);
+    CHECK(cip_status && *cip_status == 0x08);
+
+    packet_size = make_fo_reply(packet, 0x01, other, 1);
+    CHECK(eip_check_forward_open_response(packet, packet_size, &targ_id, &orig_id, &supported_size, &cip_status)
+          == PLCTAG_ERR_REMOTE_ERR);
+    CHECK(cip_status && *cip_status == 0x01);
+
+    /* an encapsulation error is not a CIP refusal. */
+    packet_size = make_fo_reply(packet, AB_EIP_OK, NULL, 0);
+    ((eip_forward_open_response_t *)packet)->encap_status = h2le32(0x65);
+    CHECK(eip_check_forward_open_response(packet, packet_size, &targ_id, &orig_id, &supported_size, &cip_status)
+          == PLCTAG_ERR_REMOTE_ERR);
+    CHECK(cip_status == NULL);
+
+    /* the Forward Close reply is checked the same way. */
+    packet_size = make_fo_reply(packet, AB_EIP_OK, NULL, 0);
+    CHECK(eip_check_forward_close_response(packet, packet_size, &cip_status) == PLCTAG_STATUS_OK);
+    packet_size = make_fo_reply(packet, 0x01, other, 1);
+    CHECK(eip_check_forward_close_response(packet, packet_size, &cip_status) == PLCTAG_ERR_REMOTE_ERR);
+}
+
+
+int main(void) {
+    test_register_session();
+    test_forward_open();
+    test_forward_open_ex();
+    test_forward_close();
+    test_forward_open_response();
+
+    return 0;
+}
@@ -0,0 +1,124 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <libplctag/lib/libplctag.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <utils/metrics.h>
+
+/* assert() is compiled out of release builds. */
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if(!(cond)) {                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                 \
+        }                                                                            \
+    } while(0)
+
+#define CHILD_OPS (1000)
+
+
+static int64_t histogram_count(metrics_p metrics) {
+    int64_t total = 0;
+
+    for(int i = 0; i < METRICS_LATENCY_BUCKETS; i++) { total += atomic_get_int64(&metrics->latency_buckets[i]); }
+
+    return total;
+}
+
+
+int main(void) {
+    struct metrics_t library;
+    struct metrics_t conn;
+    struct metrics_t tag_a;
+    struct metrics_t tag_b;
+    struct metrics_snapshot_t snapshot;
+
+    metrics_init(&library, NULL);
+    metrics_init(&conn, &library);
+    metrics_init(&tag_a, &library);
+    metrics_init(&tag_b, &library);
+
+    /* tags move under their connection once they have one. */
+    metrics_set_parent(&tag_a, &conn);
+    metrics_set_parent(&tag_b, &conn);
+
+    for(int i = 0; i < CHILD_OPS; i++) {
+        /* tag_a is fast enough to need the microsecond buckets, tag_b takes about 100ms. */
+        metrics_record_op(&tag_a, 0, PLCTAG_STATUS_OK, i % 50);
+        metrics_record_op(&tag_b, 1, (i % 10) ? PLCTAG_STATUS_OK : PLCTAG_ERR_TIMEOUT, (100 + (i % 7)) * 1000);
+    }
+
+    /* every level sees each operation exactly once. */
+    CHECK(histogram_count(&tag_a) == CHILD_OPS);
+    CHECK(histogram_count(&tag_b) == CHILD_OPS);
+    CHECK(histogram_count(&conn) == 2 * CHILD_OPS);
+    CHECK(histogram_count(&library) == 2 * CHILD_OPS);
+
+    metrics_snapshot(&conn, &snapshot);
+    CHECK(snapshot.read_count == CHILD_OPS);
+    CHECK(snapshot.write_count == CHILD_OPS);
+    CHECK(snapshot.error_count == CHILD_OPS / 10);
+    CHECK(snapshot.latency_count == 2 * CHILD_OPS);
+    CHECK(snapshot.latency_max_us == 106000);
+
+    metrics_snapshot(&library, &snapshot);
+    CHECK(snapshot.read_count == CHILD_OPS);
+    CHECK(snapshot.write_count == CHILD_OPS);
+    CHECK(snapshot.latency_count == 2 * CHILD_OPS);
+
+    /* plain latency samples also roll up once. */
+    metrics_record_latency(&tag_a, 5);
+    CHECK(histogram_count(&tag_a) == CHILD_OPS + 1);
+    CHECK(histogram_count(&conn) == (2 * CHILD_OPS) + 1);
+    CHECK(histogram_count(&library) == (2 * CHILD_OPS) + 1);
+
+    /* the percentiles come from the histogram, p50 of tag_a's 0..49us spread is about 25us. */
+    metrics_snapshot(&tag_a, &snapshot);
+    CHECK(snapshot.latency_p50_us >= 20 && snapshot.latency_p50_us <= 31);
+    CHECK(snapshot.latency_p999_us == 49);
+
+    metrics_snapshot(&tag_b, &snapshot);
+    CHECK(snapshot.latency_p50_us >= 80000 && snapshot.latency_p50_us <= 106000);
+    CHECK(snapshot.latency_p999_us == 106000);
+
+    /* the public indexes follow the snapshot layout. */
+    CHECK(METRICS_SNAPSHOT_FIELDS == PLCTAG_METRIC_MAX);
+    CHECK(offsetof(struct metrics_snapshot_t, reads_saved) == PLCTAG_METRIC_READS_SAVED * sizeof(int64_t));
+    CHECK(offsetof(struct metrics_snapshot_t, latency_p999_us) == PLCTAG_METRIC_LATENCY_P999_US * sizeof(int64_t));
+
+    printf("Metrics tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <libplctag/protocols/mb/merge.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* assert() is compiled out of release builds. */
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if(!(cond)) {                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                 \
+        }                                                                            \
+    } while(0)
+
+/*
+ * The Modbus PLC handler merges queued writes with mb_merge_writes() and
+ * picks writes to send along with reads with mb_fuse_fits().  These stand in
+ * for the queued tags so the choices can be checked without modbus_server.
+ */
+
+#define MAX_WRITES (16)
+
+/* the largest register write in one request, and the one in a read/write request. */
+#define MAX_REGISTERS (123)
+#define MAX_FUSED_REGISTERS (121)
+
+struct write_t {
+    int base;
+    int count;
+    int busy;
+    int taken; /* order in which the write was merged, from 1, zero if it was not. */
+};
+
+struct queue_t {
+    struct write_t writes[MAX_WRITES];
+    int length;
+    int num_taken;
+};
+
+
+static void queue_write(struct queue_t *queue, int base, int count, int busy) {
+    CHECK(queue->length < MAX_WRITES);
+
+    queue->writes[queue->length].base = base;
+    queue->writes[queue->length].count = count;
+    queue->writes[queue->length].busy = busy;
+    queue->writes[queue->length].taken = 0;
+    queue->length++;
+}
+
+
+static int take(void *tag, void *arg) {
+    struct write_t *write = (struct write_t *)tag;
+    struct queue_t *queue = (struct queue_t *)arg;
+
+    if(write->busy) { return 0; }
+
+    queue->num_taken++;
+    write->taken = queue->num_taken;
+
+    return 1;
+}
+
+
+/* what the PLC handler does with its ready list, the range is passed in and out. */
+static int merge(struct queue_t *queue, int *low, int *high, int max_count) {
+    struct mb_merge_candidate_t candidates[MAX_WRITES];
+    int num_candidates = 0;
+
+    for(int i = 0; i < queue->length; i++) {
+        struct write_t *write = &queue->writes[i];
+
+        if(mb_merge_in_reach(*low, *high, max_count, write->base, write->count)) {
+            candidates[num_candidates].base = write->base;
+            candidates[num_candidates].count = write->count;
+            candidates[num_candidates].tag = write;
+            num_candidates++;
+        }
+    }
+
+    return mb_merge_writes(low, high, max_count, candidates, num_candidates, take, queue);
+}
+
+
+static void test_merge_up_and_down(void) {
+    struct queue_t queue = {0};
+    int low = 105;
+    int high = 106;
+
+    /* queued out of order, the range grows up first and then down. */
+    for(int i = 9; i >= 0; i--) {
+        if(i != 5) { queue_write(&queue, 100 + i, 1, 0); }
+    }
+
+    CHECK(merge(&queue, &low, &high, MAX_REGISTERS) == 9);
+    CHECK(low == 100);
+    CHECK(high == 110);
+
+    /* registers 106 to 109 first, then 104 down to 100. */
+    for(int i = 0; i < queue.length; i++) {
+        int base = queue.writes[i].base;
+
+        CHECK(queue.writes[i].taken == (base > 105 ? base - 105 : 4 + 105 - base));
+    }
+}
+
+
+static void test_gaps_and_overlaps(void) {
+    struct queue_t queue = {0};
+    int low = 100;
+    int high = 102;
+
+    /* 101 overlaps the range, 104 is past a gap. */
+    queue_write(&queue, 104, 1, 0);
+    queue_write(&queue, 101, 2, 0);
+    queue_write(&queue, 102, 1, 0);
+    queue_write(&queue, 98, 1, 0);
+
+    CHECK(merge(&queue, &low, &high, MAX_REGISTERS) == 1);
+    CHECK(low == 100);
+    CHECK(high == 103);
+    CHECK(queue.writes[0].taken == 0);
+    CHECK(queue.writes[1].taken == 0);
+    CHECK(queue.writes[2].taken == 1);
+    CHECK(queue.writes[3].taken == 0);
+}
+
+
+static void test_size_limit(void) {
+    struct queue_t queue = {0};
+    int low = 0;
+    int high = 1;
+
+    for(int i = 1; i < 10; i++) { queue_write(&queue, i, 1, 0); }
+
+    CHECK(merge(&queue, &low, &high, 4) == 3);
+    CHECK(low == 0);
+    CHECK(high == 4);
+
+    /* a write that would take the request past the limit is left alone. */
+    queue.length = 0;
+    queue.num_taken = 0;
+    low = 0;
+    high = MAX_REGISTERS - 1;
+    queue_write(&queue, MAX_REGISTERS - 1, 2, 0);
+
+    CHECK(merge(&queue, &low, &high, MAX_REGISTERS) == 0);
+    CHECK(high == MAX_REGISTERS - 1);
+}
+
+
+static void test_busy(void) {
+    struct queue_t queue = {0};
+    int low = 100;
+    int high = 101;
+
+    /* a busy tag leaves a gap that stops the range, unless another write covers the same registers. */
+    queue_write(&queue, 101, 1, 1);
+    queue_write(&queue, 102, 1, 0);
+
+    CHECK(merge(&queue, &low, &high, MAX_REGISTERS) == 0);
+    CHECK(high == 101);
+
+    queue_write(&queue, 101, 1, 0);
+
+    CHECK(merge(&queue, &low, &high, MAX_REGISTERS) == 2);
+    CHECK(high == 103);
+    CHECK(queue.writes[0].taken == 0);
+}
+
+
+static void test_fuse(void) {
+    /* writes next to the read, on either side. */
+    CHECK(mb_fuse_fits(100, 10, 110, 5, MAX_FUSED_REGISTERS));
+    CHECK(mb_fuse_fits(100, 10, 95, 5, MAX_FUSED_REGISTERS));
+    CHECK(mb_fuse_fits(100, 10, 200, MAX_FUSED_REGISTERS, MAX_FUSED_REGISTERS));
+
+    /* the device writes before it reads, so the read must not see the write. */
+    CHECK(!mb_fuse_fits(100, 10, 96, 5, MAX_FUSED_REGISTERS));
+    CHECK(!mb_fuse_fits(100, 10, 109, 1, MAX_FUSED_REGISTERS));
+    CHECK(!mb_fuse_fits(100, 10, 102, 2, MAX_FUSED_REGISTERS));
+    CHECK(!mb_fuse_fits(100, 10, 90, 30, MAX_FUSED_REGISTERS));
+
+    /* and the write must fit in the request. */
+    CHECK(!mb_fuse_fits(200, 10, 0, MAX_FUSED_REGISTERS + 1, MAX_FUSED_REGISTERS));
+}
+
+
+static void test_coils(void) {
+    uint8_t staging[4] = {0};
+    uint8_t payload[2] = {0xFF, 0xFF};
+    uint8_t first[1] = {0x0B};  /* coils 3 to 6 of the staging area are 1, 1, 0, 1. */
+    uint8_t second[1] = {0x05}; /* coils 7 to 9 are 1, 0, 1. */
+
+    mb_copy_bits(staging, 3, first, 0, 4);
+    mb_copy_bits(staging, 7, second, 0, 3);
+
+    CHECK(staging[0] == 0xD8);
+    CHECK(staging[1] == 0x02);
+    CHECK(staging[2] == 0x00);
+
+    /* the request starts at coil 3.  The bits past the copied coils are left alone. */
+    mb_copy_bits(payload, 0, staging, 3, 7);
+
+    CHECK(payload[0] == 0xDB);
+    CHECK(payload[1] == 0xFF);
+
+    /* copied coils that are off clear their bits. */
+    mb_copy_bits(payload, 1, staging, 0, 3);
+    CHECK(payload[0] == 0xD1);
+}
+
+
+int main(void) {
+    test_merge_up_and_down();
+    test_gaps_and_overlaps();
+    test_size_limit();
+    test_busy();
+    test_fuse();
+    test_coils();
+
+    printf("Modbus merge tests passed.\n");
+
+    return 0;
+}
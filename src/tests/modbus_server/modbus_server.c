@@ -8,6 +8,10 @@
  * KRH: This server is directly cloned from the main GitHub libmodbus repo.
  *
  * Only minor changes were done to quiet clang-tidy and change the default port.
+ *
+ * The server also counts requests by function code and prints the counts when
+ * it is stopped, so tests can check which functions the library used, for
+ * instance that reads and writes were fused into 0x17 requests.
  */
 
 #include <errno.h>
@@ -37,7 +41,23 @@ static modbus_mapping_t *mb_mapping;
 
 static int server_socket = -1;
 
+/* requests seen per function code. */
+static unsigned long function_counts[256];
+
+static void print_function_counts(void) {
+    for(int fc = 0; fc < 256; fc++) {
+        if(function_counts[fc]) {
+            // NOLINTNEXTLINE
+            printf("Function 0x%02x: %lu requests\n", fc, function_counts[fc]);
+        }
+    }
+
+    fflush(stdout);
+}
+
 static void close_sigint(int dummy) {
+    print_function_counts();
+
     if(server_socket != -1) { close(server_socket); }
     modbus_free(ctx);
     modbus_mapping_free(mb_mapping);
@@ -74,6 +94,7 @@ int main(void) {
     }
 
     signal(SIGINT, close_sigint);
+    signal(SIGTERM, close_sigint);
 
     /* Clear the reference set of socket */
     FD_ZERO(&refset);
@@ -123,6 +144,8 @@ int main(void) {
                 modbus_set_socket(ctx, master_socket);
                 rc = modbus_receive(ctx, query);
                 if(rc > 0) {
+                    /* libmodbus handles 0x17 (write and read registers) along with the other functions. */
+                    function_counts[query[modbus_get_header_length(ctx)]]++;
                     modbus_reply(ctx, query, rc, mb_mapping);
                 } else if(rc == -1) {
                     /* This example server in ended on connection closing or
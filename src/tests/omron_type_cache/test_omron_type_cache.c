@@ -0,0 +1,214 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <libplctag/lib/libplctag.h>
+#include <libplctag/protocols/omron/conn.h>
+#include <libplctag/protocols/omron/tag.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utils/hash.h>
+#include <utils/hashtable.h>
+
+/* assert() is compiled out of release builds. */
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if(!(cond)) {                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                 \
+        }                                                                            \
+    } while(0)
+
+/*
+ * The Omron connection remembers the encoded type of each tag name it has
+ * read so that later tags of the same name can skip the initial read.  These
+ * drive the cache through a bare connection with no socket or thread.
+ */
+
+/* two names whose encoded forms hash to the same key. */
+#define COLLIDING_NAME_1 "Tag_078735"
+#define COLLIDING_NAME_2 "Tag_129666"
+
+
+static void set_tag(struct omron_tag_t *tag, const char *name, uint8_t type_byte, int elem_size) {
+    memset(tag, 0, sizeof(*tag));
+
+    tag->encoded_name_size = (int)strlen(name);
+    memcpy(tag->encoded_name, name, (size_t)tag->encoded_name_size);
+
+    tag->encoded_type_info[0] = type_byte;
+    tag->encoded_type_info[1] = 0;
+    tag->encoded_type_info_size = 2;
+    tag->elem_size = elem_size;
+}
+
+
+/* look the name up and return the cached type byte, or zero if it is not cached. */
+static int lookup(omron_conn_p conn, const char *name, int *elem_size) {
+    struct omron_tag_t tag;
+
+    set_tag(&tag, name, 0, 0);
+    tag.encoded_type_info_size = 0;
+
+    if(conn_get_cached_type(conn, &tag) != PLCTAG_STATUS_OK) { return 0; }
+
+    CHECK(tag.encoded_type_info_size == 2);
+
+    if(elem_size) { *elem_size = tag.elem_size; }
+
+    return tag.encoded_type_info[0];
+}
+
+
+static void cache(omron_conn_p conn, const char *name, uint8_t type_byte, int elem_size) {
+    struct omron_tag_t tag;
+
+    set_tag(&tag, name, type_byte, elem_size);
+    CHECK(conn_cache_type(conn, &tag) == PLCTAG_STATUS_OK);
+}
+
+
+static void uncache(omron_conn_p conn, const char *name, int expected_rc) {
+    struct omron_tag_t tag;
+
+    set_tag(&tag, name, 0, 0);
+    CHECK(conn_uncache_type(conn, &tag) == expected_rc);
+}
+
+
+static void test_basic(omron_conn_p conn) {
+    struct omron_tag_t tag;
+    int elem_size = 0;
+
+    CHECK(lookup(conn, "MyDint", NULL) == 0);
+
+    cache(conn, "MyDint", 0xC4, 4);
+    CHECK(lookup(conn, "MyDint", &elem_size) == 0xC4);
+    CHECK(elem_size == 4);
+
+    /* a later read with a new type replaces it. */
+    cache(conn, "MyDint", 0xC8, 8);
+    CHECK(lookup(conn, "MyDint", &elem_size) == 0xC8);
+    CHECK(elem_size == 8);
+    CHECK(conn->num_types == 1);
+
+    /* a tag without a complete type is not cached. */
+    set_tag(&tag, "NoType", 0xC4, 0);
+    CHECK(conn_cache_type(conn, &tag) == PLCTAG_STATUS_OK);
+    CHECK(lookup(conn, "NoType", NULL) == 0);
+
+    uncache(conn, "MyDint", PLCTAG_STATUS_OK);
+    CHECK(lookup(conn, "MyDint", NULL) == 0);
+    uncache(conn, "MyDint", PLCTAG_ERR_NOT_FOUND);
+    CHECK(conn->num_types == 0);
+}
+
+
+static void test_collision(omron_conn_p conn) {
+    struct omron_tag_t tag1;
+    struct omron_tag_t tag2;
+
+    /* make sure the names really collide. */
+    set_tag(&tag1, COLLIDING_NAME_1, 0, 0);
+    set_tag(&tag2, COLLIDING_NAME_2, 0, 0);
+    CHECK(hash(tag1.encoded_name, (size_t)tag1.encoded_name_size, 0)
+          == hash(tag2.encoded_name, (size_t)tag2.encoded_name_size, 0));
+
+    /* the second name must not push out the first. */
+    cache(conn, COLLIDING_NAME_1, 0xC3, 2);
+    cache(conn, COLLIDING_NAME_2, 0xC4, 4);
+    CHECK(lookup(conn, COLLIDING_NAME_1, NULL) == 0xC3);
+    CHECK(lookup(conn, COLLIDING_NAME_2, NULL) == 0xC4);
+    CHECK(conn->num_types == 2);
+
+    /* removing the older one keeps the newer one, which is first in the chain. */
+    uncache(conn, COLLIDING_NAME_1, PLCTAG_STATUS_OK);
+    CHECK(lookup(conn, COLLIDING_NAME_1, NULL) == 0);
+    CHECK(lookup(conn, COLLIDING_NAME_2, NULL) == 0xC4);
+
+    /* and the other way around. */
+    cache(conn, COLLIDING_NAME_1, 0xC3, 2);
+    uncache(conn, COLLIDING_NAME_1, PLCTAG_STATUS_OK);
+    CHECK(lookup(conn, COLLIDING_NAME_2, NULL) == 0xC4);
+    cache(conn, COLLIDING_NAME_1, 0xC3, 2);
+    uncache(conn, COLLIDING_NAME_2, PLCTAG_STATUS_OK);
+    CHECK(lookup(conn, COLLIDING_NAME_1, NULL) == 0xC3);
+    CHECK(lookup(conn, COLLIDING_NAME_2, NULL) == 0);
+
+    uncache(conn, COLLIDING_NAME_1, PLCTAG_STATUS_OK);
+    CHECK(conn->num_types == 0);
+}
+
+
+static void test_eviction(omron_conn_p conn) {
+    char name[32];
+
+    for(int i = 0; i < CONN_MAX_TYPE_CACHE; i++) {
+        snprintf(name, sizeof(name), "Fill_%d", i);
+        cache(conn, name, 0xC4, 4);
+    }
+
+    CHECK(conn->num_types == CONN_MAX_TYPE_CACHE);
+
+    /* using the oldest name makes it the newest. */
+    CHECK(lookup(conn, "Fill_0", NULL) == 0xC4);
+
+    /* the cache keeps learning, dropping the least recently used names. */
+    cache(conn, "Late_0", 0xCA, 4);
+    cache(conn, "Late_1", 0xCA, 4);
+
+    CHECK(conn->num_types == CONN_MAX_TYPE_CACHE);
+    CHECK(lookup(conn, "Late_0", NULL) == 0xCA);
+    CHECK(lookup(conn, "Late_1", NULL) == 0xCA);
+    CHECK(lookup(conn, "Fill_0", NULL) == 0xC4);
+    CHECK(lookup(conn, "Fill_1", NULL) == 0);
+    CHECK(lookup(conn, "Fill_2", NULL) == 0);
+    CHECK(lookup(conn, "Fill_3", NULL) == 0xC4);
+}
+
+
+int main(void) {
+    omron_conn_p conn = mem_alloc((int)sizeof(*conn));
+
+    CHECK(conn);
+    CHECK(mutex_create(&conn->mutex) == PLCTAG_STATUS_OK);
+    conn->type_cache = hashtable_create(CONN_MIN_TYPE_CACHE);
+    CHECK(conn->type_cache);
+
+    test_basic(conn);
+    test_collision(conn);
+    test_eviction(conn);
+
+    return 0;
+}
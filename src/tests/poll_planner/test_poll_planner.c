@@ -0,0 +1,117 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <utils/poll_planner.h>
+
+/* assert() is compiled out of release builds. */
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if(!(cond)) {                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                 \
+        }                                                                            \
+    } while(0)
+
+#define CHURN_ROUNDS (1000)
+
+
+static int64_t phase(int64_t when, int64_t period) { return ((when % period) + period) % period; }
+
+
+int main(void) {
+    struct poll_planner_t planner;
+    uint32_t slow_id = 0;
+    uint32_t odd_id = 0;
+    uint32_t fast_id = 0;
+    uint32_t ids[POLL_PLANNER_MAX_FAMILIES * 2];
+    int64_t slow_read = 0;
+    int64_t odd_read = 0;
+    int64_t fast_read = 0;
+
+    poll_planner_init(&planner);
+
+    /* 300ms and 500ms do not divide each other, so they get separate families. */
+    slow_read = poll_planner_first_read(&planner, 300, &slow_id);
+    odd_read = poll_planner_first_read(&planner, 500, &odd_id);
+    CHECK(slow_id != 0 && odd_id != 0 && slow_id != odd_id);
+    CHECK(planner.num_families == 2);
+
+    /* 100ms fits both, so both families end up on one phase. */
+    fast_read = poll_planner_first_read(&planner, 100, &fast_id);
+    CHECK(fast_id == slow_id);
+    CHECK(planner.num_families == 2);
+    CHECK(phase(fast_read, 100) == phase(slow_read, 100));
+
+    /* the 500ms tag moves onto the shared phase the next time it schedules a read. */
+    odd_read = poll_planner_align(&planner, odd_id, odd_read + 500);
+    CHECK(phase(odd_read, 100) == phase(slow_read, 100));
+    CHECK(poll_planner_align(&planner, odd_id, odd_read) == odd_read);
+
+    /* families go away with their last tag. */
+    poll_planner_leave(&planner, odd_id);
+    CHECK(planner.num_families == 1);
+    poll_planner_leave(&planner, fast_id);
+    CHECK(planner.num_families == 1);
+    poll_planner_leave(&planner, slow_id);
+    CHECK(planner.num_families == 0);
+
+    /* a family that is gone leaves reads alone. */
+    CHECK(poll_planner_align(&planner, odd_id, 12345) == 12345);
+
+    /* tags coming and going must not fill the table. */
+    for(int round = 0; round < CHURN_ROUNDS; round++) {
+        int count = (round % (POLL_PLANNER_MAX_FAMILIES * 2)) + 1;
+
+        for(int i = 0; i < count; i++) { poll_planner_first_read(&planner, 101 + (7 * ((round + i) % 37)), &ids[i]); }
+
+        CHECK(planner.num_families <= POLL_PLANNER_MAX_FAMILIES);
+
+        for(int i = 0; i < count; i++) { poll_planner_leave(&planner, ids[i]); }
+
+        CHECK(planner.num_families == 0);
+    }
+
+    /* with the table full, new periods still get a family to leave. */
+    for(int i = 0; i < POLL_PLANNER_MAX_FAMILIES + 1; i++) { poll_planner_first_read(&planner, 1009 + (i * 2), &ids[i]); }
+    CHECK(planner.num_families == POLL_PLANNER_MAX_FAMILIES);
+    CHECK(ids[POLL_PLANNER_MAX_FAMILIES] == ids[0]);
+    for(int i = 0; i < POLL_PLANNER_MAX_FAMILIES + 1; i++) { poll_planner_leave(&planner, ids[i]); }
+    CHECK(planner.num_families == 0);
+
+    printf("Poll planner tests passed.\n");
+
+    return 0;
+}
@@ -0,0 +1,195 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <libplctag/lib/libplctag.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <utils/process_image.h>
+#include <utils/rc.h>
+
+#if PROCESS_IMAGE_SUPPORTED
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <unistd.h>
+#endif
+
+/* assert() is compiled out of release builds. */
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if(!(cond)) {                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                 \
+        }                                                                            \
+    } while(0)
+
+#define IMAGE_SIZE (64 * 1024)
+#define IMAGE_ENTRIES (8)
+#define DATA_SIZE (256)
+#define PUBLISH_ROUNDS (20000)
+
+
+#if PROCESS_IMAGE_SUPPORTED
+
+static process_image_slot_p slot = NULL;
+static volatile int writer_done = 0;
+
+
+static THREAD_FUNC(writer) {
+    uint8_t data[DATA_SIZE];
+
+    (void)arg;
+
+    for(int round = 1; round <= PUBLISH_ROUNDS; round++) {
+        for(int i = 0; i < DATA_SIZE; i++) { data[i] = (uint8_t)round; }
+
+        process_image_publish(slot, 42, data, DATA_SIZE, PLCTAG_STATUS_OK);
+    }
+
+    writer_done = 1;
+
+    THREAD_RETURN(0);
+}
+
+
+/* read the entry the way a consumer in another process would. */
+static int read_entry(struct process_image_entry_t *entry, uint8_t *base, uint8_t *data, uint32_t *size, int32_t *tag_id) {
+    int32_t seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+
+    if(seq & 1) { return 0; }
+
+    *size = entry->data_size;
+    *tag_id = entry->tag_id;
+    if(*size > DATA_SIZE) { *size = DATA_SIZE; }
+    mem_copy(data, base + entry->data_offset, (int)*size);
+
+    atomic_thread_fence(memory_order_acquire);
+
+    return atomic_load_explicit(&entry->seq, memory_order_relaxed) == seq;
+}
+
+
+int main(void) {
+    char name[64];
+    int fd = -1;
+    uint8_t *base = NULL;
+    struct process_image_header_t *header = NULL;
+    struct process_image_entry_t *entry = NULL;
+    thread_p writer_thread = NULL;
+    uint8_t data[DATA_SIZE];
+    uint32_t size = 0;
+    int32_t tag_id = 0;
+    int good_reads = 0;
+
+    CHECK(process_image_supported() == PLCTAG_STATUS_OK);
+    CHECK(process_image_init() == PLCTAG_STATUS_OK);
+
+    snprintf(name, sizeof(name), "/plctag_test_image_%d", (int)getpid());
+
+    /* too small for the directory. */
+    CHECK(process_image_slot_create(name, 64, IMAGE_ENTRIES, "small") == NULL);
+
+    slot = process_image_slot_create(name, IMAGE_SIZE, IMAGE_ENTRIES, "TestTag");
+    CHECK(slot != NULL);
+
+    /* map it separately, as a consumer would. */
+    fd = shm_open(name, O_RDONLY, 0);
+    CHECK(fd >= 0);
+    base = (uint8_t *)mmap(NULL, IMAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    CHECK(base != MAP_FAILED);
+    close(fd);
+
+    header = (struct process_image_header_t *)(void *)base;
+    CHECK(header->magic == PROCESS_IMAGE_MAGIC);
+    CHECK(header->version == PROCESS_IMAGE_VERSION);
+    CHECK(header->max_entries == IMAGE_ENTRIES);
+    CHECK(atomic_load(&header->is_open) == 1);
+
+    /* no entry until the first good publish. */
+    process_image_publish(slot, 42, NULL, 0, PLCTAG_ERR_TIMEOUT);
+    CHECK(atomic_load(&header->entry_count) == 0);
+
+    CHECK(thread_create(&writer_thread, writer, 32 * 1024, NULL) == PLCTAG_STATUS_OK);
+
+    while(atomic_load(&header->entry_count) == 0) { sleep_ms(1); }
+
+    entry = (struct process_image_entry_t *)(void *)(base + header->header_size);
+    CHECK(str_cmp(entry->name, "TestTag") == 0);
+
+    /* every consistent copy must be one whole round. */
+    while(!writer_done || good_reads == 0) {
+        if(read_entry(entry, base, data, &size, &tag_id)) {
+            CHECK(size == DATA_SIZE);
+            CHECK(tag_id == 42);
+
+            for(int i = 1; i < DATA_SIZE; i++) { CHECK(data[i] == data[0]); }
+
+            good_reads++;
+        }
+    }
+
+    thread_join(writer_thread);
+    thread_destroy(&writer_thread);
+
+    CHECK(read_entry(entry, base, data, &size, &tag_id));
+    CHECK(data[0] == (uint8_t)PUBLISH_ROUNDS);
+    CHECK((atomic_load(&entry->seq) & 1) == 0);
+
+    /* the last tag going away clears the entry, closes the image and removes the name. */
+    rc_dec(slot);
+    CHECK(entry->tag_id == 0);
+    CHECK(atomic_load(&header->is_open) == 0);
+    CHECK(shm_open(name, O_RDONLY, 0) < 0);
+
+    munmap(base, IMAGE_SIZE);
+
+    process_image_teardown();
+
+    fprintf(stderr, "process_image: %d consistent reads.\n", good_reads);
+
+    return 0;
+}
+
+#else
+
+int main(void) {
+    /* tags that ask for an image must fail with a clear error. */
+    CHECK(process_image_supported() == PLCTAG_ERR_UNSUPPORTED);
+    CHECK(process_image_init() == PLCTAG_STATUS_OK);
+    CHECK(process_image_slot_create("test_image", IMAGE_SIZE, IMAGE_ENTRIES, "TestTag") == NULL);
+    process_image_teardown();
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,268 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <libplctag/lib/libplctag.h>
+#include <libplctag/protocols/eip/transport.h>
+#include <platform.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* assert() is compiled out of release builds. */
+#define CHECK(cond)                                                                  \
+    do {                                                                             \
+        if(!(cond)) {                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                 \
+        }                                                                            \
+    } while(0)
+
+/*
+ * The AB session and the Omron connection both fill in the request info the
+ * same way and hand it to eip_select_requests().  This builds real packets so
+ * the sizes come from eip_get_request_info() as they do in the sessions.
+ */
+
+#define MAX_QUEUE (16)
+#define MAX_PACKET (1024)
+
+/* a 504 byte connection, less the Multiple Service request and reply headers. */
+#define REQUEST_SPACE (504 - 8)
+#define RESPONSE_SPACE (504 - 6)
+
+#define ENCAP_CONNECTED_SEND (0x70)
+#define ENCAP_UNCONNECTED_SEND (0x6F)
+#define CO_CDI_LENGTH (42)
+#define CO_CIP (46)
+#define UC_UDI_LENGTH (38)
+#define UC_CIP (40)
+
+struct queue_t {
+    struct eip_request_info_t info[MAX_QUEUE];
+    int id[MAX_QUEUE];
+    int length;
+};
+
+
+static void set_u16(uint8_t *data, int offset, int val) {
+    data[offset] = (uint8_t)(val & 0xFF);
+    data[offset + 1] = (uint8_t)((val >> 8) & 0xFF);
+}
+
+
+/* queue a request with a CIP body of body_size bytes and a reply of response_size bytes. */
+static void add(struct queue_t *queue, int id, int connected, int body_size, int response_size, int is_read,
+                int allow_packing) {
+    uint8_t packet[MAX_PACKET] = {0};
+    struct eip_request_info_t *info = &queue->info[queue->length];
+    int packet_size = 0;
+
+    if(connected) {
+        set_u16(packet, 0, ENCAP_CONNECTED_SEND);
+        set_u16(packet, CO_CDI_LENGTH, body_size + 2);
+        packet[CO_CIP] = 0x4C;
+        packet_size = CO_CIP + body_size;
+    } else {
+        set_u16(packet, 0, ENCAP_UNCONNECTED_SEND);
+        set_u16(packet, UC_UDI_LENGTH, body_size);
+        packet[UC_CIP] = 0x4C;
+        packet_size = UC_CIP + body_size;
+    }
+
+    CHECK(eip_get_request_info(packet, packet_size, info) == PLCTAG_STATUS_OK);
+    CHECK(info->payload_size == body_size + 2);
+
+    /* what the sessions fill in, the reply size includes its offset entry. */
+    info->allow_packing = allow_packing;
+    info->is_read = is_read;
+    info->response_size = response_size + 2;
+
+    queue->id[queue->length] = id;
+    queue->length++;
+}
+
+
+/* select the next packet, take it off the queue and return the IDs in packet order. */
+static int take(struct queue_t *queue, int *ids) {
+    uint8_t selected[MAX_QUEUE];
+    int num_selected = eip_select_requests(queue->info, queue->length, REQUEST_SPACE, RESPONSE_SPACE, selected);
+    int count = 0;
+    int kept = 0;
+
+    for(int i = 0; i < queue->length; i++) {
+        if(selected[i]) {
+            ids[count++] = queue->id[i];
+        } else {
+            queue->info[kept] = queue->info[i];
+            queue->id[kept] = queue->id[i];
+            kept++;
+        }
+    }
+
+    CHECK(count == num_selected);
+
+    queue->length = kept;
+
+    return count;
+}
+
+
+static void test_oversized_head(void) {
+    struct queue_t queue = {0};
+    int ids[MAX_QUEUE];
+
+    /* a head bigger than the packet still goes, alone. */
+    add(&queue, 1, 1, 600, 10, 1, 1);
+    add(&queue, 2, 1, 20, 10, 1, 1);
+    add(&queue, 3, 1, 20, 10, 0, 1);
+
+    CHECK(take(&queue, ids) == 1);
+    CHECK(ids[0] == 1);
+
+    /* the rest go together next time. */
+    CHECK(take(&queue, ids) == 2);
+    CHECK(ids[0] == 2 && ids[1] == 3);
+
+    /* a head whose reply fills the packet also goes alone. */
+    add(&queue, 4, 1, 20, 600, 1, 1);
+    add(&queue, 5, 1, 20, 10, 1, 1);
+
+    CHECK(take(&queue, ids) == 1);
+    CHECK(ids[0] == 4);
+    CHECK(take(&queue, ids) == 1);
+    CHECK(ids[0] == 5);
+}
+
+
+static void test_unpackable_head(void) {
+    struct queue_t queue = {0};
+    int ids[MAX_QUEUE];
+
+    /* allow_packing=0 at the head means nothing rides along. */
+    add(&queue, 1, 1, 20, 10, 1, 0);
+    add(&queue, 2, 1, 20, 10, 1, 1);
+    add(&queue, 3, 1, 20, 10, 1, 1);
+
+    CHECK(take(&queue, ids) == 1);
+    CHECK(ids[0] == 1);
+
+    /* one in the middle of the reads is left for later, the write behind the reads still goes. */
+    add(&queue, 4, 1, 20, 10, 1, 0);
+    add(&queue, 5, 1, 20, 10, 1, 1);
+    add(&queue, 6, 1, 20, 10, 0, 1);
+
+    CHECK(take(&queue, ids) == 4);
+    CHECK(ids[0] == 2 && ids[1] == 3 && ids[2] == 5 && ids[3] == 6);
+    CHECK(take(&queue, ids) == 1);
+    CHECK(ids[0] == 4);
+
+    /* requests sent a different way do not share a packet. */
+    add(&queue, 7, 1, 20, 10, 1, 1);
+    add(&queue, 8, 0, 20, 10, 1, 1);
+    add(&queue, 9, 1, 20, 10, 1, 1);
+
+    CHECK(take(&queue, ids) == 2);
+    CHECK(ids[0] == 7 && ids[1] == 9);
+}
+
+
+static void test_mixed_reads_and_writes(void) {
+    struct queue_t queue = {0};
+    int ids[MAX_QUEUE];
+
+    /* a large read in a run of small reads waits, the write and read behind them do not. */
+    add(&queue, 1, 1, 20, 10, 1, 1);
+    add(&queue, 2, 1, 20, 450, 1, 1);
+    for(int i = 3; i <= 7; i++) { add(&queue, i, 1, 20, 10, 1, 1); }
+    add(&queue, 8, 1, 30, 4, 0, 1);
+    add(&queue, 9, 1, 20, 10, 1, 1);
+
+    CHECK(take(&queue, ids) == 8);
+    CHECK(ids[0] == 1);
+    for(int i = 1; i < 8; i++) { CHECK(ids[i] == i + 2); }
+
+    CHECK(take(&queue, ids) == 1);
+    CHECK(ids[0] == 2);
+    CHECK(queue.length == 0);
+
+    /* a large read behind a write is left for later too, small requests after it still go. */
+    add(&queue, 20, 1, 30, 4, 0, 1);
+    add(&queue, 21, 1, 20, 500, 1, 1);
+    add(&queue, 22, 1, 30, 4, 0, 1);
+    add(&queue, 23, 1, 20, 10, 1, 1);
+
+    CHECK(take(&queue, ids) == 3);
+    CHECK(ids[0] == 20 && ids[1] == 22 && ids[2] == 23);
+    CHECK(take(&queue, ids) == 1);
+    CHECK(ids[0] == 21);
+
+    /* a write head keeps its place ahead of the reads packed with it. */
+    add(&queue, 10, 1, 30, 4, 0, 1);
+    add(&queue, 11, 1, 20, 100, 1, 1);
+    add(&queue, 12, 1, 20, 10, 1, 1);
+
+    CHECK(take(&queue, ids) == 3);
+    CHECK(ids[0] == 10 && ids[1] == 11 && ids[2] == 12);
+
+    /* a write that does not fit stops the packet, the read behind it is not pulled ahead. */
+    add(&queue, 13, 1, 20, 10, 1, 1);
+    add(&queue, 14, 1, 480, 4, 0, 1);
+    add(&queue, 15, 1, 20, 10, 1, 1);
+
+    CHECK(take(&queue, ids) == 1);
+    CHECK(ids[0] == 13);
+    CHECK(take(&queue, ids) == 1);
+    CHECK(ids[0] == 14);
+    CHECK(take(&queue, ids) == 1);
+    CHECK(ids[0] == 15);
+
+    /* reads whose replies add up past the reply space are split across packets. */
+    for(int i = 16; i <= 19; i++) { add(&queue, i, 1, 20, 150, 1, 1); }
+
+    CHECK(take(&queue, ids) == 3);
+    CHECK(take(&queue, ids) == 1);
+    CHECK(ids[0] == 19);
+}
+
+
+int main(void) {
+    struct queue_t queue = {0};
+    uint8_t selected[1];
+
+    CHECK(eip_select_requests(queue.info, 0, REQUEST_SPACE, RESPONSE_SPACE, selected) == 0);
+
+    test_oversized_head();
+    test_unpackable_head();
+    test_mixed_reads_and_writes();
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+#!/bin/bash
+
+# Run the benchmark matrix against the bundled simulators.
+#
+# Usage: run_benchmarks.sh <directory with executables> [results file]
+#
+# Each benchmark run appends one JSON object per line to the results file
+# so that results from different builds can be compared.
+
+TEST_DIR=$1
+RESULTS=${2:-benchmark_results.jsonl}
+DURATION=${BENCH_DURATION_MS:-5000}
+WARMUP=${BENCH_WARMUP_MS:-1000}
+
+RUNS=0
+FAILURES=0
+
+if [[ ! -d $TEST_DIR ]]; then
+    echo "$TEST_DIR is not a valid path for test executables!"
+    exit 1
+fi
+
+for EXECUTABLE in ab_server benchmark
+do
+    if [[ ! -e "$TEST_DIR/$EXECUTABLE" ]]; then
+        echo "$TEST_DIR/$EXECUTABLE not found!"
+        exit 1
+    fi
+done
+
+run_bench() {
+    local LABEL=$1
+    shift
+
+    let RUNS++
+    echo -n "Benchmark $RUNS: $LABEL... "
+    $TEST_DIR/benchmark "--label=$LABEL" "--duration=$DURATION" "--warmup=$WARMUP" "$@" >> "$RESULTS" 2> "${RUNS}_${LABEL}.log"
+    if [ $? != 0 ]; then
+        echo "FAILURE"
+        let FAILURES++
+    else
+        echo "OK"
+    fi
+}
+
+
+echo "Starting AB emulator for ControlLogix benchmarks."
+$TEST_DIR/ab_server --plc=ControlLogix --path=1,0 --event_loop "--tag=BenchArray:DINT[100000]" > logix_bench_emulator.log 2>&1 &
+EMULATOR_PID=$!
+
+sleep 1
+
+run_bench ab_1tag --protocol=ab --tags=1
+run_bench ab_100tags_1thread --protocol=ab --tags=100
+run_bench ab_100tags_4threads --protocol=ab --tags=100 --threads=4
+run_bench ab_100tags_4groups --protocol=ab --tags=100 --threads=4 --groups=4
+run_bench ab_100tags_batch --protocol=ab --tags=100 --threads=4 --mode=batch
+run_bench ab_1000tags_batch_poll100 --protocol=ab --tags=1000 --threads=4 --mode=batch --poll=100
+run_bench ab_big_tags --protocol=ab --tags=10 --elems=1000
+run_bench ab_mixed_rw --protocol=ab --tags=100 --threads=4 --write-every=4
+
+echo "Killing AB emulator."
+kill $EMULATOR_PID > /dev/null 2>&1
+wait $EMULATOR_PID 2> /dev/null
+
+
+echo "Starting AB emulator for Omron benchmarks."
+$TEST_DIR/ab_server --plc=Omron --event_loop "--tag=BenchArray:DINT[100000]" > omron_bench_emulator.log 2>&1 &
+EMULATOR_PID=$!
+
+sleep 1
+
+run_bench omron_1tag --protocol=ab --plc=omron-njnx --path=18,127.0.0.1 --tags=1
+run_bench omron_100tags_4threads --protocol=ab --plc=omron-njnx --path=18,127.0.0.1 --tags=100 --threads=4
+run_bench omron_100tags_batch --protocol=ab --plc=omron-njnx --path=18,127.0.0.1 --tags=100 --threads=4 --mode=batch
+run_bench omron_100tags_batch_packed --protocol=ab --plc=omron-njnx --path=18,127.0.0.1 --tags=100 --threads=4 --mode=batch --packing=1
+run_bench omron_big_tags --protocol=ab --plc=omron-njnx --path=18,127.0.0.1 --tags=10 --elems=100
+run_bench omron_mixed_rw --protocol=ab --plc=omron-njnx --path=18,127.0.0.1 --tags=100 --threads=4 --write-every=4
+
+echo "Killing Omron emulator."
+kill $EMULATOR_PID > /dev/null 2>&1
+wait $EMULATOR_PID 2> /dev/null
+
+
+if [[ -e "$TEST_DIR/modbus_server" ]]; then
+    echo "Starting Modbus emulator for benchmarks."
+    $TEST_DIR/modbus_server > modbus_bench_emulator.log 2>&1 &
+    EMULATOR_PID=$!
+
+    sleep 1
+
+    run_bench mb_1tag --protocol=modbus --tags=1
+    run_bench mb_100tags_1thread --protocol=modbus --tags=100
+    run_bench mb_100tags_4threads --protocol=modbus --tags=100 --threads=4
+    run_bench mb_100tags_batch --protocol=modbus --tags=100 --threads=4 --mode=batch
+    run_bench mb_100tags_batch_inflight16 --protocol=modbus --tags=100 --threads=4 --mode=batch --inflight=16
+    run_bench mb_big_tags --protocol=modbus --tags=10 --elems=100
+    run_bench mb_mixed_rw --protocol=modbus --tags=100 --threads=4 --write-every=4
+    run_bench mb_mixed_rw_fused --protocol=modbus --tags=100 --threads=4 --mode=batch --write-every=2 --fuse=1
+
+    echo "Killing Modbus emulator."
+    kill $EMULATOR_PID > /dev/null 2>&1
+    wait $EMULATOR_PID 2> /dev/null
+else
+    echo "No modbus_server found, skipping Modbus benchmarks."
+fi
+
+
+if [[ -e "$TEST_DIR/accessor_bench" ]]; then
+    for LEVEL in 0 4
+    do
+        let RUNS++
+        echo -n "Benchmark $RUNS: accessors_debug_$LEVEL... "
+        $TEST_DIR/accessor_bench "--label=accessors_debug_$LEVEL" "--debug=$LEVEL" >> "$RESULTS" 2> "${RUNS}_accessors_debug_$LEVEL.log"
+        if [ $? != 0 ]; then
+            echo "FAILURE"
+            let FAILURES++
+        else
+            echo "OK"
+        fi
+    done
+fi
+
+
+echo "$RUNS benchmarks run with $FAILURES failures.  Results in $RESULTS."
+
+if [ $FAILURES != 0 ]; then
+    exit 1
+fi
+
+exit 0
@@ -21,7 +21,7 @@ if [[ ! -d $TEST_DIR ]]; then
 fi
 
 # test for the executables.
-EXECUTABLES="ab_server list_tags_logix string_non_standard_udt string_standard tag_rw2 test_auto_sync test_callback test_callback_ex test_callback_ex_logix test_callback_ex_modbus test_raw_cip test_reconnect_after_outage test_shutdown test_special test_string test_tag_attributes test_tag_type_attribute thread_stress"
+EXECUTABLES="ab_server list_tags_logix string_non_standard_udt string_standard tag_rw2 test_auto_sync test_callback test_callback_ex test_callback_ex_logix test_callback_ex_modbus test_modbus_batching test_omron_cached_type test_omron_pipelined test_omron_tag_table test_parent_read test_pipelined_writes test_raw_cip test_reconnect_after_outage test_shutdown test_snapshot_reads test_special test_string test_tag_attributes test_tag_type_attribute thread_stress"
 # echo -n "  Checking for executables..."
 for EXECUTABLE in $EXECUTABLES
 do
@@ -91,6 +91,42 @@ else
 fi
 
 
+let TEST++
+echo -n "Test $TEST: array parent reads... "
+$VALGRIND$TEST_DIR/test_parent_read > "${TEST}_parent_read_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+
+let TEST++
+echo -n "Test $TEST: pipelined fragmented writes... "
+$VALGRIND$TEST_DIR/test_pipelined_writes > "${TEST}_pipelined_writes_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+
+let TEST++
+echo -n "Test $TEST: snapshot reads from several threads... "
+$VALGRIND$TEST_DIR/test_snapshot_reads > "${TEST}_snapshot_reads_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+
 let TEST++
 echo -n "Test $TEST: indexed tags ... "
 $VALGRIND$TEST_DIR/test_indexed_tags > "${TEST}_test_indexed_tags.log" 2>&1
@@ -212,7 +248,7 @@ killall -TERM ab_server > /dev/null 2>&1
 
 
 echo "Starting AB emulator for Omron tests."
-$TEST_DIR/ab_server --debug --plc=Omron --tag=TestDINTArray:DINT[10] > omron_emulator.log 2>&1 &
+$TEST_DIR/ab_server --debug --plc=Omron --tag=TestDINTArray:DINT[10] --tag=TestINTArray:INT[5] > omron_emulator.log 2>&1 &
 EMULATOR_PID=$!
 if [ $? != 0 ]; then
     # echo "FAILURE"
@@ -236,10 +272,123 @@ else
     let SUCCESSES++
 fi
 
+let TEST++
+echo -n "Test $TEST: Omron tag type cache... "
+$VALGRIND$TEST_DIR/test_omron_cached_type > "${TEST}_omron_cached_type_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+let TEST++
+echo -n "Test $TEST: pipelined Omron requests... "
+$VALGRIND$TEST_DIR/test_omron_pipelined > "${TEST}_omron_pipelined_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
+let TEST++
+echo -n "Test $TEST: Omron variable table... "
+$VALGRIND$TEST_DIR/test_omron_tag_table > "${TEST}_omron_tag_table_test.log" 2>&1
+if [ $? != 0 ]; then
+    echo "FAILURE"
+    let FAILURES++
+else
+    echo "OK"
+    let SUCCESSES++
+fi
+
 echo "Killing Omron emulator."
 killall -TERM ab_server > /dev/null 2>&1
 
 
+# modbus_server needs libmodbus, so it is only there when BUILD_MODBUS_EMULATOR is set.
+if [[ -e "$TEST_DIR/modbus_server" ]]; then
+    # requests the server saw for a function code, it prints them when stopped.
+    function_count() {
+        local COUNT
+        COUNT=$(grep "^Function $2:" "$1" | awk '{ print $3 }')
+        echo "${COUNT:-0}"
+    }
+
+    # start a fresh server so that the counts only cover one test.
+    start_modbus_server() {
+        $TEST_DIR/modbus_server > "$1" 2>&1 &
+        EMULATOR_PID=$!
+        sleep 1
+    }
+
+    stop_modbus_server() {
+        kill -TERM $EMULATOR_PID > /dev/null 2>&1
+        wait $EMULATOR_PID 2> /dev/null
+    }
+
+    let TEST++
+    echo -n "Test $TEST: Modbus write coalescing and batched reads... "
+    start_modbus_server "${TEST}_modbus_coalesce_emulator.log"
+    $VALGRIND$TEST_DIR/test_modbus_batching coalesce > "${TEST}_modbus_coalesce_test.log" 2>&1
+    RC=$?
+    stop_modbus_server
+    # 20 rounds of writes to 10 registers each, one request per write without coalescing.
+    WRITES=$(function_count "${TEST}_modbus_coalesce_emulator.log" 0x10)
+    if [ $RC != 0 ] || [ $WRITES -ge 200 ]; then
+        echo "FAILURE ($WRITES write requests)"
+        let FAILURES++
+    else
+        echo "OK"
+        let SUCCESSES++
+    fi
+
+    let TEST++
+    echo -n "Test $TEST: Modbus read/write fusion... "
+    start_modbus_server "${TEST}_modbus_fuse_emulator.log"
+    $VALGRIND$TEST_DIR/test_modbus_batching fuse > "${TEST}_modbus_fuse_test.log" 2>&1
+    RC=$?
+    stop_modbus_server
+    FUSED=$(function_count "${TEST}_modbus_fuse_emulator.log" 0x17)
+    if [ $RC != 0 ] || [ $FUSED == 0 ]; then
+        echo "FAILURE ($FUSED read/write requests)"
+        let FAILURES++
+    else
+        echo "OK"
+        let SUCCESSES++
+    fi
+
+    let TEST++
+    echo -n "Test $TEST: Modbus automatic reads across a server restart... "
+    start_modbus_server "${TEST}_modbus_reconnect_emulator_0.log"
+    $VALGRIND$TEST_DIR/test_modbus_batching reconnect > "${TEST}_modbus_reconnect_test.log" 2>&1 &
+    TEST_PID=$!
+    # restart without a pause so that the library can connect again at once.
+    for RESTART in 1 2 3
+    do
+        sleep 1
+        stop_modbus_server
+        $TEST_DIR/modbus_server > "${TEST}_modbus_reconnect_emulator_$RESTART.log" 2>&1 &
+        EMULATOR_PID=$!
+    done
+    wait $TEST_PID
+    RC=$?
+    stop_modbus_server
+    if [ $RC != 0 ]; then
+        echo "FAILURE"
+        let FAILURES++
+    else
+        echo "OK"
+        let SUCCESSES++
+    fi
+else
+    echo "No modbus_server found, skipping Modbus tests."
+fi
+
+
 echo ""
 echo "$TEST tests."
 echo "$SUCCESSES successes."
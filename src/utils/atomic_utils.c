@@ -126,6 +126,22 @@ int64_t atomic_compare_and_set_int64(atomic_int64_t *a, int64_t old_val, int64_t
 #    endif
 }
 
+void atomic_fence_acquire(void) {
+#    ifdef _WIN32
+    MemoryBarrier();
+#    else
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+#    endif
+}
+
+void atomic_fence_release(void) {
+#    ifdef _WIN32
+    MemoryBarrier();
+#    else
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+#    endif
+}
+
 #else
 
 #    include <stdatomic.h>
@@ -164,4 +180,8 @@ int64_t atomic_compare_and_set_int64(atomic_int64_t *a, int64_t old_val, int64_t
     return atomic_compare_exchange_strong(a, &old_val, new_val);
 }
 
+void atomic_fence_acquire(void) { atomic_thread_fence(memory_order_acquire); }
+
+void atomic_fence_release(void) { atomic_thread_fence(memory_order_release); }
+
 #endif
@@ -78,3 +78,7 @@ extern int64_t atomic_get_int64(atomic_int64_t *a);
 extern int64_t atomic_set_int64(atomic_int64_t *a, int64_t new_val);
 extern int64_t atomic_add_int64(atomic_int64_t *a, int64_t other);
 extern int64_t atomic_compare_and_set_int64(atomic_int64_t *a, int64_t old_val, int64_t new_val);
+
+/* ordering for data that is not itself atomic, such as a buffer published under a sequence count. */
+extern void atomic_fence_acquire(void);
+extern void atomic_fence_release(void);
@@ -36,11 +36,13 @@
 #include <libplctag/lib/version.h>
 #include <platform.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <utils/atomic_utils.h>
 #include <utils/debug.h>
 
 
@@ -97,6 +99,9 @@ static uint32_t get_thread_id(void) {
 
 static const char *debug_level_name[DEBUG_END] = {"NONE", "ERROR", "WARN", "INFO", "DETAIL", "SPEW"};
 
+
+static int debug_async_enqueue(const char *func, int line_num, int debug_level, const char *templ, va_list va);
+
 extern void pdebug_impl(const char *func, int line_num, int debug_level, const char *templ, ...) {
     va_list va;
     struct tm t;
@@ -106,6 +111,17 @@ extern void pdebug_impl(const char *func, int line_num, int debug_level, const c
     char prefix[1000]; /* MAGIC */
     char output[1000];
 
+    /* in async mode, hand off the raw arguments and let the writer thread do the formatting. */
+    if(debug_get_async()) {
+        int rc = PLCTAG_STATUS_OK;
+
+        va_start(va, templ);
+        rc = debug_async_enqueue(func, line_num, debug_level, templ, va);
+        va_end(va);
+
+        if(rc == PLCTAG_STATUS_OK) { return; }
+    }
+
     /* get the time parts */
     epoch_ms = time_ms();
     epoch = (time_t)(epoch_ms / 1000);
@@ -166,8 +182,8 @@ void pdebug_dump_bytes_impl(const char *func, int line_num, int debug_level, uin
         /* terminate the row string*/
         row_buf[sizeof(row_buf) - 1] = 0; /* just in case */
 
-        /* output it, finally */
-        pdebug_impl(func, line_num, debug_level, row_buf);
+        /* output it, finally.  The row is data, not a template, so async logging can copy it. */
+        pdebug_impl(func, line_num, debug_level, "%s", row_buf);
     }
 }
 
@@ -201,3 +217,826 @@ int debug_unregister_logger(void) {
 
     return rc;
 }
+
+
+
+/***********************************************************************
+ ********************** Asynchronous Logging ***************************
+ **********************************************************************/
+
+/*
+ * In async mode, pdebug_impl() does not format anything.  It copies the
+ * template pointer, the function name pointer and the raw argument values
+ * into a ring buffer owned by the calling thread.  A background writer
+ * thread drains all the rings, formats the messages and outputs them.
+ *
+ * Templates and function names must be string constants, which they are
+ * for all the pdebug() calls.  String arguments are copied because they
+ * are often on the caller's stack.
+ *
+ * Each ring has one producer, its thread, and one consumer, the writer,
+ * so the head and tail indexes only need atomic loads and stores.  When a
+ * ring is full the message is dropped and counted rather than blocking the
+ * caller.  When a thread exits, its ring is handed to the next new thread
+ * that logs.  Rings are never freed because the writer may still be
+ * reading them.  Once all the ring slots are in use, new threads log
+ * synchronously.
+ *
+ * Records are time stamped with the monotonic clock so that the writer can
+ * merge the rings in order even if the wall clock is changed.  The writer
+ * converts the time stamp back to wall clock time for output.
+ */
+
+#define DEBUG_RING_SIZE (64 * 1024) /* must be a power of two. */
+#define DEBUG_MAX_RINGS (64)
+#define DEBUG_MAX_RECORD_SIZE (1024)
+#define DEBUG_MAX_STR_ARG (256)
+#define DEBUG_WRITER_IDLE_MS (5)
+#define DEBUG_ALIGN(n) (((n) + 7) & ~(uint32_t)7)
+
+struct debug_record_t {
+    uint32_t size; /* whole record, aligned to 8 bytes.  A NULL templ marks padding at the end of the ring. */
+    uint32_t thread_num;
+    int32_t tag_id;
+    int32_t line_num;
+    int64_t mono_ms;
+    const char *func;
+    const char *templ;
+    int debug_level;
+    uint32_t arg_size;
+    /* encoded arguments follow. */
+};
+
+struct debug_ring_t {
+    atomic_int32_t head; /* next byte written by the producer. */
+    atomic_int32_t tail; /* next byte read by the writer. */
+    atomic_int32_t dropped;
+    atomic_bool in_use; /* set while a thread owns the ring. */
+    uint8_t *data;
+};
+
+typedef enum {
+    FMT_LEN_NONE,
+    FMT_LEN_HH,
+    FMT_LEN_H,
+    FMT_LEN_L,
+    FMT_LEN_LL,
+    FMT_LEN_J,
+    FMT_LEN_Z,
+    FMT_LEN_T,
+    FMT_LEN_BIG_L,
+    FMT_LEN_I32,
+    FMT_LEN_I64
+} fmt_len_t;
+
+struct fmt_spec_t {
+    char flags[8];
+    int width;
+    int width_star;
+    int precision; /* -1 if none. */
+    int precision_star;
+    fmt_len_t length;
+    char conversion;
+};
+
+
+static struct debug_ring_t *debug_rings[DEBUG_MAX_RINGS] = {0};
+static atomic_int32_t debug_ring_count = 0;
+static lock_t debug_ring_lock = LOCK_INIT;
+static THREAD_LOCAL struct debug_ring_t *this_thread_ring = NULL;
+static THREAD_LOCAL int this_thread_has_no_ring = 0;
+
+static atomic_bool debug_async_enabled = false;
+static atomic_bool debug_writer_terminate = false;
+static lock_t debug_writer_lock = LOCK_INIT;
+static thread_p debug_writer_thread = NULL;
+
+static struct debug_ring_t *get_thread_ring(void);
+static void release_thread_ring(void *arg);
+static int encode_args(uint8_t *buf, uint32_t capacity, const char *templ, va_list va);
+static const char *parse_fmt_spec(const char *templ, struct fmt_spec_t *spec);
+static int drain_rings(void);
+static void output_record(struct debug_record_t *record, int64_t wall_offset_ms);
+static void format_args(char *output, size_t capacity, const char *templ, const uint8_t *args, uint32_t arg_size);
+static THREAD_FUNC(debug_writer_func);
+
+
+int debug_get_async(void) { return atomic_get_bool(&debug_async_enabled) ? 1 : 0; }
+
+
+int debug_set_async(int enable) {
+    int rc = PLCTAG_STATUS_OK;
+
+    /*
+     * Hold the lock the whole time so that two callers cannot both start a
+     * writer, and a new writer cannot start while the old one is still
+     * draining.  The writer never takes this lock.
+     */
+    spin_block(&debug_writer_lock) {
+        if(enable) {
+            if(!debug_writer_thread) {
+                atomic_set_bool(&debug_writer_terminate, false);
+
+                if(thread_create(&debug_writer_thread, debug_writer_func, 32 * 1024, NULL) != PLCTAG_STATUS_OK) {
+                    pdebug(DEBUG_WARN, "Unable to create the debug writer thread!");
+                    debug_writer_thread = NULL;
+                    rc = PLCTAG_ERR_CREATE;
+                    break;
+                }
+            }
+
+            atomic_set_bool(&debug_async_enabled, true);
+        } else {
+            atomic_set_bool(&debug_async_enabled, false);
+
+            /* the writer drains everything before it exits. */
+            if(debug_writer_thread) {
+                atomic_set_bool(&debug_writer_terminate, true);
+                thread_join(debug_writer_thread);
+                thread_destroy(&debug_writer_thread);
+            }
+        }
+    }
+
+    return rc;
+}
+
+
+int debug_async_enqueue(const char *func, int line_num, int debug_level, const char *templ, va_list va) {
+    struct debug_ring_t *ring = get_thread_ring();
+    uint8_t record_buf[DEBUG_MAX_RECORD_SIZE];
+    struct debug_record_t *record = (struct debug_record_t *)(void *)record_buf;
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    uint32_t offset = 0;
+    uint32_t to_end = 0;
+    int arg_size = 0;
+
+    if(!ring) { return PLCTAG_ERR_NO_RESOURCES; }
+
+    arg_size = encode_args(record_buf + sizeof(*record), (uint32_t)(sizeof(record_buf) - sizeof(*record)), templ, va);
+    if(arg_size < 0) { return PLCTAG_ERR_UNSUPPORTED; }
+
+    record->size = DEBUG_ALIGN((uint32_t)sizeof(*record) + (uint32_t)arg_size);
+    record->thread_num = get_thread_id();
+    record->tag_id = tag_id;
+    record->line_num = line_num;
+    record->mono_ms = time_monotonic_ms();
+    record->func = func;
+    record->templ = templ;
+    record->debug_level = debug_level;
+    record->arg_size = (uint32_t)arg_size;
+
+    head = (uint32_t)atomic_get_int32(&ring->head);
+    tail = (uint32_t)atomic_get_int32(&ring->tail);
+    offset = head & (DEBUG_RING_SIZE - 1);
+    to_end = DEBUG_RING_SIZE - offset;
+
+    /* records are contiguous, so pad out the end of the ring if this one does not fit there. */
+    if(to_end < record->size) {
+        struct debug_record_t *pad = (struct debug_record_t *)(void *)&ring->data[offset];
+
+
+        if(DEBUG_RING_SIZE - (head - tail) < to_end + record->size) {
+            atomic_add_int32(&ring->dropped, 1);
+            return PLCTAG_STATUS_OK;
+        }
+
+        /* if there is not even room for a header, the writer skips the remainder on its own. */
+        if(to_end >= sizeof(*pad)) {
+            pad->size = to_end;
+            pad->templ = NULL;
+        }
+
+        head += to_end;
+        offset = 0;
+    } else if(DEBUG_RING_SIZE - (head - tail) < record->size) {
+        atomic_add_int32(&ring->dropped, 1);
+        return PLCTAG_STATUS_OK;
+    }
+
+    memcpy(&ring->data[offset], record_buf, sizeof(*record) + (size_t)(unsigned int)arg_size);
+
+    /* publish the record. */
+    atomic_set_int32(&ring->head, (int32_t)(head + record->size));
+
+    return PLCTAG_STATUS_OK;
+}
+
+
+void debug_async_flush(void) {
+    if(atomic_get_bool(&debug_async_enabled)) { debug_set_async(0); }
+}
+
+
+struct debug_ring_t *get_thread_ring(void) {
+    struct debug_ring_t *ring = NULL;
+    int slot = -1;
+
+    if(this_thread_ring) { return this_thread_ring; }
+    if(this_thread_has_no_ring) { return NULL; }
+
+    /* take over the ring of a thread that exited if there is one. */
+    spin_block(&debug_ring_lock) {
+        int num_rings = atomic_get_int32(&debug_ring_count);
+
+        for(int i = 0; i < num_rings; i++) {
+            if(!atomic_get_bool(&debug_rings[i]->in_use)) {
+                ring = debug_rings[i];
+                atomic_set_bool(&ring->in_use, true);
+                break;
+            }
+        }
+
+        if(!ring && num_rings < DEBUG_MAX_RINGS) { slot = num_rings; }
+    }
+
+    if(!ring) {
+        if(slot < 0) {
+            this_thread_has_no_ring = 1;
+            return NULL;
+        }
+
+        /* do not use mem_alloc() here, it can log. */
+        ring = (struct debug_ring_t *)calloc(1, sizeof(*ring));
+        if(ring) { ring->data = (uint8_t *)calloc(1, DEBUG_RING_SIZE); }
+
+        if(!ring || !ring->data) {
+            if(ring) { free(ring); }
+            this_thread_has_no_ring = 1;
+            return NULL;
+        }
+
+        atomic_init_int32(&ring->head, 0);
+        atomic_init_int32(&ring->tail, 0);
+        atomic_init_int32(&ring->dropped, 0);
+        atomic_init_bool(&ring->in_use, true);
+
+        spin_block(&debug_ring_lock) {
+            slot = atomic_get_int32(&debug_ring_count);
+
+            if(slot < DEBUG_MAX_RINGS) {
+                debug_rings[slot] = ring;
+
+                /* the writer only looks at rings below the count, so set the count last. */
+                atomic_set_int32(&debug_ring_count, slot + 1);
+            } else {
+                slot = -1;
+            }
+        }
+
+        if(slot < 0) {
+            free(ring->data);
+            free(ring);
+            this_thread_has_no_ring = 1;
+            return NULL;
+        }
+    }
+
+    /* without the exit hook the ring just stays with this thread. */
+    thread_at_exit(release_thread_ring, ring);
+
+    this_thread_ring = ring;
+
+    return ring;
+}
+
+
+/* called when a thread that owns a ring exits.  The writer outputs what is left in the ring. */
+void release_thread_ring(void *arg) {
+    struct debug_ring_t *ring = (struct debug_ring_t *)arg;
+
+    /* anything logged from here on in this thread is synchronous. */
+    this_thread_ring = NULL;
+    this_thread_has_no_ring = 1;
+
+    atomic_set_bool(&ring->in_use, false);
+}
+
+
+THREAD_FUNC(debug_writer_func) {
+    (void)arg;
+
+    while(!atomic_get_bool(&debug_writer_terminate)) {
+        if(!drain_rings()) { sleep_ms(DEBUG_WRITER_IDLE_MS); }
+    }
+
+    /* get anything that came in while we were stopping. */
+    drain_rings();
+
+    THREAD_RETURN(0);
+}
+
+
+/* output all the queued records, oldest first across the rings.  Returns the number output. */
+int drain_rings(void) {
+    int count = 0;
+    int num_rings = atomic_get_int32(&debug_ring_count);
+    int64_t wall_offset_ms = time_ms() - time_monotonic_ms();
+
+    /* report drops first so that they show up near where they happened. */
+    for(int i = 0; i < num_rings; i++) {
+        int dropped = atomic_set_int32(&debug_rings[i]->dropped, 0);
+
+        if(dropped > 0) {
+            char output[100];
+
+            // NOLINTNEXTLINE
+            snprintf(output, sizeof(output), "Async debug log ring %d was full, %d messages dropped.\n", i, dropped);
+
+            if(log_callback_func) {
+                log_callback_func(0, DEBUG_WARN, output);
+            } else {
+                fputs(output, stderr);
+            }
+        }
+    }
+
+    while(1) {
+        struct debug_ring_t *oldest_ring = NULL;
+        struct debug_record_t *oldest = NULL;
+
+        for(int i = 0; i < num_rings; i++) {
+            struct debug_ring_t *ring = debug_rings[i];
+            uint32_t head = (uint32_t)atomic_get_int32(&ring->head);
+            uint32_t tail = (uint32_t)atomic_get_int32(&ring->tail);
+            struct debug_record_t *record = NULL;
+
+            if(head == tail) { continue; }
+
+            record = (struct debug_record_t *)(void *)&ring->data[tail & (DEBUG_RING_SIZE - 1)];
+
+            /* skip padding at the end of the ring. */
+            if(DEBUG_RING_SIZE - (tail & (DEBUG_RING_SIZE - 1)) < sizeof(*record) || !record->templ) {
+                uint32_t to_end = DEBUG_RING_SIZE - (tail & (DEBUG_RING_SIZE - 1));
+
+                tail += (to_end < sizeof(*record) ? to_end : record->size);
+                atomic_set_int32(&ring->tail, (int32_t)tail);
+
+                if(head == tail) { continue; }
+
+                record = (struct debug_record_t *)(void *)&ring->data[tail & (DEBUG_RING_SIZE - 1)];
+            }
+
+            if(!oldest || record->mono_ms < oldest->mono_ms) {
+                oldest = record;
+                oldest_ring = ring;
+            }
+        }
+
+        if(!oldest) { break; }
+
+        output_record(oldest, wall_offset_ms);
+
+        atomic_set_int32(&oldest_ring->tail, (int32_t)((uint32_t)atomic_get_int32(&oldest_ring->tail) + oldest->size));
+
+        count++;
+    }
+
+    if(count > 0 && !log_callback_func) { fflush(stderr); }
+
+    return count;
+}
+
+
+void output_record(struct debug_record_t *record, int64_t wall_offset_ms) {
+    struct tm t;
+    time_t epoch;
+    int64_t epoch_ms = record->mono_ms + wall_offset_ms;
+    int remainder_ms;
+    char message[1000]; /* MAGIC */
+    char output[1200];
+    int level = record->debug_level;
+
+    if(level < 0 || level >= DEBUG_END) { level = DEBUG_NONE; }
+
+    epoch = (time_t)(epoch_ms / 1000);
+    remainder_ms = (int)(epoch_ms % 1000);
+
+    localtime_r(&epoch, &t);
+
+    format_args(message, sizeof(message), record->templ, (const uint8_t *)(record + 1), record->arg_size);
+
+    // NOLINTNEXTLINE
+    snprintf(output, sizeof(output), "%04d-%02d-%02d %02d:%02d:%02d.%03d thread(%u) tag(%" PRId32 ") %s %s:%d %s\n",
+             t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec, remainder_ms, record->thread_num,
+             record->tag_id, debug_level_name[level], record->func, record->line_num, message);
+
+    if(log_callback_func) {
+        log_callback_func(record->tag_id, record->debug_level, output);
+    } else {
+        fputs(output, stderr);
+    }
+}
+
+
+/*
+ * Parse one conversion specification.  templ points just past the '%'.
+ * Returns a pointer past the end of the specification or NULL if it is
+ * not one we can handle.
+ */
+const char *parse_fmt_spec(const char *templ, struct fmt_spec_t *spec) {
+    size_t num_flags = 0;
+
+    memset(spec, 0, sizeof(*spec));
+    spec->precision = -1;
+
+    while(*templ == '-' || *templ == '+' || *templ == ' ' || *templ == '#' || *templ == '0') {
+        if(num_flags < sizeof(spec->flags) - 1) { spec->flags[num_flags++] = *templ; }
+        templ++;
+    }
+
+    if(*templ == '*') {
+        spec->width_star = 1;
+        templ++;
+    } else {
+        while(*templ >= '0' && *templ <= '9') { spec->width = (spec->width * 10) + (*templ++ - '0'); }
+    }
+
+    if(*templ == '.') {
+        templ++;
+        spec->precision = 0;
+
+        if(*templ == '*') {
+            spec->precision_star = 1;
+            templ++;
+        } else {
+            while(*templ >= '0' && *templ <= '9') { spec->precision = (spec->precision * 10) + (*templ++ - '0'); }
+        }
+    }
+
+    switch(*templ) {
+        case 'h':
+            templ++;
+            if(*templ == 'h') {
+                spec->length = FMT_LEN_HH;
+                templ++;
+            } else {
+                spec->length = FMT_LEN_H;
+            }
+            break;
+
+        case 'l':
+            templ++;
+            if(*templ == 'l') {
+                spec->length = FMT_LEN_LL;
+                templ++;
+            } else {
+                spec->length = FMT_LEN_L;
+            }
+            break;
+
+        case 'j':
+            spec->length = FMT_LEN_J;
+            templ++;
+            break;
+        case 'z':
+            spec->length = FMT_LEN_Z;
+            templ++;
+            break;
+        case 't':
+            spec->length = FMT_LEN_T;
+            templ++;
+            break;
+        case 'L':
+            spec->length = FMT_LEN_BIG_L;
+            templ++;
+            break;
+
+        case 'I':
+            /* Microsoft I32/I64 sizes. */
+            if(templ[1] == '6' && templ[2] == '4') {
+                spec->length = FMT_LEN_I64;
+                templ += 3;
+            } else if(templ[1] == '3' && templ[2] == '2') {
+                spec->length = FMT_LEN_I32;
+                templ += 3;
+            } else {
+                return NULL;
+            }
+            break;
+
+        default: break;
+    }
+
+    switch(*templ) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+        case 'c':
+        case 's':
+        case 'p':
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A': spec->conversion = *templ; return templ + 1;
+
+        default: return NULL;
+    }
+}
+
+
+/*
+ * Copy the arguments out of the va_list into buf.  Every value takes 8
+ * bytes except strings, which are stored as a 4-byte length, the
+ * characters and a terminating zero, padded to 8 bytes.
+ */
+int encode_args(uint8_t *buf, uint32_t capacity, const char *templ, va_list va) {
+    uint32_t offset = 0;
+
+#define ENCODE_VALUE(type, val)                                                 \
+    do {                                                                        \
+        type tmp_val__ = (val);                                                 \
+        if(offset + 8 > capacity) { return -1; }                                \
+        memcpy(&buf[offset], &tmp_val__, sizeof(tmp_val__));                    \
+        offset += 8;                                                            \
+    } while(0)
+
+    while(*templ) {
+        struct fmt_spec_t spec;
+        int precision = -1;
+
+        if(*templ != '%') {
+            templ++;
+            continue;
+        }
+
+        templ++;
+
+        if(*templ == '%') {
+            templ++;
+            continue;
+        }
+
+        templ = parse_fmt_spec(templ, &spec);
+        if(!templ) { return -1; }
+
+        if(spec.width_star) { ENCODE_VALUE(int64_t, (int64_t)va_arg(va, int)); }
+
+        if(spec.precision_star) {
+            precision = va_arg(va, int);
+            ENCODE_VALUE(int64_t, (int64_t)precision);
+        } else {
+            precision = spec.precision;
+        }
+
+        switch(spec.conversion) {
+            case 'd':
+            case 'i':
+                switch(spec.length) {
+                    case FMT_LEN_L: ENCODE_VALUE(int64_t, (int64_t)va_arg(va, long)); break;
+                    case FMT_LEN_LL: ENCODE_VALUE(int64_t, (int64_t)va_arg(va, long long)); break;
+                    case FMT_LEN_J: ENCODE_VALUE(int64_t, (int64_t)va_arg(va, intmax_t)); break;
+                    case FMT_LEN_Z:
+                    case FMT_LEN_T: ENCODE_VALUE(int64_t, (int64_t)va_arg(va, ptrdiff_t)); break;
+                    case FMT_LEN_I64: ENCODE_VALUE(int64_t, va_arg(va, int64_t)); break;
+                    case FMT_LEN_I32: ENCODE_VALUE(int64_t, (int64_t)va_arg(va, int32_t)); break;
+                    default: ENCODE_VALUE(int64_t, (int64_t)va_arg(va, int)); break;
+                }
+                break;
+
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                switch(spec.length) {
+                    case FMT_LEN_L: ENCODE_VALUE(uint64_t, (uint64_t)va_arg(va, unsigned long)); break;
+                    case FMT_LEN_LL: ENCODE_VALUE(uint64_t, (uint64_t)va_arg(va, unsigned long long)); break;
+                    case FMT_LEN_J: ENCODE_VALUE(uint64_t, (uint64_t)va_arg(va, uintmax_t)); break;
+                    case FMT_LEN_Z: ENCODE_VALUE(uint64_t, (uint64_t)va_arg(va, size_t)); break;
+                    case FMT_LEN_T: ENCODE_VALUE(uint64_t, (uint64_t)va_arg(va, ptrdiff_t)); break;
+                    case FMT_LEN_I64: ENCODE_VALUE(uint64_t, va_arg(va, uint64_t)); break;
+                    case FMT_LEN_I32: ENCODE_VALUE(uint64_t, (uint64_t)va_arg(va, uint32_t)); break;
+                    default: ENCODE_VALUE(uint64_t, (uint64_t)va_arg(va, unsigned int)); break;
+                }
+                break;
+
+            case 'c': ENCODE_VALUE(int64_t, (int64_t)va_arg(va, int)); break;
+
+            case 'p': ENCODE_VALUE(const void *, va_arg(va, void *)); break;
+
+            case 's': {
+                const char *str = NULL;
+                uint32_t len = 0;
+
+                /* wide strings are not supported. */
+                if(spec.length != FMT_LEN_NONE) { return -1; }
+
+                str = va_arg(va, const char *);
+                if(!str) { str = "(null)"; }
+
+                /* the string need not be terminated if there is a precision. */
+                while(len < DEBUG_MAX_STR_ARG && (precision < 0 || len < (uint32_t)precision) && str[len]) { len++; }
+
+                if(offset + DEBUG_ALIGN(4 + len + 1) > capacity) { return -1; }
+
+                memcpy(&buf[offset], &len, sizeof(len));
+                memcpy(&buf[offset + 4], str, len);
+                buf[offset + 4 + len] = 0;
+                offset += DEBUG_ALIGN(4 + len + 1);
+                break;
+            }
+
+            default:
+                /* floating point */
+                if(spec.length == FMT_LEN_BIG_L) {
+                    ENCODE_VALUE(double, (double)va_arg(va, long double));
+                } else {
+                    ENCODE_VALUE(double, va_arg(va, double));
+                }
+                break;
+        }
+    }
+
+#undef ENCODE_VALUE
+
+    return (int)offset;
+}
+
+
+/*
+ * Format the message from the template and the encoded arguments.  If the
+ * arguments run out before the template does, the rest of the template is
+ * dropped and the message is marked as truncated.
+ */
+void format_args(char *output, size_t capacity, const char *templ, const uint8_t *args, uint32_t arg_size) {
+    static const char truncated_marker[] = " <truncated>";
+    size_t out_len = 0;
+    uint32_t offset = 0;
+    int truncated = 0;
+
+    output[0] = 0;
+
+    while(*templ && out_len < capacity - 1 && !truncated) {
+        struct fmt_spec_t spec;
+        char spec_str[48];
+        const char *next = NULL;
+        int64_t width = 0;
+        int64_t precision = -1;
+        int rc = 0;
+
+        if(*templ != '%' || templ[1] == '%') {
+            output[out_len++] = *templ;
+            templ += (*templ == '%' ? 2 : 1);
+            output[out_len] = 0;
+            continue;
+        }
+
+        next = parse_fmt_spec(templ + 1, &spec);
+        if(!next) {
+            truncated = 1;
+            break;
+        }
+
+        templ = next;
+        width = spec.width;
+        precision = spec.precision;
+
+        if(spec.width_star) {
+            if(offset + 8 > arg_size) {
+                truncated = 1;
+                break;
+            }
+            memcpy(&width, &args[offset], sizeof(width));
+            offset += 8;
+        }
+
+        if(spec.precision_star) {
+            if(offset + 8 > arg_size) {
+                truncated = 1;
+                break;
+            }
+            memcpy(&precision, &args[offset], sizeof(precision));
+            offset += 8;
+        }
+
+        /* rebuild a specification with a fixed argument size. */
+        if(precision >= 0) {
+            // NOLINTNEXTLINE
+            snprintf(spec_str, sizeof(spec_str), "%%%s%d.%d", spec.flags, (int)width, (int)precision);
+        } else {
+            // NOLINTNEXTLINE
+            snprintf(spec_str, sizeof(spec_str), "%%%s%d", spec.flags, (int)width);
+        }
+
+        switch(spec.conversion) {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X': {
+                char conv[4] = {'l', 'l', spec.conversion, 0};
+                uint64_t val = 0;
+
+                if(offset + 8 > arg_size) {
+                    truncated = 1;
+                    break;
+                }
+                memcpy(&val, &args[offset], sizeof(val));
+                offset += 8;
+
+                strncat(spec_str, conv, sizeof(spec_str) - strlen(spec_str) - 1);
+
+                // NOLINTNEXTLINE
+                if(spec.conversion == 'd' || spec.conversion == 'i') {
+                    rc = snprintf(&output[out_len], capacity - out_len, spec_str, (long long)(int64_t)val);
+                } else {
+                    rc = snprintf(&output[out_len], capacity - out_len, spec_str, (unsigned long long)val);
+                }
+                break;
+            }
+
+            case 'c': {
+                int64_t val = 0;
+
+                if(offset + 8 > arg_size) {
+                    truncated = 1;
+                    break;
+                }
+                memcpy(&val, &args[offset], sizeof(val));
+                offset += 8;
+
+                strncat(spec_str, "c", sizeof(spec_str) - strlen(spec_str) - 1);
+                // NOLINTNEXTLINE
+                rc = snprintf(&output[out_len], capacity - out_len, spec_str, (int)val);
+                break;
+            }
+
+            case 'p': {
+                const void *val = NULL;
+
+                if(offset + 8 > arg_size) {
+                    truncated = 1;
+                    break;
+                }
+                memcpy(&val, &args[offset], sizeof(val));
+                offset += 8;
+
+                strncat(spec_str, "p", sizeof(spec_str) - strlen(spec_str) - 1);
+                // NOLINTNEXTLINE
+                rc = snprintf(&output[out_len], capacity - out_len, spec_str, val);
+                break;
+            }
+
+            case 's': {
+                uint32_t len = 0;
+
+                if(offset + 4 > arg_size) {
+                    truncated = 1;
+                    break;
+                }
+                memcpy(&len, &args[offset], sizeof(len));
+
+                if(offset + DEBUG_ALIGN(4 + len + 1) > arg_size) {
+                    truncated = 1;
+                    break;
+                }
+
+                strncat(spec_str, "s", sizeof(spec_str) - strlen(spec_str) - 1);
+                // NOLINTNEXTLINE
+                rc = snprintf(&output[out_len], capacity - out_len, spec_str, (const char *)&args[offset + 4]);
+                offset += DEBUG_ALIGN(4 + len + 1);
+                break;
+            }
+
+            default: {
+                char conv[2] = {spec.conversion, 0};
+                double val = 0.0;
+
+                if(offset + 8 > arg_size) {
+                    truncated = 1;
+                    break;
+                }
+                memcpy(&val, &args[offset], sizeof(val));
+                offset += 8;
+
+                strncat(spec_str, conv, sizeof(spec_str) - strlen(spec_str) - 1);
+                // NOLINTNEXTLINE
+                rc = snprintf(&output[out_len], capacity - out_len, spec_str, val);
+                break;
+            }
+        }
+
+        if(rc > 0) {
+            out_len += (size_t)rc;
+            if(out_len >= capacity) { out_len = capacity - 1; }
+        }
+    }
+
+    if(truncated) {
+        if(out_len > capacity - sizeof(truncated_marker)) { out_len = capacity - sizeof(truncated_marker); }
+
+        memcpy(&output[out_len], truncated_marker, sizeof(truncated_marker));
+        out_len += sizeof(truncated_marker) - 1;
+    }
+
+    output[out_len] = 0;
+}
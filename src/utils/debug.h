@@ -48,6 +48,15 @@
 #define DEBUG_SPEW      (5)
 #define DEBUG_END       (6)
 
+/*
+ * Calls above this level are removed at compile time.  The arguments
+ * are not evaluated and no runtime level check is done.  Set it with
+ * the DEBUG_COMPILED_LEVEL CMake option.
+ */
+#ifndef DEBUG_COMPILED_LEVEL
+    #define DEBUG_COMPILED_LEVEL DEBUG_SPEW
+#endif
+
 extern int set_debug_level(int debug_level);
 extern int get_debug_level(void);
 extern void debug_set_tag_id(int32_t tag_id);
@@ -61,10 +70,18 @@ extern void pdebug_impl(const char *func, int line_num, int debug_level, const c
 
 
 #define pdebug(dbg,...)                                                \
-   do { if((dbg) != DEBUG_NONE && (dbg) <= get_debug_level()) pdebug_impl(__func__, __LINE__, dbg, __VA_ARGS__); } while(0)
+   do { if((dbg) != DEBUG_NONE && (dbg) <= DEBUG_COMPILED_LEVEL && (dbg) <= get_debug_level()) pdebug_impl(__func__, __LINE__, dbg, __VA_ARGS__); } while(0)
 
 extern void pdebug_dump_bytes_impl(const char *func, int line_num, int debug_level, uint8_t *data,int count);
-#define pdebug_dump_bytes(dbg, d,c)  do { if((dbg) != DEBUG_NONE && (dbg) <= get_debug_level()) pdebug_dump_bytes_impl(__func__, __LINE__,dbg,d,c); } while(0)
+#define pdebug_dump_bytes(dbg, d,c)  do { if((dbg) != DEBUG_NONE && (dbg) <= DEBUG_COMPILED_LEVEL && (dbg) <= get_debug_level()) pdebug_dump_bytes_impl(__func__, __LINE__,dbg,d,c); } while(0)
+
+/*
+ * Async mode defers formatting to a background writer thread.  Messages are
+ * queued in per-thread ring buffers so logging does not block the caller.
+ */
+extern int debug_set_async(int enable);
+extern int debug_get_async(void);
+extern void debug_async_flush(void);
 
 extern int debug_register_logger(void (*log_callback_func)(int32_t tag_id, int debug_level, const char *message));
 extern int debug_unregister_logger(void);
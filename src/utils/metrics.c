@@ -0,0 +1,351 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <libplctag/lib/libplctag.h>
+#include <limits.h>
+#include <platform.h>
+#include <stddef.h>
+#include <utils/atomic_utils.h>
+#include <utils/debug.h>
+#include <utils/metrics.h>
+
+
+struct metrics_t library_metrics;
+
+
+static int latency_to_bucket(int64_t latency_us);
+static int64_t bucket_upper_bound(int bucket);
+static int64_t find_percentile(int64_t *buckets, int64_t total, int64_t per_mille);
+static void update_max(atomic_int64_t *max_val, int64_t new_val);
+static void record_latency(metrics_p metrics, int64_t latency_us);
+
+
+void metrics_init(metrics_p metrics, metrics_p parent) {
+    if(!metrics) { return; }
+
+    metrics->parent = parent;
+
+    atomic_init_int64(&metrics->read_count, 0);
+    atomic_init_int64(&metrics->write_count, 0);
+    atomic_init_int64(&metrics->error_count, 0);
+    atomic_init_int64(&metrics->retry_count, 0);
+    atomic_init_int64(&metrics->reconnect_count, 0);
+    atomic_init_int64(&metrics->packets_sent, 0);
+    atomic_init_int64(&metrics->packets_received, 0);
+    atomic_init_int64(&metrics->bytes_sent, 0);
+    atomic_init_int64(&metrics->bytes_received, 0);
+    atomic_init_int64(&metrics->requests_packed, 0);
+    atomic_init_int64(&metrics->reads_saved, 0);
+    atomic_init_int64(&metrics->queue_depth, 0);
+    atomic_init_int64(&metrics->latency_count, 0);
+    atomic_init_int64(&metrics->latency_sum_us, 0);
+    atomic_init_int64(&metrics->latency_max_us, 0);
+
+    for(int i = 0; i < METRICS_LATENCY_BUCKETS; i++) { atomic_init_int64(&metrics->latency_buckets[i], 0); }
+}
+
+
+void metrics_set_parent(metrics_p metrics, metrics_p parent) {
+    if(!metrics) { return; }
+
+    metrics->parent = parent;
+}
+
+
+void metrics_record_op(metrics_p metrics, int is_write, int status, int64_t latency_us) {
+    if(latency_us < 0) { latency_us = 0; }
+
+    for(; metrics; metrics = metrics->parent) {
+        if(is_write) {
+            atomic_add_int64(&metrics->write_count, 1);
+        } else {
+            atomic_add_int64(&metrics->read_count, 1);
+        }
+
+        if(status != PLCTAG_STATUS_OK) { atomic_add_int64(&metrics->error_count, 1); }
+
+        record_latency(metrics, latency_us);
+    }
+}
+
+
+void metrics_record_latency(metrics_p metrics, int64_t latency_us) {
+    if(latency_us < 0) { latency_us = 0; }
+
+    for(; metrics; metrics = metrics->parent) { record_latency(metrics, latency_us); }
+}
+
+
+void metrics_record_packet_sent(metrics_p metrics, int64_t bytes) {
+    if(!metrics) { return; }
+
+    atomic_add_int64(&metrics->packets_sent, 1);
+    atomic_add_int64(&metrics->bytes_sent, bytes);
+
+    if(metrics->parent) { metrics_record_packet_sent(metrics->parent, bytes); }
+}
+
+
+void metrics_record_requests_packed(metrics_p metrics, int64_t requests) {
+    if(!metrics) { return; }
+
+    atomic_add_int64(&metrics->requests_packed, requests);
+
+    if(metrics->parent) { metrics_record_requests_packed(metrics->parent, requests); }
+}
+
+
+void metrics_record_packet_received(metrics_p metrics, int64_t bytes) {
+    if(!metrics) { return; }
+
+    atomic_add_int64(&metrics->packets_received, 1);
+    atomic_add_int64(&metrics->bytes_received, bytes);
+
+    if(metrics->parent) { metrics_record_packet_received(metrics->parent, bytes); }
+}
+
+
+void metrics_record_error(metrics_p metrics) {
+    if(!metrics) { return; }
+
+    atomic_add_int64(&metrics->error_count, 1);
+
+    if(metrics->parent) { metrics_record_error(metrics->parent); }
+}
+
+
+void metrics_record_retry(metrics_p metrics) {
+    if(!metrics) { return; }
+
+    atomic_add_int64(&metrics->retry_count, 1);
+
+    if(metrics->parent) { metrics_record_retry(metrics->parent); }
+}
+
+
+void metrics_record_reconnect(metrics_p metrics) {
+    if(!metrics) { return; }
+
+    atomic_add_int64(&metrics->reconnect_count, 1);
+
+    if(metrics->parent) { metrics_record_reconnect(metrics->parent); }
+}
+
+
+void metrics_record_reads_saved(metrics_p metrics, int64_t reads) {
+    if(!metrics) { return; }
+
+    atomic_add_int64(&metrics->reads_saved, reads);
+
+    if(metrics->parent) { metrics_record_reads_saved(metrics->parent, reads); }
+}
+
+
+void metrics_set_queue_depth(metrics_p metrics, int64_t depth) {
+    int64_t old_depth = 0;
+
+    if(!metrics) { return; }
+
+    old_depth = atomic_set_int64(&metrics->queue_depth, depth);
+
+    /* the parent holds the sum of all the children. */
+    if(metrics->parent && old_depth != depth) { atomic_add_int64(&metrics->parent->queue_depth, depth - old_depth); }
+}
+
+
+void metrics_snapshot(metrics_p metrics, struct metrics_snapshot_t *snapshot) {
+    int64_t buckets[METRICS_LATENCY_BUCKETS] = {0};
+    int64_t total = 0;
+
+    if(!snapshot) { return; }
+
+    mem_set(snapshot, 0, (int)sizeof(*snapshot));
+
+    if(!metrics) { return; }
+
+    snapshot->read_count = atomic_get_int64(&metrics->read_count);
+    snapshot->write_count = atomic_get_int64(&metrics->write_count);
+    snapshot->error_count = atomic_get_int64(&metrics->error_count);
+    snapshot->retry_count = atomic_get_int64(&metrics->retry_count);
+    snapshot->reconnect_count = atomic_get_int64(&metrics->reconnect_count);
+    snapshot->packets_sent = atomic_get_int64(&metrics->packets_sent);
+    snapshot->packets_received = atomic_get_int64(&metrics->packets_received);
+    snapshot->bytes_sent = atomic_get_int64(&metrics->bytes_sent);
+    snapshot->bytes_received = atomic_get_int64(&metrics->bytes_received);
+    snapshot->requests_packed = atomic_get_int64(&metrics->requests_packed);
+    snapshot->queue_depth = atomic_get_int64(&metrics->queue_depth);
+    snapshot->latency_count = atomic_get_int64(&metrics->latency_count);
+    snapshot->latency_max_us = atomic_get_int64(&metrics->latency_max_us);
+    snapshot->reads_saved = atomic_get_int64(&metrics->reads_saved);
+
+    if(snapshot->latency_count > 0) {
+        snapshot->latency_avg_us = atomic_get_int64(&metrics->latency_sum_us) / snapshot->latency_count;
+    }
+
+    /* the buckets can move while we copy them, so total up the copy rather than use the count. */
+    for(int i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+        buckets[i] = atomic_get_int64(&metrics->latency_buckets[i]);
+        total += buckets[i];
+    }
+
+    snapshot->latency_p50_us = find_percentile(buckets, total, 500);
+    snapshot->latency_p99_us = find_percentile(buckets, total, 990);
+    snapshot->latency_p999_us = find_percentile(buckets, total, 999);
+
+    /* a bucket bound can be larger than anything we actually saw. */
+    if(snapshot->latency_p50_us > snapshot->latency_max_us) { snapshot->latency_p50_us = snapshot->latency_max_us; }
+    if(snapshot->latency_p99_us > snapshot->latency_max_us) { snapshot->latency_p99_us = snapshot->latency_max_us; }
+    if(snapshot->latency_p999_us > snapshot->latency_max_us) { snapshot->latency_p999_us = snapshot->latency_max_us; }
+}
+
+
+static const struct {
+    const char *name;
+    size_t offset;
+} metric_fields[] = {
+    {"read_count", offsetof(struct metrics_snapshot_t, read_count)},
+    {"write_count", offsetof(struct metrics_snapshot_t, write_count)},
+    {"error_count", offsetof(struct metrics_snapshot_t, error_count)},
+    {"retry_count", offsetof(struct metrics_snapshot_t, retry_count)},
+    {"reconnect_count", offsetof(struct metrics_snapshot_t, reconnect_count)},
+    {"packets_sent", offsetof(struct metrics_snapshot_t, packets_sent)},
+    {"packets_received", offsetof(struct metrics_snapshot_t, packets_received)},
+    {"bytes_sent", offsetof(struct metrics_snapshot_t, bytes_sent)},
+    {"bytes_received", offsetof(struct metrics_snapshot_t, bytes_received)},
+    {"requests_packed", offsetof(struct metrics_snapshot_t, requests_packed)},
+    {"queue_depth", offsetof(struct metrics_snapshot_t, queue_depth)},
+    {"latency_count", offsetof(struct metrics_snapshot_t, latency_count)},
+    {"latency_avg_us", offsetof(struct metrics_snapshot_t, latency_avg_us)},
+    {"latency_max_us", offsetof(struct metrics_snapshot_t, latency_max_us)},
+    {"latency_p50_us", offsetof(struct metrics_snapshot_t, latency_p50_us)},
+    {"latency_p99_us", offsetof(struct metrics_snapshot_t, latency_p99_us)},
+    {"latency_p999_us", offsetof(struct metrics_snapshot_t, latency_p999_us)},
+    {"reads_saved", offsetof(struct metrics_snapshot_t, reads_saved)},
+};
+
+
+int metrics_get_int_attrib(metrics_p metrics, const char *name, int *value) {
+    struct metrics_snapshot_t snapshot;
+
+    if(!metrics || !name || !value) { return PLCTAG_ERR_NULL_PTR; }
+
+    for(size_t i = 0; i < sizeof(metric_fields) / sizeof(metric_fields[0]); i++) {
+        if(str_cmp_i(name, metric_fields[i].name) == 0) {
+            int64_t val = 0;
+
+            metrics_snapshot(metrics, &snapshot);
+
+            val = *(int64_t *)(void *)((uint8_t *)&snapshot + metric_fields[i].offset);
+
+            /* counters can outgrow an int. */
+            *value = (val > INT_MAX ? INT_MAX : (int)val);
+
+            return PLCTAG_STATUS_OK;
+        }
+    }
+
+    return PLCTAG_ERR_UNSUPPORTED;
+}
+
+
+/***** helpers *****/
+
+int latency_to_bucket(int64_t latency_us) {
+    int exponent = 0;
+    int64_t sub_bucket = 0;
+
+    if(latency_us < METRICS_SUB_BUCKETS) { return (int)latency_us; }
+
+    /* find the highest set bit. */
+    for(int64_t tmp = latency_us; tmp > 1; tmp >>= 1) { exponent++; }
+
+    if(exponent > METRICS_MAX_EXPONENT) { return METRICS_LATENCY_BUCKETS - 1; }
+
+    sub_bucket = (latency_us >> (exponent - METRICS_SUB_BUCKET_BITS)) & (METRICS_SUB_BUCKETS - 1);
+
+    return METRICS_SUB_BUCKETS + ((exponent - METRICS_SUB_BUCKET_BITS) * METRICS_SUB_BUCKETS) + (int)sub_bucket;
+}
+
+
+int64_t bucket_upper_bound(int bucket) {
+    int exponent = 0;
+    int sub_bucket = 0;
+    int64_t lower = 0;
+
+    if(bucket < METRICS_SUB_BUCKETS) { return (int64_t)bucket; }
+
+    exponent = ((bucket - METRICS_SUB_BUCKETS) / METRICS_SUB_BUCKETS) + METRICS_SUB_BUCKET_BITS;
+    sub_bucket = (bucket - METRICS_SUB_BUCKETS) % METRICS_SUB_BUCKETS;
+    lower = (int64_t)(METRICS_SUB_BUCKETS + sub_bucket) << (exponent - METRICS_SUB_BUCKET_BITS);
+
+    return lower + ((int64_t)1 << (exponent - METRICS_SUB_BUCKET_BITS)) - 1;
+}
+
+
+int64_t find_percentile(int64_t *buckets, int64_t total, int64_t per_mille) {
+    int64_t target = 0;
+    int64_t seen = 0;
+
+    if(total <= 0) { return 0; }
+
+    /* round up so that p999 of a small sample is the largest value. */
+    target = ((total * per_mille) + 999) / 1000;
+
+    for(int i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+        seen += buckets[i];
+
+        if(seen >= target) { return bucket_upper_bound(i); }
+    }
+
+    return bucket_upper_bound(METRICS_LATENCY_BUCKETS - 1);
+}
+
+
+/* update only this block, the callers walk the parents. */
+void record_latency(metrics_p metrics, int64_t latency_us) {
+    atomic_add_int64(&metrics->latency_count, 1);
+    atomic_add_int64(&metrics->latency_sum_us, latency_us);
+    atomic_add_int64(&metrics->latency_buckets[latency_to_bucket(latency_us)], 1);
+    update_max(&metrics->latency_max_us, latency_us);
+}
+
+
+void update_max(atomic_int64_t *max_val, int64_t new_val) {
+    int64_t cur_val = atomic_get_int64(max_val);
+
+    /* the return value of compare and set differs between implementations, so just re-read. */
+    while(new_val > cur_val) {
+        atomic_compare_and_set_int64(max_val, cur_val, new_val);
+        cur_val = atomic_get_int64(max_val);
+    }
+}
@@ -0,0 +1,193 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <utils/atomic_utils.h>
+
+/*
+ * Latency histogram layout.
+ *
+ * Latencies are kept in microseconds, since packed and pipelined operations
+ * often finish in well under a millisecond.  The first METRICS_SUB_BUCKETS
+ * buckets hold the exact values 0..3us.  After that each power of two is split
+ * into METRICS_SUB_BUCKETS linear sub-buckets, so the relative error of a
+ * reported percentile is at most 25%.  Values beyond the last bucket are
+ * clamped into it.
+ */
+#define METRICS_SUB_BUCKET_BITS (2)
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BUCKET_BITS)
+#define METRICS_MAX_EXPONENT (26) /* about 67 seconds */
+#define METRICS_LATENCY_BUCKETS (METRICS_SUB_BUCKETS + ((METRICS_MAX_EXPONENT - METRICS_SUB_BUCKET_BITS + 1) * METRICS_SUB_BUCKETS))
+
+typedef struct metrics_t *metrics_p;
+
+/*
+ * All counters are updated without locks.  If a parent is set, every update
+ * is also applied to the parent.  This is used to roll tag metrics up into
+ * their connection and connection metrics up into the library-wide totals.
+ */
+struct metrics_t {
+    metrics_p parent;
+
+    /* tag operations */
+    atomic_int64_t read_count;
+    atomic_int64_t write_count;
+    atomic_int64_t error_count;
+
+    /* connection events */
+    atomic_int64_t retry_count;
+    atomic_int64_t reconnect_count;
+
+    /* traffic */
+    atomic_int64_t packets_sent;
+    atomic_int64_t packets_received;
+    atomic_int64_t bytes_sent;
+    atomic_int64_t bytes_received;
+    atomic_int64_t requests_packed;
+
+    /* automatic reads not done because the tag data was stable. */
+    atomic_int64_t reads_saved;
+
+    /* gauge, not a counter. */
+    atomic_int64_t queue_depth;
+
+    /* latency */
+    atomic_int64_t latency_count;
+    atomic_int64_t latency_sum_us;
+    atomic_int64_t latency_max_us;
+    atomic_int64_t latency_buckets[METRICS_LATENCY_BUCKETS];
+};
+
+/*
+ * A point-in-time copy of the metrics.  The field order is part of the
+ * public interface: the "metrics" system tag returns these fields in this
+ * order as little-endian 64-bit integers, and plc_tag_get_metrics() returns
+ * them in this order too.  It must match the PLCTAG_METRIC_ indexes in
+ * libplctag.h.  New fields go at the end.
+ */
+struct metrics_snapshot_t {
+    int64_t read_count;
+    int64_t write_count;
+    int64_t error_count;
+    int64_t retry_count;
+    int64_t reconnect_count;
+    int64_t packets_sent;
+    int64_t packets_received;
+    int64_t bytes_sent;
+    int64_t bytes_received;
+    int64_t requests_packed;
+    int64_t queue_depth;
+    int64_t latency_count;
+    int64_t latency_avg_us;
+    int64_t latency_max_us;
+    int64_t latency_p50_us;
+    int64_t latency_p99_us;
+    int64_t latency_p999_us;
+    int64_t reads_saved;
+};
+
+#define METRICS_SNAPSHOT_FIELDS ((int)(sizeof(struct metrics_snapshot_t) / sizeof(int64_t)))
+
+/* library-wide totals. */
+extern struct metrics_t library_metrics;
+
+/**
+ * @brief Initialize a metrics block and optionally link it to a parent.
+ *
+ * @param metrics The metrics block to initialize.
+ * @param parent The metrics block to roll updates into, or NULL.
+ */
+extern void metrics_init(metrics_p metrics, metrics_p parent);
+
+/**
+ * @brief Change the block that updates roll into.
+ *
+ * Tags start out rolling into the library totals and move under their
+ * connection once they have one.
+ */
+extern void metrics_set_parent(metrics_p metrics, metrics_p parent);
+
+/**
+ * @brief Record the completion of a tag operation.
+ *
+ * @param metrics The metrics block.
+ * @param is_write Non-zero for writes, zero for reads.
+ * @param status The final status of the operation.
+ * @param latency_us How long the operation took in microseconds.
+ */
+extern void metrics_record_op(metrics_p metrics, int is_write, int status, int64_t latency_us);
+
+extern void metrics_record_latency(metrics_p metrics, int64_t latency_us);
+extern void metrics_record_packet_sent(metrics_p metrics, int64_t bytes);
+extern void metrics_record_requests_packed(metrics_p metrics, int64_t requests);
+extern void metrics_record_packet_received(metrics_p metrics, int64_t bytes);
+extern void metrics_record_error(metrics_p metrics);
+extern void metrics_record_retry(metrics_p metrics);
+extern void metrics_record_reconnect(metrics_p metrics);
+
+/**
+ * @brief Record automatic reads skipped or given back by adaptive polling.
+ *
+ * @param metrics The metrics block.
+ * @param reads The number of reads saved.  Negative when reads counted as saved are done after all.
+ */
+extern void metrics_record_reads_saved(metrics_p metrics, int64_t reads);
+
+/**
+ * @brief Set the current queue depth.
+ *
+ * The change from the previous value is applied to the parent so that the
+ * parent holds the sum of the queue depths of all its children.
+ */
+extern void metrics_set_queue_depth(metrics_p metrics, int64_t depth);
+
+/**
+ * @brief Take a consistent-enough copy of the metrics.
+ *
+ * Each field is read atomically, but the snapshot as a whole is not taken
+ * under a lock.  Percentiles are the upper bound of the histogram bucket
+ * that contains them, but never more than the largest latency seen.
+ */
+extern void metrics_snapshot(metrics_p metrics, struct metrics_snapshot_t *snapshot);
+
+/**
+ * @brief Look up a metric by name, e.g. "read_count" or "latency_p99_us".
+ *
+ * @param metrics The metrics block.
+ * @param name The name of the metric without any scope prefix.
+ * @param value Where to put the value, clamped to the range of int.
+ * @return PLCTAG_STATUS_OK on success or PLCTAG_ERR_UNSUPPORTED if the name is unknown.
+ */
+extern int metrics_get_int_attrib(metrics_p metrics, const char *name, int *value);
@@ -0,0 +1,224 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <inttypes.h>
+#include <platform.h>
+#include <utils/debug.h>
+#include <utils/poll_planner.h>
+#include <utils/random_utils.h>
+
+
+static int find_family(poll_planner_p planner, int64_t period_ms, int start);
+static int find_family_by_id(poll_planner_p planner, uint32_t family_id);
+static int64_t find_widest_gap(poll_planner_p planner, int64_t period_ms);
+static int64_t phase_of(int64_t time_ms_val, int64_t period_ms);
+static int64_t next_on_grid(int64_t anchor_ms, int64_t period_ms, int64_t after_ms);
+
+
+void poll_planner_init(poll_planner_p planner) {
+    if(!planner) { return; }
+
+    planner->lock = LOCK_INIT;
+    planner->num_families = 0;
+    planner->next_family_id = 1;
+}
+
+
+int64_t poll_planner_first_read(poll_planner_p planner, int64_t period_ms, uint32_t *family_id) {
+    int64_t now = time_ms();
+    int64_t anchor_ms = now;
+    int64_t first_read = now;
+
+    if(family_id) { *family_id = 0; }
+
+    if(!planner || period_ms <= 0) { return now; }
+
+    spin_block(&planner->lock) {
+        int family = find_family(planner, period_ms, 0);
+
+        if(family >= 0) {
+            /* keep the family on the grid of its fastest member. */
+            if(period_ms < planner->families[family].period_ms) { planner->families[family].period_ms = period_ms; }
+
+            anchor_ms = planner->families[family].anchor_ms;
+
+            /* line up the other families this period fits with. */
+            for(int other = find_family(planner, period_ms, family + 1); other >= 0;
+                other = find_family(planner, period_ms, other + 1)) {
+                pdebug(DEBUG_DETAIL, "Moving the %" PRId64 "ms family onto the phase of the %" PRId64 "ms family.",
+                       planner->families[other].period_ms, planner->families[family].period_ms);
+                planner->families[other].anchor_ms = anchor_ms;
+            }
+        } else if(planner->num_families == 0) {
+            /* the first family gets a random phase so that separate connections do not line up. */
+            anchor_ms = now + (int64_t)random_u64((uint64_t)period_ms);
+        } else {
+            anchor_ms = now + ((find_widest_gap(planner, period_ms) - phase_of(now, period_ms) + period_ms) % period_ms);
+        }
+
+        if(family < 0) {
+            if(planner->num_families < POLL_PLANNER_MAX_FAMILIES) {
+                family = planner->num_families;
+                planner->families[family].id = planner->next_family_id++;
+                planner->families[family].members = 0;
+                planner->families[family].period_ms = period_ms;
+                planner->families[family].anchor_ms = anchor_ms;
+                planner->num_families++;
+            } else {
+                pdebug(DEBUG_DETAIL, "Poll planner is full, sharing the phase of the first family.");
+                family = 0;
+                anchor_ms = planner->families[0].anchor_ms;
+            }
+        }
+
+        planner->families[family].members++;
+
+        if(family_id) { *family_id = planner->families[family].id; }
+    }
+
+    first_read = next_on_grid(anchor_ms, period_ms, now);
+
+    pdebug(DEBUG_DETAIL, "First read for period %" PRId64 "ms in %" PRId64 "ms.", period_ms, first_read - now);
+
+    return first_read;
+}
+
+
+int64_t poll_planner_align(poll_planner_p planner, uint32_t family_id, int64_t next_read_ms) {
+    int64_t aligned_ms = next_read_ms;
+
+    if(!planner || !family_id) { return next_read_ms; }
+
+    spin_block(&planner->lock) {
+        int family = find_family_by_id(planner, family_id);
+
+        if(family >= 0) {
+            aligned_ms = next_on_grid(planner->families[family].anchor_ms, planner->families[family].period_ms, next_read_ms);
+        }
+    }
+
+    return aligned_ms;
+}
+
+
+void poll_planner_leave(poll_planner_p planner, uint32_t family_id) {
+    if(!planner || !family_id) { return; }
+
+    spin_block(&planner->lock) {
+        int family = find_family_by_id(planner, family_id);
+
+        if(family < 0) { break; }
+
+        planner->families[family].members--;
+
+        if(planner->families[family].members <= 0) {
+            pdebug(DEBUG_DETAIL, "Removing the empty %" PRId64 "ms family.", planner->families[family].period_ms);
+
+            for(int i = family + 1; i < planner->num_families; i++) { planner->families[i - 1] = planner->families[i]; }
+
+            planner->num_families--;
+        }
+    }
+}
+
+
+/*
+ * Periods are compatible when one divides the other.  Then every read of the
+ * slower tag lands on a read of the faster one.
+ */
+int find_family(poll_planner_p planner, int64_t period_ms, int start) {
+    for(int i = start; i < planner->num_families; i++) {
+        int64_t family_period_ms = planner->families[i].period_ms;
+
+        if((period_ms % family_period_ms) == 0 || (family_period_ms % period_ms) == 0) { return i; }
+    }
+
+    return -1;
+}
+
+
+int find_family_by_id(poll_planner_p planner, uint32_t family_id) {
+    for(int i = 0; i < planner->num_families; i++) {
+        if(planner->families[i].id == family_id) { return i; }
+    }
+
+    return -1;
+}
+
+
+/*
+ * Return the phase, within the new period, in the middle of the largest gap
+ * between the phases of the existing families.
+ */
+int64_t find_widest_gap(poll_planner_p planner, int64_t period_ms) {
+    int64_t phases[POLL_PLANNER_MAX_FAMILIES];
+    int num_phases = planner->num_families;
+    int64_t best_gap = 0;
+    int64_t best_phase = 0;
+
+    for(int i = 0; i < num_phases; i++) {
+        int64_t phase = phase_of(planner->families[i].anchor_ms, period_ms);
+        int j = i;
+
+        /* insertion sort, there are only a few. */
+        while(j > 0 && phases[j - 1] > phase) {
+            phases[j] = phases[j - 1];
+            j--;
+        }
+
+        phases[j] = phase;
+    }
+
+    for(int i = 0; i < num_phases; i++) {
+        int64_t next_phase = (i + 1 < num_phases ? phases[i + 1] : phases[0] + period_ms);
+        int64_t gap = next_phase - phases[i];
+
+        if(gap > best_gap) {
+            best_gap = gap;
+            best_phase = (phases[i] + (gap / 2)) % period_ms;
+        }
+    }
+
+    return best_phase;
+}
+
+
+int64_t phase_of(int64_t time_ms_val, int64_t period_ms) { return ((time_ms_val % period_ms) + period_ms) % period_ms; }
+
+
+/* first point on the grid that is not before the given time. */
+int64_t next_on_grid(int64_t anchor_ms, int64_t period_ms, int64_t after_ms) {
+    if(anchor_ms >= after_ms) { return anchor_ms; }
+
+    return anchor_ms + (((after_ms - anchor_ms) + (period_ms - 1)) / period_ms) * period_ms;
+}
@@ -0,0 +1,103 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <platform.h>
+
+/*
+ * Poll phase planning for automatic reads.
+ *
+ * Tags on the same connection whose auto_sync_read_ms periods divide one
+ * another form a family.  All tags in a family are given the same phase, so
+ * their reads come due in the same tickler pass and can be packed into the
+ * same request.  Each new family is placed in the middle of the largest gap
+ * between the phases already in use so that the families do not all hit the
+ * connection at once.
+ *
+ * A tag that fits more than one family pulls the other families onto the
+ * phase of the first one.  Their members move over the next time they
+ * schedule a read.  Families are removed when their last tag leaves.  When
+ * the table is full, new periods share the first family.
+ */
+#define POLL_PLANNER_MAX_FAMILIES (16)
+
+struct poll_planner_t {
+    lock_t lock;
+    int num_families;
+    uint32_t next_family_id;
+    struct {
+        uint32_t id;
+        int members;
+        int64_t period_ms;
+        int64_t anchor_ms;
+    } families[POLL_PLANNER_MAX_FAMILIES];
+};
+
+typedef struct poll_planner_t *poll_planner_p;
+
+/**
+ * @brief Initialize an empty planner.
+ *
+ * @param planner The planner to initialize.
+ */
+extern void poll_planner_init(poll_planner_p planner);
+
+/**
+ * @brief Join a family and find the time of the first automatic read for a new tag.
+ *
+ * @param planner The planner for the connection the tag uses.
+ * @param period_ms The tag's automatic read period.
+ * @param family_id Where to put the family the tag joined.  Pass it to poll_planner_leave() when the tag goes away.
+ * @return The time in milliseconds of the first read, never in the past.
+ */
+extern int64_t poll_planner_first_read(poll_planner_p planner, int64_t period_ms, uint32_t *family_id);
+
+/**
+ * @brief Move a scheduled read onto the phase of the tag's family.
+ *
+ * @param planner The planner for the connection the tag uses.
+ * @param family_id The family the tag joined.
+ * @param next_read_ms The time the tag would read next.
+ * @return The first read time of the family at or after next_read_ms.
+ */
+extern int64_t poll_planner_align(poll_planner_p planner, uint32_t family_id, int64_t next_read_ms);
+
+/**
+ * @brief Leave a family, removing it if this was its last tag.
+ *
+ * @param planner The planner for the connection the tag uses.
+ * @param family_id The family the tag joined.
+ */
+extern void poll_planner_leave(poll_planner_p planner, uint32_t family_id);
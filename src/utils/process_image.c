@@ -0,0 +1,447 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <inttypes.h>
+#include <libplctag/lib/libplctag.h>
+#include <platform.h>
+#include <utils/debug.h>
+#include <utils/process_image.h>
+#include <utils/rc.h>
+#include <utils/vector.h>
+
+
+#define PROCESS_IMAGE_ALIGN (8)
+#define PROCESS_IMAGE_ROUND_UP(n) (((n) + (PROCESS_IMAGE_ALIGN - 1)) & ~(PROCESS_IMAGE_ALIGN - 1))
+
+/*
+ * Shared counters use explicit C11 atomics with the ordering the seqlock
+ * needs.  Without them, process_image_supported() refuses every image and
+ * these are never reached.
+ */
+#if PROCESS_IMAGE_SUPPORTED
+#    define IMAGE_LOAD(a) atomic_load_explicit((a), memory_order_acquire)
+#    define IMAGE_STORE(a, v) atomic_store_explicit((a), (v), memory_order_release)
+#    define IMAGE_ADD(a, v) atomic_fetch_add_explicit((a), (v), memory_order_acq_rel)
+#    define IMAGE_FENCE_RELEASE() atomic_thread_fence(memory_order_release)
+#else
+#    define IMAGE_LOAD(a) (*(a))
+#    define IMAGE_STORE(a, v) (*(a) = (v))
+#    define IMAGE_ADD(a, v) (*(a) += (v))
+#    define IMAGE_FENCE_RELEASE() do { } while(0)
+#endif
+
+#define PROCESS_IMAGE_MIN_IMAGES (2)
+#define PROCESS_IMAGE_INC_IMAGES (2)
+
+typedef struct process_image_t *process_image_p;
+
+struct process_image_t {
+    char *name;
+    shared_mem_p shm;
+    uint8_t *base;
+    int size;
+    struct process_image_header_t *header;
+    struct process_image_entry_t *entries;
+
+    /* next free byte in the data area, guarded by image_mutex. */
+    int data_used;
+};
+
+struct process_image_slot_t {
+    process_image_p image;
+    char *tag_name;
+
+    /* -1 until the first publish claims an entry, -2 if there was no room. */
+    int entry_index;
+};
+
+
+static mutex_p image_mutex = NULL;
+static vector_p images = NULL;
+
+
+static process_image_p find_image_unsafe(const char *name);
+static process_image_p create_image_unsafe(const char *name, int size, int max_entries);
+static void image_destroy(void *image_arg);
+static int claim_entry_unsafe(process_image_p image, const char *tag_name, int32_t tag_id, int size);
+static void slot_destroy(void *slot_arg);
+static void begin_entry_update(struct process_image_entry_t *entry);
+static void end_entry_update(struct process_image_entry_t *entry);
+
+
+int process_image_init(void) {
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    rc = mutex_create(&image_mutex);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to create process image mutex!");
+        return rc;
+    }
+
+    images = vector_create(PROCESS_IMAGE_MIN_IMAGES, PROCESS_IMAGE_INC_IMAGES);
+    if(!images) {
+        pdebug(DEBUG_ERROR, "Unable to create process image list!");
+        return PLCTAG_ERR_NO_MEM;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return rc;
+}
+
+
+void process_image_teardown(void) {
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(images) {
+        if(vector_length(images) > 0) { pdebug(DEBUG_WARN, "%d process images are still open!", vector_length(images)); }
+
+        vector_destroy(images);
+        images = NULL;
+    }
+
+    if(image_mutex) {
+        mutex_destroy(&image_mutex);
+        image_mutex = NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+int process_image_supported(void) {
+#if PROCESS_IMAGE_SUPPORTED
+    process_image_atomic_t probe;
+
+    atomic_init(&probe, 0);
+
+    /* other processes cannot share a lock inside this library. */
+    if(!atomic_is_lock_free(&probe)) {
+        pdebug(DEBUG_WARN, "32-bit atomics are not lock free on this platform!");
+        return PLCTAG_ERR_UNSUPPORTED;
+    }
+
+    return PLCTAG_STATUS_OK;
+#else
+    pdebug(DEBUG_WARN, "Process images are not supported on this platform!");
+    return PLCTAG_ERR_UNSUPPORTED;
+#endif
+}
+
+
+process_image_slot_p process_image_slot_create(const char *image_name, int image_size, int max_entries,
+                                               const char *tag_name) {
+    process_image_slot_p slot = NULL;
+    process_image_p image = NULL;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(process_image_supported() != PLCTAG_STATUS_OK) { return NULL; }
+
+    if(!image_mutex || !images) {
+        pdebug(DEBUG_WARN, "Process images are not set up!");
+        return NULL;
+    }
+
+    if(!image_name || str_length(image_name) < 1 || !tag_name) {
+        pdebug(DEBUG_WARN, "Process image and tag names must not be empty!");
+        return NULL;
+    }
+
+    if(max_entries < 1 || image_size < (int)sizeof(struct process_image_header_t)
+                                            + (max_entries * (int)sizeof(struct process_image_entry_t))
+                                            + PROCESS_IMAGE_ALIGN) {
+        pdebug(DEBUG_WARN, "Process image size %d is too small for %d entries!", image_size, max_entries);
+        return NULL;
+    }
+
+    critical_block(image_mutex) {
+        image = find_image_unsafe(image_name);
+
+        if(!image) { image = create_image_unsafe(image_name, image_size, max_entries); }
+    }
+
+    if(!image) {
+        pdebug(DEBUG_WARN, "Unable to open process image %s!", image_name);
+        return NULL;
+    }
+
+    slot = (process_image_slot_p)rc_alloc((int)sizeof(struct process_image_slot_t), slot_destroy);
+    if(!slot) {
+        pdebug(DEBUG_ERROR, "Unable to allocate process image slot!");
+        rc_dec(image);
+        return NULL;
+    }
+
+    slot->image = image;
+    slot->entry_index = -1;
+    slot->tag_name = str_dup(tag_name);
+
+    if(!slot->tag_name) {
+        pdebug(DEBUG_ERROR, "Unable to copy tag name!");
+        rc_dec(slot);
+        return NULL;
+    }
+
+    pdebug(DEBUG_INFO, "Done.");
+
+    return slot;
+}
+
+
+void process_image_publish(process_image_slot_p slot, int32_t tag_id, uint8_t *data, int size, int status) {
+    process_image_p image = NULL;
+    struct process_image_entry_t *entry = NULL;
+
+    if(!slot || slot->entry_index == -2) { return; }
+
+    image = slot->image;
+
+    /* nothing to show consumers until there is data. */
+    if(slot->entry_index < 0) {
+        if(status != PLCTAG_STATUS_OK || !data || size <= 0) { return; }
+
+        critical_block(image_mutex) { slot->entry_index = claim_entry_unsafe(image, slot->tag_name, tag_id, size); }
+
+        if(slot->entry_index < 0) {
+            pdebug(DEBUG_WARN, "No room for tag %s in process image %s!", slot->tag_name, image->name);
+            slot->entry_index = -2;
+            return;
+        }
+    }
+
+    entry = &image->entries[slot->entry_index];
+
+    begin_entry_update(entry);
+
+    entry->status = status;
+    entry->timestamp_ms = time_ms();
+
+    if(status == PLCTAG_STATUS_OK && data) {
+        if(size >= 0 && (uint32_t)size <= entry->data_capacity) {
+            mem_copy(image->base + entry->data_offset, data, size);
+            entry->data_size = (uint32_t)size;
+        } else {
+            entry->status = PLCTAG_ERR_TOO_LARGE;
+        }
+    }
+
+    end_entry_update(entry);
+}
+
+
+process_image_p find_image_unsafe(const char *name) {
+    for(int i = 0; i < vector_length(images); i++) {
+        process_image_p image = (process_image_p)vector_get(images, i);
+
+        /* skip images that are being destroyed. */
+        if(image && str_cmp(image->name, name) == 0 && rc_inc(image)) { return image; }
+    }
+
+    return NULL;
+}
+
+
+process_image_p create_image_unsafe(const char *name, int size, int max_entries) {
+    process_image_p image = NULL;
+    int header_size = PROCESS_IMAGE_ROUND_UP((int)sizeof(struct process_image_header_t));
+    int rc = PLCTAG_STATUS_OK;
+
+    pdebug(DEBUG_INFO, "Creating process image %s with %d bytes and %d entries.", name, size, max_entries);
+
+    /* the destructor does nothing until the shared memory exists. */
+    image = (process_image_p)rc_alloc((int)sizeof(struct process_image_t), image_destroy);
+    if(!image) {
+        pdebug(DEBUG_ERROR, "Unable to allocate process image!");
+        return NULL;
+    }
+
+    image->name = str_dup(name);
+    if(!image->name) {
+        pdebug(DEBUG_ERROR, "Unable to copy process image name!");
+        rc_dec(image);
+        return NULL;
+    }
+
+    if(vector_insert(images, vector_length(images), image) != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_ERROR, "Unable to add process image %s to the list!", name);
+        mem_free(image->name);
+        rc_dec(image);
+        return NULL;
+    }
+
+    rc = shared_mem_create(&image->shm, name, size, &image->base);
+    if(rc != PLCTAG_STATUS_OK) {
+        pdebug(DEBUG_WARN, "Unable to create shared memory for process image %s, error %s!", name, plc_tag_decode_error(rc));
+        vector_remove(images, vector_length(images) - 1);
+        mem_free(image->name);
+        rc_dec(image);
+        return NULL;
+    }
+
+    image->size = size;
+    image->header = (struct process_image_header_t *)(void *)image->base;
+    image->entries = (struct process_image_entry_t *)(void *)(image->base + header_size);
+    image->data_used = PROCESS_IMAGE_ROUND_UP(header_size + (max_entries * (int)sizeof(struct process_image_entry_t)));
+
+    image->header->magic = PROCESS_IMAGE_MAGIC;
+    image->header->version = PROCESS_IMAGE_VERSION;
+    image->header->image_size = (uint32_t)size;
+    image->header->header_size = (uint32_t)header_size;
+    image->header->entry_size = (uint32_t)sizeof(struct process_image_entry_t);
+    image->header->max_entries = (uint32_t)max_entries;
+    image->header->data_offset = (uint32_t)image->data_used;
+    image->header->created_ms = time_ms();
+    IMAGE_STORE(&image->header->entry_count, 0);
+
+    /* last, the header is complete. */
+    IMAGE_STORE(&image->header->is_open, 1);
+
+    return image;
+}
+
+
+void image_destroy(void *image_arg) {
+    process_image_p image = (process_image_p)image_arg;
+    int remove_name = 1;
+
+    pdebug(DEBUG_INFO, "Starting.");
+
+    if(!image || !image->shm) { return; }
+
+    if(image_mutex && images) {
+        critical_block(image_mutex) {
+            for(int i = 0; i < vector_length(images); i++) {
+                process_image_p other = (process_image_p)vector_get(images, i);
+
+                if(other == image) {
+                    vector_remove(images, i);
+                    i--;
+                } else if(other && str_cmp(other->name, image->name) == 0) {
+                    /* a new image took over the name while we were being released. */
+                    remove_name = 0;
+                }
+            }
+        }
+    }
+
+    /* tell consumers the publisher is gone. */
+    IMAGE_STORE(&image->header->is_open, 0);
+
+    shared_mem_destroy(&image->shm, remove_name);
+
+    mem_free(image->name);
+    image->name = NULL;
+
+    pdebug(DEBUG_INFO, "Done.");
+}
+
+
+int claim_entry_unsafe(process_image_p image, const char *tag_name, int32_t tag_id, int size) {
+    struct process_image_header_t *header = image->header;
+    int32_t entry_count = IMAGE_LOAD(&header->entry_count);
+    int capacity = PROCESS_IMAGE_ROUND_UP(size);
+    struct process_image_entry_t *entry = NULL;
+
+    /* reuse the entry of a destroyed tag with the same name. */
+    for(int i = 0; i < entry_count; i++) {
+        entry = &image->entries[i];
+
+        if(entry->tag_id == 0 && entry->data_capacity >= (uint32_t)size && str_cmp(entry->name, tag_name) == 0) {
+            begin_entry_update(entry);
+            entry->tag_id = tag_id;
+            end_entry_update(entry);
+            return i;
+        }
+    }
+
+    if(entry_count >= (int32_t)header->max_entries || capacity > image->size - image->data_used) { return -1; }
+
+    entry = &image->entries[entry_count];
+
+    entry->tag_id = tag_id;
+    entry->status = PLCTAG_STATUS_PENDING;
+    entry->data_offset = (uint32_t)image->data_used;
+    entry->data_capacity = (uint32_t)capacity;
+    entry->data_size = 0;
+    str_copy(entry->name, PROCESS_IMAGE_MAX_NAME, tag_name);
+    entry->name[PROCESS_IMAGE_MAX_NAME - 1] = 0;
+
+    image->data_used += capacity;
+
+    /* the entry is filled in, let consumers see it. */
+    IMAGE_ADD(&header->entry_count, 1);
+
+    return (int)entry_count;
+}
+
+
+void slot_destroy(void *slot_arg) {
+    process_image_slot_p slot = (process_image_slot_p)slot_arg;
+
+    if(!slot) { return; }
+
+    if(slot->image && slot->entry_index >= 0) {
+        struct process_image_entry_t *entry = &slot->image->entries[slot->entry_index];
+
+        critical_block(image_mutex) {
+            begin_entry_update(entry);
+
+            entry->tag_id = 0;
+            entry->status = PLCTAG_ERR_NOT_FOUND;
+            entry->timestamp_ms = time_ms();
+
+            end_entry_update(entry);
+        }
+    }
+
+    if(slot->image) { slot->image = rc_dec(slot->image); }
+
+    if(slot->tag_name) {
+        mem_free(slot->tag_name);
+        slot->tag_name = NULL;
+    }
+}
+
+
+/* odd while the entry is being changed.  The fence keeps the field writes after the odd count. */
+void begin_entry_update(struct process_image_entry_t *entry) {
+    IMAGE_ADD(&entry->seq, 1);
+    IMAGE_FENCE_RELEASE();
+}
+
+
+/* the release ordering of the add publishes the field writes with the even count. */
+void end_entry_update(struct process_image_entry_t *entry) { IMAGE_ADD(&entry->seq, 1); }
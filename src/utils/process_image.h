@@ -0,0 +1,162 @@
+/***************************************************************************
+ *   Copyright (C) 2025 by Kyle Hayes                                      *
+ *   Author Kyle Hayes  kyle.hayes@gmail.com                               *
+ *                                                                         *
+ * This software is available under either the Mozilla Public License      *
+ * version 2.0 or the GNU LGPL version 2 (or later) license, whichever     *
+ * you choose.                                                             *
+ *                                                                         *
+ * MPL 2.0:                                                                *
+ *                                                                         *
+ *   This Source Code Form is subject to the terms of the Mozilla Public   *
+ *   License, v. 2.0. If a copy of the MPL was not distributed with this   *
+ *   file, You can obtain one at http://mozilla.org/MPL/2.0/.              *
+ *                                                                         *
+ *                                                                         *
+ * LGPL 2:                                                                 *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License as       *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <platform.h>
+
+/*
+ * Shared memory process image.
+ *
+ * Tags created with process_image=<name> publish their data into a named
+ * shared memory region after every completed read or write.  Other processes
+ * on the same host map the region read-only and read values in place.
+ *
+ * The region starts with a header, followed by max_entries directory entries
+ * and then the data area.  All offsets are from the start of the region.
+ * Consumers wait for is_open to be set, then look at the first entry_count
+ * entries.  An entry never moves once it is counted.
+ *
+ * Each entry has a sequence counter that is odd while the entry is being
+ * updated.  To read an entry, load seq with acquire ordering, skip it if it is
+ * odd, read the data and fields, issue an acquire fence, then load seq again.
+ * If it did not change, the copy is good.
+ * An entry whose tag was destroyed has tag_id zero and may be reused by a new
+ * tag with the same name.
+ *
+ * Only one process may publish into a region.  Opening the region replaces it
+ * with a new one under the same name, and the publisher removes the name when
+ * its last tag is destroyed, so consumers must reopen the region if is_open
+ * drops to zero.  A publisher that crashed leaves is_open set in the old
+ * region, so consumers should also reopen the name now and then and compare
+ * created_ms.
+ *
+ * The counters are shared with other processes, so they must be real lock-free
+ * atomics.  Process images are only built where C11 atomics are available and
+ * not on Windows.  Elsewhere tags that ask for one fail with
+ * PLCTAG_ERR_UNSUPPORTED.
+ */
+
+#if defined(_WIN32) || defined(__STDC_NO_ATOMICS__) || !defined(__STDC_VERSION__) || (__STDC_VERSION__ < 201112L)
+#    define PROCESS_IMAGE_SUPPORTED (0)
+/* only used for the layout. */
+typedef int32_t process_image_atomic_t;
+#else
+#    include <stdatomic.h>
+#    define PROCESS_IMAGE_SUPPORTED (1)
+typedef _Atomic(int32_t) process_image_atomic_t;
+#endif
+
+#define PROCESS_IMAGE_MAGIC (0x49434C50U) /* "PLCI" in little-endian byte order. */
+#define PROCESS_IMAGE_VERSION (1)
+
+#define PROCESS_IMAGE_MAX_NAME (64)
+
+#define PROCESS_IMAGE_DEFAULT_SIZE (1024 * 1024)
+#define PROCESS_IMAGE_DEFAULT_ENTRIES (1024)
+
+struct process_image_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t image_size;
+    uint32_t header_size;
+    uint32_t entry_size;
+    uint32_t max_entries;
+    uint32_t data_offset;
+    process_image_atomic_t entry_count;
+    process_image_atomic_t is_open;
+    int32_t pad;
+    int64_t created_ms;
+};
+
+struct process_image_entry_t {
+    process_image_atomic_t seq;
+    int32_t tag_id;
+    int32_t status;
+    uint32_t data_offset;
+    uint32_t data_capacity;
+    uint32_t data_size;
+    int64_t timestamp_ms;
+    char name[PROCESS_IMAGE_MAX_NAME];
+};
+
+typedef struct process_image_slot_t *process_image_slot_p;
+
+/**
+ * @brief Check whether process images can be used on this platform.
+ *
+ * @return PLCTAG_STATUS_OK if they can, PLCTAG_ERR_UNSUPPORTED if not.
+ */
+extern int process_image_supported(void);
+
+/**
+ * @brief Set up the list of open process images.
+ *
+ * @return PLCTAG_STATUS_OK on success, an error otherwise.
+ */
+extern int process_image_init(void);
+
+/**
+ * @brief Release the list of open process images.
+ */
+extern void process_image_teardown(void);
+
+/**
+ * @brief Get a slot for a tag in the named process image.
+ *
+ * The image is created the first time any tag names it.  The slot does not
+ * get a directory entry until the first successful publish.  Release the slot
+ * with rc_dec().
+ *
+ * @param image_name The shared memory name of the image.
+ * @param image_size The size of the image if it has to be created.
+ * @param max_entries The number of directory entries if the image has to be created.
+ * @param tag_name The name consumers use to find the tag.
+ * @return The new slot or NULL on failure.
+ */
+extern process_image_slot_p process_image_slot_create(const char *image_name, int image_size, int max_entries,
+                                                      const char *tag_name);
+
+/**
+ * @brief Publish the result of a completed operation into the image.
+ *
+ * Must not be called concurrently for the same slot.
+ *
+ * @param slot The tag's slot.
+ * @param tag_id The tag's ID.
+ * @param data The tag data.
+ * @param size The size of the tag data.
+ * @param status The status of the operation.  The data is only copied if this is PLCTAG_STATUS_OK.
+ */
+extern void process_image_publish(process_image_slot_p slot, int32_t tag_id, uint8_t *data, int size, int status);